@@ -24,6 +24,12 @@ static FIOBJ HTTP_HEADER_SERVER;
 static FIOBJ HTTP_VALUE_SERVER;
 static FIOBJ JSON_KEY;
 static FIOBJ JSON_VALUE;
+/* pre-serialized response headers (Server and Content-Type) */
+static http_response_template_s *JSON_TEMPLATE;
+static http_response_template_s *TEXT_TEMPLATE;
+
+/* creates a response template with the Server and Content-Type headers */
+static http_response_template_s *template_new(FIOBJ mime_type);
 
 /* *****************************************************************************
 Routing
@@ -66,6 +72,9 @@ int main(int argc, char const *argv[]) {
   /* JSON values to be serialized */
   JSON_KEY = fiobj_str_new("message", 7);
   JSON_VALUE = fiobj_str_new("Hello, World!", 13);
+  /* the response headers are serialized once and reused */
+  JSON_TEMPLATE = template_new(http_mimetype_find("json", 4));
+  TEXT_TEMPLATE = template_new(http_mimetype_find("txt", 3));
 
   /* Test for static file service */
   const char *public_folder = fio_cli_get("-www");
@@ -92,7 +101,6 @@ Request handlers
 
 /* handles JSON requests */
 static void on_request_json(http_s *h) {
-  http_set_header(h, HTTP_HEADER_CONTENT_TYPE, http_mimetype_find("json", 4));
   FIOBJ json;
   /* create a new Hash to be serialized for every request */
   FIOBJ hash = fiobj_hash_new2(1);
@@ -100,14 +108,23 @@ static void on_request_json(http_s *h) {
   json = fiobj_obj2json(hash, 0);
   fiobj_free(hash);
   fio_str_info_s tmp = fiobj_obj2cstr(json);
-  http_send_body(h, tmp.data, tmp.len);
+  http_send_template(h, JSON_TEMPLATE, tmp.data, tmp.len);
   fiobj_free(json);
 }
 
 /* handles plain text requests (Hello World) */
 static void on_request_plain_text(http_s *h) {
-  http_set_header(h, HTTP_HEADER_CONTENT_TYPE, http_mimetype_find("txt", 3));
-  http_send_body(h, "Hello, World!", 13);
+  http_send_template(h, TEXT_TEMPLATE, "Hello, World!", 13);
+}
+
+/* creates a response template with the Server and Content-Type headers */
+static http_response_template_s *template_new(FIOBJ mime_type) {
+  FIOBJ headers = fiobj_hash_new();
+  fiobj_hash_set(headers, HTTP_HEADER_SERVER, fiobj_dup(HTTP_VALUE_SERVER));
+  fiobj_hash_set(headers, HTTP_HEADER_CONTENT_TYPE, mime_type);
+  http_response_template_s *t = http_response_template_new(headers);
+  fiobj_free(headers);
+  return t;
 }
 
 /* *****************************************************************************
@@ -180,8 +197,6 @@ static void route_add(char *path, void (*handler)(http_s *)) {
 
 /* routes a request to the correct handler */
 static void route_perform(http_s *h) {
-  /* add required Serevr header */
-  http_set_header(h, HTTP_HEADER_SERVER, fiobj_dup(HTTP_VALUE_SERVER));
   /* collect path from hash map */
   fio_str_info_s tmp_i = fiobj_obj2cstr(h->path);
   fio_str_s tmp = FIO_STR_INIT_EXISTING(tmp_i.data, tmp_i.len, 0);
@@ -191,6 +206,8 @@ static void route_perform(http_s *h) {
     handler(h);
     return;
   }
+  /* add required Serevr header (the handlers' templates include it) */
+  http_set_header(h, HTTP_HEADER_SERVER, fiobj_dup(HTTP_VALUE_SERVER));
   http_send_error(h, 404);
 }
 
@@ -208,6 +225,8 @@ static void cleanup(void) {
   fiobj_free(HTTP_VALUE_SERVER);
   fiobj_free(JSON_KEY);
   fiobj_free(JSON_VALUE);
+  http_response_template_free(JSON_TEMPLATE);
+  http_response_template_free(TEXT_TEMPLATE);
 
   route_clear();
 }
@@ -16,7 +16,9 @@ Feel free to copy, use and enjoy according to the license provided.
 
 #include <ctype.h>
 #include <errno.h>
+#include <float.h>
 #include <limits.h>
+#include <math.h>
 #include <pthread.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -41,7 +43,8 @@ Feel free to copy, use and enjoy according to the license provided.
 #define FIO_ENGINE_POLL 0
 #endif
 
-#if !FIO_ENGINE_POLL && !FIO_ENGINE_EPOLL && !FIO_ENGINE_KQUEUE
+#if !FIO_ENGINE_POLL && !FIO_ENGINE_EPOLL && !FIO_ENGINE_KQUEUE &&              \
+    !FIO_ENGINE_URING
 #if defined(__linux__)
 #define FIO_ENGINE_EPOLL 1
 #elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) ||     \
@@ -52,15 +55,48 @@ Feel free to copy, use and enjoy according to the license provided.
 #endif
 #endif
 
+/* MSG_ZEROCOPY support for `fio_write2` (Linux, requires the epoll engine) */
+#ifndef FIO_ZEROCOPY
+#if FIO_ENGINE_EPOLL && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define FIO_ZEROCOPY 1
+#else
+#define FIO_ZEROCOPY 0
+#endif
+#endif
+
+/* CPU affinity for `fio_start` (Linux, `sched_setaffinity`) */
+#ifndef FIO_AFFINITY
+#if defined(__linux__)
+#define FIO_AFFINITY 1
+#else
+#define FIO_AFFINITY 0
+#endif
+#endif
+
+/* the minimal packet length for MSG_ZEROCOPY (smaller packets are copied) */
+#ifndef FIO_ZEROCOPY_MIN
+#define FIO_ZEROCOPY_MIN 16384
+#endif
+
 /* for kqueue and epoll only */
 #ifndef FIO_POLL_MAX_EVENTS
 #define FIO_POLL_MAX_EVENTS 64
 #endif
 
+/* for io_uring only - submission queue size (must be a power of 2) */
+#ifndef FIO_URING_ENTRIES
+#define FIO_URING_ENTRIES 4096
+#endif
+
 #ifndef FIO_POLL_TICK
 #define FIO_POLL_TICK 1000
 #endif
 
+/* sharded reactor (epoll only) - max ms a shard waits while tasks are queued */
+#ifndef FIO_POLL_SHARD_TICK
+#define FIO_POLL_SHARD_TICK 8
+#endif
+
 #ifndef FIO_USE_URGENT_QUEUE
 #define FIO_USE_URGENT_QUEUE 1
 #endif
@@ -99,6 +135,7 @@ static void deferred_on_close(void *uuid_, void *pr_);
 static void deferred_on_shutdown(void *arg, void *arg2);
 static void deferred_on_ready(void *arg, void *arg2);
 static void deferred_on_data(void *uuid, void *arg2);
+static void deferred_on_backpressure(void *arg, void *arg2);
 static void deferred_ping(void *arg, void *arg2);
 
 /* *****************************************************************************
@@ -149,7 +186,18 @@ struct fio_packet_s {
   uintptr_t length;
 };
 
-/** Connection data (fd_data) */
+#if defined(__GNUC__) || defined(__clang__)
+#define FIO_CACHE_LINE_ALIGN __attribute__((aligned(64)))
+#else
+#define FIO_CACHE_LINE_ALIGN
+#endif
+
+/**
+ * Connection data (fd_data) - the fields used by the per-event fast path.
+ *
+ * Kept to a single (aligned) 64 byte cache line, rarely used data lives in
+ * `fio_fd_cold_s`.
+ */
 typedef struct {
   /* current data to be send */
   fio_packet_s *packet;
@@ -157,6 +205,8 @@ typedef struct {
   fio_packet_s **packet_last;
   /* Data sent so far */
   size_t sent;
+  /** The number of pending bytes that are in the queue. */
+  size_t pending;
   /* fd protocol */
   fio_protocol_s *protocol;
   /* timer handler */
@@ -177,17 +227,50 @@ typedef struct {
   uint8_t open;
   /** indicated that the connection should be closed. */
   uint8_t close;
-  /** peer address length */
-  uint8_t addr_len;
-  /** peer address length */
-  uint8_t addr[48];
+#if FIO_ENGINE_URING
+  /** io_uring poll requests in flight (1 == read, 2 == write) */
+  uint8_t polled;
+#endif
+} FIO_CACHE_LINE_ALIGN fio_fd_data_s;
+
+/** Connection data (fd_cold) - rarely accessed, kept away from `fd_data`. */
+typedef struct {
+  /* the `active` value used to order the connection in it's timeout bucket */
+  time_t timeout_queued;
+  /* timeout bucket node (connections with a protocol) */
+  fio_ls_embd_s timeout_node;
   /** RW hooks. */
   fio_rw_hook_s *rw_hooks;
   /** RW udata. */
   void *rw_udata;
+#if FIO_ZEROCOPY
+  /** sent MSG_ZEROCOPY packets, waiting for their completion notification */
+  fio_packet_s *zc_pending;
+  /** the last packet in the `zc_pending` queue. */
+  fio_packet_s **zc_pending_last;
+  /** the next MSG_ZEROCOPY send id (counted by the kernel) */
+  uint32_t zc_next;
+  /** all MSG_ZEROCOPY send ids below this value were completed */
+  uint32_t zc_done;
+  /** SO_ZEROCOPY state (0 == untested, 1 == enabled, 2 == unsupported) */
+  uint8_t zc_state;
+#endif
+  /** outgoing buffer watermarks (see `fio_watermarks_set`) */
+  size_t watermark_high;
+  size_t watermark_low;
+  /** 1 while the pending data is above the watermarks */
+  uint8_t backpressure;
+  /** the last `backpressure` state reported to the protocol */
+  uint8_t backpressure_reported;
+  /** suspends reading while `backpressure` is set */
+  uint8_t backpressure_suspend;
+  /** peer address length */
+  uint8_t addr_len;
+  /** peer address length */
+  uint8_t addr[48];
   /* Objects linked to the UUID */
   fio_uuid_links_s links;
-} fio_fd_data_s;
+} fio_fd_cold_s;
 
 typedef struct {
   struct timespec last_cycle;
@@ -207,16 +290,31 @@ typedef struct {
   uint8_t volatile active;
   /* worker process flag - true also for single process */
   uint8_t is_worker;
+  /* each thread runs it's own reactor shard */
+  uint8_t sharded;
+  /* worker threads use local task rings (work stealing) */
+  uint8_t stealing;
   /* polling and global lock */
   fio_lock_i lock;
   /* The highest active fd with a protocol object */
   uint32_t max_protocol_fd;
+  /* connection data below this fd was initialized (see `fio_fd_commit`) */
+  uint32_t fd_commit;
+  /* connection data initialization lock */
+  fio_lock_i fd_commit_lock;
   /* timer handler */
   pid_t parent;
 #if FIO_ENGINE_POLL
   struct pollfd *poll;
 #endif
-  fio_fd_data_s info[];
+  /* timeout buckets (by timeout value), ordered by `timeout_queued` */
+  fio_ls_embd_s timeouts[256];
+  /* timeout buckets lock */
+  fio_lock_i timeout_lock;
+  /* hot connection data (cache line aligned, follows the struct in memory) */
+  fio_fd_data_s *info;
+  /* cold connection data (follows `info` in memory) */
+  fio_fd_cold_s *cold;
 } fio_data_s;
 
 /** The logging level */
@@ -241,6 +339,8 @@ union protocol_metadata_union_u {
 
 #define fd_data(fd) (fio_data->info[(uintptr_t)(fd)])
 #define uuid_data(uuid) fd_data(fio_uuid2fd((uuid)))
+#define fd_cold(fd) (fio_data->cold[(uintptr_t)(fd)])
+#define uuid_cold(uuid) fd_cold(fio_uuid2fd((uuid)))
 #define fd2uuid(fd)                                                            \
   ((intptr_t)((((uintptr_t)(fd)) << 8) | fd_data((fd)).counter))
 
@@ -259,6 +359,269 @@ size_t fio_capa(void) {
   return 0;
 }
 
+/* *****************************************************************************
+Runtime Metrics (thread local counters and histograms)
+***************************************************************************** */
+
+/* 8 sub-buckets per power of 2 */
+#define FIO_METRICS_SUB_BITS 3
+#define FIO_METRICS_BUCKETS (64 << FIO_METRICS_SUB_BITS)
+
+/* a thread's metric values (written only by the owning thread) */
+typedef struct {
+  fio_ls_embd_s node;
+  uint64_t values[FIO_METRICS_LIMIT]; /* counters, gauges, histogram sums */
+  uint64_t max[FIO_METRICS_HISTOGRAM_LIMIT];
+  uint64_t buckets[FIO_METRICS_HISTOGRAM_LIMIT][FIO_METRICS_BUCKETS];
+} fio_metrics_thread_s;
+
+typedef struct {
+  const char *name;
+  const char *help;
+  int64_t (*read)(void);
+  uint8_t type;
+  uint8_t histogram; /* the histogram's index */
+} fio_metric_info_s;
+
+/* built-in metric identifiers */
+enum {
+  FIO_METRIC_CYCLES,
+  FIO_METRIC_EVENTS,
+  FIO_METRIC_TASKS,
+  FIO_METRIC_QUEUE,
+  FIO_METRIC_CONNECTIONS,
+  FIO_METRIC_BYTES_READ,
+  FIO_METRIC_BYTES_WRITTEN,
+  FIO_METRIC_REJECTED,
+  FIO_METRIC_BUILTIN_COUNT,
+};
+
+static int64_t fio_metric_read_queue(void);
+
+static struct {
+  fio_metric_info_s metrics[FIO_METRICS_LIMIT];
+  size_t count;
+  size_t histograms;
+  fio_ls_embd_s threads;
+  fio_lock_i lock;
+} fio_metrics_data = {
+    .metrics =
+        {
+            [FIO_METRIC_CYCLES] = {.name = "fio_reactor_cycles_total",
+                                   .help = "Reactor cycles."},
+            [FIO_METRIC_EVENTS] = {.name = "fio_reactor_events_total",
+                                   .help = "IO events handled."},
+            [FIO_METRIC_TASKS] = {.name = "fio_tasks_total",
+                                  .help = "Deferred tasks performed."},
+            [FIO_METRIC_QUEUE] = {.name = "fio_task_queue_depth",
+                                  .help = "Deferred tasks waiting.",
+                                  .type = FIO_METRIC_GAUGE,
+                                  .read = fio_metric_read_queue},
+            [FIO_METRIC_CONNECTIONS] = {.name = "fio_connections",
+                                        .help = "Open sockets.",
+                                        .type = FIO_METRIC_GAUGE},
+            [FIO_METRIC_BYTES_READ] = {.name = "fio_read_bytes_total",
+                                       .help = "Bytes read from sockets."},
+            [FIO_METRIC_BYTES_WRITTEN] = {.name = "fio_written_bytes_total",
+                                          .help = "Bytes written to sockets."},
+            [FIO_METRIC_REJECTED] =
+                {.name = "fio_rejected_connections_total",
+                 .help = "Connections rejected by per address limits."},
+        },
+    .count = FIO_METRIC_BUILTIN_COUNT,
+    .threads = FIO_LS_INIT(fio_metrics_data.threads),
+    .lock = FIO_LOCK_INIT,
+};
+
+static __thread fio_metrics_thread_s *fio_metrics_local;
+
+/* relaxed (non-atomic) update, only the owning thread writes the value */
+#define FIO_METRICS_UPDATE(dest, op)                                           \
+  __atomic_store_n(&(dest), __atomic_load_n(&(dest), __ATOMIC_RELAXED) op,     \
+                   __ATOMIC_RELAXED)
+
+static fio_metrics_thread_s *fio_metrics_thread_new(void) {
+  /* not `fio_malloc`, threads might start before the allocator */
+  fio_metrics_thread_s *t = calloc(1, sizeof(*t));
+  FIO_ASSERT_ALLOC(t);
+  fio_lock(&fio_metrics_data.lock);
+  fio_ls_embd_push(&fio_metrics_data.threads, &t->node);
+  fio_unlock(&fio_metrics_data.lock);
+  fio_metrics_local = t;
+  return t;
+}
+
+static inline void fio_metrics_update(size_t id, int64_t value) {
+  fio_metrics_thread_s *t = fio_metrics_local;
+  if (!t)
+    t = fio_metrics_thread_new();
+  FIO_METRICS_UPDATE(t->values[id], +(uint64_t)value);
+}
+
+/* built-in metrics (compiled away when FIO_METRICS is 0) */
+static inline void fio_metrics_add_local(size_t id, int64_t value) {
+#if FIO_METRICS
+  fio_metrics_update(id, value);
+#else
+  (void)id, (void)value;
+#endif
+}
+
+/* the bucket's index for the value (logarithmic, with linear sub-buckets) */
+static inline size_t fio_metrics_bucket(uint64_t value) {
+  if (value < (1 << FIO_METRICS_SUB_BITS))
+    return value;
+  const size_t msb = 63 - __builtin_clzll(value);
+  return (msb << FIO_METRICS_SUB_BITS) |
+         ((value >> (msb - FIO_METRICS_SUB_BITS)) &
+          ((1 << FIO_METRICS_SUB_BITS) - 1));
+}
+
+/* the largest value that belongs to the bucket */
+static inline uint64_t fio_metrics_bucket_max(size_t index) {
+  if (index < (1 << FIO_METRICS_SUB_BITS))
+    return index;
+  const size_t msb = index >> FIO_METRICS_SUB_BITS;
+  const uint64_t base = (1 << FIO_METRICS_SUB_BITS) |
+                        (index & ((1 << FIO_METRICS_SUB_BITS) - 1));
+  return ((base + 1) << (msb - FIO_METRICS_SUB_BITS)) - 1;
+}
+
+#undef fio_metric_register
+/** Registers a metric, returning its identifier. */
+size_t fio_metric_register(struct fio_metric_args_s args) {
+  if (!args.name || args.type > FIO_METRIC_HISTOGRAM)
+    return FIO_METRIC_INVALID;
+  size_t id = FIO_METRIC_INVALID;
+  fio_lock(&fio_metrics_data.lock);
+  if (fio_metrics_data.count >= FIO_METRICS_LIMIT ||
+      (args.type == FIO_METRIC_HISTOGRAM &&
+       fio_metrics_data.histograms >= FIO_METRICS_HISTOGRAM_LIMIT))
+    goto finish;
+  id = fio_metrics_data.count++;
+  fio_metrics_data.metrics[id] = (fio_metric_info_s){
+      .name = args.name,
+      .help = args.help,
+      .type = args.type,
+      .read = (args.type == FIO_METRIC_GAUGE ? args.read : NULL),
+  };
+  if (args.type == FIO_METRIC_HISTOGRAM)
+    fio_metrics_data.metrics[id].histogram = fio_metrics_data.histograms++;
+finish:
+  fio_unlock(&fio_metrics_data.lock);
+  if (id == FIO_METRIC_INVALID)
+    FIO_LOG_ERROR("(fio_metric_register) too many metrics, %s ignored.",
+                  args.name);
+  return id;
+}
+
+/** Adds `value` to a counter or a gauge. */
+void fio_metric_add(size_t id, int64_t value) {
+  if (id >= fio_metrics_data.count ||
+      fio_metrics_data.metrics[id].type == FIO_METRIC_HISTOGRAM)
+    return;
+  fio_metrics_update(id, value);
+}
+
+/** Records a value in a histogram. */
+void fio_metric_record(size_t id, uint64_t value) {
+  if (id >= fio_metrics_data.count ||
+      fio_metrics_data.metrics[id].type != FIO_METRIC_HISTOGRAM)
+    return;
+  fio_metrics_thread_s *t = fio_metrics_local;
+  if (!t)
+    t = fio_metrics_thread_new();
+  const size_t h = fio_metrics_data.metrics[id].histogram;
+  FIO_METRICS_UPDATE(t->values[id], +value);
+  FIO_METRICS_UPDATE(t->buckets[h][fio_metrics_bucket(value)], +1);
+  if (t->max[h] < value)
+    __atomic_store_n(&t->max[h], value, __ATOMIC_RELAXED);
+}
+
+/* the upper bound of the bucket containing the `nth` value (1 based) */
+static uint64_t fio_metrics_percentile(const uint64_t *buckets, uint64_t nth) {
+  uint64_t seen = 0;
+  for (size_t i = 0; i < FIO_METRICS_BUCKETS; ++i) {
+    seen += buckets[i];
+    if (seen >= nth)
+      return fio_metrics_bucket_max(i);
+  }
+  return 0;
+}
+
+/** Collects the metrics and calls `task` for each metric. */
+void fio_metrics_each(void (*task)(fio_metric_s *metric, void *udata),
+                      void *udata) {
+  static uint64_t buckets[FIO_METRICS_BUCKETS];
+  fio_metric_s metrics[FIO_METRICS_LIMIT];
+  if (!task)
+    return;
+  fio_lock(&fio_metrics_data.lock);
+  const size_t count = fio_metrics_data.count;
+  for (size_t id = 0; id < count; ++id) {
+    const fio_metric_info_s *info = fio_metrics_data.metrics + id;
+    fio_metric_s m = {
+        .name = info->name,
+        .help = info->help,
+        .type = info->type,
+    };
+    uint64_t value = 0;
+    if (info->type == FIO_METRIC_HISTOGRAM)
+      memset(buckets, 0, sizeof(buckets));
+    FIO_LS_EMBD_FOR(&fio_metrics_data.threads, node) {
+      fio_metrics_thread_s *t =
+          FIO_LS_EMBD_OBJ(fio_metrics_thread_s, node, node);
+      value += __atomic_load_n(&t->values[id], __ATOMIC_RELAXED);
+      if (info->type != FIO_METRIC_HISTOGRAM)
+        continue;
+      const uint64_t max =
+          __atomic_load_n(&t->max[info->histogram], __ATOMIC_RELAXED);
+      if (m.max < max)
+        m.max = max;
+      for (size_t i = 0; i < FIO_METRICS_BUCKETS; ++i)
+        buckets[i] += __atomic_load_n(&t->buckets[info->histogram][i],
+                                      __ATOMIC_RELAXED);
+    }
+    if (info->type == FIO_METRIC_HISTOGRAM) {
+      m.sum = value;
+      for (size_t i = 0; i < FIO_METRICS_BUCKETS; ++i)
+        m.value += buckets[i];
+      if (m.value) {
+        m.p50 = fio_metrics_percentile(buckets, (m.value + 1) >> 1);
+        m.p90 = fio_metrics_percentile(buckets, (m.value * 9 + 9) / 10);
+        m.p99 = fio_metrics_percentile(buckets, (m.value * 99 + 99) / 100);
+        if (m.p50 > m.max)
+          m.p50 = m.max;
+        if (m.p90 > m.max)
+          m.p90 = m.max;
+        if (m.p99 > m.max)
+          m.p99 = m.max;
+      }
+    } else {
+      m.value = (info->read ? info->read() : (int64_t)value);
+    }
+    metrics[id] = m;
+  }
+  fio_unlock(&fio_metrics_data.lock);
+  /* tasks might update metrics (i.e., by writing to a socket) */
+  for (size_t id = 0; id < count; ++id)
+    task(metrics + id, udata);
+}
+
+/* the metrics describe the current process, a forked child starts at zero */
+static void fio_metrics_on_fork(void) {
+  fio_metrics_data.lock = FIO_LOCK_INIT;
+  FIO_LS_EMBD_FOR(&fio_metrics_data.threads, node) {
+    fio_metrics_thread_s *t = FIO_LS_EMBD_OBJ(fio_metrics_thread_s, node, node);
+    /* inherited connections are still open (or counted when closed) */
+    const uint64_t connections = t->values[FIO_METRIC_CONNECTIONS];
+    memset(t->values, 0, sizeof(t->values));
+    t->values[FIO_METRIC_CONNECTIONS] = connections;
+    memset(t->max, 0, sizeof(t->max));
+    memset(t->buckets, 0, sizeof(t->buckets));
+  }
+}
+
 /* *****************************************************************************
 Packet allocation (for socket's user-buffer)
 ***************************************************************************** */
@@ -277,6 +640,51 @@ static inline fio_packet_s *fio_packet_alloc(void) {
 Core Connection Data Clearing
 ***************************************************************************** */
 
+#ifndef FIO_FD_COMMIT_CHUNK
+/* the number of connection data entries initialized together (on first use) */
+#define FIO_FD_COMMIT_CHUNK 256
+#endif
+
+/*
+ * Connection data is reserved for the full capacity but initialized lazily, in
+ * chunks, the first time an fd in the chunk is opened.
+ *
+ * Untouched (anonymous `mmap`) pages are never committed, so memory scales with
+ * the highest open fd rather than with `RLIMIT_NOFILE`.
+ */
+static void fio_fd_commit_slow(uintptr_t fd) {
+  fio_lock(&fio_data->fd_commit_lock);
+  size_t end = fio_data->fd_commit;
+  if (fd >= end) {
+    size_t limit = (fd / FIO_FD_COMMIT_CHUNK + 1) * FIO_FD_COMMIT_CHUNK;
+    if (limit > fio_data->capa)
+      limit = fio_data->capa;
+    for (size_t i = end; i < limit; ++i) {
+      fd_data(i) = (fio_fd_data_s){
+          .counter = 1,
+          .packet_last = &fd_data(i).packet,
+      };
+      fd_cold(i) = (fio_fd_cold_s){
+          .rw_hooks = (fio_rw_hook_s *)&FIO_DEFAULT_RW_HOOKS,
+#if FIO_ZEROCOPY
+          .zc_pending_last = &fd_cold(i).zc_pending,
+#endif
+      };
+#if FIO_ENGINE_POLL
+      fio_data->poll[i].fd = -1;
+#endif
+    }
+    fio_atomic_xchange(&fio_data->fd_commit, (uint32_t)limit);
+  }
+  fio_unlock(&fio_data->fd_commit_lock);
+}
+
+/* makes sure the connection data for `fd` was initialized. */
+static inline void fio_fd_commit(uintptr_t fd) {
+  if (fd >= fio_data->fd_commit)
+    fio_fd_commit_slow(fd);
+}
+
 /* set the minimal max_protocol_fd */
 static void fio_max_fd_min(uint32_t fd) {
   if (fio_data->max_protocol_fd > fd)
@@ -297,6 +705,60 @@ static void fio_max_fd_shrink(void) {
   fio_unlock(&fio_data->lock);
 }
 
+/* *****************************************************************************
+Timeout buckets - connections are reviewed only when their bucket's head expires
+***************************************************************************** */
+
+#define fio_timeout_node2fd(node)                                              \
+  (FIO_LS_EMBD_OBJ(fio_fd_cold_s, timeout_node, (node)) - fio_data->cold)
+
+/* inserts the fd to it's timeout bucket, ordered by `queued` (within lock) */
+static inline void fio_timeout_insert_unsafe(intptr_t fd, time_t queued) {
+  fio_ls_embd_s *bucket = fio_data->timeouts + fd_data(fd).timeout;
+  fio_ls_embd_s *pos = bucket->prev;
+  /* connections are usually queued by the latest time, this is rarely a loop */
+  while (pos != bucket &&
+         fd_cold(fio_timeout_node2fd(pos)).timeout_queued > queued)
+    pos = pos->prev;
+  fd_cold(fd).timeout_queued = queued;
+  fio_ls_embd_push(pos->next, &fd_cold(fd).timeout_node);
+}
+
+/* true if the fd is listed in a timeout bucket */
+#define fio_timeout_is_linked(fd)                                              \
+  (fd_cold(fd).timeout_node.next &&                                            \
+   fd_cold(fd).timeout_node.next != &fd_cold(fd).timeout_node)
+
+/* adds the fd to it's timeout bucket (if missing) */
+static void fio_timeout_link(intptr_t fd) {
+  fio_lock(&fio_data->timeout_lock);
+  if (!fio_timeout_is_linked(fd))
+    fio_timeout_insert_unsafe(fd, fd_data(fd).active);
+  fio_unlock(&fio_data->timeout_lock);
+}
+
+/* removes the fd from it's timeout bucket */
+static void fio_timeout_unlink(intptr_t fd) {
+  fio_lock(&fio_data->timeout_lock);
+  fio_ls_embd_remove(&fd_cold(fd).timeout_node);
+  fio_unlock(&fio_data->timeout_lock);
+}
+
+/* updates the fd's timeout value, moving it to the matching bucket */
+static void fio_timeout_set_fd(intptr_t fd, uint8_t timeout) {
+  fio_lock(&fio_data->timeout_lock);
+  fd_data(fd).timeout = timeout;
+  if (fio_timeout_is_linked(fd)) {
+    fio_ls_embd_remove(&fd_cold(fd).timeout_node);
+    fio_timeout_insert_unsafe(fd, fd_data(fd).active);
+  }
+  fio_unlock(&fio_data->timeout_lock);
+}
+
+#if FIO_ENGINE_URING
+static void fio_poll_remove_fd(intptr_t fd);
+#endif
+
 /* resets connection data, marking it as either open or closed. */
 static inline int fio_clear_fd(intptr_t fd, uint8_t is_open) {
   fio_packet_s *packet;
@@ -304,21 +766,44 @@ static inline int fio_clear_fd(intptr_t fd, uint8_t is_open) {
   fio_rw_hook_s *rw_hooks;
   void *rw_udata;
   fio_uuid_links_s links;
+#if FIO_ENGINE_URING
+  /* pending poll requests hold a file reference, cancel before reuse / close */
+  if (fd_data(fd).polled)
+    fio_poll_remove_fd(fd);
+#endif
+  fio_timeout_unlink(fd);
   fio_lock(&(fd_data(fd).sock_lock));
-  links = fd_data(fd).links;
+  links = fd_cold(fd).links;
   packet = fd_data(fd).packet;
+#if FIO_ZEROCOPY
+  /* packets still awaiting MSG_ZEROCOPY completion are freed here, with the
+   * unsent packets, since no completion will be reported for a cleared socket
+   * (the kernel holds it's own page references) */
+  if (fd_cold(fd).zc_pending) {
+    *fd_cold(fd).zc_pending_last = packet;
+    packet = fd_cold(fd).zc_pending;
+  }
+#endif
   protocol = fd_data(fd).protocol;
-  rw_hooks = fd_data(fd).rw_hooks;
-  rw_udata = fd_data(fd).rw_udata;
+  rw_hooks = fd_cold(fd).rw_hooks;
+  rw_udata = fd_cold(fd).rw_udata;
+  const int was_open = fd_data(fd).open;
   fd_data(fd) = (fio_fd_data_s){
       .open = is_open,
       .sock_lock = fd_data(fd).sock_lock,
       .protocol_lock = fd_data(fd).protocol_lock,
-      .rw_hooks = (fio_rw_hook_s *)&FIO_DEFAULT_RW_HOOKS,
       .counter = fd_data(fd).counter + 1,
       .packet_last = &fd_data(fd).packet,
   };
+  fd_cold(fd) = (fio_fd_cold_s){
+      .rw_hooks = (fio_rw_hook_s *)&FIO_DEFAULT_RW_HOOKS,
+#if FIO_ZEROCOPY
+      .zc_pending_last = &fd_cold(fd).zc_pending,
+#endif
+  };
   fio_unlock(&(fd_data(fd).sock_lock));
+  if (was_open != is_open)
+    fio_metrics_add_local(FIO_METRIC_CONNECTIONS, is_open - was_open);
   if (rw_hooks && rw_hooks->cleanup)
     rw_hooks->cleanup(rw_udata);
   while (packet) {
@@ -386,7 +871,7 @@ inline static void protocol_unlock(fio_protocol_s *pr,
 /** returns 1 if the UUID is valid and 0 if it isn't. */
 #define uuid_is_valid(uuid)                                                    \
   ((intptr_t)(uuid) >= 0 &&                                                    \
-   ((uint32_t)fio_uuid2fd((uuid))) < fio_data->capa &&                         \
+   ((uint32_t)fio_uuid2fd((uuid))) < fio_data->fd_commit &&                    \
    ((uintptr_t)(uuid)&0xFF) == uuid_data((uuid)).counter)
 
 /* public API. */
@@ -412,6 +897,7 @@ UUID validation and state
 intptr_t fio_fd2uuid(int fd) {
   if (fd < 0 || (size_t)fd >= fio_data->capa)
     return -1;
+  fio_fd_commit(fd);
   if (!fd_data(fd).open) {
     fio_lock(&fd_data(fd).protocol_lock);
     fio_clear_fd(fd, 1);
@@ -451,10 +937,10 @@ void fio_touch(intptr_t uuid) {
 
 /* public API. */
 fio_str_info_s fio_peer_addr(intptr_t uuid) {
-  if (fio_is_closed(uuid) || !uuid_data(uuid).addr_len)
+  if (fio_is_closed(uuid) || !uuid_cold(uuid).addr_len)
     return (fio_str_info_s){.data = NULL, .len = 0, .capa = 0};
-  return (fio_str_info_s){.data = (char *)uuid_data(uuid).addr,
-                          .len = uuid_data(uuid).addr_len,
+  return (fio_str_info_s){.data = (char *)uuid_cold(uuid).addr,
+                          .len = uuid_cold(uuid).addr_len,
                           .capa = 0};
 }
 
@@ -510,7 +996,7 @@ void fio_uuid_link(intptr_t uuid, void *obj, void (*on_close)(void *obj)) {
   fio_lock(&uuid_data(uuid).sock_lock);
   if (!uuid_is_valid(uuid))
     goto locked_invalid;
-  fio_uuid_links_overwrite(&uuid_data(uuid).links, (uintptr_t)obj, on_close,
+  fio_uuid_links_overwrite(&uuid_cold(uuid).links, (uintptr_t)obj, on_close,
                            NULL);
   fio_unlock(&uuid_data(uuid).sock_lock);
   return;
@@ -530,7 +1016,7 @@ int fio_uuid_unlink(intptr_t uuid, void *obj) {
     goto locked_invalid;
   /* default object comparison is always true */
   int ret =
-      fio_uuid_links_remove(&uuid_data(uuid).links, (uintptr_t)obj, NULL, NULL);
+      fio_uuid_links_remove(&uuid_cold(uuid).links, (uintptr_t)obj, NULL, NULL);
   if (ret)
     errno = ENOTCONN;
   fio_unlock(&uuid_data(uuid).sock_lock);
@@ -648,100 +1134,136 @@ Suspending and renewing thread execution (signaling events)
 #endif
 
 /**
- * The polling throttling model will use pipes to suspend and resume threads...
+ * The parking model suspends idle threads until a task is scheduled (zero CPU
+ * when idle), using a futex on Linux, `__ulock_wait` on macOS and a condition
+ * variable elsewhere.
  *
- * However, it seems the approach is currently broken, at least on macOS.
- * I don't know why.
- *
- * If polling is disabled, the progressive throttling model will be used.
+ * If parking is disabled, the progressive throttling model will be used.
  *
  * The progressive throttling makes concurrency and parallelism likely, but uses
  * progressive nano-sleep throttling system that is less exact.
  */
-#ifndef FIO_DEFER_THROTTLE_POLL
-#define FIO_DEFER_THROTTLE_POLL 0
+#ifndef FIO_DEFER_THREAD_PARKING
+#define FIO_DEFER_THREAD_PARKING 1
 #endif
 
-typedef struct fio_thread_queue_s {
-  fio_ls_embd_s node;
-  int fd_wait;   /* used for weaiting (read signal) */
-  int fd_signal; /* used for signalling (write) */
-} fio_thread_queue_s;
+/* the maximum number of milliseconds a parked thread sleeps before rechecking */
+#ifndef FIO_DEFER_PARK_TIMEOUT
+#define FIO_DEFER_PARK_TIMEOUT 1000
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#define FIO_PARK_FUTEX 1
+#elif defined(__APPLE__)
+/* private macOS API (used by libc++ and others), available since 10.12 */
+extern int __ulock_wait(uint32_t operation, void *addr, uint64_t value,
+                        uint32_t timeout_us);
+extern int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
+#define FIO_PARK_ULOCK 1
+#define FIO_ULOCK_COMPARE_AND_WAIT 1
+#define FIO_ULOCK_WAKE_ALL 0x00000100
+#define FIO_ULOCK_NO_ERRNO 0x01000000
+#endif
 
-fio_ls_embd_s fio_thread_queue = FIO_LS_INIT(fio_thread_queue);
-fio_lock_i fio_thread_lock = FIO_LOCK_INIT;
-static __thread fio_thread_queue_s fio_thread_data = {.fd_wait = -1,
-                                                      .fd_signal = -1};
+/* parked threads state */
+static struct {
+  /* the word parked threads wait on, incremented for every wakeup */
+  uint32_t volatile word;
+  /* the number of parked (or about to park) threads */
+  size_t volatile sleepers;
+#if !FIO_PARK_FUTEX && !FIO_PARK_ULOCK
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+} fio_park_data = {
+    .word = 0,
+#if !FIO_PARK_FUTEX && !FIO_PARK_ULOCK
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+#endif
+};
 
-FIO_FUNC inline void fio_thread_make_suspendable(void) {
-  if (fio_thread_data.fd_signal >= 0)
-    return;
-  int fd[2] = {0, 0};
-  int ret = pipe(fd);
-  FIO_ASSERT(ret == 0, "`pipe` failed.");
-  FIO_ASSERT(fio_set_non_block(fd[0]) == 0,
-             "(fio) couldn't set internal pipe to non-blocking mode.");
-  FIO_ASSERT(fio_set_non_block(fd[1]) == 0,
-             "(fio) couldn't set internal pipe to non-blocking mode.");
-  fio_thread_data.fd_wait = fd[0];
-  fio_thread_data.fd_signal = fd[1];
-}
-
-FIO_FUNC inline void fio_thread_cleanup(void) {
-  if (fio_thread_data.fd_signal < 0)
-    return;
-  close(fio_thread_data.fd_wait);
-  close(fio_thread_data.fd_signal);
-  fio_thread_data.fd_wait = -1;
-  fio_thread_data.fd_signal = -1;
+/* waits while `fio_park_data.word == expected` (or until the timeout). */
+static void fio_park_wait(uint32_t expected) {
+#if FIO_PARK_FUTEX
+  struct timespec tm = {.tv_sec = FIO_DEFER_PARK_TIMEOUT / 1000,
+                        .tv_nsec = (FIO_DEFER_PARK_TIMEOUT % 1000) * 1000000};
+  syscall(SYS_futex, &fio_park_data.word, FUTEX_WAIT_PRIVATE, expected, &tm,
+          NULL, 0);
+#elif FIO_PARK_ULOCK
+  __ulock_wait(FIO_ULOCK_COMPARE_AND_WAIT | FIO_ULOCK_NO_ERRNO,
+               (void *)&fio_park_data.word, expected,
+               FIO_DEFER_PARK_TIMEOUT * 1000);
+#else
+  struct timespec tm;
+  clock_gettime(CLOCK_REALTIME, &tm);
+  tm.tv_sec += FIO_DEFER_PARK_TIMEOUT / 1000;
+  tm.tv_nsec += (FIO_DEFER_PARK_TIMEOUT % 1000) * 1000000;
+  if (tm.tv_nsec >= 1000000000) {
+    tm.tv_nsec -= 1000000000;
+    ++tm.tv_sec;
+  }
+  pthread_mutex_lock(&fio_park_data.mutex);
+  if (fio_park_data.word == expected)
+    pthread_cond_timedwait(&fio_park_data.cond, &fio_park_data.mutex, &tm);
+  pthread_mutex_unlock(&fio_park_data.mutex);
+#endif
+}
+
+/* wakes up a single parked thread (or all of them). */
+static void fio_park_wake(uint8_t all) {
+  fio_atomic_add(&fio_park_data.word, 1);
+#if FIO_PARK_FUTEX
+  syscall(SYS_futex, &fio_park_data.word, FUTEX_WAKE_PRIVATE,
+          (all ? INT_MAX : 1), NULL, NULL, 0);
+#elif FIO_PARK_ULOCK
+  __ulock_wake(FIO_ULOCK_COMPARE_AND_WAIT | FIO_ULOCK_NO_ERRNO |
+                   (all ? FIO_ULOCK_WAKE_ALL : 0),
+               (void *)&fio_park_data.word, 0);
+#else
+  pthread_mutex_lock(&fio_park_data.mutex);
+  pthread_mutex_unlock(&fio_park_data.mutex);
+  if (all)
+    pthread_cond_broadcast(&fio_park_data.cond);
+  else
+    pthread_cond_signal(&fio_park_data.cond);
+#endif
 }
 
-/* suspend thread execution (might be resumed unexpectedly) */
+/* suspend thread execution until a task is scheduled (or a timeout) */
 FIO_FUNC void fio_thread_suspend(void) {
-  fio_lock(&fio_thread_lock);
-  fio_ls_embd_push(&fio_thread_queue, &fio_thread_data.node);
-  fio_unlock(&fio_thread_lock);
-  struct pollfd list = {
-      .events = (POLLPRI | POLLIN),
-      .fd = fio_thread_data.fd_wait,
-  };
-  if (poll(&list, 1, 5000) > 0) {
-    /* thread was removed from the list through signal */
-    uint64_t data;
-    int r = read(fio_thread_data.fd_wait, &data, sizeof(data));
-    (void)r;
-  } else {
-    /* remove self from list */
-    fio_lock(&fio_thread_lock);
-    fio_ls_embd_remove(&fio_thread_data.node);
-    fio_unlock(&fio_thread_lock);
-  }
+  const uint32_t expected = fio_park_data.word;
+  fio_atomic_add(&fio_park_data.sleepers, 1);
+  /* `sleepers` must be visible before testing the queue (see signal) */
+  if (!fio_defer_has_queue())
+    fio_park_wait(expected);
+  fio_atomic_sub(&fio_park_data.sleepers, 1);
 }
 
 /* wake up a single thread */
-FIO_FUNC void fio_thread_signal(void) {
-  fio_thread_queue_s *t;
-  int fd = -2;
-  fio_lock(&fio_thread_lock);
-  t = (fio_thread_queue_s *)fio_ls_embd_shift(&fio_thread_queue);
-  if (t)
-    fd = t->fd_signal;
-  fio_unlock(&fio_thread_lock);
-  if (fd >= 0) {
-    uint64_t data = 1;
-    int r = write(fd, (void *)&data, sizeof(data));
-    (void)r;
-  } else if (fd == -1) {
-    /* hardly the best way, but there's a thread sleeping on air */
-    kill(getpid(), SIGCONT);
-  }
+FIO_FUNC inline void fio_thread_signal(void) {
+  /* the task must be visible before testing for sleepers (see suspend) */
+  __sync_synchronize();
+  if (fio_park_data.sleepers)
+    fio_park_wake(0);
 }
 
 /* wake up all threads */
 FIO_FUNC void fio_thread_broadcast(void) {
-  while (fio_ls_embd_any(&fio_thread_queue)) {
-    fio_thread_signal();
-  }
+  __sync_synchronize();
+  if (fio_park_data.sleepers)
+    fio_park_wake(1);
+}
+
+/* resets the parking state in a forked child process */
+FIO_FUNC void fio_thread_park_on_fork(void) {
+  fio_park_data.sleepers = 0;
+#if !FIO_PARK_FUTEX && !FIO_PARK_ULOCK
+  pthread_mutex_init(&fio_park_data.mutex, NULL);
+  pthread_cond_init(&fio_park_data.cond, NULL);
+#endif
 }
 
 static size_t fio_poll(void);
@@ -753,7 +1275,7 @@ static void fio_defer_thread_wait(void) {
   fio_poll();
   return;
 #endif
-  if (FIO_DEFER_THROTTLE_POLL) {
+  if (FIO_DEFER_THREAD_PARKING) {
     fio_thread_suspend();
   } else {
     /* keeps threads active (concurrent), but reduces performance */
@@ -766,19 +1288,15 @@ static void fio_defer_thread_wait(void) {
   }
 }
 
-static inline void fio_defer_on_thread_start(void) {
-  if (FIO_DEFER_THROTTLE_POLL)
-    fio_thread_make_suspendable();
-}
+static inline void fio_defer_on_thread_start(void) {}
 static inline void fio_defer_thread_signal(void) {
-  if (FIO_DEFER_THROTTLE_POLL)
+  if (FIO_DEFER_THREAD_PARKING)
     fio_thread_signal();
 }
 static inline void fio_defer_on_thread_end(void) {
-  if (FIO_DEFER_THROTTLE_POLL) {
+  /* parked threads should notice the shutdown */
+  if (FIO_DEFER_THREAD_PARKING)
     fio_thread_broadcast();
-    fio_thread_cleanup();
-  }
 }
 
 /* *****************************************************************************
@@ -827,6 +1345,30 @@ Section Start Marker
 #endif
 #endif
 
+#ifndef FIO_DEFER_RING_SIZE
+/* The number of cells in each queue's lock-free ring (must be a power of 2) */
+#define FIO_DEFER_RING_SIZE 1024
+#endif
+
+#if !FIO_DEFER_RING_SIZE || (FIO_DEFER_RING_SIZE & (FIO_DEFER_RING_SIZE - 1))
+#error FIO_DEFER_RING_SIZE must be a power of 2
+#endif
+
+#ifndef FIO_DEFER_STEALING
+/* Sets work stealing (per-thread task rings) as the default `fio_start` mode */
+#define FIO_DEFER_STEALING 0
+#endif
+
+#ifndef FIO_DEFER_LOCAL_SIZE
+/* The number of cells in each worker thread's task ring (a power of 2) */
+#define FIO_DEFER_LOCAL_SIZE 256
+#endif
+
+#if !FIO_DEFER_LOCAL_SIZE ||                                                   \
+    (FIO_DEFER_LOCAL_SIZE & (FIO_DEFER_LOCAL_SIZE - 1))
+#error FIO_DEFER_LOCAL_SIZE must be a power of 2
+#endif
+
 /* task node data */
 typedef struct {
   void (*func)(void *, void *);
@@ -834,6 +1376,17 @@ typedef struct {
   void *arg2;
 } fio_defer_task_s;
 
+/*
+ * A lock-free ring cell (a bounded MPMC queue, as described by Dmitry Vyukov).
+ *
+ * The cell's sequence number is stored minus the cell's index, so a zeroed
+ * (static) ring is a valid empty ring.
+ */
+typedef struct {
+  size_t seq;
+  fio_defer_task_s task;
+} fio_defer_ring_cell_s;
+
 /* task queue block */
 typedef struct fio_defer_queue_block_s fio_defer_queue_block_s;
 struct fio_defer_queue_block_s {
@@ -854,6 +1407,16 @@ typedef struct { /* a lock for the state machine, used for multi-threading
   fio_defer_queue_block_s *writer;
   /* static, built-in, queue */
   fio_defer_queue_block_s static_queue;
+  /* the number of tasks waiting in the (locked) block queue */
+  size_t spilled;
+  /* lock-free ring positions, each on its own cache line */
+  uint8_t pad_[64];
+  size_t ring_write;
+  uint8_t pad_w_[64 - sizeof(size_t)];
+  size_t ring_read;
+  uint8_t pad_r_[64 - sizeof(size_t)];
+  /* lock-free ring, used before spilling into the block queue */
+  fio_defer_ring_cell_s ring[FIO_DEFER_RING_SIZE];
 } fio_task_queue_s;
 
 /* the state machine - this holds all the data about the task queue and pool */
@@ -883,9 +1446,108 @@ static size_t fio_defer_count_alloc, fio_defer_count_dealloc;
 #define COUNT_RESET
 #endif
 
-static inline void fio_defer_push_task_fn(fio_defer_task_s task,
-                                          fio_task_queue_s *queue) {
+#if defined(__ATOMIC_RELAXED)
+#define fio_defer_ring_load(p_obj) __atomic_load_n((p_obj), __ATOMIC_ACQUIRE)
+#define fio_defer_ring_store(p_obj, value)                                     \
+  __atomic_store_n((p_obj), (value), __ATOMIC_RELEASE)
+#define fio_defer_ring_cas(p_obj, expected, value)                             \
+  __atomic_compare_exchange_n((p_obj), (expected), (value), 1,                 \
+                              __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+#define fio_defer_ring_load(p_obj)                                             \
+  (__sync_synchronize(), *(volatile size_t *)(p_obj))
+#define fio_defer_ring_store(p_obj, value)                                     \
+  do {                                                                         \
+    __sync_synchronize();                                                      \
+    *(volatile size_t *)(p_obj) = (value);                                     \
+  } while (0)
+static inline int fio_defer_ring_cas(size_t *p_obj, size_t *expected,
+                                     size_t value) {
+  size_t old = __sync_val_compare_and_swap(p_obj, *expected, value);
+  if (old == *expected)
+    return 1;
+  *expected = old;
+  return 0;
+}
+#endif
+
+/* the number of tasks waiting in the global queues (for the metrics) */
+static int64_t fio_metric_read_queue(void) {
+  int64_t count = (int64_t)(task_queue_normal.ring_write -
+                            task_queue_normal.ring_read) +
+                  (int64_t)fio_defer_ring_load(&task_queue_normal.spilled);
+#if FIO_USE_URGENT_QUEUE
+  count += (int64_t)(task_queue_urgent.ring_write -
+                     task_queue_urgent.ring_read) +
+           (int64_t)fio_defer_ring_load(&task_queue_urgent.spilled);
+#endif
+  return (count > 0 ? count : 0);
+}
+
+/** Pushes a task to a lock-free ring, returning -1 if the ring is full. */
+static inline int fio_defer_ring_push(size_t *write_pos,
+                                      fio_defer_ring_cell_s *ring,
+                                      const size_t size,
+                                      fio_defer_task_s task) {
+  size_t pos = fio_defer_ring_load(write_pos);
+  fio_defer_ring_cell_s *cell;
+  for (;;) {
+    const size_t index = pos & (size - 1);
+    cell = ring + index;
+    const intptr_t dif =
+        (intptr_t)(fio_defer_ring_load(&cell->seq) + index) - (intptr_t)pos;
+    if (dif == 0) {
+      if (fio_defer_ring_cas(write_pos, &pos, pos + 1))
+        break;
+    } else if (dif < 0) {
+      return -1; /* full */
+    } else {
+      pos = fio_defer_ring_load(write_pos);
+    }
+  }
+  cell->task = task;
+  fio_defer_ring_store(&cell->seq, pos + 1 - (pos & (size - 1)));
+  return 0;
+}
+
+/** Pops a task from a lock-free ring, returning -1 if the ring is empty. */
+static inline int fio_defer_ring_pop(size_t *read_pos,
+                                     fio_defer_ring_cell_s *ring,
+                                     const size_t size,
+                                     fio_defer_task_s *task) {
+  size_t pos = fio_defer_ring_load(read_pos);
+  fio_defer_ring_cell_s *cell;
+  for (;;) {
+    const size_t index = pos & (size - 1);
+    cell = ring + index;
+    const intptr_t dif = (intptr_t)(fio_defer_ring_load(&cell->seq) + index) -
+                         (intptr_t)(pos + 1);
+    if (dif == 0) {
+      if (fio_defer_ring_cas(read_pos, &pos, pos + 1))
+        break;
+    } else if (dif < 0) {
+      return -1; /* empty */
+    } else {
+      pos = fio_defer_ring_load(read_pos);
+    }
+  }
+  *task = cell->task;
+  fio_defer_ring_store(&cell->seq, pos + size - (pos & (size - 1)));
+  return 0;
+}
+
+#define fio_defer_queue_ring_push(queue, task)                                 \
+  fio_defer_ring_push(&(queue)->ring_write, (queue)->ring,                     \
+                      FIO_DEFER_RING_SIZE, (task))
+#define fio_defer_queue_ring_pop(queue, p_task)                                \
+  fio_defer_ring_pop(&(queue)->ring_read, (queue)->ring, FIO_DEFER_RING_SIZE,  \
+                     (p_task))
+
+/* pushes a task to the (locked) block queue, used when the ring is full. */
+static inline void fio_defer_push_task_locked(fio_defer_task_s task,
+                                              fio_task_queue_s *queue) {
   fio_lock(&queue->lock);
+  fio_atomic_add(&queue->spilled, 1);
 
   /* test if full */
   if (queue->writer->state && queue->writer->write == queue->writer->read) {
@@ -920,11 +1582,113 @@ critical_error:
   FIO_ASSERT_ALLOC(NULL)
 }
 
+static inline void fio_defer_push_task_fn(fio_defer_task_s task,
+                                          fio_task_queue_s *queue) {
+  /* once spilled, keep using the block queue until it drains (FIFO order) */
+  if (fio_defer_ring_load(&queue->spilled) ||
+      fio_defer_queue_ring_push(queue, task))
+    fio_defer_push_task_locked(task, queue);
+}
+
+/* *****************************************************************************
+Work stealing - per-thread task rings
+***************************************************************************** */
+
+/* a worker thread's local task ring, other threads steal from the read end */
+typedef struct {
+  size_t ring_write;
+  uint8_t pad_w_[64 - sizeof(size_t)];
+  size_t ring_read;
+  uint8_t pad_r_[64 - sizeof(size_t)];
+  fio_defer_ring_cell_s ring[FIO_DEFER_LOCAL_SIZE];
+} fio_defer_local_s;
+
+/* the local task rings, one per worker thread (NULL unless work stealing) */
+static fio_defer_local_s *fio_defer_locals;
+static size_t fio_defer_locals_count;
+/* the calling thread's local ring (NULL for non-worker threads) */
+static __thread fio_defer_local_s *fio_defer_local_self;
+
+#if DEBUG
+static size_t fio_defer_count_steal;
+#define COUNT_STEAL fio_atomic_add(&fio_defer_count_steal, 1)
+#else
+#define COUNT_STEAL
+#endif
+
+#define fio_defer_local_push(local, task)                                      \
+  fio_defer_ring_push(&(local)->ring_write, (local)->ring,                     \
+                      FIO_DEFER_LOCAL_SIZE, (task))
+#define fio_defer_local_pop(local, p_task)                                     \
+  fio_defer_ring_pop(&(local)->ring_read, (local)->ring,                       \
+                     FIO_DEFER_LOCAL_SIZE, (p_task))
+
+/* pushes a normal task, preferring the calling thread's local ring. */
+static inline void fio_defer_push_task_normal(fio_defer_task_s task) {
+  if (fio_defer_local_self && !fio_defer_local_push(fio_defer_local_self, task))
+    return;
+  fio_defer_push_task_fn(task, &task_queue_normal);
+}
+
+/* attaches the calling worker thread to it's local ring (if stealing). */
+static inline void fio_defer_local_attach(size_t index) {
+  fio_defer_local_self =
+      (index < fio_defer_locals_count) ? fio_defer_locals + index : NULL;
+}
+
+/* pops a task from the calling thread's ring or steals from a peer's ring. */
+static inline int fio_defer_local_pop_or_steal(fio_defer_task_s *task) {
+  if (!fio_defer_local_self)
+    return -1;
+  if (!fio_defer_local_pop(fio_defer_local_self, task))
+    return 0;
+  const size_t self = fio_defer_local_self - fio_defer_locals;
+  for (size_t i = 1; i < fio_defer_locals_count; ++i) {
+    fio_defer_local_s *peer =
+        fio_defer_locals + ((self + i) % fio_defer_locals_count);
+    if (!fio_defer_local_pop(peer, task)) {
+      COUNT_STEAL;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* returns true if any of the local rings holds a task. */
+static inline int fio_defer_locals_any(void) {
+  for (size_t i = 0; i < fio_defer_locals_count; ++i) {
+    if (fio_defer_ring_load(&fio_defer_locals[i].ring_read) !=
+        fio_defer_ring_load(&fio_defer_locals[i].ring_write))
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * Sets the number of local rings (0 to disable work stealing), moving any
+ * leftover tasks to the global queue. Call only when no worker threads run.
+ */
+static void fio_defer_locals_set(size_t count) {
+  for (size_t i = 0; i < fio_defer_locals_count; ++i) {
+    fio_defer_task_s task;
+    while (!fio_defer_local_pop(fio_defer_locals + i, &task))
+      fio_defer_push_task_fn(task, &task_queue_normal);
+  }
+  free(fio_defer_locals);
+  fio_defer_locals = NULL;
+  fio_defer_locals_count = 0;
+  fio_defer_local_self = NULL;
+  if (!count)
+    return;
+  fio_defer_locals = calloc(count, sizeof(*fio_defer_locals));
+  FIO_ASSERT_ALLOC(fio_defer_locals);
+  fio_defer_locals_count = count;
+}
+
 #define fio_defer_push_task(func_, arg1_, arg2_)                               \
   do {                                                                         \
-    fio_defer_push_task_fn(                                                    \
-        (fio_defer_task_s){.func = func_, .arg1 = arg1_, .arg2 = arg2_},       \
-        &task_queue_normal);                                                   \
+    fio_defer_push_task_normal(                                                \
+        (fio_defer_task_s){.func = func_, .arg1 = arg1_, .arg2 = arg2_});      \
     fio_defer_thread_signal();                                                 \
   } while (0)
 
@@ -941,6 +1705,11 @@ critical_error:
 static inline fio_defer_task_s fio_defer_pop_task(fio_task_queue_s *queue) {
   fio_defer_task_s ret = (fio_defer_task_s){.func = NULL};
   fio_defer_queue_block_s *to_free = NULL;
+  /* the ring always holds the oldest tasks */
+  if (!fio_defer_queue_ring_pop(queue, &ret))
+    return ret;
+  if (!fio_defer_ring_load(&queue->spilled))
+    return ret;
   /* lock the state machine, grab/create a task and place it at the tail */
   fio_lock(&queue->lock);
 
@@ -949,6 +1718,7 @@ static inline fio_defer_task_s fio_defer_pop_task(fio_task_queue_s *queue) {
     goto finish;
   /* collect task */
   ret = queue->reader->tasks[queue->reader->read++];
+  fio_atomic_sub(&queue->spilled, 1);
   /* cycle */
   if (queue->reader->read == DEFER_QUEUE_BLOCK_COUNT) {
     queue->reader->read = 0;
@@ -997,7 +1767,31 @@ static inline void fio_defer_clear_tasks_for_queue(fio_task_queue_s *queue) {
   }
   queue->static_queue = (fio_defer_queue_block_s){.next = NULL};
   queue->reader = queue->writer = &queue->static_queue;
+  fio_defer_ring_store(&queue->spilled, 0);
   fio_unlock(&queue->lock);
+  fio_defer_task_s tmp;
+  while (!fio_defer_queue_ring_pop(queue, &tmp))
+    ;
+}
+
+static void fio_defer_ring_noop(void *arg1, void *arg2) {
+  (void)arg1;
+  (void)arg2;
+}
+
+/*
+ * Fixes ring cells that were reserved (but not written) by a thread that
+ * didn't survive a `fork`, so readers aren't blocked by the missing task.
+ */
+static void fio_defer_on_fork_for_queue(fio_task_queue_s *queue) {
+  queue->lock = FIO_LOCK_INIT;
+  for (size_t pos = queue->ring_read; pos != queue->ring_write; ++pos) {
+    const size_t index = pos & (FIO_DEFER_RING_SIZE - 1);
+    if (queue->ring[index].seq + index == pos + 1)
+      continue;
+    queue->ring[index].task = (fio_defer_task_s){.func = fio_defer_ring_noop};
+    queue->ring[index].seq = pos + 1 - index;
+  }
 }
 
 /**
@@ -1020,9 +1814,10 @@ static inline void fio_defer_clear_tasks(void) {
 }
 
 static void fio_defer_on_fork(void) {
-  task_queue_normal.lock = FIO_LOCK_INIT;
+  fio_thread_park_on_fork();
+  fio_defer_on_fork_for_queue(&task_queue_normal);
 #if FIO_USE_URGENT_QUEUE
-  task_queue_urgent.lock = FIO_LOCK_INIT;
+  fio_defer_on_fork_for_queue(&task_queue_urgent);
 #endif
 }
 
@@ -1042,16 +1837,33 @@ call_error:
   return -1;
 }
 
-/** Performs all deferred functions until the queue had been depleted. */
-void fio_defer_perform(void) {
-#if FIO_USE_URGENT_QUEUE
-  while (fio_defer_perform_single_task_for_queue(&task_queue_urgent) == 0 ||
-         fio_defer_perform_single_task_for_queue(&task_queue_normal) == 0)
-    ;
+/**
+ * Performs a single task from the calling thread's local ring (or a peer's),
+ * returning -1 if no task was found.
+ */
+static inline int fio_defer_perform_single_local_task(void) {
+  fio_defer_task_s task;
+  if (fio_defer_local_pop_or_steal(&task))
+    return -1;
+  task.func(task.arg1, task.arg2);
+  return 0;
+}
+
+/** Performs all deferred functions until the queue had been depleted. */
+void fio_defer_perform(void) {
+  size_t count = 0;
+#if FIO_USE_URGENT_QUEUE
+  while (fio_defer_perform_single_task_for_queue(&task_queue_urgent) == 0 ||
+         fio_defer_perform_single_local_task() == 0 ||
+         fio_defer_perform_single_task_for_queue(&task_queue_normal) == 0)
+    ++count;
 #else
-  while (fio_defer_perform_single_task_for_queue(&task_queue_normal) == 0)
-    ;
+  while (fio_defer_perform_single_local_task() == 0 ||
+         fio_defer_perform_single_task_for_queue(&task_queue_normal) == 0)
+    ++count;
 #endif
+  if (count)
+    fio_metrics_add_local(FIO_METRIC_TASKS, count);
   //   for (;;) {
   // #if FIO_USE_URGENT_QUEUE
   //     fio_defer_task_s task = fio_defer_pop_task(&task_queue_urgent);
@@ -1069,22 +1881,33 @@ void fio_defer_perform(void) {
 /** Returns true if there are deferred functions waiting for execution. */
 int fio_defer_has_queue(void) {
 #if FIO_USE_URGENT_QUEUE
-  return task_queue_urgent.reader != task_queue_urgent.writer ||
-         task_queue_urgent.reader->write != task_queue_urgent.reader->read ||
-         task_queue_normal.reader != task_queue_normal.writer ||
-         task_queue_normal.reader->write != task_queue_normal.reader->read;
+  return task_queue_urgent.ring_read != task_queue_urgent.ring_write ||
+         fio_defer_ring_load(&task_queue_urgent.spilled) ||
+         task_queue_normal.ring_read != task_queue_normal.ring_write ||
+         fio_defer_ring_load(&task_queue_normal.spilled) ||
+         fio_defer_locals_any();
 #else
-  return task_queue_normal.reader != task_queue_normal.writer ||
-         task_queue_normal.reader->write != task_queue_normal.reader->read;
+  return task_queue_normal.ring_read != task_queue_normal.ring_write ||
+         fio_defer_ring_load(&task_queue_normal.spilled) ||
+         fio_defer_locals_any();
 #endif
 }
 
 /** Clears the queue. */
 void fio_defer_clear_queue(void) { fio_defer_clear_tasks(); }
 
+#if FIO_AFFINITY
+/* pins a worker thread to one of the worker's CPUs (if enabled) */
+static void fio_affinity_thread(size_t index);
+#else
+#define fio_affinity_thread(index) ((void)(index))
+#endif
+
 /* Thread pool task */
 static void *fio_defer_cycle(void *ignr) {
   fio_defer_on_thread_start();
+  fio_affinity_thread((uintptr_t)ignr);
+  fio_defer_local_attach((uintptr_t)ignr);
   for (;;) {
     fio_defer_perform();
     if (!fio_is_running())
@@ -1109,8 +1932,9 @@ static void fio_defer_thread_pool_join(fio_defer_thread_pool_s *pool) {
   free(pool);
 }
 
-/* creates a thread pool */
-static fio_defer_thread_pool_s *fio_defer_thread_pool_new(size_t count) {
+/* creates a thread pool, each thread's argument is it's index in the pool */
+static fio_defer_thread_pool_s *
+fio_defer_thread_pool_new2(size_t count, void *(*thread_func)(void *)) {
   if (!count)
     count = 1;
   fio_defer_thread_pool_s *pool =
@@ -1118,7 +1942,7 @@ static fio_defer_thread_pool_s *fio_defer_thread_pool_new(size_t count) {
   FIO_ASSERT_ALLOC(pool);
   pool->thread_count = count;
   for (size_t i = 0; i < count; ++i) {
-    pool->threads[i] = fio_thread_new(fio_defer_cycle, NULL);
+    pool->threads[i] = fio_thread_new(thread_func, (void *)(uintptr_t)i);
     if (!pool->threads[i]) {
       pool->thread_count = i;
       goto error;
@@ -1132,6 +1956,11 @@ error:
   return NULL;
 }
 
+/* creates a thread pool */
+static fio_defer_thread_pool_s *fio_defer_thread_pool_new(size_t count) {
+  return fio_defer_thread_pool_new2(count, fio_defer_cycle);
+}
+
 /* *****************************************************************************
 Section Start Marker
 
@@ -1156,17 +1985,32 @@ Section Start Marker
 
 ***************************************************************************** */
 
-typedef struct {
-  fio_ls_embd_s node;
+#ifndef FIO_TIMER_HEAP_ARITY
+/* The number of children per node in the timer heap (a d-ary min-heap) */
+#define FIO_TIMER_HEAP_ARITY 4
+#endif
+
+/* a timer's heap position while it isn't scheduled (i.e., while performed) */
+#define FIO_TIMER_UNLISTED ((size_t)-1)
+
+struct fio_timer_s {
   struct timespec due;
   size_t interval; /*in ms */
   size_t repetitions;
   void (*task)(void *);
   void *arg;
   void (*on_finish)(void *);
-} fio_timer_s;
+  /* the timer's position in the heap (or FIO_TIMER_UNLISTED) */
+  size_t pos;
+  uint8_t cancelled;
+};
 
-static fio_ls_embd_s fio_timers = FIO_LS_INIT(fio_timers);
+/* timers are kept in a d-ary min-heap, ordered by their due time */
+static struct {
+  fio_timer_s **ary;
+  size_t count;
+  size_t capa;
+} fio_timers;
 
 static fio_lock_i fio_timer_lock = FIO_LOCK_INIT;
 
@@ -1178,12 +2022,12 @@ static inline void fio_mark_time(void) {
 /** Calculates the due time for a task, given it's interval */
 static struct timespec fio_timer_calc_due(size_t interval) {
   struct timespec now = fio_last_tick();
-  if (interval > 1000) {
+  if (interval >= 1000) {
     now.tv_sec += interval / 1000;
-    interval -= interval / 1000;
+    interval -= (interval / 1000) * 1000;
   }
   now.tv_nsec += (interval * 1000000UL);
-  if (now.tv_nsec > 1000000000L) {
+  if (now.tv_nsec >= 1000000000L) {
     now.tv_nsec -= 1000000000L;
     now.tv_sec += 1;
   }
@@ -1195,12 +2039,18 @@ static struct timespec fio_timer_calc_due(size_t interval) {
 static size_t fio_timer_calc_first_interval(void) {
   if (fio_defer_has_queue())
     return 0;
-  if (fio_ls_embd_is_empty(&fio_timers)) {
+  if (!fio_timers.count) {
     return FIO_POLL_TICK;
   }
   struct timespec now = fio_last_tick();
-  struct timespec due =
-      FIO_LS_EMBD_OBJ(fio_timer_s, node, fio_timers.next)->due;
+  struct timespec due;
+  fio_lock(&fio_timer_lock);
+  if (!fio_timers.count) {
+    fio_unlock(&fio_timer_lock);
+    return FIO_POLL_TICK;
+  }
+  due = fio_timers.ary[0]->due;
+  fio_unlock(&fio_timer_lock);
   if (due.tv_sec < now.tv_sec ||
       (due.tv_sec == now.tv_sec && due.tv_nsec <= now.tv_nsec))
     return 0;
@@ -1229,21 +2079,94 @@ static int fio_timer_compare(struct timespec a, struct timespec b) {
   return -1;
 }
 
-/** Places a timer in an ordered linked list. */
+/* places the timer at `pos` in the heap (updating it's position) */
+static inline void fio_timer_heap_set(size_t pos, fio_timer_s *timer) {
+  fio_timers.ary[pos] = timer;
+  timer->pos = pos;
+}
+
+/* moves a timer up the heap (towards the root) while it's due earlier */
+static void fio_timer_heap_sift_up(size_t pos) {
+  fio_timer_s *timer = fio_timers.ary[pos];
+  while (pos) {
+    const size_t parent = (pos - 1) / FIO_TIMER_HEAP_ARITY;
+    if (fio_timer_compare(timer->due, fio_timers.ary[parent]->due) <= 0)
+      break;
+    fio_timer_heap_set(pos, fio_timers.ary[parent]);
+    pos = parent;
+  }
+  fio_timer_heap_set(pos, timer);
+}
+
+/* moves a timer down the heap while any of it's children is due earlier */
+static void fio_timer_heap_sift_down(size_t pos) {
+  fio_timer_s *timer = fio_timers.ary[pos];
+  for (;;) {
+    size_t child = (pos * FIO_TIMER_HEAP_ARITY) + 1;
+    if (child >= fio_timers.count)
+      break;
+    size_t end = child + FIO_TIMER_HEAP_ARITY;
+    if (end > fio_timers.count)
+      end = fio_timers.count;
+    size_t min = child;
+    for (++child; child < end; ++child) {
+      if (fio_timer_compare(fio_timers.ary[child]->due,
+                            fio_timers.ary[min]->due) > 0)
+        min = child;
+    }
+    if (fio_timer_compare(fio_timers.ary[min]->due, timer->due) <= 0)
+      break;
+    fio_timer_heap_set(pos, fio_timers.ary[min]);
+    pos = min;
+  }
+  fio_timer_heap_set(pos, timer);
+}
+
+/* adds a timer to the heap (call within the lock) */
+static void fio_timer_heap_push(fio_timer_s *timer) {
+  if (fio_timers.count == fio_timers.capa) {
+    size_t capa = fio_timers.capa ? (fio_timers.capa << 1) : 64;
+    fio_timer_s **tmp = realloc(fio_timers.ary, capa * sizeof(*tmp));
+    FIO_ASSERT_ALLOC(tmp);
+    fio_timers.ary = tmp;
+    fio_timers.capa = capa;
+  }
+  fio_timer_heap_set(fio_timers.count++, timer);
+  fio_timer_heap_sift_up(timer->pos);
+}
+
+/* removes a timer from the heap (call within the lock) */
+static void fio_timer_heap_remove(fio_timer_s *timer) {
+  const size_t pos = timer->pos;
+  timer->pos = FIO_TIMER_UNLISTED;
+  if (--fio_timers.count == pos)
+    return;
+  fio_timer_s *last = fio_timers.ary[fio_timers.count];
+  fio_timer_heap_set(pos, last);
+  fio_timer_heap_sift_up(pos);
+  if (last->pos == pos)
+    fio_timer_heap_sift_down(pos);
+}
+
+/** Calls the timer's `on_finish` callback and frees the timer's memory. */
+static void fio_timer_finish(fio_timer_s *timer) {
+  if (timer->on_finish)
+    timer->on_finish(timer->arg);
+  free(timer);
+}
+
+/** Places a timer in the heap, unless it was cancelled. */
 static void fio_timer_add_order(fio_timer_s *timer) {
   timer->due = fio_timer_calc_due(timer->interval);
-  // fio_ls_embd_s *pos = &fio_timers;
   fio_lock(&fio_timer_lock);
-  FIO_LS_EMBD_FOR(&fio_timers, node) {
-    fio_timer_s *t2 = FIO_LS_EMBD_OBJ(fio_timer_s, node, node);
-    if (fio_timer_compare(timer->due, t2->due) >= 0) {
-      fio_ls_embd_push(node, &timer->node);
-      goto finish;
-    }
-  }
-  fio_ls_embd_push(&fio_timers, &timer->node);
-finish:
+  if (timer->cancelled)
+    goto cancelled;
+  fio_timer_heap_push(timer);
+  fio_unlock(&fio_timer_lock);
+  return;
+cancelled:
   fio_unlock(&fio_timer_lock);
+  fio_timer_finish(timer);
 }
 
 /** Performs a timer task and re-adds it to the queue (or cleans it up) */
@@ -1252,9 +2175,7 @@ static void fio_timer_perform_single(void *timer_, void *ignr) {
   timer->task(timer->arg);
   if (!timer->repetitions || fio_atomic_sub(&timer->repetitions, 1))
     goto reschedule;
-  if (timer->on_finish)
-    timer->on_finish(timer->arg);
-  free(timer);
+  fio_timer_finish(timer);
   return;
   (void)ignr;
 reschedule:
@@ -1265,58 +2186,94 @@ reschedule:
 static void fio_timer_schedule(void) {
   struct timespec now = fio_last_tick();
   fio_lock(&fio_timer_lock);
-  while (fio_ls_embd_any(&fio_timers) &&
-         fio_timer_compare(
-             FIO_LS_EMBD_OBJ(fio_timer_s, node, fio_timers.next)->due, now) >=
-             0) {
-    fio_ls_embd_s *tmp = fio_ls_embd_remove(fio_timers.next);
-    fio_defer(fio_timer_perform_single, FIO_LS_EMBD_OBJ(fio_timer_s, node, tmp),
-              NULL);
+  while (fio_timers.count &&
+         fio_timer_compare(fio_timers.ary[0]->due, now) >= 0) {
+    fio_timer_s *timer = fio_timers.ary[0];
+    fio_timer_heap_remove(timer);
+    fio_defer(fio_timer_perform_single, timer, NULL);
   }
   fio_unlock(&fio_timer_lock);
 }
 
 static void fio_timer_clear_all(void) {
   fio_lock(&fio_timer_lock);
-  while (fio_ls_embd_any(&fio_timers)) {
-    fio_timer_s *timer =
-        FIO_LS_EMBD_OBJ(fio_timer_s, node, fio_ls_embd_pop(&fio_timers));
-    if (timer->on_finish)
-      timer->on_finish(timer->arg);
-    free(timer);
-  }
+  while (fio_timers.count) {
+    fio_timer_s *timer = fio_timers.ary[--fio_timers.count];
+    timer->pos = FIO_TIMER_UNLISTED;
+    fio_timer_finish(timer);
+  }
+  free(fio_timers.ary);
+  fio_timers.ary = NULL;
+  fio_timers.capa = 0;
   fio_unlock(&fio_timer_lock);
 }
 
 /**
- * Creates a timer to run a task at the specified interval.
- *
- * The task will repeat `repetitions` times. If `repetitions` is set to 0, task
- * will repeat forever.
- *
- * Returns -1 on error.
+ * Creates a timer to run a task at the specified interval, returning a handle
+ * that can be used to cancel the timer (see `fio_timer_cancel`).
  *
- * The `on_finish` handler is always called (even on error).
+ * Returns NULL on error.
  */
-int fio_run_every(size_t milliseconds, size_t repetitions, void (*task)(void *),
-                  void *arg, void (*on_finish)(void *)) {
+fio_timer_s *fio_run_every_timer(size_t milliseconds, size_t repetitions,
+                                 void (*task)(void *), void *arg,
+                                 void (*on_finish)(void *)) {
   if (!task || (milliseconds == 0 && !repetitions))
-    return -1;
+    return NULL;
   fio_timer_s *timer = malloc(sizeof(*timer));
   FIO_ASSERT_ALLOC(timer);
   fio_mark_time();
   *timer = (fio_timer_s){
-      .due = fio_timer_calc_due(milliseconds),
       .interval = milliseconds,
       .repetitions = repetitions,
       .task = task,
       .arg = arg,
       .on_finish = on_finish,
+      .pos = FIO_TIMER_UNLISTED,
   };
   fio_timer_add_order(timer);
+  return timer;
+}
+
+/**
+ * Creates a timer to run a task at the specified interval.
+ *
+ * The task will repeat `repetitions` times. If `repetitions` is set to 0, task
+ * will repeat forever.
+ *
+ * Returns -1 on error.
+ *
+ * The `on_finish` handler is always called (even on error).
+ */
+int fio_run_every(size_t milliseconds, size_t repetitions, void (*task)(void *),
+                  void *arg, void (*on_finish)(void *)) {
+  if (!fio_run_every_timer(milliseconds, repetitions, task, arg, on_finish))
+    return -1;
   return 0;
 }
 
+/**
+ * Cancels a timer, calling it's `on_finish` callback (if any).
+ *
+ * If the timer's task is currently running, the timer will be cancelled once
+ * the task returns.
+ */
+void fio_timer_cancel(fio_timer_s *timer) {
+  if (!timer)
+    return;
+  fio_lock(&fio_timer_lock);
+  if (timer->cancelled)
+    goto done;
+  timer->cancelled = 1;
+  if (timer->pos == FIO_TIMER_UNLISTED)
+    goto done; /* performing, cleanup once the task returns */
+  fio_timer_heap_remove(timer);
+  fio_unlock(&fio_timer_lock);
+  fio_timer_finish(timer);
+  return;
+done:
+  fio_unlock(&fio_timer_lock);
+}
+
 /* *****************************************************************************
 Section Start Marker
 
@@ -1354,6 +2311,16 @@ static struct sigaction fio_old_sig_term;
 static struct sigaction fio_old_sig_int;
 #if !FIO_DISABLE_HOT_RESTART
 static struct sigaction fio_old_sig_usr1;
+static struct sigaction fio_old_sig_usr2;
+/* binary upgrade support (SIGUSR2), see `fio_upgrade` */
+static void fio_upgrade_signal(void);
+static void fio_upgrade_init(void);
+static void fio_upgrade_review(void);
+static void fio_upgrade_ready(void);
+#else
+#define fio_upgrade_init()
+#define fio_upgrade_review()
+#define fio_upgrade_ready()
 #endif
 
 /*
@@ -1396,6 +2363,10 @@ static void sig_int_handler(int sig) {
     fio_signal_children_flag = 1;
     old = &fio_old_sig_usr1;
     break;
+  case SIGUSR2:
+    fio_upgrade_signal();
+    old = &fio_old_sig_usr2;
+    break;
 #endif
   case SIGINT: /* fallthrough */
     if (!old)
@@ -1443,6 +2414,10 @@ static void fio_signal_handler_setup(void) {
     perror("couldn't set signal handler");
     return;
   };
+  if (sigaction(SIGUSR2, &act, &fio_old_sig_usr2)) {
+    perror("couldn't set signal handler");
+    return;
+  };
 #endif
 
   act.sa_handler = SIG_IGN;
@@ -1465,6 +2440,8 @@ void fio_signal_handler_reset(void) {
 #if !FIO_DISABLE_HOT_RESTART
   sigaction(SIGUSR1, &fio_old_sig_usr1, &old);
   memset(&fio_old_sig_usr1, 0, sizeof(fio_old_sig_usr1));
+  sigaction(SIGUSR2, &fio_old_sig_usr2, &old);
+  memset(&fio_old_sig_usr2, 0, sizeof(fio_old_sig_usr2));
 #endif
   memset(&fio_old_sig_int, 0, sizeof(fio_old_sig_int));
   memset(&fio_old_sig_term, 0, sizeof(fio_old_sig_term));
@@ -1625,15 +2602,20 @@ Section Start Marker
 /**
  * Returns a C string detailing the IO engine selected during compilation.
  *
- * Valid values are "kqueue", "epoll" and "poll".
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
  */
 char const *fio_engine(void) { return "epoll"; }
 
-/* epoll tester, in and out */
-static int evio_fd[3] = {-1, -1, -1};
+/* epoll tester, in and out - one set of 3 per reactor shard */
+static int evio_fd_static[3] = {-1, -1, -1};
+static int *evio_fd = evio_fd_static;
+static size_t evio_shards = 1;
+
+/* the epoll set (of 3) that manages the fd, selected as `fd % shards` */
+#define evio_fd4(fd) (evio_fd + (((uintptr_t)(fd) % evio_shards) * 3))
 
 static void fio_poll_close(void) {
-  for (int i = 0; i < 3; ++i) {
+  for (size_t i = 0; i < (evio_shards * 3); ++i) {
     if (evio_fd[i] != -1) {
       close(evio_fd[i]);
       evio_fd[i] = -1;
@@ -1643,18 +2625,21 @@ static void fio_poll_close(void) {
 
 static void fio_poll_init(void) {
   fio_poll_close();
-  for (int i = 0; i < 3; ++i) {
-    evio_fd[i] = epoll_create1(EPOLL_CLOEXEC);
-    if (evio_fd[i] == -1)
-      goto error;
-  }
-  for (int i = 1; i < 3; ++i) {
-    struct epoll_event chevent = {
-        .events = (EPOLLOUT | EPOLLIN),
-        .data.fd = evio_fd[i],
-    };
-    if (epoll_ctl(evio_fd[0], EPOLL_CTL_ADD, evio_fd[i], &chevent) == -1)
-      goto error;
+  for (size_t s = 0; s < evio_shards; ++s) {
+    int *ev = evio_fd + (s * 3);
+    for (int i = 0; i < 3; ++i) {
+      ev[i] = epoll_create1(EPOLL_CLOEXEC);
+      if (ev[i] == -1)
+        goto error;
+    }
+    for (int i = 1; i < 3; ++i) {
+      struct epoll_event chevent = {
+          .events = (EPOLLOUT | EPOLLIN),
+          .data.fd = ev[i],
+      };
+      if (epoll_ctl(ev[0], EPOLL_CTL_ADD, ev[i], &chevent) == -1)
+        goto error;
+    }
   }
   return;
 error:
@@ -1689,38 +2674,78 @@ static inline int fio_poll_add2(int fd, uint32_t events, int ep_fd) {
 
 static inline void fio_poll_add_read(intptr_t fd) {
   fio_poll_add2(fd, (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLONESHOT),
-                evio_fd[1]);
+                evio_fd4(fd)[1]);
   return;
 }
 
 static inline void fio_poll_add_write(intptr_t fd) {
   fio_poll_add2(fd, (EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLONESHOT),
-                evio_fd[2]);
+                evio_fd4(fd)[2]);
   return;
 }
 
 static inline void fio_poll_add(intptr_t fd) {
   if (fio_poll_add2(fd, (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLONESHOT),
-                    evio_fd[1]) == -1)
+                    evio_fd4(fd)[1]) == -1)
     return;
   fio_poll_add2(fd, (EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLONESHOT),
-                evio_fd[2]);
+                evio_fd4(fd)[2]);
   return;
 }
 
+#if FIO_ZEROCOPY
+static int fio_sock_zerocopy_on_error(int fd);
+#endif
+
 FIO_FUNC inline void fio_poll_remove_fd(intptr_t fd) {
   struct epoll_event chevent = {.events = (EPOLLOUT | EPOLLIN), .data.fd = fd};
-  epoll_ctl(evio_fd[1], EPOLL_CTL_DEL, fd, &chevent);
-  epoll_ctl(evio_fd[2], EPOLL_CTL_DEL, fd, &chevent);
+  epoll_ctl(evio_fd4(fd)[1], EPOLL_CTL_DEL, fd, &chevent);
+  epoll_ctl(evio_fd4(fd)[2], EPOLL_CTL_DEL, fd, &chevent);
 }
 
-static size_t fio_poll(void) {
-  int timeout_millisec = fio_timer_calc_first_interval();
+/**
+ * Sets the number of reactor shards, re-registering any polled connection with
+ * it's new shard.
+ *
+ * Must be called before any thread is polling (shards aren't thread safe).
+ */
+static void fio_poll_shards_set(size_t count) {
+  if (!count)
+    count = 1;
+  if (count == evio_shards)
+    return;
+  fio_poll_close();
+  if (evio_fd != evio_fd_static)
+    free(evio_fd);
+  evio_fd = evio_fd_static;
+  if (count > 1) {
+    evio_fd = malloc(sizeof(*evio_fd) * 3 * count);
+    FIO_ASSERT_ALLOC(evio_fd);
+    for (size_t i = 0; i < 3 * count; ++i)
+      evio_fd[i] = -1;
+  }
+  evio_shards = count;
+  fio_poll_init();
+  for (uintptr_t i = 0; i <= fio_data->max_protocol_fd; ++i) {
+    if (fd_data(i).open && (fd_data(i).protocol || fd_data(i).packet))
+      fio_poll_add(i);
+  }
+}
+
+/**
+ * Polls a single reactor shard.
+ *
+ * When the reactor is sharded, events are handled inline by the polling thread
+ * (the shard owns the connection), otherwise they are scheduled using the task
+ * queue.
+ */
+static size_t fio_poll_shard(size_t shard, int timeout_millisec) {
+  int *ev = evio_fd + (shard * 3);
   struct epoll_event internal[2];
   struct epoll_event events[FIO_POLL_MAX_EVENTS];
   int total = 0;
   /* wait for events and handle them */
-  int internal_count = epoll_wait(evio_fd[0], internal, 2, timeout_millisec);
+  int internal_count = epoll_wait(ev[0], internal, 2, timeout_millisec);
   if (internal_count == 0)
     return internal_count;
   for (int j = 0; j < internal_count; ++j) {
@@ -1728,9 +2753,36 @@ static size_t fio_poll(void) {
         epoll_wait(internal[j].data.fd, events, FIO_POLL_MAX_EVENTS, 0);
     if (active_count > 0) {
       for (int i = 0; i < active_count; i++) {
+#if FIO_ZEROCOPY
+        if ((events[i].events & (~(EPOLLIN | EPOLLOUT))) == EPOLLERR &&
+            !fio_sock_zerocopy_on_error(events[i].data.fd)) {
+          // MSG_ZEROCOPY completion notifications, not an actual error
+          const int fd = events[i].data.fd;
+          if (fd_data(fd).close && !fd_data(fd).packet &&
+              !fd_cold(fd).zc_pending) {
+            fio_force_close_in_poll(fd2uuid(fd));
+            continue;
+          }
+          if (internal[j].data.fd == ev[1] && !(events[i].events & EPOLLIN))
+            fio_poll_add_read(fd);
+          if (internal[j].data.fd == ev[2] && !(events[i].events & EPOLLOUT))
+            fio_poll_add_write(fd);
+          events[i].events &= ~EPOLLERR;
+        }
+#endif
+        if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) ==
+            (EPOLLIN | EPOLLRDHUP))
+          // read the peer's final data first, `fio_read` closes on EOF
+          events[i].events &= ~EPOLLRDHUP;
         if (events[i].events & (~(EPOLLIN | EPOLLOUT))) {
           // errors are hendled as disconnections (on_close)
           fio_force_close_in_poll(fd2uuid(events[i].data.fd));
+        } else if (evio_shards > 1) {
+          // sharded reactor, the shard's thread handles the event(s)
+          if (events[i].events & EPOLLOUT)
+            deferred_on_ready((void *)fd2uuid(events[i].data.fd), NULL);
+          if (events[i].events & EPOLLIN)
+            deferred_on_data((void *)fd2uuid(events[i].data.fd), NULL);
         } else {
           // no error, then it's an active event(s)
           if (events[i].events & EPOLLOUT) {
@@ -1748,6 +2800,10 @@ static size_t fio_poll(void) {
   return total;
 }
 
+static size_t fio_poll(void) {
+  return fio_poll_shard(0, fio_timer_calc_first_interval());
+}
+
 #endif
 /* *****************************************************************************
 Section Start Marker
@@ -1764,7 +2820,7 @@ Section Start Marker
 
 
 
-                       Polling State Machine - kqueue
+                       Polling State Machine - io_uring
 
 
 
@@ -1780,100 +2836,427 @@ Section Start Marker
 
 
 ***************************************************************************** */
-#if FIO_ENGINE_KQUEUE
-#include <sys/event.h>
+#if FIO_ENGINE_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
 
 /**
  * Returns a C string detailing the IO engine selected during compilation.
  *
- * Valid values are "kqueue", "epoll" and "poll".
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
  */
-char const *fio_engine(void) { return "kqueue"; }
+char const *fio_engine(void) { return "io_uring"; }
 
-static int evio_fd = -1;
+/*
+ * The io_uring engine is a readiness engine, same as epoll / kqueue, so the
+ * rw_hooks (i.e., TLS) keep performing the actual IO.
+ *
+ * One-shot `IORING_OP_POLL_ADD` requests replace EPOLLONESHOT registrations.
+ * Requests are queued in the submission ring and submitted in a single
+ * `io_uring_enter` call per cycle, unless the polling thread is waiting for
+ * events, in which case the requests are submitted immediately.
+ *
+ * The `user_data` field stores the fd, the fd's `counter` and the direction,
+ * so completions for a closed (or reused) fd are ignored.
+ */
 
-static void fio_poll_close(void) { close(evio_fd); }
+#define FIO_URING_REMOVE_UDATA (~(uint64_t)0)
+#define FIO_URING_UDATA(fd, write)                                             \
+  (((uint64_t)(fd) << 16) | ((uint64_t)fd_data((fd)).counter << 1) |           \
+   ((write) & 1))
+
+static struct {
+  int fd;
+  /* submission ring */
+  void *sq_map;
+  size_t sq_map_len;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned sq_local_tail;
+  /* completion ring */
+  void *cq_map;
+  size_t cq_map_len;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  /* set while the polling thread is blocking in io_uring_enter */
+  uint8_t volatile waiting;
+  fio_lock_i lock;
+} fio_uring = {.fd = -1, .lock = FIO_LOCK_INIT};
+
+static inline int fio_uring_enter(unsigned to_submit, unsigned min_complete,
+                                  unsigned flags, void *arg, size_t arg_len) {
+  return (int)syscall(__NR_io_uring_enter, fio_uring.fd, to_submit,
+                      min_complete, flags, arg, arg_len);
+}
+
+/* returns the number of queued SQEs the kernel didn't consume yet */
+static inline unsigned fio_uring_pending_unsafe(void) {
+  return fio_uring.sq_local_tail -
+         __atomic_load_n(fio_uring.sq_head, __ATOMIC_ACQUIRE);
+}
+
+static void fio_poll_close(void) {
+  if (fio_uring.sqes)
+    munmap(fio_uring.sqes, fio_uring.sqes_len);
+  if (fio_uring.cq_map && fio_uring.cq_map != fio_uring.sq_map)
+    munmap(fio_uring.cq_map, fio_uring.cq_map_len);
+  if (fio_uring.sq_map)
+    munmap(fio_uring.sq_map, fio_uring.sq_map_len);
+  if (fio_uring.fd != -1)
+    close(fio_uring.fd);
+  fio_uring.sqes = NULL;
+  fio_uring.cq_map = NULL;
+  fio_uring.sq_map = NULL;
+  fio_uring.fd = -1;
+  fio_uring.sq_local_tail = 0;
+  fio_uring.waiting = 0;
+  fio_uring.lock = FIO_LOCK_INIT;
+}
 
 static void fio_poll_init(void) {
+  struct io_uring_params params;
   fio_poll_close();
-  evio_fd = kqueue();
-  if (evio_fd == -1) {
-    FIO_LOG_FATAL("couldn't open kqueue.\n");
-    exit(errno);
+  memset(&params, 0, sizeof(params));
+  fio_uring.fd =
+      (int)syscall(__NR_io_uring_setup, FIO_URING_ENTRIES, &params);
+  if (fio_uring.fd == -1)
+    goto error;
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    FIO_LOG_FATAL("io_uring engine requires IORING_FEAT_EXT_ARG (Linux 5.11).");
+    errno = ENOSYS;
+    goto error;
+  }
+  fcntl(fio_uring.fd, F_SETFD, FD_CLOEXEC);
+  fio_uring.sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  fio_uring.cq_map_len =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) &&
+      fio_uring.cq_map_len > fio_uring.sq_map_len)
+    fio_uring.sq_map_len = fio_uring.cq_map_len;
+  fio_uring.sq_map =
+      mmap(NULL, fio_uring.sq_map_len, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, fio_uring.fd, IORING_OFF_SQ_RING);
+  if (fio_uring.sq_map == MAP_FAILED) {
+    fio_uring.sq_map = NULL;
+    goto error;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    fio_uring.cq_map = fio_uring.sq_map;
+  } else {
+    fio_uring.cq_map =
+        mmap(NULL, fio_uring.cq_map_len, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fio_uring.fd, IORING_OFF_CQ_RING);
+    if (fio_uring.cq_map == MAP_FAILED) {
+      fio_uring.cq_map = NULL;
+      goto error;
+    }
+  }
+  fio_uring.sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  fio_uring.sqes =
+      mmap(NULL, fio_uring.sqes_len, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, fio_uring.fd, IORING_OFF_SQES);
+  if (fio_uring.sqes == MAP_FAILED) {
+    fio_uring.sqes = NULL;
+    goto error;
+  }
+  fio_uring.sq_head =
+      (unsigned *)((uintptr_t)fio_uring.sq_map + params.sq_off.head);
+  fio_uring.sq_tail =
+      (unsigned *)((uintptr_t)fio_uring.sq_map + params.sq_off.tail);
+  fio_uring.sq_mask =
+      (unsigned *)((uintptr_t)fio_uring.sq_map + params.sq_off.ring_mask);
+  fio_uring.sq_array =
+      (unsigned *)((uintptr_t)fio_uring.sq_map + params.sq_off.array);
+  fio_uring.cq_head =
+      (unsigned *)((uintptr_t)fio_uring.cq_map + params.cq_off.head);
+  fio_uring.cq_tail =
+      (unsigned *)((uintptr_t)fio_uring.cq_map + params.cq_off.tail);
+  fio_uring.cq_mask =
+      (unsigned *)((uintptr_t)fio_uring.cq_map + params.cq_off.ring_mask);
+  fio_uring.cqes = (struct io_uring_cqe *)((uintptr_t)fio_uring.cq_map +
+                                           params.cq_off.cqes);
+  fio_uring.sq_local_tail = *fio_uring.sq_tail;
+  return;
+error:
+  FIO_LOG_FATAL("couldn't initialize io_uring.");
+  fio_poll_close();
+  exit(errno);
+}
+
+/* queues a single SQE, flushing the ring if it's full. Call within lock. */
+static void fio_uring_push_unsafe(uint8_t opcode, int fd, uint32_t events,
+                                  uint64_t addr, uint64_t udata) {
+  if (fio_uring_pending_unsafe() > *fio_uring.sq_mask) {
+    /* ring is full - submit what we have */
+    while (fio_uring_enter(fio_uring_pending_unsafe(), 0, 0, NULL, 0) == -1 &&
+           (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+      ;
   }
+  const unsigned index = fio_uring.sq_local_tail & *fio_uring.sq_mask;
+  struct io_uring_sqe *sqe = fio_uring.sqes + index;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = addr;
+#if __BIG_ENDIAN__
+  sqe->poll32_events = (events << 16) | (events >> 16);
+#else
+  sqe->poll32_events = events;
+#endif
+  sqe->user_data = udata;
+  fio_uring.sq_array[index] = index;
+  ++fio_uring.sq_local_tail;
+  __atomic_store_n(fio_uring.sq_tail, fio_uring.sq_local_tail,
+                   __ATOMIC_RELEASE);
+}
+
+/* a waiting poller won't see new requests unless they're submitted now */
+static inline void fio_uring_submit_if_waiting_unsafe(void) {
+  if (!fio_uring.waiting)
+    return;
+  while (fio_uring_enter(fio_uring_pending_unsafe(), 0, 0, NULL, 0) == -1 &&
+         errno == EINTR)
+    ;
+}
+
+static inline void fio_poll_add2(intptr_t fd, uint8_t flag, uint32_t events) {
+  if (fio_uring.fd == -1)
+    return;
+  fio_lock(&fio_uring.lock);
+  if (fd_data(fd).polled & flag)
+    goto finish;
+  fd_data(fd).polled |= flag;
+  fio_uring_push_unsafe(IORING_OP_POLL_ADD, (int)fd, events, 0,
+                        FIO_URING_UDATA(fd, (flag >> 1)));
+  fio_uring_submit_if_waiting_unsafe();
+finish:
+  fio_unlock(&fio_uring.lock);
 }
 
 static inline void fio_poll_add_read(intptr_t fd) {
-  struct kevent chevent[1];
-  EV_SET(chevent, fd, EVFILT_READ, EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT,
-         0, 0, ((void *)fd));
-  do {
-    errno = 0;
-    kevent(evio_fd, chevent, 1, NULL, 0, NULL);
-  } while (errno == EINTR);
-  return;
+  fio_poll_add2(fd, 1, (POLLIN | POLLRDHUP | POLLHUP));
 }
 
 static inline void fio_poll_add_write(intptr_t fd) {
-  struct kevent chevent[1];
-  EV_SET(chevent, fd, EVFILT_WRITE, EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT,
-         0, 0, ((void *)fd));
-  do {
-    errno = 0;
-    kevent(evio_fd, chevent, 1, NULL, 0, NULL);
-  } while (errno == EINTR);
-  return;
+  fio_poll_add2(fd, 2, (POLLOUT | POLLRDHUP | POLLHUP));
 }
 
 static inline void fio_poll_add(intptr_t fd) {
-  struct kevent chevent[2];
-  EV_SET(chevent, fd, EVFILT_READ, EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT,
-         0, 0, ((void *)fd));
-  EV_SET(chevent + 1, fd, EVFILT_WRITE,
-         EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT, 0, 0, ((void *)fd));
-  do {
-    errno = 0;
-    kevent(evio_fd, chevent, 2, NULL, 0, NULL);
-  } while (errno == EINTR);
-  return;
+  fio_poll_add_read(fd);
+  fio_poll_add_write(fd);
 }
 
-FIO_FUNC inline void fio_poll_remove_fd(intptr_t fd) {
-  if (evio_fd < 0)
+static void fio_poll_remove_fd(intptr_t fd) {
+  if (fio_uring.fd == -1)
     return;
-  struct kevent chevent[2];
-  EV_SET(chevent, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-  EV_SET(chevent + 1, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
-  do {
-    errno = 0;
-    kevent(evio_fd, chevent, 2, NULL, 0, NULL);
-  } while (errno == EINTR);
+  fio_lock(&fio_uring.lock);
+  if (fd_data(fd).polled & 1)
+    fio_uring_push_unsafe(IORING_OP_POLL_REMOVE, -1, 0, FIO_URING_UDATA(fd, 0),
+                          FIO_URING_REMOVE_UDATA);
+  if (fd_data(fd).polled & 2)
+    fio_uring_push_unsafe(IORING_OP_POLL_REMOVE, -1, 0, FIO_URING_UDATA(fd, 1),
+                          FIO_URING_REMOVE_UDATA);
+  fd_data(fd).polled = 0;
+  /* cancellation must reach the kernel before the fd is closed */
+  while (fio_uring_enter(fio_uring_pending_unsafe(), 0, 0, NULL, 0) == -1 &&
+         errno == EINTR)
+    ;
+  fio_unlock(&fio_uring.lock);
 }
 
 static size_t fio_poll(void) {
-  if (evio_fd < 0)
+  if (fio_uring.fd == -1)
     return -1;
   int timeout_millisec = fio_timer_calc_first_interval();
-  struct kevent events[FIO_POLL_MAX_EVENTS] = {{0}};
-
-  const struct timespec timeout = {
+  struct __kernel_timespec timeout = {
       .tv_sec = (timeout_millisec / 1000),
-      .tv_nsec = ((timeout_millisec & (~1023UL)) * 1000000)};
-  /* wait for events and handle them */
-  int active_count =
-      kevent(evio_fd, NULL, 0, events, FIO_POLL_MAX_EVENTS, &timeout);
+      .tv_nsec = ((timeout_millisec % 1000) * 1000000L)};
+  struct io_uring_getevents_arg arg = {.ts = (uint64_t)(uintptr_t)&timeout};
+  size_t total = 0;
+  unsigned to_submit;
+
+  /* submit queued requests and wait for events in a single system call */
+  fio_lock(&fio_uring.lock);
+  to_submit = fio_uring_pending_unsafe();
+  fio_uring.waiting = 1;
+  fio_unlock(&fio_uring.lock);
+  int ret = fio_uring_enter(to_submit, 1,
+                            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                            sizeof(arg));
+  fio_uring.waiting = 0;
+  if (ret == -1 && errno != ETIME && errno != EINTR && errno != EBUSY)
+    return -1;
 
-  if (active_count > 0) {
-    for (int i = 0; i < active_count; i++) {
-      // test for event(s) type
-      if (events[i].filter == EVFILT_WRITE) {
-        fio_defer_push_urgent(deferred_on_ready,
-                              ((void *)fd2uuid(events[i].udata)), NULL);
-      } else if (events[i].filter == EVFILT_READ) {
+  unsigned head = *fio_uring.cq_head;
+  const unsigned tail = __atomic_load_n(fio_uring.cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    struct io_uring_cqe *cqe = fio_uring.cqes + (head & *fio_uring.cq_mask);
+    const uint64_t udata = cqe->user_data;
+    int32_t res = cqe->res;
+    if (udata == FIO_URING_REMOVE_UDATA)
+      continue;
+    const intptr_t fd = (intptr_t)(udata >> 16);
+    const uint8_t write = udata & 1;
+    if ((size_t)fd >= fio_data->capa ||
+        ((udata >> 1) & 0xFF) != fd_data(fd).counter || res == -ECANCELED)
+      continue; /* stale (closed / reused fd) or cancelled request */
+    fio_lock(&fio_uring.lock);
+    fd_data(fd).polled &= ~(1 << write);
+    fio_unlock(&fio_uring.lock);
+    ++total;
+    if (!write && res > 0 &&
+        (res & (POLLIN | POLLRDHUP | POLLERR | POLLHUP)) ==
+            (POLLIN | POLLRDHUP))
+      // read the peer's final data first, `fio_read` closes on EOF
+      res &= ~POLLRDHUP;
+    if (res < 0 || (res & (~(POLLIN | POLLOUT)))) {
+      // errors are hendled as disconnections (on_close)
+      fio_force_close_in_poll(fd2uuid(fd));
+    } else if (write) {
+      fio_defer_push_urgent(deferred_on_ready, (void *)fd2uuid(fd), NULL);
+    } else {
+      fio_defer_push_task(deferred_on_data, (void *)fd2uuid(fd), NULL);
+    }
+  }
+  __atomic_store_n(fio_uring.cq_head, head, __ATOMIC_RELEASE);
+  return total;
+}
+
+#endif /* FIO_ENGINE_URING */
+/* *****************************************************************************
+Section Start Marker
+
+
+
+
+
+
+
+
+
+
+
+
+
+                       Polling State Machine - kqueue
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+***************************************************************************** */
+#if FIO_ENGINE_KQUEUE
+#include <sys/event.h>
+
+/**
+ * Returns a C string detailing the IO engine selected during compilation.
+ *
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
+ */
+char const *fio_engine(void) { return "kqueue"; }
+
+static int evio_fd = -1;
+
+static void fio_poll_close(void) { close(evio_fd); }
+
+static void fio_poll_init(void) {
+  fio_poll_close();
+  evio_fd = kqueue();
+  if (evio_fd == -1) {
+    FIO_LOG_FATAL("couldn't open kqueue.\n");
+    exit(errno);
+  }
+}
+
+static inline void fio_poll_add_read(intptr_t fd) {
+  struct kevent chevent[1];
+  EV_SET(chevent, fd, EVFILT_READ, EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT,
+         0, 0, ((void *)fd));
+  do {
+    errno = 0;
+    kevent(evio_fd, chevent, 1, NULL, 0, NULL);
+  } while (errno == EINTR);
+  return;
+}
+
+static inline void fio_poll_add_write(intptr_t fd) {
+  struct kevent chevent[1];
+  EV_SET(chevent, fd, EVFILT_WRITE, EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT,
+         0, 0, ((void *)fd));
+  do {
+    errno = 0;
+    kevent(evio_fd, chevent, 1, NULL, 0, NULL);
+  } while (errno == EINTR);
+  return;
+}
+
+static inline void fio_poll_add(intptr_t fd) {
+  struct kevent chevent[2];
+  EV_SET(chevent, fd, EVFILT_READ, EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT,
+         0, 0, ((void *)fd));
+  EV_SET(chevent + 1, fd, EVFILT_WRITE,
+         EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT, 0, 0, ((void *)fd));
+  do {
+    errno = 0;
+    kevent(evio_fd, chevent, 2, NULL, 0, NULL);
+  } while (errno == EINTR);
+  return;
+}
+
+FIO_FUNC inline void fio_poll_remove_fd(intptr_t fd) {
+  if (evio_fd < 0)
+    return;
+  struct kevent chevent[2];
+  EV_SET(chevent, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  EV_SET(chevent + 1, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+  do {
+    errno = 0;
+    kevent(evio_fd, chevent, 2, NULL, 0, NULL);
+  } while (errno == EINTR);
+}
+
+static size_t fio_poll(void) {
+  if (evio_fd < 0)
+    return -1;
+  int timeout_millisec = fio_timer_calc_first_interval();
+  struct kevent events[FIO_POLL_MAX_EVENTS] = {{0}};
+
+  const struct timespec timeout = {
+      .tv_sec = (timeout_millisec / 1000),
+      .tv_nsec = ((timeout_millisec & (~1023UL)) * 1000000)};
+  /* wait for events and handle them */
+  int active_count =
+      kevent(evio_fd, NULL, 0, events, FIO_POLL_MAX_EVENTS, &timeout);
+
+  if (active_count > 0) {
+    for (int i = 0; i < active_count; i++) {
+      // test for event(s) type
+      if (events[i].filter == EVFILT_WRITE) {
+        fio_defer_push_urgent(deferred_on_ready,
+                              ((void *)fd2uuid(events[i].udata)), NULL);
+      } else if (events[i].filter == EVFILT_READ) {
         fio_defer_push_task(deferred_on_data, (void *)fd2uuid(events[i].udata),
                             NULL);
       }
-      if (events[i].flags & (EV_EOF | EV_ERROR)) {
+      if ((events[i].flags & EV_ERROR) ||
+          ((events[i].flags & EV_EOF) &&
+           (events[i].filter != EVFILT_READ || !events[i].data))) {
+        // unread data is read first, `fio_read` closes on EOF
         fio_force_close_in_poll(fd2uuid(events[i].udata));
       }
     }
@@ -1923,7 +3306,7 @@ Section Start Marker
 /**
  * Returns a C string detailing the IO engine selected during compilation.
  *
- * Valid values are "kqueue", "epoll" and "poll".
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
  */
 char const *fio_engine(void) { return "poll"; }
 
@@ -1977,7 +3360,7 @@ static inline void fio_poll_remove_write(int fd) {
 /** returns non-zero if events were scheduled, 0 if idle */
 static size_t fio_poll(void) {
   /* shrink fd poll range */
-  size_t end = fio_data->capa; // max_protocol_fd might break TLS
+  size_t end = fio_data->fd_commit; // max_protocol_fd might break TLS
   size_t start = 0;
   struct pollfd *list = NULL;
   fio_lock(&fio_data->lock);
@@ -2102,7 +3485,7 @@ static void mock_ping2(intptr_t uuid, fio_protocol_s *protocol) {
   if (uuid_data(uuid).timeout == 255)
     return;
   protocol->ping = mock_ping;
-  uuid_data(uuid).timeout = 8;
+  fio_timeout_set_fd(fio_uuid2fd(uuid), 8);
   fio_close(uuid);
 }
 
@@ -2139,16 +3522,16 @@ static void deferred_on_shutdown(void *arg, void *arg2) {
   uint8_t r = pr->on_shutdown ? pr->on_shutdown((intptr_t)arg, pr) : 0;
   if (r) {
     if (r == 255) {
-      uuid_data(arg).timeout = 0;
+      fio_timeout_set_fd(fio_uuid2fd(arg), 0);
     } else {
       fio_atomic_add(&fio_data->connection_count, 1);
-      uuid_data(arg).timeout = r;
+      fio_timeout_set_fd(fio_uuid2fd(arg), r);
     }
     pr->ping = mock_ping2;
     protocol_unlock(pr, FIO_PR_LOCK_TASK);
   } else {
     fio_atomic_add(&fio_data->connection_count, 1);
-    uuid_data(arg).timeout = 8;
+    fio_timeout_set_fd(fio_uuid2fd(arg), 8);
     pr->ping = mock_ping;
     protocol_unlock(pr, FIO_PR_LOCK_TASK);
     fio_close((intptr_t)arg);
@@ -2228,6 +3611,28 @@ no_protocol:
   return;
 }
 
+static void deferred_on_backpressure(void *arg, void *arg2) {
+  errno = 0;
+  fio_protocol_s *pr = protocol_try_lock(fio_uuid2fd(arg), FIO_PR_LOCK_WRITE);
+  if (!pr) {
+    if (errno == EBADF)
+      return;
+    goto postpone;
+  }
+  /* report the current state (events might be reordered or coalesced) */
+  const uint8_t state = uuid_cold(arg).backpressure;
+  if (state != uuid_cold(arg).backpressure_reported) {
+    uuid_cold(arg).backpressure_reported = state;
+    if (pr->on_backpressure)
+      pr->on_backpressure((intptr_t)arg, pr, state);
+  }
+  protocol_unlock(pr, FIO_PR_LOCK_WRITE);
+  return;
+postpone:
+  fio_defer_push_task(deferred_on_backpressure, arg, NULL);
+  (void)arg2;
+}
+
 static void deferred_ping(void *arg, void *arg2) {
   if (!uuid_data(arg).protocol ||
       (uuid_data(arg).timeout &&
@@ -2304,6 +3709,147 @@ Section Start Marker
 
 ***************************************************************************** */
 
+/* *****************************************************************************
+Client address resolution (cached)
+***************************************************************************** */
+
+#ifndef FIO_DNS_CACHE_TTL
+/**
+ * The number of seconds a resolved host name is cached for client connections.
+ *
+ * `getaddrinfo` doesn't report the record's TTL, so a fixed TTL is used.
+ */
+#define FIO_DNS_CACHE_TTL 60
+#endif
+
+#ifndef FIO_DNS_CACHE_LIMIT
+/** The maximal number of cached host names (the cache is reset when full). */
+#define FIO_DNS_CACHE_LIMIT 256
+#endif
+
+/* a resolved (client) address */
+typedef struct {
+  struct sockaddr_storage addr;
+  socklen_t len;
+  int family;
+  int socktype;
+  int protocol;
+} fio_dns_addr_s;
+
+/* a cache entry, keyed by "address:port" */
+typedef struct {
+  fio_dns_addr_s addr;
+  time_t expires;
+  size_t key_len;
+  char key[256];
+} fio_dns_entry_s;
+
+#define FIO_SET_NAME fio_dns_cache
+#define FIO_SET_OBJ_TYPE fio_dns_entry_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2)                                            \
+  ((o1)->key_len == (o2)->key_len &&                                           \
+   !memcmp((o1)->key, (o2)->key, (o1)->key_len))
+#define FIO_SET_OBJ_DESTROY(o) fio_free((o))
+#include <fio.h>
+
+static fio_dns_cache_s fio_dns_cache = FIO_SET_INIT;
+static fio_lock_i fio_dns_cache_lock = FIO_LOCK_INIT;
+
+/* sets the entry's key, returning -1 if the key is too long (not cached) */
+static int fio_dns_key(fio_dns_entry_s *e, const char *address,
+                       const char *port) {
+  const size_t a_len = strlen(address);
+  const size_t p_len = strlen(port);
+  if (a_len + p_len + 1 >= sizeof(e->key))
+    return -1;
+  memcpy(e->key, address, a_len);
+  e->key[a_len] = ':';
+  memcpy(e->key + a_len + 1, port, p_len + 1);
+  e->key_len = a_len + p_len + 1;
+  return 0;
+}
+
+static inline uint64_t fio_dns_hash(fio_dns_entry_s *e) {
+  return FIO_HASH_FALLBACK_FN(e->key, e->key_len);
+}
+
+static void fio_dns_addr_cpy(fio_dns_addr_s *dest, struct addrinfo *ai) {
+  memcpy(&dest->addr, ai->ai_addr, ai->ai_addrlen);
+  dest->len = ai->ai_addrlen;
+  dest->family = ai->ai_family;
+  dest->socktype = ai->ai_socktype;
+  dest->protocol = ai->ai_protocol;
+}
+
+/**
+ * Resolves numerical addresses and cached host names, never blocking.
+ *
+ * Returns 0 on success and -1 if the host name must be resolved.
+ */
+static int fio_dns_lookup(fio_dns_addr_s *dest, const char *address,
+                          const char *port) {
+  struct addrinfo hints = {
+      .ai_family = AF_UNSPEC,
+      .ai_socktype = SOCK_STREAM,
+      .ai_flags = AI_NUMERICHOST | AI_NUMERICSERV,
+  };
+  struct addrinfo *addrinfo;
+  if (!getaddrinfo(address, port, &hints, &addrinfo)) {
+    fio_dns_addr_cpy(dest, addrinfo);
+    freeaddrinfo(addrinfo);
+    return 0;
+  }
+  fio_dns_entry_s tmp;
+  if (!address || fio_dns_key(&tmp, address, port))
+    return -1;
+  int ret = -1;
+  const uint64_t hash = fio_dns_hash(&tmp);
+  fio_lock(&fio_dns_cache_lock);
+  fio_dns_entry_s *e = fio_dns_cache_find(&fio_dns_cache, hash, &tmp);
+  if (e && e->expires < fio_last_tick().tv_sec) {
+    fio_dns_cache_remove(&fio_dns_cache, hash, e, NULL);
+  } else if (e) {
+    *dest = e->addr;
+    ret = 0;
+  }
+  fio_unlock(&fio_dns_cache_lock);
+  return ret;
+}
+
+/**
+ * Resolves (and caches) the address. This might block while the host name is
+ * resolved, so `fio_connect` performs it on a resolver thread.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+static int fio_dns_resolve(fio_dns_addr_s *dest, const char *address,
+                           const char *port) {
+  if (!fio_dns_lookup(dest, address, port))
+    return 0;
+  struct addrinfo hints = {
+      .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM,
+  };
+  struct addrinfo *addrinfo;
+  if (getaddrinfo(address, port, &hints, &addrinfo))
+    return -1;
+  fio_dns_addr_cpy(dest, addrinfo);
+  freeaddrinfo(addrinfo);
+  fio_dns_entry_s *e = fio_malloc(sizeof(*e));
+  FIO_ASSERT_ALLOC(e);
+  if (fio_dns_key(e, address, port)) {
+    fio_free(e);
+    return 0;
+  }
+  e->addr = *dest;
+  e->expires = fio_last_tick().tv_sec + FIO_DNS_CACHE_TTL;
+  fio_lock(&fio_dns_cache_lock);
+  if (fio_dns_cache_count(&fio_dns_cache) >= FIO_DNS_CACHE_LIMIT)
+    fio_dns_cache_free(&fio_dns_cache);
+  fio_dns_cache_overwrite(&fio_dns_cache, fio_dns_hash(e), e, NULL);
+  fio_unlock(&fio_dns_cache_lock);
+  return 0;
+}
+
 /* *****************************************************************************
 Internal socket initialization functions
 ***************************************************************************** */
@@ -2341,13 +3887,87 @@ static void fio_tcp_addr_cpy(int fd, int family, struct sockaddr *addrinfo) {
                 family == AF_INET
                     ? (void *)&(((struct sockaddr_in *)addrinfo)->sin_addr)
                     : (void *)&(((struct sockaddr_in6 *)addrinfo)->sin6_addr),
-                (char *)fd_data(fd).addr, sizeof(fd_data(fd).addr));
+                (char *)fd_cold(fd).addr, sizeof(fd_cold(fd).addr));
   if (result) {
-    fd_data(fd).addr_len = strlen((char *)fd_data(fd).addr);
+    fd_cold(fd).addr_len = strlen((char *)fd_cold(fd).addr);
   } else {
-    fd_data(fd).addr_len = 0;
-    fd_data(fd).addr[0] = 0;
+    fd_cold(fd).addr_len = 0;
+    fd_cold(fd).addr[0] = 0;
+  }
+}
+
+/* process wide accept counters (see `fio_accept_stats`) */
+static struct {
+  size_t accepted;
+  size_t emfile;
+  size_t budget_exhausted;
+} fio_accept_counters;
+
+#if defined(__linux__)
+/* reads the TcpExt counters shared by all the listening sockets */
+static void fio_accept_stats_netstat(fio_accept_stats_s *r) {
+  char buf[8192];
+  int fd = open("/proc/net/netstat", O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return;
+  ssize_t len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (len <= 0)
+    return;
+  buf[len] = 0;
+  /* "TcpExt: <names...>\nTcpExt: <values...>\n" */
+  char *names = strstr(buf, "TcpExt:");
+  char *values = (names ? strstr(names + 7, "TcpExt:") : NULL);
+  if (!values)
+    return;
+  names += 7;
+  values += 7;
+  while (*names == ' ' && *values == ' ') {
+    char *name = ++names;
+    while (*names && *names != ' ' && *names != '\n')
+      ++names;
+    size_t name_len = names - name;
+    ++values;
+    size_t value = (size_t)fio_atol(&values);
+    if (name_len == 15 && !memcmp(name, "ListenOverflows", 15))
+      r->listen_overflows = value;
+    else if (name_len == 11 && !memcmp(name, "ListenDrops", 11))
+      r->listen_drops = value;
+    else if (name_len == 14 && !memcmp(name, "SyncookiesSent", 14))
+      r->syncookies_sent = value;
+  }
+}
+#endif
+
+/**
+ * Returns the accept path statistics for this process (see
+ * `fio_accept_stats_s`).
+ */
+fio_accept_stats_s fio_accept_stats(intptr_t srv_uuid) {
+  fio_accept_stats_s r = {
+      .accepted = fio_atomic_add(&fio_accept_counters.accepted, 0),
+      .emfile = fio_atomic_add(&fio_accept_counters.emfile, 0),
+      .budget_exhausted =
+          fio_atomic_add(&fio_accept_counters.budget_exhausted, 0),
+  };
+#if defined(__linux__)
+#if defined(TCP_INFO)
+  if (srv_uuid != -1 && fio_is_valid(srv_uuid)) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    /* on listening sockets: unacked == accept queue, sacked == backlog */
+    if (!getsockopt(fio_uuid2fd(srv_uuid), IPPROTO_TCP, TCP_INFO, &info,
+                    &len) &&
+        info.tcpi_state == 10 /* TCP_LISTEN */) {
+      r.backlog = info.tcpi_unacked;
+      r.backlog_max = info.tcpi_sacked;
+    }
   }
+#endif
+  fio_accept_stats_netstat(&r);
+#endif
+  (void)srv_uuid;
+  return r;
 }
 
 /**
@@ -2364,17 +3984,21 @@ intptr_t fio_accept(intptr_t srv_uuid) {
 #ifdef SOCK_NONBLOCK
   client = accept4(fio_uuid2fd(srv_uuid), (struct sockaddr *)addrinfo, &addrlen,
                    SOCK_NONBLOCK | SOCK_CLOEXEC);
-  if (client <= 0)
-    return -1;
 #else
   client = accept(fio_uuid2fd(srv_uuid), (struct sockaddr *)addrinfo, &addrlen);
-  if (client <= 0)
+#endif
+  if (client <= 0) {
+    if (client == -1 && (errno == EMFILE || errno == ENFILE))
+      fio_atomic_add(&fio_accept_counters.emfile, 1);
     return -1;
+  }
+#ifndef SOCK_NONBLOCK
   if (fio_set_non_block(client) == -1) {
     close(client);
     return -1;
   }
 #endif
+  fio_atomic_add(&fio_accept_counters.accepted, 1);
   // avoid the TCP delay algorithm.
   {
     int optval = 1;
@@ -2393,15 +4017,16 @@ intptr_t fio_accept(intptr_t srv_uuid) {
     }
   }
 
+  fio_fd_commit(client);
   fio_lock(&fd_data(client).protocol_lock);
   fio_clear_fd(client, 1);
   fio_unlock(&fd_data(client).protocol_lock);
   /* copy peer address */
   if (((struct sockaddr *)addrinfo)->sa_family == AF_UNIX) {
-    fd_data(client).addr_len = uuid_data(srv_uuid).addr_len;
-    if (uuid_data(srv_uuid).addr_len) {
-      memcpy(fd_data(client).addr, uuid_data(srv_uuid).addr,
-             uuid_data(srv_uuid).addr_len + 1);
+    fd_cold(client).addr_len = uuid_cold(srv_uuid).addr_len;
+    if (uuid_cold(srv_uuid).addr_len) {
+      memcpy(fd_cold(client).addr, uuid_cold(srv_uuid).addr,
+             uuid_cold(srv_uuid).addr_len + 1);
     }
   } else {
     fio_tcp_addr_cpy(client, ((struct sockaddr *)addrinfo)->sa_family,
@@ -2411,6 +4036,20 @@ intptr_t fio_accept(intptr_t srv_uuid) {
   return fd2uuid(client);
 }
 
+/* fio_socket2 flags: opens a server (listening) socket */
+#define FIO_SOCKET_SERVER 1
+/* fio_socket2 flags: sets SO_REUSEPORT before binding a TCP/IP server */
+#define FIO_SOCKET_REUSE_PORT 2
+/* fio_socket2 flags: binds a TCP/IP server without calling `listen` */
+#define FIO_SOCKET_BIND_ONLY 4
+
+/* SO_REUSEPORT flavors where the kernel distributes incoming connections */
+#if defined(SO_REUSEPORT_LB) /* FreeBSD 12 */
+#define FIO_SO_REUSEPORT SO_REUSEPORT_LB
+#elif defined(SO_REUSEPORT) && (defined(__linux__) || defined(__DragonFly__))
+#define FIO_SO_REUSEPORT SO_REUSEPORT
+#endif
+
 /* Creates a Unix socket - returning it's uuid (or -1) */
 static intptr_t fio_unix_socket(const char *address, uint8_t server) {
   /* Unix socket */
@@ -2457,19 +4096,52 @@ static intptr_t fio_unix_socket(const char *address, uint8_t server) {
       return -1;
     }
   }
+  fio_fd_commit(fd);
   fio_lock(&fd_data(fd).protocol_lock);
   fio_clear_fd(fd, 1);
   fio_unlock(&fd_data(fd).protocol_lock);
-  if (addr_len < sizeof(fd_data(fd).addr)) {
-    memcpy(fd_data(fd).addr, address, addr_len + 1); /* copy the NUL byte. */
-    fd_data(fd).addr_len = addr_len;
+  if (addr_len < sizeof(fd_cold(fd).addr)) {
+    memcpy(fd_cold(fd).addr, address, addr_len + 1); /* copy the NUL byte. */
+    fd_cold(fd).addr_len = addr_len;
   }
   return fd2uuid(fd);
 }
 
+/* opens a non-blocking socket, connecting it to the address (or -1) */
+static int fio_dns_connect_fd(fio_dns_addr_s *a) {
+  int fd = socket(a->family, a->socktype, a->protocol);
+  if (fd == -1)
+    return -1;
+  if (fio_set_non_block(fd) < 0)
+    goto error;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(fd, (struct sockaddr *)&a->addr, a->len) == -1 &&
+      errno != EINPROGRESS)
+    goto error;
+  return fd;
+error:
+  close(fd);
+  return -1;
+}
+
 /* Creates a TCP/IP socket - returning it's uuid (or -1) */
 static intptr_t fio_tcp_socket(const char *address, const char *port,
                                uint8_t server) {
+  if (!server) {
+    fio_dns_addr_s addr;
+    if (fio_dns_resolve(&addr, address, port))
+      return -1;
+    int fd = fio_dns_connect_fd(&addr);
+    if (fd == -1)
+      return -1;
+    fio_fd_commit(fd);
+    fio_lock(&fd_data(fd).protocol_lock);
+    fio_clear_fd(fd, 1);
+    fio_unlock(&fd_data(fd).protocol_lock);
+    fio_tcp_addr_cpy(fd, addr.family, (struct sockaddr *)&addr.addr);
+    return fd2uuid(fd);
+  }
   /* TCP/IP socket */
   // setup the address
   struct addrinfo hints = {0};
@@ -2495,60 +4167,59 @@ static intptr_t fio_tcp_socket(const char *address, const char *port,
     close(fd);
     return -1;
   }
-  if (server) {
-    {
-      // avoid the "address taken"
-      int optval = 1;
-      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
-    }
-    // bind the address to the socket
-    int bound = 0;
-    for (struct addrinfo *i = addrinfo; i != NULL; i = i->ai_next) {
-      if (!bind(fd, i->ai_addr, i->ai_addrlen))
-        bound = 1;
-    }
-    if (!bound) {
-      // perror("bind err");
+  {
+    // avoid the "address taken"
+    int optval = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+  }
+#ifdef FIO_SO_REUSEPORT
+  if ((server & FIO_SOCKET_REUSE_PORT)) {
+    int optval = 1;
+    if (setsockopt(fd, SOL_SOCKET, FIO_SO_REUSEPORT, &optval,
+                   sizeof(optval))) {
       freeaddrinfo(addrinfo);
       close(fd);
       return -1;
     }
+  }
+#endif
+  // bind the address to the socket
+  int bound = 0;
+  for (struct addrinfo *i = addrinfo; i != NULL; i = i->ai_next) {
+    if (!bind(fd, i->ai_addr, i->ai_addrlen))
+      bound = 1;
+  }
+  if (!bound) {
+    // perror("bind err");
+    freeaddrinfo(addrinfo);
+    close(fd);
+    return -1;
+  }
 #ifdef TCP_FASTOPEN
-    {
-      // support TCP Fast Open when available
-      int optval = 128;
-      setsockopt(fd, addrinfo->ai_protocol, TCP_FASTOPEN, &optval,
-                 sizeof(optval));
-    }
+  {
+    // support TCP Fast Open when available
+    int optval = 128;
+    setsockopt(fd, addrinfo->ai_protocol, TCP_FASTOPEN, &optval,
+               sizeof(optval));
+  }
 #endif
-    if (listen(fd, SOMAXCONN) < 0) {
-      freeaddrinfo(addrinfo);
-      close(fd);
-      return -1;
-    }
-  } else {
-    int one = 1;
-    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
-    errno = 0;
-    for (struct addrinfo *i = addrinfo; i; i = i->ai_next) {
-      if (connect(fd, i->ai_addr, i->ai_addrlen) == 0 || errno == EINPROGRESS)
-        goto socket_okay;
-    }
+  if (!(server & FIO_SOCKET_BIND_ONLY) && listen(fd, SOMAXCONN) < 0) {
     freeaddrinfo(addrinfo);
     close(fd);
     return -1;
   }
-socket_okay:
+  fio_fd_commit(fd);
   fio_lock(&fd_data(fd).protocol_lock);
   fio_clear_fd(fd, 1);
   fio_unlock(&fd_data(fd).protocol_lock);
-  fio_tcp_addr_cpy(fd, addrinfo->ai_family, (void *)addrinfo);
+  fio_tcp_addr_cpy(fd, addrinfo->ai_family, addrinfo->ai_addr);
   freeaddrinfo(addrinfo);
   return fd2uuid(fd);
 }
 
-/* PUBLIC API: opens a server or client socket */
-intptr_t fio_socket(const char *address, const char *port, uint8_t server) {
+/* opens a server or client socket, accepting FIO_SOCKET_* flags */
+static intptr_t fio_socket2(const char *address, const char *port,
+                            uint8_t flags) {
   intptr_t uuid;
   if (port) {
     char *pos = (char *)port;
@@ -2575,19 +4246,24 @@ intptr_t fio_socket(const char *address, const char *port, uint8_t server) {
   if (!port) {
     do {
       errno = 0;
-      uuid = fio_unix_socket(address, server);
+      uuid = fio_unix_socket(address, (flags & FIO_SOCKET_SERVER));
     } while (errno == EINTR);
   } else {
     do {
       errno = 0;
-      uuid = fio_tcp_socket(address, port, server);
+      uuid = fio_tcp_socket(address, port, flags);
     } while (errno == EINTR);
   }
   return uuid;
 }
 
-/* *****************************************************************************
-Internal socket flushing related functions
+/* PUBLIC API: opens a server or client socket */
+intptr_t fio_socket(const char *address, const char *port, uint8_t server) {
+  return fio_socket2(address, port, (server ? FIO_SOCKET_SERVER : 0));
+}
+
+/* *****************************************************************************
+Internal socket flushing related functions
 ***************************************************************************** */
 
 #ifndef BUFFER_FILE_READ_SIZE
@@ -2610,9 +4286,11 @@ Internal socket flushing related functions
 
 static void fio_sock_perform_close_fd(intptr_t fd) { close(fd); }
 
-static inline void fio_sock_packet_rotate_unsafe(uintptr_t fd) {
+/* removes the first packet from the outgoing queue and returns it */
+static inline fio_packet_s *fio_sock_packet_shift_unsafe(uintptr_t fd) {
   fio_packet_s *packet = fd_data(fd).packet;
   fd_data(fd).packet = packet->next;
+  fd_data(fd).pending -= packet->length; /* unsent (i.e., truncated files) */
   fio_atomic_sub(&fd_data(fd).packet_count, 1);
   if (!packet->next) {
     fd_data(fd).packet_last = &fd_data(fd).packet;
@@ -2620,16 +4298,21 @@ static inline void fio_sock_packet_rotate_unsafe(uintptr_t fd) {
   } else if (&packet->next == fd_data(fd).packet_last) {
     fd_data(fd).packet_last = &fd_data(fd).packet;
   }
-  fio_packet_free(packet);
+  return packet;
+}
+
+static inline void fio_sock_packet_rotate_unsafe(uintptr_t fd) {
+  fio_packet_free(fio_sock_packet_shift_unsafe(fd));
 }
 
 static int fio_sock_write_buffer(int fd, fio_packet_s *packet) {
-  int written = fd_data(fd).rw_hooks->write(
-      fd2uuid(fd), fd_data(fd).rw_udata,
+  int written = fd_cold(fd).rw_hooks->write(
+      fd2uuid(fd), fd_cold(fd).rw_udata,
       ((uint8_t *)packet->data.buffer + packet->offset), packet->length);
   if (written > 0) {
     packet->length -= written;
     packet->offset += written;
+    fd_data(fd).pending -= written;
     if (!packet->length) {
       fio_sock_packet_rotate_unsafe(fd);
     }
@@ -2637,14 +4320,180 @@ static int fio_sock_write_buffer(int fd, fio_packet_s *packet) {
   return written;
 }
 
+#ifndef FIO_WRITEV_MAX
+/* The maximal number of packets gathered by a single `writev` hook call */
+#define FIO_WRITEV_MAX 128
+#endif
+
+#if defined(IOV_MAX) && IOV_MAX < FIO_WRITEV_MAX
+#undef FIO_WRITEV_MAX
+#define FIO_WRITEV_MAX IOV_MAX
+#endif
+
+/*
+ * Writes consecutive memory packets using the `writev` hook, returning the
+ * number of bytes written (or -1). Fully written packets are rotated.
+ */
+static int fio_sock_writev_buffers(int fd) {
+  struct iovec iov[FIO_WRITEV_MAX];
+  int count = 0;
+  for (fio_packet_s *pos = fd_data(fd).packet;
+       pos && pos->write_func == fio_sock_write_buffer && count < FIO_WRITEV_MAX;
+       pos = pos->next) {
+    iov[count++] = (struct iovec){
+        .iov_base = ((uint8_t *)pos->data.buffer + pos->offset),
+        .iov_len = pos->length,
+    };
+  }
+  ssize_t written = fd_cold(fd).rw_hooks->writev(
+      fd2uuid(fd), fd_cold(fd).rw_udata, iov, count);
+  if (written <= 0)
+    return (int)written;
+  size_t remaining = (size_t)written;
+  fd_data(fd).pending -= remaining;
+  while (remaining) {
+    fio_packet_s *packet = fd_data(fd).packet;
+    if (packet->length > remaining) {
+      packet->length -= remaining;
+      packet->offset += remaining;
+      break;
+    }
+    remaining -= packet->length;
+    packet->length = 0;
+    fio_sock_packet_rotate_unsafe(fd);
+  }
+  return (written > INT_MAX ? INT_MAX : (int)written);
+}
+
+#if FIO_ZEROCOPY
+#include <linux/errqueue.h>
+
+/* releases MSG_ZEROCOPY packets with completed send ids (within sock_lock) */
+static void fio_sock_zerocopy_release_unsafe(int fd) {
+  while (fd_cold(fd).zc_pending &&
+         (int32_t)((uint32_t)fd_cold(fd).zc_pending->offset -
+                   fd_cold(fd).zc_done) < 0) {
+    fio_packet_s *packet = fd_cold(fd).zc_pending;
+    fd_cold(fd).zc_pending = packet->next;
+    if (!packet->next)
+      fd_cold(fd).zc_pending_last = &fd_cold(fd).zc_pending;
+    fio_packet_free(packet);
+  }
+}
+
+/**
+ * Reads MSG_ZEROCOPY completion notifications from the socket's error queue,
+ * releasing any completed packets (call within sock_lock).
+ */
+static void fio_sock_zerocopy_reap_unsafe(int fd) {
+  while (fd_cold(fd).zc_pending) {
+    char control[128];
+    struct msghdr msg = {.msg_control = control,
+                         .msg_controllen = sizeof(control)};
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE) == -1)
+      break;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+            (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+        continue;
+      struct sock_extended_err *err = (void *)CMSG_DATA(cm);
+      if (err->ee_errno || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+      /* TCP notifications are ordered, ranges may be coalesced */
+      if ((int32_t)(err->ee_info - fd_cold(fd).zc_done) <= 0 &&
+          (int32_t)(err->ee_data - fd_cold(fd).zc_done) >= 0)
+        fd_cold(fd).zc_done = err->ee_data + 1;
+    }
+  }
+  fio_sock_zerocopy_release_unsafe(fd);
+}
+
+/*
+ * Handles an epoll error event for a socket with pending MSG_ZEROCOPY
+ * notifications. Returns 0 if the error was only a notification.
+ */
+static int fio_sock_zerocopy_on_error(int fd) {
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (!fd_cold(fd).zc_pending || fio_trylock(&fd_data(fd).sock_lock))
+    return -1;
+  fio_sock_zerocopy_reap_unsafe(fd);
+  fio_unlock(&fd_data(fd).sock_lock);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) || err)
+    return -1;
+  return 0;
+}
+
+static int fio_sock_write_buffer(int fd, fio_packet_s *packet);
+
+/* writes a memory packet using MSG_ZEROCOPY, falling back to copying */
+static int fio_sock_write_zerocopy(int fd, fio_packet_s *packet) {
+  if (fd_cold(fd).zc_state == 0) {
+    int one = 1;
+    fd_cold(fd).zc_state =
+        (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) ? 2 : 1);
+  }
+  if (fd_cold(fd).zc_state != 1 ||
+      fd_cold(fd).rw_hooks != &FIO_DEFAULT_RW_HOOKS)
+    goto copy;
+  ssize_t written =
+      send(fd, ((uint8_t *)packet->data.buffer + packet->offset),
+           packet->length, MSG_ZEROCOPY);
+  if (written < 0 && errno == ENOBUFS)
+    goto copy; /* optmem limit reached, copy the data instead */
+  if (written <= 0)
+    return (int)written;
+  ++fd_cold(fd).zc_next;
+  packet->length -= written;
+  packet->offset += written;
+  fd_data(fd).pending -= written;
+  if (!packet->length) {
+    /* keep the memory until the kernel is done, `offset` holds the send id */
+    fio_sock_packet_shift_unsafe(fd);
+    packet->offset = fd_cold(fd).zc_next - 1;
+    packet->next = NULL;
+    *fd_cold(fd).zc_pending_last = packet;
+    fd_cold(fd).zc_pending_last = &packet->next;
+  }
+  return (written > INT_MAX ? INT_MAX : (int)written);
+copy:
+  packet->write_func = fio_sock_write_buffer;
+  return fio_sock_write_buffer(fd, packet);
+}
+#endif
+
 static int fio_sock_write_from_fd(int fd, fio_packet_s *packet) {
   ssize_t asked = 0;
   ssize_t sent = 0;
   ssize_t total = 0;
+  if (fd_cold(fd).rw_hooks->sendfile) {
+    /* the read/write hook can send the file without a user-space copy */
+    sent = fd_cold(fd).rw_hooks->sendfile(fd2uuid(fd), fd_cold(fd).rw_udata,
+                                          packet->data.fd, packet->offset,
+                                          packet->length);
+    if (sent > 0) {
+      packet->offset += sent;
+      packet->length -= sent;
+      fd_data(fd).pending -= sent;
+      if (!packet->length)
+        fio_sock_packet_rotate_unsafe(fd);
+      return sent;
+    }
+    if (sent == 0) {
+      /* end of file (the file was truncated) */
+      fio_sock_packet_rotate_unsafe(fd);
+      return 1;
+    }
+    if (errno != ENOTSUP && errno != EOPNOTSUPP)
+      return -1;
+    sent = 0;
+  }
   char buff[BUFFER_FILE_READ_SIZE];
   do {
     packet->offset += sent;
     packet->length -= sent;
+    fd_data(fd).pending -= sent;
   retry:
     asked = pread(packet->data.fd, buff,
                   ((packet->length < BUFFER_FILE_READ_SIZE)
@@ -2653,12 +4502,13 @@ static int fio_sock_write_from_fd(int fd, fio_packet_s *packet) {
                   packet->offset);
     if (asked <= 0)
       goto read_error;
-    sent = fd_data(fd).rw_hooks->write(fd2uuid(fd), fd_data(fd).rw_udata, buff,
+    sent = fd_cold(fd).rw_hooks->write(fd2uuid(fd), fd_cold(fd).rw_udata, buff,
                                        asked);
   } while (sent == asked && packet->length);
   if (sent >= 0) {
     packet->offset += sent;
     packet->length -= sent;
+    fd_data(fd).pending -= sent;
     total += sent;
     if (!packet->length) {
       fio_sock_packet_rotate_unsafe(fd);
@@ -2687,6 +4537,7 @@ static int fio_sock_sendfile_from_fd(int fd, fio_packet_s *packet) {
   if (sent < 0)
     return -1;
   packet->length -= sent;
+  fd_data(fd).pending -= sent;
   if (!packet->length)
     fio_sock_packet_rotate_unsafe(fd);
   return sent;
@@ -2710,6 +4561,7 @@ static int fio_sock_sendfile_from_fd(int fd, fio_packet_s *packet) {
       goto error;
     packet->length -= act_sent;
     packet->offset += act_sent;
+    fd_data(fd).pending -= act_sent;
   }
   fio_sock_packet_rotate_unsafe(fd);
   return act_sent;
@@ -2717,6 +4569,7 @@ error:
   if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
     packet->length -= act_sent;
     packet->offset += act_sent;
+    fd_data(fd).pending -= act_sent;
   }
   return -1;
 }
@@ -2767,8 +4620,8 @@ ssize_t fio_read(intptr_t uuid, void *buffer, size_t count) {
     return 0;
   fio_lock(&uuid_data(uuid).sock_lock);
   ssize_t (*rw_read)(intptr_t, void *, void *, size_t) =
-      uuid_data(uuid).rw_hooks->read;
-  void *udata = uuid_data(uuid).rw_udata;
+      uuid_cold(uuid).rw_hooks->read;
+  void *udata = uuid_cold(uuid).rw_udata;
   fio_unlock(&uuid_data(uuid).sock_lock);
   int old_errno = errno;
   ssize_t ret;
@@ -2776,6 +4629,7 @@ retry_int:
   ret = rw_read(uuid, udata, buffer, count);
   if (ret > 0) {
     fio_touch(uuid);
+    fio_metrics_add_local(FIO_METRIC_BYTES_READ, ret);
     return ret;
   }
   if (ret < 0 && errno == EINTR)
@@ -2792,6 +4646,86 @@ retry_int:
 /**
  * `fio_write2_fn` is the actual function behind the macro `fio_write2`.
  */
+/* *****************************************************************************
+Outgoing buffer watermarks (back-pressure)
+***************************************************************************** */
+
+/* tests the watermark state (within sock_lock): 1 == pressure, 2 == release */
+static inline uint8_t fio_watermark_test_unsafe(intptr_t fd) {
+  if (!fd_cold(fd).watermark_high)
+    return 0;
+  if (!fd_cold(fd).backpressure) {
+    if (fd_data(fd).pending < fd_cold(fd).watermark_high)
+      return 0;
+    fd_cold(fd).backpressure = 1;
+    return 1;
+  }
+  if (fd_data(fd).pending > fd_cold(fd).watermark_low)
+    return 0;
+  fd_cold(fd).backpressure = 0;
+  return 2;
+}
+
+/* suspends / resumes reading and schedules the `on_backpressure` callback */
+static void fio_watermark_notify(intptr_t uuid, uint8_t state,
+                                 uint8_t suspend) {
+  if (suspend) {
+    if (state == 1)
+      fio_suspend(uuid);
+    else
+      fio_force_event(uuid, FIO_EVENT_ON_DATA);
+  }
+  fio_defer_push_urgent(deferred_on_backpressure, (void *)uuid, NULL);
+}
+
+/**
+ * Sets the connection's outgoing buffer watermarks (in bytes).
+ *
+ * Returns -1 on error (invalid `uuid`) and 0 on success.
+ */
+int fio_watermarks_set(intptr_t uuid, size_t high, size_t low,
+                       uint8_t suspend) {
+  if (!uuid_is_valid(uuid))
+    goto invalid;
+  if (low > high)
+    low = high;
+  uint8_t state = 0;
+  uint8_t was_suspended;
+  fio_lock(&uuid_data(uuid).sock_lock);
+  if (!uuid_is_valid(uuid)) {
+    fio_unlock(&uuid_data(uuid).sock_lock);
+    goto invalid;
+  }
+  was_suspended = uuid_cold(uuid).backpressure &&
+                  uuid_cold(uuid).backpressure_suspend;
+  uuid_cold(uuid).watermark_high = high;
+  uuid_cold(uuid).watermark_low = low;
+  uuid_cold(uuid).backpressure_suspend = suspend;
+  if (!high && uuid_cold(uuid).backpressure) {
+    uuid_cold(uuid).backpressure = 0;
+    state = 2;
+  } else {
+    state = fio_watermark_test_unsafe(fio_uuid2fd(uuid));
+  }
+  fio_unlock(&uuid_data(uuid).sock_lock);
+  if (state)
+    fio_watermark_notify(uuid, state, (state == 1 ? suspend : was_suspended));
+  return 0;
+invalid:
+  errno = EBADF;
+  return -1;
+}
+
+/**
+ * Returns the number of bytes that are waiting in the socket's queue and
+ * haven't been sent.
+ */
+size_t fio_pending_bytes(intptr_t uuid) {
+  if (!uuid_is_valid(uuid))
+    return 0;
+  return uuid_data(uuid).pending;
+}
+
 ssize_t fio_write2_fn(intptr_t uuid, fio_write_args_s options) {
   if (!uuid_is_valid(uuid))
     goto error;
@@ -2804,7 +4738,7 @@ ssize_t fio_write2_fn(intptr_t uuid, fio_write_args_s options) {
       .data.buffer = (void *)options.data.buffer,
   };
   if (options.is_fd) {
-    packet->write_func = (uuid_data(uuid).rw_hooks == &FIO_DEFAULT_RW_HOOKS)
+    packet->write_func = (uuid_cold(uuid).rw_hooks == &FIO_DEFAULT_RW_HOOKS)
                              ? fio_sock_sendfile_from_fd
                              : fio_sock_write_from_fd;
     packet->dealloc =
@@ -2812,6 +4746,10 @@ ssize_t fio_write2_fn(intptr_t uuid, fio_write_args_s options) {
                                : (void (*)(void *))fio_sock_perform_close_fd);
   } else {
     packet->write_func = fio_sock_write_buffer;
+#if FIO_ZEROCOPY
+    if (options.zerocopy && options.length >= FIO_ZEROCOPY_MIN)
+      packet->write_func = fio_sock_write_zerocopy;
+#endif
     packet->dealloc = (options.after.dealloc ? options.after.dealloc : free);
   }
   /* add packet to outgoing list */
@@ -2836,11 +4774,18 @@ ssize_t fio_write2_fn(intptr_t uuid, fio_write_args_s options) {
     }
   }
   fio_atomic_add(&uuid_data(uuid).packet_count, 1);
+  uuid_data(uuid).pending += packet->length;
+  const uint8_t watermark = fio_watermark_test_unsafe(fio_uuid2fd(uuid));
   fio_unlock(&uuid_data(uuid).sock_lock);
 
+  if (watermark)
+    fio_watermark_notify(uuid, watermark, uuid_cold(uuid).backpressure_suspend);
   if (was_empty) {
     touchfd(fio_uuid2fd(uuid));
-    deferred_on_ready((void *)uuid, (void *)1);
+    if (options.coalesce)
+      fio_defer_push_task(deferred_on_ready, (void *)uuid, (void *)1);
+    else
+      deferred_on_ready((void *)uuid, (void *)1);
   }
   return 0;
 locked_error:
@@ -2885,6 +4830,14 @@ void fio_close(intptr_t uuid) {
     fio_poll_add_write(fio_uuid2fd(uuid));
     return;
   }
+#if FIO_ZEROCOPY
+  if (uuid_cold(uuid).zc_pending) {
+    /* wait for the completion notifications (reported as epoll errors) */
+    uuid_data(uuid).close = 1;
+    fio_poll_add_read(fio_uuid2fd(uuid));
+    return;
+  }
+#endif
   fio_force_close(uuid);
 }
 
@@ -2917,7 +4870,7 @@ void fio_force_close(intptr_t uuid) {
   }
   /* check for rw-hooks termination packet */
   if (uuid_data(uuid).open && (uuid_data(uuid).close & 1) &&
-      uuid_data(uuid).rw_hooks->before_close(uuid, uuid_data(uuid).rw_udata)) {
+      uuid_cold(uuid).rw_hooks->before_close(uuid, uuid_cold(uuid).rw_udata)) {
     uuid_data(uuid).close = 2; /* don't repeat the before_close callback */
     fio_touch(uuid);
     fio_poll_add_write(fio_uuid2fd(uuid));
@@ -2953,17 +4906,39 @@ ssize_t fio_flush(intptr_t uuid) {
   if (fio_trylock(&uuid_data(uuid).sock_lock))
     goto would_block;
 
+#if FIO_ZEROCOPY
+  if (uuid_cold(uuid).zc_pending) {
+    fio_sock_zerocopy_reap_unsafe(fio_uuid2fd(uuid));
+    if (!uuid_cold(uuid).zc_pending && !uuid_data(uuid).packet &&
+        uuid_data(uuid).close) {
+      /* closure was delayed until the kernel was done with the memory */
+      fio_unlock(&uuid_data(uuid).sock_lock);
+      goto closed;
+    }
+  }
+#endif
+
   if (!uuid_data(uuid).packet)
     goto flush_rw_hook;
 
   const fio_packet_s *old_packet = uuid_data(uuid).packet;
   const size_t old_sent = uuid_data(uuid).sent;
+  const size_t old_pending = uuid_data(uuid).pending;
 
-  tmp = uuid_data(uuid).packet->write_func(fio_uuid2fd(uuid),
-                                           uuid_data(uuid).packet);
+  if (uuid_data(uuid).packet->next &&
+      uuid_data(uuid).packet->write_func == fio_sock_write_buffer &&
+      uuid_data(uuid).packet->next->write_func == fio_sock_write_buffer &&
+      uuid_cold(uuid).rw_hooks->writev)
+    tmp = fio_sock_writev_buffers(fio_uuid2fd(uuid)); /* gather packets */
+  else
+    tmp = uuid_data(uuid).packet->write_func(fio_uuid2fd(uuid),
+                                             uuid_data(uuid).packet);
   if (tmp <= 0) {
     goto test_errno;
   }
+  fio_metrics_add_local(FIO_METRIC_BYTES_WRITTEN,
+                        old_pending - uuid_data(uuid).pending);
+  const uint8_t watermark = fio_watermark_test_unsafe(fio_uuid2fd(uuid));
 
   if (uuid_data(uuid).packet_count >= 1024 &&
       uuid_data(uuid).packet == old_packet &&
@@ -2976,6 +4951,9 @@ ssize_t fio_flush(intptr_t uuid) {
   /* end critical section */
   fio_unlock(&uuid_data(uuid).sock_lock);
 
+  if (watermark)
+    fio_watermark_notify(uuid, watermark, uuid_cold(uuid).backpressure_suspend);
+
   /* test for fio_close marker */
   if (!uuid_data(uuid).packet && uuid_data(uuid).close)
     goto closed;
@@ -2992,7 +4970,7 @@ closed:
   return -1;
 
 flush_rw_hook:
-  flushed = uuid_data(uuid).rw_hooks->flush(uuid, uuid_data(uuid).rw_udata);
+  flushed = uuid_cold(uuid).rw_hooks->flush(uuid, uuid_cold(uuid).rw_udata);
   fio_unlock(&uuid_data(uuid).sock_lock);
   if (!flushed)
     return 0;
@@ -3072,6 +5050,12 @@ static ssize_t fio_hooks_default_write(intptr_t uuid, void *udata,
   (void)(udata);
 }
 
+static ssize_t fio_hooks_default_writev(intptr_t uuid, void *udata,
+                                        const struct iovec *iov, int iovcnt) {
+  return writev(fio_uuid2fd(uuid), iov, iovcnt);
+  (void)(udata);
+}
+
 static ssize_t fio_hooks_default_before_close(intptr_t uuid, void *udata) {
   return 0;
   (void)udata;
@@ -3092,6 +5076,7 @@ const fio_rw_hook_s FIO_DEFAULT_RW_HOOKS = {
     .flush = fio_hooks_default_flush,
     .before_close = fio_hooks_default_before_close,
     .cleanup = fio_hooks_default_cleanup,
+    .writev = fio_hooks_default_writev,
 };
 
 /**
@@ -3111,6 +5096,8 @@ int fio_rw_hook_replace_unsafe(intptr_t uuid, fio_rw_hook_s *rw_hooks,
     rw_hooks->read = fio_hooks_default_read;
   if (!rw_hooks->write)
     rw_hooks->write = fio_hooks_default_write;
+  if (!rw_hooks->writev && rw_hooks->write == fio_hooks_default_write)
+    rw_hooks->writev = fio_hooks_default_writev;
   if (!rw_hooks->flush)
     rw_hooks->flush = fio_hooks_default_flush;
   if (!rw_hooks->before_close)
@@ -3120,8 +5107,8 @@ int fio_rw_hook_replace_unsafe(intptr_t uuid, fio_rw_hook_s *rw_hooks,
   /* protect against some fulishness... but not all of it. */
   was_locked = fio_trylock(&fd_data(fd).sock_lock);
   if (fd2uuid(fd) == uuid) {
-    fd_data(fd).rw_hooks = rw_hooks;
-    fd_data(fd).rw_udata = udata;
+    fd_cold(fd).rw_hooks = rw_hooks;
+    fd_cold(fd).rw_udata = udata;
     replaced = 0;
   }
   if (!was_locked)
@@ -3137,6 +5124,8 @@ int fio_rw_hook_set(intptr_t uuid, fio_rw_hook_s *rw_hooks, void *udata) {
     rw_hooks->read = fio_hooks_default_read;
   if (!rw_hooks->write)
     rw_hooks->write = fio_hooks_default_write;
+  if (!rw_hooks->writev && rw_hooks->write == fio_hooks_default_write)
+    rw_hooks->writev = fio_hooks_default_writev;
   if (!rw_hooks->flush)
     rw_hooks->flush = fio_hooks_default_flush;
   if (!rw_hooks->before_close)
@@ -3151,10 +5140,10 @@ int fio_rw_hook_set(intptr_t uuid, fio_rw_hook_s *rw_hooks, void *udata) {
     fio_unlock(&fd_data(fd).sock_lock);
     goto invalid_uuid;
   }
-  old_rw_hooks = fd_data(fd).rw_hooks;
-  old_udata = fd_data(fd).rw_udata;
-  fd_data(fd).rw_hooks = rw_hooks;
-  fd_data(fd).rw_udata = udata;
+  old_rw_hooks = fd_cold(fd).rw_hooks;
+  old_udata = fd_cold(fd).rw_udata;
+  fd_cold(fd).rw_hooks = rw_hooks;
+  fd_cold(fd).rw_udata = udata;
   fio_unlock(&fd_data(fd).sock_lock);
   if (old_rw_hooks && old_rw_hooks->cleanup)
     old_rw_hooks->cleanup(old_udata);
@@ -3231,6 +5220,10 @@ static int fio_attach__internal(void *uuid_, void *protocol_) {
   uuid_data(uuid).open = 1;
   uuid_data(uuid).protocol = protocol;
   touchfd(fio_uuid2fd(uuid));
+  if (protocol)
+    fio_timeout_link(fio_uuid2fd(uuid));
+  else
+    fio_timeout_unlink(fio_uuid2fd(uuid));
   fio_unlock(&uuid_data(uuid).protocol_lock);
   if (old_pr) {
     /* protocol replacement */
@@ -3278,7 +5271,7 @@ void fio_attach_fd(int fd, fio_protocol_s *protocol) {
 void fio_timeout_set(intptr_t uuid, uint8_t timeout) {
   if (uuid_is_valid(uuid)) {
     touchfd(fio_uuid2fd(uuid));
-    uuid_data(uuid).timeout = timeout;
+    fio_timeout_set_fd(fio_uuid2fd(uuid), timeout);
   } else {
     FIO_LOG_DEBUG("Called fio_timeout_set for invalid uuid %p", (void *)uuid);
   }
@@ -3495,17 +5488,19 @@ Initialize the library
 ***************************************************************************** */
 
 static void fio_pubsub_on_fork(void);
+static void fio_dns_on_fork(void);
 
 /* Called within a child process after it starts. */
 static void fio_on_fork(void) {
   fio_timer_lock = FIO_LOCK_INIT;
   fio_data->lock = FIO_LOCK_INIT;
+  fio_data->timeout_lock = FIO_LOCK_INIT;
   fio_defer_on_fork();
   fio_malloc_after_fork();
   fio_poll_init();
   fio_state_callback_on_fork();
 
-  const size_t limit = fio_data->capa;
+  const size_t limit = fio_data->fd_commit;
   for (size_t i = 0; i < limit; ++i) {
     fd_data(i).sock_lock = FIO_LOCK_INIT;
     fd_data(i).protocol_lock = FIO_LOCK_INIT;
@@ -3516,12 +5511,14 @@ static void fio_on_fork(void) {
   }
 
   fio_pubsub_on_fork();
+  fio_dns_on_fork();
   fio_max_fd_shrink();
   uint16_t old_active = fio_data->active;
   fio_data->active = 0;
   fio_defer_perform();
   fio_data->active = old_active;
   fio_data->is_worker = 1;
+  fio_metrics_on_fork();
 }
 
 static void fio_mem_destroy(void);
@@ -3546,6 +5543,7 @@ static void __attribute__((destructor)) fio_lib_destroy(void) {
 
 static void fio_mem_init(void);
 static void fio_cluster_init(void);
+static void fio_rate_limit_init(void);
 static void fio_pubsub_initialize(void);
 static void __attribute__((constructor)) fio_lib_init(void) {
   /* detect socket capacity - MUST be first...*/
@@ -3584,49 +5582,63 @@ static void __attribute__((constructor)) fio_lib_init(void) {
 #if FIO_ENGINE_POLL
     FIO_LOG_INFO("facil.io " FIO_VERSION_STRING " capacity initialization:\n"
                  "*    Meximum open files %zu out of %zu\n"
-                 "*    Allocating %zu bytes for state handling.\n"
+                 "*    Reserving %zu bytes for state handling (used lazily).\n"
                  "*    %zu bytes per connection + %zu for state handling.",
                  capa, (size_t)rlim.rlim_max,
                  (sizeof(*fio_data) + (capa * (sizeof(*fio_data->poll))) +
-                  (capa * (sizeof(*fio_data->info)))),
-                 (sizeof(*fio_data->poll) + sizeof(*fio_data->info)),
+                  (capa * (sizeof(*fio_data->info) + sizeof(*fio_data->cold)))),
+                 (sizeof(*fio_data->poll) + sizeof(*fio_data->info) +
+                  sizeof(*fio_data->cold)),
                  sizeof(*fio_data));
 #else
     FIO_LOG_INFO("facil.io " FIO_VERSION_STRING " capacity initialization:\n"
                  "*    Meximum open files %zu out of %zu\n"
-                 "*    Allocating %zu bytes for state handling.\n"
+                 "*    Reserving %zu bytes for state handling (used lazily).\n"
                  "*    %zu bytes per connection + %zu for state handling.",
                  capa, (size_t)rlim.rlim_max,
-                 (sizeof(*fio_data) + (capa * (sizeof(*fio_data->info)))),
-                 (sizeof(*fio_data->info)), sizeof(*fio_data));
+                 (sizeof(*fio_data) +
+                  (capa * (sizeof(*fio_data->info) + sizeof(*fio_data->cold)))),
+                 (sizeof(*fio_data->info) + sizeof(*fio_data->cold)),
+                 sizeof(*fio_data));
 #endif
 #endif
   }
 
 #if FIO_ENGINE_POLL
   /* allocate and initialize main data structures by detected capacity */
-  fio_data = fio_mmap(sizeof(*fio_data) + (capa * (sizeof(*fio_data->poll))) +
-                      (capa * (sizeof(*fio_data->info))));
+  fio_data = fio_mmap(sizeof(*fio_data) + 64 +
+                      (capa * (sizeof(*fio_data->poll))) +
+                      (capa * (sizeof(*fio_data->info))) +
+                      (capa * (sizeof(*fio_data->cold))));
   FIO_ASSERT_ALLOC(fio_data);
   fio_data->capa = capa;
-  fio_data->poll =
-      (void *)((uintptr_t)(fio_data + 1) + (sizeof(fio_data->info[0]) * capa));
+  fio_data->info =
+      (void *)(((uintptr_t)(fio_data + 1) + 63) & (~(uintptr_t)63));
+  fio_data->cold = (void *)(fio_data->info + capa);
+  fio_data->poll = (void *)(fio_data->cold + capa);
 #else
   /* allocate and initialize main data structures by detected capacity */
-  fio_data = fio_mmap(sizeof(*fio_data) + (capa * (sizeof(*fio_data->info))));
+  fio_data = fio_mmap(sizeof(*fio_data) + 64 +
+                      (capa * (sizeof(*fio_data->info))) +
+                      (capa * (sizeof(*fio_data->cold))));
   FIO_ASSERT_ALLOC(fio_data);
   fio_data->capa = capa;
+  fio_data->info =
+      (void *)(((uintptr_t)(fio_data + 1) + 63) & (~(uintptr_t)63));
+  fio_data->cold = (void *)(fio_data->info + capa);
 #endif
   fio_data->parent = getpid();
   fio_data->connection_count = 0;
-  fio_mark_time();
-
-  for (ssize_t i = 0; i < capa; ++i) {
-    fio_clear_fd(i, 0);
-#if FIO_ENGINE_POLL
-    fio_data->poll[i].fd = -1;
-#endif
+  fio_data->timeout_lock = FIO_LOCK_INIT;
+  for (size_t i = 0; i < 256; ++i) {
+    fio_data->timeouts[i] = (fio_ls_embd_s)FIO_LS_INIT(fio_data->timeouts[i]);
   }
+  fio_data->fd_commit = 0;
+  fio_data->fd_commit_lock = FIO_LOCK_INIT;
+  fio_mark_time();
+  /* connection data is initialized on first use, see `fio_fd_commit` */
+  fio_upgrade_init();
+  fio_rate_limit_init();
 
   /* call initialization callbacks */
   fio_state_callback_force(FIO_CALL_ON_INITIALIZE);
@@ -3665,41 +5677,58 @@ Section Start Marker
 
 static void fio_cluster_signal_children(void);
 
+/*
+ * Reviews the heads of all the timeout buckets, visiting only connections that
+ * might have expired (O(expired) rather than O(connections)).
+ *
+ * Connections that were touched are re-ordered within their bucket. Expired
+ * connections are pinged and reviewed again on the following second (unless
+ * they were touched).
+ */
 static void fio_review_timeout(void *arg, void *ignr) {
   // TODO: Fix review for connections with no protocol?
+  (void)arg;
   (void)ignr;
   fio_protocol_s *tmp;
-  time_t review = fio_data->last_cycle.tv_sec;
-  intptr_t fd = (intptr_t)arg;
-
-  uint16_t timeout = fd_data(fd).timeout;
-  if (!timeout)
-    timeout = 300; /* enforced timout settings */
-  if (!fd_data(fd).protocol || (fd_data(fd).active + timeout >= review))
-    goto finish;
-  tmp = protocol_try_lock(fd, FIO_PR_LOCK_STATE);
-  if (!tmp) {
-    if (errno == EBADF)
-      goto finish;
-    goto reschedule;
-  }
-  if (prt_meta(tmp).locks[FIO_PR_LOCK_TASK] ||
-      prt_meta(tmp).locks[FIO_PR_LOCK_WRITE])
-    goto unlock;
-  fio_defer_push_task(deferred_ping, (void *)fio_fd2uuid((int)fd), NULL);
-unlock:
-  protocol_unlock(tmp, FIO_PR_LOCK_STATE);
-finish:
-  do {
-    fd++;
-  } while (!fd_data(fd).protocol && (fd <= fio_data->max_protocol_fd));
-
-  if (fio_data->max_protocol_fd < fd) {
-    fio_data->need_review = 1;
-    return;
+  const time_t review = fio_data->last_cycle.tv_sec;
+  fio_lock(&fio_data->timeout_lock);
+  for (size_t i = 0; i < 256; ++i) {
+    fio_ls_embd_s *bucket = fio_data->timeouts + i;
+    fio_ls_embd_s again = FIO_LS_INIT(again);
+    const time_t timeout = i ? (time_t)i : 300; /* enforced timout settings */
+    while (fio_ls_embd_any(bucket)) {
+      const intptr_t fd = fio_timeout_node2fd(bucket->next);
+      if (fd_cold(fd).timeout_queued + timeout >= review)
+        break;
+      fio_ls_embd_remove(&fd_cold(fd).timeout_node);
+      if (!fd_data(fd).protocol)
+        continue;
+      if (fd_data(fd).active + timeout >= review) {
+        /* touched since queued */
+        fio_timeout_insert_unsafe(fd, fd_data(fd).active);
+        continue;
+      }
+      fio_ls_embd_push(&again, &fd_cold(fd).timeout_node);
+      tmp = protocol_try_lock(fd, FIO_PR_LOCK_STATE);
+      if (!tmp) {
+        if (errno == EBADF)
+          fio_ls_embd_remove(&fd_cold(fd).timeout_node);
+        continue;
+      }
+      if (!prt_meta(tmp).locks[FIO_PR_LOCK_TASK] &&
+          !prt_meta(tmp).locks[FIO_PR_LOCK_WRITE])
+        fio_defer_push_task(deferred_ping, (void *)fio_fd2uuid((int)fd), NULL);
+      protocol_unlock(tmp, FIO_PR_LOCK_STATE);
+    }
+    /* expired connections are reviewed again on the next second */
+    while (fio_ls_embd_any(&again)) {
+      const intptr_t fd = fio_timeout_node2fd(fio_ls_embd_pop(&again));
+      fd_cold(fd).timeout_queued = review - timeout;
+      fio_ls_embd_unshift(bucket, &fd_cold(fd).timeout_node);
+    }
   }
-reschedule:
-  fio_defer_push_task(fio_review_timeout, (void *)fd, NULL);
+  fio_unlock(&fio_data->timeout_lock);
+  fio_data->need_review = 1;
 }
 
 /* reactor pattern cycling - common actions */
@@ -3714,10 +5743,13 @@ static void fio_cycle_schedule_events(void) {
     fio_signal_children_flag = 0;
     fio_cluster_signal_children();
   }
+  fio_upgrade_review();
   int events = fio_poll();
   if (events < 0) {
     return;
   }
+  fio_metrics_add_local(FIO_METRIC_CYCLES, 1);
+  fio_metrics_add_local(FIO_METRIC_EVENTS, events);
   if (events > 0) {
     idle = 1;
   } else {
@@ -3749,12 +5781,187 @@ static void fio_cycle_unwind(void *ignr, void *ignr2) {
 static void fio_cycle(void *ignr, void *ignr2) {
   fio_cycle_schedule_events();
   if (fio_data->active) {
-    fio_defer_push_task(fio_cycle, ignr, ignr2);
+    /* no need to wake a parked thread, this thread will keep cycling */
+    fio_defer_push_task_normal(
+        (fio_defer_task_s){.func = fio_cycle, .arg1 = ignr, .arg2 = ignr2});
     return;
   }
   return;
 }
 
+#if FIO_ENGINE_EPOLL
+/* sharded reactor cycling - each thread polls and handles it's own shard */
+static void *fio_reactor_shard_cycle(void *shard_) {
+  const size_t shard = (uintptr_t)shard_;
+  fio_defer_on_thread_start();
+  fio_affinity_thread(shard);
+  fio_defer_local_attach(shard);
+  while (fio_data->active) {
+    if (shard) {
+      size_t events = fio_poll_shard(
+          shard, (fio_defer_has_queue() ? 0 : FIO_POLL_SHARD_TICK));
+      fio_metrics_add_local(FIO_METRIC_CYCLES, 1);
+      fio_metrics_add_local(FIO_METRIC_EVENTS, events);
+    } else
+      fio_cycle_schedule_events(); /* shard 0 also manages timers etc' */
+    fio_defer_perform();
+  }
+  fio_defer_on_thread_end();
+  return shard_;
+}
+#endif
+
+/* *****************************************************************************
+CPU Affinity (worker and thread placement)
+***************************************************************************** */
+
+#if FIO_AFFINITY
+#include <sched.h>
+
+#ifndef FIO_AFFINITY_NUMA_NODES
+/** The number of NUMA nodes tested when ordering the CPUs (node0 ... nodeN). */
+#define FIO_AFFINITY_NUMA_NODES 64
+#endif
+
+/* the CPUs available to the root process, ordered by NUMA node */
+static struct {
+  uint16_t cpus[CPU_SETSIZE];
+  uint16_t count;   /* CPUs in the `cpus` array */
+  uint16_t first;   /* the worker's first CPU (index in `cpus`) */
+  uint16_t length;  /* the worker's CPU count (0 == not pinned) */
+  uint8_t enabled;  /* set by `fio_start` */
+} fio_affinity;
+
+/* parses a kernel CPU list ("0-3,8,10-11"), adding the CPUs in `mask` */
+static size_t fio_affinity_parse(const char *list, cpu_set_t *mask,
+                                 uint16_t *dest, size_t count) {
+  while (*list && count < CPU_SETSIZE) {
+    char *end;
+    size_t start = (size_t)strtoul(list, &end, 10);
+    size_t stop = start;
+    if (end == list)
+      break;
+    if (*end == '-')
+      stop = (size_t)strtoul(end + 1, &end, 10);
+    for (size_t i = start; i <= stop && i < CPU_SETSIZE; ++i) {
+      if (!CPU_ISSET(i, mask))
+        continue;
+      CPU_CLR(i, mask);
+      dest[count++] = (uint16_t)i;
+    }
+    list = end;
+    if (*list == ',')
+      ++list;
+    else
+      break;
+  }
+  return count;
+}
+
+/* computes the CPUs (`first`, `length`) reserved for a worker */
+static void fio_affinity_slice(size_t count, size_t workers, size_t index,
+                               uint16_t *first, uint16_t *length) {
+  if (!workers)
+    workers = 1;
+  if (workers > count) {
+    /* more workers than CPUs, workers share CPUs */
+    *first = (uint16_t)(index % count);
+    *length = 1;
+    return;
+  }
+  *first = (uint16_t)((index * count) / workers);
+  *length = (uint16_t)((((index + 1) * count) / workers) - *first);
+}
+
+/* collects the CPUs allowed for the process, grouping them by NUMA node */
+static void fio_affinity_init(void) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  fio_affinity.count = 0;
+  if (sched_getaffinity(0, sizeof(mask), &mask)) {
+    FIO_LOG_WARNING("couldn't read the CPU affinity mask (%s), CPU affinity "
+                    "disabled.",
+                    strerror(errno));
+    return;
+  }
+  char buf[4096];
+  for (size_t node = 0; node < FIO_AFFINITY_NUMA_NODES; ++node) {
+    snprintf(buf, 64, "/sys/devices/system/node/node%zu/cpulist", node);
+    FILE *f = fopen(buf, "r");
+    if (!f)
+      continue;
+    if (fgets(buf, sizeof(buf), f))
+      fio_affinity.count = (uint16_t)fio_affinity_parse(
+          buf, &mask, fio_affinity.cpus, fio_affinity.count);
+    fclose(f);
+  }
+  /* CPUs without NUMA information (i.e., no sysfs) */
+  for (size_t i = 0; i < CPU_SETSIZE; ++i) {
+    if (CPU_ISSET(i, &mask))
+      fio_affinity.cpus[fio_affinity.count++] = (uint16_t)i;
+  }
+  fio_affinity.enabled = (fio_affinity.count > 0);
+}
+
+/* pins the calling thread to `length` CPUs, starting at `first` */
+static int fio_affinity_pin(size_t first, size_t length) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  for (size_t i = 0; i < length; ++i)
+    CPU_SET(fio_affinity.cpus[(first + i) % fio_affinity.count], &mask);
+  return sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+/*
+ * Pins a (newly forked) worker process to it's CPUs. Memory is allocated on
+ * the NUMA node of the CPU that first touches it, so the worker's copy of the
+ * fd table and it's `fio_malloc` arenas (used by CPU) become node local.
+ */
+static void fio_affinity_worker(size_t index) {
+  fio_affinity.length = 0;
+  if (!fio_affinity.enabled)
+    return;
+  fio_affinity_slice(fio_affinity.count, fio_data->workers, index,
+                     &fio_affinity.first, &fio_affinity.length);
+  if (fio_affinity_pin(fio_affinity.first, fio_affinity.length)) {
+    FIO_LOG_WARNING("(%d) couldn't set CPU affinity: %s", (int)getpid(),
+                    strerror(errno));
+    fio_affinity.length = 0;
+    return;
+  }
+  FIO_LOG_DEBUG("(%d) worker %zu pinned to %u CPU(s), starting at CPU %u",
+                (int)getpid(), index, (unsigned)fio_affinity.length,
+                (unsigned)fio_affinity.cpus[fio_affinity.first]);
+}
+
+/* pins a worker thread to one of the worker's CPUs */
+static void fio_affinity_thread(size_t index) {
+  if (fio_affinity.length < 2)
+    return; /* single core workers (or no affinity) */
+  fio_affinity_pin(fio_affinity.first + (index % fio_affinity.length), 1);
+}
+
+/* sets `SO_INCOMING_CPU`, preferring the worker's socket for it's CPU */
+static void fio_affinity_listen(intptr_t uuid) {
+#ifdef SO_INCOMING_CPU
+  if (!fio_affinity.length)
+    return;
+  int cpu = fio_affinity.cpus[fio_affinity.first];
+  if (setsockopt(fio_uuid2fd(uuid), SOL_SOCKET, SO_INCOMING_CPU, &cpu,
+                 sizeof(cpu)))
+    FIO_LOG_WARNING("(%d) couldn't set SO_INCOMING_CPU: %s", (int)getpid(),
+                    strerror(errno));
+#else
+  (void)uuid;
+#endif
+}
+
+#else
+#define fio_affinity_init()
+#define fio_affinity_worker(index) ((void)(index))
+#define fio_affinity_listen(uuid) ((void)(uuid))
+#endif
+
 /* TODO: fixme */
 static void fio_worker_startup(void) {
   /* Call the on_start callbacks for worker processes. */
@@ -3777,12 +5984,29 @@ static void fio_worker_startup(void) {
   /* require timeout review */
   fio_data->need_review = 1;
 
+  /* worker threads keep the tasks they schedule (others steal when idle) */
+  if (fio_data->stealing && fio_data->threads > 1)
+    fio_defer_locals_set(fio_data->threads);
+
+#if FIO_ENGINE_EPOLL
+  if (fio_data->sharded && fio_data->threads > 1) {
+    /* every thread owns a reactor shard, no shared polling thread */
+    fio_poll_shards_set(fio_data->threads);
+    fio_defer_thread_pool_join(fio_defer_thread_pool_new2(
+        fio_data->threads, fio_reactor_shard_cycle));
+    fio_poll_shards_set(1);
+    fio_defer_locals_set(0);
+    return;
+  }
+#endif
+
   /* the cycle task will loop by re-scheduling until it's time to finish */
   fio_defer_push_task(fio_cycle, NULL, NULL);
 
   /* A single thread doesn't need a pool. */
   if (fio_data->threads > 1) {
     fio_defer_thread_pool_join(fio_defer_thread_pool_new(fio_data->threads));
+    fio_defer_locals_set(0);
   } else {
     fio_defer_perform();
   }
@@ -3862,11 +6086,13 @@ static void *fio_sentinel_worker_thread(void *arg) {
         FIO_LOG_WARNING("Child worker (%d) shutdown. Respawning worker.",
                         (int)child);
       }
-      fio_defer_push_task(fio_sentinel_task, NULL, NULL);
+      fio_defer_push_task(fio_sentinel_task, arg, NULL);
       fio_unlock(&fio_fork_lock);
     }
 #endif
   } else {
+    /* pinned before any memory is touched (first touch NUMA placement) */
+    fio_affinity_worker((uintptr_t)arg);
     fio_on_fork();
     fio_state_callback_force(FIO_CALL_AFTER_FORK);
     fio_state_callback_force(FIO_CALL_IN_CHILD);
@@ -3875,7 +6101,6 @@ static void *fio_sentinel_worker_thread(void *arg) {
     exit(0);
   }
   return NULL;
-  (void)arg;
 }
 
 static void fio_sentinel_task(void *arg1, void *arg2) {
@@ -3883,14 +6108,13 @@ static void fio_sentinel_task(void *arg1, void *arg2) {
     return;
   fio_state_callback_force(FIO_CALL_BEFORE_FORK);
   fio_lock(&fio_fork_lock); /* will wait for worker thread to release lock. */
-  void *thrd =
-      fio_thread_new(fio_sentinel_worker_thread, (void *)&fio_fork_lock);
+  /* the argument is the worker's index (respawned workers keep it) */
+  void *thrd = fio_thread_new(fio_sentinel_worker_thread, arg1);
   fio_thread_free(thrd);
   fio_lock(&fio_fork_lock);   /* will wait for worker thread to release lock. */
   fio_unlock(&fio_fork_lock); /* release lock for next fork. */
   fio_state_callback_force(FIO_CALL_AFTER_FORK);
   fio_state_callback_force(FIO_CALL_IN_MASTER);
-  (void)arg1;
   (void)arg2;
 }
 
@@ -3911,6 +6135,22 @@ void fio_start FIO_IGNORE_MACRO(struct fio_start_args args) {
 
   fio_data->workers = (uint16_t)args.workers;
   fio_data->threads = (uint16_t)args.threads;
+#if FIO_ENGINE_EPOLL
+  fio_data->sharded = args.sharded;
+#else
+  if (args.sharded)
+    FIO_LOG_WARNING("sharded reactor requires epoll, ignoring (%s).",
+                    fio_engine());
+  fio_data->sharded = 0;
+#endif
+  fio_data->stealing = (args.stealing || FIO_DEFER_STEALING);
+#if FIO_AFFINITY
+  if (args.affinity)
+    fio_affinity_init();
+#else
+  if (args.affinity)
+    FIO_LOG_WARNING("CPU affinity requires Linux, ignoring.");
+#endif
   fio_data->active = 1;
   fio_data->is_worker = 0;
 
@@ -3928,9 +6168,13 @@ void fio_start FIO_IGNORE_MACRO(struct fio_start_args args) {
 
   if (args.workers > 1) {
     for (int i = 0; i < args.workers && fio_data->active; ++i) {
-      fio_sentinel_task(NULL, NULL);
+      fio_sentinel_task((void *)(uintptr_t)i, NULL);
     }
+  } else {
+    fio_affinity_worker(0);
   }
+  /* an upgraded binary notifies the previous binary that it took over */
+  fio_upgrade_ready();
   fio_worker_startup();
   fio_worker_cleanup();
 }
@@ -3994,6 +6238,126 @@ FIO_FUNC inline uint64_t fio_atol_consume(char **pstr, uint8_t base) {
   return result;
 }
 
+/* converts 8 decimal digits (most significant first) to their value (SWAR) */
+FIO_FUNC inline uint64_t fio_atol_8digits(const char *str) {
+  uint64_t v = fio_str2u64(str) - 0x3030303030303030ULL;
+  v = (((v >> 8) & 0x00FF00FF00FF00FFULL) * 10) + (v & 0x00FF00FF00FF00FFULL);
+  v = (((v >> 16) & 0x0000FFFF0000FFFFULL) * 100) + (v & 0x0000FFFF0000FFFFULL);
+  return ((v >> 32) * 10000) + (v & 0xFFFFFFFFULL);
+}
+
+/* converts `len` (up to 19) decimal digits to their value, 8 at a time */
+FIO_FUNC inline uint64_t fio_atol_digits(const char *str, size_t len) {
+  uint64_t result = 0;
+  const char *const end = str + len;
+  for (const char *const head = str + (len & 7); str < head; ++str)
+    result = (result * 10) + (*str - '0');
+  for (; str < end; str += 8)
+    result = (result * 100000000) + fio_atol_8digits(str);
+  return result;
+}
+
+/* counts the decimal digits at the beginning of the string */
+FIO_FUNC inline size_t fio_atol_count_digits(const char *str) {
+  size_t len = 0;
+  while ((uint8_t)(str[len] - '0') < 10)
+    ++len;
+  return len;
+}
+
+static const uint64_t fio___atol_pow10[] = {1ULL,
+                                            10ULL,
+                                            100ULL,
+                                            1000ULL,
+                                            10000ULL,
+                                            100000ULL,
+                                            1000000ULL,
+                                            10000000ULL,
+                                            100000000ULL,
+                                            1000000000ULL,
+                                            10000000000ULL,
+                                            100000000000ULL,
+                                            1000000000000ULL,
+                                            10000000000000ULL,
+                                            100000000000000ULL,
+                                            1000000000000000ULL,
+                                            10000000000000000ULL,
+                                            100000000000000000ULL,
+                                            1000000000000000000ULL,
+                                            10000000000000000000ULL};
+
+#ifndef FIO_ATOL_READ_AHEAD
+/*
+ * Decimal numbers are consumed 8 bytes at a time, possibly reading a few bytes
+ * beyond the end of the number (but never beyond the memory page containing
+ * it, so the read is always safe). Disabled when using AddressSanitizer.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(FIO_GNUC_BYPASS) &&  \
+    !defined(__SANITIZE_ADDRESS__)
+#define FIO_ATOL_READ_AHEAD 1
+#else
+#define FIO_ATOL_READ_AHEAD 0
+#endif
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) /* clang */
+#undef FIO_ATOL_READ_AHEAD
+#define FIO_ATOL_READ_AHEAD 0
+#endif
+#endif
+#endif
+
+/* consumes any decimal digits in the string, returning their value */
+FIO_FUNC inline uint64_t fio_atol_consume10(char **pstr) {
+  char *str = *pstr;
+  if (!FIO_ATOL_READ_AHEAD || (uint8_t)(str[0] - '0') >= 10 ||
+      (uint8_t)(str[1] - '0') >= 10) {
+    /* single digit numbers (or no read ahead) */
+    return fio_atol_consume(pstr, 10);
+  }
+#if FIO_ATOL_READ_AHEAD
+  uint64_t result = 0;
+  size_t total = 0;
+  for (;;) {
+    if (((uintptr_t)str & 4095) > 4088) {
+      /* the next 8 bytes might cross a page boundary, use a safe loop */
+      size_t len = fio_atol_count_digits(str);
+      if (total + len > 19)
+        return fio_atol_consume(pstr, 10);
+      result = (result * fio___atol_pow10[len]) + fio_atol_digits(str, len);
+      str += len;
+      break;
+    }
+    uint64_t v;
+    memcpy(&v, str, 8);
+#if __BIG_ENDIAN__
+    v = fio_bswap64(v); /* the first digit must be the least significant */
+#endif
+    /* the most significant bit is set for any byte that isn't a digit */
+    const uint64_t non_digits =
+        ((v + 0x4646464646464646ULL) | (v - 0x3030303030303030ULL)) &
+        0x8080808080808080ULL;
+    const size_t len =
+        non_digits ? ((size_t)__builtin_ctzll(non_digits) >> 3) : 8;
+    if (!len)
+      break;
+    total += len;
+    if (total > 19) /* might overflow */
+      return fio_atol_consume(pstr, 10);
+    /* move the digits to the top (leading zeros) and combine pairs */
+    v = (v & 0x0F0F0F0F0F0F0F0FULL) << (64 - (len << 3));
+    v = (v * 2561) >> 8;
+    v = ((v & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    v = ((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+    result = (result * fio___atol_pow10[len]) + v;
+    str += len;
+    if (len < 8)
+      break;
+  }
+  *pstr = str;
+  return result;
+#endif
+}
+
 /* returns true if there's data to be skipped */
 FIO_FUNC inline uint8_t fio_atol_skip_test(char **pstr, uint8_t base) {
   return (**pstr >= '0' && **pstr < ('0' + base));
@@ -4104,7 +6468,7 @@ int64_t fio_atol(char **pstr) {
       return 0;
   } else {
     /* base 10 */
-    result = fio_atol_consume(&str, 10);
+    result = fio_atol_consume10(&str);
     if (fio_atol_skip_test(&str, 10)) /* too large for a number */
       return 0;
   }
@@ -4117,21 +6481,102 @@ sign:
   return (int64_t)result;
 }
 
-/** A helper function that converts between String data to a signed double. */
-double fio_atof(char **pstr) { return strtold(*pstr, pstr); }
-
-/* *****************************************************************************
-Numbers to Strings
-***************************************************************************** */
-
 /**
- * A helper function that writes a signed int64_t to a string.
- *
- * No overflow guard is provided, make sure there's at least 68 bytes
- * available (for base 2).
+ * A helper function that converts between String data to a signed double.
  *
- * Offers special support for base 2 (binary), base 8 (octal), base 10 and base
- * 16 (hex). An unsupported base will silently default to base 10. Prefixes
+ * Decimal numbers with up to 19 significant digits that are exactly
+ * representable (up to 2^53) and a small exponent (up to 22 in magnitude) are
+ * computed directly (only a single, correctly rounded, operation is required).
+ * Any other input is converted using `strtod` (rounding a `long double` result
+ * to a `double` could round twice).
+ */
+double fio_atof(char **pstr) {
+#if defined(FLT_EVAL_METHOD) && (FLT_EVAL_METHOD == 0 || FLT_EVAL_METHOD == 1)
+  static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+  char *str = *pstr;
+  uint8_t invert = 0;
+  if (*str == '-') {
+    invert = 1;
+    ++str;
+  } else if (*str == '+') {
+    ++str;
+  }
+  char *const start = str;
+  while (*str == '0') /* leading zeros aren't significant digits */
+    ++str;
+  size_t len = fio_atol_count_digits(str);
+  if (len > 19)
+    goto slow_path;
+  uint64_t mantissa = fio_atol_digits(str, len);
+  int64_t exponent = 0;
+  str += len;
+  if (*str == '.') {
+    ++str;
+    char *const frac = str;
+    if (!mantissa)
+      while (*str == '0')
+        ++str;
+    size_t frac_len = fio_atol_count_digits(str);
+    if (len + frac_len > 19)
+      goto slow_path;
+    mantissa = (mantissa * fio___atol_pow10[frac_len]) +
+               fio_atol_digits(str, frac_len);
+    str += frac_len;
+    exponent = 0 - (int64_t)(str - frac);
+    if (str == frac && str == start + 1)
+      goto slow_path; /* no digits (".") */
+  } else if (str == start || *str == 'x' || *str == 'X') {
+    goto slow_path; /* i.e., "inf", "nan" or hex floats */
+  }
+  if ((*str | 32) == 'e') {
+    char *e = str + 1;
+    uint8_t e_invert = 0;
+    if (*e == '-') {
+      e_invert = 1;
+      ++e;
+    } else if (*e == '+') {
+      ++e;
+    }
+    size_t e_len = fio_atol_count_digits(e);
+    if (e_len) {
+      if (e_len > 4)
+        goto slow_path;
+      int64_t tmp = (int64_t)fio_atol_digits(e, e_len);
+      exponent += (e_invert ? (0 - tmp) : tmp);
+      str = e + e_len;
+    }
+  }
+  if (mantissa > ((uint64_t)1 << 53) || exponent < -22 || exponent > 22)
+    goto slow_path;
+  {
+    double result = (double)mantissa;
+    if (exponent < 0)
+      result /= pow10[0 - exponent];
+    else
+      result *= pow10[exponent];
+    *pstr = str;
+    return (invert ? -result : result);
+  }
+slow_path:
+#endif
+  return strtod(*pstr, pstr);
+}
+
+/* *****************************************************************************
+Numbers to Strings
+***************************************************************************** */
+
+/**
+ * A helper function that writes a signed int64_t to a string.
+ *
+ * No overflow guard is provided, make sure there's at least 68 bytes
+ * available (for base 2).
+ *
+ * Offers special support for base 2 (binary), base 8 (octal), base 10 and base
+ * 16 (hex). An unsupported base will silently default to base 10. Prefixes
  * are automatically added (i.e., "0x" for hex and "0b" for base 2).
  *
  * Returns the number of bytes actually written (excluding the NUL
@@ -4252,23 +6697,39 @@ size_t fio_ltoa(char *dest, int64_t num, uint8_t base) {
     break;
   }
   /* Base 10, the default base */
-
-  if (num < 0) {
-    dest[len++] = '-';
-    num = 0 - num;
-  }
-  uint64_t l = 0;
-  while (num) {
-    uint64_t t = num / 10;
-    buf[l++] = '0' + (num - (t * 10));
-    num = t;
-  }
-  while (l) {
-    --l;
-    dest[len++] = buf[l];
+  {
+    static const char digits[] =
+      "0001020304050607080910111213141516171819"
+      "2021222324252627282930313233343536373839"
+      "4041424344454647484950515253545556575859"
+      "6061626364656667686970717273747576777879"
+      "8081828384858687888990919293949596979899";
+    uint64_t n = (uint64_t)num;
+    if (num < 0) {
+      dest[len++] = '-';
+      n = 0 - n;
+    }
+    /* count the digits, so they can be written in place (two at a time) */
+    size_t l = 1;
+    for (uint64_t t = 10; l < 20 && n >= t; t *= 10)
+      ++l;
+    len += l;
+    dest[len] = 0;
+    char *pos = dest + len;
+    while (n >= 100) {
+      const size_t i = (size_t)(n % 100) << 1;
+      n /= 100;
+      *(--pos) = digits[i + 1];
+      *(--pos) = digits[i];
+    }
+    if (n >= 10) {
+      *(--pos) = digits[(n << 1) + 1];
+      *(--pos) = digits[n << 1];
+    } else {
+      *(--pos) = (char)('0' + n);
+    }
+    return len;
   }
-  dest[len] = 0;
-  return len;
 
 zero:
   switch (base) {
@@ -4291,6 +6752,257 @@ zero:
   return len;
 }
 
+/* *****************************************************************************
+Shortest round-trip double to string conversion (Grisu2)
+
+Based on Florian Loitsch's "Printing Floating-Point Numbers Quickly and
+Accurately with Integers" (the Grisu2 algorithm), which produces the shortest
+representation for the vast majority of values and a (slightly longer) round
+trip safe representation for the rest.
+***************************************************************************** */
+
+/* a "do it yourself" floating point type: `f * 2^e` */
+typedef struct {
+  uint64_t f;
+  int e;
+} fio_ftoa_fp_s;
+
+/* cached powers of ten (10^-348 ... 10^340, step 8), as normalized `f * 2^e` */
+static const uint64_t fio_ftoa_powers_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+static const int16_t fio_ftoa_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954,
+    -927, -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635,
+    -608, -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316,
+    -289, -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30, 56,
+    83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348, 375, 402, 428, 455,
+    481, 508, 534, 561, 588, 614, 641, 667, 694, 720, 747, 774, 800, 827, 853,
+    880, 907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static inline fio_ftoa_fp_s fio_ftoa_fp_mul(fio_ftoa_fp_s a, fio_ftoa_fp_s b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t p = (__uint128_t)a.f * (__uint128_t)b.f;
+  uint64_t h = (uint64_t)(p >> 64);
+  h += ((uint64_t)p >> 63); /* round */
+  return (fio_ftoa_fp_s){.f = h, .e = a.e + b.e + 64};
+#else
+  const uint64_t M32 = 0xFFFFFFFFULL;
+  const uint64_t ah = a.f >> 32, al = a.f & M32;
+  const uint64_t bh = b.f >> 32, bl = b.f & M32;
+  const uint64_t hh = ah * bh, hl = ah * bl, lh = al * bh, ll = al * bl;
+  uint64_t tmp = (ll >> 32) + (hl & M32) + (lh & M32);
+  tmp += 1ULL << 31; /* round */
+  return (fio_ftoa_fp_s){.f = hh + (hl >> 32) + (lh >> 32) + (tmp >> 32),
+                         .e = a.e + b.e + 64};
+#endif
+}
+
+static inline fio_ftoa_fp_s fio_ftoa_fp_normalize(fio_ftoa_fp_s v) {
+  const int shift = __builtin_clzll(v.f);
+  return (fio_ftoa_fp_s){.f = v.f << shift, .e = v.e - shift};
+}
+
+/* rounds the last digit towards the exact value (while within the range) */
+static inline void fio_ftoa_round(char *buf, size_t len, uint64_t delta,
+                                  uint64_t rest, uint64_t ten_kappa,
+                                  uint64_t wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w ||
+          wp_w - rest > rest + ten_kappa - wp_w)) {
+    buf[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+/* generates the digits of `w` (within the `mp - delta` ... `mp` range) */
+static inline size_t fio_ftoa_digits(fio_ftoa_fp_s w, fio_ftoa_fp_s mp,
+                                     uint64_t delta, char *buf, int *k) {
+  static const uint64_t pow10[] = {
+      1ULL,
+      10ULL,
+      100ULL,
+      1000ULL,
+      10000ULL,
+      100000ULL,
+      1000000ULL,
+      10000000ULL,
+      100000000ULL,
+      1000000000ULL,
+      10000000000ULL,
+      100000000000ULL,
+      1000000000000ULL,
+      10000000000000ULL,
+      100000000000000ULL,
+      1000000000000000ULL,
+      10000000000000000ULL,
+      100000000000000000ULL,
+      1000000000000000000ULL,
+      10000000000000000000ULL,
+  };
+  const int one_e = -mp.e;
+  const uint64_t one_f = 1ULL << one_e;
+  const uint64_t wp_w = mp.f - w.f;
+  uint32_t p1 = (uint32_t)(mp.f >> one_e);
+  uint64_t p2 = mp.f & (one_f - 1);
+  size_t len = 0;
+  int kappa = 10;
+  while (kappa > 1 && p1 < pow10[kappa - 1])
+    --kappa;
+  while (kappa > 0) {
+    const uint32_t d = p1 / (uint32_t)pow10[kappa - 1];
+    p1 %= (uint32_t)pow10[kappa - 1];
+    if (d || len)
+      buf[len++] = (char)('0' + d);
+    --kappa;
+    const uint64_t rest = ((uint64_t)p1 << one_e) + p2;
+    if (rest <= delta) {
+      *k += kappa;
+      fio_ftoa_round(buf, len, delta, rest, pow10[kappa] << one_e, wp_w);
+      return len;
+    }
+  }
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    const char d = (char)(p2 >> one_e);
+    if (d || len)
+      buf[len++] = (char)('0' + d);
+    p2 &= one_f - 1;
+    --kappa;
+    if (p2 < delta) {
+      *k += kappa;
+      fio_ftoa_round(buf, len, delta, p2, one_f,
+                     (-kappa < 20) ? wp_w * pow10[-kappa] : 0);
+      return len;
+    }
+  }
+}
+
+/* writes the digits of a positive, finite and non-zero double, sets `k` */
+static size_t fio_ftoa_grisu2(double num, char *buf, int *k) {
+  union {
+    double d;
+    uint64_t u;
+  } u = {.d = num};
+  const uint64_t hidden = 1ULL << 52;
+  const int biased_e = (int)((u.u >> 52) & 0x7FF);
+  fio_ftoa_fp_s v = {.f = u.u & (hidden - 1)};
+  if (biased_e) {
+    v.f += hidden;
+    v.e = biased_e - 1075;
+  } else {
+    v.e = -1074;
+  }
+  /* the boundaries (the half way points to the neighbouring doubles) */
+  fio_ftoa_fp_s plus = {.f = (v.f << 1) + 1, .e = v.e - 1};
+  plus = fio_ftoa_fp_normalize(plus);
+  fio_ftoa_fp_s minus;
+  if (v.f == hidden)
+    minus = (fio_ftoa_fp_s){.f = (v.f << 2) - 1, .e = v.e - 2};
+  else
+    minus = (fio_ftoa_fp_s){.f = (v.f << 1) - 1, .e = v.e - 1};
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+  /* find a cached power of ten so the product's exponent is in [-60, -32] */
+  const double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+  int ki = (int)dk;
+  if (dk - ki > 0.0)
+    ++ki;
+  const size_t index = (size_t)((ki >> 3) + 1);
+  *k = -(-348 + (int)(index << 3));
+  const fio_ftoa_fp_s c = {.f = fio_ftoa_powers_f[index],
+                           .e = fio_ftoa_powers_e[index]};
+  const fio_ftoa_fp_s w = fio_ftoa_fp_mul(fio_ftoa_fp_normalize(v), c);
+  fio_ftoa_fp_s wp = fio_ftoa_fp_mul(plus, c);
+  fio_ftoa_fp_s wm = fio_ftoa_fp_mul(minus, c);
+  ++wm.f;
+  --wp.f;
+  return fio_ftoa_digits(w, wp, wp.f - wm.f, buf, k);
+}
+
+/* formats the `len` digits in `buf` (`digits * 10^k`), returns the length */
+static size_t fio_ftoa_format(char *buf, size_t len, int k) {
+  const int kk = (int)len + k; /* 10^(kk-1) <= value < 10^kk */
+  if (k >= 0 && kk <= 21) {
+    /* 1234e7 => 12340000000.0 */
+    for (int i = (int)len; i < kk; ++i)
+      buf[i] = '0';
+    buf[kk] = '.';
+    buf[kk + 1] = '0';
+    return (size_t)kk + 2;
+  }
+  if (kk > 0 && kk <= 21) {
+    /* 1234e-2 => 12.34 */
+    memmove(buf + kk + 1, buf + kk, len - (size_t)kk);
+    buf[kk] = '.';
+    return len + 1;
+  }
+  if (kk > -6 && kk <= 0) {
+    /* 1234e-6 => 0.001234 */
+    const size_t offset = (size_t)(2 - kk);
+    memmove(buf + offset, buf, len);
+    buf[0] = '0';
+    buf[1] = '.';
+    for (size_t i = 2; i < offset; ++i)
+      buf[i] = '0';
+    return len + offset;
+  }
+  /* 1234e30 => 1.234e+33 */
+  size_t pos = 1;
+  if (len > 1) {
+    memmove(buf + 2, buf + 1, len - 1);
+    buf[1] = '.';
+    pos = len + 1;
+  }
+  buf[pos++] = 'e';
+  int e = kk - 1;
+  if (e < 0) {
+    buf[pos++] = '-';
+    e = -e;
+  } else {
+    buf[pos++] = '+';
+  }
+  if (e >= 100) {
+    buf[pos++] = (char)('0' + e / 100);
+    e %= 100;
+    buf[pos++] = (char)('0' + e / 10);
+  } else if (e >= 10) {
+    buf[pos++] = (char)('0' + e / 10);
+  }
+  buf[pos++] = (char)('0' + e % 10);
+  return pos;
+}
+
 /**
  * A helper function that converts between a double to a string.
  *
@@ -4301,6 +7013,10 @@ zero:
  * default to base 10. Prefixes aren't added (i.e., no "0x" or "0b" at the
  * beginning of the string).
  *
+ * Base 10 uses the shortest representation that converts back to the same
+ * value (i.e., "0.1" rather than "0.10000000000000001"), using an exponent
+ * only for very large or very small values (i.e., "1e+21").
+ *
  * Returns the number of bytes actually written (excluding the NUL
  * terminator).
  */
@@ -4313,22 +7029,28 @@ size_t fio_ftoa(char *dest, double num, uint8_t base) {
     return fio_ltoa(dest, *i, base);
   }
 
-  size_t written = sprintf(dest, "%g", num);
-  uint8_t need_zero = 1;
-  char *start = dest;
-  while (*start) {
-    if (*start == ',') // locale issues?
-      *start = '.';
-    if (*start == '.' || *start == 'e') {
-      need_zero = 0;
-      break;
-    }
-    start++;
+  /* base 10 - the shortest (round trip safe) representation */
+  size_t written = 0;
+  if (num != num) {
+    memcpy(dest, "NaN", 4);
+    return 3;
+  }
+  if (signbit(num)) {
+    dest[written++] = '-';
+    num = -num;
   }
-  if (need_zero) {
-    dest[written++] = '.';
-    dest[written++] = '0';
+  if (num == 0) {
+    memcpy(dest + written, "0.0", 4);
+    return written + 3;
   }
+  if (isinf(num)) {
+    memcpy(dest + written, "Infinity", 9);
+    return written + 8;
+  }
+  int k;
+  size_t len = fio_ftoa_grisu2(num, dest + written, &k);
+  written += fio_ftoa_format(dest + written, len, k);
+  dest[written] = 0;
   return written;
 }
 
@@ -4466,6 +7188,180 @@ Section Start Marker
 The listening protocol (use the facil.io API to make a socket and attach it)
 ***************************************************************************** */
 
+#ifndef FIO_LISTEN_ACCEPT_BATCH
+/** The initial (and minimal) number of connections accepted per wakeup. */
+#define FIO_LISTEN_ACCEPT_BATCH 4
+#endif
+
+#ifndef FIO_LISTEN_ACCEPT_MAX
+/** The maximal accept budget per wakeup when all workers share a socket. */
+#define FIO_LISTEN_ACCEPT_MAX 16
+#endif
+
+#ifndef FIO_LISTEN_ACCEPT_MAX_REUSEPORT
+/** The maximal accept budget per wakeup for a worker's SO_REUSEPORT socket. */
+#define FIO_LISTEN_ACCEPT_MAX_REUSEPORT 64
+#endif
+
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#include <linux/filter.h>
+#endif
+
+/* *****************************************************************************
+Rate Limiting (per address admission control)
+***************************************************************************** */
+
+#ifndef FIO_RATE_LIMIT_GROUPS
+/**
+ * The number of 64 byte entry groups (3 addresses each) in the rate limiting
+ * table shared by the worker processes. Must be a power of 2.
+ */
+#define FIO_RATE_LIMIT_GROUPS 4096
+#endif
+
+typedef struct {
+  uint64_t key;         /* the hashed (id, address) pair, 0 == free */
+  uint32_t stamp;       /* the last refill (milliseconds, wraps) */
+  uint16_t tokens;      /* the bucket's available tokens */
+  uint16_t connections; /* open connections (see `connections_per_address`) */
+} fio_rate_limit_entry_s;
+
+/* a cache line: a lock and a tiny (linear probing) bucket of entries */
+typedef struct {
+  fio_lock_i lock;
+  uint8_t reserved[sizeof(fio_rate_limit_entry_s) - sizeof(fio_lock_i)];
+  fio_rate_limit_entry_s entries[3];
+} fio_rate_limit_group_s;
+
+/* allocated (shared) by `fio_lib_init`, so all the workers share limits */
+static fio_rate_limit_group_s *fio_rate_limit_table;
+
+static void fio_rate_limit_init(void) {
+  void *mem = mmap(NULL, sizeof(*fio_rate_limit_table) * FIO_RATE_LIMIT_GROUPS,
+                   PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS
+#ifdef MAP_NORESERVE
+                       | MAP_NORESERVE
+#endif
+                   ,
+                   -1, 0);
+  if (mem == MAP_FAILED) {
+    FIO_LOG_WARNING("rate limiting unavailable: %s", strerror(errno));
+    return;
+  }
+  fio_rate_limit_table = mem;
+}
+
+static inline uint32_t fio_rate_limit_now(void) {
+  struct timespec t = fio_last_tick();
+  return (uint32_t)((t.tv_sec * 1000) + (t.tv_nsec / 1000000));
+}
+
+static inline uintptr_t fio_rate_limit_key(uintptr_t id, fio_str_info_s addr) {
+  return (uintptr_t)fio_risky_hash(addr.data, addr.len,
+                                   fio_hash_secret_seed ^ id) |
+         1;
+}
+
+/*
+ * Takes a token from the key's bucket (unless `rate` is 0) and counts a
+ * connection (unless `max_connections` is 0).
+ *
+ * Returns 0 on success and -1 if the key is limited.
+ *
+ * When a group is full, the least recently refilled entry without open
+ * connections is recycled, so limits are approximate under address floods.
+ */
+static int fio_rate_limit_take(uintptr_t key, uint32_t rate, uint32_t burst,
+                               uint32_t max_connections, uint32_t now) {
+  if (!fio_rate_limit_table)
+    return 0;
+  if (!burst || burst > 0xFFFF)
+    burst = (rate && rate < 0xFFFF) ? rate : 0xFFFF;
+  fio_rate_limit_group_s *g =
+      fio_rate_limit_table + ((key >> 1) & (FIO_RATE_LIMIT_GROUPS - 1));
+  int ret = -1;
+  fio_lock(&g->lock);
+  fio_rate_limit_entry_s *e = NULL;
+  for (size_t i = 0; i < 3; ++i) {
+    if (g->entries[i].key == key) {
+      e = g->entries + i;
+      goto found;
+    }
+  }
+  /* recycle a free entry, an idle entry or the oldest entry (in that order) */
+  e = g->entries;
+  for (size_t i = 1; i < 3; ++i) {
+    fio_rate_limit_entry_s *c = g->entries + i;
+    if (!e->key)
+      break;
+    if (!c->key || (!c->connections && e->connections) ||
+        (!c->connections == !e->connections &&
+         (uint32_t)(now - c->stamp) > (uint32_t)(now - e->stamp)))
+      e = c;
+  }
+  *e = (fio_rate_limit_entry_s){.key = key, .stamp = now, .tokens = burst};
+found:
+  if (rate) {
+    /* worker clocks (see `fio_last_tick`) might be a few milliseconds apart */
+    int32_t elapsed = (int32_t)(now - e->stamp);
+    if (elapsed < 0)
+      elapsed = (elapsed < -1000) ? INT32_MAX : 0;
+    uint64_t refill = ((uint64_t)elapsed * rate) / 1000;
+    if (refill + e->tokens >= burst) {
+      e->tokens = burst;
+      e->stamp = now;
+    } else if (refill) {
+      e->tokens += refill;
+      e->stamp += (uint32_t)((refill * 1000) / rate);
+    }
+    if (!e->tokens)
+      goto finish;
+  }
+  if (max_connections) {
+    if (e->connections >= max_connections || e->connections == 0xFFFF)
+      goto finish;
+    ++e->connections;
+  }
+  if (rate)
+    --e->tokens;
+  ret = 0;
+finish:
+  fio_unlock(&g->lock);
+  return ret;
+}
+
+/* releases a connection counted by `fio_rate_limit_take` */
+static void fio_rate_limit_release(uintptr_t key) {
+  if (!fio_rate_limit_table)
+    return;
+  fio_rate_limit_group_s *g =
+      fio_rate_limit_table + ((key >> 1) & (FIO_RATE_LIMIT_GROUPS - 1));
+  fio_lock(&g->lock);
+  for (size_t i = 0; i < 3; ++i) {
+    if (g->entries[i].key == key) {
+      if (g->entries[i].connections)
+        --g->entries[i].connections;
+      break;
+    }
+  }
+  fio_unlock(&g->lock);
+}
+
+/* `fio_uuid_link` callback, the linked "object" is the entry's key */
+static void fio_rate_limit_on_close(void *key) {
+  fio_rate_limit_release((uintptr_t)key);
+}
+
+/* public API. */
+int fio_rate_limit(uintptr_t id, fio_str_info_s key, uint32_t rate,
+                   uint32_t burst) {
+  if (!rate || !key.len)
+    return 0;
+  return fio_rate_limit_take(fio_rate_limit_key(id, key), rate, burst, 0,
+                             fio_rate_limit_now());
+}
+
 typedef struct {
   fio_protocol_s pr;
   intptr_t uuid;
@@ -4478,10 +7374,469 @@ typedef struct {
   size_t port_len;
   size_t addr_len;
   void *tls;
+  size_t accept_budget;
+  size_t accept_max;
+  fio_ls_embd_s node; /* the root's listeners (see `fio_upgrade`) */
+  uint32_t connection_rate;
+  uint32_t connection_burst;
+  uint32_t connections_per_address;
+  uint8_t reuse_port;
 } fio_listen_protocol_s;
 
+/* *****************************************************************************
+Binary Upgrade (listening socket handoff)
+***************************************************************************** */
+
+/* the listening sockets registered by the root process (see `fio_listen`) */
+static fio_ls_embd_s fio_listeners = FIO_LS_INIT(fio_listeners);
+
+#if !FIO_DISABLE_HOT_RESTART
+
+#ifndef FIO_UPGRADE_MAX_LISTENERS
+/** The maximal number of listening sockets passed to an upgraded binary. */
+#define FIO_UPGRADE_MAX_LISTENERS 64
+#endif
+
+#ifndef FIO_UPGRADE_ARGV_LIMIT
+/** The maximal length of the (NUL separated) arguments reused by upgrades. */
+#define FIO_UPGRADE_ARGV_LIMIT 65536
+#endif
+
+/* names the upgrade socket (inherited by the upgraded binary) */
+#define FIO_UPGRADE_ENV "FIO_UPGRADE_FD"
+
+/* a listening socket's address, as passed to `fio_listen` */
+typedef struct {
+  char addr[256];
+  char port[16];
+} fio_upgrade_record_s;
+
+/* listening sockets inherited from the previous binary (new process) */
+static struct {
+  fio_upgrade_record_s records[FIO_UPGRADE_MAX_LISTENERS];
+  int fds[FIO_UPGRADE_MAX_LISTENERS];
+  uint32_t count;
+  int sock; /* the previous binary's upgrade socket */
+} fio_upgrade_inherited = {.sock = -1};
+
+/* the upgrade state (old process) */
+static struct {
+  char exe[PATH_MAX];
+  volatile uint8_t flag; /* set by SIGUSR2 */
+  uint8_t state;         /* 1 == waiting for the new binary, 2 == handed off */
+} fio_upgrade_data;
+
+/* sends the listening sockets (and their addresses) using `SCM_RIGHTS` */
+static int fio_upgrade_send(int sock, fio_upgrade_record_s *records, int *fds,
+                            uint32_t count) {
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int) * FIO_UPGRADE_MAX_LISTENERS)];
+  } ctrl;
+  struct iovec iov[2] = {
+      {.iov_base = &count, .iov_len = sizeof(count)},
+      {.iov_base = records, .iov_len = sizeof(*records) * count},
+  };
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = (count ? 2 : 1)};
+  if (count > FIO_UPGRADE_MAX_LISTENERS) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (count) {
+    memset(&ctrl, 0, sizeof(ctrl));
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(c), fds, sizeof(int) * count);
+  }
+  const ssize_t total = sizeof(count) + (sizeof(*records) * count);
+  return (sendmsg(sock, &msg, 0) == total) ? 0 : -1;
+}
+
+/* receives the listening sockets sent by `fio_upgrade_send` */
+static int fio_upgrade_receive(int sock) {
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int) * FIO_UPGRADE_MAX_LISTENERS)];
+  } ctrl;
+  uint32_t count = 0;
+  uint32_t fd_count = 0;
+  struct iovec iov = {.iov_base = &count, .iov_len = sizeof(count)};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = ctrl.buf,
+                       .msg_controllen = sizeof(ctrl.buf)};
+  if (recvmsg(sock, &msg, 0) != sizeof(count))
+    return -1;
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+      continue;
+    fd_count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (fd_count > FIO_UPGRADE_MAX_LISTENERS)
+      fd_count = FIO_UPGRADE_MAX_LISTENERS;
+    memcpy(fio_upgrade_inherited.fds, CMSG_DATA(c), sizeof(int) * fd_count);
+  }
+  if (count != fd_count || (msg.msg_flags & MSG_CTRUNC))
+    goto error;
+  /* the addresses follow the count (in the same message) */
+  char *pos = (char *)fio_upgrade_inherited.records;
+  size_t remaining = sizeof(fio_upgrade_record_s) * count;
+  while (remaining) {
+    ssize_t r = read(sock, pos, remaining);
+    if (r <= 0) {
+      if (r < 0 && errno == EINTR)
+        continue;
+      goto error;
+    }
+    pos += r;
+    remaining -= r;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    fio_upgrade_inherited.records[i].addr[255] = 0;
+    fio_upgrade_inherited.records[i].port[15] = 0;
+  }
+  fio_upgrade_inherited.count = count;
+  return 0;
+error:
+  for (uint32_t i = 0; i < fd_count; ++i)
+    close(fio_upgrade_inherited.fds[i]);
+  return -1;
+}
+
+/* returns the inherited listening socket for an address (or -1) */
+static intptr_t fio_upgrade_listener(const char *addr, size_t addr_len,
+                                     const char *port, size_t port_len) {
+  for (uint32_t i = 0; i < fio_upgrade_inherited.count; ++i) {
+    fio_upgrade_record_s *r = fio_upgrade_inherited.records + i;
+    if (fio_upgrade_inherited.fds[i] == -1 || strlen(r->addr) != addr_len ||
+        strlen(r->port) != port_len || memcmp(r->addr, addr, addr_len) ||
+        memcmp(r->port, port, port_len))
+      continue;
+    const int fd = fio_upgrade_inherited.fds[i];
+    fio_upgrade_inherited.fds[i] = -1;
+    if (fio_set_non_block(fd) == -1) {
+      close(fd);
+      return -1;
+    }
+    return fio_fd2uuid(fd);
+  }
+  return -1;
+}
+
+/* called by the new binary once it's workers were forked (see `fio_start`) */
+static void fio_upgrade_ready(void) {
+  if (fio_upgrade_inherited.sock == -1)
+    return;
+  for (uint32_t i = 0; i < fio_upgrade_inherited.count; ++i) {
+    if (fio_upgrade_inherited.fds[i] == -1)
+      continue;
+    FIO_LOG_WARNING("inherited listening socket (%s:%s) unused, closing.",
+                    fio_upgrade_inherited.records[i].addr,
+                    fio_upgrade_inherited.records[i].port);
+    close(fio_upgrade_inherited.fds[i]);
+    fio_upgrade_inherited.fds[i] = -1;
+  }
+  if (write(fio_upgrade_inherited.sock, "R", 1) != 1)
+    FIO_LOG_ERROR("couldn't notify the previous binary: %s", strerror(errno));
+  close(fio_upgrade_inherited.sock);
+  fio_upgrade_inherited.sock = -1;
+}
+
+/* records the executable and collects any sockets passed to this process */
+static void fio_upgrade_init(void) {
+#if defined(__linux__)
+  ssize_t len = readlink("/proc/self/exe", fio_upgrade_data.exe,
+                         sizeof(fio_upgrade_data.exe) - 1);
+  fio_upgrade_data.exe[(len > 0 ? len : 0)] = 0;
+#endif
+  char *env = getenv(FIO_UPGRADE_ENV);
+  if (!env)
+    return;
+  const int sock = (int)fio_atol(&env);
+  unsetenv(FIO_UPGRADE_ENV);
+  if (sock <= 2)
+    return;
+  if (fio_upgrade_receive(sock)) {
+    FIO_LOG_ERROR("couldn't receive the listening sockets of the previous "
+                  "binary.");
+    close(sock);
+    return;
+  }
+  fio_upgrade_inherited.sock = sock;
+  FIO_LOG_INFO("inherited %u listening socket(s) from the previous binary.",
+               (unsigned)fio_upgrade_inherited.count);
+}
+
+static void fio_upgrade_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  char c = 0;
+  if (fio_read(uuid, &c, 1) != 1 || c != 'R')
+    return;
+  fio_upgrade_data.state = 2;
+  FIO_LOG_INFO("(%d) the upgraded binary took over, shutting down.",
+               (int)getpid());
+  fio_close(uuid);
+  fio_stop();
+  (void)pr;
+}
+
+static void fio_upgrade_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  if (fio_upgrade_data.state == 1) {
+    FIO_LOG_ERROR("binary upgrade failed, the new process exited before "
+                  "taking over.");
+    fio_upgrade_data.state = 0;
+  }
+  (void)uuid;
+  (void)pr;
+}
+
+static fio_protocol_s fio_upgrade_protocol = {
+    .on_data = fio_upgrade_on_data,
+    .on_close = fio_upgrade_on_close,
+    .ping = mock_ping_eternal,
+};
+
+/* collects the process's arguments (NULL terminated array, a single malloc) */
+static char **fio_upgrade_argv(const char *executable) {
+  char *buf = NULL;
+  size_t len = 0;
+#if defined(__linux__)
+  FILE *f = fopen("/proc/self/cmdline", "r");
+  if (f) {
+    buf = malloc(FIO_UPGRADE_ARGV_LIMIT);
+    if (buf)
+      len = fread(buf, 1, FIO_UPGRADE_ARGV_LIMIT - 1, f);
+    fclose(f);
+  }
+#endif
+  size_t count = 0;
+  for (size_t i = 0; i < len; ++i)
+    count += !buf[i];
+  char **argv = malloc((sizeof(char *) * (count + 2)) + len + 1);
+  FIO_ASSERT_ALLOC(argv);
+  char *data = (char *)(argv + count + 2);
+  if (len)
+    memcpy(data, buf, len);
+  data[len] = 0;
+  free(buf);
+  count = 0;
+  for (size_t i = 0; i < len; i += strlen(data + i) + 1)
+    argv[count++] = data + i;
+  if (!count)
+    argv[count++] = (char *)executable;
+  argv[count] = NULL;
+  return argv;
+}
+
+/* starts a graceful binary upgrade (see fio.h) */
+/* collects the (zeroed) records and descriptors of the listening sockets */
+static uint32_t fio_upgrade_collect(fio_upgrade_record_s *records, int *fds) {
+  uint32_t count = 0;
+  FIO_LS_EMBD_FOR(&fio_listeners, node) {
+    fio_listen_protocol_s *pr =
+        FIO_LS_EMBD_OBJ(fio_listen_protocol_s, node, node);
+    if (count == FIO_UPGRADE_MAX_LISTENERS) {
+      FIO_LOG_WARNING("(fio_upgrade) too many listening sockets, some will "
+                      "be re-bound.");
+      break;
+    }
+    /* reuse_port sockets belong to the workers (the root's is only bound) */
+    if (pr->reuse_port || pr->addr_len >= sizeof(records->addr) ||
+        pr->port_len >= sizeof(records->port) || !uuid_is_valid(pr->uuid))
+      continue;
+    memcpy(records[count].addr, pr->addr, pr->addr_len);
+    memcpy(records[count].port, pr->port, pr->port_len);
+    fds[count++] = fio_uuid2fd(pr->uuid);
+  }
+  return count;
+}
+
+int fio_upgrade(const char *executable, char *const argv[]) {
+  if (fio_parent_pid() != getpid()) {
+    errno = EPERM;
+    return -1;
+  }
+  if (fio_upgrade_data.state) {
+    errno = EALREADY;
+    return -1;
+  }
+  if (!executable)
+    executable = fio_upgrade_data.exe;
+  if (!executable || !*executable) {
+    errno = EINVAL;
+    return -1;
+  }
+  /* collect the listening sockets */
+  fio_upgrade_record_s *records =
+      calloc(FIO_UPGRADE_MAX_LISTENERS, sizeof(*records));
+  FIO_ASSERT_ALLOC(records);
+  int fds[FIO_UPGRADE_MAX_LISTENERS];
+  uint32_t count = fio_upgrade_collect(records, fds);
+  /* prepare everything `execve` requires before forking */
+  char **args = (argv ? NULL : fio_upgrade_argv(executable));
+  size_t env_count = 0;
+  while (environ[env_count])
+    ++env_count;
+  char **env = malloc(sizeof(*env) * (env_count + 2));
+  FIO_ASSERT_ALLOC(env);
+  size_t pos = 0;
+  for (size_t i = 0; i < env_count; ++i) {
+    if (strncmp(environ[i], FIO_UPGRADE_ENV "=", sizeof(FIO_UPGRADE_ENV)))
+      env[pos++] = environ[i];
+  }
+  char env_fd[sizeof(FIO_UPGRADE_ENV) + 24];
+  env[pos++] = env_fd;
+  env[pos] = NULL;
+
+  int sv[2] = {-1, -1};
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) ||
+      fio_upgrade_send(sv[0], records, fds, count))
+    goto error;
+  snprintf(env_fd, sizeof(env_fd), FIO_UPGRADE_ENV "=%d", sv[1]);
+
+  pid_t child = fork();
+  if (child == -1)
+    goto error;
+  if (!child) {
+    /* a grandchild, so the new root isn't waited for (or signaled) by us */
+    if (fork())
+      _exit(0);
+    setsid();
+    for (int i = 3; i < (int)fio_data->capa; ++i) {
+      if (i != sv[1])
+        close(i);
+    }
+    execve(executable, (argv ? argv : args), env);
+    _exit(127);
+  }
+  waitpid(child, NULL, 0);
+  close(sv[1]);
+  free(records);
+  free(args);
+  free(env);
+  fio_upgrade_data.state = 1;
+  fio_set_non_block(sv[0]);
+  fio_attach_fd(sv[0], &fio_upgrade_protocol);
+  FIO_LOG_INFO("(%d) starting a binary upgrade (%s), passing %u listening "
+               "socket(s).",
+               (int)getpid(), executable, (unsigned)count);
+  return 0;
+error:
+  FIO_LOG_ERROR("(fio_upgrade) couldn't start the new binary: %s",
+                strerror(errno));
+  if (sv[0] != -1) {
+    close(sv[0]);
+    close(sv[1]);
+  }
+  free(records);
+  free(args);
+  free(env);
+  return -1;
+}
+
+/* the (signal safe) SIGUSR2 handler */
+static void fio_upgrade_signal(void) { fio_upgrade_data.flag = 1; }
+
+/* performs a SIGUSR2 upgrade request (called by the reactor) */
+static void fio_upgrade_review(void) {
+  if (!fio_upgrade_data.flag)
+    return;
+  fio_upgrade_data.flag = 0;
+  if (fio_parent_pid() == getpid())
+    fio_upgrade(NULL, NULL);
+}
+
+#define fio_upgrade_handed_off() (fio_upgrade_data.state == 2)
+
+#else
+
+int fio_upgrade(const char *executable, char *const argv[]) {
+  errno = ENOTSUP;
+  return -1;
+  (void)executable;
+  (void)argv;
+}
+
+#define fio_upgrade_listener(...) ((intptr_t)-1)
+#define fio_upgrade_handed_off() 0
+
+#endif /* FIO_DISABLE_HOT_RESTART */
+
+/*
+ * Doubles the accept budget while wakeups use all of it (the queue was left
+ * with pending connections) and halves it when wakeups use less than a quarter.
+ *
+ * Called by `on_data`, which is never performed concurrently for a socket.
+ */
+static inline void fio_listen_accept_budget(fio_listen_protocol_s *pr,
+                                            size_t accepted) {
+  if (accepted >= pr->accept_budget) {
+    fio_atomic_add(&fio_accept_counters.budget_exhausted, 1);
+    pr->accept_budget <<= 1;
+    if (pr->accept_budget > pr->accept_max)
+      pr->accept_budget = pr->accept_max;
+  } else if (accepted < (pr->accept_budget >> 2)) {
+    pr->accept_budget >>= 1;
+    if (pr->accept_budget < FIO_LISTEN_ACCEPT_BATCH)
+      pr->accept_budget = FIO_LISTEN_ACCEPT_BATCH;
+  }
+}
+
+/* attaches a CBPF program selecting the SO_REUSEPORT socket `cpu % workers` */
+static void fio_listen_steer_cpu(intptr_t uuid) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+  if (fio_data->workers < 2)
+    return;
+  struct sock_filter code[] = {
+      {BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)},
+      {BPF_ALU | BPF_MOD | BPF_K, 0, 0, fio_data->workers},
+      {BPF_RET | BPF_A, 0, 0, 0},
+  };
+  struct sock_fprog prog = {.len = sizeof(code) / sizeof(code[0]),
+                            .filter = code};
+  /* the kernel falls back to hashing when the index has no socket */
+  if (setsockopt(fio_uuid2fd(uuid), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                 &prog, sizeof(prog)))
+    FIO_LOG_WARNING("(%d) couldn't attach SO_REUSEPORT CPU steering: %s",
+                    (int)getpid(), strerror(errno));
+#else
+  FIO_LOG_WARNING("SO_REUSEPORT CPU steering requires Linux, ignored.");
+  (void)uuid;
+#endif
+}
+
+/*
+ * Replaces the inherited socket (bound, but not listening) with a listening
+ * socket owned by this process, so the kernel balances connections between
+ * the processes instead of waking all of them for every connection.
+ */
+static void fio_listen_reuse_port(fio_listen_protocol_s *pr) {
+  intptr_t uuid =
+      fio_socket2((pr->addr_len ? pr->addr : NULL), pr->port,
+                  (FIO_SOCKET_SERVER | FIO_SOCKET_REUSE_PORT));
+  if (uuid == -1) {
+    FIO_LOG_ERROR("(%d) SO_REUSEPORT failed on port %s (%s), using a shared "
+                  "listening socket.",
+                  (int)getpid(), pr->port, strerror(errno));
+    /* the address is already bound, all that's missing is `listen` */
+    if (listen(fio_uuid2fd(pr->uuid), SOMAXCONN) < 0)
+      FIO_LOG_ERROR("(%d) couldn't listen on port %s: %s", (int)getpid(),
+                    pr->port, strerror(errno));
+    pr->accept_max = FIO_LISTEN_ACCEPT_MAX;
+    return;
+  }
+  if (pr->reuse_port > 1)
+    fio_listen_steer_cpu(uuid);
+  fio_affinity_listen(uuid);
+  fio_force_close(pr->uuid);
+  pr->uuid = uuid;
+}
+
 static void fio_listen_cleanup_task(void *pr_) {
   fio_listen_protocol_s *pr = pr_;
+  fio_ls_embd_remove(&pr->node);
   if (pr->tls)
     fio_tls_destroy(pr->tls);
   if (pr->on_finish) {
@@ -4491,8 +7846,8 @@ static void fio_listen_cleanup_task(void *pr_) {
   if (pr->addr &&
       (!pr->port || *pr->port == 0 ||
        (pr->port[0] == '0' && pr->port[1] == 0)) &&
-      fio_is_master()) {
-    /* delete Unix sockets */
+      fio_is_master() && !fio_upgrade_handed_off()) {
+    /* delete Unix sockets (unless an upgraded binary inherited them) */
     unlink(pr->addr);
   }
   free(pr_);
@@ -4501,6 +7856,8 @@ static void fio_listen_cleanup_task(void *pr_) {
 static void fio_listen_on_startup(void *pr_) {
   fio_state_callback_remove(FIO_CALL_ON_SHUTDOWN, fio_listen_cleanup_task, pr_);
   fio_listen_protocol_s *pr = pr_;
+  if (pr->reuse_port)
+    fio_listen_reuse_port(pr);
   fio_attach(pr->uuid, &pr->pr);
   if (pr->port_len)
     FIO_LOG_DEBUG("(%d) started listening on port %s", (int)getpid(), pr->port);
@@ -4514,35 +7871,71 @@ static void fio_listen_on_close(intptr_t uuid, fio_protocol_s *pr_) {
   (void)uuid;
 }
 
+/*
+ * Applies the per address limits to a new connection (before any protocol
+ * allocation), closing rejected connections.
+ *
+ * Returns 0 if the connection was admitted and -1 if it was rejected.
+ */
+static inline int fio_listen_admit(fio_listen_protocol_s *pr, intptr_t client) {
+  if (!(pr->connection_rate | pr->connections_per_address))
+    return 0;
+  fio_str_info_s addr = fio_peer_addr(client);
+  if (!addr.len)
+    return 0;
+  uintptr_t key = fio_rate_limit_key((uintptr_t)pr, addr);
+  if (fio_rate_limit_take(key, pr->connection_rate, pr->connection_burst,
+                          pr->connections_per_address, fio_rate_limit_now())) {
+    fio_metrics_add_local(FIO_METRIC_REJECTED, 1);
+    fio_force_close(client);
+    return -1;
+  }
+  if (pr->connections_per_address)
+    fio_uuid_link(client, (void *)key, fio_rate_limit_on_close);
+  return 0;
+}
+
 static void fio_listen_on_data(intptr_t uuid, fio_protocol_s *pr_) {
   fio_listen_protocol_s *pr = (fio_listen_protocol_s *)pr_;
-  for (int i = 0; i < 4; ++i) {
+  size_t i = 0;
+  for (; i < pr->accept_budget; ++i) {
     intptr_t client = fio_accept(uuid);
     if (client == -1)
-      return;
+      break;
+    if (fio_listen_admit(pr, client))
+      continue;
     pr->on_open(client, pr->udata);
   }
+  fio_listen_accept_budget(pr, i);
 }
 
 static void fio_listen_on_data_tls(intptr_t uuid, fio_protocol_s *pr_) {
   fio_listen_protocol_s *pr = (fio_listen_protocol_s *)pr_;
-  for (int i = 0; i < 4; ++i) {
+  size_t i = 0;
+  for (; i < pr->accept_budget; ++i) {
     intptr_t client = fio_accept(uuid);
     if (client == -1)
-      return;
+      break;
+    if (fio_listen_admit(pr, client))
+      continue;
     fio_tls_accept(client, pr->tls, pr->udata);
     pr->on_open(client, pr->udata);
   }
+  fio_listen_accept_budget(pr, i);
 }
 
 static void fio_listen_on_data_tls_alpn(intptr_t uuid, fio_protocol_s *pr_) {
   fio_listen_protocol_s *pr = (fio_listen_protocol_s *)pr_;
-  for (int i = 0; i < 4; ++i) {
+  size_t i = 0;
+  for (; i < pr->accept_budget; ++i) {
     intptr_t client = fio_accept(uuid);
     if (client == -1)
-      return;
+      break;
+    if (fio_listen_admit(pr, client))
+      continue;
     fio_tls_accept(client, pr->tls, pr->udata);
   }
+  fio_listen_accept_budget(pr, i);
 }
 
 /* stub for editor - unused */
@@ -4577,9 +7970,33 @@ intptr_t fio_listen FIO_IGNORE_MACRO(struct fio_listen_args args) {
       goto error;
     }
   }
-  const intptr_t uuid = fio_socket(args.address, args.port, 1);
+  if (args.reuse_port && !port_len) {
+    FIO_LOG_WARNING("(fio_listen) reuse_port ignored for Unix sockets.");
+    args.reuse_port = 0;
+  }
+#ifndef FIO_SO_REUSEPORT
+  if (args.reuse_port) {
+    FIO_LOG_WARNING("(fio_listen) SO_REUSEPORT load balancing unavailable, "
+                    "reuse_port ignored.");
+    args.reuse_port = 0;
+  }
+#endif
+  /* a binary upgrade passes the listening sockets to the new process */
+  intptr_t uuid = fio_upgrade_listener(args.address, addr_len, args.port,
+                                       port_len);
+  if (uuid == -1) {
+    /* before the workers start, the address is only reserved (on_startup) */
+    uuid = fio_socket2(args.address, args.port,
+                       (FIO_SOCKET_SERVER |
+                        (args.reuse_port
+                             ? (FIO_SOCKET_REUSE_PORT |
+                                (fio_is_running() ? 0 : FIO_SOCKET_BIND_ONLY))
+                             : 0)));
+  }
   if (uuid == -1)
     goto error;
+  if (args.reuse_port > 1 && fio_is_running())
+    fio_listen_steer_cpu(uuid);
 
   fio_listen_protocol_s *pr = malloc(sizeof(*pr) + addr_len + port_len +
                                      ((addr_len + port_len) ? 2 : 0));
@@ -4608,6 +8025,14 @@ intptr_t fio_listen FIO_IGNORE_MACRO(struct fio_listen_args args) {
       .port_len = port_len,
       .addr = (char *)(pr + 1),
       .port = ((char *)(pr + 1) + addr_len + 1),
+      .accept_budget = FIO_LISTEN_ACCEPT_BATCH,
+      .accept_max = (args.reuse_port ? FIO_LISTEN_ACCEPT_MAX_REUSEPORT
+                                     : FIO_LISTEN_ACCEPT_MAX),
+      .connection_rate = args.connection_rate,
+      .connection_burst = args.connection_burst,
+      .connections_per_address = args.connections_per_address,
+      .reuse_port = (args.reuse_port && !fio_is_running()) ? args.reuse_port
+                                                          : 0,
   };
 
   if (addr_len)
@@ -4618,12 +8043,14 @@ intptr_t fio_listen FIO_IGNORE_MACRO(struct fio_listen_args args) {
   if (fio_is_running()) {
     fio_attach(pr->uuid, &pr->pr);
   } else {
+    fio_ls_embd_push(&fio_listeners, &pr->node);
     fio_state_callback_add(FIO_CALL_ON_START, fio_listen_on_startup, pr);
     fio_state_callback_add(FIO_CALL_ON_SHUTDOWN, fio_listen_cleanup_task, pr);
   }
 
   if (args.port)
-    FIO_LOG_INFO("Listening on port %s", args.port);
+    FIO_LOG_INFO("Listening on port %s%s", args.port,
+                 (args.reuse_port ? " (SO_REUSEPORT)" : ""));
   else
     FIO_LOG_INFO("Listening on Unix Socket at %s", args.address);
 
@@ -4728,6 +8155,198 @@ static void fio_connect_on_ready_tls_alpn(intptr_t uuid, fio_protocol_s *pr_) {
   (void)uuid;
 }
 
+/* attaches the connection protocol (takes ownership of the TLS reference) */
+static void fio_connect_attach(intptr_t uuid, struct fio_connect_args *args) {
+  fio_timeout_set(uuid, args->timeout);
+
+  fio_connect_protocol_s *pr = fio_malloc(sizeof(*pr));
+  FIO_ASSERT_ALLOC(pr);
+
+  *pr = (fio_connect_protocol_s){
+      .pr =
+          {
+              .on_ready = (args->tls ? (fio_tls_alpn_count(args->tls)
+                                            ? fio_connect_on_ready_tls_alpn
+                                            : fio_connect_on_ready_tls)
+                                     : fio_connect_on_ready),
+              .on_close = fio_connect_on_close,
+          },
+      .uuid = uuid,
+      .tls = args->tls,
+      .udata = args->udata,
+      .on_connect = args->on_connect,
+      .on_fail = args->on_fail,
+  };
+  fio_attach(uuid, &pr->pr);
+}
+
+/* *****************************************************************************
+Asynchronous host name resolution for `fio_connect`
+
+Host names that aren't numerical (or cached) are resolved by a small pool of
+resolver threads, so a slow DNS server never blocks the reactor or the task
+queue. `fio_connect` returns a reserved uuid right away and the connection
+protocol is attached once the address was resolved.
+***************************************************************************** */
+
+#ifndef FIO_DNS_THREADS
+/** The maximal number of threads resolving host names for `fio_connect`. */
+#define FIO_DNS_THREADS 4
+#endif
+
+typedef struct {
+  fio_ls_embd_s node;
+  struct fio_connect_args args; /* `address` and `port` point to `buf` */
+  fio_dns_addr_s addr;
+  intptr_t uuid;
+  pid_t pid;
+  int failed;
+  char buf[];
+} fio_dns_job_s;
+
+static struct {
+  fio_ls_embd_s pending; /* jobs waiting for a resolver thread */
+  fio_ls_embd_s active;  /* jobs being resolved */
+  size_t threads;
+  pid_t pid; /* the process running the resolver threads */
+  fio_lock_i lock;
+} fio_dns_queue = {
+    .pending = FIO_LS_INIT(fio_dns_queue.pending),
+    .active = FIO_LS_INIT(fio_dns_queue.active),
+    .lock = FIO_LOCK_INIT,
+};
+
+/* completes (or fails) a connection once the address was resolved */
+static void fio_dns_on_resolved(void *job_, void *ignr_) {
+  fio_dns_job_s *job = job_;
+  const int fd = fio_uuid2fd(job->uuid);
+  /* a forked child doesn't inherit connections that didn't connect yet */
+  if (job->failed || job->pid != getpid() || !fio_is_valid(job->uuid))
+    goto failed;
+  /* replace the reserved socket, keeping the fd (and the uuid) */
+  int tmp = fio_dns_connect_fd(&job->addr);
+  if (tmp == -1)
+    goto failed;
+  if (dup2(tmp, fd) == -1) {
+    close(tmp);
+    goto failed;
+  }
+  close(tmp);
+  fio_tcp_addr_cpy(fd, job->addr.family, (struct sockaddr *)&job->addr.addr);
+  fio_connect_attach(job->uuid, &job->args);
+  fio_free(job);
+  return;
+failed:
+  fio_force_close(job->uuid);
+  if (job->args.tls)
+    fio_tls_destroy(job->args.tls);
+  if (job->args.on_fail)
+    job->args.on_fail(job->uuid, job->args.udata);
+  fio_free(job);
+  (void)ignr_;
+}
+
+/* a resolver thread, exits once there are no more pending jobs */
+static void *fio_dns_thread(void *ignr_) {
+  for (;;) {
+    fio_lock(&fio_dns_queue.lock);
+    fio_ls_embd_s *node = fio_ls_embd_shift(&fio_dns_queue.pending);
+    if (!node) {
+      --fio_dns_queue.threads;
+      fio_unlock(&fio_dns_queue.lock);
+      return NULL;
+    }
+    fio_ls_embd_push(&fio_dns_queue.active, node);
+    fio_unlock(&fio_dns_queue.lock);
+    fio_dns_job_s *job = FIO_LS_EMBD_OBJ(fio_dns_job_s, node, node);
+    job->failed = fio_dns_resolve(&job->addr, job->args.address,
+                                  job->args.port);
+    fio_lock(&fio_dns_queue.lock);
+    fio_ls_embd_remove(node);
+    fio_unlock(&fio_dns_queue.lock);
+    fio_defer(fio_dns_on_resolved, job, NULL);
+  }
+  (void)ignr_;
+}
+
+/* queues the job, starting a resolver thread if the pool isn't full */
+static void fio_dns_push(fio_dns_job_s *job) {
+  fio_lock(&fio_dns_queue.lock);
+  fio_ls_embd_push(&fio_dns_queue.pending, &job->node);
+  if (fio_dns_queue.threads >= FIO_DNS_THREADS) {
+    fio_unlock(&fio_dns_queue.lock);
+    return;
+  }
+  ++fio_dns_queue.threads;
+  fio_dns_queue.pid = getpid();
+  fio_unlock(&fio_dns_queue.lock);
+  void *thr = fio_thread_new(fio_dns_thread, NULL);
+  if (thr) {
+    fio_thread_free(thr);
+    return;
+  }
+  FIO_LOG_ERROR("(%d) couldn't start a resolver thread, resolving inline.",
+                (int)getpid());
+  fio_dns_thread(NULL);
+}
+
+/* Called within a child process: fails the jobs inherited from the parent. */
+static void fio_dns_on_fork(void) {
+  if (fio_dns_queue.pid == getpid())
+    return; /* called during cleanup, the resolver threads might be running */
+  fio_dns_queue.lock = FIO_LOCK_INIT;
+  fio_dns_cache_lock = FIO_LOCK_INIT;
+  fio_dns_queue.threads = 0;
+  fio_ls_embd_s *node;
+  while ((node = fio_ls_embd_shift(&fio_dns_queue.active)) ||
+         (node = fio_ls_embd_shift(&fio_dns_queue.pending)))
+    fio_defer(fio_dns_on_resolved, FIO_LS_EMBD_OBJ(fio_dns_job_s, node, node),
+              NULL);
+}
+
+/* returns 1 if the address is a host name that isn't cached */
+static int fio_dns_is_pending(struct fio_connect_args *args) {
+  if (!args->address || !args->port)
+    return 0;
+  char *pos = (char *)args->port;
+  if (fio_atol(&pos) <= 0 || *pos)
+    return 0; /* Unix sockets and invalid ports are handled by `fio_socket` */
+  fio_dns_addr_s tmp;
+  return fio_dns_lookup(&tmp, args->address, args->port) != 0;
+}
+
+/* reserves a uuid and queues the host name for resolution */
+static intptr_t fio_connect_async(struct fio_connect_args *args) {
+  /* a placeholder socket, replaced once the address is known */
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+  if (fio_set_non_block(fd) < 0) {
+    close(fd);
+    return -1;
+  }
+  fio_fd_commit(fd);
+  fio_lock(&fd_data(fd).protocol_lock);
+  fio_clear_fd(fd, 1);
+  fio_unlock(&fd_data(fd).protocol_lock);
+  const size_t a_len = strlen(args->address);
+  const size_t p_len = strlen(args->port);
+  fio_dns_job_s *job = fio_malloc(sizeof(*job) + a_len + p_len + 2);
+  FIO_ASSERT_ALLOC(job);
+  *job = (fio_dns_job_s){
+      .args = *args,
+      .uuid = fd2uuid(fd),
+      .pid = getpid(),
+  };
+  memcpy(job->buf, args->address, a_len + 1);
+  memcpy(job->buf + a_len + 1, args->port, p_len + 1);
+  job->args.address = job->buf;
+  job->args.port = job->buf + a_len + 1;
+  const intptr_t uuid = job->uuid;
+  fio_dns_push(job);
+  return uuid;
+}
+
 /* stub for sublime text function navigation */
 intptr_t fio_connect___(struct fio_connect_args args);
 
@@ -4737,33 +8356,23 @@ intptr_t fio_connect FIO_IGNORE_MACRO(struct fio_connect_args args) {
     errno = EINVAL;
     goto error;
   }
-  const intptr_t uuid = fio_socket(args.address, args.port, 0);
+  intptr_t uuid;
+  if (fio_dns_is_pending(&args)) {
+    if (args.tls)
+      fio_tls_dup(args.tls);
+    uuid = fio_connect_async(&args);
+    if (uuid == -1 && args.tls)
+      fio_tls_destroy(args.tls);
+    if (uuid == -1)
+      goto error;
+    return uuid;
+  }
+  uuid = fio_socket(args.address, args.port, 0);
   if (uuid == -1)
     goto error;
-  fio_timeout_set(uuid, args.timeout);
-
-  fio_connect_protocol_s *pr = fio_malloc(sizeof(*pr));
-  FIO_ASSERT_ALLOC(pr);
-
   if (args.tls)
     fio_tls_dup(args.tls);
-
-  *pr = (fio_connect_protocol_s){
-      .pr =
-          {
-              .on_ready = (args.tls ? (fio_tls_alpn_count(args.tls)
-                                           ? fio_connect_on_ready_tls_alpn
-                                           : fio_connect_on_ready_tls)
-                                    : fio_connect_on_ready),
-              .on_close = fio_connect_on_close,
-          },
-      .uuid = uuid,
-      .tls = args.tls,
-      .udata = args.udata,
-      .on_connect = args.on_connect,
-      .on_fail = args.on_fail,
-  };
-  fio_attach(uuid, &pr->pr);
+  fio_connect_attach(uuid, &args);
   return uuid;
 error:
   if (args.on_fail)
@@ -4974,48 +8583,500 @@ start_path:
 
   r.path = (fio_str_info_s){.data = (char *)url, .len = pos - url};
 
-  if (pos >= end) {
-    goto finish;
+  if (pos >= end) {
+    goto finish;
+  }
+  ++pos;
+  if (pos[-1] == '#')
+    goto start_target;
+
+start_query:
+  url = pos;
+  while (pos < end && pos[0] != '#')
+    ++pos;
+
+  r.query = (fio_str_info_s){.data = (char *)url, .len = pos - url};
+  ++pos;
+
+  if (pos >= end)
+    goto finish;
+
+start_target:
+  r.target = (fio_str_info_s){.data = (char *)pos, .len = end - pos};
+
+finish:
+
+  /* set any empty values to NULL */
+  if (!r.scheme.len)
+    r.scheme.data = NULL;
+  if (!r.user.len)
+    r.user.data = NULL;
+  if (!r.password.len)
+    r.password.data = NULL;
+  if (!r.host.len)
+    r.host.data = NULL;
+  if (!r.port.len)
+    r.port.data = NULL;
+  if (!r.path.len)
+    r.path.data = NULL;
+  if (!r.query.len)
+    r.query.data = NULL;
+  if (!r.target.len)
+    r.target.data = NULL;
+
+  return r;
+}
+
+/* *****************************************************************************
+UDP (datagram) sockets
+***************************************************************************** */
+
+#ifndef FIO_UDP_BATCH
+/** The number of datagrams per `recvmmsg` / `sendmmsg` system call. */
+#define FIO_UDP_BATCH 16
+#endif
+
+#ifndef FIO_UDP_PACKET_SIZE
+/** The receive buffer per datagram (larger datagrams are dropped). */
+#define FIO_UDP_PACKET_SIZE 2048
+#endif
+
+#ifndef FIO_UDP_SEND_BUFFER
+/** The bytes queued by `fio_send_to` before the queue is flushed. */
+#define FIO_UDP_SEND_BUFFER 65536
+#endif
+
+/* the number of receive batches per `on_data` event (fairness) */
+#define FIO_UDP_READ_LOOPS 4
+/* the kernel's limits for a single GSO send (UDP_MAX_SEGMENTS) */
+#define FIO_UDP_GSO_SEGMENTS 64
+#define FIO_UDP_GSO_BYTES 65000
+
+#if defined(__linux__)
+#include <netinet/udp.h>
+#define FIO_UDP_MMSG 1
+#else
+#define FIO_UDP_MMSG 0
+#endif
+
+#if !defined(__linux__) || !defined(UDP_SEGMENT)
+#define FIO_UDP_OFFLOAD 0
+#else
+#define FIO_UDP_OFFLOAD 1
+#endif
+
+typedef struct {
+  fio_protocol_s pr;
+  void (*on_datagram)(intptr_t uuid, void *data, size_t len,
+                      fio_udp_peer_s *peer, void *udata);
+  void (*on_close)(intptr_t uuid, void *udata);
+  void *udata;
+  intptr_t uuid;
+  char *rbuf;      /* FIO_UDP_BATCH receive buffers */
+  size_t rbuf_len; /* the length of each receive buffer */
+  /* the send queue (protected by the protocol's FIO_PR_LOCK_WRITE lock) */
+  size_t queued;
+  size_t queued_bytes;
+  uint8_t flush_scheduled;
+  uint8_t gso;
+  uint8_t gro;
+  uint32_t lengths[FIO_UDP_BATCH];
+  fio_udp_peer_s peers[FIO_UDP_BATCH];
+  char sbuf[FIO_UDP_SEND_BUFFER];
+} fio_udp_protocol_s;
+
+/* opens a non-blocking UDP socket bound to the address (or -1) */
+static int fio_udp_socket(const char *address, const char *port) {
+  struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                           .ai_socktype = SOCK_DGRAM,
+                           .ai_flags = AI_PASSIVE};
+  struct addrinfo *addrinfo;
+  if (getaddrinfo(address, port, &hints, &addrinfo))
+    return -1;
+  int fd = -1;
+  for (struct addrinfo *i = addrinfo; i; i = i->ai_next) {
+    fd = socket(i->ai_family, i->ai_socktype, i->ai_protocol);
+    if (fd == -1)
+      continue;
+    int optval = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    if (!fio_set_non_block(fd) && !bind(fd, i->ai_addr, i->ai_addrlen))
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addrinfo);
+  return fd;
+}
+
+/* sends the queued datagrams (called within the FIO_PR_LOCK_WRITE lock) */
+static void fio_udp_flush(fio_udp_protocol_s *p, int fd) {
+  size_t pos = 0;
+  size_t offset = 0;
+  size_t sent = 0;
+  while (pos < p->queued) {
+#if FIO_UDP_MMSG
+    struct mmsghdr msgs[FIO_UDP_BATCH];
+    struct iovec iov[FIO_UDP_BATCH];
+    size_t counts[FIO_UDP_BATCH];
+#if FIO_UDP_OFFLOAD
+    union {
+      char buf[CMSG_SPACE(sizeof(uint16_t))];
+      size_t align; /* `struct cmsghdr` alignment */
+    } ctrl[FIO_UDP_BATCH];
+#endif
+    size_t count = 0;
+    size_t i = pos;
+    size_t o = offset;
+    while (i < p->queued) {
+      /* GSO: same peer, same length (the last segment might be shorter) */
+      size_t run = 1;
+      size_t run_bytes = p->lengths[i];
+#if FIO_UDP_OFFLOAD
+      while (p->gso && i + run < p->queued && run < FIO_UDP_GSO_SEGMENTS &&
+             p->lengths[i + run - 1] == p->lengths[i] &&
+             p->lengths[i + run] <= p->lengths[i] &&
+             run_bytes + p->lengths[i + run] <= FIO_UDP_GSO_BYTES &&
+             p->peers[i + run].len == p->peers[i].len &&
+             !memcmp(&p->peers[i + run].addr, &p->peers[i].addr,
+                     p->peers[i].len)) {
+        run_bytes += p->lengths[i + run];
+        ++run;
+      }
+#endif
+      iov[count] =
+          (struct iovec){.iov_base = p->sbuf + o, .iov_len = run_bytes};
+      msgs[count] = (struct mmsghdr){
+          .msg_hdr =
+              {
+                  .msg_name = &p->peers[i].addr,
+                  .msg_namelen = p->peers[i].len,
+                  .msg_iov = iov + count,
+                  .msg_iovlen = 1,
+              },
+      };
+#if FIO_UDP_OFFLOAD
+      if (run > 1) {
+        msgs[count].msg_hdr.msg_control = ctrl[count].buf;
+        msgs[count].msg_hdr.msg_controllen = sizeof(ctrl[count].buf);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msgs[count].msg_hdr);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t segment = p->lengths[i];
+        memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+      }
+#endif
+      counts[count++] = run;
+      i += run;
+      o += run_bytes;
+      if (count == FIO_UDP_BATCH)
+        break;
+    }
+    int ret = sendmmsg(fd, msgs, count, 0);
+    if (ret <= 0) {
+      if (ret == -1 && errno == EINTR)
+        continue;
+#if FIO_UDP_OFFLOAD
+      if (ret == -1 && p->gso && (errno == EIO || errno == EINVAL)) {
+        /* the device (or the kernel) doesn't support UDP segmentation */
+        FIO_LOG_DEBUG("(fio_send_to) UDP GSO unavailable, disabled.");
+        p->gso = 0;
+        continue;
+      }
+#endif
+      break;
+    }
+    for (int j = 0; j < ret; ++j) {
+      pos += counts[j];
+      offset += iov[j].iov_len;
+      sent += iov[j].iov_len;
+    }
+#else
+    if (sendto(fd, p->sbuf + offset, p->lengths[pos], 0,
+               (struct sockaddr *)&p->peers[pos].addr, p->peers[pos].len) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    sent += p->lengths[pos];
+    offset += p->lengths[pos];
+    ++pos;
+#endif
+  }
+  if (pos < p->queued)
+    FIO_LOG_DEBUG("(fio_send_to) %zu datagram(s) dropped: %s",
+                  p->queued - pos, strerror(errno));
+  fio_metrics_add_local(FIO_METRIC_BYTES_WRITTEN, sent);
+  p->queued = 0;
+  p->queued_bytes = 0;
+}
+
+static void fio_udp_flush_task(intptr_t uuid, fio_protocol_s *pr, void *ignr) {
+  fio_udp_protocol_s *p = (fio_udp_protocol_s *)pr;
+  p->flush_scheduled = 0;
+  fio_udp_flush(p, fio_uuid2fd(uuid));
+  (void)ignr;
+}
+
+/* queues a datagram (called within the FIO_PR_LOCK_WRITE lock) */
+static int fio_udp_queue(fio_udp_protocol_s *p, int fd,
+                         const fio_udp_peer_s *peer, const void *data,
+                         size_t len) {
+  if (len > FIO_UDP_SEND_BUFFER) {
+    /* too big to queue, send as is (IP fragmentation is likely) */
+    fio_udp_flush(p, fd);
+    ssize_t ret =
+        sendto(fd, data, len, 0, (struct sockaddr *)&peer->addr, peer->len);
+    if (ret > 0)
+      fio_metrics_add_local(FIO_METRIC_BYTES_WRITTEN, ret);
+    return ret < 0 ? -1 : 0;
+  }
+  if (p->queued == FIO_UDP_BATCH ||
+      p->queued_bytes + len > FIO_UDP_SEND_BUFFER)
+    fio_udp_flush(p, fd);
+  memcpy(p->sbuf + p->queued_bytes, data, len);
+  p->peers[p->queued] = *peer;
+  p->lengths[p->queued] = len;
+  p->queued_bytes += len;
+  ++p->queued;
+  return 0;
+}
+
+/* calls `on_datagram` for a received buffer (split into GRO segments) */
+static inline void fio_udp_deliver(fio_udp_protocol_s *p, intptr_t uuid,
+                                   char *data, size_t len, size_t segment,
+                                   fio_udp_peer_s *peer) {
+  if (!segment)
+    segment = len;
+  while (len) {
+    size_t part = (len < segment) ? len : segment;
+    p->on_datagram(uuid, data, part, peer, p->udata);
+    data += part;
+    len -= part;
+  }
+}
+
+static void fio_udp_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  fio_udp_protocol_s *p = (fio_udp_protocol_s *)pr;
+  const int fd = fio_uuid2fd(uuid);
+  fio_udp_peer_s peers[FIO_UDP_BATCH];
+  size_t total = 0;
+  for (size_t loop = 0; loop < FIO_UDP_READ_LOOPS; ++loop) {
+#if FIO_UDP_MMSG
+    struct mmsghdr msgs[FIO_UDP_BATCH];
+    struct iovec iov[FIO_UDP_BATCH];
+#if FIO_UDP_OFFLOAD
+    union {
+      char buf[CMSG_SPACE(sizeof(int))];
+      size_t align; /* `struct cmsghdr` alignment */
+    } ctrl[FIO_UDP_BATCH];
+#endif
+    for (size_t i = 0; i < FIO_UDP_BATCH; ++i) {
+      iov[i] = (struct iovec){.iov_base = p->rbuf + (i * p->rbuf_len),
+                              .iov_len = p->rbuf_len};
+      msgs[i] = (struct mmsghdr){
+          .msg_hdr =
+              {
+                  .msg_name = &peers[i].addr,
+                  .msg_namelen = sizeof(peers[i].addr),
+                  .msg_iov = iov + i,
+                  .msg_iovlen = 1,
+#if FIO_UDP_OFFLOAD
+                  .msg_control = (p->gro ? ctrl[i].buf : NULL),
+                  .msg_controllen = (p->gro ? sizeof(ctrl[i].buf) : 0),
+#endif
+              },
+      };
+    }
+    int count = recvmmsg(fd, msgs, FIO_UDP_BATCH, MSG_DONTWAIT, NULL);
+    if (count <= 0)
+      break;
+    for (int i = 0; i < count; ++i) {
+      total += msgs[i].msg_len;
+      if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+        FIO_LOG_DEBUG("(%d) UDP datagram too long (FIO_UDP_PACKET_SIZE), "
+                      "dropped.",
+                      (int)getpid());
+        continue;
+      }
+      if (!p->on_datagram)
+        continue;
+      size_t segment = 0;
+#if FIO_UDP_OFFLOAD
+      for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm;
+           cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+          int tmp;
+          memcpy(&tmp, CMSG_DATA(cm), sizeof(tmp));
+          segment = tmp;
+        }
+      }
+#endif
+      peers[i].len = msgs[i].msg_hdr.msg_namelen;
+      fio_udp_deliver(p, uuid, iov[i].iov_base, msgs[i].msg_len, segment,
+                      peers + i);
+    }
+    if (count < FIO_UDP_BATCH)
+      break;
+#else
+    size_t i = 0;
+    for (; i < FIO_UDP_BATCH; ++i) {
+      socklen_t len = sizeof(peers[0].addr);
+      ssize_t ret = recvfrom(fd, p->rbuf, p->rbuf_len, MSG_DONTWAIT,
+                             (struct sockaddr *)&peers[0].addr, &len);
+      if (ret < 0)
+        break;
+      total += ret;
+      peers[0].len = len;
+      if (p->on_datagram)
+        p->on_datagram(uuid, p->rbuf, ret, peers, p->udata);
+    }
+    if (i < FIO_UDP_BATCH)
+      break;
+#endif
+  }
+  fio_metrics_add_local(FIO_METRIC_BYTES_READ, total);
+}
+
+/* flushes the send queue before the socket is closed by `fio_stop` */
+static uint8_t fio_udp_on_shutdown(intptr_t uuid, fio_protocol_s *pr) {
+  fio_udp_protocol_s *p = (fio_udp_protocol_s *)pr;
+  if (p->queued && !fio_trylock(&prt_meta(pr).locks[FIO_PR_LOCK_WRITE])) {
+    fio_udp_flush(p, fio_uuid2fd(uuid));
+    fio_unlock(&prt_meta(pr).locks[FIO_PR_LOCK_WRITE]);
   }
-  ++pos;
-  if (pos[-1] == '#')
-    goto start_target;
+  return 0;
+}
 
-start_query:
-  url = pos;
-  while (pos < end && pos[0] != '#')
-    ++pos;
+static void fio_udp_free(fio_udp_protocol_s *p) {
+  free(p->rbuf);
+  free(p);
+}
 
-  r.query = (fio_str_info_s){.data = (char *)url, .len = pos - url};
-  ++pos;
+static void fio_udp_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  fio_udp_protocol_s *p = (fio_udp_protocol_s *)pr;
+  if (p->on_close)
+    p->on_close(uuid, p->udata);
+  fio_udp_free(p);
+}
 
-  if (pos >= end)
-    goto finish;
+static void fio_udp_cleanup_task(void *p_) {
+  fio_udp_protocol_s *p = p_;
+  if (p->on_close)
+    p->on_close(p->uuid, p->udata);
+  fio_force_close(p->uuid);
+  fio_udp_free(p);
+}
 
-start_target:
-  r.target = (fio_str_info_s){.data = (char *)pos, .len = end - pos};
+static void fio_udp_on_startup(void *p_) {
+  fio_state_callback_remove(FIO_CALL_ON_SHUTDOWN, fio_udp_cleanup_task, p_);
+  fio_udp_protocol_s *p = p_;
+  fio_attach(p->uuid, &p->pr);
+}
 
-finish:
+/* creates the protocol object for a new UDP socket (or NULL) */
+static fio_udp_protocol_s *fio_udp_new(struct fio_udp_args *args) {
+  int fd = fio_udp_socket(args->address, args->port);
+  if (fd == -1)
+    return NULL;
+  fio_udp_protocol_s *p = malloc(sizeof(*p));
+  FIO_ASSERT_ALLOC(p);
+  *p = (fio_udp_protocol_s){
+      .pr =
+          {
+              .on_data = fio_udp_on_data,
+              .on_shutdown = fio_udp_on_shutdown,
+              .on_close = fio_udp_on_close,
+              .ping = mock_ping_eternal,
+          },
+      .on_datagram = args->on_datagram,
+      .on_close = args->on_close,
+      .udata = args->udata,
+      .rbuf_len = FIO_UDP_PACKET_SIZE,
+  };
+#if FIO_UDP_OFFLOAD
+  int optval = 1;
+  if (args->gro && !setsockopt(fd, SOL_UDP, UDP_GRO, &optval, sizeof(optval))) {
+    /* coalesced datagrams can be as large as a full IP packet */
+    p->gro = 1;
+    p->rbuf_len = 65536;
+  }
+  p->gso = args->gso;
+#endif
+  p->rbuf = malloc(p->rbuf_len * FIO_UDP_BATCH);
+  FIO_ASSERT_ALLOC(p->rbuf);
+  fio_fd_commit(fd);
+  fio_lock(&fd_data(fd).protocol_lock);
+  fio_clear_fd(fd, 1);
+  fio_unlock(&fd_data(fd).protocol_lock);
+  p->uuid = fd2uuid(fd);
+  return p;
+}
 
-  /* set any empty values to NULL */
-  if (!r.scheme.len)
-    r.scheme.data = NULL;
-  if (!r.user.len)
-    r.user.data = NULL;
-  if (!r.password.len)
-    r.password.data = NULL;
-  if (!r.host.len)
-    r.host.data = NULL;
-  if (!r.port.len)
-    r.port.data = NULL;
-  if (!r.path.len)
-    r.path.data = NULL;
-  if (!r.query.len)
-    r.query.data = NULL;
-  if (!r.target.len)
-    r.target.data = NULL;
+/* public API. */
+intptr_t fio_udp_listen FIO_IGNORE_MACRO(struct fio_udp_args args) {
+  if (!args.port) {
+    errno = EINVAL;
+    return -1;
+  }
+  fio_udp_protocol_s *p = fio_udp_new(&args);
+  if (!p) {
+    FIO_LOG_ERROR("(fio_udp_listen) couldn't bind UDP port %s: %s", args.port,
+                  strerror(errno));
+    return -1;
+  }
+  if (fio_is_running()) {
+    fio_attach(p->uuid, &p->pr);
+  } else {
+    fio_state_callback_add(FIO_CALL_ON_START, fio_udp_on_startup, p);
+    fio_state_callback_add(FIO_CALL_ON_SHUTDOWN, fio_udp_cleanup_task, p);
+  }
+  FIO_LOG_INFO("Listening on UDP port %s", args.port);
+  return p->uuid;
+}
 
-  return r;
+/* public API. */
+int fio_udp_peer_set(fio_udp_peer_s *peer, const char *address,
+                     const char *port) {
+  struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM};
+  struct addrinfo *addrinfo;
+  if (!peer || getaddrinfo(address, port, &hints, &addrinfo))
+    return -1;
+  memcpy(&peer->addr, addrinfo->ai_addr, addrinfo->ai_addrlen);
+  peer->len = addrinfo->ai_addrlen;
+  freeaddrinfo(addrinfo);
+  return 0;
+}
+
+/* public API. */
+int fio_send_to(intptr_t uuid, const fio_udp_peer_s *peer, const void *data,
+                size_t len) {
+  if (!peer || (!data && len))
+    goto invalid;
+  fio_protocol_s *pr;
+  while (!(pr = fio_protocol_try_lock(uuid, FIO_PR_LOCK_WRITE))) {
+    if (errno != EWOULDBLOCK)
+      return -1;
+    fio_reschedule_thread();
+  }
+  if (pr->on_data != fio_udp_on_data) {
+    protocol_unlock(pr, FIO_PR_LOCK_WRITE);
+    goto invalid;
+  }
+  fio_udp_protocol_s *p = (fio_udp_protocol_s *)pr;
+  int ret = fio_udp_queue(p, fio_uuid2fd(uuid), peer, data, len);
+  if (p->queued && !p->flush_scheduled) {
+    /* flushed once the current task (i.e., `on_datagram`) is done */
+    p->flush_scheduled = 1;
+    fio_defer_io_task(uuid, .type = FIO_PR_LOCK_WRITE,
+                      .task = fio_udp_flush_task);
+  }
+  protocol_unlock(pr, FIO_PR_LOCK_WRITE);
+  return ret;
+invalid:
+  errno = EINVAL;
+  return -1;
 }
 
 /* *****************************************************************************
@@ -5094,6 +9155,7 @@ typedef enum fio_cluster_message_type_e {
   FIO_CLUSTER_MSG_SHUTDOWN,
   FIO_CLUSTER_MSG_ERROR,
   FIO_CLUSTER_MSG_PING,
+  FIO_CLUSTER_MSG_SHM,
 } fio_cluster_message_type_e;
 
 typedef struct fio_collection_s fio_collection_s;
@@ -5107,6 +9169,7 @@ typedef struct {
   fio_collection_s *parent;
   fio_match_fn match;
   fio_lock_i lock;
+  fio_ls_embd_s match_node; /* pattern index node (patterns only) */
 } channel_s;
 #pragma pack()
 
@@ -5124,6 +9187,141 @@ struct subscription_s {
   fio_lock_i unsubscribed;
 };
 
+/* *****************************************************************************
+Pattern index - a prefix trie of the patterns' literal (non-wildcard) prefix
+***************************************************************************** */
+
+/*
+ * Glob patterns are indexed by their literal prefix (up to the first wildcard),
+ * so publishing only tests the patterns that might match the channel's name.
+ * Custom matchers (and patterns starting with a wildcard) are always tested.
+ *
+ * The index is protected by the patterns collection lock.
+ */
+
+/* the maximal literal prefix length indexed by the pattern trie */
+#ifndef FIO_PUBSUB_PATTERN_DEPTH
+#define FIO_PUBSUB_PATTERN_DEPTH 32
+#endif
+
+static int fio_glob_match(fio_str_info_s pat, fio_str_info_s ch);
+
+typedef struct fio_match_trie_s fio_match_trie_s;
+struct fio_match_trie_s {
+  fio_ls_embd_s channels;      /* patterns with a literal prefix ending here */
+  fio_match_trie_s **children; /* child nodes, sorted by their `key` */
+  uint16_t count;
+  uint16_t capa;
+  uint8_t key;
+};
+
+static fio_match_trie_s fio_match_trie = {
+    .channels = FIO_LS_INIT(fio_match_trie.channels),
+};
+
+/* returns the position of `key` in the node's children (or where it belongs) */
+static inline size_t fio_match_trie_pos(fio_match_trie_s *node, uint8_t key) {
+  size_t lo = 0, hi = node->count;
+  while (lo < hi) {
+    const size_t mid = (lo + hi) >> 1;
+    if (node->children[mid]->key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* returns the child node for `key`, if any */
+static inline fio_match_trie_s *fio_match_trie_child(fio_match_trie_s *node,
+                                                     uint8_t key) {
+  const size_t pos = fio_match_trie_pos(node, key);
+  if (pos < node->count && node->children[pos]->key == key)
+    return node->children[pos];
+  return NULL;
+}
+
+/* the length of the pattern's literal prefix (a match must start with it) */
+static size_t fio_match_trie_prefix(channel_s *ch) {
+  if (ch->match != fio_glob_match)
+    return 0;
+  size_t len = 0;
+  while (len < ch->name_len && len < FIO_PUBSUB_PATTERN_DEPTH) {
+    switch (ch->name[len]) {
+    case '*': /* fallthrough */
+    case '?': /* fallthrough */
+    case '[': /* fallthrough */
+    case '\\':
+      return len;
+    }
+    ++len;
+  }
+  return len;
+}
+
+/* adds a pattern channel to the index (called within the collection lock) */
+static void fio_match_trie_add(channel_s *ch) {
+  fio_match_trie_s *node = &fio_match_trie;
+  const size_t len = fio_match_trie_prefix(ch);
+  for (size_t i = 0; i < len; ++i) {
+    const uint8_t key = (uint8_t)ch->name[i];
+    const size_t pos = fio_match_trie_pos(node, key);
+    if (pos == node->count || node->children[pos]->key != key) {
+      if (node->count == node->capa) {
+        node->capa = node->capa ? (node->capa << 1) : 2;
+        node->children =
+            realloc(node->children, sizeof(*node->children) * node->capa);
+        FIO_ASSERT_ALLOC(node->children);
+      }
+      fio_match_trie_s *child = malloc(sizeof(*child));
+      FIO_ASSERT_ALLOC(child);
+      *child = (fio_match_trie_s){
+          .channels = FIO_LS_INIT(child->channels),
+          .key = key,
+      };
+      memmove(node->children + pos + 1, node->children + pos,
+              sizeof(*node->children) * (node->count - pos));
+      node->children[pos] = child;
+      ++node->count;
+    }
+    node = node->children[pos];
+  }
+  fio_ls_embd_push(&node->channels, &ch->match_node);
+}
+
+/* removes a pattern channel from the index, pruning any empty nodes */
+static void fio_match_trie_remove(channel_s *ch) {
+  fio_match_trie_s *path[FIO_PUBSUB_PATTERN_DEPTH + 1];
+  size_t pos[FIO_PUBSUB_PATTERN_DEPTH];
+  const size_t len = fio_match_trie_prefix(ch);
+  fio_ls_embd_remove(&ch->match_node);
+  path[0] = &fio_match_trie;
+  for (size_t i = 0; i < len; ++i) {
+    pos[i] = fio_match_trie_pos(path[i], (uint8_t)ch->name[i]);
+    path[i + 1] = path[i]->children[pos[i]];
+  }
+  for (size_t i = len; i; --i) {
+    fio_match_trie_s *node = path[i];
+    if (node->count || fio_ls_embd_any(&node->channels))
+      break;
+    free(node->children);
+    free(node);
+    node = path[i - 1];
+    --node->count;
+    memmove(node->children + pos[i - 1], node->children + pos[i - 1] + 1,
+            sizeof(*node->children) * (node->count - pos[i - 1]));
+  }
+  if (!fio_match_trie.count) {
+    free(fio_match_trie.children);
+    fio_match_trie.children = NULL;
+    fio_match_trie.capa = 0;
+  }
+}
+
+/* *****************************************************************************
+Channel objects
+***************************************************************************** */
+
 /* Use `malloc` / `free`, because channles might have a long life. */
 
 /** Used internally by the Set object to create a new channel. */
@@ -5140,6 +9338,8 @@ static channel_s *fio_channel_copy(channel_s *src) {
   dest->subscriptions = (fio_ls_embd_s)FIO_LS_INIT(dest->subscriptions);
   dest->ref = 1;
   dest->lock = FIO_LOCK_INIT;
+  if (dest->match)
+    fio_match_trie_add(dest);
   return dest;
 }
 /** Frees a channel (reference counting). */
@@ -5150,6 +9350,12 @@ static void fio_channel_free(channel_s *ch) {
     return;
   free(ch);
 }
+/** Removes a channel from the pattern index before releasing it. */
+static void fio_channel_remove(channel_s *ch) {
+  if (ch->match)
+    fio_match_trie_remove(ch);
+  fio_channel_free(ch);
+}
 /** Increases a channel's reference count. */
 static void fio_channel_dup(channel_s *ch) {
   if (!ch)
@@ -5166,8 +9372,10 @@ static int fio_channel_cmp(channel_s *ch1, channel_s *ch2) {
 #define FIO_SET_NAME fio_ch_set
 #define FIO_SET_OBJ_TYPE channel_s *
 #define FIO_SET_OBJ_COMPARE(o1, o2) fio_channel_cmp((o1), (o2))
-#define FIO_SET_OBJ_DESTROY(obj) fio_channel_free((obj))
+#define FIO_SET_OBJ_DESTROY(obj) fio_channel_remove((obj))
 #define FIO_SET_OBJ_COPY(dest, src) ((dest) = fio_channel_copy((src)))
+#define FIO_SET_HASH_FALLBACK(ch)                                              \
+  FIO_HASH_FALLBACK_FN((ch)->name, (ch)->name_len)
 #include <fio.h>
 
 #define FIO_FORCE_MALLOC_TMP 1
@@ -5270,7 +9478,8 @@ static fio_msg_internal_s *
 fio_msg_internal_create(int32_t filter, uint32_t type, fio_str_info_s ch,
                         fio_str_info_s data, int8_t is_json, int8_t cpy) {
   fio_meta_ary_s t = FIO_ARY_INIT;
-  if (!filter)
+  /* metadata is only computed for published messages (once per process) */
+  if (!filter && type <= FIO_CLUSTER_MSG_ROOT_JSON)
     t = fio_postoffice_meta_copy_new();
   fio_msg_internal_s *m = fio_malloc(sizeof(*m) + (sizeof(*m->meta) * t.end) +
                                      (ch.len) + (data.len) + 16 + 2);
@@ -5776,20 +9985,24 @@ static void fio_publish2process(fio_msg_internal_s *m) {
                           fio_msg_internal_dup(m));
   }
   if (m->filter == 0) {
-    /* pattern matching match */
+    /* pattern matching match - test only the patterns with a common prefix */
+    fio_match_trie_s *node = &fio_match_trie;
+    size_t i = 0;
     fio_lock(&fio_postoffice.patterns.lock);
-    FIO_SET_FOR_LOOP(&fio_postoffice.patterns.channels, p) {
-      if (!p->hash) {
-        continue;
-      }
-
-      if (p->obj->match(
-              (fio_str_info_s){.data = p->obj->name, .len = p->obj->name_len},
-              m->channel)) {
-        fio_channel_dup(p->obj);
-        fio_defer_push_urgent(fio_publish2channel_task, p->obj,
-                              fio_msg_internal_dup(m));
+    for (;;) {
+      FIO_LS_EMBD_FOR(&node->channels, pos) {
+        channel_s *p = FIO_LS_EMBD_OBJ(channel_s, match_node, pos);
+        if (p->match((fio_str_info_s){.data = p->name, .len = p->name_len},
+                     m->channel)) {
+          fio_channel_dup(p);
+          fio_defer_push_urgent(fio_publish2channel_task, p,
+                                fio_msg_internal_dup(m));
+        }
       }
+      if (i == m->channel.len || i == FIO_PUBSUB_PATTERN_DEPTH ||
+          !(node = fio_match_trie_child(node, (uint8_t)m->channel.data[i])))
+        break;
+      ++i;
     }
     fio_unlock(&fio_postoffice.patterns.lock);
   }
@@ -5803,6 +10016,61 @@ finish:
 
 #define CLUSTER_READ_BUFFER 16384
 
+/*
+ * Published messages sent to a cluster peer are coalesced into a buffer of up
+ * to this many bytes, which is written once per reactor cycle (or when full).
+ *
+ * Should be smaller than FIO_MEMORY_BLOCK_ALLOC_LIMIT to avoid `mmap` calls.
+ */
+#ifndef FIO_CLUSTER_BATCH_LIMIT
+#define FIO_CLUSTER_BATCH_LIMIT 8192
+#endif
+
+/*
+ * If true, published messages are passed between the root process and it's
+ * workers using shared memory ring buffers (one per direction, per worker),
+ * signaled using `eventfd`. The Unix socket is still used for control messages.
+ *
+ * Requires Linux (`eventfd`).
+ */
+#ifndef FIO_CLUSTER_SHM
+#define FIO_CLUSTER_SHM 0
+#endif
+
+#if FIO_CLUSTER_SHM && !defined(__linux__)
+#warning FIO_CLUSTER_SHM requires eventfd (Linux), using the Unix socket.
+#undef FIO_CLUSTER_SHM
+#define FIO_CLUSTER_SHM 0
+#endif
+
+/* the size of each shared memory ring buffer, must be a power of 2 */
+#ifndef FIO_CLUSTER_SHM_SIZE
+#define FIO_CLUSTER_SHM_SIZE (1UL << 18)
+#endif
+
+#if FIO_CLUSTER_SHM
+#include <sys/eventfd.h>
+
+/* A single producer, single consumer byte ring in shared memory. */
+typedef struct {
+  volatile size_t head; /* bytes written, updated by the producer */
+  uint8_t pad_head[64 - sizeof(size_t)];
+  volatile size_t tail; /* bytes read, updated by the consumer */
+  uint8_t pad_tail[64 - sizeof(size_t)];
+  uint8_t data[FIO_CLUSTER_SHM_SIZE];
+} fio_cluster_ring_s;
+
+/* A worker's shared memory transport, created by the root before forking. */
+typedef struct {
+  fio_cluster_ring_s *up;   /* worker => root */
+  fio_cluster_ring_s *down; /* root => worker */
+  int up_fd;                /* eventfd signaling data in `up` */
+  int down_fd;              /* eventfd signaling data in `down` */
+  intptr_t reader;          /* the uuid of the (local) reading eventfd */
+  uintptr_t ref;            /* local reference count (sender + reader) */
+} fio_cluster_shm_s;
+#endif
+
 #define FIO_SET_NAME fio_sub_hash
 #define FIO_SET_OBJ_TYPE subscription_s *
 #define FIO_SET_KEY_TYPE fio_str_s
@@ -5812,6 +10080,8 @@ finish:
 #define FIO_SET_KEY_COMPARE(k1, k2) fio_str_iseq(&(k1), &(k2))
 #define FIO_SET_KEY_DESTROY(key) fio_str_free(&(key))
 #define FIO_SET_OBJ_DESTROY(obj) fio_unsubscribe(obj)
+#define FIO_SET_HASH_FALLBACK(key)                                             \
+  FIO_HASH_FALLBACK_FN(fio_str_data(&(key)), fio_str_len(&(key)))
 #include <fio.h>
 
 #define FIO_CLUSTER_NAME_LIMIT 255
@@ -5830,17 +10100,167 @@ typedef struct cluster_pr_s {
   int32_t filter;
   uint32_t length;
   fio_lock_i lock;
+  struct {
+    char *buf;         /* coalesced outgoing messages */
+    size_t len;        /* bytes waiting to be written */
+    fio_lock_i lock;   /* protects the outgoing buffer */
+    uint8_t scheduled; /* a flush task was scheduled */
+    size_t capa;       /* the outgoing buffer's capacity */
+#if FIO_CLUSTER_SHM
+    fio_cluster_ring_s *ring; /* if set, messages are written to the ring */
+    int signal;               /* eventfd signaled after writing to `ring` */
+#endif
+  } out;
+#if FIO_CLUSTER_SHM
+  fio_cluster_shm_s *shm;  /* shared memory transport (if any) */
+  fio_cluster_ring_s *in; /* if set, data is read from the ring (a reader) */
+#endif
   uint8_t buffer[CLUSTER_READ_BUFFER];
 } cluster_pr_s;
 
 static struct cluster_data_s {
   intptr_t uuid;
-  fio_ls_s clients;
+  fio_ls_s clients;     /* the root's connections (cluster_pr_s objects) */
+  cluster_pr_s *client; /* a worker's connection to the root process */
+#if FIO_CLUSTER_SHM
+  fio_ls_s shm;             /* transports of workers that didn't connect yet */
+  fio_cluster_shm_s *fresh; /* the transport created for the forked worker */
+#endif
   fio_lock_i lock;
   char name[FIO_CLUSTER_NAME_LIMIT + 1];
 } cluster_data = {.clients = FIO_LS_INIT(cluster_data.clients),
+#if FIO_CLUSTER_SHM
+                  .shm = FIO_LS_INIT(cluster_data.shm),
+#endif
                   .lock = FIO_LOCK_INIT};
 
+#if FIO_CLUSTER_SHM
+/* *****************************************************************************
+ * Cluster shared memory transport
+ **************************************************************************** */
+
+/* writes as many bytes as the ring can hold, returning the number written */
+static size_t fio_cluster_ring_write(fio_cluster_ring_s *r, uint8_t *src,
+                                     size_t len) {
+  const size_t head = r->head;
+  const size_t room =
+      FIO_CLUSTER_SHM_SIZE - (head - fio_defer_ring_load(&r->tail));
+  if (len > room)
+    len = room;
+  if (!len)
+    return 0;
+  const size_t pos = head & (FIO_CLUSTER_SHM_SIZE - 1);
+  size_t first = FIO_CLUSTER_SHM_SIZE - pos;
+  if (first > len)
+    first = len;
+  memcpy(r->data + pos, src, first);
+  memcpy(r->data, src + first, len - first);
+  fio_defer_ring_store(&r->head, head + len);
+  return len;
+}
+
+/* reads up to `len` bytes from the ring, returning the number read */
+static size_t fio_cluster_ring_read(fio_cluster_ring_s *r, uint8_t *dest,
+                                    size_t len) {
+  const size_t tail = r->tail;
+  const size_t ready = fio_defer_ring_load(&r->head) - tail;
+  if (len > ready)
+    len = ready;
+  if (!len)
+    return 0;
+  const size_t pos = tail & (FIO_CLUSTER_SHM_SIZE - 1);
+  size_t first = FIO_CLUSTER_SHM_SIZE - pos;
+  if (first > len)
+    first = len;
+  memcpy(dest, r->data + pos, first);
+  memcpy(dest + first, r->data, len - first);
+  fio_defer_ring_store(&r->tail, tail + len);
+  return len;
+}
+
+/* Creates a transport for the next worker (called by the root process). */
+static fio_cluster_shm_s *fio_cluster_shm_new(void) {
+  fio_cluster_shm_s *shm = malloc(sizeof(*shm));
+  FIO_ASSERT_ALLOC(shm);
+  *shm = (fio_cluster_shm_s){.up_fd = -1, .down_fd = -1};
+  shm->up = mmap(NULL, sizeof(*shm->up) * 2, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shm->up == MAP_FAILED)
+    goto error;
+  shm->down = shm->up + 1;
+  shm->up_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  shm->down_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (shm->up_fd == -1 || shm->down_fd == -1)
+    goto error;
+  return shm;
+error:
+  FIO_LOG_WARNING("(%d) cluster shared memory unavailable, using sockets.",
+                  (int)getpid());
+  if (shm->up != MAP_FAILED)
+    munmap(shm->up, sizeof(*shm->up) * 2);
+  if (shm->up_fd != -1)
+    close(shm->up_fd);
+  if (shm->down_fd != -1)
+    close(shm->down_fd);
+  free(shm);
+  return NULL;
+}
+
+/* Unmaps the local view of the transport (the peer's view is unaffected). */
+static void fio_cluster_shm_free(fio_cluster_shm_s *shm) {
+  /* the reader's eventfd is owned (and closed) by the IO reactor */
+  const int reader_fd = shm->reader ? (int)fio_uuid2fd(shm->reader) : -1;
+  if (shm->up_fd != reader_fd)
+    close(shm->up_fd);
+  if (shm->down_fd != reader_fd)
+    close(shm->down_fd);
+  munmap(shm->up, sizeof(*shm->up) * 2);
+  free(shm);
+}
+
+static inline void fio_cluster_shm_release(fio_cluster_shm_s *shm) {
+  if (!shm || fio_atomic_sub(&shm->ref, 1))
+    return;
+  fio_cluster_shm_free(shm);
+}
+
+/* frees all unclaimed transports, except `keep` (called under lock) */
+static void fio_cluster_shm_clear(fio_cluster_shm_s *keep) {
+  while (fio_ls_any(&cluster_data.shm)) {
+    fio_cluster_shm_s *shm = fio_ls_pop(&cluster_data.shm);
+    if (shm != keep)
+      fio_cluster_shm_free(shm);
+  }
+  cluster_data.shm = (fio_ls_s)FIO_LS_INIT(cluster_data.shm);
+  cluster_data.fresh = keep;
+}
+
+/* creates a transport for the worker that's about to be forked */
+static void fio_cluster_shm_before_fork(void *ignr_) {
+  if (!fio_is_master())
+    return;
+  fio_cluster_shm_s *shm = fio_cluster_shm_new();
+  fio_lock(&cluster_data.lock);
+  cluster_data.fresh = shm;
+  if (shm)
+    fio_ls_push(&cluster_data.shm, shm);
+  fio_unlock(&cluster_data.lock);
+  (void)ignr_;
+}
+
+/* the root process keeps the transport until the worker claimed it */
+static void fio_cluster_shm_in_master(void *ignr_) {
+  cluster_data.fresh = NULL;
+  (void)ignr_;
+}
+
+/* the worker keeps only it's own transport */
+static void fio_cluster_shm_in_child(void *ignr_) {
+  fio_cluster_shm_clear(cluster_data.fresh);
+  (void)ignr_;
+}
+#endif
+
 static void fio_cluster_data_cleanup(int delete_file) {
   if (delete_file && cluster_data.name[0]) {
 #if DEBUG
@@ -5849,14 +10269,18 @@ static void fio_cluster_data_cleanup(int delete_file) {
     unlink(cluster_data.name);
   }
   while (fio_ls_any(&cluster_data.clients)) {
-    intptr_t uuid = (intptr_t)fio_ls_pop(&cluster_data.clients);
-    if (uuid > 0) {
-      fio_close(uuid);
+    cluster_pr_s *pr = fio_ls_pop(&cluster_data.clients);
+    if (pr->uuid > 0) {
+      fio_close(pr->uuid);
     }
   }
   cluster_data.uuid = 0;
+  cluster_data.client = NULL;
   cluster_data.lock = FIO_LOCK_INIT;
   cluster_data.clients = (fio_ls_s)FIO_LS_INIT(cluster_data.clients);
+#if FIO_CLUSTER_SHM
+  fio_cluster_shm_clear(NULL);
+#endif
 }
 
 static void fio_cluster_cleanup(void *ignore) {
@@ -5908,6 +10332,109 @@ static void fio_cluster_init(void) {
 
 static inline void fio_cluster_protocol_free(void *pr) { fio_free(pr); }
 
+/* writes the coalesced messages (if any), called within the `out` lock */
+static inline void fio_cluster_out_write(cluster_pr_s *pr) {
+  if (!pr->out.len)
+    return;
+#if FIO_CLUSTER_SHM
+  if (pr->out.ring) {
+    /* the buffer is kept, anything the ring can't hold is written later */
+    size_t written = fio_cluster_ring_write(pr->out.ring,
+                                            (uint8_t *)pr->out.buf, pr->out.len);
+    if (!written)
+      return;
+    pr->out.len -= written;
+    if (pr->out.len)
+      memmove(pr->out.buf, pr->out.buf + written, pr->out.len);
+    eventfd_write(pr->out.signal, 1);
+    return;
+  }
+#endif
+  fio_write2(pr->uuid, .data.buffer = pr->out.buf, .length = pr->out.len,
+             .after.dealloc = fio_free);
+  pr->out.buf = NULL;
+  pr->out.len = 0;
+  pr->out.capa = 0;
+}
+
+/* flushes the coalesced messages once per reactor cycle */
+static void fio_cluster_out_flush(intptr_t uuid, fio_protocol_s *pr_,
+                                  void *ignr_) {
+  cluster_pr_s *pr = (cluster_pr_s *)pr_;
+  fio_lock(&pr->out.lock);
+  pr->out.scheduled = 0;
+  fio_cluster_out_write(pr);
+  if (pr->out.len) {
+    /* the shared memory ring is full, retry on the next cycle */
+    pr->out.scheduled = 1;
+    fio_defer_io_task(pr->uuid, .type = FIO_PR_LOCK_WRITE,
+                      .task = fio_cluster_out_flush);
+  }
+  fio_unlock(&pr->out.lock);
+  (void)uuid;
+  (void)ignr_;
+}
+
+/**
+ * Sends a message to a cluster peer.
+ *
+ * Published messages are copied to the peer's outgoing buffer, so they can be
+ * written (and read by the peer) in batches. Control messages (and big
+ * messages) flush the buffer and are sent as is, preserving message order.
+ *
+ * When a shared memory transport is used, published messages are always
+ * buffered (and written to the ring) while control messages are sent using the
+ * socket, so control messages might arrive before earlier published messages.
+ */
+static void fio_cluster_send(cluster_pr_s *pr, fio_msg_internal_s *m) {
+  const size_t offset = sizeof(*m) + (m->meta_len * sizeof(*m->meta));
+  const size_t len = 16 + m->channel.len + m->data.len + 2;
+  const uint32_t type = fio_str2u32((uint8_t *)m + offset + 8);
+  fio_lock(&pr->out.lock);
+#if FIO_CLUSTER_SHM
+  if (pr->out.ring) {
+    if (type > FIO_CLUSTER_MSG_ROOT_JSON) {
+      fio_msg_internal_send_dup(pr->uuid, m);
+      fio_unlock(&pr->out.lock);
+      return;
+    }
+    if (pr->out.len + len > pr->out.capa) {
+      size_t capa = pr->out.capa ? pr->out.capa : FIO_CLUSTER_BATCH_LIMIT;
+      while (capa < pr->out.len + len)
+        capa <<= 1;
+      pr->out.buf = fio_realloc2(pr->out.buf, capa, pr->out.len);
+      FIO_ASSERT_ALLOC(pr->out.buf);
+      pr->out.capa = capa;
+    }
+    goto buffer_message;
+  }
+#endif
+  if (len >= FIO_CLUSTER_BATCH_LIMIT || type > FIO_CLUSTER_MSG_ROOT_JSON) {
+    fio_cluster_out_write(pr);
+    fio_msg_internal_send_dup(pr->uuid, m);
+    fio_unlock(&pr->out.lock);
+    return;
+  }
+  if (pr->out.len + len > FIO_CLUSTER_BATCH_LIMIT)
+    fio_cluster_out_write(pr);
+  if (!pr->out.buf) {
+    pr->out.buf = fio_malloc(FIO_CLUSTER_BATCH_LIMIT);
+    FIO_ASSERT_ALLOC(pr->out.buf);
+    pr->out.capa = FIO_CLUSTER_BATCH_LIMIT;
+  }
+#if FIO_CLUSTER_SHM
+buffer_message:
+#endif
+  memcpy(pr->out.buf + pr->out.len, (uint8_t *)m + offset, len);
+  pr->out.len += len;
+  if (!pr->out.scheduled) {
+    pr->out.scheduled = 1;
+    fio_defer_io_task(pr->uuid, .type = FIO_PR_LOCK_WRITE,
+                      .task = fio_cluster_out_flush);
+  }
+  fio_unlock(&pr->out.lock);
+}
+
 static uint8_t fio_cluster_on_shutdown(intptr_t uuid, fio_protocol_s *pr_) {
   cluster_pr_s *p = (cluster_pr_s *)pr_;
   p->sender(fio_msg_internal_create(0, FIO_CLUSTER_MSG_SHUTDOWN,
@@ -5921,11 +10448,21 @@ static uint8_t fio_cluster_on_shutdown(intptr_t uuid, fio_protocol_s *pr_) {
 
 static void fio_cluster_on_data(intptr_t uuid, fio_protocol_s *pr_) {
   cluster_pr_s *c = (cluster_pr_s *)pr_;
-  ssize_t i =
-      fio_read(uuid, c->buffer + c->length, CLUSTER_READ_BUFFER - c->length);
+  ssize_t i;
+  size_t space;
+read_batch:
+  /* messages are written in batches, keep reading until the socket is empty */
+  space = CLUSTER_READ_BUFFER - c->length;
+#if FIO_CLUSTER_SHM
+  if (c->in)
+    i = (ssize_t)fio_cluster_ring_read(c->in, c->buffer + c->length, space);
+  else
+#endif
+    i = fio_read(uuid, c->buffer + c->length, space);
   if (i <= 0)
     return;
   c->length += i;
+  space -= i;
   i = 0;
   do {
     if (!c->exp_channel && !c->exp_msg) {
@@ -6001,6 +10538,8 @@ static void fio_cluster_on_data(intptr_t uuid, fio_protocol_s *pr_) {
   if (c->length && i) {
     memmove(c->buffer, c->buffer + i, c->length);
   }
+  if (!space)
+    goto read_batch;
   (void)pr_;
 }
 
@@ -6019,13 +10558,19 @@ static void fio_cluster_on_close(intptr_t uuid, fio_protocol_s *pr_) {
     /* a child was lost, respawning is handled elsewhere. */
     fio_lock(&cluster_data.lock);
     FIO_LS_FOR(&cluster_data.clients, pos) {
-      if (pos->obj == (void *)uuid) {
+      if (pos->obj == (void *)c) {
         fio_ls_remove(pos);
         break;
       }
     }
     fio_unlock(&cluster_data.lock);
-  } else if (fio_data->active) {
+  } else {
+    fio_lock(&cluster_data.lock);
+    if (cluster_data.client == c)
+      cluster_data.client = NULL;
+    fio_unlock(&cluster_data.lock);
+  }
+  if (fio_data->is_worker && fio_data->active) {
     /* no shutdown message received - parent crashed. */
     if (c->type != FIO_CLUSTER_MSG_SHUTDOWN && fio_is_running()) {
       FIO_LOG_FATAL("(%d) Parent Process crash detected!", (int)getpid());
@@ -6038,6 +10583,14 @@ static void fio_cluster_on_close(intptr_t uuid, fio_protocol_s *pr_) {
   if (c->msg)
     fio_msg_internal_free(c->msg);
   c->msg = NULL;
+  fio_free(c->out.buf);
+  c->out.buf = NULL;
+#if FIO_CLUSTER_SHM
+  if (c->shm) {
+    fio_force_close(c->shm->reader);
+    fio_cluster_shm_release(c->shm);
+  }
+#endif
   fio_sub_hash_free(&c->pubsub);
   fio_cluster_protocol_free(c);
   (void)uuid;
@@ -6064,9 +10617,60 @@ fio_cluster_protocol_alloc(intptr_t uuid,
   p->pubsub = (fio_sub_hash_s)FIO_SET_INIT;
   p->patterns = (fio_sub_hash_s)FIO_SET_INIT;
   p->lock = FIO_LOCK_INIT;
+  p->out.lock = FIO_LOCK_INIT;
   return &p->protocol;
 }
 
+#if FIO_CLUSTER_SHM
+static void fio_cluster_shm_on_data(intptr_t uuid, fio_protocol_s *pr_) {
+  /* reset the signal before reading, so new data will trigger a new event */
+  eventfd_t ignr;
+  eventfd_read(fio_uuid2fd(uuid), &ignr);
+  fio_cluster_on_data(uuid, pr_);
+}
+
+static void fio_cluster_shm_on_close(intptr_t uuid, fio_protocol_s *pr_) {
+  cluster_pr_s *c = (cluster_pr_s *)pr_;
+  if (c->msg)
+    fio_msg_internal_free(c->msg);
+  fio_cluster_shm_release(c->shm);
+  fio_cluster_protocol_free(c);
+  (void)uuid;
+}
+
+/**
+ * Moves a cluster connection's published messages to the shared memory
+ * transport, attaching a reader for the incoming ring's eventfd.
+ *
+ * Both the connection and the reader keep a reference to the transport.
+ */
+static void fio_cluster_shm_attach(cluster_pr_s *pr, fio_cluster_shm_s *shm,
+                                   fio_cluster_ring_s *out, int signal,
+                                   fio_cluster_ring_s *in, int in_fd) {
+  shm->ref = 2;
+  cluster_pr_s *r = (cluster_pr_s *)fio_cluster_protocol_alloc(
+      pr->uuid, pr->handler, pr->sender);
+  r->protocol.on_data = fio_cluster_shm_on_data;
+  r->protocol.on_close = fio_cluster_shm_on_close;
+  r->protocol.on_shutdown = mock_on_shutdown_eternal;
+  r->protocol.ping = mock_ping_eternal;
+  r->shm = shm;
+  r->in = in;
+  shm->reader = fio_fd2uuid(in_fd);
+
+  fio_lock(&pr->out.lock);
+  fio_cluster_out_write(pr); /* messages already buffered use the socket */
+  pr->shm = shm;
+  pr->out.ring = out;
+  pr->out.signal = signal;
+  fio_unlock(&pr->out.lock);
+
+  fio_attach_fd(in_fd, &r->protocol);
+  /* the peer might have written data before the reader was attached */
+  fio_force_event(shm->reader, FIO_EVENT_ON_DATA);
+}
+#endif
+
 /* *****************************************************************************
  * Master (server) IPC Connections
  **************************************************************************** */
@@ -6075,10 +10679,9 @@ static void fio_cluster_server_sender(void *m_, intptr_t avoid_uuid) {
   fio_msg_internal_s *m = m_;
   fio_lock(&cluster_data.lock);
   FIO_LS_FOR(&cluster_data.clients, pos) {
-    if ((intptr_t)pos->obj != -1) {
-      if ((intptr_t)pos->obj != avoid_uuid) {
-        fio_msg_internal_send_dup((intptr_t)pos->obj, m);
-      }
+    cluster_pr_s *pr = (cluster_pr_s *)pos->obj;
+    if (pr->uuid != avoid_uuid) {
+      fio_cluster_send(pr, m);
     }
   }
   fio_unlock(&cluster_data.lock);
@@ -6161,6 +10764,32 @@ static void fio_cluster_server_handler(struct cluster_pr_s *pr) {
     fio_publish2process(fio_msg_internal_dup(pr->msg));
     break;
 
+  case FIO_CLUSTER_MSG_SHM: {
+#if FIO_CLUSTER_SHM
+    /* the worker claims a transport (the address is inherited by `fork`) */
+    fio_cluster_shm_s *shm =
+        (fio_cluster_shm_s *)(uintptr_t)fio_str2u64(pr->msg->data.data);
+    fio_lock(&cluster_data.lock);
+    FIO_LS_FOR(&cluster_data.shm, pos) {
+      if (pos->obj == (void *)shm) {
+        fio_ls_remove(pos);
+        goto found_shm;
+      }
+    }
+    shm = NULL;
+  found_shm:
+    fio_unlock(&cluster_data.lock);
+    if (!shm || pr->shm) {
+      FIO_LOG_WARNING("(%d) unknown cluster shared memory transport.",
+                      (int)getpid());
+      break;
+    }
+    fio_cluster_shm_attach(pr, shm, shm->down, shm->down_fd, shm->up,
+                           shm->up_fd);
+#endif
+    break;
+  }
+
   case FIO_CLUSTER_MSG_SHUTDOWN: /* fallthrough */
   case FIO_CLUSTER_MSG_ERROR:    /* fallthrough */
   case FIO_CLUSTER_MSG_PING:     /* fallthrough */
@@ -6175,12 +10804,12 @@ static void fio_cluster_listen_accept(intptr_t uuid, fio_protocol_s *protocol) {
   /* prevent `accept` backlog in parent */
   intptr_t client;
   while ((client = fio_accept(uuid)) != -1) {
-    fio_attach(client,
-               fio_cluster_protocol_alloc(client, fio_cluster_server_handler,
-                                          fio_cluster_server_sender));
+    fio_protocol_s *pr = fio_cluster_protocol_alloc(
+        client, fio_cluster_server_handler, fio_cluster_server_sender);
     fio_lock(&cluster_data.lock);
-    fio_ls_push(&cluster_data.clients, (void *)client);
+    fio_ls_push(&cluster_data.clients, pr);
     fio_unlock(&cluster_data.lock);
+    fio_attach(client, pr);
   }
 }
 
@@ -6246,6 +10875,7 @@ static void fio_cluster_client_handler(struct cluster_pr_s *pr) {
   case FIO_CLUSTER_MSG_PUBSUB_UNSUB:  /* fallthrough */
   case FIO_CLUSTER_MSG_PATTERN_SUB:   /* fallthrough */
   case FIO_CLUSTER_MSG_PATTERN_UNSUB: /* fallthrough */
+  case FIO_CLUSTER_MSG_SHM:           /* fallthrough */
 
   default:
     break;
@@ -6253,13 +10883,17 @@ static void fio_cluster_client_handler(struct cluster_pr_s *pr) {
 }
 static void fio_cluster_client_sender(void *m_, intptr_t ignr_) {
   fio_msg_internal_s *m = m_;
-  if (!uuid_is_valid(cluster_data.uuid) && fio_data->active) {
-    /* delay message delivery until we have a vaild uuid */
+  fio_lock(&cluster_data.lock);
+  if (!cluster_data.client && fio_data->active) {
+    fio_unlock(&cluster_data.lock);
+    /* delay message delivery until we have a vaild connection */
     fio_defer_push_task((void (*)(void *, void *))fio_cluster_client_sender, m_,
                         (void *)ignr_);
     return;
   }
-  fio_msg_internal_send_dup(cluster_data.uuid, m);
+  if (cluster_data.client)
+    fio_cluster_send(cluster_data.client, m);
+  fio_unlock(&cluster_data.lock);
   fio_msg_internal_free(m);
 }
 
@@ -6275,6 +10909,28 @@ static void fio_cluster_client_sender(void *m_, intptr_t ignr_) {
  */
 static void fio_cluster_on_connect(intptr_t uuid, void *udata) {
   cluster_data.uuid = uuid;
+  fio_protocol_s *pr = fio_cluster_protocol_alloc(
+      uuid, fio_cluster_client_handler, fio_cluster_client_sender);
+  fio_attach(uuid, pr);
+#if FIO_CLUSTER_SHM
+  fio_cluster_shm_s *shm = cluster_data.fresh;
+  cluster_data.fresh = NULL;
+  if (shm) {
+    /* ask root to use the transport before any published message is sent */
+    char buf[8];
+    fio_u2str64(buf, (uint64_t)(uintptr_t)shm);
+    fio_msg_internal_s *m = fio_msg_internal_create(
+        0, FIO_CLUSTER_MSG_SHM, (fio_str_info_s){.len = 0},
+        (fio_str_info_s){.data = buf, .len = 8}, 0, 1);
+    fio_msg_internal_send_dup(uuid, m);
+    fio_msg_internal_free(m);
+    fio_cluster_shm_attach((cluster_pr_s *)pr, shm, shm->up, shm->up_fd,
+                           shm->down, shm->down_fd);
+  }
+#endif
+  fio_lock(&cluster_data.lock);
+  cluster_data.client = (cluster_pr_s *)pr;
+  fio_unlock(&cluster_data.lock);
 
   /* inform root about all existing channels */
   fio_lock(&fio_postoffice.pubsub.lock);
@@ -6293,9 +10949,6 @@ static void fio_cluster_on_connect(intptr_t uuid, void *udata) {
     fio_cluster_inform_root_about_channel(pos->obj, 1);
   }
   fio_unlock(&fio_postoffice.patterns.lock);
-
-  fio_attach(uuid, fio_cluster_protocol_alloc(uuid, fio_cluster_client_handler,
-                                              fio_cluster_client_sender));
   (void)udata;
 }
 /**
@@ -6443,6 +11096,12 @@ static void fio_pubsub_initialize(void) {
   fio_state_callback_add(FIO_CALL_PRE_START, fio_listen2cluster, NULL);
   fio_state_callback_add(FIO_CALL_IN_MASTER, fio_accept_after_fork, NULL);
   fio_state_callback_add(FIO_CALL_IN_CHILD, fio_connect2cluster, NULL);
+#if FIO_CLUSTER_SHM
+  fio_state_callback_add(FIO_CALL_BEFORE_FORK, fio_cluster_shm_before_fork,
+                         NULL);
+  fio_state_callback_add(FIO_CALL_IN_MASTER, fio_cluster_shm_in_master, NULL);
+  fio_state_callback_add(FIO_CALL_IN_CHILD, fio_cluster_shm_in_child, NULL);
+#endif
   fio_state_callback_add(FIO_CALL_ON_FINISH, fio_cluster_cleanup, NULL);
   fio_state_callback_add(FIO_CALL_AT_EXIT, fio_cluster_at_exit, NULL);
 }
@@ -6459,6 +11118,7 @@ static void fio_pubsub_on_fork(void) {
   fio_postoffice.meta.lock = FIO_LOCK_INIT;
   cluster_data.lock = FIO_LOCK_INIT;
   cluster_data.uuid = 0;
+  cluster_data.client = NULL;
   FIO_SET_FOR_LOOP(&fio_postoffice.filters.channels, pos) {
     if (!pos->hash)
       continue;
@@ -6682,6 +11342,207 @@ static void fio_cluster_signal_children(void) {}
 
 #endif /* FIO_PUBSUB_SUPPORT */
 
+/* *****************************************************************************
+Shared Memory Cache
+***************************************************************************** */
+
+/* the number of entries per set (each set has its own lock) */
+#define FIO_SHM_CACHE_WAYS 4
+
+typedef struct {
+  uint64_t hash;      /* the key's hash, 0 == free */
+  uint64_t used;      /* the set's clock when last used (LRU eviction) */
+  uint32_t expires;   /* seconds (see `fio_last_tick`), 0 == never */
+  uint32_t key_len;   /* the key is followed by the value */
+  uint32_t value_len; /* the value's length */
+  uint32_t reserved;
+} fio_shm_cache_entry_s;
+
+typedef struct {
+  fio_lock_i lock;
+  uint64_t clock;
+} fio_shm_cache_set_s;
+
+struct fio_shm_cache_s {
+  size_t mem_len;    /* the mapping's length */
+  size_t mask;       /* the number of sets - 1 */
+  size_t set_len;    /* the bytes per set (header + entries) */
+  size_t entry_len;  /* the bytes per entry (header + data) */
+  size_t entry_size; /* the key + value limit */
+};
+
+#define FIO_SHM_CACHE_ALIGN(n) (((n) + 63) & (~(size_t)63))
+
+static inline fio_shm_cache_set_s *fio_shm_cache_set_of(fio_shm_cache_s *c,
+                                                        uint64_t hash) {
+  return (fio_shm_cache_set_s *)((uintptr_t)c +
+                                 FIO_SHM_CACHE_ALIGN(sizeof(*c)) +
+                                 (((hash >> 1) & c->mask) * c->set_len));
+}
+
+static inline fio_shm_cache_entry_s *
+fio_shm_cache_entry(fio_shm_cache_s *c, fio_shm_cache_set_s *s, size_t i) {
+  return (fio_shm_cache_entry_s *)((uintptr_t)(s + 1) + (i * c->entry_len));
+}
+
+static inline uint64_t fio_shm_cache_hash(fio_str_info_s key) {
+  return fio_risky_hash(key.data, key.len, fio_hash_secret_seed) | 1;
+}
+
+/* finds `key` in a (locked) set, freeing expired entries */
+static fio_shm_cache_entry_s *fio_shm_cache_find(fio_shm_cache_s *c,
+                                                 fio_shm_cache_set_s *s,
+                                                 uint64_t hash,
+                                                 fio_str_info_s key,
+                                                 uint32_t now) {
+  for (size_t i = 0; i < FIO_SHM_CACHE_WAYS; ++i) {
+    fio_shm_cache_entry_s *e = fio_shm_cache_entry(c, s, i);
+    if (e->hash != hash || e->key_len != key.len ||
+        memcmp(e + 1, key.data, key.len))
+      continue;
+    if (e->expires && e->expires <= now) {
+      e->hash = 0;
+      return NULL;
+    }
+    return e;
+  }
+  return NULL;
+}
+
+/* public API. */
+fio_shm_cache_s *
+fio_shm_cache_new FIO_IGNORE_MACRO(struct fio_shm_cache_args_s args) {
+  if (!args.capacity)
+    args.capacity = 1024;
+  if (!args.entry_size)
+    args.entry_size = 256;
+  size_t sets = 1;
+  while (sets * FIO_SHM_CACHE_WAYS < args.capacity)
+    sets <<= 1;
+  const size_t entry_len =
+      (sizeof(fio_shm_cache_entry_s) + args.entry_size + 15) & (~(size_t)15);
+  const size_t set_len = FIO_SHM_CACHE_ALIGN(
+      sizeof(fio_shm_cache_set_s) + (entry_len * FIO_SHM_CACHE_WAYS));
+  const size_t mem_len =
+      FIO_SHM_CACHE_ALIGN(sizeof(fio_shm_cache_s)) + (sets * set_len);
+  if (args.entry_size > 0xFFFFFFFFUL || mem_len / set_len < sets) {
+    errno = EINVAL;
+    return NULL;
+  }
+  fio_shm_cache_s *c = mmap(NULL, mem_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (c == MAP_FAILED) {
+    FIO_LOG_ERROR("couldn't map the shared memory cache (%zu bytes): %s",
+                  mem_len, strerror(errno));
+    return NULL;
+  }
+  if (fio_data && fio_data->workers > 1 && fio_is_running())
+    FIO_LOG_WARNING("(%d) shared memory caches should be created before the "
+                    "workers are forked.",
+                    (int)getpid());
+  *c = (fio_shm_cache_s){
+      .mem_len = mem_len,
+      .mask = sets - 1,
+      .set_len = set_len,
+      .entry_len = entry_len,
+      .entry_size = args.entry_size,
+  };
+  return c;
+}
+
+/* public API. */
+void fio_shm_cache_free(fio_shm_cache_s *c) {
+  if (c)
+    munmap(c, c->mem_len);
+}
+
+static int fio_shm_cache_set2(fio_shm_cache_s *c, fio_str_info_s key,
+                              fio_str_info_s value, uint32_t ttl,
+                              uint32_t now) {
+  if (!c || !key.len || key.len + value.len > c->entry_size) {
+    errno = E2BIG;
+    return -1;
+  }
+  const uint64_t hash = fio_shm_cache_hash(key);
+  fio_shm_cache_set_s *s = fio_shm_cache_set_of(c, hash);
+  fio_lock(&s->lock);
+  fio_shm_cache_entry_s *e = fio_shm_cache_find(c, s, hash, key, now);
+  if (!e) {
+    /* use a free entry, an expired entry or the least recently used entry */
+    e = fio_shm_cache_entry(c, s, 0);
+    for (size_t i = 0; i < FIO_SHM_CACHE_WAYS && e->hash; ++i) {
+      fio_shm_cache_entry_s *tmp = fio_shm_cache_entry(c, s, i);
+      if (!tmp->hash || (tmp->expires && tmp->expires <= now)) {
+        e = tmp;
+        break;
+      }
+      if (tmp->used < e->used)
+        e = tmp;
+    }
+    e->hash = hash;
+    e->key_len = key.len;
+    memcpy(e + 1, key.data, key.len);
+  }
+  e->used = ++s->clock;
+  e->expires = ttl ? now + ttl : 0;
+  e->value_len = value.len;
+  if (value.len)
+    memcpy((char *)(e + 1) + key.len, value.data, value.len);
+  fio_unlock(&s->lock);
+  return 0;
+}
+
+static ssize_t fio_shm_cache_get2(fio_shm_cache_s *c, fio_str_info_s key,
+                                  char *dest, size_t capa, uint32_t now) {
+  if (!c || !key.len)
+    return -1;
+  const uint64_t hash = fio_shm_cache_hash(key);
+  fio_shm_cache_set_s *s = fio_shm_cache_set_of(c, hash);
+  ssize_t ret = -1;
+  fio_lock(&s->lock);
+  fio_shm_cache_entry_s *e = fio_shm_cache_find(c, s, hash, key, now);
+  if (e) {
+    e->used = ++s->clock;
+    ret = e->value_len;
+    if (capa) {
+      size_t len = (e->value_len < capa) ? e->value_len : (capa - 1);
+      memcpy(dest, (char *)(e + 1) + key.len, len);
+      dest[len] = 0;
+    }
+  }
+  fio_unlock(&s->lock);
+  return ret;
+}
+
+/* public API. */
+int fio_shm_cache_set(fio_shm_cache_s *c, fio_str_info_s key,
+                      fio_str_info_s value, uint32_t ttl) {
+  return fio_shm_cache_set2(c, key, value, ttl,
+                            (uint32_t)fio_last_tick().tv_sec);
+}
+
+/* public API. */
+ssize_t fio_shm_cache_get(fio_shm_cache_s *c, fio_str_info_s key, char *dest,
+                          size_t capa) {
+  return fio_shm_cache_get2(c, key, dest, capa,
+                            (uint32_t)fio_last_tick().tv_sec);
+}
+
+/* public API. */
+int fio_shm_cache_remove(fio_shm_cache_s *c, fio_str_info_s key) {
+  if (!c || !key.len)
+    return -1;
+  const uint64_t hash = fio_shm_cache_hash(key);
+  fio_shm_cache_set_s *s = fio_shm_cache_set_of(c, hash);
+  fio_lock(&s->lock);
+  fio_shm_cache_entry_s *e =
+      fio_shm_cache_find(c, s, hash, key, (uint32_t)fio_last_tick().tv_sec);
+  if (e)
+    e->hash = 0;
+  fio_unlock(&s->lock);
+  return e ? 0 : -1;
+}
+
 /* *****************************************************************************
 Section Start Marker
 
@@ -6748,6 +11609,50 @@ Allocator default settings
 #define FIO_MEMORY_BLOCKS_PER_ALLOCATION 256
 #endif
 
+/*
+ * The number of empty blocks each thread keeps for reuse. When non-zero, each
+ * thread slices memory from it's own block, without locking an arena.
+ *
+ * Set to 0 to use the (locked) per-CPU arenas instead.
+ */
+#ifndef FIO_MEMORY_THREAD_CACHE
+#define FIO_MEMORY_THREAD_CACHE 4
+#endif
+
+/*
+ * If true, small allocations are served from per size-class slabs, reusing
+ * freed objects (rather than slicing blocks until the whole block was freed).
+ *
+ * Empty slabs are returned to the system (`madvise`), which limits memory
+ * fragmentation when long-lived and short-lived objects are mixed.
+ */
+#ifndef FIO_MEMORY_SLAB
+#define FIO_MEMORY_SLAB 0
+#endif
+
+#if FIO_MEMORY_SLAB
+/* slabs are managed by size-class, not by thread */
+#undef FIO_MEMORY_THREAD_CACHE
+#define FIO_MEMORY_THREAD_CACHE 0
+/* slab header size, must be divisable by 16 bytes and >= sizeof(fio_slab_s) */
+#define FIO_MEMORY_SLAB_HEADER 64
+/* the slab's first (header) page isn't returned to the system */
+#define FIO_MEMORY_SLAB_PAGE 4096
+/* the maximum number of size classes */
+#define FIO_MEMORY_SLAB_CLASSES 64
+#endif
+
+/*
+ * If true, allocation counters are collected (per thread, without atomics) and
+ * reported by `fio_malloc_stats`.
+ */
+#ifndef FIO_MEMORY_STATS
+#define FIO_MEMORY_STATS 1
+#endif
+
+/* per-thread allocator data is used by the block cache and the statistics */
+#define FIO_MEMORY_THREAD_DATA (FIO_MEMORY_THREAD_CACHE || FIO_MEMORY_STATS)
+
 #define FIO_MEMORY_BLOCK_MASK (FIO_MEMORY_BLOCK_SIZE - 1) /* 0b0...1... */
 
 #define FIO_MEMORY_BLOCK_SLICES (FIO_MEMORY_BLOCK_SIZE >> 4) /* 16B slices */
@@ -6790,6 +11695,24 @@ void fio_malloc_after_fork(void) {}
 void fio_mem_destroy(void) {}
 void fio_mem_init(void) {}
 
+fio_malloc_stats_s fio_malloc_stats(void) {
+  return (fio_malloc_stats_s){.block_size = 0};
+}
+size_t fio_malloc_arena_bytes(size_t arena) {
+  return 0;
+  (void)arena;
+}
+
+fio_region_s *fio_region_set(fio_region_s *region) {
+  return NULL;
+  (void)region;
+}
+void fio_region_reset(fio_region_s *region) { (void)region; }
+int fio_region_owns(const void *mem) {
+  return 0;
+  (void)mem;
+}
+
 #else
 
 /* *****************************************************************************
@@ -6991,7 +11914,8 @@ typedef struct {
 /* The memory allocators persistent state */
 static struct {
   fio_ls_embd_s available; /* free list for memory blocks */
-  // intptr_t count;          /* free list counter */
+  size_t count;            /* free list counter */
+  size_t reserved;         /* blocks collected from the system */
   size_t cores;    /* the number of detected CPU cores*/
   fio_lock_i lock; /* a global lock */
   uint8_t forked;  /* a forked collection indicator. */
@@ -7004,6 +11928,89 @@ static struct {
 /* The per-CPU arena array. */
 static arena_s *arenas;
 
+/* big allocation (`mmap`) counters */
+static size_t fio_mem_big_count;
+static size_t fio_mem_big_bytes;
+
+#if FIO_MEMORY_STATS
+/* allocation counters, by size class (powers of 2) */
+typedef struct {
+  size_t allocations[FIO_MALLOC_STATS_CLASSES];
+#if FIO_MEMORY_SLAB
+  size_t frees_by_class[FIO_MALLOC_STATS_CLASSES];
+#endif
+  size_t frees;
+} fio_mem_counters_s;
+
+/* counters of exited threads (or threads without thread data) */
+static fio_mem_counters_s fio_mem_counters_retired;
+/* the active thread counters */
+static fio_ls_embd_s fio_mem_counters_list =
+    FIO_LS_INIT(fio_mem_counters_list);
+static fio_lock_i fio_mem_counters_lock = FIO_LOCK_INIT;
+
+/* adds the `src` counters to `dest` */
+static void fio_mem_counters_add(fio_mem_counters_s *dest,
+                                 fio_mem_counters_s *src) {
+  for (size_t i = 0; i < FIO_MALLOC_STATS_CLASSES; ++i) {
+    fio_atomic_add(dest->allocations + i, src->allocations[i]);
+#if FIO_MEMORY_SLAB
+    fio_atomic_add(dest->frees_by_class + i, src->frees_by_class[i]);
+#endif
+  }
+  fio_atomic_add(&dest->frees, src->frees);
+}
+#endif
+
+#if FIO_MEMORY_THREAD_DATA
+/* per-thread allocator data (block cache / counters), used without any locks */
+typedef struct {
+#if FIO_MEMORY_THREAD_CACHE
+  block_s *block;
+  block_s *cache[FIO_MEMORY_THREAD_CACHE];
+  uint8_t count;
+#endif
+#if FIO_MEMORY_STATS
+  fio_ls_embd_s node;
+  fio_mem_counters_s counters;
+#endif
+  /* 0 == unregistered, 1 == active, 2 == thread is exiting (use arenas) */
+  uint8_t state;
+} fio_mem_thread_s;
+
+static __thread fio_mem_thread_s fio_mem_thread;
+/* used for the thread exit destructor */
+static pthread_key_t fio_mem_thread_key;
+static uint8_t fio_mem_thread_key_valid;
+#endif
+
+#if FIO_MEMORY_SLAB
+/* A slab header, the memory pool's data (block_node_s) must come first. */
+typedef struct {
+  block_s blk;        /* memory pool data, including the root block */
+  fio_ls_embd_s node; /* memory pool node / partial slab list node */
+  void *free;         /* freed objects, available for reuse */
+  uint32_t used;      /* objects in use */
+  uint32_t capa;      /* total number of objects in the slab */
+  uint32_t bump;      /* objects at this index (and above) were never used */
+  uint8_t cls;        /* the slab's size class */
+} fio_slab_s;
+
+/* a size class */
+typedef struct {
+  fio_ls_embd_s partial; /* slabs with available objects */
+  size_t used;           /* objects in use */
+  size_t slabs;          /* slabs owned by the size class */
+  uint32_t size;         /* object size (in bytes) */
+  fio_lock_i lock;
+} fio_slab_class_s;
+
+static fio_slab_class_s fio_slab_classes[FIO_MEMORY_SLAB_CLASSES];
+static size_t fio_slab_class_count;
+/* maps the allocation size (in 16 byte units) to a size class */
+static uint8_t fio_slab_class_of[(FIO_MEMORY_BLOCK_ALLOC_LIMIT >> 4) + 1];
+#endif
+
 /* The per-CPU arena array. */
 static long double on_malloc_zero;
 
@@ -7063,7 +12070,17 @@ static inline arena_s *arena_lock(arena_s *preffered) {
 
 static __thread arena_s *arena_last_used;
 
-static void arena_enter(void) { arena_last_used = arena_lock(arena_last_used); }
+static void arena_enter(void) {
+#if FIO_AFFINITY
+  /* start with the CPU's arena (it's memory is local to the CPU's node) */
+  if (!arena_last_used) {
+    const int cpu = sched_getcpu();
+    if (cpu >= 0)
+      arena_last_used = arenas + ((size_t)cpu % memory.cores);
+  }
+#endif
+  arena_last_used = arena_lock(arena_last_used);
+}
 
 static inline void arena_exit(void) { fio_unlock(&arena_last_used->lock); }
 
@@ -7078,6 +12095,23 @@ void fio_malloc_after_fork(void) {
   for (size_t i = 0; i < memory.cores; ++i) {
     arenas[i].lock = FIO_LOCK_INIT;
   }
+#if FIO_MEMORY_SLAB
+  for (size_t i = 0; i < fio_slab_class_count; ++i) {
+    fio_slab_classes[i].lock = FIO_LOCK_INIT;
+  }
+#endif
+#if FIO_MEMORY_STATS
+  /* only the forking thread survives, retire the other threads' counters */
+  fio_mem_counters_lock = FIO_LOCK_INIT;
+  while (fio_ls_embd_any(&fio_mem_counters_list)) {
+    fio_mem_thread_s *t = FIO_LS_EMBD_OBJ(
+        fio_mem_thread_s, node, fio_ls_embd_pop(&fio_mem_counters_list));
+    if (t != &fio_mem_thread)
+      fio_mem_counters_add(&fio_mem_counters_retired, &t->counters);
+  }
+  if (fio_mem_thread.state == 1)
+    fio_ls_embd_push(&fio_mem_counters_list, &fio_mem_thread.node);
+#endif
 }
 
 /* *****************************************************************************
@@ -7105,14 +12139,11 @@ static inline void block_init(block_s *blk) {
   fio_atomic_add(&blk->parent->root_ref, 1);
 }
 
-/* intializes the block header for an available block of memory. */
-static inline void block_free(block_s *blk) {
-  if (fio_atomic_sub(&blk->ref, 1))
-    return;
-
-  memset(blk + 1, 0, (FIO_MEMORY_BLOCK_SIZE - sizeof(*blk)));
+/* returns an empty block to the memory pool (or the system). */
+static void block_release(block_s *blk) {
   fio_lock(&memory.lock);
   fio_ls_embd_push(&memory.available, &((block_node_s *)blk)->node);
+  ++memory.count;
 
   blk = blk->parent;
 
@@ -7129,6 +12160,8 @@ static inline void block_free(block_s *blk) {
         (block_node_s *)((uintptr_t)blk + (i * FIO_MEMORY_BLOCK_SIZE));
     fio_ls_embd_remove(&pos->node);
   }
+  memory.count -= FIO_MEMORY_BLOCKS_PER_ALLOCATION;
+  memory.reserved -= FIO_MEMORY_BLOCKS_PER_ALLOCATION;
 
   fio_unlock(&memory.lock);
   sys_free(blk, FIO_MEMORY_BLOCK_SIZE * FIO_MEMORY_BLOCKS_PER_ALLOCATION);
@@ -7136,13 +12169,46 @@ static inline void block_free(block_s *blk) {
   FIO_MEMORY_ON_BLOCK_FREE();
 }
 
+/* caches or releases an empty block (its memory must be zeroed out). */
+static inline void block_recycle(block_s *blk) {
+#if FIO_MEMORY_THREAD_CACHE
+  /* the last reference might be freed by any thread, it's block is empty */
+  if (fio_mem_thread.state == 1 &&
+      fio_mem_thread.count < FIO_MEMORY_THREAD_CACHE) {
+    fio_mem_thread.cache[fio_mem_thread.count++] = blk;
+    return;
+  }
+#endif
+  block_release(blk);
+}
+
+/* decreases a block's reference count, releasing the block if empty. */
+static inline void block_free(block_s *blk) {
+  if (fio_atomic_sub(&blk->ref, 1))
+    return;
+
+  memset(blk + 1, 0, (FIO_MEMORY_BLOCK_SIZE - sizeof(*blk)));
+  block_recycle(blk);
+}
+
 /* intializes the block header for an available block of memory. */
 static inline block_s *block_new(void) {
   block_s *blk = NULL;
 
+#if FIO_MEMORY_THREAD_CACHE
+  if (fio_mem_thread.count) {
+    /* cached blocks are still counted by their root block */
+    blk = fio_mem_thread.cache[--fio_mem_thread.count];
+    blk->ref = 1;
+    blk->pos = FIO_MEMORY_BLOCK_START_POS;
+    return blk;
+  }
+#endif
+
   fio_lock(&memory.lock);
   blk = (block_s *)fio_ls_embd_pop(&memory.available);
   if (blk) {
+    --memory.count;
     blk = (block_s *)FIO_LS_EMBD_OBJ(block_node_s, node, blk);
     FIO_ASSERT(((uintptr_t)blk & FIO_MEMORY_BLOCK_MASK) == 0,
                "Memory allocator error! double `fio_free`?\n");
@@ -7158,6 +12224,8 @@ static inline block_s *block_new(void) {
   }
   FIO_LOG_DEBUG("memory allocator allocated %p from the system", (void *)blk);
   FIO_MEMORY_ON_BLOCK_ALLOC();
+  memory.reserved += FIO_MEMORY_BLOCKS_PER_ALLOCATION;
+  memory.count += FIO_MEMORY_BLOCKS_PER_ALLOCATION - 1;
   block_init_root(blk, blk);
   /* the extra memory goes into the memory pool. initialize + linke-list. */
   block_node_s *tmp = (block_node_s *)blk;
@@ -7171,18 +12239,21 @@ static inline block_s *block_new(void) {
   return blk;
 }
 
-/* allocates memory from within a block - called within an arena's lock */
-static inline void *block_slice(uint16_t units) {
-  block_s *blk = arena_last_used->block;
+/*
+ * allocates memory from within a block - called within an arena's lock (or
+ * using the thread's own block).
+ */
+static inline void *block_slice(block_s **current, uint16_t units) {
+  block_s *blk = *current;
   if (!blk) {
     /* arena is empty */
     blk = block_new();
-    arena_last_used->block = blk;
+    *current = blk;
   } else if (blk->pos + units > FIO_MEMORY_MAX_SLICES_PER_BLOCK) {
     /* not enough memory in the block - rotate */
     block_free(blk);
     blk = block_new();
-    arena_last_used->block = blk;
+    *current = blk;
   }
   if (!blk) {
     /* no system memory available? */
@@ -7196,11 +12267,60 @@ static inline void *block_slice(uint16_t units) {
   if (blk->pos >= FIO_MEMORY_MAX_SLICES_PER_BLOCK) {
     /* ... the block was fully utilized, clear arena */
     block_free(blk);
-    arena_last_used->block = NULL;
+    *current = NULL;
   }
   return (void *)mem;
 }
 
+/* *****************************************************************************
+Per-thread block cache and counters
+***************************************************************************** */
+
+#if FIO_MEMORY_THREAD_DATA
+/* releases the thread's blocks, called when a thread exits. */
+static void fio_mem_thread_destroy(void *thread_) {
+  fio_mem_thread_s *t = thread_;
+  t->state = 2; /* any later allocations (other destructors) use the arenas */
+#if FIO_MEMORY_THREAD_CACHE
+  if (t->block)
+    block_free(t->block);
+  t->block = NULL;
+  while (t->count)
+    block_release(t->cache[--t->count]);
+#endif
+#if FIO_MEMORY_STATS
+  fio_lock(&fio_mem_counters_lock);
+  fio_mem_counters_add(&fio_mem_counters_retired, &t->counters);
+  fio_ls_embd_remove(&t->node);
+  fio_unlock(&fio_mem_counters_lock);
+  t->counters = (fio_mem_counters_s){.frees = 0};
+#endif
+}
+
+/* registers the thread's exit destructor, returns 0 if the thread is exiting */
+static inline int fio_mem_thread_enter(void) {
+  if (fio_mem_thread.state == 1)
+    return 1;
+  if (fio_mem_thread.state || !fio_mem_thread_key_valid ||
+      pthread_setspecific(fio_mem_thread_key, &fio_mem_thread))
+    return 0;
+#if FIO_MEMORY_STATS
+  fio_lock(&fio_mem_counters_lock);
+  fio_ls_embd_push(&fio_mem_counters_list, &fio_mem_thread.node);
+  fio_unlock(&fio_mem_counters_lock);
+#endif
+  fio_mem_thread.state = 1;
+  return 1;
+}
+#endif
+
+#if FIO_MEMORY_THREAD_CACHE
+#define fio_mem_current_block()                                                \
+  (fio_mem_thread.state == 1 ? fio_mem_thread.block : arena_last_used->block)
+#else
+#define fio_mem_current_block() (arena_last_used->block)
+#endif
+
 /* handle's a bock's reference count - called without a lock */
 static inline void block_slice_free(void *mem) {
   /* locate block boundary */
@@ -7208,6 +12328,239 @@ static inline void block_slice_free(void *mem) {
   block_free(blk);
 }
 
+/* *****************************************************************************
+Memory regions (per-scope bump allocation)
+***************************************************************************** */
+
+/* marks a region's block (the `max` field is otherwise unused) */
+#define FIO_MEMORY_REGION_MARK 0xFFFFU
+
+/* the calling thread's active region (if any) */
+static __thread fio_region_s *fio_region_active;
+
+/* tests if the memory was sliced from a region (`fio_free` should ignore it) */
+#define fio_region_is_owner(mem)                                               \
+  (((block_s *)((uintptr_t)(mem) & (~FIO_MEMORY_BLOCK_MASK)))->max ==          \
+   FIO_MEMORY_REGION_MARK)
+
+/* slices memory from the region's block, without touching reference counts */
+static inline void *fio_region_slice(fio_region_s *region, uint16_t units) {
+  block_s *blk = region->block;
+  if (!blk || blk->pos + units > FIO_MEMORY_MAX_SLICES_PER_BLOCK) {
+    block_s *tmp = block_new();
+    if (!tmp) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    tmp->max = FIO_MEMORY_REGION_MARK;
+    /* link the previous block using the (otherwise unused) pool node */
+    ((block_node_s *)tmp)->node.next = (fio_ls_embd_s *)blk;
+    region->block = blk = tmp;
+  }
+  void *mem = (void *)((uintptr_t)blk + ((uintptr_t)blk->pos << 4));
+  blk->pos += units;
+  return mem;
+}
+
+fio_region_s *fio_region_set(fio_region_s *region) {
+  fio_region_s *old = fio_region_active;
+  fio_region_active = region;
+  return old;
+}
+
+void fio_region_reset(fio_region_s *region) {
+  if (!region)
+    return;
+  block_s *blk = region->block;
+  region->block = NULL;
+  while (blk) {
+    block_s *next = (block_s *)((block_node_s *)blk)->node.next;
+    /* memory above `pos` was never sliced, so it's still zeroed out */
+    memset(blk + 1, 0, ((size_t)blk->pos << 4) - sizeof(*blk));
+    blk->max = 0;
+    blk->ref = 0;
+    block_recycle(blk);
+    blk = next;
+  }
+}
+
+int fio_region_owns(const void *mem) {
+  if (!mem || mem == (void *)&on_malloc_zero ||
+      ((uintptr_t)mem & FIO_MEMORY_BLOCK_MASK) == 16)
+    return 0;
+  return fio_region_is_owner(mem);
+}
+
+/* *****************************************************************************
+Size-class slabs (FIO_MEMORY_SLAB)
+***************************************************************************** */
+
+#if FIO_MEMORY_SLAB
+/* initializes the size classes: 16 byte steps up to 128 bytes, 4 per power */
+static void fio_slab_init(void) {
+  size_t size = 16;
+  fio_slab_class_count = 0;
+  for (;;) {
+    FIO_ASSERT(fio_slab_class_count < FIO_MEMORY_SLAB_CLASSES,
+               "too many slab size classes (FIO_MEMORY_BLOCK_SIZE_LOG?)");
+    fio_slab_classes[fio_slab_class_count++] = (fio_slab_class_s){
+        .size = size,
+        .lock = FIO_LOCK_INIT,
+    };
+    if (size >= FIO_MEMORY_BLOCK_ALLOC_LIMIT)
+      break;
+    if (size < 128) {
+      size += 16;
+    } else {
+      size_t step = size;
+      while (step & (step - 1))
+        step &= step - 1;
+      size += step >> 2;
+    }
+  }
+  for (size_t i = 0; i < fio_slab_class_count; ++i) {
+    fio_slab_classes[i].partial =
+        (fio_ls_embd_s)FIO_LS_INIT(fio_slab_classes[i].partial);
+  }
+  size_t cls = 0;
+  for (size_t units = 0; units <= (FIO_MEMORY_BLOCK_ALLOC_LIMIT >> 4);
+       ++units) {
+    while (cls + 1 < fio_slab_class_count &&
+           fio_slab_classes[cls].size < (units << 4))
+      ++cls;
+    fio_slab_class_of[units] = cls;
+  }
+}
+
+/* returns an empty slab to the memory pool - called within the class lock */
+static void fio_slab_release(fio_slab_s *slab);
+
+/* releases the empty slabs kept by each size class (during cleanup) */
+static void fio_slab_destroy(void) {
+  for (size_t i = 0; i < fio_slab_class_count; ++i) {
+    fio_slab_class_s *c = fio_slab_classes + i;
+    fio_lock(&c->lock);
+    FIO_LS_EMBD_FOR(&c->partial, node) {
+      fio_slab_s *slab = FIO_LS_EMBD_OBJ(fio_slab_s, node, node);
+      if (!slab->used) {
+        node = node->prev;
+        fio_slab_release(slab);
+      }
+    }
+    fio_unlock(&c->lock);
+  }
+}
+
+/* returns an empty slab to the memory pool - called within the class lock */
+static void fio_slab_release(fio_slab_s *slab) {
+  fio_slab_class_s *c = fio_slab_classes + slab->cls;
+  fio_ls_embd_remove(&slab->node);
+  --c->slabs;
+  /* free memory must be zero, `madvise` zeros the pages without touching */
+  memset((void *)&slab->free, 0,
+         FIO_MEMORY_SLAB_PAGE - ((uintptr_t)&slab->free - (uintptr_t)slab));
+  if (madvise((void *)((uintptr_t)slab + FIO_MEMORY_SLAB_PAGE),
+              FIO_MEMORY_BLOCK_SIZE - FIO_MEMORY_SLAB_PAGE, MADV_DONTNEED))
+    memset((void *)((uintptr_t)slab + FIO_MEMORY_SLAB_PAGE), 0,
+           FIO_MEMORY_BLOCK_SIZE - FIO_MEMORY_SLAB_PAGE);
+  block_release(&slab->blk);
+}
+
+/* allocates an object from a slab - `size` is in bytes and non-zero */
+static inline void *fio_slab_alloc(size_t size) {
+  const uint8_t cls = fio_slab_class_of[(size + 15) >> 4];
+  fio_slab_class_s *c = fio_slab_classes + cls;
+  fio_slab_s *slab;
+  void *mem;
+  fio_lock(&c->lock);
+  if (fio_ls_embd_any(&c->partial)) {
+    slab = FIO_LS_EMBD_OBJ(fio_slab_s, node, c->partial.next);
+  } else {
+    slab = (fio_slab_s *)block_new();
+    if (!slab) {
+      fio_unlock(&c->lock);
+      errno = ENOMEM;
+      return NULL;
+    }
+    slab->free = NULL;
+    slab->used = 0;
+    slab->bump = 0;
+    slab->cls = cls;
+    slab->capa = (FIO_MEMORY_BLOCK_SIZE - FIO_MEMORY_SLAB_HEADER) / c->size;
+    ++c->slabs;
+    fio_ls_embd_push(&c->partial, &slab->node);
+  }
+  if (slab->free) {
+    mem = slab->free;
+    slab->free = *(void **)mem;
+    *(void **)mem = NULL;
+  } else {
+    mem = (void *)((uintptr_t)slab + FIO_MEMORY_SLAB_HEADER +
+                   ((uintptr_t)slab->bump * c->size));
+    ++slab->bump;
+  }
+  ++c->used;
+  if (++slab->used == slab->capa)
+    fio_ls_embd_remove(&slab->node); /* slab is full */
+  fio_unlock(&c->lock);
+  return mem;
+}
+
+/* returns an object to the slab, releasing empty slabs */
+static inline void fio_slab_free(void *mem) {
+  fio_slab_s *slab = (fio_slab_s *)((uintptr_t)mem & (~FIO_MEMORY_BLOCK_MASK));
+  fio_slab_class_s *c = fio_slab_classes + slab->cls;
+  memset(mem, 0, c->size); /* free memory is always zero */
+  fio_lock(&c->lock);
+  *(void **)mem = slab->free;
+  slab->free = mem;
+  --c->used;
+  if (slab->used-- == slab->capa)
+    fio_ls_embd_push(&c->partial, &slab->node); /* slab was full */
+  /* keep the last partial slab, so alloc / free cycles don't hit the pool */
+  if (!slab->used &&
+      (c->partial.next != &slab->node || c->partial.prev != &slab->node))
+    fio_slab_release(slab);
+  fio_unlock(&c->lock);
+}
+
+/* returns the object size for a slab allocation */
+#define fio_slab_size(mem)                                                     \
+  (fio_slab_classes[((fio_slab_s *)((uintptr_t)(mem) &                         \
+                                    (~FIO_MEMORY_BLOCK_MASK)))                 \
+                        ->cls]                                                 \
+       .size)
+
+/*
+ * Collects slab statistics: the memory used by objects vs. the memory held by
+ * slabs (the difference is fragmentation).
+ */
+static void fio_slab_stats(size_t *used, size_t *reserved) {
+  *used = 0;
+  *reserved = 0;
+  for (size_t i = 0; i < fio_slab_class_count; ++i) {
+    fio_lock(&fio_slab_classes[i].lock);
+    *used += fio_slab_classes[i].used * fio_slab_classes[i].size;
+    *reserved += fio_slab_classes[i].slabs * FIO_MEMORY_BLOCK_SIZE;
+    fio_unlock(&fio_slab_classes[i].lock);
+  }
+}
+
+#if DEBUG
+#define FIO_MEMORY_PRINT_SLAB_STAT()                                           \
+  do {                                                                         \
+    size_t used_, reserved_;                                                   \
+    fio_slab_stats(&used_, &reserved_);                                        \
+    FIO_LOG_INFO("(fio) slabs hold %zu bytes, %zu bytes in use "               \
+                 "(%zu%% fragmentation)",                                      \
+                 reserved_, used_,                                             \
+                 reserved_ ? (100 - ((used_ * 100) / reserved_)) : 0);         \
+  } while (0)
+#else
+#define FIO_MEMORY_PRINT_SLAB_STAT()
+#endif
+#endif /* FIO_MEMORY_SLAB */
+
 /* *****************************************************************************
 Non-Block allocations (direct from the system)
 ***************************************************************************** */
@@ -7219,6 +12572,8 @@ static inline void *big_alloc(size_t size) {
   if (!mem)
     goto error;
   *mem = size;
+  fio_atomic_add(&fio_mem_big_count, 1);
+  fio_atomic_add(&fio_mem_big_bytes, size);
   return (void *)(((uintptr_t)mem) + 16);
 error:
   return NULL;
@@ -7227,6 +12582,8 @@ error:
 /* reads size header and frees memory back to the system */
 static inline void big_free(void *ptr) {
   size_t *mem = (void *)(((uintptr_t)ptr) - 16);
+  fio_atomic_sub(&fio_mem_big_count, 1);
+  fio_atomic_sub(&fio_mem_big_bytes, *mem);
   sys_free(mem, *mem);
 }
 
@@ -7234,10 +12591,13 @@ static inline void big_free(void *ptr) {
 static inline void *big_realloc(void *ptr, size_t new_size) {
   size_t *mem = (void *)(((uintptr_t)ptr) - 16);
   new_size = sys_round_size(new_size + 16);
+  const size_t old_size = *mem;
   mem = sys_realloc(mem, *mem, new_size);
   if (!mem)
     goto error;
   *mem = new_size;
+  fio_atomic_add(&fio_mem_big_bytes, new_size);
+  fio_atomic_sub(&fio_mem_big_bytes, old_size);
   return (void *)(((uintptr_t)mem) + 16);
 error:
   return NULL;
@@ -7292,6 +12652,14 @@ static void fio_mem_init(void) {
   memory.cores = cpu_count;
   arenas = big_alloc(sizeof(*arenas) * cpu_count);
   FIO_ASSERT_ALLOC(arenas);
+#if FIO_MEMORY_SLAB
+  fio_slab_init();
+#endif
+#if FIO_MEMORY_THREAD_DATA
+  if (!fio_mem_thread_key_valid &&
+      !pthread_key_create(&fio_mem_thread_key, fio_mem_thread_destroy))
+    fio_mem_thread_key_valid = 1;
+#endif
   block_free(block_new());
   pthread_atfork(NULL, NULL, fio_malloc_after_fork);
 }
@@ -7301,7 +12669,17 @@ static void fio_mem_destroy(void) {
     return;
 
   FIO_MEMORY_PRINT_BLOCK_STAT();
+#if FIO_MEMORY_SLAB
+  FIO_MEMORY_PRINT_SLAB_STAT();
+  fio_slab_destroy();
+#endif
 
+#if FIO_MEMORY_THREAD_DATA
+  /* thread destructors aren't called for the main thread */
+  if (fio_mem_thread.state == 1)
+    fio_mem_thread_destroy(&fio_mem_thread);
+  fio_mem_thread.state = 0;
+#endif
   for (size_t i = 0; i < memory.cores; ++i) {
     if (arenas[i].block)
       block_free(arenas[i].block);
@@ -7319,9 +12697,66 @@ static void fio_mem_destroy(void) {
     fio_memory_dump_missing();
 #endif
   }
-  big_free(arenas);
-  arenas = NULL;
+  big_free(arenas);
+  arenas = NULL;
+}
+/* *****************************************************************************
+Allocation counters
+***************************************************************************** */
+
+/* returns the statistics size class (powers of 2, starting at 16 bytes) */
+static inline size_t fio_mem_stats_class(size_t size) {
+  size = (size - 1) >> 4;
+#if defined(__GNUC__) || defined(__clang__)
+  return size ? ((sizeof(long) << 3) - __builtin_clzl((unsigned long)size))
+              : 0;
+#else
+  size_t cls = 0;
+  while (size) {
+    ++cls;
+    size >>= 1;
+  }
+  return cls;
+#endif
+}
+
+#if FIO_MEMORY_STATS
+/* counts a block allocation, `size` is in bytes. */
+static inline void fio_mem_on_alloc(size_t size) {
+  const size_t cls = fio_mem_stats_class(size);
+  if (fio_mem_thread_enter())
+    ++fio_mem_thread.counters.allocations[cls];
+  else
+    fio_atomic_add(fio_mem_counters_retired.allocations + cls, 1);
+}
+
+/* counts a block allocation being freed. */
+static inline void fio_mem_on_free(void *mem) {
+  fio_mem_counters_s *c = &fio_mem_counters_retired;
+  if (fio_mem_thread_enter())
+    c = &fio_mem_thread.counters;
+#if FIO_MEMORY_SLAB
+  const size_t cls = fio_mem_stats_class(fio_slab_size(mem));
+  if (c == &fio_mem_counters_retired) {
+    fio_atomic_add(c->frees_by_class + cls, 1);
+    fio_atomic_add(&c->frees, 1);
+    return;
+  }
+  ++c->frees_by_class[cls];
+#else
+  if (c == &fio_mem_counters_retired) {
+    fio_atomic_add(&c->frees, 1);
+    return;
+  }
+#endif
+  ++c->frees;
+  (void)mem;
 }
+#else
+#define fio_mem_on_alloc(size) ((void)0)
+#define fio_mem_on_free(mem) ((void)0)
+#endif
+
 /* *****************************************************************************
 Memory allocation / deacclocation API
 ***************************************************************************** */
@@ -7340,10 +12775,21 @@ void *fio_malloc(size_t size) {
     // FIO_LOG_WARNING("fio_malloc re-routed to mmap - big allocation");
     return big_alloc(size);
   }
+  if (fio_region_active)
+    return fio_region_slice(fio_region_active,
+                            (size >> 4) + (!!(size & 15)));
+  fio_mem_on_alloc(size);
+#if FIO_MEMORY_SLAB
+  return fio_slab_alloc(size);
+#endif
   /* ceiling for 16 byte alignement, translated to 16 byte units */
   size = (size >> 4) + (!!(size & 15));
+#if FIO_MEMORY_THREAD_CACHE
+  if (fio_mem_thread_enter())
+    return block_slice(&fio_mem_thread.block, size);
+#endif
   arena_enter();
-  void *mem = block_slice(size);
+  void *mem = block_slice(&arena_last_used->block, size);
   arena_exit();
   return mem;
 }
@@ -7361,7 +12807,14 @@ void fio_free(void *ptr) {
     return;
   }
   /* allocated within block */
+  if (fio_region_is_owner(ptr))
+    return; /* released by `fio_region_reset` */
+  fio_mem_on_free(ptr);
+#if FIO_MEMORY_SLAB
+  fio_slab_free(ptr);
+#else
   block_slice_free(ptr);
+#endif
 }
 
 /**
@@ -7381,6 +12834,16 @@ void *fio_realloc2(void *ptr, size_t new_size, size_t copy_length) {
     /* big reallocation - direct from the system */
     return big_realloc(ptr, new_size);
   }
+  const uint8_t in_region = fio_region_is_owner(ptr);
+#if FIO_MEMORY_SLAB
+  if (!in_region) {
+    const size_t old_size = fio_slab_size(ptr);
+    if (new_size <= old_size && (new_size << 1) > old_size)
+      return ptr; /* no need to move the (mostly used) allocation */
+    if (copy_length > old_size)
+      copy_length = old_size;
+  }
+#endif
   /* allocated within block - don't even try to expand the allocation */
   /* ceiling for 16 byte alignement, translated to 16 byte units */
   void *new_mem = fio_malloc(new_size);
@@ -7389,8 +12852,15 @@ void *fio_realloc2(void *ptr, size_t new_size, size_t copy_length) {
   new_size = ((new_size >> 4) + (!!(new_size & 15)));
   copy_length = ((copy_length >> 4) + (!!(copy_length & 15)));
   fio_memcpy(new_mem, ptr, copy_length > new_size ? new_size : copy_length);
+  if (in_region)
+    return new_mem; /* released by `fio_region_reset` */
 
+  fio_mem_on_free(ptr);
+#if FIO_MEMORY_SLAB
+  fio_slab_free(ptr);
+#else
   block_slice_free(ptr);
+#endif
   return new_mem;
 zero_size:
   fio_free(ptr);
@@ -7416,6 +12886,59 @@ void *fio_mmap(size_t size) {
   return big_alloc(size);
 }
 
+/* *****************************************************************************
+Memory allocator statistics
+***************************************************************************** */
+
+/** Returns the memory allocator's statistics. */
+fio_malloc_stats_s fio_malloc_stats(void) {
+  fio_malloc_stats_s r = {
+      .block_size = FIO_MEMORY_BLOCK_SIZE,
+      .big_count = fio_mem_big_count,
+      .big_bytes = fio_mem_big_bytes,
+      .arena_count = (arenas ? memory.cores : 0),
+  };
+  fio_lock(&memory.lock);
+  r.blocks_reserved = memory.reserved;
+  r.blocks_in_use = memory.reserved - memory.count;
+  fio_unlock(&memory.lock);
+#if FIO_MEMORY_STATS
+  fio_mem_counters_s sum = {.frees = 0};
+  fio_lock(&fio_mem_counters_lock);
+  fio_mem_counters_add(&sum, &fio_mem_counters_retired);
+  FIO_LS_EMBD_FOR(&fio_mem_counters_list, node) {
+    fio_mem_counters_add(
+        &sum, &FIO_LS_EMBD_OBJ(fio_mem_thread_s, node, node)->counters);
+  }
+  fio_unlock(&fio_mem_counters_lock);
+  r.class_count = fio_mem_stats_class(FIO_MEMORY_BLOCK_ALLOC_LIMIT - 1) + 1;
+  if (r.class_count > FIO_MALLOC_STATS_CLASSES)
+    r.class_count = FIO_MALLOC_STATS_CLASSES;
+  for (size_t i = 0; i < r.class_count; ++i) {
+    r.classes[i].size = (size_t)16 << i;
+    r.classes[i].allocations = sum.allocations[i];
+#if FIO_MEMORY_SLAB
+    r.classes[i].frees = sum.frees_by_class[i];
+#endif
+    r.allocations += sum.allocations[i];
+  }
+  r.frees = sum.frees;
+#endif
+  return r;
+}
+
+/** Returns the number of bytes sliced from an arena's current block. */
+size_t fio_malloc_arena_bytes(size_t arena) {
+  if (!arenas || arena >= memory.cores)
+    return 0;
+  size_t r = 0;
+  fio_lock(&arenas[arena].lock);
+  if (arenas[arena].block)
+    r = ((size_t)arenas[arena].block->pos << 4) - FIO_MEMORY_BLOCK_HEADER_SIZE;
+  fio_unlock(&arenas[arena].lock);
+  return r;
+}
+
 /* *****************************************************************************
 FIO_OVERRIDE_MALLOC - override glibc / library malloc
 ***************************************************************************** */
@@ -7471,6 +12994,13 @@ uint64_t fio_rand64(void) {
   return fio_lrot64(s[0], 31) + fio_lrot64(s[1], 29);
 }
 
+/* seeds keyed hashing before any other constructor (i.e., static objects) */
+static void __attribute__((constructor(101))) fio_hash_secret_seed_init(void) {
+  struct timespec clk;
+  clock_gettime(CLOCK_REALTIME, &clk);
+  fio_hash_secret_seed = fio_risky_hash(&clk, sizeof(clk), fio_rand64());
+}
+
 /* copies 64 bits of randomness (8 bytes) repeatedly... */
 void fio_rand_bytes(void *data_, size_t len) {
   if (!data_ || !len)
@@ -7662,17 +13192,188 @@ uint64_t fio_siphash13(const void *data, size_t len, uint64_t key1,
   return fio_siphash_xy(data, len, 1, 3, key1, key2);
 }
 
+/* *****************************************************************************
+SHA-1 / SHA-256 hardware acceleration
+***************************************************************************** */
+
+#ifndef FIO_SHA_HW
+/**
+ * Set to 0 to disable the hardware accelerated SHA-1 and SHA-256 rounds.
+ *
+ * The x86 SHA extensions (SHA-NI) are detected at runtime. The ARMv8 SHA
+ * extensions are used when the compiler targets them (i.e., Apple Silicon or
+ * `-march=armv8-a+crypto`).
+ */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define FIO_SHA_HW 1
+#elif defined(__aarch64__) && !__BIG_ENDIAN__ &&                               \
+    (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+#define FIO_SHA_HW 1
+#else
+#define FIO_SHA_HW 0
+#endif
+#endif
+
+#if FIO_SHA_HW && defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define FIO_SHA_HW_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#elif FIO_SHA_HW && defined(__aarch64__)
+#include <arm_neon.h>
+#define FIO_SHA_HW_TARGET
+#else
+#undef FIO_SHA_HW
+#define FIO_SHA_HW 0
+#endif
+
+#if FIO_SHA_HW
+/* -1 == unknown (a benign race - all threads store the same value) */
+static int8_t fio___sha_hw = -1;
+
+/** Returns 1 if the SHA extensions are available. */
+static inline int fio___sha_hw_available(void) {
+  if (fio___sha_hw < 0) {
+#if defined(__x86_64__)
+    unsigned int a, b, c, d;
+    fio___sha_hw = __get_cpuid(1, &a, &b, &c, &d) &&
+                   (c & (1U << 19)) /* SSE4.1 */ && (c & (1U << 9)) /* SSSE3 */
+                   && __get_cpuid_count(7, 0, &a, &b, &c, &d) &&
+                   (b & (1U << 29)); /* SHA */
+#else
+    fio___sha_hw = 1;
+#endif
+  }
+  return fio___sha_hw;
+}
+#endif
+
 /* *****************************************************************************
 SHA-1
 ***************************************************************************** */
 
 static const uint8_t sha1_padding[64] = {0x80, 0};
 
+#if FIO_SHA_HW && defined(__x86_64__)
+/* 4 SHA-1 rounds using message words `m[k & 3]` (SHA-NI). */
+#define FIO_SHA1_HW_ROUNDS(k, f)                                               \
+  do {                                                                         \
+    if ((k) == 0) {                                                            \
+      e[0] = _mm_add_epi32(e[0], m[0]);                                        \
+    } else {                                                                   \
+      e[(k)&1] = _mm_sha1nexte_epu32(e[(k)&1], m[(k)&3]);                      \
+    }                                                                          \
+    e[((k) + 1) & 1] = abcd;                                                   \
+    abcd = _mm_sha1rnds4_epu32(abcd, e[(k)&1], (f));                           \
+    /* compute message words for the following rounds */                      \
+    if ((k) >= 1 && (k) <= 16)                                                 \
+      m[((k)-1) & 3] = _mm_sha1msg1_epu32(m[((k)-1) & 3], m[(k)&3]);           \
+    if ((k) >= 2 && (k) <= 17)                                                 \
+      m[((k)-2) & 3] = _mm_xor_si128(m[((k)-2) & 3], m[(k)&3]);                \
+    if ((k) >= 3 && (k) <= 18)                                                 \
+      m[((k)-3) & 3] = _mm_sha1msg2_epu32(m[((k)-3) & 3], m[(k)&3]);           \
+  } while (0)
+
+/** Processes a 64 byte block using the x86 SHA extensions. */
+FIO_SHA_HW_TARGET static void fio___sha1_hw(uint32_t *digest,
+                                            const uint8_t *data) {
+  const __m128i shuffle =
+      _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)digest), 0x1B);
+  __m128i e[2], m[4];
+  e[0] = _mm_set_epi32((int)digest[4], 0, 0, 0);
+  const __m128i abcd_org = abcd, e_org = e[0];
+  for (size_t i = 0; i < 4; ++i)
+    m[i] = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data + (i << 4))),
+                            shuffle);
+  FIO_SHA1_HW_ROUNDS(0, 0);
+  FIO_SHA1_HW_ROUNDS(1, 0);
+  FIO_SHA1_HW_ROUNDS(2, 0);
+  FIO_SHA1_HW_ROUNDS(3, 0);
+  FIO_SHA1_HW_ROUNDS(4, 0);
+  FIO_SHA1_HW_ROUNDS(5, 1);
+  FIO_SHA1_HW_ROUNDS(6, 1);
+  FIO_SHA1_HW_ROUNDS(7, 1);
+  FIO_SHA1_HW_ROUNDS(8, 1);
+  FIO_SHA1_HW_ROUNDS(9, 1);
+  FIO_SHA1_HW_ROUNDS(10, 2);
+  FIO_SHA1_HW_ROUNDS(11, 2);
+  FIO_SHA1_HW_ROUNDS(12, 2);
+  FIO_SHA1_HW_ROUNDS(13, 2);
+  FIO_SHA1_HW_ROUNDS(14, 2);
+  FIO_SHA1_HW_ROUNDS(15, 3);
+  FIO_SHA1_HW_ROUNDS(16, 3);
+  FIO_SHA1_HW_ROUNDS(17, 3);
+  FIO_SHA1_HW_ROUNDS(18, 3);
+  FIO_SHA1_HW_ROUNDS(19, 3);
+  /* after the last (odd) group, e[0] holds the state needed to compute `e` */
+  e[0] = _mm_sha1nexte_epu32(e[0], e_org);
+  abcd = _mm_add_epi32(abcd, abcd_org);
+  _mm_storeu_si128((__m128i *)digest, _mm_shuffle_epi32(abcd, 0x1B));
+  digest[4] = (uint32_t)_mm_extract_epi32(e[0], 3);
+}
+#undef FIO_SHA1_HW_ROUNDS
+
+#elif FIO_SHA_HW && defined(__aarch64__)
+
+/* 4 SHA-1 rounds using message words `m[k & 3]` (ARMv8 SHA extensions). */
+#define FIO_SHA1_HW_ROUNDS(k, fn, key)                                         \
+  do {                                                                         \
+    if ((k) >= 4)                                                              \
+      m[(k)&3] = vsha1su1q_u32(                                                \
+          vsha1su0q_u32(m[(k)&3], m[((k) + 1) & 3], m[((k) + 2) & 3]),         \
+          m[((k) + 3) & 3]);                                                   \
+    const uint32x4_t t_ = vaddq_u32(m[(k)&3], vdupq_n_u32((key)));             \
+    const uint32_t e_ = vsha1h_u32(vgetq_lane_u32(abcd, 0));                   \
+    abcd = fn(abcd, e, t_);                                                    \
+    e = e_;                                                                    \
+  } while (0)
+
+/** Processes a 64 byte block using the ARMv8 SHA extensions. */
+static void fio___sha1_hw(uint32_t *digest, const uint8_t *data) {
+  uint32x4_t abcd = vld1q_u32(digest);
+  uint32_t e = digest[4];
+  uint32x4_t m[4];
+  const uint32x4_t abcd_org = abcd;
+  const uint32_t e_org = e;
+  for (size_t i = 0; i < 4; ++i)
+    m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + (i << 4))));
+  FIO_SHA1_HW_ROUNDS(0, vsha1cq_u32, 0x5A827999);
+  FIO_SHA1_HW_ROUNDS(1, vsha1cq_u32, 0x5A827999);
+  FIO_SHA1_HW_ROUNDS(2, vsha1cq_u32, 0x5A827999);
+  FIO_SHA1_HW_ROUNDS(3, vsha1cq_u32, 0x5A827999);
+  FIO_SHA1_HW_ROUNDS(4, vsha1cq_u32, 0x5A827999);
+  FIO_SHA1_HW_ROUNDS(5, vsha1pq_u32, 0x6ED9EBA1);
+  FIO_SHA1_HW_ROUNDS(6, vsha1pq_u32, 0x6ED9EBA1);
+  FIO_SHA1_HW_ROUNDS(7, vsha1pq_u32, 0x6ED9EBA1);
+  FIO_SHA1_HW_ROUNDS(8, vsha1pq_u32, 0x6ED9EBA1);
+  FIO_SHA1_HW_ROUNDS(9, vsha1pq_u32, 0x6ED9EBA1);
+  FIO_SHA1_HW_ROUNDS(10, vsha1mq_u32, 0x8F1BBCDC);
+  FIO_SHA1_HW_ROUNDS(11, vsha1mq_u32, 0x8F1BBCDC);
+  FIO_SHA1_HW_ROUNDS(12, vsha1mq_u32, 0x8F1BBCDC);
+  FIO_SHA1_HW_ROUNDS(13, vsha1mq_u32, 0x8F1BBCDC);
+  FIO_SHA1_HW_ROUNDS(14, vsha1mq_u32, 0x8F1BBCDC);
+  FIO_SHA1_HW_ROUNDS(15, vsha1pq_u32, 0xCA62C1D6);
+  FIO_SHA1_HW_ROUNDS(16, vsha1pq_u32, 0xCA62C1D6);
+  FIO_SHA1_HW_ROUNDS(17, vsha1pq_u32, 0xCA62C1D6);
+  FIO_SHA1_HW_ROUNDS(18, vsha1pq_u32, 0xCA62C1D6);
+  FIO_SHA1_HW_ROUNDS(19, vsha1pq_u32, 0xCA62C1D6);
+  vst1q_u32(digest, vaddq_u32(abcd, abcd_org));
+  digest[4] = e + e_org;
+}
+#undef FIO_SHA1_HW_ROUNDS
+#endif
+
 /**
 Process the buffer once full.
 */
 static inline void fio_sha1_perform_all_rounds(fio_sha1_s *s,
                                                const uint8_t *buffer) {
+#if FIO_SHA_HW
+  if (fio___sha_hw_available()) {
+    fio___sha1_hw(s->digest.i, buffer);
+    return;
+  }
+#endif
   /* collect data */
   uint32_t a = s->digest.i[0];
   uint32_t b = s->digest.i[1];
@@ -7828,7 +13529,7 @@ void fio_sha1_write(fio_sha1_s *s, const void *data, size_t len) {
     len -= 64;
   }
   if (len) {
-    memcpy(s->buffer + in_buffer, data, len);
+    memcpy(s->buffer, data, len);
   }
   return;
 }
@@ -7932,6 +13633,108 @@ static uint64_t sha2_512_words[] = {
 #define Omg0_64(x) (fio_rrot64((x), 1) ^ fio_rrot64((x), 8) ^ (((x) >> 7)))
 #define Omg1_64(x) (fio_rrot64((x), 19) ^ fio_rrot64((x), 61) ^ (((x) >> 6)))
 
+#if FIO_SHA_HW && defined(__x86_64__)
+/* 4 SHA-256 rounds using message words `m[k & 3]` (SHA-NI). */
+#define FIO_SHA256_HW_ROUNDS(k)                                                \
+  do {                                                                         \
+    if ((k) >= 4)                                                              \
+      m[(k)&3] = _mm_sha256msg2_epu32(                                         \
+          _mm_add_epi32(                                                       \
+              _mm_sha256msg1_epu32(m[(k)&3], m[((k) + 1) & 3]),                \
+              _mm_alignr_epi8(m[((k) + 3) & 3], m[((k) + 2) & 3], 4)),         \
+          m[((k) + 3) & 3]);                                                   \
+    __m128i t_ = _mm_add_epi32(                                                \
+        m[(k)&3], _mm_loadu_si128((__m128i *)(sha2_256_words + ((k) << 2))));  \
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, t_);                              \
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(t_, 0x0E));     \
+  } while (0)
+
+/** Processes a 64 byte block using the x86 SHA extensions. */
+FIO_SHA_HW_TARGET static void fio___sha256_hw(uint32_t *digest,
+                                              const uint8_t *data) {
+  const __m128i shuffle =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)digest), 0xB1);
+  __m128i cdgh =
+      _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)(digest + 4)), 0x1B);
+  __m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);
+  cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+  const __m128i abef_org = abef, cdgh_org = cdgh;
+  __m128i m[4];
+  for (size_t i = 0; i < 4; ++i)
+    m[i] = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data + (i << 4))),
+                            shuffle);
+  FIO_SHA256_HW_ROUNDS(0);
+  FIO_SHA256_HW_ROUNDS(1);
+  FIO_SHA256_HW_ROUNDS(2);
+  FIO_SHA256_HW_ROUNDS(3);
+  FIO_SHA256_HW_ROUNDS(4);
+  FIO_SHA256_HW_ROUNDS(5);
+  FIO_SHA256_HW_ROUNDS(6);
+  FIO_SHA256_HW_ROUNDS(7);
+  FIO_SHA256_HW_ROUNDS(8);
+  FIO_SHA256_HW_ROUNDS(9);
+  FIO_SHA256_HW_ROUNDS(10);
+  FIO_SHA256_HW_ROUNDS(11);
+  FIO_SHA256_HW_ROUNDS(12);
+  FIO_SHA256_HW_ROUNDS(13);
+  FIO_SHA256_HW_ROUNDS(14);
+  FIO_SHA256_HW_ROUNDS(15);
+  abef = _mm_add_epi32(abef, abef_org);
+  cdgh = _mm_add_epi32(cdgh, cdgh_org);
+  /* ABEF / CDGH => ABCD / EFGH (little endian words, DCBA / HGFE) */
+  tmp = _mm_shuffle_epi32(abef, 0x1B);
+  cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+  _mm_storeu_si128((__m128i *)digest, _mm_blend_epi16(tmp, cdgh, 0xF0));
+  _mm_storeu_si128((__m128i *)(digest + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+}
+#undef FIO_SHA256_HW_ROUNDS
+
+#elif FIO_SHA_HW && defined(__aarch64__)
+
+/* 4 SHA-256 rounds using message words `m[k & 3]` (ARMv8 SHA extensions). */
+#define FIO_SHA256_HW_ROUNDS(k)                                                \
+  do {                                                                         \
+    if ((k) >= 4)                                                              \
+      m[(k)&3] = vsha256su1q_u32(vsha256su0q_u32(m[(k)&3], m[((k) + 1) & 3]),  \
+                                 m[((k) + 2) & 3], m[((k) + 3) & 3]);          \
+    const uint32x4_t t_ =                                                      \
+        vaddq_u32(m[(k)&3], vld1q_u32(sha2_256_words + ((k) << 2)));           \
+    const uint32x4_t abcd_ = abcd;                                             \
+    abcd = vsha256hq_u32(abcd, efgh, t_);                                      \
+    efgh = vsha256h2q_u32(efgh, abcd_, t_);                                    \
+  } while (0)
+
+/** Processes a 64 byte block using the ARMv8 SHA extensions. */
+static void fio___sha256_hw(uint32_t *digest, const uint8_t *data) {
+  uint32x4_t abcd = vld1q_u32(digest);
+  uint32x4_t efgh = vld1q_u32(digest + 4);
+  const uint32x4_t abcd_org = abcd, efgh_org = efgh;
+  uint32x4_t m[4];
+  for (size_t i = 0; i < 4; ++i)
+    m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + (i << 4))));
+  FIO_SHA256_HW_ROUNDS(0);
+  FIO_SHA256_HW_ROUNDS(1);
+  FIO_SHA256_HW_ROUNDS(2);
+  FIO_SHA256_HW_ROUNDS(3);
+  FIO_SHA256_HW_ROUNDS(4);
+  FIO_SHA256_HW_ROUNDS(5);
+  FIO_SHA256_HW_ROUNDS(6);
+  FIO_SHA256_HW_ROUNDS(7);
+  FIO_SHA256_HW_ROUNDS(8);
+  FIO_SHA256_HW_ROUNDS(9);
+  FIO_SHA256_HW_ROUNDS(10);
+  FIO_SHA256_HW_ROUNDS(11);
+  FIO_SHA256_HW_ROUNDS(12);
+  FIO_SHA256_HW_ROUNDS(13);
+  FIO_SHA256_HW_ROUNDS(14);
+  FIO_SHA256_HW_ROUNDS(15);
+  vst1q_u32(digest, vaddq_u32(abcd, abcd_org));
+  vst1q_u32(digest + 4, vaddq_u32(efgh, efgh_org));
+}
+#undef FIO_SHA256_HW_ROUNDS
+#endif
+
 /**
 Process the buffer once full.
 */
@@ -8030,6 +13833,12 @@ static inline void fio_sha2_perform_all_rounds(fio_sha2_s *s,
     s->digest.i64[7] += h;
     return;
   } else {
+#if FIO_SHA_HW
+    if (fio___sha_hw_available()) {
+      fio___sha256_hw(s->digest.i32, data);
+      return;
+    }
+#endif
     // process values for the 32bit words
     uint32_t a = s->digest.i32[0];
     uint32_t b = s->digest.i32[1];
@@ -8238,7 +14047,7 @@ void fio_sha2_write(fio_sha2_s *s, const void *data, size_t len) {
       len -= 128;
     }
     if (len) {
-      memcpy(s->buffer + in_buffer, data, len);
+      memcpy(s->buffer, data, len);
     }
     return;
   }
@@ -8265,7 +14074,7 @@ void fio_sha2_write(fio_sha2_s *s, const void *data, size_t len) {
     len -= 64;
   }
   if (len) {
-    memcpy(s->buffer + in_buffer, data, len);
+    memcpy(s->buffer, data, len);
   }
   return;
 }
@@ -9156,6 +14965,82 @@ Testing Memory Allocator
 #define fio_malloc_test()                                                      \
   fprintf(stderr, "\n=== SKIPPED facil.io memory allocator (bypassed)\n");
 #else
+#if FIO_MEMORY_THREAD_DATA
+FIO_FUNC void *fio_malloc_test_thread(void *mem) {
+  char *tmp = fio_malloc(16);
+  if (tmp)
+    tmp[0] = 'a';
+  *(char **)mem = tmp;
+  return NULL;
+}
+#endif
+
+#if FIO_MEMORY_SLAB
+FIO_FUNC void fio_malloc_slab_test(void) {
+  fprintf(stderr, "* Testing size-class slabs.\n");
+  FIO_ASSERT(fio_slab_class_count && fio_slab_classes[0].size == 16 &&
+                 fio_slab_classes[fio_slab_class_count - 1].size >=
+                     FIO_MEMORY_BLOCK_ALLOC_LIMIT - 1,
+             "slab size classes should cover all block allocations (%zu)",
+             fio_slab_class_count);
+  for (size_t i = 1; i < (FIO_MEMORY_BLOCK_ALLOC_LIMIT >> 4); ++i) {
+    FIO_ASSERT(fio_slab_classes[fio_slab_class_of[i]].size >= (i << 4) &&
+                   (!fio_slab_class_of[i] ||
+                    fio_slab_classes[fio_slab_class_of[i] - 1].size < (i << 4)),
+               "size class mapping error for %zu bytes", (i << 4));
+  }
+  fio_slab_class_s *c = fio_slab_classes + fio_slab_class_of[3];
+  const size_t slabs = c->slabs;
+  const size_t capa = (FIO_MEMORY_BLOCK_SIZE - FIO_MEMORY_SLAB_HEADER) / 48;
+  const size_t count = capa * 4;
+  char **objs = malloc(sizeof(*objs) * count);
+  FIO_ASSERT_ALLOC(objs);
+  for (size_t i = 0; i < count; ++i) {
+    objs[i] = fio_malloc(40);
+    FIO_ASSERT(objs[i] && !((uintptr_t)objs[i] & 15),
+               "slab allocation error (%zu)", i);
+    FIO_ASSERT(!objs[i][0] && !objs[i][39], "slab memory isn't zeroed");
+    memset(objs[i], 'x', 40);
+  }
+  FIO_ASSERT(c->slabs >= slabs + 3, "slabs weren't allocated (%zu)", c->slabs);
+  /* keep a single long-lived object per slab, reuse the freed memory */
+#define FIO_SLAB_TEST_KEEP(i)                                                  \
+  (!(i) || (((uintptr_t)objs[(i)] ^ (uintptr_t)objs[(i)-1]) &                  \
+            (~FIO_MEMORY_BLOCK_MASK)))
+  for (size_t i = count - 1; i < count; --i) {
+    if (!FIO_SLAB_TEST_KEEP(i))
+      fio_free(objs[i]);
+  }
+  size_t used, reserved;
+  fio_slab_stats(&used, &reserved);
+  FIO_ASSERT(used < reserved, "slab statistics error");
+  const size_t slabs_fragmented = c->slabs;
+  for (size_t i = count - 1; i < count; --i) {
+    if (!FIO_SLAB_TEST_KEEP(i)) {
+      objs[i] = fio_malloc(48);
+      FIO_ASSERT(!objs[i][0] && !objs[i][47], "reused memory isn't zeroed");
+    }
+  }
+  FIO_ASSERT(c->slabs == slabs_fragmented,
+             "freed objects weren't reused (%zu != %zu slabs)", c->slabs,
+             slabs_fragmented);
+#undef FIO_SLAB_TEST_KEEP
+  {
+    char *tmp = fio_realloc(objs[1], 44);
+    FIO_ASSERT(tmp == objs[1], "slab realloc within class should stay put");
+    objs[1] = fio_realloc(tmp, 1024);
+    FIO_ASSERT(objs[1] && fio_slab_size(objs[1]) >= 1024,
+               "slab realloc failed");
+  }
+  for (size_t i = 0; i < count; ++i)
+    fio_free(objs[i]);
+  free(objs);
+  FIO_ASSERT(c->slabs <= slabs + 1,
+             "empty slabs weren't released (%zu slabs, %zu before)", c->slabs,
+             slabs);
+}
+#endif
+
 FIO_FUNC void fio_malloc_test(void) {
   fprintf(stderr, "\n=== Testing facil.io memory allocator's system calls\n");
   char *mem = sys_alloc(FIO_MEMORY_BLOCK_SIZE, 0);
@@ -9185,19 +15070,29 @@ FIO_FUNC void fio_malloc_test(void) {
   mem = fio_realloc(mem, 1);
   FIO_ASSERT(mem, "fio_realloc failed!\n");
   FIO_ASSERT(mem[0] == 'a', "fio_realloc memory wasn't copied!\n");
+#if FIO_MEMORY_SLAB
+  fio_free(mem);
+  fio_malloc_slab_test();
+  mem = fio_malloc(1);
+#else
+#if FIO_MEMORY_THREAD_CACHE
+  FIO_ASSERT(fio_mem_thread.state == 1,
+             "thread cache wasn't initialized!\n");
+#else
   FIO_ASSERT(arena_last_used, "arena_last_used wasn't initialized!\n");
+#endif
   fio_free(mem);
-  block_s *b = arena_last_used->block;
+  block_s *b = fio_mem_current_block();
 
   /* move arena to block's start */
-  while (arena_last_used->block == b) {
+  while (fio_mem_current_block() == b) {
     mem = fio_malloc(1);
     FIO_ASSERT(mem, "fio_malloc failed to allocate memory!\n");
     fio_free(mem);
   }
   /* make sure a block is assigned */
   fio_free(fio_malloc(1));
-  b = arena_last_used->block;
+  b = fio_mem_current_block();
   size_t count = 1;
   /* count allocations within block */
   do {
@@ -9214,10 +15109,10 @@ FIO_FUNC void fio_malloc_test(void) {
     fio_free(mem); /* make sure we hold on to the block, so it rotates */
     mem = fio_malloc(1);
     ++count;
-  } while (arena_last_used->block == b);
+  } while (fio_mem_current_block() == b);
   {
     fprintf(stderr, "* Confirm block address: %p, last allocation was %p\n",
-            (void *)arena_last_used->block, (void *)mem);
+            (void *)fio_mem_current_block(), (void *)mem);
     fprintf(
         stderr,
         "* Performed %zu allocations out of expected %zu allocations per "
@@ -9225,7 +15120,15 @@ FIO_FUNC void fio_malloc_test(void) {
         count,
         (size_t)((FIO_MEMORY_BLOCK_SLICES - 2) - (sizeof(block_s) >> 4) - 1));
     fio_ls_embd_s old_memory_list = memory.available;
+#if FIO_MEMORY_THREAD_CACHE
+    /* make sure the block is returned to the pool, not the thread's cache */
+    const uint8_t old_cache_count = fio_mem_thread.count;
+    fio_mem_thread.count = FIO_MEMORY_THREAD_CACHE;
+#endif
     fio_free(mem);
+#if FIO_MEMORY_THREAD_CACHE
+    fio_mem_thread.count = old_cache_count;
+#endif
     FIO_ASSERT(fio_ls_embd_any(&memory.available),
                "memory pool empty (memory block wasn't freed)!\n");
     FIO_ASSERT(old_memory_list.next != memory.available.next ||
@@ -9233,7 +15136,7 @@ FIO_FUNC void fio_malloc_test(void) {
                "memory pool not updated after block being freed!\n");
   }
   /* rotate block again */
-  b = arena_last_used->block;
+  b = fio_mem_current_block();
   mem = fio_realloc(mem, 1);
   do {
     mem2 = mem;
@@ -9250,7 +15153,9 @@ FIO_FUNC void fio_malloc_test(void) {
     mem[0] = 'a';
 #endif
     ++count;
-  } while (arena_last_used->block == b);
+  } while (fio_mem_current_block() == b);
+
+#endif /* FIO_MEMORY_SLAB */
 
   mem2 = mem;
   mem = fio_calloc(FIO_MEMORY_BLOCK_ALLOC_LIMIT - 64, 1);
@@ -9297,6 +15202,133 @@ FIO_FUNC void fio_malloc_test(void) {
     FIO_ASSERT(new_pool_size == pool_size,
                "fio_free of fio_mmap went to memory pool!\n");
   }
+#if FIO_MEMORY_THREAD_CACHE
+  {
+    /* empty blocks are kept by the thread and reused */
+    while (fio_mem_thread.count)
+      block_release(fio_mem_thread.cache[--fio_mem_thread.count]);
+    block_s *blk = block_new();
+    block_free(blk);
+    FIO_ASSERT(fio_mem_thread.count == 1 && fio_mem_thread.cache[0] == blk,
+               "empty block wasn't cached by the thread!\n");
+    FIO_ASSERT(block_new() == blk, "cached block wasn't reused!\n");
+    block_free(blk);
+    /* memory allocated by an exited thread, freed by this thread */
+    pthread_t thread;
+    mem = NULL;
+    FIO_ASSERT(!pthread_create(&thread, NULL, fio_malloc_test_thread, &mem) &&
+                   !pthread_join(thread, NULL),
+               "couldn't run the allocation thread!\n");
+    FIO_ASSERT(mem && mem[0] == 'a', "thread allocation failed!\n");
+    blk = (block_s *)((uintptr_t)mem & (~FIO_MEMORY_BLOCK_MASK));
+    FIO_ASSERT(blk->ref == 1,
+               "exiting thread should release it's block (ref %u)!\n",
+               (unsigned int)blk->ref);
+    fio_free(mem);
+    FIO_ASSERT(fio_mem_thread.count == 2 && fio_mem_thread.cache[1] == blk,
+               "remotely emptied block should be cached by the freeing "
+               "thread!\n");
+  }
+#endif
+  {
+    fio_malloc_stats_s st = fio_malloc_stats();
+    FIO_ASSERT(st.block_size == FIO_MEMORY_BLOCK_SIZE && st.blocks_reserved &&
+                   st.blocks_in_use <= st.blocks_reserved &&
+                   st.arena_count == memory.cores,
+               "fio_malloc_stats block data error!\n");
+    FIO_ASSERT(fio_malloc_arena_bytes(st.arena_count) == 0,
+               "fio_malloc_arena_bytes should ignore invalid arenas!\n");
+#if FIO_MEMORY_STATS
+    char *objs[64];
+    for (size_t i = 0; i < 64; ++i)
+      objs[i] = fio_malloc(40);
+    char *big = fio_malloc(FIO_MEMORY_BLOCK_ALLOC_LIMIT);
+    fio_malloc_stats_s st2 = fio_malloc_stats();
+    FIO_ASSERT(st2.class_count > 2 && st2.classes[2].size == 64 &&
+                   st2.classes[2].allocations ==
+                       st.classes[2].allocations + 64 &&
+                   st2.allocations == st.allocations + 64,
+               "fio_malloc_stats allocation counters error!\n");
+    FIO_ASSERT(st2.big_count == st.big_count + 1 &&
+                   st2.big_bytes > st.big_bytes,
+               "fio_malloc_stats big allocation counters error!\n");
+    for (size_t i = 0; i < 64; ++i)
+      fio_free(objs[i]);
+    fio_free(big);
+    st2 = fio_malloc_stats();
+    FIO_ASSERT(st2.frees == st.frees + 64 && st2.big_count == st.big_count &&
+                   st2.big_bytes == st.big_bytes,
+               "fio_malloc_stats free counters error!\n");
+#if FIO_MEMORY_SLAB
+    FIO_ASSERT(st2.classes[2].frees == st.classes[2].frees + 64,
+               "fio_malloc_stats size class free counters error!\n");
+#endif
+    /* counters of exited threads are retained */
+    pthread_t thread;
+    mem = NULL;
+    FIO_ASSERT(!pthread_create(&thread, NULL, fio_malloc_test_thread, &mem) &&
+                   !pthread_join(thread, NULL),
+               "couldn't run the allocation thread!\n");
+    fio_malloc_stats_s st3 = fio_malloc_stats();
+    FIO_ASSERT(st3.classes[0].allocations == st2.classes[0].allocations + 1,
+               "exited thread counters were lost!\n");
+    fio_free(mem);
+#endif
+  }
+  {
+    fio_region_s region = FIO_REGION_INIT;
+    fio_malloc_stats_s st = fio_malloc_stats();
+    FIO_ASSERT(!fio_region_set(&region), "no region should be active!\n");
+    char *first = fio_malloc(24);
+    FIO_ASSERT(first && fio_region_is_owner(first) &&
+                   ((uintptr_t)first & 15) == 0,
+               "region allocation error!\n");
+    block_s *blk = region.block;
+    /* fill more than a single block, making sure memory is zeroed out */
+    for (size_t i = 0; i < FIO_MEMORY_BLOCK_SLICES; ++i) {
+      char *tmp = fio_malloc(32);
+      FIO_ASSERT(tmp && !tmp[0] && !tmp[31], "region memory not zeroed!\n");
+      memset(tmp, 'r', 32);
+      fio_free(tmp); /* ignored */
+    }
+    FIO_ASSERT(region.block != blk &&
+                   ((block_node_s *)region.block)->node.next,
+               "region blocks should be linked!\n");
+    memset(first, 'f', 24);
+    first = fio_realloc(first, 48);
+    FIO_ASSERT(first && fio_region_is_owner(first) && first[23] == 'f' &&
+                   !first[24],
+               "region reallocation error!\n");
+    FIO_ASSERT(fio_region_owns(first), "fio_region_owns missed a region!\n");
+    FIO_ASSERT(fio_region_set(NULL) == &region,
+               "fio_region_set should return the active region!\n");
+    mem = fio_malloc(16);
+    FIO_ASSERT(mem && !fio_region_is_owner(mem),
+               "allocation after leaving region was sliced from region!\n");
+    FIO_ASSERT(!fio_region_owns(mem) && !fio_region_owns(NULL),
+               "fio_region_owns should ignore memory outside regions!\n");
+    fio_free(mem);
+#if FIO_MEMORY_STATS
+    fio_malloc_stats_s st2 = fio_malloc_stats();
+    FIO_ASSERT(st2.allocations == st.allocations + 1,
+               "region allocations shouldn't be counted!\n");
+#endif
+    fio_region_reset(&region);
+    FIO_ASSERT(!region.block, "region reset error!\n");
+    /* recycled blocks must be zeroed out and unmarked */
+    fio_region_set(&region);
+    for (size_t i = 0; i < (FIO_MEMORY_BLOCK_SLICES << 1); ++i) {
+      char *tmp = fio_malloc(32);
+      FIO_ASSERT(tmp && !tmp[0] && !tmp[31], "recycled region memory error!\n");
+    }
+    fio_region_set(NULL);
+    fio_region_reset(&region);
+    mem = fio_malloc(FIO_MEMORY_BLOCK_ALLOC_LIMIT >> 1);
+    FIO_ASSERT(mem && !fio_region_is_owner(mem) && !mem[0],
+               "recycled region block is still marked!\n");
+    fio_free(mem);
+    (void)st;
+  }
 
   fprintf(stderr, "* passed.\n");
 }
@@ -9359,7 +15391,7 @@ FIO_FUNC void fio_timer_test(void) {
   size_t result = 0;
   const size_t total = 5;
   fio_data->active = 1;
-  FIO_ASSERT(fio_timers.next, "Timers not initialized!");
+  FIO_ASSERT(!fio_timers.count, "Timers not initialized!");
   FIO_ASSERT(fio_run_every(0, 0, fio_timer_test_task, NULL, NULL) == -1,
              "Timers without an interval should be an error.");
   FIO_ASSERT(fio_run_every(1000, 0, NULL, NULL, NULL) == -1,
@@ -9367,18 +15399,18 @@ FIO_FUNC void fio_timer_test(void) {
   FIO_ASSERT(fio_run_every(900, total, fio_timer_test_task, &result,
                            fio_timer_test_task) == 0,
              "Timer creation failure.");
-  FIO_ASSERT(fio_ls_embd_any(&fio_timers),
-             "Timer scheduling failure - no timer in list.");
+  FIO_ASSERT(fio_timers.count == 1,
+             "Timer scheduling failure - no timer in heap.");
   FIO_ASSERT(fio_timer_calc_first_interval() >= 898 &&
                  fio_timer_calc_first_interval() <= 902,
              "next timer calculation error %zu",
              fio_timer_calc_first_interval());
 
-  fio_ls_embd_s *first = fio_timers.next;
+  fio_timer_s *first = fio_timers.ary[0];
   FIO_ASSERT(fio_run_every(10000, total, fio_timer_test_task, &result,
                            fio_timer_test_task) == 0,
              "Timer creation failure (second timer).");
-  FIO_ASSERT(fio_timers.next == first, "Timer Ordering error!");
+  FIO_ASSERT(fio_timers.ary[0] == first, "Timer Ordering error!");
 
   FIO_ASSERT(fio_timer_calc_first_interval() >= 898 &&
                  fio_timer_calc_first_interval() <= 902,
@@ -9399,7 +15431,7 @@ FIO_FUNC void fio_timer_test(void) {
                 (i == total - 1 && result == total + 1)),
                "Timer running and rescheduling error (%zu != %zu)\n", result,
                i + 1);
-    FIO_ASSERT(fio_timers.next == first || i == total - 1,
+    FIO_ASSERT(fio_timers.ary[0] == first || i == total - 1,
                "Timer Ordering error on cycle %zu!", i);
   }
 
@@ -9408,6 +15440,52 @@ FIO_FUNC void fio_timer_test(void) {
   fio_defer_perform();
   FIO_ASSERT(result == total + 2, "Timer # 2 error (%zu != %zu)\n", result,
              total + 2);
+
+  fio_timer_clear_all();
+
+  /* cancellation */
+  result = 0;
+  fio_timer_s *cancel = fio_run_every_timer(100, 0, fio_timer_test_task,
+                                            &result, fio_timer_test_task);
+  FIO_ASSERT(cancel && fio_timers.count == 1, "Timer creation failure (3).");
+  fio_timer_cancel(cancel);
+  FIO_ASSERT(!fio_timers.count && result == 1,
+             "Timer cancellation error (%zu)", result);
+  fio_data->last_cycle.tv_sec += 1;
+  fio_timer_schedule();
+  fio_defer_perform();
+  FIO_ASSERT(result == 1, "Cancelled timer performed (%zu)", result);
+
+  /* heap ordering, with random intervals and random cancellations */
+  {
+    const size_t count = 4096;
+    fio_timer_s **timers = malloc(sizeof(*timers) * count);
+    FIO_ASSERT_ALLOC(timers);
+    result = 0;
+    for (size_t i = 0; i < count; ++i) {
+      timers[i] = fio_run_every_timer(1 + (fio_rand64() & 0xFFFF), 1,
+                                      fio_timer_test_task, &result, NULL);
+    }
+    for (size_t i = 0; i < count; i += 3) {
+      fio_timer_cancel(timers[i]);
+    }
+    FIO_ASSERT(fio_timers.count == count - ((count + 2) / 3),
+               "Timer heap count error after cancellations (%zu)",
+               fio_timers.count);
+    struct timespec last = {.tv_sec = 0};
+    while (fio_timers.count) {
+      fio_timer_s *t = fio_timers.ary[0];
+      FIO_ASSERT(fio_timer_compare(last, t->due) >= 0,
+                 "Timer heap ordering error");
+      last = t->due;
+      fio_lock(&fio_timer_lock);
+      fio_timer_heap_remove(t);
+      fio_unlock(&fio_timer_lock);
+      fio_timer_finish(t);
+    }
+    free(timers);
+  }
+
   fio_data->active = 0;
   fio_timer_clear_all();
   fio_defer_clear_tasks();
@@ -9418,6 +15496,10 @@ FIO_FUNC void fio_timer_test(void) {
 Testing listening socket
 ***************************************************************************** */
 
+static void fio_socket_test_on_connect(intptr_t uuid, void *connected) {
+  *(size_t *)connected = (size_t)uuid;
+}
+
 FIO_FUNC void fio_socket_test(void) {
   /* initialize unix socket name */
   fio_str_s sock_name = FIO_STR_INIT;
@@ -9509,9 +15591,100 @@ FIO_FUNC void fio_socket_test(void) {
   FIO_ASSERT(client2 != -1,
              "Failed to accept TCP/IP socket connection on port 8765");
   fprintf(stderr, "* TCP/IP client2 addr %s\n", fio_peer_addr(client2).data);
+  {
+    fio_accept_stats_s stats = fio_accept_stats(uuid);
+    FIO_ASSERT(stats.accepted, "fio_accept_stats didn't count connections");
+#if defined(__linux__) && defined(TCP_INFO)
+    FIO_ASSERT(stats.backlog_max, "fio_accept_stats missing backlog limit");
+#endif
+    fprintf(stderr,
+            "* accept stats: %zu accepted, backlog %zu/%zu, %zu overflows, "
+            "%zu drops, %zu SYN cookies\n",
+            stats.accepted, stats.backlog, stats.backlog_max,
+            stats.listen_overflows, stats.listen_drops, stats.syncookies_sent);
+  }
   fio_force_close(client1);
   fio_force_close(client2);
+  {
+    fio_dns_addr_s addr;
+    FIO_ASSERT(!fio_dns_lookup(&addr, "127.0.0.1", "8765"),
+               "numerical addresses should resolve without blocking");
+    FIO_ASSERT(!fio_dns_lookup(&addr, "Localhost", "8765"),
+               "the resolved host name should be cached");
+    FIO_ASSERT(fio_dns_lookup(&addr, "localhost", "8765"),
+               "the host name shouldn't be cached yet");
+    /* host names are resolved asynchronously, before connecting */
+    size_t connected = 0;
+    client1 = fio_connect(.address = "localhost", .port = "8765",
+                          .on_connect = fio_socket_test_on_connect,
+                          .udata = &connected);
+    FIO_ASSERT(client1 != -1, "fio_connect should reserve a uuid");
+    for (size_t i = 0; i < 500 && !connected; ++i) {
+      fio_poll();
+      fio_defer_perform();
+      fio_reschedule_thread();
+    }
+    FIO_ASSERT(connected == (size_t)client1,
+               "fio_connect didn't connect after resolving the host name");
+    FIO_ASSERT(!fio_dns_lookup(&addr, "localhost", "8765"),
+               "fio_connect should cache the resolved host name");
+    client2 = fio_accept(uuid);
+    fprintf(stderr, "* fio_connect resolved localhost to %s\n",
+            fio_peer_addr(client1).data);
+    fio_force_close(client1);
+    fio_force_close(client2);
+    fio_defer_perform();
+  }
   fio_force_close(uuid);
+  {
+    /* the accept budget grows with full wakeups and shrinks with idle ones */
+    fio_listen_protocol_s pr = {.accept_budget = FIO_LISTEN_ACCEPT_BATCH,
+                                .accept_max = FIO_LISTEN_ACCEPT_MAX};
+    for (size_t i = 0; i < 16; ++i)
+      fio_listen_accept_budget(&pr, pr.accept_budget);
+    FIO_ASSERT(pr.accept_budget == FIO_LISTEN_ACCEPT_MAX,
+               "accept budget should grow to its limit (%zu)",
+               pr.accept_budget);
+    fio_listen_accept_budget(&pr, (pr.accept_budget >> 1));
+    FIO_ASSERT(pr.accept_budget == FIO_LISTEN_ACCEPT_MAX,
+               "accept budget shouldn't shrink while wakeups are busy");
+    for (size_t i = 0; i < 16; ++i)
+      fio_listen_accept_budget(&pr, 0);
+    FIO_ASSERT(pr.accept_budget == FIO_LISTEN_ACCEPT_BATCH,
+               "accept budget should shrink to its minimum (%zu)",
+               pr.accept_budget);
+  }
+#ifdef FIO_SO_REUSEPORT
+  {
+    /* a bound (not listening) reservation and two per-worker listeners */
+    const uint8_t flags = FIO_SOCKET_SERVER | FIO_SOCKET_REUSE_PORT;
+    uuid = fio_socket2(NULL, "8766", flags | FIO_SOCKET_BIND_ONLY);
+    FIO_ASSERT(uuid != -1, "Failed to reserve SO_REUSEPORT port 8766");
+    intptr_t listeners[2];
+    listeners[0] = fio_socket2(NULL, "8766", flags);
+    listeners[1] = fio_socket2(NULL, "8766", flags);
+    FIO_ASSERT(listeners[0] != -1 && listeners[1] != -1,
+               "Failed to open SO_REUSEPORT listeners on port 8766");
+    intptr_t shared = fio_socket(NULL, "8766", 1);
+    FIO_ASSERT(shared == -1, "SO_REUSEPORT port shared without SO_REUSEPORT");
+    client1 = fio_socket("Localhost", "8766", 0);
+    FIO_ASSERT(client1 != -1, "Failed to connect to SO_REUSEPORT listener");
+    client2 = -1;
+    for (size_t i = 0; i < 200 && client2 == -1; ++i) {
+      fio_reschedule_thread();
+      client2 = fio_accept(listeners[i & 1]);
+    }
+    FIO_ASSERT(client2 != -1, "Failed to accept SO_REUSEPORT connection");
+    FIO_ASSERT(fio_accept(uuid) == -1,
+               "SO_REUSEPORT reservation shouldn't accept connections");
+    fprintf(stderr, "* SO_REUSEPORT listeners passed.\n");
+    fio_force_close(client1);
+    fio_force_close(client2);
+    fio_force_close(listeners[0]);
+    fio_force_close(listeners[1]);
+    fio_force_close(uuid);
+  }
+#endif
   fio_timer_clear_all();
   fio_defer_clear_tasks();
   fprintf(stderr, "* passed.\n");
@@ -9531,21 +15704,563 @@ FIO_FUNC void fio_cycle_test_task2(void *arg) {
   (void)arg;
 }
 
-FIO_FUNC void fio_cycle_test(void) {
-  fprintf(stderr,
-          "=== Testing facil.io cycling logic (partial - only tests timers)\n");
+FIO_FUNC void fio_cycle_test(void) {
+  fprintf(stderr,
+          "=== Testing facil.io cycling logic (partial - only tests timers)\n");
+  fio_mark_time();
+  fio_timer_clear_all();
+  struct timespec start = fio_last_tick();
+  fio_run_every(1000, 1, fio_cycle_test_task, NULL, NULL);
+  fio_run_every(10000, 1, fio_cycle_test_task2, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1);
+  struct timespec end = fio_last_tick();
+  fio_timer_clear_all();
+  FIO_ASSERT(end.tv_sec == start.tv_sec + 1 || end.tv_sec == start.tv_sec + 2,
+             "facil.io cycling error?");
+#if FIO_ENGINE_EPOLL
+  fio_run_every(100, 1, fio_cycle_test_task, NULL, NULL);
+  fio_start(.threads = 2, .workers = 1, .sharded = 1);
+  fio_timer_clear_all();
+  FIO_ASSERT(evio_shards == 1 && evio_fd == evio_fd_static,
+             "sharded reactor didn't restore the shared reactor.");
+#endif
+  fio_run_every(100, 1, fio_cycle_test_task, NULL, NULL);
+  fio_start(.threads = 2, .workers = 1, .stealing = 1);
+  fio_timer_clear_all();
+  FIO_ASSERT(!fio_defer_locals, "work stealing rings weren't released.");
+  fprintf(stderr, "* passed.\n");
+}
+
+#if FIO_ENGINE_EPOLL
+FIO_FUNC void fio_poll_shard_test_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  char buf[16];
+  if (fio_read(uuid, buf, 16) > 0)
+    ++(((size_t *)(pr + 1))[0]);
+}
+
+FIO_FUNC void fio_poll_shard_test(void) {
+  fprintf(stderr, "=== Testing sharded reactor (epoll) event dispatching\n");
+  struct {
+    fio_protocol_s pr;
+    size_t count;
+  } pr = {.pr = {.on_data = fio_poll_shard_test_on_data}, .count = 0};
+  int sv[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed.");
+  fio_set_non_block(sv[0]);
+  fio_set_non_block(sv[1]);
+  intptr_t uuid = fio_fd2uuid(sv[0]);
+  fio_poll_shards_set(2);
+  fio_attach(uuid, &pr.pr);
+  FIO_ASSERT(write(sv[1], "shard", 5) == 5, "socketpair write failed.");
+  /* the other shard shouldn't see the event */
+  fio_poll_shard((sv[0] + 1) & 1, 0);
+  FIO_ASSERT(!pr.count, "sharded reactor event leaked to the wrong shard.");
+  for (size_t i = 0; i < 100 && !pr.count; ++i) {
+    fio_poll_shard(sv[0] & 1, 10);
+  }
+  FIO_ASSERT(pr.count == 1,
+             "sharded reactor didn't handle the event inline (%zu).", pr.count);
+  fio_poll_shards_set(1);
+  fio_force_close(uuid);
+  close(sv[1]);
+  fio_defer_perform();
+  fprintf(stderr, "* passed.\n");
+}
+#else
+#define fio_poll_shard_test()
+#endif
+/* *****************************************************************************
+Testing vectored (writev) packet flushing
+***************************************************************************** */
+
+FIO_FUNC ssize_t fio_writev_test_blocked(intptr_t uuid, void *udata,
+                                         const void *buf, size_t count) {
+  errno = EWOULDBLOCK;
+  return -1;
+  (void)uuid;
+  (void)udata;
+  (void)buf;
+  (void)count;
+}
+
+FIO_FUNC void fio_writev_test(void) {
+  fprintf(stderr, "=== Testing vectored (writev) packet flushing\n");
+  int sv[2];
+  char buf[64];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed.");
+  fio_set_non_block(sv[0]);
+  fio_set_non_block(sv[1]);
+  intptr_t uuid = fio_fd2uuid(sv[0]);
+  /* block writing, so packets are queued */
+  fio_rw_hook_s blocked = {.write = fio_writev_test_blocked};
+  fio_rw_hook_set(uuid, &blocked, NULL);
+  FIO_ASSERT(!blocked.writev, "custom write hooks shouldn't gather data.");
+  fio_write(uuid, "Hello", 5);
+  fio_write(uuid, " ", 1);
+  fio_write2(uuid, .data.buffer = "World", .length = 5,
+             .after.dealloc = FIO_DEALLOC_NOOP);
+  fio_write2(uuid, .data.buffer = "!!!", .length = 1, .offset = 2,
+             .after.dealloc = FIO_DEALLOC_NOOP);
+  FIO_ASSERT(fd_data(sv[0]).packet_count == 4, "packets weren't queued (%u).",
+             (unsigned int)fd_data(sv[0]).packet_count);
+  fio_rw_hook_set(uuid, (fio_rw_hook_s *)&FIO_DEFAULT_RW_HOOKS, NULL);
+  FIO_ASSERT(fio_flush(uuid) == 0 && !fd_data(sv[0]).packet &&
+                 !fd_data(sv[0]).packet_count,
+             "packets weren't gathered using writev.");
+  ssize_t r = read(sv[1], buf, 64);
+  FIO_ASSERT(r == 12 && !memcmp(buf, "Hello World!", 12),
+             "writev data error (%zd)", r);
+  fio_rw_hook_s hooks = {.write = NULL};
+  fio_rw_hook_set(uuid, &hooks, NULL);
+  FIO_ASSERT(hooks.writev == fio_hooks_default_writev,
+             "system writev hook should be the default for system writes.");
+  fio_defer_perform();
+  fio_force_close(uuid);
+  close(sv[1]);
+  fio_defer_perform();
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing the outgoing buffer watermarks (back-pressure)
+***************************************************************************** */
+
+static uint8_t fio_watermarks_test_state;
+static size_t fio_watermarks_test_count;
+
+FIO_FUNC void fio_watermarks_test_on_backpressure(intptr_t uuid,
+                                                  fio_protocol_s *pr,
+                                                  uint8_t pressure) {
+  fio_watermarks_test_state = pressure;
+  ++fio_watermarks_test_count;
+  (void)uuid;
+  (void)pr;
+}
+
+FIO_FUNC void fio_watermarks_test(void) {
+  fprintf(stderr, "=== Testing outgoing buffer watermarks (back-pressure)\n");
+  int sv[2];
+  char buf[64];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed.");
+  fio_set_non_block(sv[0]);
+  fio_set_non_block(sv[1]);
+  intptr_t uuid = fio_fd2uuid(sv[0]);
+  fio_protocol_s pr = {.on_backpressure = fio_watermarks_test_on_backpressure};
+  fio_attach(uuid, &pr);
+  FIO_ASSERT(fio_watermarks_set(-1, 10, 4, 0) == -1,
+             "watermarks shouldn't be set for invalid connections.");
+  FIO_ASSERT(!fio_watermarks_set(uuid, 10, 4, 1), "fio_watermarks_set failed.");
+  /* block writing, so packets are queued */
+  fio_rw_hook_s blocked = {.write = fio_writev_test_blocked};
+  fio_rw_hook_set(uuid, &blocked, NULL);
+  fio_write(uuid, "Hello ", 6);
+  fio_defer_perform();
+  FIO_ASSERT(fio_pending_bytes(uuid) == 6 && !fio_watermarks_test_count,
+             "pending bytes error (%zu) or early back-pressure.",
+             fio_pending_bytes(uuid));
+  fio_write(uuid, "World!", 6);
+  fio_defer_perform();
+  FIO_ASSERT(fio_pending_bytes(uuid) == 12 && fio_watermarks_test_count == 1 &&
+                 fio_watermarks_test_state == 1,
+             "high watermark wasn't reported (%zu bytes).",
+             fio_pending_bytes(uuid));
+  FIO_ASSERT(fio_trylock(&uuid_data(uuid).scheduled),
+             "reading should be suspended above the high watermark.");
+  fio_write(uuid, "!", 1);
+  fio_defer_perform();
+  FIO_ASSERT(fio_watermarks_test_count == 1,
+             "back-pressure should be reported once.");
+  fio_rw_hook_set(uuid, (fio_rw_hook_s *)&FIO_DEFAULT_RW_HOOKS, NULL);
+  FIO_ASSERT(fio_flush(uuid) == 0 && !fio_pending_bytes(uuid),
+             "pending bytes weren't released (%zu).", fio_pending_bytes(uuid));
+  fio_defer_perform();
+  FIO_ASSERT(fio_watermarks_test_count == 2 && fio_watermarks_test_state == 0,
+             "low watermark wasn't reported.");
+  ssize_t r = read(sv[1], buf, 64);
+  FIO_ASSERT(r == 13 && !memcmp(buf, "Hello World!!", 13),
+             "watermark test data error (%zd)", r);
+  /* disabling the watermarks releases the back-pressure */
+  fio_rw_hook_set(uuid, &blocked, NULL);
+  fio_write(uuid, "Hello World!", 12);
+  fio_defer_perform();
+  FIO_ASSERT(fio_watermarks_test_count == 3 && fio_watermarks_test_state == 1,
+             "high watermark wasn't reported after draining.");
+  FIO_ASSERT(!fio_watermarks_set(uuid, 0, 0, 0), "fio_watermarks_set failed.");
+  fio_defer_perform();
+  FIO_ASSERT(fio_watermarks_test_count == 4 && fio_watermarks_test_state == 0 &&
+                 fio_pending_bytes(uuid) == 12,
+             "disabling the watermarks should release the back-pressure.");
+  fio_rw_hook_set(uuid, (fio_rw_hook_s *)&FIO_DEFAULT_RW_HOOKS, NULL);
+  fio_force_close(uuid);
+  fio_defer_perform();
+  FIO_ASSERT(!fd_data(sv[0]).pending, "closed connections should be cleared.");
+  close(sv[1]);
+  fprintf(stderr, "* passed.\n");
+}
+
+#if FIO_ZEROCOPY
+/* *****************************************************************************
+Testing MSG_ZEROCOPY writes
+***************************************************************************** */
+
+static size_t fio_zerocopy_test_count;
+FIO_FUNC void fio_zerocopy_test_dealloc(void *buf) {
+  ++fio_zerocopy_test_count;
+  free(buf);
+}
+
+FIO_FUNC void fio_zerocopy_test(void) {
+  fprintf(stderr, "=== Testing MSG_ZEROCOPY writes\n");
+  const size_t len = FIO_ZEROCOPY_MIN * 4;
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t addr_len = sizeof(addr);
+  int srv = socket(AF_INET, SOCK_STREAM, 0);
+  FIO_ASSERT(srv != -1, "couldn't open a TCP socket.");
+  FIO_ASSERT(!bind(srv, (struct sockaddr *)&addr, addr_len) &&
+                 !listen(srv, 1) &&
+                 !getsockname(srv, (struct sockaddr *)&addr, &addr_len),
+             "couldn't listen on the loopback interface.");
+  int sv[2];
+  sv[0] = socket(AF_INET, SOCK_STREAM, 0);
+  FIO_ASSERT(sv[0] != -1 &&
+                 !connect(sv[0], (struct sockaddr *)&addr, addr_len),
+             "couldn't connect on the loopback interface.");
+  sv[1] = accept(srv, NULL, NULL);
+  FIO_ASSERT(sv[1] != -1, "couldn't accept the loopback connection.");
+  close(srv);
+  fio_set_non_block(sv[0]);
+  fio_set_non_block(sv[1]);
+  intptr_t uuid = fio_fd2uuid(sv[0]);
+  char *data = malloc(len);
+  FIO_ASSERT_ALLOC(data);
+  /* a pattern (rather than a single byte) also exposes reordered data */
+  for (size_t i = 0; i < len; ++i)
+    data[i] = 'a' + (i % 26);
+  fio_zerocopy_test_count = 0;
+  fio_write2(uuid, .data.buffer = data, .length = len,
+             .after.dealloc = fio_zerocopy_test_dealloc, .zerocopy = 1);
+  char buf[4096];
+  size_t received = 0;
+  for (size_t i = 0; i < 1000 && (received < len || !fio_zerocopy_test_count);
+       ++i) {
+    fio_flush(uuid);
+    ssize_t r = read(sv[1], buf, sizeof(buf));
+    if (r > 0) {
+      for (ssize_t j = 0; j < r; ++j) {
+        if (buf[j] != (char)('a' + ((received + j) % 26)))
+          FIO_ASSERT(0, "zerocopy data error at byte %zu", received + j);
+      }
+      received += r;
+    } else if (received < len || !fio_zerocopy_test_count) {
+      fio_throttle_thread(1000000);
+    }
+  }
+  FIO_ASSERT(received == len, "zerocopy data error (%zu / %zu)", received,
+             len);
+  if (fd_cold(sv[0]).zc_state == 2) {
+    fprintf(stderr, "* SO_ZEROCOPY unsupported, tested the fallback.\n");
+  }
+  FIO_ASSERT(fio_zerocopy_test_count == 1,
+             "zerocopy buffer wasn't released after completion (%zu).",
+             fio_zerocopy_test_count);
+  FIO_ASSERT(!fd_cold(sv[0]).zc_pending && !fd_data(sv[0]).packet,
+             "zerocopy packets should have been released.");
+  fio_force_close(uuid);
+  close(sv[1]);
+  fio_defer_perform();
+  fprintf(stderr, "* passed.\n");
+}
+#else
+#define fio_zerocopy_test()
+#endif
+
+/* *****************************************************************************
+Testing the runtime metrics
+***************************************************************************** */
+
+typedef struct {
+  size_t counter, gauge, histogram;
+  fio_metric_s results[3];
+  size_t builtin;
+} fio_metrics_test_s;
+
+FIO_FUNC void fio_metrics_test_collect(fio_metric_s *m, void *t_) {
+  fio_metrics_test_s *t = t_;
+  if (!strcmp(m->name, "fio_test_total"))
+    t->results[0] = *m;
+  else if (!strcmp(m->name, "fio_test_gauge"))
+    t->results[1] = *m;
+  else if (!strcmp(m->name, "fio_test_latency"))
+    t->results[2] = *m;
+  else if (!strncmp(m->name, "fio_", 4))
+    ++t->builtin;
+}
+
+FIO_FUNC void *fio_metrics_test_thread(void *t_) {
+  fio_metrics_test_s *t = t_;
+  for (size_t i = 0; i < 1000; ++i) {
+    fio_metric_add(t->counter, 1);
+    fio_metric_add(t->gauge, -1);
+    fio_metric_record(t->histogram, 1000);
+  }
+  return NULL;
+}
+
+FIO_FUNC void fio_metrics_test(void) {
+  fprintf(stderr, "=== Testing runtime metrics\n");
+  for (uint64_t i = 0; i < (1ULL << 20); i = (i << 1) + 1 + (i >> 3)) {
+    const size_t b = fio_metrics_bucket(i);
+    FIO_ASSERT(b < FIO_METRICS_BUCKETS && fio_metrics_bucket_max(b) >= i &&
+                   fio_metrics_bucket_max(b) - i <= (i >> FIO_METRICS_SUB_BITS),
+               "histogram bucket error for %llu (%zu => %llu)",
+               (unsigned long long)i, b,
+               (unsigned long long)fio_metrics_bucket_max(b));
+    FIO_ASSERT(fio_metrics_bucket(fio_metrics_bucket_max(b)) == b &&
+                   fio_metrics_bucket(fio_metrics_bucket_max(b) + 1) > b,
+               "histogram bucket bounds error for %llu", (unsigned long long)i);
+  }
+  fio_metrics_test_s t = {
+      .counter = fio_metric_register((struct fio_metric_args_s){
+          .name = "fio_test_total", .help = "testing."}),
+      .gauge = fio_metric_register((struct fio_metric_args_s){
+          .name = "fio_test_gauge", .type = FIO_METRIC_GAUGE}),
+      .histogram = fio_metric_register((struct fio_metric_args_s){
+          .name = "fio_test_latency", .type = FIO_METRIC_HISTOGRAM}),
+  };
+  FIO_ASSERT(t.counter != FIO_METRIC_INVALID &&
+                 t.gauge != FIO_METRIC_INVALID &&
+                 t.histogram != FIO_METRIC_INVALID,
+             "metric registration failed");
+  FIO_ASSERT(fio_metric_register((struct fio_metric_args_s){
+                 .name = "x", .type = 9}) == FIO_METRIC_INVALID,
+             "invalid metric types should be rejected");
+  for (size_t i = 1; i <= 100; ++i)
+    fio_metric_record(t.histogram, i);
+  fio_metric_add(t.histogram, 5); /* ignored */
+  fio_metric_record(t.counter, 5); /* ignored */
+  void *thr = fio_thread_new(fio_metrics_test_thread, &t);
+  FIO_ASSERT(thr, "couldn't start a metrics test thread");
+  fio_thread_join(thr);
+  fio_metric_add(t.counter, 1);
+  fio_metrics_each(fio_metrics_test_collect, &t);
+  FIO_ASSERT(t.builtin >= FIO_METRIC_BUILTIN_COUNT,
+             "built-in metrics missing (%zu)", t.builtin);
+  FIO_ASSERT(t.results[0].value == 1001, "counter error (%lld)",
+             (long long)t.results[0].value);
+  FIO_ASSERT(t.results[1].value == -1000 &&
+                 t.results[1].type == FIO_METRIC_GAUGE,
+             "gauge error (%lld)", (long long)t.results[1].value);
+  FIO_ASSERT(t.results[2].value == 1100 &&
+                 t.results[2].sum == 5050 + 1000000 &&
+                 t.results[2].max == 1000,
+             "histogram totals error (%lld, %llu, %llu)",
+             (long long)t.results[2].value,
+             (unsigned long long)t.results[2].sum,
+             (unsigned long long)t.results[2].max);
+  FIO_ASSERT(t.results[2].p50 == 1000 && t.results[2].p99 == 1000,
+             "histogram percentiles error (%llu, %llu)",
+             (unsigned long long)t.results[2].p50,
+             (unsigned long long)t.results[2].p99);
+  for (size_t i = 0; i < 10000; ++i)
+    fio_metric_record(t.histogram, 10);
+  fio_metrics_each(fio_metrics_test_collect, &t);
+  FIO_ASSERT(t.results[2].p50 >= 10 &&
+                 t.results[2].p50 <= 10 + (10 >> FIO_METRICS_SUB_BITS) &&
+                 t.results[2].p90 < 16,
+             "histogram percentiles error (%llu, %llu)",
+             (unsigned long long)t.results[2].p50,
+             (unsigned long long)t.results[2].p90);
+  fprintf(stderr, "* %zu metrics registered.\n", fio_metrics_data.count);
+}
+
+/* *****************************************************************************
+Testing the connection data layout (hot / cold split)
+***************************************************************************** */
+
+static size_t fio_fd_data_test_count;
+
+FIO_FUNC void fio_fd_data_test_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  ++fio_fd_data_test_count;
+  fio_suspend(uuid); /* no polling for these (fake) connections */
+  (void)pr;
+}
+
+FIO_FUNC void fio_fd_data_test(void) {
+  fprintf(stderr, "=== Testing connection data layout (hot / cold split)\n");
+  FIO_ASSERT(sizeof(fio_fd_data_s) == 64 && !((uintptr_t)fio_data->info & 63),
+             "hot connection data should fill a single aligned cache line "
+             "(%zu bytes)",
+             sizeof(fio_fd_data_s));
+  /* connection data is initialized lazily, a chunk at a time */
+  FIO_ASSERT(fio_data->fd_commit <= fio_data->capa &&
+                 (fio_data->fd_commit == fio_data->capa ||
+                  !(fio_data->fd_commit % FIO_FD_COMMIT_CHUNK)),
+             "connection data commit watermark error (%u)",
+             (unsigned)fio_data->fd_commit);
+  for (size_t i = 0; i < fio_data->fd_commit; ++i) {
+    FIO_ASSERT(fd_data(i).packet_last && fd_cold(i).rw_hooks,
+               "committed connection data wasn't initialized (fd %zu)", i);
+  }
+  for (size_t i = fio_data->fd_commit; i < fio_data->capa; ++i) {
+    FIO_ASSERT(!fd_data(i).packet_last && !fd_data(i).counter,
+               "uncommitted connection data was touched (fd %zu)", i);
+  }
+  FIO_ASSERT(fio_data->fd_commit == fio_data->capa ||
+                 !fio_is_valid((intptr_t)fio_data->fd_commit << 8),
+             "uncommitted connection data shouldn't be valid");
+  fio_protocol_s pr = {.on_data = fio_fd_data_test_on_data};
+  size_t count = fio_data->capa >> 2;
+  if (count > (1 << 16))
+    count = (1 << 16);
+  intptr_t *uuids = malloc(sizeof(*uuids) * count);
+  FIO_ASSERT_ALLOC(uuids);
+  size_t fds = 0;
+  /* fake connections, using the (unused) top of the fd range */
+  for (intptr_t fd = fio_data->capa - 1; fd >= 0 && fds < count; --fd) {
+    if (fd_data(fd).open || fcntl(fd, F_GETFD) != -1)
+      continue;
+    fio_fd_commit(fd);
+    fio_clear_fd(fd, 1);
+    fd_data(fd).protocol = &pr;
+    uuids[fds++] = fd2uuid(fd);
+  }
+  FIO_ASSERT(!fds || fio_data->fd_commit == fio_data->capa,
+             "opening the highest fd should commit all connection data");
+  /* events arrive in no particular order */
+  for (size_t i = fds - 1; i; --i) {
+    size_t j = fio_rand64() % (i + 1);
+    intptr_t tmp = uuids[i];
+    uuids[i] = uuids[j];
+    uuids[j] = tmp;
+  }
+  const size_t rounds = 16;
+  fio_fd_data_test_count = 0;
+  clock_t start = clock();
+  for (size_t r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < fds; ++i)
+      fio_force_event(uuids[i], FIO_EVENT_ON_DATA);
+    fio_defer_perform();
+  }
+  clock_t dispatch = clock() - start;
+  FIO_ASSERT(fio_fd_data_test_count == fds * rounds,
+             "on_data dispatch count error (%zu != %zu)",
+             fio_fd_data_test_count, fds * rounds);
+
+  /* the same fast path access pattern, over a combined (single array) layout */
+  struct {
+    fio_fd_data_s hot;
+    fio_fd_cold_s cold;
+  } *combined = calloc(sizeof(*combined), fio_data->capa);
+  FIO_ASSERT_ALLOC(combined);
+  clock_t split = 0, joined = 0;
+  size_t sum = 0;
+  for (size_t r = 0; r < rounds; ++r) {
+    start = clock();
+    for (size_t i = 0; i < fds; ++i) {
+      fio_fd_data_s *d = &uuid_data(uuids[i]);
+      sum += d->open + d->counter + (uintptr_t)d->protocol + d->active +
+             d->scheduled + d->protocol_lock;
+    }
+    split += clock() - start;
+    start = clock();
+    for (size_t i = 0; i < fds; ++i) {
+      fio_fd_data_s *d = &combined[fio_uuid2fd(uuids[i])].hot;
+      sum += d->open + d->counter + (uintptr_t)d->protocol + d->active +
+             d->scheduled + d->protocol_lock;
+    }
+    joined += clock() - start;
+  }
+  free(combined);
+  fprintf(stderr,
+          "* %zu events over %zu connections: dispatch %lu cycles.\n"
+          "* fast path access (%zu + %zu bytes per fd): split %lu cycles vs. "
+          "combined %lu cycles (%zu).\n",
+          fds * rounds, fds, (unsigned long)dispatch, sizeof(fio_fd_data_s),
+          sizeof(fio_fd_cold_s), (unsigned long)split, (unsigned long)joined,
+          sum & 1);
+
+  for (size_t i = 0; i < fds; ++i)
+    fio_clear_fd(fio_uuid2fd(uuids[i]), 0);
+  fio_max_fd_shrink();
+  free(uuids);
+  fio_defer_perform();
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing connection timeout buckets
+***************************************************************************** */
+
+FIO_FUNC void fio_timeout_test_ping(intptr_t uuid, fio_protocol_s *pr) {
+  ++(((size_t *)(pr + 1))[0]);
+  (void)uuid;
+}
+
+FIO_FUNC void fio_timeout_test(void) {
+  fprintf(stderr, "=== Testing connection timeout buckets\n");
+  struct {
+    fio_protocol_s pr;
+    size_t count;
+  } pr[2] = {{.pr = {.ping = fio_timeout_test_ping}},
+             {.pr = {.ping = fio_timeout_test_ping}}};
+  int sv[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed.");
+  intptr_t uuid[2] = {fio_fd2uuid(sv[0]), fio_fd2uuid(sv[1])};
   fio_mark_time();
-  fio_timer_clear_all();
-  struct timespec start = fio_last_tick();
-  fio_run_every(1000, 1, fio_cycle_test_task, NULL, NULL);
-  fio_run_every(10000, 1, fio_cycle_test_task2, NULL, NULL);
-  fio_start(.threads = 1, .workers = 1);
-  struct timespec end = fio_last_tick();
-  fio_timer_clear_all();
-  FIO_ASSERT(end.tv_sec == start.tv_sec + 1 || end.tv_sec == start.tv_sec + 2,
-             "facil.io cycling error?");
+  const time_t start = fio_data->last_cycle.tv_sec;
+  for (size_t i = 0; i < 2; ++i) {
+    fio_attach(uuid[i], &pr[i].pr);
+    fio_timeout_set(uuid[i], 2 + (i * 8));
+    FIO_ASSERT(fio_timeout_is_linked(sv[i]) &&
+                   fio_data->timeouts[2 + (i * 8)].next ==
+                       &fd_cold(sv[i]).timeout_node,
+               "connection missing from timeout bucket.");
+  }
+  fio_review_timeout(NULL, NULL);
+  fio_defer_perform();
+  FIO_ASSERT(!pr[0].count && !pr[1].count, "timeout review pinged too soon.");
+  /* only the first connection expires */
+  fio_data->last_cycle.tv_sec = start + 3;
+  fio_review_timeout(NULL, NULL);
+  fio_defer_perform();
+  FIO_ASSERT(pr[0].count == 1 && !pr[1].count,
+             "timeout review ping error (%zu, %zu).", pr[0].count, pr[1].count);
+  /* expired connections are pinged again (every second) until touched */
+  fio_data->last_cycle.tv_sec = start + 4;
+  fio_review_timeout(NULL, NULL);
+  fio_defer_perform();
+  FIO_ASSERT(pr[0].count == 2, "expired connection wasn't pinged again.");
+  fio_touch(uuid[0]);
+  fio_touch(uuid[1]);
+  fio_data->last_cycle.tv_sec = start + 5;
+  fio_review_timeout(NULL, NULL);
+  fio_defer_perform();
+  FIO_ASSERT(pr[0].count == 2 && !pr[1].count,
+             "touched connection was pinged.");
+  /* changing the timeout moves the connection between buckets */
+  fio_timeout_set(uuid[0], 0);
+  FIO_ASSERT(fio_data->timeouts[0].next == &fd_cold(sv[0]).timeout_node &&
+                 !fio_ls_embd_any(fio_data->timeouts + 2),
+             "connection didn't move between timeout buckets.");
+  fio_data->last_cycle.tv_sec = start + 16;
+  fio_review_timeout(NULL, NULL);
+  fio_defer_perform();
+  FIO_ASSERT(pr[0].count == 2 && pr[1].count == 1,
+             "timeout review ping error after bucket change (%zu, %zu).",
+             pr[0].count, pr[1].count);
+  for (size_t i = 0; i < 2; ++i) {
+    fio_force_close(uuid[i]);
+  }
+  fio_defer_perform();
+  FIO_ASSERT(!fio_ls_embd_any(fio_data->timeouts) &&
+                 !fio_ls_embd_any(fio_data->timeouts + 10),
+             "closed connections weren't removed from timeout buckets.");
+  fio_mark_time();
+  fio_data->need_review = 0;
   fprintf(stderr, "* passed.\n");
 }
+
 /* *****************************************************************************
 Testing fio_defer task system
 ***************************************************************************** */
@@ -9624,7 +16339,136 @@ FIO_FUNC void fio_defer_test(void) {
   }
   FIO_ASSERT(task_queue_normal.writer == &task_queue_normal.static_queue,
              "defer library didn't release dynamic queue (should be static)");
-  fprintf(stderr, "\n* passed.\n");
+
+  /* FIFO order must survive spilling from the ring into the block queue */
+  for (uintptr_t i = 0; i < (FIO_DEFER_RING_SIZE << 2); ++i) {
+    fio_defer_push_task_fn((fio_defer_task_s){.func = sample_task,
+                                              .arg1 = (void *)i},
+                           &task_queue_normal);
+  }
+  FIO_ASSERT(task_queue_normal.spilled == (FIO_DEFER_RING_SIZE * 3),
+             "defer ring didn't spill to the block queue (%zu)",
+             task_queue_normal.spilled);
+  for (uintptr_t i = 0; i < (FIO_DEFER_RING_SIZE << 2); ++i) {
+    fio_defer_task_s task = fio_defer_pop_task(&task_queue_normal);
+    FIO_ASSERT(task.func == sample_task && task.arg1 == (void *)i,
+               "defer queue order error at %zu", (size_t)i);
+  }
+  FIO_ASSERT(!fio_defer_has_queue() && !task_queue_normal.spilled,
+             "defer queue should be empty after ring / spill test");
+
+  /* ring vs. locked block queue, push / pop cycles */
+  {
+    clock_t ring = 0, locked = 0;
+    for (size_t round = 0;
+         round < FIO_DEFER_TOTAL_COUNT / FIO_DEFER_RING_SIZE; ++round) {
+      start = clock();
+      for (size_t i = 0; i < FIO_DEFER_RING_SIZE; ++i)
+        fio_defer_queue_ring_push(&task_queue_normal,
+                                  (fio_defer_task_s){.func = sample_task});
+      for (size_t i = 0; i < FIO_DEFER_RING_SIZE; ++i)
+        fio_defer_pop_task(&task_queue_normal);
+      end = clock();
+      ring += end - start;
+      start = clock();
+      for (size_t i = 0; i < FIO_DEFER_RING_SIZE; ++i)
+        fio_defer_push_task_locked((fio_defer_task_s){.func = sample_task},
+                                   &task_queue_normal);
+      for (size_t i = 0; i < FIO_DEFER_RING_SIZE; ++i)
+        fio_defer_pop_task(&task_queue_normal);
+      end = clock();
+      locked += end - start;
+    }
+    fprintf(stderr, "\n* %d tasks: ring %lu cycles vs. locked %lu cycles\n",
+            FIO_DEFER_TOTAL_COUNT, (unsigned long)ring,
+            (unsigned long)locked);
+  }
+  FIO_ASSERT(!fio_defer_has_queue(), "defer queue should be empty");
+  FIO_ASSERT(fio_defer_count_dealloc == fio_defer_count_alloc,
+             "defer deallocation vs. allocation error, %zu != %zu",
+             fio_defer_count_dealloc, fio_defer_count_alloc);
+  fprintf(stderr, "* passed.\n");
+}
+
+FIO_FUNC void fio_defer_park_test_task(void *latency_, void *pushed_) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  const struct timespec *pushed = pushed_;
+  *(int64_t *)latency_ = ((int64_t)(now.tv_sec - pushed->tv_sec) * 1000000000) +
+                         (now.tv_nsec - pushed->tv_nsec);
+}
+
+FIO_FUNC void *fio_defer_park_test_thread(void *done) {
+  while (!*(size_t volatile *)done) {
+    fio_defer_perform();
+    fio_defer_thread_wait();
+  }
+  return NULL;
+}
+
+FIO_FUNC void fio_defer_park_test(void) {
+  fprintf(stderr, "=== Testing fio_defer thread parking\n");
+  if (!FIO_DEFER_THREAD_PARKING || FIO_ENGINE_POLL) {
+    fprintf(stderr, "* skipped (parking disabled).\n");
+    return;
+  }
+  size_t done = 0;
+  int64_t latency, worst = 0, total = 0;
+  struct timespec pushed;
+  void *thr = fio_thread_new(fio_defer_park_test_thread, &done);
+  FIO_ASSERT(thr, "couldn't spawn parking test thread.");
+  for (size_t i = 0; i < 64; ++i) {
+    /* wait for the thread to park */
+    for (size_t j = 0; !fio_park_data.sleepers; ++j) {
+      FIO_ASSERT(j < 1000, "thread didn't park.");
+      fio_throttle_thread(100000);
+    }
+    fio_throttle_thread(100000);
+    latency = -1;
+    clock_gettime(CLOCK_MONOTONIC, &pushed);
+    fio_defer(fio_defer_park_test_task, &latency, &pushed);
+    for (size_t j = 0; *(int64_t volatile *)&latency == -1; ++j) {
+      FIO_ASSERT(j < 1000, "parked thread wasn't woken up.");
+      fio_throttle_thread(100000);
+    }
+    total += latency;
+    if (latency > worst)
+      worst = latency;
+  }
+  done = 1;
+  fio_thread_broadcast();
+  fio_thread_join(thr);
+  FIO_ASSERT(!fio_park_data.sleepers, "parked thread count error.");
+  fprintf(stderr, "* wakeup latency: %lldns average, %lldns worst.\n",
+          (long long)(total / 64), (long long)worst);
+  fprintf(stderr, "* passed.\n");
+}
+
+FIO_FUNC void fio_defer_stealing_test(void) {
+  const size_t threads = 4;
+  uintptr_t i_count = 0;
+  fprintf(stderr, "=== Testing fio_defer work stealing (%zu threads)\n",
+          threads);
+  fio_defer_count_steal = 0;
+  fio_defer_locals_set(threads);
+  /* every scheduling task pushes it's tasks into a thread's local ring */
+  for (size_t i = 0; i < 64; ++i) {
+    fio_defer(sched_sample_task, (void *)(FIO_DEFER_LOCAL_SIZE << 2),
+              &i_count);
+  }
+  fio_defer_thread_pool_join(fio_defer_thread_pool_new(threads));
+  FIO_ASSERT(!fio_defer_locals_any(), "local task rings weren't depleted.");
+  fio_defer_locals_set(0);
+  FIO_ASSERT(!fio_defer_has_queue(), "defer queue should be empty.");
+  FIO_ASSERT(i_count == 64 * (FIO_DEFER_LOCAL_SIZE << 2),
+             "work stealing task count error (%zu).", (size_t)i_count);
+  /* without worker threads, tasks are pushed to the global queue */
+  fio_defer(sample_task, &i_count, NULL);
+  FIO_ASSERT(!fio_defer_locals_count && fio_defer_has_queue(),
+             "work stealing should be disabled.");
+  fio_defer_perform();
+  fprintf(stderr, "* %zu tasks stolen.\n* passed.\n",
+          fio_defer_count_steal);
 }
 
 /* *****************************************************************************
@@ -9681,6 +16525,18 @@ Set data-structure Testing
 #define FIO_SET_OBJ_TYPE uintptr_t
 #include <fio.h>
 
+#define FIO_SET_NAME fio_set_fallback
+#define FIO_SET_OBJ_COMPARE(a, b) ((a) == (b))
+#define FIO_SET_OBJ_TYPE uintptr_t
+#define FIO_SET_HASH_FALLBACK(o) FIO_HASH_FALLBACK_FN(&(o), sizeof(o))
+#include <fio.h>
+
+#define FIO_SET_NAME fio_set_simd_test
+#define FIO_SET_KEY_TYPE uintptr_t
+#define FIO_SET_OBJ_TYPE uintptr_t
+#define FIO_SET_SIMD_PROBE 1
+#include <fio.h>
+
 FIO_FUNC void fio_set_test(void) {
   fio_set_test_s s = FIO_SET_INIT;
   fio_hash_test_s h = FIO_SET_INIT;
@@ -9901,7 +16757,87 @@ FIO_FUNC void fio_set_test(void) {
                   "normal) %zu vs. %zu",
                   end_bad - start_bad, end_ok - start_ok);
     fio_set_attack_free(&as);
+
+    /* full collision attack, using FIO_SET_HASH_FALLBACK */
+    fio_set_fallback_s fs = FIO_SET_INIT;
+    for (uintptr_t i = 0; i < FIO_SET_TEST_COUNT; ++i) {
+      fio_set_fallback_insert(&fs, 1, i + 1);
+    }
+    FIO_ASSERT(fio_set_fallback_count(&fs) == FIO_SET_TEST_COUNT,
+               "fallback hash failed, not enough inserts!");
+    FIO_ASSERT(fs.hash_fallback, "fallback hash wasn't used under attack");
+    for (uintptr_t i = 0; i < FIO_SET_TEST_COUNT; ++i) {
+      FIO_ASSERT(fio_set_fallback_find(&fs, 1, i + 1) == i + 1,
+                 "fallback hash find error");
+    }
+    FIO_ASSERT(!fio_set_fallback_remove(&fs, 1, 2, NULL) &&
+                   !fio_set_fallback_find(&fs, 1, 2) &&
+                   fio_set_fallback_find(&fs, 1, 3) == 3,
+               "fallback hash remove error");
+    fio_set_fallback_free(&fs);
+  }
+}
+
+FIO_FUNC void fio_set_simd_test(void) {
+  fio_hash_test_s h = FIO_SET_INIT;
+  fio_set_simd_test_s v = FIO_SET_INIT;
+  fprintf(stderr, "=== Testing Hash Map with FIO_SET_SIMD_PROBE\n");
+  for (uintptr_t i = 1; i < FIO_SET_TEST_COUNT; ++i) {
+    /* mix the hash, so bins share tags as well as groups */
+    const uintptr_t hash = (i & 1) ? (i * 0x9E3779B97F4A7C15ULL) : i;
+    fio_hash_test_insert(&h, hash, i, i + 1, NULL);
+    fio_set_simd_test_insert(&v, hash, i, i + 1, NULL);
+    FIO_ASSERT(fio_set_simd_test_find(&v, hash, i) == i + 1,
+               "SIMD probe hash insertion != find");
+  }
+  FIO_ASSERT(fio_set_simd_test_count(&v) == FIO_SET_TEST_COUNT - 1,
+             "SIMD probe hash count error");
+  {
+    uintptr_t i = 1;
+    FIO_SET_FOR_LOOP(&v, pos) {
+      FIO_ASSERT(pos->obj.key == i && pos->obj.obj == i + 1,
+                 "SIMD probe hash order mismatch %lu != %lu", (unsigned long)i,
+                 (unsigned long)pos->obj.key);
+      ++i;
+    }
   }
+  fprintf(stderr, "* capacity for %lu items: %zu (SIMD) vs. %zu\n",
+          FIO_SET_TEST_COUNT, fio_set_simd_test_capa(&v),
+          fio_hash_test_capa(&h));
+  for (uintptr_t i = 1; i < FIO_SET_TEST_COUNT; i += 2) {
+    const uintptr_t hash = i * 0x9E3779B97F4A7C15ULL;
+    FIO_ASSERT(!fio_set_simd_test_remove(&v, hash, i, NULL),
+               "SIMD probe hash removal failed");
+    FIO_ASSERT(!fio_set_simd_test_find(&v, hash, i),
+               "SIMD probe hash removal failed (still exists)");
+  }
+  for (uintptr_t i = 2; i < FIO_SET_TEST_COUNT; i += 2) {
+    FIO_ASSERT(fio_set_simd_test_find(&v, i, i) == i + 1,
+               "SIMD probe hash lost an item after removals");
+    FIO_ASSERT(!fio_set_simd_test_find(&v, i, i + 1),
+               "SIMD probe hash found a missing key (same hash)");
+  }
+  /* re-adding removed items (reusing holes) */
+  for (uintptr_t i = 1; i < 1024; i += 2) {
+    const uintptr_t hash = i * 0x9E3779B97F4A7C15ULL;
+    fio_set_simd_test_insert(&v, hash, i, i, NULL);
+    FIO_ASSERT(fio_set_simd_test_find(&v, hash, i) == i,
+               "SIMD probe hash re-insertion failed");
+  }
+  fio_set_simd_test_compact(&v);
+  for (uintptr_t i = 2; i < FIO_SET_TEST_COUNT; i += 2) {
+    FIO_ASSERT(fio_set_simd_test_find(&v, i, i) == i + 1,
+               "SIMD probe hash lost an item after compacting");
+  }
+  while (fio_set_simd_test_count(&v)) {
+    fio_set_simd_test__ordered_s_ *last = v.ordered + v.pos - 1;
+    FIO_ASSERT(!fio_set_simd_test_remove(&v, last->hash, last->obj.key, NULL),
+               "SIMD probe hash couldn't remove the last item");
+  }
+  FIO_ASSERT(!fio_set_simd_test_find(&v, 2, 2),
+             "SIMD probe hash should be empty");
+  fio_set_simd_test_free(&v);
+  fio_hash_test_free(&h);
 }
 
 /* *****************************************************************************
@@ -9962,6 +16898,34 @@ FIO_FUNC void fio_riskyhash_test(void) {
 #endif
 }
 
+/* *****************************************************************************
+wyhash tests
+***************************************************************************** */
+
+FIO_FUNC void fio_wyhash_test(void) {
+  fprintf(stderr, "=== Testing fio_wyhash\n");
+  uint8_t buffer[80];
+  uint8_t unaligned[81];
+  for (size_t i = 0; i < sizeof(buffer); ++i)
+    buffer[i] = (uint8_t)(i * 7 + 1);
+  memcpy(unaligned + 1, buffer, sizeof(buffer));
+  uint64_t prev = fio_wyhash(buffer, 0, 1);
+  for (size_t len = 1; len <= 64; ++len) {
+    const uint64_t hash = fio_wyhash(buffer, len, 1);
+    FIO_ASSERT(hash == fio_wyhash(unaligned + 1, len, 1),
+               "fio_wyhash alignment error (length %zu)", len);
+    FIO_ASSERT(hash != prev, "fio_wyhash prefix collision (length %zu)", len);
+    FIO_ASSERT(hash != fio_wyhash(buffer, len, 2),
+               "fio_wyhash seed ignored (length %zu)", len);
+    buffer[len - 1] ^= 1;
+    FIO_ASSERT(hash != fio_wyhash(buffer, len, 1),
+               "fio_wyhash last byte ignored (length %zu)", len);
+    buffer[len - 1] ^= 1;
+    prev = hash;
+  }
+  FIO_ASSERT(fio_hash_secret_seed, "fio_hash_secret_seed wasn't initialized");
+}
+
 /* *****************************************************************************
 SipHash tests
 ***************************************************************************** */
@@ -10029,7 +16993,7 @@ FIO_FUNC void fio_siphash_test(void) {
 SHA-1 tests
 ***************************************************************************** */
 
-FIO_FUNC void fio_sha1_speed_test(void) {
+FIO_FUNC void fio_sha1_speed_test(const char *name) {
   /* test based on code from BearSSL with credit to Thomas Pornin */
   uint8_t buffer[8192];
   uint8_t result[21];
@@ -10053,7 +17017,7 @@ FIO_FUNC void fio_sha1_speed_test(void) {
     end = clock();
     fio_sha1_result(&sha1);
     if ((end - start) >= (2 * CLOCKS_PER_SEC)) {
-      fprintf(stderr, "%-20s %8.2f MB/s\n", "fio SHA-1",
+      fprintf(stderr, "%-20s %8.2f MB/s\n", name,
               (double)(sizeof(buffer) * cycles) /
                   (((end - start) * 1000000.0 / CLOCKS_PER_SEC)));
       break;
@@ -10062,6 +17026,55 @@ FIO_FUNC void fio_sha1_speed_test(void) {
   }
 }
 
+FIO_FUNC void fio_sha1_short_speed_test(const char *name) {
+  /* a WebSocket handshake hashes the 24 byte key and the 36 byte GUID */
+  uint8_t buffer[60];
+  memset(buffer, 'T', sizeof(buffer));
+  /* loop until test runs for more than 2 seconds */
+  for (size_t cycles = 8192;;) {
+    clock_t start, end;
+    start = clock();
+    for (size_t i = cycles; i > 0; i--) {
+      fio_sha1_s sha1 = fio_sha1_init();
+      fio_sha1_write(&sha1, buffer, sizeof(buffer));
+      buffer[0] ^= fio_sha1_result(&sha1)[0];
+      __asm__ volatile("" ::: "memory");
+    }
+    end = clock();
+    if ((end - start) >= (2 * CLOCKS_PER_SEC)) {
+      fprintf(stderr, "%-20s %8.2f hashes/ms\n", name,
+              (double)cycles / ((end - start) * 1000.0 / CLOCKS_PER_SEC));
+      break;
+    }
+    cycles <<= 1;
+  }
+}
+
+/* Compares single writes using portable rounds with fragmented writes. */
+FIO_FUNC void fio_sha1_consistency_test(void) {
+  uint8_t data[1024];
+  for (size_t i = 0; i < sizeof(data); ++i)
+    data[i] = (uint8_t)fio_rand64();
+  for (size_t len = 0; len < sizeof(data); len += 1 + (len >> 3)) {
+    char expect[21];
+    fio_sha1_s sha1;
+#if FIO_SHA_HW
+    fio___sha_hw = 0;
+#endif
+    sha1 = fio_sha1_init();
+    fio_sha1_write(&sha1, data, len);
+    memcpy(expect, fio_sha1_result(&sha1), 21);
+#if FIO_SHA_HW
+    fio___sha_hw = -1;
+#endif
+    sha1 = fio_sha1_init();
+    for (size_t pos = 0, step = 1; pos < len; pos += step, step += step + 1)
+      fio_sha1_write(&sha1, data + pos, (pos + step > len ? len - pos : step));
+    FIO_ASSERT(!memcmp(expect, fio_sha1_result(&sha1), 20),
+               "SHA-1 consistency error for length %zu", len);
+  }
+}
+
 #ifdef HAVE_OPENSSL
 FIO_FUNC void fio_sha1_open_ssl_speed_test(void) {
   /* test based on code from BearSSL with credit to Thomas Pornin */
@@ -10112,6 +17125,9 @@ FIO_FUNC void fio_sha1_test(void) {
            0xda, 0x39, 0xa3, 0xee, 0x5e, 0x6b, 0x4b, 0x0d, 0x32, 0x55,
            0xbf, 0xef, 0x95, 0x60, 0x18, 0x90, 0xaf, 0xd8, 0x07, 0x09,
        }},        // an empty set
+      {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+       {0x84, 0x98, 0x3e, 0x44, 0x1c, 0x3b, 0xd2, 0x6e, 0xba, 0xae, 0x4a,
+        0xa1, 0xf9, 0x51, 0x29, 0xe5, 0xe5, 0x46, 0x70, 0xf1, 0}}, // two blocks
       {NULL, {0}} // Stop
   };
   // clang-format on
@@ -10139,12 +17155,27 @@ FIO_FUNC void fio_sha1_test(void) {
     }
     i++;
   }
+  fio_sha1_consistency_test();
   fprintf(stderr, " SHA-1 passed.\n");
+#if FIO_SHA_HW
+  fprintf(stderr, "* SHA-1 hardware acceleration: %s\n",
+          (fio___sha_hw_available() ? "enabled" : "unavailable"));
+#endif
 #if NODEBUG
-  fio_sha1_speed_test();
+  fio_sha1_speed_test("fio SHA-1");
+  fio_sha1_short_speed_test("fio SHA-1 (60 byte)");
+#if FIO_SHA_HW
+  if (fio___sha_hw_available()) {
+    fio___sha_hw = 0;
+    fio_sha1_speed_test("fio SHA-1 (portable)");
+    fio_sha1_short_speed_test("fio SHA-1 (portable, 60 byte)");
+    fio___sha_hw = -1;
+  }
+#endif
 #else
   fprintf(stderr, "fio SHA1 speed test skipped (debug mode is slow)\n");
   (void)fio_sha1_speed_test;
+  (void)fio_sha1_short_speed_test;
 #endif
 
 #ifdef HAVE_OPENSSL
@@ -10207,6 +17238,32 @@ FIO_FUNC void fio_sha2_speed_test(fio_sha2_variant_e var,
   }
 }
 
+/* Compares single writes using portable rounds with fragmented writes. */
+FIO_FUNC void fio_sha2_consistency_test(fio_sha2_variant_e var) {
+  uint8_t data[1024];
+  for (size_t i = 0; i < sizeof(data); ++i)
+    data[i] = (uint8_t)fio_rand64();
+  for (size_t len = 0; len < sizeof(data); len += 1 + (len >> 3)) {
+    char expect[65];
+    fio_sha2_s sha2;
+#if FIO_SHA_HW
+    fio___sha_hw = 0;
+#endif
+    sha2 = fio_sha2_init(var);
+    fio_sha2_write(&sha2, data, len);
+    memcpy(expect, fio_sha2_result(&sha2), 65);
+#if FIO_SHA_HW
+    fio___sha_hw = -1;
+#endif
+    sha2 = fio_sha2_init(var);
+    for (size_t pos = 0, step = 1; pos < len; pos += step, step += step + 1)
+      fio_sha2_write(&sha2, data + pos, (pos + step > len ? len - pos : step));
+    FIO_ASSERT(!memcmp(expect, fio_sha2_result(&sha2), 64),
+               "SHA-2 (%s) consistency error for length %zu",
+               sha2_variant_names[var], len);
+  }
+}
+
 FIO_FUNC void fio_sha2_openssl_speed_test(const char *var_name, int (*init)(),
                                           int (*update)(), int (*final)(),
                                           void *sha) {
@@ -10332,6 +17389,18 @@ FIO_FUNC void fio_sha2_test(void) {
   got = fio_sha2_result(&s);
   if (strcmp(expect, got))
     goto error;
+
+  s = fio_sha2_init(SHA_256);
+  str = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  fio_sha2_write(&s, str, strlen(str));
+  expect = "\x24\x8d\x6a\x61\xd2\x06\x38\xb8\xe5\xc0\x26\x93\x0c\x3e\x60\x39"
+           "\xa3\x3c\xe4\x59\x64\xff\x21\x67\xf6\xec\xed\xd4\x19\xdb\x06\xc1";
+  got = fio_sha2_result(&s);
+  if (strcmp(expect, got))
+    goto error;
+
+  fio_sha2_consistency_test(SHA_256);
+  fio_sha2_consistency_test(SHA_512);
   fprintf(stderr, " SHA-2 passed.\n");
 
 #if NODEBUG
@@ -10339,6 +17408,13 @@ FIO_FUNC void fio_sha2_test(void) {
   fio_sha2_speed_test(SHA_256, "fio SHA-256");
   fio_sha2_speed_test(SHA_384, "fio SHA-384");
   fio_sha2_speed_test(SHA_512, "fio SHA-512");
+#if FIO_SHA_HW
+  if (fio___sha_hw_available()) {
+    fio___sha_hw = 0;
+    fio_sha2_speed_test(SHA_256, "fio SHA-256 (portable)");
+    fio___sha_hw = -1;
+  }
+#endif
 #else
   fprintf(stderr, "fio SHA-2 speed test skipped (debug mode is slow)\n");
 #endif
@@ -10712,6 +17788,41 @@ FIO_FUNC void fio_pubsub_test(void) {
   ++expect;
   fio_defer_perform();
   FIO_ASSERT(counter == expect, "unsubscribe wasn't called for named channel!");
+  {
+    /* pattern subscriptions are indexed by their literal prefix */
+    const char *patterns[] = {"news.*", "news.sport.?", "ne*", "*", "news",
+                              "n[aeiou]ws.*", "news.sport.a", NULL};
+    subscription_s *subs[8];
+    uintptr_t counters[8] = {0};
+    for (size_t i = 0; patterns[i]; ++i) {
+      subs[i] = fio_subscribe(
+          .channel = {0, strlen(patterns[i]), (char *)patterns[i]},
+          .match = FIO_MATCH_GLOB, .udata1 = counters + i,
+          .on_message = fio_pubsub_test_on_message);
+      FIO_ASSERT(subs[i], "fio_subscribe FAILED on pattern subscription.");
+    }
+    FIO_ASSERT(fio_match_trie.count == 1 &&
+                   fio_ls_embd_any(&fio_match_trie.channels),
+               "pattern index should start at 'n' ('*' is tested at the root).");
+    const char *channels[] = {"news.sport.a", "news", "new", "nows.x", "x",
+                              NULL};
+    /* expected match counts, by pattern, after all the channels are used */
+    const uintptr_t expected[] = {1, 1, 3, 5, 1, 2, 1};
+    for (size_t i = 0; channels[i]; ++i) {
+      fio_publish(.channel = {0, strlen(channels[i]), (char *)channels[i]});
+    }
+    fio_defer_perform();
+    for (size_t i = 0; patterns[i]; ++i) {
+      FIO_ASSERT(counters[i] == expected[i],
+                 "pattern %s matched %zu times (expected %zu)!", patterns[i],
+                 (size_t)counters[i], (size_t)expected[i]);
+      fio_unsubscribe(subs[i]);
+    }
+    fio_defer_perform();
+    FIO_ASSERT(!fio_match_trie.count && !fio_match_trie.children &&
+                   fio_ls_embd_is_empty(&fio_match_trie.channels),
+               "pattern index wasn't cleared!");
+  }
   fio_data->is_worker = 0;
   fio_data->active = 0;
   fio_data->workers = 0;
@@ -10720,8 +17831,247 @@ FIO_FUNC void fio_pubsub_test(void) {
   (void)fio_pubsub_test_on_unsubscribe;
   fprintf(stderr, "* passed.\n");
 }
+
+/* *****************************************************************************
+Cluster batching tests
+***************************************************************************** */
+
+static struct {
+  size_t count;
+  size_t errors;
+  size_t lengths[6];
+} fio_cluster_batch_test_data;
+
+FIO_FUNC void fio_cluster_batch_test_handler(cluster_pr_s *pr) {
+  const size_t i = fio_cluster_batch_test_data.count++;
+  if (i >= 6 || pr->type != FIO_CLUSTER_MSG_FORWARD || pr->msg->filter ||
+      pr->msg->channel.len != fio_cluster_batch_test_data.lengths[i] ||
+      pr->msg->data.len != fio_cluster_batch_test_data.lengths[i] * 3) {
+    ++fio_cluster_batch_test_data.errors;
+    return;
+  }
+  for (size_t j = 0; j < pr->msg->channel.len; ++j) {
+    if (pr->msg->channel.data[j] != (char)('a' + i))
+      ++fio_cluster_batch_test_data.errors;
+  }
+  for (size_t j = 0; j < pr->msg->data.len; ++j) {
+    if (pr->msg->data.data[j] != (char)('0' + (j % 10)))
+      ++fio_cluster_batch_test_data.errors;
+  }
+}
+
+FIO_FUNC void fio_cluster_batch_test(void) {
+  fprintf(stderr, "=== Testing cluster message batching (split frames)\n");
+  /* the last message is bigger than the read buffer */
+  const size_t lengths[6] = {0, 1, 15, 300, 2000, CLUSTER_READ_BUFFER / 2};
+  const size_t splits[] = {1, 3, 7, 16, 17, 18, 100, 4095, 16383, 70000};
+  char *tmp = fio_malloc(CLUSTER_READ_BUFFER * 2);
+  char *batch = fio_malloc(CLUSTER_READ_BUFFER * 4);
+  FIO_ASSERT_ALLOC(tmp);
+  FIO_ASSERT_ALLOC(batch);
+  for (size_t j = 0; j < CLUSTER_READ_BUFFER * 2; ++j)
+    tmp[j] = (char)('0' + (j % 10));
+  size_t total = 0;
+  for (size_t i = 0; i < 6; ++i) {
+    char channel[CLUSTER_READ_BUFFER / 2];
+    memset(channel, 'a' + i, lengths[i]);
+    fio_cluster_batch_test_data.lengths[i] = lengths[i];
+    fio_msg_internal_s *m = fio_msg_internal_create(
+        0, FIO_CLUSTER_MSG_FORWARD,
+        (fio_str_info_s){.data = channel, .len = lengths[i]},
+        (fio_str_info_s){.data = tmp, .len = lengths[i] * 3}, 0, 1);
+    const size_t offset = sizeof(*m) + (m->meta_len * sizeof(*m->meta));
+    const size_t len = 16 + m->channel.len + m->data.len + 2;
+    memcpy(batch + total, (uint8_t *)m + offset, len);
+    total += len;
+    fio_msg_internal_free(m);
+  }
+  FIO_ASSERT(total <= CLUSTER_READ_BUFFER * 4, "test batch overflow.");
+  for (size_t s = 0; s < sizeof(splits) / sizeof(splits[0]); ++s) {
+    int sv[2];
+    FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed.");
+    fio_set_non_block(sv[0]);
+    fio_set_non_block(sv[1]);
+    cluster_pr_s *pr = fio_malloc(sizeof(*pr));
+    FIO_ASSERT_ALLOC(pr);
+    *pr = (cluster_pr_s){
+        .handler = fio_cluster_batch_test_handler,
+        .uuid = fio_fd2uuid(sv[0]),
+    };
+    fio_cluster_batch_test_data.count = 0;
+    fio_cluster_batch_test_data.errors = 0;
+    for (size_t pos = 0; pos < total;) {
+      size_t len = splits[s];
+      if (len > total - pos)
+        len = total - pos;
+      FIO_ASSERT(write(sv[1], batch + pos, len) == (ssize_t)len,
+                 "socketpair write failed.");
+      pos += len;
+      fio_cluster_on_data(pr->uuid, &pr->protocol);
+    }
+    FIO_ASSERT(fio_cluster_batch_test_data.count == 6 &&
+                   !fio_cluster_batch_test_data.errors,
+               "batched messages split every %zu bytes: %zu/6 delivered, "
+               "%zu errors.",
+               splits[s], fio_cluster_batch_test_data.count,
+               fio_cluster_batch_test_data.errors);
+    FIO_ASSERT(!pr->length && !pr->msg && !pr->exp_channel && !pr->exp_msg,
+               "cluster parser state should be reset after a full batch.");
+    fio_force_close(pr->uuid);
+    close(sv[1]);
+    fio_defer_perform();
+    fio_free(pr);
+  }
+  fio_free(batch);
+  fio_free(tmp);
+  fprintf(stderr, "* passed.\n");
+}
+
+#if FIO_CLUSTER_SHM
+/* *****************************************************************************
+Cluster shared memory transport tests
+***************************************************************************** */
+
+#define FIO_CLUSTER_SHM_TEST_COUNT ((FIO_CLUSTER_SHM_SIZE * 4) / 1024)
+
+static struct {
+  size_t count;
+  size_t pings;
+  size_t errors;
+} fio_cluster_shm_test_data;
+
+FIO_FUNC void fio_cluster_shm_test_handler(cluster_pr_s *pr) {
+  if (pr->type == FIO_CLUSTER_MSG_PING) {
+    ++fio_cluster_shm_test_data.pings;
+    return;
+  }
+  /* messages from a single publisher must arrive in order */
+  const size_t i = fio_cluster_shm_test_data.count++;
+  if (pr->type != FIO_CLUSTER_MSG_FORWARD || pr->msg->data.len != 1000 ||
+      fio_str2u64(pr->msg->data.data) != i) {
+    ++fio_cluster_shm_test_data.errors;
+    return;
+  }
+  for (size_t j = 8; j < 1000; ++j) {
+    if (pr->msg->data.data[j] != (char)('a' + (i % 26))) {
+      ++fio_cluster_shm_test_data.errors;
+      return;
+    }
+  }
+}
+
+FIO_FUNC void fio_cluster_shm_test(void) {
+  fprintf(stderr, "=== Testing cluster shared memory transport (fork)\n");
+  int sv[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed.");
+  fio_set_non_block(sv[0]);
+  fio_set_non_block(sv[1]);
+  fio_cluster_shm_s *shm = fio_cluster_shm_new();
+  FIO_ASSERT(shm, "couldn't create the shared memory transport.");
+  fio_cluster_shm_test_data.count = 0;
+  fio_cluster_shm_test_data.pings = 0;
+  fio_cluster_shm_test_data.errors = 0;
+  pid_t child = fork();
+  FIO_ASSERT(child != -1, "fork failed");
+  if (!child) {
+    /* the worker publishes 4 times the ring's capacity, pausing only when the
+     * ring is full, then sends a control message using the socket. */
+    cluster_pr_s *pr = fio_malloc(sizeof(*pr));
+    FIO_ASSERT_ALLOC(pr);
+    *pr = (cluster_pr_s){.uuid = fio_fd2uuid(sv[1])};
+    pr->out.lock = FIO_LOCK_INIT;
+    pr->out.ring = shm->up;
+    pr->out.signal = shm->up_fd;
+    pr->out.scheduled = 1; /* the test flushes the buffer */
+    char data[1000];
+    for (size_t i = 0; i < FIO_CLUSTER_SHM_TEST_COUNT; ++i) {
+      memset(data, 'a' + (i % 26), 1000);
+      fio_u2str64(data, i);
+      fio_msg_internal_s *m = fio_msg_internal_create(
+          0, FIO_CLUSTER_MSG_FORWARD, (fio_str_info_s){.data = "shm", .len = 3},
+          (fio_str_info_s){.data = data, .len = 1000}, 0, 1);
+      fio_cluster_send(pr, m);
+      fio_msg_internal_free(m);
+      if (!i) {
+        /* writing one message first makes later writes wrap around */
+        fio_lock(&pr->out.lock);
+        fio_cluster_out_write(pr);
+        fio_unlock(&pr->out.lock);
+      }
+    }
+    fio_lock(&pr->out.lock);
+    fio_cluster_out_write(pr);
+    const int overflow = pr->out.len > 0;
+    fio_unlock(&pr->out.lock);
+    for (size_t i = 0; pr->out.len && i < 5000; ++i) {
+      usleep(1000);
+      fio_lock(&pr->out.lock);
+      fio_cluster_out_write(pr);
+      fio_unlock(&pr->out.lock);
+    }
+    fio_msg_internal_s *m = fio_msg_internal_create(
+        0, FIO_CLUSTER_MSG_PING, (fio_str_info_s){.len = 0},
+        (fio_str_info_s){.len = 0}, 0, 1);
+    fio_cluster_send(pr, m);
+    fio_msg_internal_free(m);
+    fio_flush_strong(pr->uuid);
+    _exit(pr->out.len ? 2 : !overflow);
+  }
+  cluster_pr_s *r = fio_malloc(sizeof(*r));
+  FIO_ASSERT_ALLOC(r);
+  *r = (cluster_pr_s){.handler = fio_cluster_shm_test_handler, .in = shm->up};
+  for (size_t i = 0;
+       fio_cluster_shm_test_data.count < FIO_CLUSTER_SHM_TEST_COUNT && i < 5000;
+       ++i) {
+    struct pollfd pfd = {.fd = shm->up_fd, .events = POLLIN};
+    if (poll(&pfd, 1, 1) == 1) {
+      eventfd_t ignr;
+      eventfd_read(shm->up_fd, &ignr);
+    }
+    fio_cluster_on_data(-1, &r->protocol);
+  }
+  int status = 0;
+  waitpid(child, &status, 0);
+  FIO_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) != 2,
+             "the worker couldn't write all the messages to the ring.");
+  FIO_ASSERT(WIFEXITED(status) && !WEXITSTATUS(status),
+             "the test should overflow the ring (ring size: %zu).",
+             (size_t)FIO_CLUSTER_SHM_SIZE);
+  FIO_ASSERT(fio_cluster_shm_test_data.count == FIO_CLUSTER_SHM_TEST_COUNT &&
+                 !fio_cluster_shm_test_data.errors,
+             "shared memory messages: %zu/%zu delivered, %zu out of order.",
+             fio_cluster_shm_test_data.count,
+             (size_t)FIO_CLUSTER_SHM_TEST_COUNT,
+             fio_cluster_shm_test_data.errors);
+  FIO_ASSERT(!r->length && !r->msg,
+             "the ring should end on a message boundary.");
+  FIO_ASSERT(!fio_cluster_shm_test_data.pings,
+             "control messages shouldn't be written to the ring.");
+  /* control messages use the socket */
+  cluster_pr_s *s = fio_malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  *s = (cluster_pr_s){.handler = fio_cluster_shm_test_handler,
+                      .uuid = fio_fd2uuid(sv[0])};
+  fio_cluster_on_data(s->uuid, &s->protocol);
+  FIO_ASSERT(fio_cluster_shm_test_data.pings == 1 &&
+                 fio_cluster_shm_test_data.count == FIO_CLUSTER_SHM_TEST_COUNT,
+             "the control message should be sent using the socket.");
+  fio_force_close(s->uuid);
+  close(sv[1]);
+  fio_defer_perform();
+  fio_free(s);
+  fio_free(r);
+  fio_cluster_shm_free(shm);
+  fprintf(stderr, "* passed.\n");
+}
+#undef FIO_CLUSTER_SHM_TEST_COUNT
+#else
+#define fio_cluster_shm_test()
+#endif
 #else
 #define fio_pubsub_test()
+#define fio_cluster_batch_test()
+#define fio_cluster_shm_test()
 #endif
 
 /* *****************************************************************************
@@ -10795,6 +18145,37 @@ FIO_FUNC void fio_atol_test(void) {
             9223372036854775807LL); /* INT64_MAX overflow protection */
   TEST_ATOL("9223372036854775999",
             9223372036854775807LL); /* INT64_MAX overflow protection */
+  TEST_ATOL("18446744073709551615",
+            9223372036854775807LL); /* 20 digits (UINT64_MAX) */
+  TEST_ATOL("-12345678", -12345678);                   /* a single SWAR word */
+  TEST_ATOL("123456789012345678", 123456789012345678); /* 2 digits + 2 words */
+  TEST_ATOL("90000000000000009", 90000000000000009);
+  {
+    /* every length (and SWAR alignment) up to 19 digits */
+    char digits[24];
+    int64_t n = 0;
+    for (size_t i = 0; i < 19; ++i) {
+      digits[i] = '1' + (i % 9);
+      digits[i + 1] = 0;
+      n = (n * 10) + (digits[i] - '0');
+      TEST_ATOL(digits, n);
+    }
+    /* reading stops on the first non-digit, wherever it is */
+    memcpy(digits, "1234567x9012", 13);
+    char *p = digits;
+    FIO_ASSERT(fio_atol(&p) == 1234567 && p == digits + 7,
+               "fio_atol should stop at a non-digit");
+    /* numbers crossing a (4Kb) page boundary */
+    static char pages[3 << 12];
+    char *const boundary =
+        (char *)((((uintptr_t)pages + 4095) & ~((uintptr_t)4095)) + 4096);
+    for (size_t i = 1; i < 24; ++i) {
+      memcpy(boundary - i, "123456789012\0", 13);
+      p = boundary - i;
+      FIO_ASSERT(fio_atol(&p) == 123456789012 && p == boundary - i + 12,
+                 "fio_atol failed at page boundary offset -%zu", i);
+    }
+  }
 
   char number_hex[128] = "0xe5d4c3b2a1908770"; /* hex with embedded sign */
   // char number_hex[128] = "-0x1a2b3c4d5e6f7890";
@@ -10849,6 +18230,53 @@ FIO_FUNC void fio_atol_test(void) {
   fprintf(stderr, "native strtol base 16 (%ld): %zd CPU cycles%s\n", result,
           end - start, (result != expect ? " (!?stdlib overflow?!)" : ""));
 
+  {
+    /* short numbers are common (i.e., lengths) */
+    char number_short[] = "12345";
+    result = 0;
+    start = clock();
+    for (size_t i = 0; i < FIO_ATOL_TEST_MAX_CYCLES; ++i) {
+      __asm__ volatile("" ::: "memory");
+      char *pos = number_short;
+      result = fio_atol(&pos);
+      __asm__ volatile("" ::: "memory");
+    }
+    end = clock();
+    fprintf(stderr, "fio_atol base 10 (%ld): %zd CPU cycles\n", result,
+            end - start);
+    result = 0;
+    start = clock();
+    for (size_t i = 0; i < FIO_ATOL_TEST_MAX_CYCLES; ++i) {
+      __asm__ volatile("" ::: "memory");
+      result = strtol(number_short, NULL, 0);
+      __asm__ volatile("" ::: "memory");
+    }
+    end = clock();
+    fprintf(stderr, "native strtol base 10 (%ld): %zd CPU cycles\n", result,
+            end - start);
+  }
+  {
+    char number_float[] = "-12345.6789e-3";
+    double f = 0;
+    start = clock();
+    for (size_t i = 0; i < FIO_ATOL_TEST_MAX_CYCLES; ++i) {
+      __asm__ volatile("" ::: "memory");
+      char *pos = number_float;
+      f = fio_atof(&pos);
+      __asm__ volatile("" ::: "memory");
+    }
+    end = clock();
+    fprintf(stderr, "fio_atof (%g): %zd CPU cycles\n", f, end - start);
+    start = clock();
+    for (size_t i = 0; i < FIO_ATOL_TEST_MAX_CYCLES; ++i) {
+      __asm__ volatile("" ::: "memory");
+      f = strtod(number_float, NULL);
+      __asm__ volatile("" ::: "memory");
+    }
+    end = clock();
+    fprintf(stderr, "native strtod (%g): %zd CPU cycles\n", f, end - start);
+  }
+
   result = 0;
   start = clock();
   for (size_t i = 0; i < FIO_ATOL_TEST_MAX_CYCLES; ++i) {
@@ -10982,9 +18410,367 @@ FIO_FUNC void fio_atof_test(void) {
               5708990770823839524233143877797980545530986496.0, 0);
   TEST_DOUBLE("5708990770823839207320493820740630171355185152001e-3",
               5708990770823839524233143877797980545530986496.0, 0);
+  /* the fast path (up to 19 digits, small exponents) and its edges */
+  TEST_DOUBLE("0.1", 0.1, 1);
+  TEST_DOUBLE(".5", 0.5, 1);
+  TEST_DOUBLE("0.000123", 0.000123, 1);
+  TEST_DOUBLE("-123.456e+3", -123.456e+3, 1);
+  TEST_DOUBLE("9007199254740993", 9007199254740993.0, 1); /* 2^53 + 1 */
+  TEST_DOUBLE("1e22", 1e22, 1);
+  TEST_DOUBLE("1e23", 1e23, 1);
+  TEST_DOUBLE("1234567890123456789e-22", 1234567890123456789e-22, 1);
+  {
+    /* random decimals must match `strtod` */
+    char buf[64];
+    for (size_t i = 0; i < 4096; ++i) {
+      uint64_t r = fio_rand64();
+      size_t len = snprintf(buf, 64, "%s%llu.%llue%d", ((r & 1) ? "-" : ""),
+                            (unsigned long long)((r >> 1) & 0xFFFFF),
+                            (unsigned long long)((r >> 21) & 0xFFFFFFF),
+                            (int)((r >> 49) & 63) - 32);
+      char *p = buf;
+      double d = fio_atof(&p);
+      FIO_ASSERT(d == strtod(buf, NULL) && p == buf + len,
+                 "fio_atof error: %s => %.17g (not %.17g)", buf, d,
+                 strtod(buf, NULL));
+    }
+    const char *partial[] = {"1e", "1e+", "1.", "-.5x", "12.5.3"};
+    const size_t consumed[] = {1, 1, 2, 3, 4};
+    for (size_t i = 0; i < sizeof(partial) / sizeof(partial[0]); ++i) {
+      char *p = (char *)partial[i];
+      char *p2 = (char *)partial[i];
+      double d = fio_atof(&p);
+      FIO_ASSERT(d == strtod(p2, &p2) && p == p2 &&
+                     p == partial[i] + consumed[i],
+                 "fio_atof reading position error: %s", partial[i]);
+    }
+  }
+#undef TEST_DOUBLE
+#define TEST_FTOA(d, s)                                                        \
+  do {                                                                         \
+    char buf[32];                                                              \
+    size_t len = fio_ftoa(buf, (d), 10);                                       \
+    FIO_ASSERT(len == strlen(s) && !memcmp(buf, (s), len + 1),                 \
+               "fio_ftoa error: %s (not %s)", buf, (s));                       \
+  } while (0)
+  TEST_FTOA(0.1, "0.1");
+  TEST_FTOA(-0.0, "-0.0");
+  TEST_FTOA(100.0, "100.0");
+  TEST_FTOA(-1.5, "-1.5");
+  TEST_FTOA(1e21, "1e+21");
+  TEST_FTOA(1e-7, "1e-7");
+  TEST_FTOA(123456.789, "123456.789");
+  TEST_FTOA(5e-324, "5e-324");
+  TEST_FTOA(1.7976931348623157e+308, "1.7976931348623157e+308");
+  TEST_FTOA(0.0 / 0.0, "NaN");
+  TEST_FTOA(-1.0 / 0.0, "-Infinity");
+#undef TEST_FTOA
+  for (size_t i = 0; i < 4096; ++i) {
+    /* random bit patterns should survive a round trip */
+    union {
+      uint64_t u;
+      double d;
+    } u = {.u = fio_rand64()};
+    char buf[32];
+    if (u.d != u.d || isinf(u.d))
+      continue;
+    fio_ftoa(buf, u.d, 10);
+    FIO_ASSERT(strtod(buf, NULL) == u.d, "fio_ftoa round trip error: %s", buf);
+  }
   fprintf(stderr, "\n* passed.\n");
 }
 /* *****************************************************************************
+Testing UDP sockets
+***************************************************************************** */
+
+FIO_FUNC void fio_udp_test_on_datagram(intptr_t uuid, void *data, size_t len,
+                                       fio_udp_peer_s *peer, void *udata) {
+  fio_str_s *str = udata;
+  fio_str_write(str, data, len);
+  fio_str_write(str, "|", 1);
+  (void)uuid, (void)peer;
+}
+
+FIO_FUNC void fio_udp_test(void) {
+  fprintf(stderr, "=== Testing UDP sockets (batched send / receive)\n");
+  for (uint8_t offload = 0; offload < 2; ++offload) {
+    fio_str_s str = FIO_STR_INIT;
+    struct fio_udp_args args = {.address = "127.0.0.1",
+                                .port = "0",
+                                .on_datagram = fio_udp_test_on_datagram,
+                                .udata = &str,
+                                .gso = offload,
+                                .gro = offload};
+    fio_udp_protocol_s *p = fio_udp_new(&args);
+    FIO_ASSERT(p, "couldn't open a UDP socket: %s", strerror(errno));
+    const int fd = fio_uuid2fd(p->uuid);
+    fio_udp_peer_s peer = {.len = sizeof(peer.addr)};
+    FIO_ASSERT(!getsockname(fd, (struct sockaddr *)&peer.addr, &peer.len),
+               "getsockname failed");
+    char port[16];
+    snprintf(port, sizeof(port), "%u",
+             (unsigned)ntohs(((struct sockaddr_in *)&peer.addr)->sin_port));
+    fio_udp_peer_s resolved;
+    FIO_ASSERT(!fio_udp_peer_set(&resolved, "127.0.0.1", port) &&
+                   resolved.len == peer.len &&
+                   !memcmp(&resolved.addr, &peer.addr, peer.len),
+               "fio_udp_peer_set error");
+    /* a GSO run (same size, shorter last segment) followed by a datagram */
+    fio_udp_queue(p, fd, &peer, "aaaa", 4);
+    fio_udp_queue(p, fd, &peer, "aaaa", 4);
+    fio_udp_queue(p, fd, &peer, "aaaa", 4);
+    fio_udp_queue(p, fd, &peer, "bb", 2);
+    fio_udp_queue(p, fd, &peer, "cccccc", 6);
+    FIO_ASSERT(p->queued == 5 && p->queued_bytes == 20,
+               "datagrams weren't queued");
+    fio_udp_flush(p, fd);
+    FIO_ASSERT(!p->queued, "the send queue wasn't flushed");
+    fio_udp_on_data(p->uuid, &p->pr);
+    FIO_ASSERT(!strcmp(fio_str_data(&str), "aaaa|aaaa|aaaa|bb|cccccc|"),
+               "UDP datagrams error (offload %d): %s", (int)offload,
+               fio_str_data(&str));
+    /* filling the queue flushes it */
+    for (size_t i = 0; i <= FIO_UDP_BATCH; ++i)
+      fio_udp_queue(p, fd, &peer, "x", 1);
+    FIO_ASSERT(p->queued == 1, "a full send queue should be flushed");
+    fio_udp_flush(p, fd);
+    fio_str_resize(&str, 0);
+    fio_udp_on_data(p->uuid, &p->pr);
+    FIO_ASSERT(fio_str_len(&str) == (FIO_UDP_BATCH + 1) * 2,
+               "UDP batch error (%zu bytes)", fio_str_len(&str));
+    fio_str_free(&str);
+    fio_force_close(p->uuid);
+    fio_udp_free(p);
+  }
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing the shared memory cache
+***************************************************************************** */
+
+FIO_FUNC void fio_shm_cache_test(void) {
+  fprintf(stderr, "=== Testing the shared memory cache\n");
+  fio_shm_cache_s *c = fio_shm_cache_new(.capacity = 4, .entry_size = 16);
+  FIO_ASSERT(c && !c->mask, "shared memory cache allocation error");
+  char buf[16];
+  fio_str_info_s keys[5] = {
+      {.data = (char *)"k0", .len = 2}, {.data = (char *)"k1", .len = 2},
+      {.data = (char *)"k2", .len = 2}, {.data = (char *)"k3", .len = 2},
+      {.data = (char *)"k4", .len = 2},
+  };
+  fio_str_info_s val = {.data = (char *)"value", .len = 5};
+  FIO_ASSERT(fio_shm_cache_get(c, keys[0], buf, 16) == -1,
+             "empty cache shouldn't find keys");
+  FIO_ASSERT(!fio_shm_cache_set(c, keys[0], val, 0) &&
+                 fio_shm_cache_get(c, keys[0], buf, 16) == 5 &&
+                 !strcmp(buf, "value"),
+             "shared memory cache set / get error");
+  FIO_ASSERT(fio_shm_cache_get(c, keys[0], buf, 3) == 5 && !strcmp(buf, "va"),
+             "truncated values should be NUL terminated");
+  val = (fio_str_info_s){.data = (char *)"0123456789abcdef", .len = 15};
+  FIO_ASSERT(fio_shm_cache_set(c, keys[0], val, 0) == -1 &&
+                 fio_shm_cache_get(c, keys[0], buf, 16) == 5,
+             "values longer than the entry size should be rejected");
+  val.len = 14;
+  FIO_ASSERT(!fio_shm_cache_set(c, keys[0], val, 0) &&
+                 fio_shm_cache_get(c, keys[0], buf, 16) == 14 &&
+                 !memcmp(buf, val.data, 14),
+             "replacing a value failed");
+  FIO_ASSERT(!fio_shm_cache_remove(c, keys[0]) &&
+                 fio_shm_cache_remove(c, keys[0]) == -1 &&
+                 fio_shm_cache_get(c, keys[0], buf, 16) == -1,
+             "shared memory cache remove error");
+  /* TTL */
+  val.len = 1;
+  fio_shm_cache_set2(c, keys[0], val, 2, 100);
+  FIO_ASSERT(fio_shm_cache_get2(c, keys[0], buf, 16, 101) == 1 &&
+                 fio_shm_cache_get2(c, keys[0], buf, 16, 102) == -1,
+             "entries should expire");
+  /* LRU eviction (a single set) */
+  for (size_t i = 0; i < 4; ++i)
+    fio_shm_cache_set2(c, keys[i], val, 0, 100);
+  fio_shm_cache_get2(c, keys[0], buf, 16, 100);
+  fio_shm_cache_set2(c, keys[4], val, 0, 100);
+  FIO_ASSERT(fio_shm_cache_get2(c, keys[1], buf, 16, 100) == -1 &&
+                 fio_shm_cache_get2(c, keys[0], buf, 16, 100) == 1 &&
+                 fio_shm_cache_get2(c, keys[4], buf, 16, 100) == 1,
+             "the least recently used entry should be evicted");
+  fio_shm_cache_set2(c, keys[2], val, 1, 100);
+  fio_shm_cache_set2(c, keys[1], val, 0, 101);
+  FIO_ASSERT(fio_shm_cache_get2(c, keys[1], buf, 16, 101) == 1 &&
+                 fio_shm_cache_get2(c, keys[3], buf, 16, 101) == 1,
+             "expired entries should be evicted first");
+  /* the cache is shared with forked processes */
+  pid_t child = fork();
+  FIO_ASSERT(child != -1, "fork failed");
+  if (!child) {
+    val = (fio_str_info_s){.data = (char *)"child", .len = 5};
+    fio_shm_cache_set(c, keys[0], val, 0);
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(child, &status, 0);
+  FIO_ASSERT(fio_shm_cache_get(c, keys[0], buf, 16) == 5 &&
+                 !strcmp(buf, "child"),
+             "the cache isn't shared with child processes");
+  fio_shm_cache_free(c);
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing rate limiting
+***************************************************************************** */
+
+FIO_FUNC void fio_rate_limit_test(void) {
+  fprintf(stderr, "=== Testing rate limiting (token buckets)\n");
+  FIO_ASSERT(fio_rate_limit_table, "rate limiting table missing");
+  fio_str_info_s addr = {.data = (char *)"10.0.0.1", .len = 8};
+  uintptr_t key = fio_rate_limit_key(1, addr);
+  FIO_ASSERT(key != fio_rate_limit_key(2, addr),
+             "rate limiting keys should differ by id");
+  /* 10 tokens per second, burst of 2 */
+  FIO_ASSERT(!fio_rate_limit_take(key, 10, 2, 0, 1000) &&
+                 !fio_rate_limit_take(key, 10, 2, 0, 1000) &&
+                 fio_rate_limit_take(key, 10, 2, 0, 1050),
+             "token bucket burst error");
+  FIO_ASSERT(!fio_rate_limit_take(key, 10, 2, 0, 1100) &&
+                 fio_rate_limit_take(key, 10, 2, 0, 1150) &&
+                 !fio_rate_limit_take(key, 10, 2, 0, 1200),
+             "token bucket refill error");
+  FIO_ASSERT(fio_rate_limit_take(key, 10, 2, 0, 1190),
+             "clock drift between workers shouldn't refill the bucket");
+  /* concurrent connection cap without a rate limit */
+  key = fio_rate_limit_key(3, addr);
+  FIO_ASSERT(!fio_rate_limit_take(key, 0, 0, 2, 0) &&
+                 !fio_rate_limit_take(key, 0, 0, 2, 0) &&
+                 fio_rate_limit_take(key, 0, 0, 2, 0),
+             "connection cap error");
+  fio_rate_limit_release(key);
+  FIO_ASSERT(!fio_rate_limit_take(key, 0, 0, 2, 0) &&
+                 fio_rate_limit_take(key, 0, 0, 2, 0),
+             "connection cap release error");
+  /* full groups recycle idle entries before entries with open connections */
+  const uintptr_t stride = (uintptr_t)FIO_RATE_LIMIT_GROUPS << 1;
+  uintptr_t keys[4] = {key + stride, key + (2 * stride), key + (3 * stride),
+                       key + (4 * stride)};
+  fio_rate_limit_take(keys[0], 1, 1, 0, 0);
+  fio_rate_limit_take(keys[1], 1, 1, 0, 10);
+  FIO_ASSERT(fio_rate_limit_take(keys[0], 1, 1, 0, 20) &&
+                 fio_rate_limit_take(keys[1], 1, 1, 0, 20),
+             "rate limited entries missing");
+  fio_rate_limit_take(keys[2], 1, 1, 0, 30);
+  FIO_ASSERT(fio_rate_limit_take(key, 0, 0, 2, 40) &&
+                 !fio_rate_limit_take(keys[0], 1, 1, 0, 40),
+             "the oldest idle entry should have been recycled");
+  fio_rate_limit_take(keys[3], 1, 1, 0, 40);
+  FIO_ASSERT(fio_rate_limit_take(key, 0, 0, 2, 40),
+             "entries with open connections should be kept");
+  fio_rate_limit_release(key);
+  fio_rate_limit_release(key);
+  FIO_ASSERT(!fio_rate_limit(4, (fio_str_info_s){.len = 0}, 1, 1) &&
+                 !fio_rate_limit(4, addr, 0, 0),
+             "unknown addresses and disabled limits should be allowed");
+  FIO_ASSERT(!fio_rate_limit(4, addr, 1, 1) && fio_rate_limit(4, addr, 1, 1),
+             "fio_rate_limit should limit the address");
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing the binary upgrade socket handoff
+***************************************************************************** */
+
+FIO_FUNC void fio_upgrade_test(void) {
+#if !FIO_DISABLE_HOT_RESTART
+  fprintf(stderr, "=== Testing binary upgrade socket handoff\n");
+  int sv[2], p[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv) && !pipe(p),
+             "couldn't create the test sockets / pipe");
+  fio_upgrade_record_s records[2] = {{.port = "3000"},
+                                     {.addr = "/tmp/sock", .port = ""}};
+  FIO_ASSERT(!fio_upgrade_send(sv[0], records, p, 2),
+             "couldn't send file descriptors (%s)", strerror(errno));
+  FIO_ASSERT(!fio_upgrade_receive(sv[1]) && fio_upgrade_inherited.count == 2,
+             "couldn't receive file descriptors");
+  FIO_ASSERT(!strcmp(fio_upgrade_inherited.records[0].port, "3000") &&
+                 !strcmp(fio_upgrade_inherited.records[1].addr, "/tmp/sock"),
+             "listening socket addresses weren't passed on");
+  /* the received descriptors reference the same pipe */
+  FIO_ASSERT(write(fio_upgrade_inherited.fds[1], "x", 1) == 1,
+             "received descriptor isn't writable");
+  char c = 0;
+  FIO_ASSERT(read(p[0], &c, 1) == 1 && c == 'x',
+             "received descriptor doesn't reference the sent pipe");
+  FIO_ASSERT(fio_upgrade_listener(NULL, 0, "300", 3) == -1 &&
+                 fio_upgrade_listener("x", 1, "3000", 4) == -1,
+             "inherited sockets should match the address and port");
+  intptr_t uuid = fio_upgrade_listener("/tmp/sock", 9, NULL, 0);
+  FIO_ASSERT(uuid != -1 && fio_upgrade_inherited.fds[1] == -1 &&
+                 fio_upgrade_listener("/tmp/sock", 9, NULL, 0) == -1,
+             "inherited sockets should be adopted once");
+  fio_force_close(uuid);
+  close(fio_upgrade_inherited.fds[0]);
+  fio_upgrade_inherited.count = 0;
+  /* reuse_port sockets aren't passed on */
+  fio_listen_protocol_s listeners[2] = {
+      {.uuid = fio_fd2uuid(p[0]), .port = "3000", .port_len = 4},
+      {.uuid = fio_fd2uuid(p[1]), .port = "3001", .port_len = 4,
+       .reuse_port = 1},
+  };
+  fio_ls_embd_push(&fio_listeners, &listeners[0].node);
+  fio_ls_embd_push(&fio_listeners, &listeners[1].node);
+  fio_upgrade_record_s collected[FIO_UPGRADE_MAX_LISTENERS] = {{.port = ""}};
+  int fds[FIO_UPGRADE_MAX_LISTENERS];
+  FIO_ASSERT(fio_upgrade_collect(collected, fds) == 1 && fds[0] == p[0] &&
+                 !strcmp(collected[0].port, "3000"),
+             "only listening sockets not using reuse_port should be passed");
+  fio_ls_embd_remove(&listeners[0].node);
+  fio_ls_embd_remove(&listeners[1].node);
+  close(p[0]);
+  close(p[1]);
+  close(sv[0]);
+  close(sv[1]);
+  fprintf(stderr, "* passed.\n");
+#endif
+}
+
+/* *****************************************************************************
+Testing CPU affinity (placement)
+***************************************************************************** */
+
+FIO_FUNC void fio_affinity_test(void) {
+#if FIO_AFFINITY
+  fprintf(stderr, "=== Testing CPU affinity placement\n");
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  for (size_t i = 0; i < 16; ++i)
+    CPU_SET(i, &mask);
+  CPU_CLR(9, &mask);
+  uint16_t cpus[CPU_SETSIZE];
+  size_t count = fio_affinity_parse("8-11,0\n", &mask, cpus, 0);
+  FIO_ASSERT(count == 4 && cpus[0] == 8 && cpus[1] == 10 && cpus[2] == 11 &&
+                 cpus[3] == 0,
+             "CPU list parsing error (%zu CPUs)", count);
+  count = fio_affinity_parse("0-3", &mask, cpus, count);
+  FIO_ASSERT(count == 7 && cpus[4] == 1 && cpus[6] == 3 &&
+                 !CPU_ISSET(2, &mask) && CPU_ISSET(4, &mask),
+             "CPUs should be listed once (%zu CPUs)", count);
+  uint16_t first, length, total = 0;
+  for (size_t i = 0; i < 3; ++i) {
+    fio_affinity_slice(8, 3, i, &first, &length);
+    FIO_ASSERT(first == total && (length == 2 || length == 3),
+               "worker %zu CPU slice error (%u, %u)", i, (unsigned)first,
+               (unsigned)length);
+    total += length;
+  }
+  FIO_ASSERT(total == 8, "CPU slices should cover all CPUs");
+  fio_affinity_slice(2, 5, 3, &first, &length);
+  FIO_ASSERT(first == 1 && length == 1,
+             "workers should share CPUs when there are more workers");
+  fprintf(stderr, "* passed.\n");
+#endif
+}
+/* *****************************************************************************
 Run all tests
 ***************************************************************************** */
 
@@ -10999,19 +18785,37 @@ void fio_test(void) {
   fio_llist_test();
   fio_ary_test();
   fio_set_test();
+  fio_set_simd_test();
   fio_defer_test();
+  fio_defer_stealing_test();
+  fio_defer_park_test();
   fio_timer_test();
   fio_poll_test();
   fio_socket_test();
   fio_uuid_link_test();
   fio_cycle_test();
+  fio_poll_shard_test();
+  fio_timeout_test();
+  fio_writev_test();
+  fio_watermarks_test();
+  fio_zerocopy_test();
+  fio_fd_data_test();
+  fio_affinity_test();
+  fio_upgrade_test();
+  fio_rate_limit_test();
+  fio_shm_cache_test();
+  fio_udp_test();
+  fio_metrics_test();
   fio_riskyhash_test();
+  fio_wyhash_test();
   fio_siphash_test();
   fio_sha1_test();
   fio_sha2_test();
   fio_base64_test();
   fio_test_random();
   fio_pubsub_test();
+  fio_cluster_batch_test();
+  fio_cluster_shm_test();
   (void)fio_sentinel_task;
   (void)deferred_on_shutdown;
   (void)fio_poll;
@@ -214,8 +214,10 @@ Version and helper macros
 #include <time.h>
 
 #include <fcntl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #if !defined(__GNUC__) && !defined(__clang__) && !defined(FIO_GNUC_BYPASS)
@@ -379,6 +381,105 @@ void *FIO_ALIGN_NEW fio_mmap(size_t size);
  */
 void fio_malloc_after_fork(void);
 
+/** The number of size classes reported by `fio_malloc_stats`. */
+#define FIO_MALLOC_STATS_CLASSES 24
+
+/** Allocation counters for a size class (see `fio_malloc_stats_s`). */
+typedef struct {
+  /** The size class limit: allocations of up to `size` bytes. */
+  size_t size;
+  /** The number of allocations performed. */
+  size_t allocations;
+  /**
+   * The number of objects freed (the block allocator doesn't track object
+   * sizes, so this is only tracked when compiled with `FIO_MEMORY_SLAB`).
+   */
+  size_t frees;
+} fio_malloc_class_stats_s;
+
+/** Memory allocator statistics, as returned by `fio_malloc_stats`. */
+typedef struct {
+  /** The size of a memory block (slices or slabs are allocated in blocks). */
+  size_t block_size;
+  /** The number of memory blocks mapped from the system. */
+  size_t blocks_reserved;
+  /** The number of memory blocks in use (not in the free block pool). */
+  size_t blocks_in_use;
+  /** Big allocations (`mmap`) currently in use. */
+  size_t big_count;
+  /** Bytes mapped for big allocations (`mmap`) currently in use. */
+  size_t big_bytes;
+  /** The number of per-CPU arenas (see `fio_malloc_arena_bytes`). */
+  size_t arena_count;
+  /** Total number of block (small) allocations performed. */
+  size_t allocations;
+  /** Total number of block (small) allocations freed. */
+  size_t frees;
+  /** The number of valid entries in the `classes` array. */
+  size_t class_count;
+  /** Counters per size class (powers of 2, starting at 16 bytes). */
+  fio_malloc_class_stats_s classes[FIO_MALLOC_STATS_CLASSES];
+} fio_malloc_stats_s;
+
+/**
+ * Returns the memory allocator's statistics.
+ *
+ * Counters are collected per thread (without atomic operations) and summed
+ * only when this function is called, so they might be slightly out of date.
+ *
+ * Returns all zeros when the allocator is bypassed (`FIO_FORCE_MALLOC`).
+ */
+fio_malloc_stats_s fio_malloc_stats(void);
+
+/**
+ * Returns the number of bytes sliced from an arena's current memory block
+ * (0 if `arena >= fio_malloc_stats().arena_count`).
+ */
+size_t fio_malloc_arena_bytes(size_t arena);
+
+/**
+ * A memory region is a bump allocator for objects sharing a single lifetime
+ * (i.e., an HTTP request's headers). See `fio_region_set`.
+ *
+ * Initialize with `FIO_REGION_INIT` (or zero out the memory).
+ */
+typedef struct {
+  /* the region's current memory block (blocks are linked). Don't access. */
+  void *block;
+} fio_region_s;
+
+/** Initializes a memory region object. */
+#define FIO_REGION_INIT                                                        \
+  { .block = NULL }
+
+/**
+ * Routes the calling thread's `fio_malloc` (and `fio_realloc`) calls to the
+ * memory region until `fio_region_set` is called again, returning the
+ * previously active region (or NULL).
+ *
+ * Set `region` to NULL to resume normal allocations.
+ *
+ * Region allocations are sliced (bumped) from the region's blocks and
+ * `fio_free` ignores them. Their memory is released all at once by
+ * `fio_region_reset`, regardless of any references the objects might have.
+ *
+ * Big allocations (see `fio_mmap`) are never sliced from a region.
+ */
+fio_region_s *fio_region_set(fio_region_s *region);
+
+/**
+ * Releases all of the memory sliced from the region in a single step.
+ *
+ * The memory must no longer be accessed (any pointer to it becomes invalid).
+ */
+void fio_region_reset(fio_region_s *region);
+
+/**
+ * Returns true if the memory was sliced from a memory region (and will be
+ * released by `fio_region_reset` rather than `fio_free`).
+ */
+int fio_region_owns(const void *mem);
+
 #undef FIO_ALIGN
 
 /* *****************************************************************************
@@ -578,6 +679,14 @@ struct fio_protocol_s {
   void (*on_close)(intptr_t uuid, fio_protocol_s *protocol);
   /** called when a connection's timeout was reached */
   void (*ping)(intptr_t uuid, fio_protocol_s *protocol);
+  /**
+   * Called when the outgoing data crosses the high watermark (`pressure` is 1)
+   * and when it drains below the low watermark (`pressure` is 0).
+   *
+   * See `fio_watermarks_set`. This callback is optional.
+   */
+  void (*on_backpressure)(intptr_t uuid, fio_protocol_s *protocol,
+                          uint8_t pressure);
   /** private metadata used by facil. */
   size_t rsv;
 };
@@ -698,6 +807,34 @@ struct fio_listen_args {
    *
    * This will be called separately for every process. */
   void (*on_finish)(intptr_t uuid, void *udata);
+  /**
+   * Set to TRUE so every worker process listens on its own `SO_REUSEPORT`
+   * socket, letting the kernel balance new connections between the workers
+   * (instead of waking all of them for every new connection).
+   *
+   * Set to 2 to also attach a (Linux) BPF program routing connections to the
+   * worker matching the CPU handling the connection, which is only useful when
+   * the worker processes are pinned one per CPU.
+   *
+   * Ignored for Unix sockets and on systems that don't balance `SO_REUSEPORT`
+   * sockets (Linux, DragonFly BSD and FreeBSD's `SO_REUSEPORT_LB` do).
+   */
+  uint8_t reuse_port;
+  /**
+   * The number of new connections per second accepted from each peer address
+   * (a token bucket, see `fio_rate_limit`). Defaults to 0 (no limit).
+   *
+   * Rejected connections are closed before `on_open` (or the TLS handshake)
+   * and counted by the `fio_rejected_connections_total` metric.
+   */
+  uint32_t connection_rate;
+  /** The connections burst allowed per address (see `connection_rate`). */
+  uint32_t connection_burst;
+  /**
+   * The maximal number of concurrent connections per peer address. Defaults to
+   * 0 (no limit).
+   */
+  uint32_t connections_per_address;
 };
 
 /**
@@ -798,6 +935,25 @@ int main() {
 */
 #define fio_listen(...) fio_listen((struct fio_listen_args){__VA_ARGS__})
 
+/* *****************************************************************************
+Rate Limiting
+***************************************************************************** */
+
+/**
+ * Takes a token from the token bucket of the `key` (i.e., a peer address, see
+ * `fio_peer_addr`) in the limits set identified by `id` (i.e., a settings
+ * object's address), refilled at `rate` tokens per second up to `burst` tokens
+ * (or `rate`, if `burst` is 0).
+ *
+ * Returns 0 if a token was available and -1 if the key is rate limited.
+ *
+ * The buckets live in a fixed size table, shared by the worker processes, that
+ * recycles idle entries when full (see `FIO_RATE_LIMIT_GROUPS`), so limits are
+ * approximate when under attack by many different addresses.
+ */
+int fio_rate_limit(uintptr_t id, fio_str_info_s key, uint32_t rate,
+                   uint32_t burst);
+
 /* *****************************************************************************
 Connecting to remote servers as a client
 ***************************************************************************** */
@@ -846,11 +1002,90 @@ See the `struct fio_connect_args` details for any possible named arguments.
 
 * `.on_fail` called if a connection failed to establish.
 
+Host names that aren't cached are resolved by a resolver thread, in which case
+the returned uuid is reserved and the connection is attempted once the address
+was resolved (`on_fail` is called if the resolution failed).
+
 (experimental: untested)
 */
 intptr_t fio_connect(struct fio_connect_args);
 #define fio_connect(...) fio_connect((struct fio_connect_args){__VA_ARGS__})
 
+/* *****************************************************************************
+UDP (datagram) sockets
+***************************************************************************** */
+
+/** A datagram's peer address, see `on_datagram` and `fio_send_to`. */
+typedef struct {
+  struct sockaddr_storage addr;
+  socklen_t len;
+} fio_udp_peer_s;
+
+/** Named arguments for the `fio_udp_listen` function. */
+struct fio_udp_args {
+  /** The UDP port to bind. Use "0" for a random port (i.e., for clients). */
+  const char *port;
+  /** The socket binding address. Defaults to the recommended NULL. */
+  const char *address;
+  /**
+   * Called for every datagram (the data and the peer are only valid during the
+   * callback). Use `fio_send_to` to answer the `peer`.
+   *
+   * Datagrams are received in batches (`recvmmsg` on Linux).
+   */
+  void (*on_datagram)(intptr_t uuid, void *data, size_t len,
+                      fio_udp_peer_s *peer, void *udata);
+  /** Called when the socket is closed, usable for cleanup. */
+  void (*on_close)(intptr_t uuid, void *udata);
+  /** Opaque user data. */
+  void *udata;
+  /**
+   * Set to TRUE to receive coalesced datagrams (Linux `UDP_GRO`), which are
+   * split before calling `on_datagram`. Uses 64Kb receive buffers.
+   */
+  uint8_t gro;
+  /**
+   * Set to TRUE so consecutive datagrams of the same size that are sent to the
+   * same peer are sent as a single buffer (Linux `UDP_SEGMENT`).
+   */
+  uint8_t gso;
+};
+
+/**
+ * Opens a UDP socket bound to the `port` (and `address`) and attaches it to the
+ * IO reactor.
+ *
+ * When called before `fio_start`, all the worker processes share the socket.
+ *
+ * Returns the socket's uuid or -1 (on error).
+ */
+intptr_t fio_udp_listen(struct fio_udp_args args);
+#define fio_udp_listen(...) fio_udp_listen((struct fio_udp_args){__VA_ARGS__})
+
+/**
+ * Resolves the `address` and `port` of a peer (i.e., a StatsD server).
+ *
+ * Uses a blocking DNS lookup (resolve before the server starts when possible).
+ *
+ * Returns 0 on success or -1 on error.
+ */
+int fio_udp_peer_set(fio_udp_peer_s *peer, const char *address,
+                     const char *port);
+
+/**
+ * Sends a datagram to `peer` using the UDP socket `uuid`.
+ *
+ * The data is copied to a send queue that is flushed (`sendmmsg` on Linux)
+ * once the current task (i.e., `on_datagram`) is done, so multiple datagrams
+ * share a single system call.
+ *
+ * Like all UDP traffic, datagrams are dropped if the socket's buffer is full.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+int fio_send_to(intptr_t uuid, const fio_udp_peer_s *peer, const void *data,
+                size_t len);
+
 /* *****************************************************************************
 URL address parsing
 ***************************************************************************** */
@@ -931,6 +1166,35 @@ struct fio_start_args {
   int16_t threads;
   /** The number of worker processes to run. See `threads`. */
   int16_t workers;
+  /**
+   * If true, every thread runs it's own reactor shard (epoll only).
+   *
+   * Connections are mapped to shards by their file descriptor (`fd % threads`)
+   * and their IO events are handled by the shard's thread, without passing
+   * through the shared task queue. Other tasks (`fio_defer`, timers) are still
+   * performed by all threads.
+   */
+  uint8_t sharded;
+  /**
+   * If true, worker threads keep the tasks they schedule in a local task ring
+   * and idle threads steal tasks from their peers (work stealing).
+   *
+   * This keeps a connection's data in one core's cache, at the price of
+   * relaxing the order of tasks scheduled by different threads. Defaults to
+   * the `FIO_DEFER_STEALING` compile time value (0).
+   */
+  uint8_t stealing;
+  /**
+   * If true, every worker process is pinned to it's own set of CPU cores and
+   * every worker thread is pinned to one of the worker's cores (Linux only).
+   *
+   * The CPUs allowed for the root process (i.e., `taskset`) are grouped by
+   * NUMA node and split between the workers, so each worker (and the memory
+   * it touches first, such as it's `fio_malloc` arenas and fd table pages)
+   * stays on one node when possible. A worker's `reuse_port` listening sockets
+   * set `SO_INCOMING_CPU` to the worker's first core.
+   */
+  uint8_t affinity;
 };
 
 /**
@@ -951,6 +1215,33 @@ void fio_start(struct fio_start_args args);
  */
 void fio_stop(void);
 
+/**
+ * Starts a graceful binary upgrade (a zero downtime restart, root process
+ * only).
+ *
+ * A new process is started using `execve(executable, argv)` and the listening
+ * sockets are passed to it (`SCM_RIGHTS`). The new process's `fio_listen`
+ * calls adopt the inherited socket with the same address and port instead of
+ * binding a new one, so pending connections wait in the same accept queue.
+ *
+ * Once the new process forked it's workers, this process is stopped as if
+ * SIGINT was received: it's workers stop accepting connections and drain the
+ * existing ones (`on_shutdown`). If the new process exits before taking over,
+ * an error is logged and this process keeps running.
+ *
+ * If `executable` is NULL, the program's original path is used (Linux only).
+ * If `argv` is NULL, the original arguments are used (Linux only, otherwise
+ * the executable's path is the only argument).
+ *
+ * A SIGUSR2 signal sent to the root process calls `fio_upgrade(NULL, NULL)`.
+ *
+ * Note: `reuse_port` sockets are owned by the workers and aren't passed on,
+ * so connections still queued in them when the old workers exit are reset.
+ *
+ * Returns 0 if the new process was started and -1 on error.
+ */
+int fio_upgrade(const char *executable, char *const argv[]);
+
 /**
  * Returns the number of expected threads / processes to be used by facil.io.
  *
@@ -1015,7 +1306,7 @@ struct timespec fio_last_tick(void);
 /**
  * Returns a C string detailing the IO engine selected during compilation.
  *
- * Valid values are "kqueue", "epoll" and "poll".
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
  */
 char const *fio_engine(void);
 
@@ -1055,6 +1346,43 @@ intptr_t fio_socket(const char *address, const char *port, uint8_t is_server);
  */
 intptr_t fio_accept(intptr_t srv_uuid);
 
+/** Accept path statistics, as returned by `fio_accept_stats`. */
+typedef struct {
+  /** Connections accepted by this process (using `fio_accept`). */
+  size_t accepted;
+  /** `accept` failures due to the open file limit (`EMFILE` / `ENFILE`). */
+  size_t emfile;
+  /**
+   * Listening socket wakeups that used up their whole accept budget (leaving
+   * connections in the queue). The budget adapts, doubling up to
+   * `FIO_LISTEN_ACCEPT_MAX` (or `FIO_LISTEN_ACCEPT_MAX_REUSEPORT`).
+   */
+  size_t budget_exhausted;
+  /** Connections waiting in the server socket's accept queue (Linux). */
+  size_t backlog;
+  /** The server socket's accept queue limit (Linux). */
+  size_t backlog_max;
+  /** System wide accept queue overflows (Linux `ListenOverflows`). */
+  size_t listen_overflows;
+  /** System wide dropped connection requests (Linux `ListenDrops`). */
+  size_t listen_drops;
+  /** System wide SYN cookies sent due to a full SYN queue (Linux). */
+  size_t syncookies_sent;
+} fio_accept_stats_s;
+
+/**
+ * Returns the accept path statistics for this process.
+ *
+ * If `srv_uuid` is a listening TCP/IP socket, `backlog` and `backlog_max`
+ * report its accept queue (`TCP_INFO`). Otherwise pass -1.
+ *
+ * The `listen_overflows`, `listen_drops` and `syncookies_sent` counters are
+ * read from `/proc/net/netstat` and are shared by the whole network namespace.
+ *
+ * Counters that aren't available on the platform are zero.
+ */
+fio_accept_stats_s fio_accept_stats(intptr_t srv_uuid);
+
 /**
  * Returns 1 if the uuid refers to a valid and open, socket.
  *
@@ -1169,6 +1497,22 @@ typedef struct {
    *  `.data.fd = fd` or `.data.buffer = (void*)fd;`
    */
   unsigned is_fd : 1;
+  /**
+   * If set, large memory buffers are sent using MSG_ZEROCOPY (Linux / epoll
+   * only, other systems ignore the flag).
+   *
+   * The `dealloc` callback will be delayed until the kernel reports it's done
+   * with the memory, which MUST NOT be changed until then.
+   */
+  unsigned zerocopy : 1;
+  /**
+   * If set, the socket isn't flushed immediately. Instead, a flush is
+   * scheduled (deferred), so packets written to the socket during the same
+   * reactor cycle are coalesced into a single write (`writev`).
+   *
+   * Useful when broadcasting to many connections.
+   */
+  unsigned coalesce : 1;
   /** for internal use */
   unsigned rsv : 1;
   /** for internal use */
@@ -1251,6 +1595,32 @@ inline FIO_FUNC ssize_t fio_sendfile(intptr_t uuid, intptr_t source_fd,
  */
 size_t fio_pending(intptr_t uuid);
 
+/**
+ * Returns the number of bytes that are waiting in the socket's queue and
+ * haven't been sent.
+ */
+size_t fio_pending_bytes(intptr_t uuid);
+
+/**
+ * Sets the connection's outgoing buffer watermarks (in bytes).
+ *
+ * When the pending data (see `fio_pending_bytes`) reaches `high`, the
+ * protocol's `on_backpressure` callback is called with `pressure == 1`. When
+ * the data drains to `low` (or below), `on_backpressure` is called with
+ * `pressure == 0`.
+ *
+ * If `suspend` is set, reading from the connection is suspended (see
+ * `fio_suspend`) when reaching the high watermark and resumed when draining to
+ * the low watermark.
+ *
+ * A `high` value of 0 disables the watermarks (the default). `low` is capped
+ * at `high`.
+ *
+ * Returns -1 on error (invalid `uuid`) and 0 on success.
+ */
+int fio_watermarks_set(intptr_t uuid, size_t high, size_t low,
+                       uint8_t suspend);
+
 /**
  * `fio_flush` attempts to write any remaining data in the internal buffer to
  * the underlying file descriptor and closes the underlying file descriptor once
@@ -1405,6 +1775,31 @@ typedef struct fio_rw_hook_s {
    * This callback is always called, even if `fio_rw_hook_set` fails.
    * */
   void (*cleanup)(void *udata);
+  /**
+   * When implemented, consecutive memory packets are written using a single
+   * gather call. Should behave like the system `writev` call.
+   *
+   * If NULL (i.e., TLS hooks that don't gather data), each packet is written
+   * separately using the `write` callback.
+   *
+   * Note: facil.io library functions MUST NEVER be called by any r/w hook, or a
+   * deadlock might occur.
+   */
+  ssize_t (*writev)(intptr_t uuid, void *udata, const struct iovec *iov,
+                    int iovcnt);
+  /**
+   * When implemented, file packets are written using this callback (i.e., when
+   * a TLS connection is offloaded to the kernel) rather than by reading the
+   * file into a user-space buffer and calling `write`.
+   *
+   * Should behave like the system `sendfile` call (without updating `offset`).
+   * Return -1 with `errno` set to ENOTSUP to fall back to the `write` callback.
+   *
+   * Note: facil.io library functions MUST NEVER be called by any r/w hook, or a
+   * deadlock might occur.
+   */
+  ssize_t (*sendfile)(intptr_t uuid, void *udata, int fd, off_t offset,
+                      size_t count);
 } fio_rw_hook_s;
 
 /** Sets a socket hook state (a pointer to the struct). */
@@ -1555,6 +1950,32 @@ int fio_defer(void (*task)(void *, void *), void *udata1, void *udata2);
 int fio_run_every(size_t milliseconds, size_t repetitions, void (*task)(void *),
                   void *arg, void (*on_finish)(void *));
 
+/** A timer handle, see `fio_run_every_timer` and `fio_timer_cancel`. */
+typedef struct fio_timer_s fio_timer_s;
+
+/**
+ * Creates a timer to run a task at the specified interval, returning a handle
+ * that can be used to cancel the timer (see `fio_timer_cancel`).
+ *
+ * Works the same as `fio_run_every`, except it returns NULL on error.
+ *
+ * The handle is valid until the timer's `on_finish` callback is called (when
+ * the timer was cancelled or it's repetitions were completed).
+ *
+ * Scheduling and cancelling timers are O(log n) operations.
+ */
+fio_timer_s *fio_run_every_timer(size_t milliseconds, size_t repetitions,
+                                 void (*task)(void *), void *arg,
+                                 void (*on_finish)(void *));
+
+/**
+ * Cancels a timer, calling it's `on_finish` callback (if any).
+ *
+ * If the timer's task is currently running, the timer will be cancelled once
+ * the task returns (it's safe to cancel a timer from within it's own task).
+ */
+void fio_timer_cancel(fio_timer_s *timer);
+
 /**
  * Performs all deferred tasks.
  */
@@ -1618,6 +2039,187 @@ void fio_state_callback_force(callback_type_e);
 /** Clears all the existing callbacks for the event. */
 void fio_state_callback_clear(callback_type_e);
 
+/* *****************************************************************************
+Runtime Metrics
+***************************************************************************** */
+
+#ifndef FIO_METRICS
+/**
+ * Set to 0 to disable the built-in metrics (the reactor, the task queue and
+ * the HTTP extension). The API remains available.
+ */
+#define FIO_METRICS 1
+#endif
+
+#ifndef FIO_METRICS_LIMIT
+/** The maximal number of registered metrics. */
+#define FIO_METRICS_LIMIT 64
+#endif
+
+#ifndef FIO_METRICS_HISTOGRAM_LIMIT
+/** The maximal number of registered histograms (included in the limit). */
+#define FIO_METRICS_HISTOGRAM_LIMIT 8
+#endif
+
+/** The value returned by `fio_metric_register` on error. */
+#define FIO_METRIC_INVALID ((size_t)-1)
+
+/** Metric types, see `fio_metric_register`. */
+enum {
+  /** A monotonic counter (see `fio_metric_add`). */
+  FIO_METRIC_COUNTER = 0,
+  /** A value that can go up and down (see `fio_metric_add`). */
+  FIO_METRIC_GAUGE = 1,
+  /** A distribution of values, i.e. latency (see `fio_metric_record`). */
+  FIO_METRIC_HISTOGRAM = 2,
+};
+
+/** Named arguments for `fio_metric_register`. */
+struct fio_metric_args_s {
+  /**
+   * The metric's name (a static string, it isn't copied).
+   *
+   * Counters and gauges may include Prometheus style labels, i.e.:
+   * `"http_responses_total{class=\"2xx\"}"`.
+   */
+  const char *name;
+  /** A short description (a static string, it isn't copied). */
+  const char *help;
+  /** One of the `FIO_METRIC_*` types. */
+  uint8_t type;
+  /** An optional function that reads a gauge's value (`fio_metric_add` is
+   * ignored for these gauges). */
+  int64_t (*read)(void);
+};
+
+/**
+ * Registers a metric, returning its identifier (or `FIO_METRIC_INVALID` when
+ * the registry is full).
+ *
+ * Metrics should be registered before `fio_start` (or at least before forking
+ * workers), so their identifiers are the same in all processes.
+ */
+size_t fio_metric_register(struct fio_metric_args_s args);
+#define fio_metric_register(...)                                               \
+  fio_metric_register((struct fio_metric_args_s){__VA_ARGS__})
+
+/**
+ * Adds `value` to a counter or a gauge (gauges accept negative values).
+ *
+ * This is a thread local update (no locks or atomic instructions).
+ */
+void fio_metric_add(size_t id, int64_t value);
+
+/**
+ * Records a value in a histogram (i.e., a duration in microseconds).
+ *
+ * Histograms use logarithmic buckets with 8 sub-buckets per power of 2, so
+ * reported percentiles are within 12.5% of the recorded value.
+ *
+ * This is a thread local update (no locks or atomic instructions).
+ */
+void fio_metric_record(size_t id, uint64_t value);
+
+/** A metric's collected data, see `fio_metrics_each`. */
+typedef struct {
+  const char *name;
+  const char *help;
+  uint8_t type;
+  /** A counter's or a gauge's value, or the number of recorded values. */
+  int64_t value;
+  /** Histograms: the sum of all the recorded values. */
+  uint64_t sum;
+  /** Histograms: the largest recorded value. */
+  uint64_t max;
+  /** Histograms: the 50th, 90th and 99th percentiles. */
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+} fio_metric_s;
+
+/**
+ * Collects the metrics (adding up all the threads) and calls `task` for each
+ * metric, in the order they were registered.
+ *
+ * Metrics are collected per process (workers report their own metrics). To
+ * push metrics (i.e., to StatsD), call this function using `fio_run_every`.
+ *
+ * The built-in metrics are:
+ *
+ * * `fio_reactor_cycles_total` - reactor cycles (polling the IO events).
+ * * `fio_reactor_events_total` - IO events handled by the reactor.
+ * * `fio_tasks_total` - deferred tasks performed.
+ * * `fio_task_queue_depth` - deferred tasks waiting in the global queue.
+ * * `fio_connections` - open sockets (including listening sockets).
+ * * `fio_read_bytes_total` - bytes read using `fio_read`.
+ * * `fio_written_bytes_total` - bytes written by `fio_flush`.
+ */
+void fio_metrics_each(void (*task)(fio_metric_s *metric, void *udata),
+                      void *udata);
+
+/* *****************************************************************************
+Shared Memory Cache (one copy for all the worker processes)
+***************************************************************************** */
+
+/**
+ * A fixed size key / value cache in a shared memory region, so all the worker
+ * processes share a single copy of the data (no IPC is required).
+ */
+typedef struct fio_shm_cache_s fio_shm_cache_s;
+
+/** Named arguments for `fio_shm_cache_new`. */
+struct fio_shm_cache_args_s {
+  /** The number of entries (rounded up to a power of 2). Defaults to 1024. */
+  size_t capacity;
+  /** The longest key + value (in bytes) an entry can hold. Defaults to 256. */
+  size_t entry_size;
+};
+
+/**
+ * Creates a shared memory cache.
+ *
+ * The cache MUST be created before the worker processes are forked (i.e.,
+ * before `fio_start` or during `FIO_CALL_PRE_START`), otherwise every process
+ * will have its own copy.
+ *
+ * Entries are grouped in sets of 4, each set protected by its own lock. When a
+ * set is full, an expired entry or the set's least recently used entry is
+ * evicted.
+ *
+ * Returns NULL on error.
+ */
+fio_shm_cache_s *fio_shm_cache_new(struct fio_shm_cache_args_s args);
+#define fio_shm_cache_new(...)                                                 \
+  fio_shm_cache_new((struct fio_shm_cache_args_s){__VA_ARGS__})
+
+/** Frees the cache (the memory is released once all processes freed it). */
+void fio_shm_cache_free(fio_shm_cache_s *cache);
+
+/**
+ * Sets the `value` of `key`, replacing any existing value.
+ *
+ * The entry expires after `ttl` seconds (0 == never).
+ *
+ * Returns 0 on success or -1 on error (i.e., the key and value are longer
+ * than the cache's `entry_size`).
+ */
+int fio_shm_cache_set(fio_shm_cache_s *cache, fio_str_info_s key,
+                      fio_str_info_s value, uint32_t ttl);
+
+/**
+ * Copies the value of `key` to `dest`, writing at most `capa - 1` bytes and a
+ * NUL byte.
+ *
+ * Returns the value's length, much like `snprintf`, so a return value that is
+ * `>= capa` indicates that the value was truncated. Returns -1 if the `key`
+ * is missing (or expired).
+ */
+ssize_t fio_shm_cache_get(fio_shm_cache_s *cache, fio_str_info_s key,
+                          char *dest, size_t capa);
+
+/** Removes `key` from the cache. Returns 0 on success or -1 if missing. */
+int fio_shm_cache_remove(fio_shm_cache_s *cache, fio_str_info_s key);
+
 /* *****************************************************************************
 Lower Level API - for special circumstances, use with care.
 ***************************************************************************** */
@@ -2371,6 +2973,10 @@ size_t fio_ltoa(char *dest, int64_t num, uint8_t base);
  * default to base 10. Prefixes aren't added (i.e., no "0x" or "0b" at the
  * beginning of the string).
  *
+ * Base 10 uses the shortest representation that converts back to the same
+ * value (i.e., "0.1" rather than "0.10000000000000001"), using an exponent
+ * only for very large or very small values (i.e., "1e+21").
+ *
  * Returns the number of bytes actually written (excluding the NUL
  * terminator).
  */
@@ -2428,7 +3034,20 @@ uint8_t __attribute__((weak)) fio_hash_secret_marker2;
 #define FIO_HASH_SECRET_SEED64_2 ((uintptr_t)&fio_hash_secret_marker2)
 #endif
 
-#if FIO_USE_RISKY_HASH
+/*
+ * A random, per-process, seed used by the `FIO_USE_WYHASH` hashing variant.
+ *
+ * It's initialized (using `fio_rand64`) by `fio.c` before any other code runs
+ * and is inherited by any forked worker processes.
+ */
+uint64_t __attribute__((weak)) fio_hash_secret_seed;
+
+#if FIO_USE_WYHASH
+#define FIO_HASH_FN(data, length, key1, key2)                                  \
+  fio_wyhash((data), (length),                                                 \
+             fio_hash_secret_seed ^ (uint64_t)(key1) ^                         \
+                 fio_lrot64((uint64_t)(key2), 31))
+#elif FIO_USE_RISKY_HASH
 #define FIO_HASH_FN(data, length, key1, key2)                                  \
   fio_risky_hash((data), (length),                                             \
                  ((uint64_t)(key1) >> 19) | ((uint64_t)(key2) << 27))
@@ -2437,6 +3056,12 @@ uint8_t __attribute__((weak)) fio_hash_secret_marker2;
   fio_siphash13((data), (length), (uint64_t)(key1), (uint64_t)(key2))
 #endif
 
+/** A DoS resistant, randomly keyed, hash (see `FIO_SET_HASH_FALLBACK`). */
+#define FIO_HASH_FALLBACK_FN(data, length)                                     \
+  fio_siphash13((data), (length),                                              \
+                fio_hash_secret_seed ^ (uint64_t)FIO_HASH_SECRET_SEED64_1,     \
+                (uint64_t)FIO_HASH_SECRET_SEED64_2)
+
 /* *****************************************************************************
 Risky Hash (always available, even if using only the fio.h header)
 ***************************************************************************** */
@@ -2544,6 +3169,113 @@ FIO_FUNC inline uint64_t fio_risky_hash(const void *data_, size_t len,
 #undef FIO_RISKY_PRIME_0
 #undef FIO_RISKY_PRIME_1
 
+/* *****************************************************************************
+wyhash (always available, even if using only the fio.h header)
+***************************************************************************** */
+
+/* wyhash secret primes */
+#define FIO_WYHASH_P0 0xA0761D6478BD642FULL
+#define FIO_WYHASH_P1 0xE7037ED1A0B428DBULL
+#define FIO_WYHASH_P2 0x8EBC6AF09C88C6E3ULL
+#define FIO_WYHASH_P3 0x589965CC75374CC3ULL
+
+/* multiplies two 64 bit words, folding the 128 bit result (xor) */
+FIO_FUNC inline uint64_t fio_wyhash_mix(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+  const uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+  const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  const uint64_t t = rl + (rm0 << 32);
+  uint64_t lo = t + (rm1 << 32);
+  const uint64_t hi =
+      rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+  return lo ^ hi;
+#endif
+}
+
+/* reads a little endian 64 bit word */
+FIO_FUNC inline uint64_t fio_wyhash_r8(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+#if __BIG_ENDIAN__
+  v = fio_bswap64(v);
+#endif
+  return v;
+}
+
+/* reads a little endian 32 bit word */
+FIO_FUNC inline uint64_t fio_wyhash_r4(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+#if __BIG_ENDIAN__
+  v = fio_bswap32(v);
+#endif
+  return v;
+}
+
+/**
+ * Computes a wyhash (v.3) based hash value.
+ *
+ * wyhash is significantly faster than SipHash, especially for short keys (such
+ * as header names and pub/sub channels), at the price of weaker guarantees.
+ *
+ * Use a random seed (see `fio_hash_secret_seed`) when hashing data from
+ * unknown (possibly malicious) sources and pair it with collision attack
+ * protection (see `FIO_SET_HASH_FALLBACK`).
+ */
+FIO_FUNC inline uint64_t fio_wyhash(const void *data_, size_t len,
+                                    uint64_t seed) {
+  const uint8_t *data = (const uint8_t *)data_;
+  uint64_t a, b;
+  seed ^= FIO_WYHASH_P0;
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (fio_wyhash_r4(data) << 32) | fio_wyhash_r4(data + ((len >> 3) << 2));
+      b = (fio_wyhash_r4(data + len - 4) << 32) |
+          fio_wyhash_r4(data + len - 4 - ((len >> 3) << 2));
+    } else if (len) {
+      a = ((uint64_t)data[0] << 16) | ((uint64_t)data[len >> 1] << 8) |
+          data[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t seed1 = seed, seed2 = seed;
+      do {
+        seed = fio_wyhash_mix(fio_wyhash_r8(data) ^ FIO_WYHASH_P1,
+                              fio_wyhash_r8(data + 8) ^ seed);
+        seed1 = fio_wyhash_mix(fio_wyhash_r8(data + 16) ^ FIO_WYHASH_P2,
+                               fio_wyhash_r8(data + 24) ^ seed1);
+        seed2 = fio_wyhash_mix(fio_wyhash_r8(data + 32) ^ FIO_WYHASH_P3,
+                               fio_wyhash_r8(data + 40) ^ seed2);
+        data += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (i > 16) {
+      seed = fio_wyhash_mix(fio_wyhash_r8(data) ^ FIO_WYHASH_P1,
+                            fio_wyhash_r8(data + 8) ^ seed);
+      i -= 16;
+      data += 16;
+    }
+    a = fio_wyhash_r8(data + i - 16);
+    b = fio_wyhash_r8(data + i - 8);
+  }
+  return fio_wyhash_mix(FIO_WYHASH_P1 ^ len,
+                        fio_wyhash_mix(a ^ FIO_WYHASH_P1, b ^ seed));
+}
+
+#undef FIO_WYHASH_P0
+#undef FIO_WYHASH_P1
+#undef FIO_WYHASH_P2
+#undef FIO_WYHASH_P3
+
 /* *****************************************************************************
 SipHash
 ***************************************************************************** */
@@ -5485,6 +6217,12 @@ Done
  *
  * Note: Before freeing the Set, FIO_SET_OBJ_DESTROY will be automatically
  *       called for every existing object.
+ *
+ * Note: when using a fast (non cryptographic) hash, define
+ *       FIO_SET_HASH_FALLBACK(key) to compute a secure (i.e., SipHash) hash
+ *       value for a key (for Sets, the object). Once a Set is under attack,
+ *       it will re-hash all its objects using the fallback and ignore any
+ *       hash value arguments.
  */
 
 /* Used for naming functions and types, prefixing FIO_SET_NAME to the name */
@@ -5570,11 +6308,67 @@ Done
 #define FIO_SET_MAX_MAP_FULL_COLLISIONS (96)
 #endif
 
+/*
+ * FIO_SET_HASH_FALLBACK(key) - if defined, replaces the hash values once too
+ * many full collisions are detected (see note above). Undefined by default.
+ */
+
 /* Prime numbers are better */
 #ifndef FIO_SET_CUCKOO_STEPS
 #define FIO_SET_CUCKOO_STEPS 11
 #endif
 
+/*
+ * If true, the map keeps a 1 byte tag per bin and seeks 16 bins at a time
+ * (SwissTable style), comparing the tags using SSE2 / NEON where available.
+ *
+ * This costs an extra byte per bin, but lookups rarely touch a bin with a
+ * different hash and the map can be filled further before it grows.
+ */
+#ifndef FIO_SET_SIMD_PROBE
+#define FIO_SET_SIMD_PROBE 0
+#endif
+
+/* The maximum number of 16 bin groups to seek (when FIO_SET_SIMD_PROBE) */
+#ifndef FIO_SET_SIMD_PROBE_GROUPS
+#define FIO_SET_SIMD_PROBE_GROUPS 8
+#endif
+
+#if FIO_SET_SIMD_PROBE && !defined(H_FIO_SET_SIMD_PROBE)
+#define H_FIO_SET_SIMD_PROBE
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* A bin's tag: 7 bits of the (mixed) hash, the top bit marks a used bin. */
+#define FIO_SET_SIMD_TAG(hash)                                                 \
+  ((uint8_t)((((uint64_t)(hash)) * 0x9E3779B97F4A7C15ULL) >> 57) | 0x80)
+
+/** Returns a bitmap of the 16 `tags` that are equal to `tag`. */
+FIO_FUNC inline uint32_t fio_set_simd_match16(const uint8_t *tags,
+                                              uint8_t tag) {
+#if defined(__SSE2__)
+  const __m128i t = _mm_loadu_si128((const __m128i *)tags);
+  return (uint32_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(t, _mm_set1_epi8((char)tag)));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                   1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t m = vandq_u8(vceqq_u8(vld1q_u8(tags), vdupq_n_u8(tag)),
+                                vld1q_u8(bits));
+  return (uint32_t)vaddv_u8(vget_low_u8(m)) |
+         ((uint32_t)vaddv_u8(vget_high_u8(m)) << 8);
+#else
+  uint32_t r = 0;
+  for (size_t i = 0; i < 16; ++i)
+    r |= (uint32_t)(tags[i] == tag) << i;
+  return r;
+#endif
+}
+#endif
+
 #ifdef FIO_SET_KEY_TYPE
 typedef struct {
   FIO_SET_KEY_TYPE key;
@@ -5813,9 +6607,13 @@ struct FIO_NAME(s) {
   uintptr_t pos;
   FIO_NAME(_ordered_s_) * ordered;
   FIO_NAME(_map_s_) * map;
+#if FIO_SET_SIMD_PROBE
+  uint8_t *tags; /* a tag per map bin, 0 == empty */
+#endif
   uint8_t has_collisions;
   uint8_t used_bits;
   uint8_t under_attack;
+  uint8_t hash_fallback; /* FIO_SET_HASH_FALLBACK replaced the hash values */
 };
 
 #undef FIO_SET_FOR_LOOP
@@ -5827,6 +6625,19 @@ struct FIO_NAME(s) {
 Set / Hash Map Internal Helpers
 ***************************************************************************** */
 
+/** Updates a map bin's tag after the bin's hash was set (FIO_SET_SIMD_PROBE) */
+FIO_FUNC inline void FIO_NAME(_tag_update_)(FIO_NAME(s) * set,
+                                            FIO_NAME(_map_s_) * mp) {
+#if FIO_SET_SIMD_PROBE
+  set->tags[mp - set->map] =
+      FIO_SET_HASH_COMPARE(mp->hash, FIO_SET_HASH_INVALID)
+          ? 0
+          : FIO_SET_SIMD_TAG(FIO_SET_HASH2UINTPTR(mp->hash, 0));
+#endif
+  (void)set;
+  (void)mp;
+}
+
 /** Locates an object's map position in the Set, if it exists. */
 FIO_FUNC inline FIO_NAME(_map_s_) *
     FIO_NAME(_find_map_pos_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
@@ -5850,6 +6661,48 @@ FIO_FUNC inline FIO_NAME(_map_s_) *
     const uintptr_t hash_value_i = FIO_SET_HASH2UINTPTR(hash_value, 0);
     uintptr_t hash_alt = FIO_SET_HASH2UINTPTR(hash_value, set->used_bits);
 
+#if FIO_SET_SIMD_PROBE
+    if (set->capa >= 16) {
+      /* seek 16 bin groups, using triangular steps (visits every group) */
+      const uint8_t tag = FIO_SET_SIMD_TAG(hash_value_i);
+      const uintptr_t group_mask = mask >> 4;
+      const uintptr_t limit = (group_mask < FIO_SET_SIMD_PROBE_GROUPS)
+                                  ? (group_mask + 1)
+                                  : FIO_SET_SIMD_PROBE_GROUPS;
+      uintptr_t group = (hash_alt & mask) >> 4;
+      for (i = 0; i < limit; ++i) {
+        group = (group + i) & group_mask;
+        FIO_NAME(_map_s_) *const base = set->map + (group << 4);
+        const uint8_t *const tags = set->tags + (group << 4);
+        uint32_t match = fio_set_simd_match16(tags, tag);
+        while (match) {
+          pos = base + __builtin_ctz(match);
+          match &= match - 1;
+          if (!FIO_SET_HASH_COMPARE(pos->hash, hash_value_i))
+            continue;
+          if (!pos->pos || FIO_SET_COMPARE(pos->pos->obj, obj))
+            return pos;
+          /* full hash value collision detected */
+          set->has_collisions = 1;
+          if (++full_collisions_counter >= FIO_SET_MAX_MAP_FULL_COLLISIONS) {
+            /* is the hash under attack? */
+            FIO_LOG_WARNING(
+                "(fio hash map) too many full collisions - under attack?");
+            set->under_attack = 1;
+          }
+          if (set->under_attack) {
+            return pos;
+          }
+        }
+        /* an empty bin ends the search (objects never skip an empty bin) */
+        match = fio_set_simd_match16(tags, 0);
+        if (match)
+          return base + __builtin_ctz(match);
+      }
+      return NULL;
+    }
+#endif
+
     /* O(1) access to object */
     pos = set->map + (hash_alt & mask);
     if (FIO_SET_HASH_COMPARE(FIO_SET_HASH_INVALID, pos->hash))
@@ -5895,6 +6748,48 @@ FIO_FUNC inline FIO_NAME(_map_s_) *
 }
 #undef FIO_SET_CUCKOO_STEPS
 
+#ifdef FIO_SET_HASH_FALLBACK
+/** Computes an object's (valid) fallback hash value. */
+FIO_FUNC inline FIO_SET_HASH_TYPE FIO_NAME(_hash_fallback_)(FIO_SET_TYPE obj) {
+#ifdef FIO_SET_KEY_TYPE
+  FIO_SET_HASH_TYPE hash_value = FIO_SET_HASH_FALLBACK(obj.key);
+#else
+  FIO_SET_HASH_TYPE hash_value = FIO_SET_HASH_FALLBACK(obj);
+#endif
+  if (FIO_SET_HASH_COMPARE(hash_value, FIO_SET_HASH_INVALID))
+    hash_value = FIO_SET_HASH_FORCE;
+  return hash_value;
+}
+#endif
+
+/**
+ * Locates an object's map position, updating the hash value if the Set
+ * re-hashed its objects using FIO_SET_HASH_FALLBACK (as a result of an attack).
+ */
+FIO_FUNC inline FIO_NAME(_map_s_) *
+    FIO_NAME(_seek_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE *hash_value,
+                     FIO_SET_TYPE obj) {
+#ifdef FIO_SET_HASH_FALLBACK
+  if (set->hash_fallback)
+    *hash_value = FIO_NAME(_hash_fallback_)(obj);
+  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, *hash_value, obj);
+  if (!set->under_attack || set->hash_fallback)
+    return pos;
+  /* re-hash every object using the fallback hash function */
+  FIO_LOG_WARNING("(fio hash map) switching to the fallback hash function.");
+  FIO_NAME(_ordered_s_) *const end = set->ordered + set->pos;
+  for (FIO_NAME(_ordered_s_) *i = set->ordered; i < end; ++i) {
+    if (!FIO_SET_HASH_COMPARE(i->hash, FIO_SET_HASH_INVALID))
+      i->hash = FIO_NAME(_hash_fallback_)(i->obj);
+  }
+  set->hash_fallback = 1;
+  set->under_attack = 0;
+  FIO_NAME(rehash)(set);
+  *hash_value = FIO_NAME(_hash_fallback_)(obj);
+#endif
+  return FIO_NAME(_find_map_pos_)(set, *hash_value, obj);
+}
+
 /** Removes "holes" from the Set's internal Array - MUST re-hash afterwards.
  */
 FIO_FUNC inline void FIO_NAME(_compact_ordered_array_)(FIO_NAME(s) * set) {
@@ -5919,6 +6814,14 @@ FIO_FUNC inline void FIO_NAME(_reallocate_set_mem_)(FIO_NAME(s) * set) {
   const uintptr_t new_capa = 1ULL << set->used_bits;
   FIO_SET_FREE(set->map, set->capa * sizeof(*set->map));
   set->map = (FIO_NAME(_map_s_) *)FIO_SET_CALLOC(sizeof(*set->map), new_capa);
+#if FIO_SET_SIMD_PROBE
+  FIO_SET_FREE(set->tags, set->capa);
+  set->tags = (uint8_t *)FIO_SET_CALLOC(1, new_capa);
+  if (!set->tags) {
+    perror("FATAL ERROR: couldn't allocate memory for Set data");
+    exit(errno);
+  }
+#endif
   set->ordered = (FIO_NAME(_ordered_s_) *)FIO_SET_REALLOC(
       set->ordered, (set->capa * sizeof(*set->ordered)),
       (new_capa * sizeof(*set->ordered)), (set->pos * sizeof(*set->ordered)));
@@ -5953,7 +6856,7 @@ FIO_NAME(_insert_or_overwrite_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
   }
 
   /* locate future position */
-  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
+  FIO_NAME(_map_s_) *pos = FIO_NAME(_seek_)(set, &hash_value, obj);
 
   if (!pos) {
     /* inserting a new object, with too many holes in the map */
@@ -5994,6 +6897,7 @@ FIO_NAME(_insert_or_overwrite_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
   }
   /* store object at position */
   pos->hash = hash_value;
+  FIO_NAME(_tag_update_)(set, pos);
   pos->pos->hash = hash_value;
   FIO_SET_COPY(pos->pos->obj, obj);
 
@@ -6018,6 +6922,9 @@ FIO_FUNC void FIO_NAME_FREE()(FIO_NAME(s) * s) {
   /* free ordered array and hash mapping */
   FIO_SET_FREE(s->map, s->capa * sizeof(*s->map));
   FIO_SET_FREE(s->ordered, s->capa * sizeof(*s->ordered));
+#if FIO_SET_SIMD_PROBE
+  FIO_SET_FREE(s->tags, s->capa);
+#endif
   *s = (FIO_NAME(s)){.map = NULL};
 }
 
@@ -6033,8 +6940,9 @@ FIO_FUNC void FIO_NAME_FREE()(FIO_NAME(s) * s) {
 FIO_FUNC FIO_SET_OBJ_TYPE FIO_NAME(find)(FIO_NAME(s) * set,
                                          const FIO_SET_HASH_TYPE hash_value,
                                          FIO_SET_KEY_TYPE key) {
+  FIO_SET_HASH_TYPE hash = hash_value;
   FIO_NAME(_map_s_) *pos =
-      FIO_NAME(_find_map_pos_)(set, hash_value, (FIO_SET_TYPE){.key = key});
+      FIO_NAME(_seek_)(set, &hash, (FIO_SET_TYPE){.key = key});
   if (!pos || !pos->pos) {
     FIO_SET_OBJ_TYPE empty;
     memset(&empty, 0, sizeof(empty));
@@ -6076,8 +6984,9 @@ FIO_FUNC inline int FIO_NAME(remove)(FIO_NAME(s) * set,
                                      const FIO_SET_HASH_TYPE hash_value,
                                      FIO_SET_KEY_TYPE key,
                                      FIO_SET_OBJ_TYPE *old) {
+  FIO_SET_HASH_TYPE hash = hash_value;
   FIO_NAME(_map_s_) *pos =
-      FIO_NAME(_find_map_pos_)(set, hash_value, (FIO_SET_TYPE){.key = key});
+      FIO_NAME(_seek_)(set, &hash, (FIO_SET_TYPE){.key = key});
   if (!pos || !pos->pos)
     return -1;
   if (old)
@@ -6088,6 +6997,7 @@ FIO_FUNC inline int FIO_NAME(remove)(FIO_NAME(s) * set,
   if (pos->pos == set->pos + set->ordered - 1) {
     /* removing last item inserted */
     pos->hash = FIO_SET_HASH_INVALID; /* no need for a "hole" */
+    FIO_NAME(_tag_update_)(set, pos);
     do {
       --set->pos;
     } while (set->pos && FIO_SET_HASH_COMPARE(set->ordered[set->pos - 1].hash,
@@ -6105,7 +7015,8 @@ FIO_FUNC inline int FIO_NAME(remove)(FIO_NAME(s) * set,
 FIO_FUNC FIO_SET_OBJ_TYPE FIO_NAME(find)(FIO_NAME(s) * set,
                                          const FIO_SET_HASH_TYPE hash_value,
                                          FIO_SET_OBJ_TYPE obj) {
-  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
+  FIO_SET_HASH_TYPE hash = hash_value;
+  FIO_NAME(_map_s_) *pos = FIO_NAME(_seek_)(set, &hash, obj);
   if (!pos || !pos->pos) {
     FIO_SET_OBJ_TYPE empty;
     memset(&empty, 0, sizeof(empty));
@@ -6150,7 +7061,8 @@ FIO_FUNC int FIO_NAME(remove)(FIO_NAME(s) * set,
                               FIO_SET_OBJ_TYPE obj, FIO_SET_OBJ_TYPE *old) {
   if (FIO_SET_HASH_COMPARE(hash_value, FIO_SET_HASH_INVALID))
     return -1;
-  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
+  FIO_SET_HASH_TYPE hash = hash_value;
+  FIO_NAME(_map_s_) *pos = FIO_NAME(_seek_)(set, &hash, obj);
   if (!pos || !pos->pos)
     return -1;
   if (old)
@@ -6161,6 +7073,7 @@ FIO_FUNC int FIO_NAME(remove)(FIO_NAME(s) * set,
   if (pos->pos == set->pos + set->ordered - 1) {
     /* removing last item inserted */
     pos->hash = FIO_SET_HASH_INVALID; /* no need for a "hole" */
+    FIO_NAME(_tag_update_)(set, pos);
     do {
       --set->pos;
     } while (set->pos && FIO_SET_HASH_COMPARE(set->ordered[set->pos - 1].hash,
@@ -6284,6 +7197,7 @@ restart:
       }
       mp->pos = pos;
       mp->hash = pos->hash;
+      FIO_NAME(_tag_update_)(set, mp);
     }
   }
 }
@@ -6306,6 +7220,9 @@ restart:
 #undef FIO_SET_DESTROY
 #undef FIO_SET_MAX_MAP_SEEK
 #undef FIO_SET_MAX_MAP_FULL_COLLISIONS
+#undef FIO_SET_HASH_FALLBACK
+#undef FIO_SET_SIMD_PROBE
+#undef FIO_SET_SIMD_PROBE_GROUPS
 #undef FIO_SET_REALLOC
 #undef FIO_SET_CALLOC
 #undef FIO_SET_FREE
@@ -46,6 +46,23 @@ JSON API
 #define JSON_MAX_DEPTH 32
 #endif
 
+#ifndef JSON_SIMD
+/**
+ * If true, buffers of `JSON_SIMD_MIN_LENGTH` bytes or more are parsed in two
+ * stages: a (vectorized) pass indexes the structural characters 64 bytes at a
+ * time and the callbacks are driven by the index, so white space and String
+ * data aren't inspected byte by byte (requires SSE2 or NEON).
+ *
+ * Data containing comments is parsed byte by byte from the first comment.
+ */
+#define JSON_SIMD 1
+#endif
+
+#ifndef JSON_SIMD_MIN_LENGTH
+/** Shorter buffers are parsed byte by byte (see `JSON_SIMD`). */
+#define JSON_SIMD_MIN_LENGTH 256
+#endif
+
 /** The JSON parser type. Memory must be initialized to 0 before first uses. */
 typedef struct {
   /** in dictionary flag. */
@@ -69,6 +86,19 @@ typedef struct {
 static size_t __attribute__((unused))
 fio_json_parse(json_parser_s *parser, const char *buffer, size_t length);
 
+/**
+ * Returns 1 if `buffer` contains a single valid JSON value (surrounded by
+ * optional white space). Otherwise returns 0.
+ *
+ * Validation is strict (RFC 8259): the parser's extensions (comments, hex
+ * numerals, NaN, missing commas, etc') are rejected and String data must be
+ * valid UTF-8. Nesting is limited to `JSON_MAX_DEPTH`, as when parsing.
+ *
+ * No callbacks are called and the data doesn't require a NUL byte.
+ */
+static int __attribute__((unused))
+fio_json_validate(const char *buffer, size_t length);
+
 /**
  * This function allows JSON formatted strings to be converted to native
  * strings.
@@ -118,7 +148,7 @@ Marks as object seperators any of the following:
 * == [0x09, 0x0A, 0x0D, 0x20, 0x2C]
 The rest belong to objects,
 */
-static const uint8_t JSON_SEPERATOR[] = {
+static const uint8_t JSON_SEPERATOR[256] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
     0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -137,7 +167,7 @@ Marks a numeral valid char (it's a permisive list):
 ['0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'e', 'E', '+', '-', 'x', 'b',
 '.']
 */
-static const uint8_t JSON_NUMERAL[] = {
+static const uint8_t JSON_NUMERAL[256] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 1, 0,
     1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0,
@@ -304,15 +334,156 @@ JSON Consumption (astract parsing)
 ***************************************************************************** */
 
 /**
- * Returns the number of bytes consumed. Stops as close as possible to the end
- * of the buffer or once an object parsing was completed.
+ * Consumes a single (non String) token at `*ppos`, invoking the callbacks.
+ *
+ * Returns 0 on success (updating `*ppos`), 1 if more data is required (the
+ * token ends at the end of the buffer) and -1 on error.
+ */
+static inline int fio_json_consume_token(json_parser_s *parser, uint8_t **ppos,
+                                         const uint8_t *limit) {
+  uint8_t *pos = *ppos;
+  switch (*pos) {
+  case '{':
+    if (parser->key) {
+#if DEBUG
+      fprintf(stderr, "ERROR: JSON key can't be a Hash.\n");
+#endif
+      return -1;
+    }
+    ++parser->depth;
+    if (parser->depth >= JSON_MAX_DEPTH)
+      return -1;
+    parser->dict = (parser->dict << 1) | 1;
+    ++pos;
+    if (fio_json_on_start_object(parser))
+      return -1;
+    break;
+  case '}':
+    if ((parser->dict & 1) == 0) {
+#if DEBUG
+      fprintf(stderr, "ERROR: JSON dictionary closure error.\n");
+#endif
+      return -1;
+    }
+    if (!parser->key) {
+#if DEBUG
+      fprintf(stderr, "ERROR: JSON dictionary closure missing key value.\n");
+      return -1;
+#endif
+      fio_json_on_null(parser); /* append NULL and recuperate from error. */
+    }
+    --parser->depth;
+    ++pos;
+    parser->dict = (parser->dict >> 1);
+    fio_json_on_end_object(parser);
+    break;
+  case '[':
+    if (parser->key) {
+#if DEBUG
+      fprintf(stderr, "ERROR: JSON key can't be an array.\n");
+#endif
+      return -1;
+    }
+    ++parser->depth;
+    if (parser->depth >= JSON_MAX_DEPTH)
+      return -1;
+    ++pos;
+    parser->dict = (parser->dict << 1);
+    if (fio_json_on_start_array(parser))
+      return -1;
+    break;
+  case ']':
+    if ((parser->dict & 1))
+      return -1;
+    --parser->depth;
+    ++pos;
+    parser->dict = (parser->dict >> 1);
+    fio_json_on_end_array(parser);
+    break;
+  case 't':
+    if (pos + 3 >= limit)
+      return 1;
+    if (pos[1] == 'r' && pos[2] == 'u' && pos[3] == 'e')
+      fio_json_on_true(parser);
+    else
+      return -1;
+    pos += 4;
+    break;
+  case 'N': /* overflow */
+  case 'n':
+    if (pos + 2 <= limit && (pos[1] | 32) == 'a' && (pos[2] | 32) == 'n')
+      goto numeral;
+    if (pos + 3 >= limit)
+      return 1;
+    if (pos[1] == 'u' && pos[2] == 'l' && pos[3] == 'l')
+      fio_json_on_null(parser);
+    else
+      return -1;
+    pos += 4;
+    break;
+  case 'f':
+    if (pos + 4 >= limit)
+      return 1;
+    if (pos + 4 < limit && pos[1] == 'a' && pos[2] == 'l' && pos[3] == 's' &&
+        pos[4] == 'e')
+      fio_json_on_false(parser);
+    else
+      return -1;
+    pos += 5;
+    break;
+  case '-': /* overflow */
+  case '0': /* overflow */
+  case '1': /* overflow */
+  case '2': /* overflow */
+  case '3': /* overflow */
+  case '4': /* overflow */
+  case '5': /* overflow */
+  case '6': /* overflow */
+  case '7': /* overflow */
+  case '8': /* overflow */
+  case '9': /* overflow */
+  case '.': /* overflow */
+  case 'e': /* overflow */
+  case 'E': /* overflow */
+  case 'x': /* overflow */
+  case 'i': /* overflow */
+  case 'I': /* overflow */
+  numeral : {
+    uint8_t *tmp = pos;
+    long long i = fio_atol((char **)&tmp);
+    if (tmp > limit)
+      return 1;
+    /* floats (i.e., NaN, -Infinity) might not be an integer's prefix */
+    if (!tmp || tmp == pos || JSON_NUMERAL[*tmp] ||
+        (tmp == pos + 1 && *pos == '-')) {
+      tmp = pos;
+      double f = fio_atof((char **)&tmp);
+      if (tmp > limit)
+        return 1;
+      if (!tmp || tmp == pos || JSON_NUMERAL[*tmp])
+        return -1;
+      fio_json_on_float(parser, f);
+      pos = tmp;
+    } else {
+      fio_json_on_number(parser, i);
+      pos = tmp;
+    }
+    break;
+  }
+  default:
+    return -1;
+  }
+  *ppos = pos;
+  return 0;
+}
+
+/**
+ * Parses the data byte by byte, starting at `pos`. Returns the number of bytes
+ * consumed (from `buffer`), or 0 on error.
  */
 static size_t __attribute__((unused))
-fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
-  if (!length || !buffer)
-    return 0;
-  uint8_t *pos = (uint8_t *)buffer;
-  const uint8_t *limit = pos + length;
+fio_json_parse_bytewise(json_parser_s *parser, const char *buffer, uint8_t *pos,
+                        const uint8_t *limit) {
   do {
     while (pos < limit && JSON_SEPERATOR[*pos])
       ++pos;
@@ -343,131 +514,6 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
       }
       break;
     }
-    case '{':
-      if (parser->key) {
-#if DEBUG
-        fprintf(stderr, "ERROR: JSON key can't be a Hash.\n");
-#endif
-        goto error;
-      }
-      ++parser->depth;
-      if (parser->depth >= JSON_MAX_DEPTH)
-        goto error;
-      parser->dict = (parser->dict << 1) | 1;
-      ++pos;
-      if (fio_json_on_start_object(parser))
-        goto error;
-      break;
-    case '}':
-      if ((parser->dict & 1) == 0) {
-#if DEBUG
-        fprintf(stderr, "ERROR: JSON dictionary closure error.\n");
-#endif
-        goto error;
-      }
-      if (!parser->key) {
-#if DEBUG
-        fprintf(stderr, "ERROR: JSON dictionary closure missing key value.\n");
-        goto error;
-#endif
-        fio_json_on_null(parser); /* append NULL and recuperate from error. */
-      }
-      --parser->depth;
-      ++pos;
-      parser->dict = (parser->dict >> 1);
-      fio_json_on_end_object(parser);
-      break;
-    case '[':
-      if (parser->key) {
-#if DEBUG
-        fprintf(stderr, "ERROR: JSON key can't be an array.\n");
-#endif
-        goto error;
-      }
-      ++parser->depth;
-      if (parser->depth >= JSON_MAX_DEPTH)
-        goto error;
-      ++pos;
-      parser->dict = (parser->dict << 1);
-      if (fio_json_on_start_array(parser))
-        goto error;
-      break;
-    case ']':
-      if ((parser->dict & 1))
-        goto error;
-      --parser->depth;
-      ++pos;
-      parser->dict = (parser->dict >> 1);
-      fio_json_on_end_array(parser);
-      break;
-    case 't':
-      if (pos + 3 >= limit)
-        goto stop;
-      if (pos[1] == 'r' && pos[2] == 'u' && pos[3] == 'e')
-        fio_json_on_true(parser);
-      else
-        goto error;
-      pos += 4;
-      break;
-    case 'N': /* overflow */
-    case 'n':
-      if (pos + 2 <= limit && (pos[1] | 32) == 'a' && (pos[2] | 32) == 'n')
-        goto numeral;
-      if (pos + 3 >= limit)
-        goto stop;
-      if (pos[1] == 'u' && pos[2] == 'l' && pos[3] == 'l')
-        fio_json_on_null(parser);
-      else
-        goto error;
-      pos += 4;
-      break;
-    case 'f':
-      if (pos + 4 >= limit)
-        goto stop;
-      if (pos + 4 < limit && pos[1] == 'a' && pos[2] == 'l' && pos[3] == 's' &&
-          pos[4] == 'e')
-        fio_json_on_false(parser);
-      else
-        goto error;
-      pos += 5;
-      break;
-    case '-': /* overflow */
-    case '0': /* overflow */
-    case '1': /* overflow */
-    case '2': /* overflow */
-    case '3': /* overflow */
-    case '4': /* overflow */
-    case '5': /* overflow */
-    case '6': /* overflow */
-    case '7': /* overflow */
-    case '8': /* overflow */
-    case '9': /* overflow */
-    case '.': /* overflow */
-    case 'e': /* overflow */
-    case 'E': /* overflow */
-    case 'x': /* overflow */
-    case 'i': /* overflow */
-    case 'I': /* overflow */
-    numeral : {
-      uint8_t *tmp = pos;
-      long long i = fio_atol((char **)&tmp);
-      if (tmp > limit)
-        goto stop;
-      if (!tmp || JSON_NUMERAL[*tmp]) {
-        tmp = pos;
-        double f = fio_atof((char **)&tmp);
-        if (tmp > limit)
-          goto stop;
-        if (!tmp || JSON_NUMERAL[*tmp])
-          goto error;
-        fio_json_on_float(parser, f);
-        pos = tmp;
-      } else {
-        fio_json_on_number(parser, i);
-        pos = tmp;
-      }
-      break;
-    }
     case '#': /* Ruby style comment */
     {
       uint8_t *tmp = memchr(pos, '\n', (uintptr_t)(limit - pos));
@@ -498,9 +544,15 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
       continue; /* skip tests */
       ;
     default:
-      goto error;
+      switch (fio_json_consume_token(parser, &pos, limit)) {
+      case 1:
+        goto stop;
+      case -1:
+        goto error;
+      }
     }
     if (parser->depth == 0) {
+      parser->key = 0; /* the parser might be reused for the next value */
       fio_json_on_json(parser);
       goto stop;
     }
@@ -513,6 +565,625 @@ error:
   return 0;
 }
 
+/* *****************************************************************************
+JSON Structural Index (the first stage of the two stage parser)
+
+Each 64 byte block is classified using SIMD instructions (when available) into
+bitmaps (bit `i` marks byte `i`). Escaped characters and String data are then
+computed using bit operations (no branches), so the index holds the position of
+every token in the block: an operator, a String's quotes or the first byte of
+any other value.
+***************************************************************************** */
+
+#if JSON_SIMD && defined(__SSE2__)
+#include <emmintrin.h>
+#define JSON_SIMD_SSE2 1
+#elif JSON_SIMD && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define JSON_SIMD_NEON 1
+#endif
+
+/* the index is filled (and consumed) in chunks of up to this many positions */
+#define JSON_INDEX_CAPA 1024
+
+/* character class bitmaps for a 64 byte block */
+typedef struct {
+  uint64_t quote;   /* '"' */
+  uint64_t escape;  /* '\\' */
+  uint64_t op;      /* '{', '}', '[', ']', ':' (and ',' when validating) */
+  uint64_t space;   /* JSON white space (and ',' when parsing) */
+  uint64_t comment; /* '#', '/' (when parsing) */
+  uint64_t ctrl;    /* control characters, < 0x20 (when validating) */
+  uint64_t high;    /* non-ASCII, >= 0x80 (when validating) */
+} fio_json_block_s;
+
+typedef struct {
+  const uint8_t *base;  /* the position of the first indexed block */
+  const uint8_t *pos;   /* the next block to be indexed */
+  const uint8_t *limit; /* end of data */
+  uint64_t in_string;   /* all bits set if the last block ended in a String */
+  uint64_t escaped;     /* 1 if the next block starts with an escaped byte */
+  uint64_t scalar;      /* 1 if the last block ended within a value */
+  uint32_t count;       /* the number of positions in the index */
+  uint32_t next;        /* the next position to be consumed */
+  uint8_t validate;     /* strict mode, different data is collected */
+  uint8_t fallback;     /* a comment was found, the index stops before it */
+  uint8_t invalid;      /* invalid String data was found (strict mode) */
+  uint8_t utf8;         /* UTF-8 continuation bytes in the next block */
+  uint32_t window;      /* the number of blocks the next refill may index */
+  uint32_t index[JSON_INDEX_CAPA]; /* offsets from `base` */
+} fio_json_index_s;
+
+#if JSON_SIMD_SSE2
+typedef __m128i fio_json_vec_t;
+#define JSON_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define JSON_EQ(v, c) _mm_cmpeq_epi8((v), _mm_set1_epi8((char)(c)))
+#define JSON_OR(a, b) _mm_or_si128((a), (b))
+#define JSON_OR20(v) _mm_or_si128((v), _mm_set1_epi8(0x20))
+#define JSON_CTRL(v) _mm_cmpeq_epi8(_mm_min_epu8((v), _mm_set1_epi8(0x1F)), (v))
+#define JSON_HIGH(v) (v)
+#define JSON_MASK(m) ((uint64_t)(uint16_t)_mm_movemask_epi8((m)))
+#elif JSON_SIMD_NEON
+typedef uint8x16_t fio_json_vec_t;
+#define JSON_LOAD(p) vld1q_u8((p))
+#define JSON_EQ(v, c) vceqq_u8((v), vdupq_n_u8((uint8_t)(c)))
+#define JSON_OR(a, b) vorrq_u8((a), (b))
+#define JSON_OR20(v) vorrq_u8((v), vdupq_n_u8(0x20))
+#define JSON_CTRL(v) vcltq_u8((v), vdupq_n_u8(0x20))
+#define JSON_HIGH(v) vcgeq_u8((v), vdupq_n_u8(0x80))
+#define JSON_MASK(m) fio_json_neon_mask((m))
+/* collects the most significant bit of each byte (like `_mm_movemask_epi8`) */
+static inline uint64_t fio_json_neon_mask(uint8x16_t m) {
+  static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                   1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t t = vandq_u8(m, vld1q_u8(bits));
+  return (uint64_t)vaddv_u8(vget_low_u8(t)) |
+         ((uint64_t)vaddv_u8(vget_high_u8(t)) << 8);
+}
+#endif
+
+#if JSON_SIMD_SSE2 || JSON_SIMD_NEON
+/* character class tests for 16 bytes */
+#define JSON_QUOTE(v) JSON_EQ((v), '"')
+#define JSON_ESCAPE(v) JSON_EQ((v), '\\')
+/* '[' and ']' only differ from '{' and '}' by the 0x20 bit */
+#define JSON_OP(v)                                                             \
+  JSON_OR(JSON_OR(JSON_EQ(JSON_OR20(v), '{'), JSON_EQ(JSON_OR20(v), '}')),     \
+          JSON_EQ((v), ':'))
+#define JSON_OP_COMMA(v) JSON_OR(JSON_OP(v), JSON_EQ((v), ','))
+#define JSON_SPACE(v)                                                          \
+  JSON_OR(JSON_OR(JSON_EQ((v), ' '), JSON_EQ((v), '\t')),                      \
+          JSON_OR(JSON_EQ((v), '\n'), JSON_EQ((v), '\r')))
+#define JSON_SPACE_COMMA(v) JSON_OR(JSON_SPACE(v), JSON_EQ((v), ','))
+#define JSON_COMMENT(v) JSON_OR(JSON_EQ((v), '#'), JSON_EQ((v), '/'))
+/* the 64 bit mask of a class test (for the 4 vectors in `v`) */
+#define JSON_MAP(test)                                                         \
+  (JSON_MASK(test(v[0])) | (JSON_MASK(test(v[1])) << 16) |                     \
+   (JSON_MASK(test(v[2])) << 32) | (JSON_MASK(test(v[3])) << 48))
+#else
+/* classifies the 64 bytes at `p`, one byte at a time */
+static inline void fio_json_classify(fio_json_block_s *b, const uint8_t *p,
+                                     const uint8_t validate) {
+  *b = (fio_json_block_s){.quote = 0};
+  for (size_t i = 0; i < 64; ++i) {
+    const uint64_t bit = (uint64_t)1 << i;
+    switch (p[i]) {
+    case '"':
+      b->quote |= bit;
+      break;
+    case '\\':
+      b->escape |= bit;
+      break;
+    case '{': /* overflow */
+    case '}': /* overflow */
+    case '[': /* overflow */
+    case ']': /* overflow */
+    case ':':
+      b->op |= bit;
+      break;
+    case ',':
+      if (validate)
+        b->op |= bit;
+      else
+        b->space |= bit;
+      break;
+    case '\t': /* overflow */
+    case '\n': /* overflow */
+    case '\r':
+      b->ctrl |= bit;
+      /* overflow */
+    case ' ':
+      b->space |= bit;
+      break;
+    case '#': /* overflow */
+    case '/':
+      b->comment |= bit;
+      break;
+    default:
+      if (p[i] < 0x20)
+        b->ctrl |= bit;
+      else if (p[i] >= 0x80)
+        b->high |= bit;
+    }
+  }
+}
+#endif
+
+static inline unsigned int fio_json_ctz64(uint64_t i) {
+#if defined(__GNUC__) || __has_builtin(__builtin_ctzll)
+  return (unsigned int)__builtin_ctzll(i);
+#else
+  unsigned int c = 0;
+  while (!(i & 1)) {
+    i >>= 1;
+    ++c;
+  }
+  return c;
+#endif
+}
+
+/* tests an escaped character (the one following a backslash) */
+static inline int fio_json_escape_valid(const uint8_t *pos,
+                                        const uint8_t *limit) {
+  if (pos >= limit)
+    return 0;
+  switch (*pos) {
+  case '"':  /* overflow */
+  case '\\': /* overflow */
+  case '/':  /* overflow */
+  case 'b':  /* overflow */
+  case 'f':  /* overflow */
+  case 'n':  /* overflow */
+  case 'r':  /* overflow */
+  case 't':
+    return 1;
+  case 'u':
+    return pos + 4 < limit && is_hex[pos[1]] && is_hex[pos[2]] &&
+           is_hex[pos[3]] && is_hex[pos[4]];
+  }
+  return 0;
+}
+
+/* returns the length of the UTF-8 sequence at `p`, or 0 if it's invalid */
+static inline size_t fio_json_utf8_len(const uint8_t *p, const uint8_t *limit) {
+  uint32_t u, min;
+  size_t n;
+  if ((*p & 0xE0) == 0xC0) {
+    n = 1, u = *p & 0x1F, min = 0x80;
+  } else if ((*p & 0xF0) == 0xE0) {
+    n = 2, u = *p & 0x0F, min = 0x800;
+  } else if ((*p & 0xF8) == 0xF0) {
+    n = 3, u = *p & 0x07, min = 0x10000;
+  } else
+    return 0;
+  if ((size_t)(limit - p) <= n)
+    return 0;
+  for (size_t i = 1; i <= n; ++i) {
+    if ((p[i] & 0xC0) != 0x80)
+      return 0;
+    u = (u << 6) | (p[i] & 0x3F);
+  }
+  /* no overlong forms, surrogates or values over 0x10FFFF */
+  if (u < min || u > 0x10FFFF || (u >= 0xD800 && u <= 0xDFFF))
+    return 0;
+  return n + 1;
+}
+
+/* validates the UTF-8 sequences starting in the block (`high` bytes only) */
+static inline void fio_json_index_utf8(fio_json_index_s *s, const uint8_t *p,
+                                       uint64_t high) {
+  /* skip the continuation bytes of a sequence started in the previous block */
+  high &= ~(((uint64_t)1 << s->utf8) - 1);
+  s->utf8 = 0;
+  while (high) {
+    const unsigned int i = fio_json_ctz64(high);
+    const size_t len = fio_json_utf8_len(p + i, s->limit);
+    if (!len) {
+      s->invalid = 1;
+      return;
+    }
+    if (i + len >= 64) {
+      s->utf8 = (uint8_t)(i + len - 64);
+      return;
+    }
+    high &= ~((((uint64_t)1 << len) - 1) << i);
+  }
+}
+
+/* indexes the block at `p` (`data` is either `p` or a padded copy) */
+static inline __attribute__((always_inline)) void
+fio_json_index_block(fio_json_index_s *s, const uint8_t *p,
+                     const uint8_t *data, const uint8_t validate) {
+  fio_json_block_s b;
+#if JSON_SIMD_SSE2 || JSON_SIMD_NEON
+  const fio_json_vec_t v[4] = {JSON_LOAD(data), JSON_LOAD(data + 16),
+                               JSON_LOAD(data + 32), JSON_LOAD(data + 48)};
+  b.quote = JSON_MAP(JSON_QUOTE);
+  b.escape = JSON_MAP(JSON_ESCAPE);
+  if (!(b.quote | b.escape | s->escaped) && s->in_string) {
+    /* the block is String data */
+    s->scalar = 0;
+    if (validate) {
+      const uint64_t high = JSON_MAP(JSON_HIGH);
+      s->invalid |= !!JSON_MAP(JSON_CTRL);
+      if (high | s->utf8)
+        fio_json_index_utf8(s, p, high);
+    }
+    return;
+  }
+  if (validate) {
+    b.op = JSON_MAP(JSON_OP_COMMA);
+    b.space = JSON_MAP(JSON_SPACE);
+    b.ctrl = JSON_MAP(JSON_CTRL);
+    b.high = JSON_MAP(JSON_HIGH);
+    b.comment = 0;
+  } else {
+    b.op = JSON_MAP(JSON_OP);
+    b.space = JSON_MAP(JSON_SPACE_COMMA); /* commas are white space */
+    b.comment = JSON_MAP(JSON_COMMENT);
+    b.ctrl = b.high = 0;
+  }
+#else
+  fio_json_classify(&b, data, validate);
+  if (!(b.quote | b.escape | s->escaped) && s->in_string) {
+    /* the block is String data */
+    s->scalar = 0;
+    if (validate) {
+      s->invalid |= !!b.ctrl;
+      if (b.high | s->utf8)
+        fio_json_index_utf8(s, p, b.high);
+    }
+    return;
+  }
+#endif
+  /* escaped bytes follow an odd sequence of backslashes */
+  uint64_t escaped = s->escaped;
+  s->escaped = 0;
+  if (b.escape) {
+    const uint64_t odd = 0xAAAAAAAAAAAAAAAAULL;
+    const uint64_t starts = b.escape & ~escaped;
+    const uint64_t codes = (((starts << 1) | odd) - starts) ^ odd;
+    escaped = codes ^ (b.escape | escaped);
+    s->escaped = (codes & b.escape) >> 63;
+  }
+  const uint64_t quote = b.quote & ~escaped;
+  /* a prefix XOR marks the opening quote and String data (until closed) */
+  uint64_t in = quote;
+  in ^= in << 1;
+  in ^= in << 2;
+  in ^= in << 4;
+  in ^= in << 8;
+  in ^= in << 16;
+  in ^= in << 32;
+  in ^= s->in_string;
+  s->in_string = (uint64_t)((int64_t)in >> 63);
+  const uint64_t str = in | quote;
+  /* anything else (outside of Strings) is part of a value */
+  const uint64_t scalar = ~(str | b.op | b.space);
+  uint64_t tokens =
+      (b.op & ~str) | quote | (scalar & ~((scalar << 1) | s->scalar));
+  s->scalar = scalar >> 63;
+  if (validate) {
+    s->invalid |= !!(b.ctrl & in);
+    if (b.high | s->utf8)
+      fio_json_index_utf8(s, p, b.high);
+    for (uint64_t e = escaped & in; e; e &= e - 1)
+      s->invalid |= !fio_json_escape_valid(p + fio_json_ctz64(e), s->limit);
+  } else if ((b.comment & scalar)) {
+    s->fallback = 1;
+    return;
+  }
+  const uint32_t offset = (uint32_t)(p - s->base);
+  for (; tokens; tokens &= tokens - 1)
+    s->index[s->count++] = offset + fio_json_ctz64(tokens);
+}
+
+#undef JSON_LOAD
+#undef JSON_EQ
+#undef JSON_OR
+#undef JSON_OR20
+#undef JSON_CTRL
+#undef JSON_HIGH
+#undef JSON_MASK
+#undef JSON_QUOTE
+#undef JSON_ESCAPE
+#undef JSON_OP
+#undef JSON_OP_COMMA
+#undef JSON_SPACE
+#undef JSON_SPACE_COMMA
+#undef JSON_COMMENT
+#undef JSON_MAP
+
+/* refills the index (inlined by the mode specific functions below) */
+static inline __attribute__((always_inline)) void
+fio_json_index_fill(fio_json_index_s *s, const uint8_t validate) {
+  s->count = s->next = 0;
+  s->base = s->pos;
+  /* offsets are 32 bits, long Strings could span many (empty) blocks */
+  const uint8_t *limit = s->limit;
+  if ((uintptr_t)(limit - s->base) > ((uintptr_t)1 << 31))
+    limit = s->base + ((uintptr_t)1 << 31);
+  /* the window grows, so small documents (i.e., NDJSON) aren't over-indexed */
+  for (uint32_t blocks = s->window;
+       blocks && (uintptr_t)(limit - s->pos) >= 64 && !s->fallback &&
+       s->count <= JSON_INDEX_CAPA - 64;
+       --blocks) {
+    fio_json_index_block(s, s->pos, s->pos, validate);
+    s->pos += 64;
+  }
+  s->window <<= (s->window < JSON_INDEX_CAPA);
+  if (s->pos < s->limit && (uintptr_t)(s->limit - s->pos) < 64 &&
+      limit == s->limit && !s->fallback && s->count <= JSON_INDEX_CAPA - 64) {
+    /* the last block is padded with white space */
+    uint8_t tail[64];
+    memset(tail, ' ', 64);
+    memcpy(tail, s->pos, (size_t)(s->limit - s->pos));
+    fio_json_index_block(s, s->pos, tail, validate);
+    s->pos = s->limit;
+  }
+}
+
+static void __attribute__((unused))
+fio_json_index_fill_parse(fio_json_index_s *s) {
+  fio_json_index_fill(s, 0);
+}
+
+static void __attribute__((unused))
+fio_json_index_fill_validate(fio_json_index_s *s) {
+  fio_json_index_fill(s, 1);
+}
+
+/* returns the next token, or NULL once the data (or index) was exhausted. */
+static inline uint8_t *fio_json_index_next(fio_json_index_s *s) {
+  while (s->next == s->count) {
+    if (s->pos >= s->limit || s->fallback)
+      return NULL;
+    if (s->validate)
+      fio_json_index_fill_validate(s);
+    else
+      fio_json_index_fill_parse(s);
+  }
+  return (uint8_t *)s->base + s->index[s->next++];
+}
+
+static inline void fio_json_index_init(fio_json_index_s *s, const char *buffer,
+                                       size_t length, uint8_t validate) {
+  s->base = s->pos = (const uint8_t *)buffer;
+  s->limit = s->pos + length;
+  s->in_string = s->escaped = s->scalar = 0;
+  s->count = s->next = 0;
+  s->validate = validate;
+  s->fallback = s->invalid = s->utf8 = 0;
+  s->window = 4;
+}
+
+/* *****************************************************************************
+JSON Two Stage Parsing (driving the callbacks from the structural index)
+***************************************************************************** */
+
+/* true if the byte can't be a part of a value (it ends the value) */
+static inline int fio_json_is_boundary(uint8_t c) {
+  return JSON_SEPERATOR[c] | (c == '"') | (c == ':') | ((c | 32) == '{') |
+         ((c | 32) == '}');
+}
+
+/**
+ * Parses the data using the structural index, behaving exactly as
+ * `fio_json_parse_bytewise` (which continues the parsing when required).
+ */
+static size_t __attribute__((unused))
+fio_json_parse_indexed(json_parser_s *parser, const char *buffer,
+                       size_t length) {
+  fio_json_index_s s;
+  fio_json_index_init(&s, buffer, length, 0);
+  const uint8_t *limit = s.limit;
+  uint8_t *pos = (uint8_t *)buffer; /* the end of the consumed data */
+  uint8_t *tok;
+  while ((tok = fio_json_index_next(&s))) {
+    if (tok < pos)
+      continue;
+    uint8_t value = 0; /* set for numbers, true, false, etc' */
+    if (*tok == '"') {
+      uint8_t *end = fio_json_index_next(&s);
+      if (!end)
+        goto incomplete;
+      if (parser->key) {
+        uint8_t *colon = fio_json_index_next(&s);
+        if (!colon)
+          goto incomplete;
+        if (*colon != ':')
+          goto error;
+        fio_json_on_string(parser, tok + 1, (uintptr_t)(end - (tok + 1)));
+        pos = colon + 1;
+        parser->key = 0;
+        continue; /* skip tests */
+      }
+      fio_json_on_string(parser, tok + 1, (uintptr_t)(end - (tok + 1)));
+      pos = end + 1;
+    } else {
+      pos = tok;
+      value = ((*tok | 32) != '{' && (*tok | 32) != '}');
+      switch (fio_json_consume_token(parser, &pos, limit)) {
+      case 1:
+        goto stop;
+      case -1:
+        goto error;
+      }
+    }
+    if (parser->depth == 0) {
+      parser->key = 0; /* the parser might be reused for the next value */
+      fio_json_on_json(parser);
+      goto stop;
+    }
+    parser->key = (parser->dict & 1);
+    /* unindexed values (i.e., `true1`) are left for the bytewise parser */
+    if (value && pos < limit && !fio_json_is_boundary(*pos))
+      goto bytewise;
+  }
+  if (s.fallback)
+    goto bytewise;
+  pos = (uint8_t *)limit; /* only white space remains */
+stop:
+  return (size_t)((uintptr_t)pos - (uintptr_t)buffer);
+incomplete:
+  /* the token's end wasn't indexed (end of data or a comment) */
+  pos = tok;
+  if (!s.fallback)
+    goto stop;
+bytewise:
+  return fio_json_parse_bytewise(parser, buffer, pos, limit);
+error:
+  fio_json_on_error(parser);
+  return 0;
+}
+
+/**
+ * Returns the number of bytes consumed. Stops as close as possible to the end
+ * of the buffer or once an object parsing was completed.
+ */
+static size_t __attribute__((unused))
+fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
+  if (!length || !buffer)
+    return 0;
+#if JSON_SIMD_SSE2 || JSON_SIMD_NEON
+  /* the scalar index is slower than byte by byte parsing */
+  if (length >= JSON_SIMD_MIN_LENGTH)
+    return fio_json_parse_indexed(parser, buffer, length);
+#endif
+  return fio_json_parse_bytewise(parser, buffer, (uint8_t *)buffer,
+                                 (uint8_t *)buffer + length);
+}
+
+/* *****************************************************************************
+JSON Validation
+***************************************************************************** */
+
+/* validates a number / true / false / null, which must end at a boundary */
+static inline int fio_json_validate_value(const uint8_t *p,
+                                          const uint8_t *limit) {
+#define JSON_DIGIT(c) ((uint8_t)((c) - '0') < 10)
+  switch (*p) {
+  case 't':
+    if (limit - p < 4 || memcmp(p, "true", 4))
+      return 0;
+    p += 4;
+    break;
+  case 'f':
+    if (limit - p < 5 || memcmp(p, "false", 5))
+      return 0;
+    p += 5;
+    break;
+  case 'n':
+    if (limit - p < 4 || memcmp(p, "null", 4))
+      return 0;
+    p += 4;
+    break;
+  default:
+    if (*p == '-')
+      ++p;
+    if (p >= limit || !JSON_DIGIT(*p))
+      return 0;
+    if (*p == '0')
+      ++p;
+    else
+      while (p < limit && JSON_DIGIT(*p))
+        ++p;
+    if (p < limit && *p == '.') {
+      ++p;
+      if (p >= limit || !JSON_DIGIT(*p))
+        return 0;
+      while (p < limit && JSON_DIGIT(*p))
+        ++p;
+    }
+    if (p < limit && (*p | 32) == 'e') {
+      ++p;
+      if (p < limit && (*p == '+' || *p == '-'))
+        ++p;
+      if (p >= limit || !JSON_DIGIT(*p))
+        return 0;
+      while (p < limit && JSON_DIGIT(*p))
+        ++p;
+    }
+  }
+#undef JSON_DIGIT
+  return p == limit || fio_json_is_boundary(*p);
+}
+
+static int __attribute__((unused))
+fio_json_validate(const char *buffer, size_t length) {
+  enum {
+    JSON_V_VALUE,          /* a value is expected */
+    JSON_V_VALUE_OR_CLOSE, /* the first value in an array (or `]`) */
+    JSON_V_KEY,            /* a key is expected */
+    JSON_V_KEY_OR_CLOSE,   /* the first key in an object (or `}`) */
+    JSON_V_COLON,          /* a colon is expected (following a key) */
+    JSON_V_NEXT,           /* a comma or a closure is expected */
+    JSON_V_DONE,           /* only white space is allowed */
+  } state = JSON_V_VALUE;
+  if (!buffer)
+    return 0;
+  fio_json_index_s s;
+  fio_json_index_init(&s, buffer, length, 1);
+  uint32_t dict = 0;
+  uint8_t depth = 0;
+  uint8_t *tok;
+  while ((tok = fio_json_index_next(&s))) {
+    switch (*tok) {
+    case '{': /* overflow */
+    case '[':
+      if (state != JSON_V_VALUE && state != JSON_V_VALUE_OR_CLOSE)
+        return 0;
+      if (++depth >= JSON_MAX_DEPTH)
+        return 0;
+      dict = (dict << 1) | (*tok == '{');
+      state = (*tok == '{') ? JSON_V_KEY_OR_CLOSE : JSON_V_VALUE_OR_CLOSE;
+      continue;
+    case '}':
+      if (!depth || !(dict & 1) ||
+          (state != JSON_V_NEXT && state != JSON_V_KEY_OR_CLOSE))
+        return 0;
+      --depth;
+      dict >>= 1;
+      break;
+    case ']':
+      if (!depth || (dict & 1) ||
+          (state != JSON_V_NEXT && state != JSON_V_VALUE_OR_CLOSE))
+        return 0;
+      --depth;
+      dict >>= 1;
+      break;
+    case ':':
+      if (state != JSON_V_COLON)
+        return 0;
+      state = JSON_V_VALUE;
+      continue;
+    case ',':
+      if (state != JSON_V_NEXT || !depth)
+        return 0;
+      state = (dict & 1) ? JSON_V_KEY : JSON_V_VALUE;
+      continue;
+    case '"':
+      if (!fio_json_index_next(&s)) /* the closing quote */
+        return 0;
+      if (state == JSON_V_KEY || state == JSON_V_KEY_OR_CLOSE) {
+        state = JSON_V_COLON;
+        continue;
+      }
+      if (state != JSON_V_VALUE && state != JSON_V_VALUE_OR_CLOSE)
+        return 0;
+      break;
+    default:
+      if (state != JSON_V_VALUE && state != JSON_V_VALUE_OR_CLOSE)
+        return 0;
+      if (!fio_json_validate_value(tok, s.limit))
+        return 0;
+    }
+    /* a value was completed */
+    state = depth ? JSON_V_NEXT : JSON_V_DONE;
+  }
+  return state == JSON_V_DONE && !s.in_string && !s.invalid;
+}
+
 /* *****************************************************************************
 JSON Unescape String
 ***************************************************************************** */
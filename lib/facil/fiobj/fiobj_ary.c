@@ -138,6 +138,7 @@ FIOBJ fiobj_ary_index(FIOBJ ary, int64_t pos) {
  */
 void fiobj_ary_set(FIOBJ ary, FIOBJ obj, int64_t pos) {
   assert(ary && FIOBJ_TYPE_IS(ary, FIOBJ_T_ARRAY));
+  fiobj___share_nested(ary, obj);
   FIOBJ old = FIOBJ_INVALID;
   fio_ary___set(&obj2ary(ary)->ary, pos, obj, &old);
   fiobj_free(old);
@@ -152,6 +153,7 @@ Array push / shift API
  */
 void fiobj_ary_push(FIOBJ ary, FIOBJ obj) {
   assert(ary && FIOBJ_TYPE_IS(ary, FIOBJ_T_ARRAY));
+  fiobj___share_nested(ary, obj);
   fio_ary___push(&obj2ary(ary)->ary, obj);
 }
 
@@ -169,6 +171,7 @@ FIOBJ fiobj_ary_pop(FIOBJ ary) {
  */
 void fiobj_ary_unshift(FIOBJ ary, FIOBJ obj) {
   assert(ary && FIOBJ_TYPE_IS(ary, FIOBJ_T_ARRAY));
+  fiobj___share_nested(ary, obj);
   fio_ary___unshift(&obj2ary(ary)->ary, obj);
 }
 
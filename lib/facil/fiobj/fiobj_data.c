@@ -25,10 +25,22 @@ License: MIT
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__) &&                                \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define FIOBJ_DATA_COPY_FILE_RANGE 1
+#else
+#define FIOBJ_DATA_COPY_FILE_RANGE 0
+#endif
+
 #include <fio.h>
 
 /* *****************************************************************************
@@ -46,7 +58,9 @@ typedef struct {
   size_t capa; /* total buffer capacity / slice offset */
   size_t len;  /* length of valid data in buffer */
   size_t pos;  /* position of reader */
-  int fd;      /* file descriptor (-1 if invalid). */
+  uint8_t *map;   /* a (read only) memory mapping of the file (or NULL) */
+  size_t map_len; /* the length of the memory mapped file */
+  int fd;         /* file descriptor (-1 if invalid). */
 } fiobj_data_s;
 
 #define obj2io(o) ((fiobj_data_s *)(o))
@@ -63,6 +77,97 @@ Object required VTable and functions
     }                                                                          \
   } while (0)
 
+/**
+ * Memory maps a file (once it's larger than `FIOBJ_DATA_MMAP_MIN`), updating
+ * the mapping when the file's `size` changed.
+ *
+ * Returns 1 if the file is mapped (and should be read in place) or 0 if the
+ * file should be read using `pread`.
+ */
+static inline int fiobj_data_map(FIOBJ o, int64_t size) {
+#if FIOBJ_DATA_MMAP_MIN
+  if (size == (int64_t)obj2io(o)->map_len)
+    return obj2io(o)->map != NULL;
+  /* the file grew or was truncated, pages beyond EOF must not be accessed */
+  if (obj2io(o)->map)
+    munmap(obj2io(o)->map, obj2io(o)->map_len);
+  obj2io(o)->map = NULL;
+  obj2io(o)->map_len = 0;
+  if (size < (int64_t)FIOBJ_DATA_MMAP_MIN)
+    return 0;
+  void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, obj2io(o)->fd, 0);
+  if (map == MAP_FAILED)
+    return 0; /* i.e., a write only file descriptor, fallback to `pread` */
+  obj2io(o)->map = map;
+  obj2io(o)->map_len = size;
+  /* the `pread` buffer is discarded, `source.fpos` is the reading position */
+  obj2io(o)->pos = 0;
+  obj2io(o)->len = 0;
+  return 1;
+#else
+  (void)o;
+  (void)size;
+  return 0;
+#endif
+}
+
+/**
+ * Copies `len` bytes from the `src` file, starting at `offset`, to the `target`
+ * file's current position (stops early on EOF). Returns -1 on error.
+ *
+ * Copies are performed by the kernel when possible (`copy_file_range` or
+ * `sendfile`).
+ */
+static int fiobj_data_copy_fd(int target, int src, off_t offset, size_t len) {
+#if FIOBJ_DATA_COPY_FILE_RANGE
+  while (len) {
+    ssize_t act = copy_file_range(src, &offset, target, NULL, len, 0);
+    if (act > 0) {
+      len -= act;
+      continue;
+    }
+    if (!act)
+      return 0; /* EOF */
+    if (errno == EINTR)
+      continue;
+    break; /* i.e., EXDEV (on older kernels) or ENOSYS, try `sendfile` */
+  }
+#endif
+#if defined(__linux__)
+  while (len) {
+    ssize_t act = sendfile(target, src, &offset, len);
+    if (act > 0) {
+      len -= act;
+      continue;
+    }
+    if (!act)
+      return 0; /* EOF */
+    if (errno == EINTR)
+      continue;
+    break; /* fallback to `pread` and `write` */
+  }
+#endif
+  char buf[4096];
+  while (len) {
+    ssize_t act = pread(src, buf, (len > 4096 ? 4096 : len), offset);
+    if (act < 0 && errno == EINTR)
+      continue;
+    if (act <= 0)
+      return (act ? -1 : 0);
+    for (ssize_t written = 0; written < act;) {
+      ssize_t act2 = write(target, buf + written, act - written);
+      if (act2 < 0 && errno == EINTR)
+        continue;
+      if (act2 <= 0)
+        return -1;
+      written += act2;
+    }
+    offset += act;
+    len -= act;
+  }
+  return 0;
+}
+
 static void fiobj_data_copy_buffer(FIOBJ o) {
   obj2io(o)->capa = (((obj2io(o)->len) >> 12) + 1) << 12;
   void *tmp = fio_malloc(obj2io(o)->capa);
@@ -93,27 +198,14 @@ static void fiobj_data_copy_parent(FIOBJ o) {
       perror("FATAL ERROR: (fiobj_data) can't create temporary file");
       exit(errno);
     }
-    fio_str_info_s data;
-    size_t pos = 0;
-    do {
-      ssize_t written;
-      data = fiobj_data_pread(obj2io(o)->source.parent, pos + obj2io(o)->capa,
-                              4096);
-      if (data.len + pos > obj2io(o)->len)
-        data.len = obj2io(o)->len - pos;
-    retry_int:
-      written = write(obj2io(o)->fd, data.data, data.len);
-      if (written < 0) {
-        if (errno == EINTR)
-          goto retry_int;
-        perror("FATAL ERROR: (fiobj_data) can't write to temporary file");
-        exit(errno);
-      }
-      pos += written;
-    } while (data.len == 4096);
+    if (fiobj_data_copy_fd(obj2io(o)->fd, obj2io(obj2io(o)->source.parent)->fd,
+                           obj2io(o)->capa, obj2io(o)->len)) {
+      perror("FATAL ERROR: (fiobj_data) can't write to temporary file");
+      exit(errno);
+    }
     fiobj_free(obj2io(o)->source.parent);
     obj2io(o)->capa = 0;
-    obj2io(o)->len = pos;
+    obj2io(o)->len = 0;
     obj2io(o)->source.fpos = obj2io(o)->pos;
     obj2io(o)->pos = 0;
     obj2io(o)->buffer = NULL;
@@ -173,6 +265,8 @@ static void fiobj_data_dealloc(FIOBJ o, void (*task)(FIOBJ, void *),
     fiobj_free(obj2io(o)->source.parent);
     break;
   default:
+    if (obj2io(o)->map)
+      munmap(obj2io(o)->map, obj2io(o)->map_len);
     close(obj2io(o)->fd);
     fio_free(obj2io(o)->buffer);
     break;
@@ -195,6 +289,13 @@ static intptr_t fiobj_data_i(const FIOBJ o) {
 
 static size_t fiobj_data_is_true(const FIOBJ o) { return fiobj_data_i(o) > 0; }
 
+static inline size_t fiobj_data_page_size(void) {
+  static size_t page_size;
+  if (!page_size)
+    page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
 static fio_str_info_s fio_io2str(const FIOBJ o) {
   switch (obj2io(o)->fd) {
   case -1:
@@ -210,6 +311,9 @@ static fio_str_info_s fio_io2str(const FIOBJ o) {
   if (i <= 0)
     return (fio_str_info_s){.data = (char *)obj2io(o)->buffer,
                             .len = obj2io(o)->len};
+  if (fiobj_data_map(o, i) && (i & (fiobj_data_page_size() - 1)))
+    /* the end of the last page is zero filled (the data is NUL terminated) */
+    return (fio_str_info_s){.data = (char *)obj2io(o)->map, .len = i};
   obj2io(o)->len = 0;
   obj2io(o)->pos = 0;
   fiobj_data_pre_write((FIOBJ)o, i + 1);
@@ -395,19 +499,26 @@ FIOBJ fiobj_data_slice(FIOBJ parent, intptr_t offset, uintptr_t length) {
 Saving the IO object
 ***************************************************************************** */
 
+static int fiobj_data_save_buffer(int target, uint8_t *buffer, size_t len) {
+  size_t total = 0;
+  while (total < len) {
+    ssize_t act = write(target, buffer + total, len - total);
+    if (act < 0 && errno == EINTR)
+      continue;
+    if (act <= 0)
+      return -1;
+    total += act;
+  }
+  return 0;
+}
+
 static int fiobj_data_save_str(FIOBJ o, const char *filename) {
   int target = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0777);
   if (target == -1)
     return -1;
   errno = 0;
-  size_t total = 0;
-  do {
-    ssize_t act =
-        write(target, obj2io(o)->buffer + total, obj2io(o)->len - total);
-    if (act < 0)
-      goto error;
-    total += act;
-  } while (total < obj2io(o)->len);
+  if (fiobj_data_save_buffer(target, obj2io(o)->buffer, obj2io(o)->len))
+    goto error;
   close(target);
   return 0;
 error:
@@ -421,19 +532,9 @@ static int fiobj_data_save_file(FIOBJ o, const char *filename) {
   if (target == -1)
     return -1;
   errno = 0;
-  char buf[1024];
-  size_t total = 0;
-  do {
-    ssize_t act = pread(obj2io(o)->fd, buf, 1024, total);
-    if (act == 0)
-      break;
-    if (act < 0)
-      goto error;
-    ssize_t act2 = write(target, buf, act);
-    if (act2 < act)
-      goto error;
-    total += act2;
-  } while (1);
+  int64_t size = fiobj_data_get_fd_size(o);
+  if (size < 0 || fiobj_data_copy_fd(target, obj2io(o)->fd, 0, size))
+    goto error;
   close(target);
   return 0;
 error:
@@ -447,22 +548,16 @@ static int fiobj_data_save_slice(FIOBJ o, const char *filename) {
   if (target == -1)
     return -1;
   errno = 0;
-  fio_str_info_s tmp;
-  size_t total = 0;
-  do {
-    tmp = fiobj_data_pread(obj2io(o)->source.parent, obj2io(o)->capa + total,
-                           4096);
-    if (tmp.len == 0)
-      break;
-    if (total + tmp.len > obj2io(o)->len)
-      tmp.len = obj2io(o)->len - total;
-    if (tmp.len) {
-      ssize_t act2 = write(target, tmp.data, tmp.len);
-      if (act2 < 0 || (size_t)act2 < tmp.len)
-        goto error;
-      total += act2;
-    }
-  } while (tmp.len == 4096);
+  /* slices of slices are never created, the parent is a String or a file */
+  FIOBJ parent = obj2io(o)->source.parent;
+  if (obj2io(parent)->fd == -1) {
+    if (fiobj_data_save_buffer(target, obj2io(parent)->buffer + obj2io(o)->capa,
+                               obj2io(o)->len))
+      goto error;
+  } else if (fiobj_data_copy_fd(target, obj2io(parent)->fd, obj2io(o)->capa,
+                                obj2io(o)->len)) {
+    goto error;
+  }
   close(target);
   return 0;
 error:
@@ -471,7 +566,7 @@ error:
   return -1;
 }
 
-/** Creates a new local file IO object */
+/** Saves the Data object to a file, returning -1 on error and 0 on success. */
 int fiobj_data_save(FIOBJ o, const char *filename) {
   switch (obj2io(o)->fd) {
   case -1:
@@ -555,6 +650,18 @@ static fio_str_info_s fiobj_data_read_file(FIOBJ io, intptr_t length) {
     return (fio_str_info_s){.data = NULL, .len = 0};
   }
 
+  if (fiobj_data_map(io, fsize)) {
+    /* memory mapped files are read in place */
+    const size_t fpos = obj2io(io)->source.fpos;
+    if (fpos >= fsize)
+      return (fio_str_info_s){.data = NULL, .len = 0};
+    if ((uintptr_t)length > fsize - fpos)
+      length = fsize - fpos;
+    obj2io(io)->source.fpos += length;
+    return (fio_str_info_s){.data = (char *)obj2io(io)->map + fpos,
+                            .len = (uintptr_t)length};
+  }
+
   /* reading length bytes */
   if (length + obj2io(io)->pos <= obj2io(io)->len) {
     /* the data already exists in the buffer */
@@ -660,6 +767,29 @@ static fio_str_info_s fiobj_data_read2ch_file(FIOBJ io, uint8_t token) {
     };
   }
 
+  if (obj2io(io)->map || fiobj_data_map(io, fiobj_data_get_fd_size(io))) {
+    /* memory mapped files are searched in place */
+    uint8_t *start = obj2io(io)->map + obj2io(io)->source.fpos;
+    lim = obj2io(io)->map + obj2io(io)->map_len;
+    pos = start;
+    if (start < lim && swallow_ch(&pos, lim, token))
+      goto mapped_found;
+    /* not found, test for new data (the file's size is tested only here) */
+    if (!fiobj_data_map(io, fiobj_data_get_fd_size(io)))
+      goto not_mapped;
+    start = obj2io(io)->map + obj2io(io)->source.fpos;
+    lim = obj2io(io)->map + obj2io(io)->map_len;
+    pos = start;
+    if (start >= lim)
+      return (fio_str_info_s){.data = NULL, .len = 0};
+    swallow_ch(&pos, lim, token);
+  mapped_found:
+    obj2io(io)->source.fpos += (uintptr_t)(pos - start);
+    return (fio_str_info_s){.data = (char *)start,
+                            .len = (uintptr_t)(pos - start)};
+  }
+not_mapped:;
+
   obj2io(io)->pos = 0;
   obj2io(io)->len = 0;
 
@@ -860,13 +990,22 @@ static fio_str_info_s fiobj_data_pread_slice(FIOBJ io, intptr_t start_at,
 
 static fio_str_info_s fiobj_data_pread_file(FIOBJ io, intptr_t start_at,
                                             uintptr_t length) {
-  const int64_t size = fiobj_data_get_fd_size(io);
+  int64_t size = fiobj_data_get_fd_size(io);
+  if (size < 0)
+    size = 0;
   if (start_at < 0)
     start_at = size + start_at;
   if (start_at < 0)
     start_at = 0;
+  if (start_at > size)
+    start_at = size;
   if (length + start_at > (uint64_t)size)
     length = size - start_at;
+  if (length && fiobj_data_map(io, size))
+    return (fio_str_info_s){
+        .data = (char *)obj2io(io)->map + start_at,
+        .len = length,
+    };
   if (length == 0) {
     /* free memory once there's no more data to read */
     obj2io(io)->capa = 0;
@@ -1151,6 +1290,81 @@ void fiobj_data_test(void) {
   }
   fiobj_free(sliceio);
 
+#if FIOBJ_DATA_MMAP_MIN
+  {
+#define TEST_ASSERT(cond, ...)                                                 \
+  if (!(cond)) {                                                               \
+    fprintf(stderr, "* " __VA_ARGS__);                                         \
+    fprintf(stderr, "Testing failed.\n");                                      \
+    exit(-1);                                                                  \
+  }
+    /* 16 byte lines, so the file is mapped */
+    const size_t count = (FIOBJ_DATA_MMAP_MIN >> 4) + 7;
+    text = fiobj_str_buf(count << 4);
+    for (size_t i = 0; i < count; ++i) {
+      char line[24];
+      snprintf(line, 24, "line %09zu\r\n", i);
+      fiobj_str_write(text, line, 16);
+    }
+    fio_str_info_s t = fiobj_obj2cstr(text);
+    fdio = fiobj_data_newtmpfile();
+    fiobj_data_write(fdio, t.data, t.len);
+    for (size_t i = 0; i < count; ++i) {
+      s1 = fiobj_data_gets(fdio);
+      TEST_ASSERT(s1.len == 16 && !memcmp(s1.data, t.data + (i << 4), 16),
+                  "mapped `gets` error (line %zu)\n", i);
+    }
+    TEST_ASSERT(obj2io(fdio)->map &&
+                    (uint8_t *)s1.data == obj2io(fdio)->map + t.len - 16,
+                "mapped `gets` didn't use the memory map\n");
+    s1 = fiobj_data_gets(fdio);
+    TEST_ASSERT(!s1.data, "mapped `gets` EOF error\n");
+    fiobj_data_seek(fdio, 16);
+    s1 = fiobj_data_read(fdio, 32);
+    TEST_ASSERT(s1.len == 32 && !memcmp(s1.data, t.data + 16, 32),
+                "mapped `read` error\n");
+    TEST_ASSERT(fiobj_data_pos(fdio) == 48, "mapped `read` position error\n");
+    sliceio = fiobj_data_slice(fdio, 40, 4096);
+    s1 = fiobj_data_read(sliceio, 0);
+    TEST_ASSERT(s1.len == 4096 && (uint8_t *)s1.data == obj2io(fdio)->map + 40,
+                "mapped slices should be read in place\n");
+    /* writing remaps the file */
+    fiobj_data_write(fdio, "tail", 4);
+    s1 = fiobj_data_pread(fdio, -4, 4);
+    TEST_ASSERT(s1.len == 4 && !memcmp(s1.data, "tail", 4) &&
+                    obj2io(fdio)->map_len == t.len + 4,
+                "mapped `pread` after `write` error\n");
+    fiobj_str_write(text, "tail", 4);
+    t = fiobj_obj2cstr(text);
+    s1 = fiobj_obj2cstr(fdio);
+    TEST_ASSERT(s1.len == t.len && !memcmp(s1.data, t.data, t.len) &&
+                    !s1.data[s1.len],
+                "mapped `fiobj_obj2cstr` error\n");
+    /* saving copies the file / slice */
+    char name[] = "/tmp/facil_io_test_XXXXXXXX";
+    int fd = mkstemp(name);
+    TEST_ASSERT(fd != -1, "couldn't create a temporary file name\n");
+    close(fd);
+    TEST_ASSERT(!fiobj_data_save(fdio, name), "mapped `save` failed\n");
+    FIOBJ tmp = fiobj_str_buf(0);
+    fiobj_str_readfile(tmp, name, 0, 0);
+    TEST_ASSERT(fiobj_iseq(tmp, text), "saved data error\n");
+    TEST_ASSERT(!fiobj_data_save(sliceio, name), "slice `save` failed\n");
+    fiobj_str_resize(tmp, 0);
+    fiobj_str_readfile(tmp, name, 0, 0);
+    TEST_ASSERT(fiobj_obj2cstr(tmp).len == 4096 &&
+                    !memcmp(fiobj_obj2cstr(tmp).data, t.data + 40, 4096),
+                "saved slice error\n");
+    unlink(name);
+    fiobj_free(tmp);
+    fiobj_free(sliceio);
+    fiobj_free(fdio);
+    fiobj_free(text);
+    fprintf(stderr, "* memory mapped files passed.\n");
+#undef TEST_ASSERT
+  }
+#endif
+
   fprintf(stderr, "* passed.\n");
 }
 
@@ -18,6 +18,15 @@ License: MIT
 
 #include <fiobject.h>
 
+#ifndef FIOBJ_DATA_MMAP_MIN
+/**
+ * File backed Data objects of at least this many bytes are memory mapped, so
+ * reading (and reading slices) returns data directly from the mapping rather
+ * than copying it to an internal buffer (0 disables memory mapping).
+ */
+#define FIOBJ_DATA_MMAP_MIN 65536
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -50,7 +59,13 @@ FIOBJ fiobj_data_slice(FIOBJ parent, intptr_t offset, uintptr_t length);
 Saving the Data Stream object
 ***************************************************************************** */
 
-/** Creates a new local file Data Stream object */
+/**
+ * Saves the Data Stream object's data to a file (`filename`), returning -1 on
+ * error and 0 on success.
+ *
+ * File backed data is copied by the kernel (using `copy_file_range` or
+ * `sendfile`) when possible.
+ */
 int fiobj_data_save(FIOBJ io, const char *filename);
 
 /* *****************************************************************************
@@ -39,24 +39,126 @@ License: MIT
 /* *****************************************************************************
 Hash types
 ***************************************************************************** */
+
+/* an inline key-value pair (used until the Hash Map is allocated) */
+typedef struct {
+  uint64_t hash;
+  FIOBJ key;
+  FIOBJ obj;
+} fiobj_hash_pair_s;
+
 typedef struct {
   fiobj_object_header_s head;
   fio_hash___s hash;
+  /* the number of inline pairs - always 0 once `hash.map` is allocated */
+  uint8_t small;
+  fiobj_hash_pair_s pairs[FIOBJ_HASH_SMALL];
 } fiobj_hash_s;
 
 #define obj2hash(o) ((fiobj_hash_s *)(FIOBJ2PTR(o)))
 
+/* true while the Hash stores its key-value pairs inline */
+#define fiobj_hash_is_small(h) (!(h)->hash.map)
+
 void fiobj_hash_rehash(FIOBJ h) {
   assert(h && FIOBJ_TYPE_IS(h, FIOBJ_T_HASH));
+  if (fiobj_hash_is_small(obj2hash(h)))
+    return;
   fio_hash___rehash(&obj2hash(h)->hash);
 }
 
+/* *****************************************************************************
+Inline (small Hash) key-value pairs
+***************************************************************************** */
+
+/* finds an inline pair. A `key` of -1 compares only the hash values. */
+static inline fiobj_hash_pair_s *
+fiobj_hash_small_find(fiobj_hash_s *h, uint64_t hash_value, FIOBJ key) {
+  for (fiobj_hash_pair_s *pos = h->pairs, *end = h->pairs + h->small;
+       pos < end; ++pos) {
+    if (pos->hash == hash_value &&
+        (key == (FIOBJ)-1 || pos->key == key || fiobj_iseq(pos->key, key)))
+      return pos;
+  }
+  return NULL;
+}
+
+/* moves the inline pairs to a newly allocated Hash Map */
+static void fiobj_hash_small_upgrade(fiobj_hash_s *h, size_t capa) {
+  fio_hash___capa_require(&h->hash, capa);
+  for (size_t i = 0; i < h->small; ++i) {
+    fio_hash___insert(&h->hash, h->pairs[i].hash, h->pairs[i].key,
+                      h->pairs[i].obj, NULL);
+    fiobj_free(h->pairs[i].key);
+    fiobj_free(h->pairs[i].obj);
+  }
+  h->small = 0;
+}
+
+/* sets a key-value pair, duplicating both (see `fio_hash___insert`) */
+static inline void fiobj_hash_insert(fiobj_hash_s *h, uint64_t hash_value,
+                                     FIOBJ key, FIOBJ obj, FIOBJ *old) {
+  if (fiobj_hash_is_small(h)) {
+    fiobj_hash_pair_s *pos = fiobj_hash_small_find(h, hash_value, key);
+    if (pos) {
+      if (old)
+        *old = pos->obj;
+      else
+        fiobj_free(pos->obj);
+      pos->obj = fiobj_dup(obj);
+      return;
+    }
+    if (h->small < FIOBJ_HASH_SMALL) {
+      h->pairs[h->small++] = (fiobj_hash_pair_s){
+          .hash = hash_value,
+          .key = fiobj_dup(key),
+          .obj = fiobj_dup(obj),
+      };
+      return;
+    }
+    fiobj_hash_small_upgrade(h, FIOBJ_HASH_SMALL << 1);
+  }
+  fio_hash___insert(&h->hash, hash_value, key, obj, old);
+}
+
+/* removes a key-value pair, returning -1 if it wasn't found */
+static inline int fiobj_hash_erase(fiobj_hash_s *h, uint64_t hash_value,
+                                   FIOBJ key, FIOBJ *old) {
+  if (!fiobj_hash_is_small(h))
+    return fio_hash___remove(&h->hash, hash_value, key, old);
+  fiobj_hash_pair_s *pos = fiobj_hash_small_find(h, hash_value, key);
+  if (!pos)
+    return -1;
+  if (old)
+    *old = pos->obj;
+  else
+    fiobj_free(pos->obj);
+  fiobj_free(pos->key);
+  --h->small;
+  /* keep the insertion order */
+  memmove(pos, pos + 1, (h->pairs + h->small - pos) * sizeof(*pos));
+  return 0;
+}
+
+/* returns the object associated with the hash value (and key), if any */
+static inline FIOBJ fiobj_hash_find(fiobj_hash_s *h, uint64_t hash_value,
+                                    FIOBJ key) {
+  if (!fiobj_hash_is_small(h))
+    return fio_hash___find(&h->hash, hash_value, key);
+  fiobj_hash_pair_s *pos = fiobj_hash_small_find(h, hash_value, key);
+  return pos ? pos->obj : FIOBJ_INVALID;
+}
+
 /* *****************************************************************************
 Hash alloc + VTable
 ***************************************************************************** */
 
 static void fiobj_hash_dealloc(FIOBJ o, void (*task)(FIOBJ, void *),
                                void *arg) {
+  for (size_t i = 0; i < obj2hash(o)->small; ++i) {
+    task(obj2hash(o)->pairs[i].obj, arg);
+    fiobj_free(obj2hash(o)->pairs[i].key);
+  }
   FIO_SET_FOR_LOOP(&obj2hash(o)->hash, i) {
     if (i->obj.key)
       task((FIOBJ)i->obj.obj, arg);
@@ -77,7 +179,15 @@ static size_t fiobj_hash_each1(FIOBJ o, size_t start_at,
   FIOBJ old_each_at_key = each_at_key;
   fio_hash___s *hash = &obj2hash(o)->hash;
   size_t count = 0;
-  if (hash->count == hash->pos) {
+  if (fiobj_hash_is_small(obj2hash(o))) {
+    for (count = start_at; count < obj2hash(o)->small; ++count) {
+      each_at_key = obj2hash(o)->pairs[count].key;
+      if (task(obj2hash(o)->pairs[count].obj, arg) == -1) {
+        ++count;
+        goto end;
+      }
+    }
+  } else if (hash->count == hash->pos) {
     /* no holes in the hash, we can work as we please. */
     for (count = start_at; count < hash->count; ++count) {
       each_at_key = hash->ordered[count].obj.key;
@@ -113,8 +223,7 @@ end:
 FIOBJ fiobj_hash_key_in_loop(void) { return each_at_key; }
 
 static size_t fiobj_hash_is_eq(const FIOBJ self, const FIOBJ other) {
-  if (fio_hash___count(&obj2hash(self)->hash) !=
-      fio_hash___count(&obj2hash(other)->hash))
+  if (fiobj_hash_count(self) != fiobj_hash_count(other))
     return 0;
   return 1;
 }
@@ -122,7 +231,7 @@ static size_t fiobj_hash_is_eq(const FIOBJ self, const FIOBJ other) {
 /** Returns the number of elements in the Array. */
 size_t fiobj_hash_count(const FIOBJ o) {
   assert(o && FIOBJ_TYPE_IS(o, FIOBJ_T_HASH));
-  return fio_hash___count(&obj2hash(o)->hash);
+  return fio_hash___count(&obj2hash(o)->hash) + obj2hash(o)->small;
 }
 
 intptr_t fiobj_hash2num(const FIOBJ o) { return (intptr_t)fiobj_hash_count(o); }
@@ -177,7 +286,8 @@ FIOBJ fiobj_hash_new2(size_t capa) {
   FIO_ASSERT_ALLOC(h);
   *h = (fiobj_hash_s){.head = {.ref = 1, .type = FIOBJ_T_HASH},
                       .hash = FIO_SET_INIT};
-  fio_hash___capa_require(&h->hash, capa);
+  if (capa > FIOBJ_HASH_SMALL)
+    fio_hash___capa_require(&h->hash, capa);
   return (FIOBJ)h | FIOBJECT_HASH_FLAG;
 }
 
@@ -187,6 +297,8 @@ FIOBJ fiobj_hash_new2(size_t capa) {
  */
 size_t fiobj_hash_capa(const FIOBJ hash) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
+  if (fiobj_hash_is_small(obj2hash(hash)))
+    return FIOBJ_HASH_SMALL;
   return fio_hash___capa(&obj2hash(hash)->hash);
 }
 
@@ -200,7 +312,9 @@ int fiobj_hash_set(FIOBJ hash, FIOBJ key, FIOBJ obj) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
   if (FIOBJ_TYPE_IS(key, FIOBJ_T_STRING))
     fiobj_str_freeze(key);
-  fio_hash___insert(&obj2hash(hash)->hash, fiobj_obj2hash(key), key, obj, NULL);
+  fiobj___share_nested(hash, key);
+  fiobj___share_nested(hash, obj);
+  fiobj_hash_insert(obj2hash(hash), fiobj_obj2hash(key), key, obj, NULL);
   fiobj_free(obj); /* take ownership - free the user's reference. */
   return 0;
 }
@@ -218,7 +332,18 @@ int fiobj_hash_set(FIOBJ hash, FIOBJ key, FIOBJ obj) {
 FIOBJ fiobj_hash_pop(FIOBJ hash, FIOBJ *key) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
   FIOBJ old;
-  if (fio_hash___count(&obj2hash(hash)->hash))
+  fiobj_hash_s *h = obj2hash(hash);
+  if (fiobj_hash_is_small(h)) {
+    if (!h->small)
+      return FIOBJ_INVALID;
+    --h->small;
+    if (key)
+      *key = h->pairs[h->small].key;
+    else
+      fiobj_free(h->pairs[h->small].key);
+    return h->pairs[h->small].obj;
+  }
+  if (!fio_hash___count(&obj2hash(hash)->hash))
     return FIOBJ_INVALID;
   old = fiobj_dup(fio_hash___last(&obj2hash(hash)->hash).obj);
   if (key)
@@ -239,7 +364,9 @@ FIOBJ fiobj_hash_pop(FIOBJ hash, FIOBJ *key) {
 FIOBJ fiobj_hash_replace(FIOBJ hash, FIOBJ key, FIOBJ obj) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
   FIOBJ old = FIOBJ_INVALID;
-  fio_hash___insert(&obj2hash(hash)->hash, fiobj_obj2hash(key), key, obj, &old);
+  fiobj___share_nested(hash, key);
+  fiobj___share_nested(hash, obj);
+  fiobj_hash_insert(obj2hash(hash), fiobj_obj2hash(key), key, obj, &old);
   fiobj_free(obj); /* take ownership - free the user's reference. */
   return old;
 }
@@ -250,7 +377,7 @@ FIOBJ fiobj_hash_replace(FIOBJ hash, FIOBJ key, FIOBJ obj) {
 FIOBJ fiobj_hash_remove(FIOBJ hash, FIOBJ key) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
   FIOBJ old = FIOBJ_INVALID;
-  fio_hash___remove(&obj2hash(hash)->hash, fiobj_obj2hash(key), key, &old);
+  fiobj_hash_erase(obj2hash(hash), fiobj_obj2hash(key), key, &old);
   return old;
 }
 
@@ -261,7 +388,7 @@ FIOBJ fiobj_hash_remove(FIOBJ hash, FIOBJ key) {
 FIOBJ fiobj_hash_remove2(FIOBJ hash, uint64_t hash_value) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
   FIOBJ old = FIOBJ_INVALID;
-  fio_hash___remove(&obj2hash(hash)->hash, hash_value, -1, &old);
+  fiobj_hash_erase(obj2hash(hash), hash_value, -1, &old);
   return old;
 }
 
@@ -272,8 +399,7 @@ FIOBJ fiobj_hash_remove2(FIOBJ hash, uint64_t hash_value) {
  * Returns -1 on type error or if the object never existed.
  */
 int fiobj_hash_delete(FIOBJ hash, FIOBJ key) {
-  return fio_hash___remove(&obj2hash(hash)->hash, fiobj_obj2hash(key), key,
-                           NULL);
+  return fiobj_hash_erase(obj2hash(hash), fiobj_obj2hash(key), key, NULL);
 }
 
 /**
@@ -287,7 +413,7 @@ int fiobj_hash_delete(FIOBJ hash, FIOBJ key) {
  * Returns -1 on type error or if the object never existed.
  */
 int fiobj_hash_delete2(FIOBJ hash, uint64_t key_hash) {
-  return fio_hash___remove(&obj2hash(hash)->hash, key_hash, -1, NULL);
+  return fiobj_hash_erase(obj2hash(hash), key_hash, -1, NULL);
 }
 
 /**
@@ -296,8 +422,7 @@ int fiobj_hash_delete2(FIOBJ hash, uint64_t key_hash) {
  */
 FIOBJ fiobj_hash_get(const FIOBJ hash, FIOBJ key) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
-  return fio_hash___find(&obj2hash(hash)->hash, fiobj_obj2hash(key), key);
-  ;
+  return fiobj_hash_find(obj2hash(hash), fiobj_obj2hash(key), key);
 }
 
 /**
@@ -310,8 +435,7 @@ FIOBJ fiobj_hash_get(const FIOBJ hash, FIOBJ key) {
  */
 FIOBJ fiobj_hash_get2(const FIOBJ hash, uint64_t key_hash) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
-  return fio_hash___find(&obj2hash(hash)->hash, key_hash, -1);
-  ;
+  return fiobj_hash_find(obj2hash(hash), key_hash, -1);
 }
 
 /**
@@ -319,7 +443,7 @@ FIOBJ fiobj_hash_get2(const FIOBJ hash, uint64_t key_hash) {
  */
 int fiobj_hash_haskey(const FIOBJ hash, FIOBJ key) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
-  return fio_hash___find(&obj2hash(hash)->hash, fiobj_obj2hash(key), key) !=
+  return fiobj_hash_find(obj2hash(hash), fiobj_obj2hash(key), key) !=
          FIOBJ_INVALID;
 }
 
@@ -328,7 +452,13 @@ int fiobj_hash_haskey(const FIOBJ hash, FIOBJ key) {
  */
 void fiobj_hash_clear(const FIOBJ hash) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
-  fio_hash___free(&obj2hash(hash)->hash);
+  fiobj_hash_s *h = obj2hash(hash);
+  while (h->small) {
+    --h->small;
+    fiobj_free(h->pairs[h->small].key);
+    fiobj_free(h->pairs[h->small].obj);
+  }
+  fio_hash___free(&h->hash);
 }
 
 /* *****************************************************************************
@@ -336,6 +466,14 @@ Simple Tests
 ***************************************************************************** */
 
 #if DEBUG
+#include <fiobj_ary.h>
+#include <fiobj_numbers.h>
+
+static int fiobj_hash_test_collect(FIOBJ obj, void *ary) {
+  fiobj_ary_push((FIOBJ)ary, fiobj_dup(obj));
+  return 0;
+}
+
 void fiobj_test_hash(void) {
   fprintf(stderr, "=== Testing Hash\n");
 #define TEST_ASSERT(cond, ...)                                                 \
@@ -359,16 +497,16 @@ void fiobj_test_hash(void) {
               "hash compare didn't get value back");
 
   FIOBJ o2 = fiobj_hash_new2(3);
-  TEST_ASSERT(obj2hash(o2)->hash.capa >= 3,
+  TEST_ASSERT(fiobj_hash_capa(o2) >= 3,
               "Hash capacity should be larger than 3! %zu != 4\n",
-              (size_t)obj2hash(o2)->hash.capa);
+              fiobj_hash_capa(o2));
   fiobj_hash_set(o2, str_key, fiobj_true());
   TEST_ASSERT(fiobj_hash_is_eq(o, o2), "Hashes not equal at core! %zu != %zu\n",
               fiobj_hash_count(o), fiobj_hash_count(o2));
   TEST_ASSERT(fiobj_iseq(o, o2), "Hashes not equal!\n");
-  TEST_ASSERT(obj2hash(o2)->hash.capa > 3,
+  TEST_ASSERT(fiobj_hash_capa(o2) > 3,
               "Hash capacity should be larger than 3! %zu != 4\n",
-              (size_t)obj2hash(o2)->hash.capa);
+              fiobj_hash_capa(o2));
 
   fiobj_hash_delete(o, str_key);
 
@@ -378,6 +516,69 @@ void fiobj_test_hash(void) {
       str_key); /* note that a copy will remain in the Hash until rehashing. */
   fiobj_free(o);
   fiobj_free(o2);
+
+  /* inline pairs, upgrading to a Hash Map and back (after clearing) */
+  o = fiobj_hash_new();
+  for (size_t round = 0; round < 2; ++round) {
+    for (intptr_t i = 0; i < (FIOBJ_HASH_SMALL * 3); ++i) {
+      FIOBJ key = fiobj_num_new(i);
+      fiobj_hash_set(o, key, fiobj_num_new(i));
+      fiobj_free(key);
+      TEST_ASSERT(fiobj_hash_count(o) == (size_t)i + 1,
+                  "Hash count error after %zu insertions\n", (size_t)i + 1);
+      TEST_ASSERT(
+          fiobj_hash_is_small(obj2hash(o)) == (i < FIOBJ_HASH_SMALL),
+          "Hash should switch to a Hash Map once it outgrows inline storage\n");
+      for (intptr_t j = 0; j <= i; ++j) {
+        FIOBJ tmp = fiobj_num_new(j);
+        TEST_ASSERT(fiobj_obj2num(fiobj_hash_get(o, tmp)) == j,
+                    "Hash lost a value (%zu of %zu)\n", (size_t)j,
+                    (size_t)i + 1);
+        fiobj_free(tmp);
+      }
+    }
+    fiobj_hash_clear(o);
+    TEST_ASSERT(!fiobj_hash_count(o) && fiobj_hash_is_small(obj2hash(o)),
+                "Hash should use inline storage after clearing\n");
+  }
+  for (intptr_t i = 0; i < FIOBJ_HASH_SMALL; ++i) {
+    FIOBJ key = fiobj_num_new(i);
+    fiobj_hash_set(o, key, fiobj_num_new(i));
+    fiobj_free(key);
+  }
+  {
+    FIOBJ key = fiobj_num_new(1);
+    FIOBJ old = fiobj_hash_replace(o, key, fiobj_num_new(100));
+    TEST_ASSERT(fiobj_obj2num(old) == 1, "small Hash replace failed\n");
+    fiobj_free(old);
+    old = fiobj_hash_remove(o, key);
+    TEST_ASSERT(fiobj_obj2num(old) == 100, "small Hash remove failed\n");
+    TEST_ASSERT(!fiobj_hash_haskey(o, key), "small Hash key not removed\n");
+    fiobj_free(old);
+    fiobj_free(key);
+    TEST_ASSERT(fiobj_hash_count(o) == FIOBJ_HASH_SMALL - 1,
+                "small Hash count error after removal\n");
+    intptr_t expect = 0;
+    FIOBJ ary = fiobj_ary_new();
+    fiobj_each1(o, 0, fiobj_hash_test_collect, (void *)ary);
+    for (size_t i = 0; i < fiobj_ary_count(ary); ++i) {
+      if (expect == 1)
+        ++expect; /* removed */
+      TEST_ASSERT(fiobj_obj2num(fiobj_ary_index(ary, i)) == expect,
+                  "small Hash order error after removal\n");
+      ++expect;
+    }
+    TEST_ASSERT(fiobj_ary_count(ary) == FIOBJ_HASH_SMALL - 1,
+                "small Hash each count error\n");
+    fiobj_free(ary);
+    old = fiobj_hash_pop(o, &key);
+    TEST_ASSERT(fiobj_obj2num(old) == FIOBJ_HASH_SMALL - 1 &&
+                    fiobj_obj2num(key) == FIOBJ_HASH_SMALL - 1,
+                "small Hash pop failed\n");
+    fiobj_free(old);
+    fiobj_free(key);
+  }
+  fiobj_free(o);
   fprintf(stderr, "* passed.\n");
 }
 #endif
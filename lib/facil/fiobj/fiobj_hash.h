@@ -30,6 +30,17 @@ extern "C" {
 /* MUST be a power of 2 */
 #define HASH_INITIAL_CAPACITY 16
 
+#ifndef FIOBJ_HASH_SMALL
+/**
+ * The number of key-value pairs a Hash stores inline (in a linear array within
+ * the Hash object), before it allocates a Hash Map. Must be 1-255.
+ *
+ * Most Hash objects (i.e., JSON objects) are small enough that a linear search
+ * is faster than a Hash Map lookup and this saves two allocations per object.
+ */
+#define FIOBJ_HASH_SMALL 8
+#endif
+
 /** attempts to rehash the hashmap. */
 void fiobj_hash_rehash(FIOBJ h);
 
@@ -86,6 +86,14 @@ static void fio_json_on_float(json_parser_s *p, double f) {
 }
 /** a String was detected (int / float). update `pos` to point at ending */
 static void fio_json_on_string(json_parser_s *p, void *start, size_t length) {
+  fiobj_json_parser_s *pr = (fiobj_json_parser_s *)p;
+  if (pr->top && pr->is_hash && !pr->key &&
+      length <= FIOBJ_STR_INTERN_MAX_LEN) {
+    /* object keys repeat (within and across documents), intern them */
+    char key[FIOBJ_STR_INTERN_MAX_LEN];
+    pr->key = fiobj_str_intern(key, fio_json_unescape_str(key, start, length));
+    return;
+  }
   FIOBJ str = fiobj_str_buf(length);
   fiobj_str_resize(
       str, fio_json_unescape_str(fiobj_obj2cstr(str).data, start, length));
@@ -163,130 +171,177 @@ static void fio_json_on_error(json_parser_s *p) {
 JSON formatting
 ***************************************************************************** */
 
-/** Writes a JSON friendly version of the src String */
-static void write_safe_str(FIOBJ dest, const FIOBJ str) {
+typedef struct {
+  FIOBJ dest;
+  FIOBJ parent;
+  fio_json_stack_s *stack;
+  uintptr_t count;
+  uint8_t pretty;
+  /* the destination's buffer (the String's length is set once done) */
+  char *buf;
+  size_t len;
+  size_t capa;
+} obj2json_data_s;
+
+/* grows the destination buffer so `required` more bytes can be written */
+static __attribute__((noinline)) char *
+fiobj_obj2json_grow(obj2json_data_s *data, size_t required) {
+  size_t capa = data->capa + (data->capa >> 1);
+  if (capa < data->len + required)
+    capa = data->len + required;
+  fiobj_str_resize(data->dest, data->len); /* preserve the data written */
+  data->capa = fiobj_str_capa_assert(data->dest, capa);
+  data->buf = fiobj_obj2cstr(data->dest).data;
+  return data->buf + data->len;
+}
+
+/* returns the writing position, making sure `required` bytes can be written */
+static inline char *fiobj_obj2json_reserve(obj2json_data_s *data,
+                                           size_t required) {
+  if (data->len + required <= data->capa)
+    return data->buf + data->len;
+  return fiobj_obj2json_grow(data, required);
+}
+
+static inline void fiobj_obj2json_write(obj2json_data_s *data,
+                                        const char *src, size_t len) {
+  memcpy(fiobj_obj2json_reserve(data, len), src, len);
+  data->len += len;
+}
+
+/* writes an escaped version of `src[0]`, returns the number of bytes written */
+static inline size_t fiobj_obj2json_escape(char *writer, uint8_t c) {
+  static const char escapes[32] = {
+      'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n',
+      'u', 'f', 'r', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+      'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  };
+  writer[0] = '\\';
+  if (c >= 32) { /* '"' or '\\' */
+    writer[1] = (char)c;
+    return 2;
+  }
+  writer[1] = escapes[c];
+  if (writer[1] != 'u')
+    return 2;
+  /* MUST escape all control values less than 32 */
+  writer[2] = '0';
+  writer[3] = '0';
+  writer[4] = hex_chars[c >> 4];
+  writer[5] = hex_chars[c & 15];
+  return 6;
+}
+
+/* returns a bit map of the bytes (in 16) that must be escaped */
+#if JSON_SIMD_SSE2
+static inline uint64_t fiobj_obj2json_mask16(const uint8_t *src) {
+  const __m128i v = _mm_loadu_si128((const __m128i *)src);
+  const __m128i m = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+      _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v));
+  return (uint64_t)(uint16_t)_mm_movemask_epi8(m);
+}
+#define FIOBJ_JSON_BLOCK 16
+#elif JSON_SIMD_NEON
+static inline uint64_t fiobj_obj2json_mask16(const uint8_t *src) {
+  const uint8x16_t v = vld1q_u8(src);
+  const uint8x16_t m =
+      vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')),
+                        vceqq_u8(v, vdupq_n_u8('\\'))),
+               vcltq_u8(v, vdupq_n_u8(0x20)));
+  return fio_json_neon_mask(m);
+}
+#define FIOBJ_JSON_BLOCK 16
+#endif
+
+/** Writes a JSON friendly (quoted and escaped) version of the src String */
+static void write_safe_str(obj2json_data_s *data, const FIOBJ str) {
   fio_str_info_s s = fiobj_obj2cstr(str);
-  fio_str_info_s t = fiobj_obj2cstr(dest);
-  t.data[t.len] = '"';
-  t.len++;
-  fiobj_str_resize(dest, t.len);
-  t = fiobj_obj2cstr(dest);
   const uint8_t *restrict src = (const uint8_t *)s.data;
   size_t len = s.len;
-  uint64_t end = t.len;
-  /* make sure we have some room */
-  size_t added = 0;
-  size_t capa = fiobj_str_capa(dest);
-  if (capa <= end + s.len + 64) {
-    if (0) {
-      capa = (((capa >> 12) + 1) << 12) - 1;
-      capa = fiobj_str_capa_assert(dest, capa);
-    } else {
-      capa = fiobj_str_capa_assert(dest, (end + s.len + 64));
+  /* assumes nothing needs escaping (room for quotes and a block's overrun) */
+  char *restrict writer = fiobj_obj2json_reserve(data, len + 18);
+  *(writer++) = '"';
+  for (;;) {
+#ifdef FIOBJ_JSON_BLOCK
+    /* copy clean blocks in bulk (the copy might overrun the escaped byte) */
+    while (len >= FIOBJ_JSON_BLOCK) {
+      uint64_t mask = fiobj_obj2json_mask16(src);
+      memcpy(writer, src, FIOBJ_JSON_BLOCK);
+      if (mask) {
+        const size_t i = fio_json_ctz64(mask);
+        writer += i;
+        src += i;
+        len -= i;
+        goto escape;
+      }
+      writer += FIOBJ_JSON_BLOCK;
+      src += FIOBJ_JSON_BLOCK;
+      len -= FIOBJ_JSON_BLOCK;
     }
-    fio_str_info_s tmp = fiobj_obj2cstr(dest);
-    t = tmp;
-  }
-  while (len) {
-    char *restrict writer = (char *)t.data;
-    while (len && src[0] > 32 && src[0] != '"' && src[0] != '\\') {
-      len--;
-      writer[end++] = *(src++);
+#endif
+    while (len && src[0] >= 32 && src[0] != '"' && src[0] != '\\') {
+      *(writer++) = (char)*(src++);
+      --len;
     }
     if (!len)
       break;
-    switch (src[0]) {
-    case '\b':
-      writer[end++] = '\\';
-      writer[end++] = 'b';
-      added++;
-      break; /* from switch */
-    case '\f':
-      writer[end++] = '\\';
-      writer[end++] = 'f';
-      added++;
-      break; /* from switch */
-    case '\n':
-      writer[end++] = '\\';
-      writer[end++] = 'n';
-      added++;
-      break; /* from switch */
-    case '\r':
-      writer[end++] = '\\';
-      writer[end++] = 'r';
-      added++;
-      break; /* from switch */
-    case '\t':
-      writer[end++] = '\\';
-      writer[end++] = 't';
-      added++;
-      break; /* from switch */
-    case '"':
-    case '\\':
-    case '/':
-      writer[end++] = '\\';
-      writer[end++] = src[0];
-      added++;
-      break; /* from switch */
-    default:
-      if (src[0] <= 31) {
-        /* MUST escape all control values less than 32 */
-        writer[end++] = '\\';
-        writer[end++] = 'u';
-        writer[end++] = '0';
-        writer[end++] = '0';
-        writer[end++] = hex_chars[src[0] >> 4];
-        writer[end++] = hex_chars[src[0] & 15];
-        added += 4;
-      } else
-        writer[end++] = src[0];
-      break; /* from switch */
-    }
-    src++;
-    len--;
-    if (added >= 48 && capa <= end + len + 64) {
-      writer[end] = 0;
-      fiobj_str_resize(dest, end);
-      fiobj_str_capa_assert(dest, (end + len + 64));
-      t = fiobj_obj2cstr(dest);
-      writer = (char *)t.data;
-      capa = t.capa;
-      added = 0;
+#ifdef FIOBJ_JSON_BLOCK
+  escape:
+#endif
+    {
+      /* an escaped byte might need 6 bytes (5 more than reserved) */
+      const size_t pos = (size_t)(writer - data->buf);
+      if (pos + len + 23 > data->capa) {
+        data->len = pos;
+        writer = fiobj_obj2json_grow(data, len + 23);
+      }
+      writer += fiobj_obj2json_escape(writer, src[0]);
+      ++src;
+      --len;
     }
   }
-  t.data[end++] = '"';
-  fiobj_str_resize(dest, end);
+  *(writer++) = '"';
+  data->len = (size_t)(writer - data->buf);
 }
 
-typedef struct {
-  FIOBJ dest;
-  FIOBJ parent;
-  fio_json_stack_s *stack;
-  uintptr_t count;
-  uint8_t pretty;
-} obj2json_data_s;
-
 static int fiobj_obj2json_task(FIOBJ o, void *data_) {
   obj2json_data_s *data = data_;
   uint8_t add_seperator = 1;
   if (fiobj_hash_key_in_loop()) {
-    write_safe_str(data->dest, fiobj_hash_key_in_loop());
-    fiobj_str_write(data->dest, ":", 1);
+    write_safe_str(data, fiobj_hash_key_in_loop());
+    *fiobj_obj2json_reserve(data, 1) = ':';
+    ++data->len;
   }
   switch (FIOBJ_TYPE(o)) {
   case FIOBJ_T_NUMBER:
+    data->len += fio_ltoa(fiobj_obj2json_reserve(data, 24), fiobj_obj2num(o),
+                          10);
+    --data->count;
+    break;
+  case FIOBJ_T_FLOAT:
+    data->len += fio_ftoa(fiobj_obj2json_reserve(data, 32),
+                          fiobj_obj2float(o), 10);
+    --data->count;
+    break;
   case FIOBJ_T_NULL:
+    fiobj_obj2json_write(data, "null", 4);
+    --data->count;
+    break;
   case FIOBJ_T_TRUE:
+    fiobj_obj2json_write(data, "true", 4);
+    --data->count;
+    break;
   case FIOBJ_T_FALSE:
-  case FIOBJ_T_FLOAT:
-    fiobj_str_join(data->dest, o);
+    fiobj_obj2json_write(data, "false", 5);
     --data->count;
     break;
 
   case FIOBJ_T_DATA:
   case FIOBJ_T_UNKNOWN:
   case FIOBJ_T_STRING:
-    write_safe_str(data->dest, o);
+    write_safe_str(data, o);
     --data->count;
     break;
 
@@ -296,7 +351,7 @@ static int fiobj_obj2json_task(FIOBJ o, void *data_) {
     fio_json_stack_push(data->stack, (FIOBJ)data->count);
     data->parent = o;
     data->count = fiobj_ary_count(o);
-    fiobj_str_write(data->dest, "[", 1);
+    fiobj_obj2json_write(data, "[", 1);
     add_seperator = 0;
     break;
 
@@ -306,61 +361,32 @@ static int fiobj_obj2json_task(FIOBJ o, void *data_) {
     fio_json_stack_push(data->stack, (FIOBJ)data->count);
     data->parent = o;
     data->count = fiobj_hash_count(o);
-    fiobj_str_write(data->dest, "{", 1);
+    fiobj_obj2json_write(data, "{", 1);
     add_seperator = 0;
     break;
   }
-  if (data->pretty) {
-    fiobj_str_capa_assert(data->dest,
-                          fiobj_obj2cstr(data->dest).len +
-                              (fio_json_stack_count(data->stack) * 5));
-    while (!data->count && data->parent) {
-      if (FIOBJ_TYPE_IS(data->parent, FIOBJ_T_HASH)) {
-        fiobj_str_write(data->dest, "}", 1);
-      } else {
-        fiobj_str_write(data->dest, "]", 1);
-      }
-      add_seperator = 1;
-      data->count = 0;
-      fio_json_stack_pop(data->stack, &data->count);
-      data->parent = FIOBJ_INVALID;
-      fio_json_stack_pop(data->stack, &data->parent);
-    }
-
-    if (add_seperator && data->parent) {
-      fiobj_str_write(data->dest, ",\n", 2);
+  while (!data->count && data->parent) {
+    fiobj_obj2json_write(
+        data, (FIOBJ_TYPE_IS(data->parent, FIOBJ_T_HASH) ? "}" : "]"), 1);
+    add_seperator = 1;
+    data->count = 0;
+    data->parent = FIOBJ_INVALID;
+    fio_json_stack_pop(data->stack, &data->count);
+    fio_json_stack_pop(data->stack, &data->parent);
+  }
+  if (add_seperator && data->parent) {
+    if (data->pretty) {
       uintptr_t indent = fio_json_stack_count(data->stack) - 1;
-      fiobj_str_capa_assert(data->dest,
-                            fiobj_obj2cstr(data->dest).len + (indent * 2));
-      fio_str_info_s buf = fiobj_obj2cstr(data->dest);
-      while (indent--) {
-        buf.data[buf.len++] = ' ';
-        buf.data[buf.len++] = ' ';
-      }
-      fiobj_str_resize(data->dest, buf.len);
-    }
-  } else {
-    fiobj_str_capa_assert(data->dest,
-                          fiobj_obj2cstr(data->dest).len +
-                              (fio_json_stack_count(data->stack) << 1));
-    while (!data->count && data->parent) {
-      if (FIOBJ_TYPE_IS(data->parent, FIOBJ_T_HASH)) {
-        fiobj_str_write(data->dest, "}", 1);
-      } else {
-        fiobj_str_write(data->dest, "]", 1);
-      }
-      add_seperator = 1;
-      data->count = 0;
-      data->parent = FIOBJ_INVALID;
-      fio_json_stack_pop(data->stack, &data->count);
-      fio_json_stack_pop(data->stack, &data->parent);
-    }
-
-    if (add_seperator && data->parent) {
-      fiobj_str_write(data->dest, ",", 1);
+      char *writer = fiobj_obj2json_reserve(data, 2 + (indent << 1));
+      writer[0] = ',';
+      writer[1] = '\n';
+      memset(writer + 2, ' ', indent << 1);
+      data->len += 2 + (indent << 1);
+    } else {
+      *fiobj_obj2json_reserve(data, 1) = ',';
+      ++data->len;
     }
   }
-
   return 0;
 }
 
@@ -387,6 +413,11 @@ size_t fiobj_json2obj(FIOBJ *pobj, const void *data, size_t len) {
   return consumed;
 }
 
+/** Returns 1 if `data` is a single valid (RFC 8259) JSON value, 0 if not. */
+int fiobj_json_validate(const void *data, size_t len) {
+  return fio_json_validate(data, len);
+}
+
 /**
  * Updates a Hash using JSON data.
  *
@@ -419,20 +450,28 @@ FIOBJ fiobj_obj2json2(FIOBJ dest, FIOBJ o, uint8_t pretty) {
   assert(dest && FIOBJ_TYPE_IS(dest, FIOBJ_T_STRING));
   if (!o) {
     fiobj_str_write(dest, "null", 4);
-    return 0;
+    return dest;
   }
+  fio_str_info_s s = fiobj_obj2cstr(dest);
   fio_json_stack_s stack = FIO_ARY_INIT;
   obj2json_data_s data = {
       .dest = dest,
       .stack = &stack,
       .pretty = pretty,
       .count = 1,
+      .len = s.len,
+      .capa = fiobj_str_capa_assert(dest, s.len + 64),
   };
-  if (!o || !FIOBJ_IS_ALLOCATED(o) || !FIOBJECT2VTBL(o)->each) {
-    fiobj_obj2json_task(o, &data);
+  if (data.capa <= s.len) {
+    FIO_LOG_ERROR("fiobj_obj2json2 - the destination String is frozen.");
     return dest;
   }
-  fiobj_each2(o, fiobj_obj2json_task, &data);
+  data.buf = fiobj_obj2cstr(dest).data; /* might have moved */
+  if (!FIOBJ_IS_ALLOCATED(o) || !FIOBJECT2VTBL(o)->each)
+    fiobj_obj2json_task(o, &data);
+  else
+    fiobj_each2(o, fiobj_obj2json_task, &data);
+  fiobj_str_resize(dest, data.len);
   fio_json_stack_free(&stack);
   return dest;
 }
@@ -616,6 +655,82 @@ void fiobj_test_json(void) {
   fprintf(stderr, "Messy JSON:\n%s\n", fiobj_obj2cstr(tmp).data);
   fiobj_free(o);
   fiobj_free(tmp);
+  fiobj_json2obj(&o, "[NaN, -Infinity]", 16);
+  TEST_ASSERT(FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY) && fiobj_ary_count(o) == 2 &&
+                  FIOBJ_TYPE_IS(fiobj_ary_index(o, 0), FIOBJ_T_FLOAT),
+              "JSON NaN / Infinity failed to parse!\n");
+  fiobj_free(o);
+  fprintf(stderr, "* passed.\n");
+
+  fprintf(stderr, "=== Testing JSON validation\n");
+  TEST_ASSERT(fiobj_json_validate(json_str2, sizeof(json_str2) - 1),
+              "JSON validation failed for a valid document!\n");
+  TEST_ASSERT(!fiobj_json_validate(json_str2, sizeof(json_str2) - 2),
+              "JSON validation passed for a truncated document!\n");
+  TEST_ASSERT(fiobj_json_validate(" {\"a\":[1,2.5e3,\"\xC3\xA9\"]} ", 22),
+              "JSON validation failed for a valid object!\n");
+  TEST_ASSERT(!fiobj_json_validate("[1,]", 4) &&
+                  !fiobj_json_validate("[1] /* */", 9) &&
+                  !fiobj_json_validate("[\"\xC0\xAF\"]", 6) &&
+                  !fiobj_json_validate("[01]", 4) &&
+                  !fiobj_json_validate("[NaN]", 5),
+              "JSON validation passed for invalid data!\n");
+  fprintf(stderr, "* passed.\n");
+
+  fprintf(stderr, "=== Testing JSON formatting (escaping and round trips)\n");
+  tmp = fiobj_obj2json(FIOBJ_INVALID, 0);
+  TEST_ASSERT(!strcmp(fiobj_obj2cstr(tmp).data, "null"),
+              "JSON formatting of FIOBJ_INVALID should be null\n");
+  fiobj_free(tmp);
+  {
+    /* escapes at every offset of (and across) a 16 byte block */
+    char raw[80];
+    for (size_t i = 0; i < sizeof(raw); ++i)
+      raw[i] = (i % 7 == 3) ? (char)(i & 31) : (i % 11 == 5) ? '"' : 'a';
+    raw[40] = '\\';
+    o = fiobj_str_new(raw, sizeof(raw));
+    tmp = fiobj_obj2json(o, 0);
+    FIOBJ back = FIOBJ_INVALID;
+    fio_str_info_s j = fiobj_obj2cstr(tmp);
+    TEST_ASSERT(fiobj_json2obj(&back, j.data, j.len) == j.len &&
+                    fiobj_iseq(back, o),
+                "JSON escaped String round trip failed:\n%s\n", j.data);
+    fiobj_free(back);
+    fiobj_free(tmp);
+    fiobj_free(o);
+  }
+  o = fiobj_str_new("\"\\\b\f\n\r\t\x01\x1F", 9);
+  tmp = fiobj_obj2json(o, 0);
+  TEST_ASSERT(!strcmp(fiobj_obj2cstr(tmp).data,
+                      "\"\\\"\\\\\\b\\f\\n\\r\\t\\u0001\\u001F\""),
+              "JSON String escaping error: %s\n", fiobj_obj2cstr(tmp).data);
+  fiobj_free(tmp);
+  fiobj_free(o);
+  o = fiobj_ary_new();
+  fiobj_ary_push(o, fiobj_float_new(0.1));
+  fiobj_ary_push(o, fiobj_float_new(1e21));
+  fiobj_ary_push(o, fiobj_float_new(-0.0));
+  fiobj_ary_push(o, fiobj_float_new(100));
+  fiobj_ary_push(o, fiobj_num_new(INT64_MIN));
+  tmp = fiobj_obj2json(o, 0);
+  TEST_ASSERT(!strcmp(fiobj_obj2cstr(tmp).data,
+                      "[0.1,1e+21,-0.0,100.0,-9223372036854775808]"),
+              "JSON number formatting error: %s\n", fiobj_obj2cstr(tmp).data);
+  fiobj_free(tmp);
+  fiobj_free(o);
+  consumed = fiobj_json2obj(&o, json_str2, sizeof(json_str2));
+  for (uint8_t pretty = 0; pretty < 2; ++pretty) {
+    FIOBJ back = FIOBJ_INVALID;
+    tmp = fiobj_obj2json(o, pretty);
+    fio_str_info_s j = fiobj_obj2cstr(tmp);
+    TEST_ASSERT(fiobj_json2obj(&back, j.data, j.len) == j.len &&
+                    fiobj_iseq(back, o),
+                "JSON formatting round trip failed (pretty == %d)\n",
+                (int)pretty);
+    fiobj_free(back);
+    fiobj_free(tmp);
+  }
+  fiobj_free(o);
   fprintf(stderr, "* passed.\n");
 }
 
@@ -33,6 +33,18 @@ JSON API
  * consumed.
  */
 size_t fiobj_json2obj(FIOBJ *pobj, const void *data, size_t len);
+
+/**
+ * Validates JSON data without creating any objects.
+ *
+ * Returns 1 if `data` is a single, complete and valid (RFC 8259, UTF-8) JSON
+ * value (surrounded by optional white space) and 0 otherwise.
+ *
+ * Note that the parser is more lenient than the validator (i.e., it accepts
+ * comments), so some data accepted by `fiobj_json2obj` is rejected here.
+ */
+int fiobj_json_validate(const void *data, size_t len);
+
 /**
  * Stringify an object into a JSON string. Remember to `fiobj_free`.
  *
@@ -18,6 +18,80 @@ License: MIT
 #define FIO_IGNORE_MACRO
 #endif
 
+/* *****************************************************************************
+Template Compilation (pre-hashed names)
+***************************************************************************** */
+
+/* the compiled data attached to a template (the `mustache_s` udata) */
+typedef struct {
+  size_t text_len; /* the template's static text length (an output hint) */
+  size_t last_len; /* the last rendered length (an output hint) */
+  uint32_t count;  /* the number of instructions */
+  /* per instruction: a key, an Array of keys (dot notation) or FIOBJ_INVALID */
+  FIOBJ names[];
+} fiobj_mustache_names_s;
+
+/* the rendering state (the root section's udata1) */
+typedef struct {
+  FIOBJ dest;
+  fiobj_mustache_names_s *names;
+  int (*on_chunk)(fio_str_info_s chunk, void *udata);
+  void *udata;
+} fiobj_mustache_writer_s;
+
+/*
+ * Converts a tag's name to the keys looked up when rendering. Dot notation
+ * names are converted to an Array of keys, in the order they are looked up:
+ *
+ *     [full name, segment, rest of name, segment, rest of name, ...]
+ */
+static FIOBJ fiobj_mustache_name_compile(const char *name, uint32_t name_len) {
+  uint32_t dot = 0;
+  while (dot < name_len && name[dot] != '.')
+    ++dot;
+  if (dot == name_len)
+    return fiobj_str_intern(name, name_len);
+  FIOBJ keys = fiobj_ary_new2(4);
+  fiobj_ary_push(keys, fiobj_str_intern(name, name_len));
+  fiobj_ary_push(keys, fiobj_str_intern(name, dot));
+  ++dot;
+  for (;;) {
+    fiobj_ary_push(keys, fiobj_str_intern(name + dot, name_len - dot));
+    name += dot;
+    name_len -= dot;
+    dot = 0;
+    while (dot < name_len && name[dot] != '.')
+      ++dot;
+    if (dot == name_len)
+      break;
+    fiobj_ary_push(keys, fiobj_str_intern(name, dot));
+    ++dot;
+  }
+  return keys;
+}
+
+/* attaches the pre-hashed names to the template */
+static mustache_s *fiobj_mustache_compile(mustache_s *m) {
+  if (!m)
+    return m;
+  const uint32_t count = mustache_instruction_count(m);
+  fiobj_mustache_names_s *n =
+      fio_malloc(sizeof(*n) + (sizeof(n->names[0]) * count));
+  FIO_ASSERT_ALLOC(n);
+  *n = (fiobj_mustache_names_s){.count = count,
+                                .text_len = mustache_text_length(m)};
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t len;
+    const char *name = mustache_instruction_name(m, i, &len);
+    /* templates might be used by any thread, so the names are shared */
+    n->names[i] =
+        name ? fiobj_share(fiobj_mustache_name_compile(name, len))
+             : FIOBJ_INVALID;
+  }
+  m->udata = n;
+  return m;
+}
+
 /**
  * Loads a mustache template, converting it into an opaque instruction array.
  *
@@ -29,7 +103,8 @@ License: MIT
  * The `filename` argument should contain the template's file name.
  */
 mustache_s *fiobj_mustache_load(fio_str_info_s filename) {
-  return mustache_load(.filename = filename.data, .filename_len = filename.len);
+  return fiobj_mustache_compile(
+      mustache_load(.filename = filename.data, .filename_len = filename.len));
 }
 
 /**
@@ -43,11 +118,21 @@ mustache_s *fiobj_mustache_load(fio_str_info_s filename) {
  * The `filename` argument should contain the template's file name.
  */
 mustache_s *fiobj_mustache_new FIO_IGNORE_MACRO(mustache_load_args_s args) {
-  return mustache_load FIO_IGNORE_MACRO(args);
+  return fiobj_mustache_compile(mustache_load FIO_IGNORE_MACRO(args));
 }
 
 /** Free the mustache template */
-void fiobj_mustache_free(mustache_s *mustache) { mustache_free(mustache); }
+void fiobj_mustache_free(mustache_s *mustache) {
+  if (!mustache)
+    return;
+  fiobj_mustache_names_s *n = mustache->udata;
+  if (n) {
+    for (uint32_t i = 0; i < n->count; ++i)
+      fiobj_free(n->names[i]);
+    fio_free(n);
+  }
+  mustache_free(mustache);
+}
 
 /**
  * Renders a template into an existing FIOBJ String (`dest`'s end), using the
@@ -56,7 +141,10 @@ void fiobj_mustache_free(mustache_s *mustache) { mustache_free(mustache); }
  * Returns FIOBJ_INVALID if an error occured and a FIOBJ String on success.
  */
 FIOBJ fiobj_mustache_build2(FIOBJ dest, mustache_s *mustache, FIOBJ data) {
-  mustache_build(mustache, .udata1 = (void *)dest, .udata2 = (void *)data);
+  if (!mustache)
+    return dest;
+  fiobj_mustache_writer_s w = {.dest = dest, .names = mustache->udata};
+  mustache_build(mustache, .udata1 = (void *)&w, .udata2 = (void *)data);
   return dest;
 }
 
@@ -69,8 +157,45 @@ FIOBJ fiobj_mustache_build2(FIOBJ dest, mustache_s *mustache, FIOBJ data) {
 FIOBJ fiobj_mustache_build(mustache_s *mustache, FIOBJ data) {
   if (!mustache)
     return FIOBJ_INVALID;
-  return fiobj_mustache_build2(fiobj_str_buf(mustache->u.read_only.data_length),
-                               mustache, data);
+  fiobj_mustache_names_s *n = mustache->udata;
+  size_t capa = mustache->u.read_only.data_length;
+  if (n) {
+    /* size the output using the previous (or the static text) length */
+    capa = __atomic_load_n(&n->last_len, __ATOMIC_RELAXED);
+    if (capa < n->text_len)
+      capa = n->text_len;
+  }
+  FIOBJ dest = fiobj_mustache_build2(fiobj_str_buf(capa), mustache, data);
+  if (n)
+    __atomic_store_n(&n->last_len, fiobj_obj2cstr(dest).len, __ATOMIC_RELAXED);
+  return dest;
+}
+
+/**
+ * Renders a template using the information in the `data` object, passing the
+ * output to the `on_chunk` callback in chunks of about
+ * `FIOBJ_MUSTACHE_CHUNK_SIZE` bytes.
+ *
+ * Returns -1 if an error occurred and 0 on success.
+ */
+int fiobj_mustache_stream(mustache_s *mustache, FIOBJ data,
+                          int (*on_chunk)(fio_str_info_s chunk, void *udata),
+                          void *udata) {
+  if (!mustache || !on_chunk)
+    return -1;
+  fiobj_mustache_writer_s w = {
+      .dest = fiobj_str_buf(FIOBJ_MUSTACHE_CHUNK_SIZE + 512),
+      .names = mustache->udata,
+      .on_chunk = on_chunk,
+      .udata = udata,
+  };
+  int ret =
+      mustache_build(mustache, .udata1 = (void *)&w, .udata2 = (void *)data);
+  fio_str_info_s rest = fiobj_obj2cstr(w.dest);
+  if (!ret && rest.len)
+    ret = on_chunk(rest, udata);
+  fiobj_free(w.dest);
+  return ret;
 }
 
 /* *****************************************************************************
@@ -85,11 +210,8 @@ static inline FIOBJ fiobj_mustache_find_obj_absolute(FIOBJ parent, FIOBJ key) {
   return o;
 }
 
-static inline FIOBJ fiobj_mustache_find_obj_tree(mustache_section_s *section,
-                                                 const char *name,
-                                                 uint32_t name_len) {
-  FIOBJ key = fiobj_str_tmp();
-  fiobj_str_write(key, name, name_len);
+static inline FIOBJ fiobj_mustache_find_key_tree(mustache_section_s *section,
+                                                 FIOBJ key) {
   do {
     FIOBJ tmp = fiobj_mustache_find_obj_absolute((FIOBJ)section->udata2, key);
     if (tmp != FIOBJ_INVALID) {
@@ -99,9 +221,48 @@ static inline FIOBJ fiobj_mustache_find_obj_tree(mustache_section_s *section,
   return FIOBJ_INVALID;
 }
 
+static inline FIOBJ fiobj_mustache_find_obj_tree(mustache_section_s *section,
+                                                 const char *name,
+                                                 uint32_t name_len) {
+  FIOBJ key = fiobj_str_tmp();
+  fiobj_str_write(key, name, name_len);
+  return fiobj_mustache_find_key_tree(section, key);
+}
+
+/* performs the same lookup as `fiobj_mustache_find_obj`, using compiled keys */
+static inline FIOBJ fiobj_mustache_find_compiled(mustache_section_s *section,
+                                                 FIOBJ keys) {
+  if (!FIOBJ_TYPE_IS(keys, FIOBJ_T_ARRAY))
+    return fiobj_mustache_find_key_tree(section, keys);
+  FIOBJ tmp = fiobj_mustache_find_key_tree(section, fiobj_ary_index(keys, 0));
+  if (tmp != FIOBJ_INVALID)
+    return tmp;
+  tmp = fiobj_mustache_find_key_tree(section, fiobj_ary_index(keys, 1));
+  if (!tmp)
+    return FIOBJ_INVALID;
+  const size_t count = fiobj_ary_count(keys);
+  for (size_t i = 2;; i += 2) {
+    FIOBJ obj = fiobj_mustache_find_obj_absolute(tmp, fiobj_ary_index(keys, i));
+    if (obj != FIOBJ_INVALID)
+      return obj;
+    if (i + 1 >= count)
+      return FIOBJ_INVALID;
+    tmp = fiobj_mustache_find_obj_absolute(tmp, fiobj_ary_index(keys, i + 1));
+    if (tmp == FIOBJ_INVALID)
+      return FIOBJ_INVALID;
+  }
+}
+
 static inline FIOBJ fiobj_mustache_find_obj(mustache_section_s *section,
                                             const char *name,
                                             uint32_t name_len) {
+  fiobj_mustache_names_s *n =
+      ((fiobj_mustache_writer_s *)section->udata1)->names;
+  if (n) {
+    const uint32_t pos = mustache_section_instruction(section);
+    if (pos < n->count && n->names[pos])
+      return fiobj_mustache_find_compiled(section, n->names[pos]);
+  }
   FIOBJ tmp = fiobj_mustache_find_obj_tree(section, name, name_len);
   if (tmp != FIOBJ_INVALID)
     return tmp;
@@ -169,8 +330,16 @@ static int mustache_on_arg(mustache_section_s *section, const char *name,
  */
 static int mustache_on_text(mustache_section_s *section, const char *data,
                             uint32_t data_len) {
-  FIOBJ dest = (FIOBJ)section->udata1;
-  fiobj_str_write(dest, data, data_len);
+  fiobj_mustache_writer_s *w = section->udata1;
+  fiobj_str_write(w->dest, data, data_len);
+  if (w->on_chunk) {
+    fio_str_info_s s = fiobj_obj2cstr(w->dest);
+    if (s.len >= FIOBJ_MUSTACHE_CHUNK_SIZE) {
+      if (w->on_chunk(s, w->udata) == -1)
+        return -1;
+      fiobj_str_resize(w->dest, 0);
+    }
+  }
   return 0;
 }
 
@@ -216,8 +385,8 @@ static int mustache_on_section_start(mustache_section_s *section,
                                      char const *name, uint32_t name_len,
                                      uint32_t index) {
   FIOBJ o = fiobj_mustache_find_obj(section, name, name_len);
-  if (!o)
-    return -1;
+  if (!o) /* inverted sections are performed for missing values */
+    return 0;
   if (FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY))
     section->udata2 = (void *)fiobj_ary_index(o, index);
   else
@@ -253,6 +422,17 @@ static inline void mustache_save2file(char const *filename, char const *data,
   close(fd);
 }
 
+static int mustache_test_on_chunk(fio_str_info_s chunk, void *udata) {
+  fiobj_str_write((FIOBJ)udata, chunk.data, chunk.len);
+  return 0;
+}
+
+static int mustache_test_on_chunk_stop(fio_str_info_s chunk, void *udata) {
+  return -1;
+  (void)chunk;
+  (void)udata;
+}
+
 void fiobj_mustache_test(void) {
 #define TEST_ASSERT(cond, ...)                                                 \
   if (!(cond)) {                                                               \
@@ -298,11 +478,76 @@ void fiobj_mustache_test(void) {
   fiobj_hash_set(ary, key, fiobj_str_new("dot notation success", 20));
   fiobj_free(key);
   key = fiobj_mustache_build(m, data);
-  fiobj_free(data);
   TEST_ASSERT(key, "fiobj_mustache_build failed!\n");
   fprintf(stderr, "%s\n", fiobj_obj2cstr(key).data);
+  TEST_ASSERT(!strcmp(fiobj_obj2cstr(key).data,
+                      "* Users:\r\n0. User 0 (User&#32;0)\r\n"
+                      "1. User 1 (User&#32;1)\r\n2. User 2 (User&#32;2)\r\n"
+                      "3. User 3 (User&#32;3)\r\n"
+                      "Nested: dot notation success."),
+              "fiobj_mustache_build output error!\n");
+  fiobj_free(key);
+  fiobj_mustache_free(m);
+
+  fprintf(stderr, "=== Testing compiled mustache names\n");
+  template = "{{#nested}}{{&item}}{{/nested}}|{{&nested.item}}|{{nested.none}}"
+             "|{{^missing}}none{{/missing}}|"
+             "{{#users}}{{{nested.item}}}{{/users}}";
+  m = fiobj_mustache_new(.data = template, .data_len = strlen(template));
+  TEST_ASSERT(m, "fiobj_mustache_new failed.\n");
+  key = fiobj_mustache_build(m, data);
+  TEST_ASSERT(!strcmp(fiobj_obj2cstr(key).data,
+                      "dot notation success|dot notation success||none|"
+                      "dot notation successdot notation success"
+                      "dot notation successdot notation success"),
+              "compiled mustache output error: %s\n", fiobj_obj2cstr(key).data);
+  {
+    /* the name based (uncompiled) lookup should render the same output */
+    mustache_s *raw =
+        mustache_load(.data = template, .data_len = strlen(template));
+    FIOBJ tmp = fiobj_mustache_build2(fiobj_str_buf(0), raw, data);
+    TEST_ASSERT(fiobj_iseq(tmp, key), "uncompiled mustache output error: %s\n",
+                fiobj_obj2cstr(tmp).data);
+    fiobj_free(tmp);
+    mustache_free(raw);
+  }
   fiobj_free(key);
   fiobj_mustache_free(m);
+  fprintf(stderr, "* passed.\n");
+
+  fprintf(stderr, "=== Testing mustache streaming\n");
+  template =
+      "{{#users}}<li>{{id}}: {{name}} ({{nested.item}})</li>\n{{/users}}";
+  m = fiobj_mustache_new(.data = template, .data_len = strlen(template));
+  ary = fiobj_hash_get2(data, fiobj_hash_string("users", 5));
+  for (int i = 4; i < 2048; ++i) {
+    FIOBJ usr = fiobj_hash_new2(2);
+    FIOBJ id = fiobj_str_buf(8);
+    fiobj_str_write_i(id, i);
+    key = fiobj_str_new("id", 2);
+    fiobj_hash_set(usr, key, id);
+    fiobj_free(key);
+    fiobj_ary_push(ary, usr);
+  }
+  {
+    FIOBJ expected = fiobj_mustache_build(m, data);
+    FIOBJ streamed = fiobj_str_buf(0);
+    TEST_ASSERT(fiobj_obj2cstr(expected).len > FIOBJ_MUSTACHE_CHUNK_SIZE * 2,
+                "mustache streaming test output too short.\n");
+    TEST_ASSERT(!fiobj_mustache_stream(m, data, mustache_test_on_chunk,
+                                       (void *)streamed),
+                "fiobj_mustache_stream failed!\n");
+    TEST_ASSERT(fiobj_iseq(streamed, expected),
+                "fiobj_mustache_stream output error!\n");
+    fiobj_free(streamed);
+    fiobj_free(expected);
+  }
+  TEST_ASSERT(fiobj_mustache_stream(m, data, mustache_test_on_chunk_stop,
+                                    NULL) == -1,
+              "fiobj_mustache_stream should stop when `on_chunk` fails.\n");
+  fiobj_mustache_free(m);
+  fiobj_free(data);
+  fprintf(stderr, "* passed.\n");
 }
 
 #endif
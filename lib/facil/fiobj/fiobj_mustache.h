@@ -9,12 +9,21 @@ License: MIT
 
 #include <mustache_parser.h>
 
+#ifndef FIOBJ_MUSTACHE_CHUNK_SIZE
+/** The (approximate) size of the chunks passed to `fiobj_mustache_stream`. */
+#define FIOBJ_MUSTACHE_CHUNK_SIZE 16384
+#endif
+
 /**
  * Loads a mustache template, converting it into an opaque instruction array.
  *
  * Returns a pointer to the instruction array or NULL (on error).
  *
  * The `filename` argument should contain the template's file name.
+ *
+ * Templates are compiled once loaded: argument and section names are converted
+ * to pre-hashed (interned) keys, so rendering doesn't hash names, and the
+ * template's static text length is used to size the rendered output.
  */
 mustache_s *fiobj_mustache_load(fio_str_info_s filename);
 
@@ -55,6 +64,21 @@ FIOBJ fiobj_mustache_build(mustache_s *mustache, FIOBJ data);
  */
 FIOBJ fiobj_mustache_build2(FIOBJ dest, mustache_s *mustache, FIOBJ data);
 
+/**
+ * Renders a template using the information in the `data` object, passing the
+ * output to the `on_chunk` callback in chunks of about
+ * `FIOBJ_MUSTACHE_CHUNK_SIZE` bytes, rather than creating a String containing
+ * the whole output.
+ *
+ * The chunk's data is only valid until the callback returns. If the callback
+ * returns -1, rendering stops.
+ *
+ * Returns -1 if an error occurred and 0 on success.
+ */
+int fiobj_mustache_stream(mustache_s *mustache, FIOBJ data,
+                          int (*on_chunk)(fio_str_info_s chunk, void *udata),
+                          void *udata);
+
 #if DEBUG
 void fiobj_mustache_test(void);
 #endif
@@ -26,6 +26,7 @@ License: MIT
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <string.h>
 #include <sys/stat.h>
 
@@ -37,6 +38,18 @@ License: MIT
 #define PATH_MAX PAGE_SIZE
 #endif
 
+#ifndef FIOBJ_STR_CACHE
+/**
+ * The number of String object containers each thread keeps for reuse (0
+ * disables the cache).
+ *
+ * Short Strings are stored within the container, so short lived Strings (i.e.,
+ * header names and values) are usually created and freed without calling the
+ * allocator.
+ */
+#define FIOBJ_STR_CACHE 64
+#endif
+
 /* *****************************************************************************
 String Type
 ***************************************************************************** */
@@ -53,6 +66,80 @@ static inline fio_str_info_s fiobj_str_get_cstr(const FIOBJ o) {
   return fio_str_info(&obj2str(o)->str);
 }
 
+/* *****************************************************************************
+String container cache (per thread)
+***************************************************************************** */
+
+#if FIOBJ_STR_CACHE
+typedef struct {
+  size_t count;
+  /* 0 == unregistered, 1 == active, 2 == thread exiting (don't cache) */
+  uint8_t state;
+  fiobj_str_s *objs[FIOBJ_STR_CACHE];
+} fiobj_str_cache_s;
+
+static __thread fiobj_str_cache_s fiobj_str_cache;
+static pthread_key_t fiobj_str_cache_key;
+static uint8_t fiobj_str_cache_key_valid;
+static pthread_once_t fiobj_str_cache_once = PTHREAD_ONCE_INIT;
+
+/* frees the cached containers, called when a thread exits. */
+static void fiobj_str_cache_destroy(void *cache_) {
+  fiobj_str_cache_s *cache = cache_;
+  cache->state = 2;
+  while (cache->count)
+    fio_free(cache->objs[--cache->count]);
+}
+
+/* thread destructors aren't called for the main thread */
+static void fiobj_str_cache_at_exit(void *ignr_) {
+  fiobj_str_cache_destroy(&fiobj_str_cache);
+  (void)ignr_;
+}
+
+static void fiobj_str_cache_init(void) {
+  fiobj_str_cache_key_valid =
+      !pthread_key_create(&fiobj_str_cache_key, fiobj_str_cache_destroy);
+  fio_state_callback_add(FIO_CALL_AT_EXIT, fiobj_str_cache_at_exit, NULL);
+}
+#endif
+
+/* allocates a String container (the caller initializes it) */
+static inline fiobj_str_s *fiobj_str_alloc(void) {
+#if FIOBJ_STR_CACHE
+  if (fiobj_str_cache.count)
+    return fiobj_str_cache.objs[--fiobj_str_cache.count];
+#endif
+  fiobj_str_s *s = fio_malloc(sizeof(*s));
+  if (!s) {
+    perror("ERROR: fiobj string couldn't allocate memory");
+    exit(errno);
+  }
+  return s;
+}
+
+/* frees (or caches) a String container */
+static inline void fiobj_str_release(fiobj_str_s *s) {
+#if FIOBJ_STR_CACHE
+  if (!fiobj_str_cache.state) {
+    /* register the thread's exit destructor before caching anything */
+    pthread_once(&fiobj_str_cache_once, fiobj_str_cache_init);
+    fiobj_str_cache.state =
+        (fiobj_str_cache_key_valid &&
+         !pthread_setspecific(fiobj_str_cache_key, &fiobj_str_cache))
+            ? 1
+            : 2;
+  }
+  /* region memory is released by `fio_region_reset`, it can't be reused */
+  if (fiobj_str_cache.state == 1 && fiobj_str_cache.count < FIOBJ_STR_CACHE &&
+      !fio_region_owns(s)) {
+    fiobj_str_cache.objs[fiobj_str_cache.count++] = s;
+    return;
+  }
+#endif
+  fio_free(s);
+}
+
 /* *****************************************************************************
 String VTables
 ***************************************************************************** */
@@ -63,7 +150,7 @@ static fio_str_info_s fio_str2str(const FIOBJ o) {
 
 static void fiobj_str_dealloc(FIOBJ o, void (*task)(FIOBJ, void *), void *arg) {
   fio_str_free(&obj2str(o)->str);
-  fio_free(FIOBJ2PTR(o));
+  fiobj_str_release(obj2str(o));
   (void)task;
   (void)arg;
 }
@@ -109,11 +196,7 @@ FIOBJ fiobj_str_buf(size_t capa) {
   else
     capa = PAGE_SIZE;
 
-  fiobj_str_s *s = fio_malloc(sizeof(*s));
-  if (!s) {
-    perror("ERROR: fiobj string couldn't allocate memory");
-    exit(errno);
-  }
+  fiobj_str_s *s = fiobj_str_alloc();
   *s = (fiobj_str_s){
       .head =
           {
@@ -130,11 +213,7 @@ FIOBJ fiobj_str_buf(size_t capa) {
 
 /** Creates a String object. Remember to use `fiobj_free`. */
 FIOBJ fiobj_str_new(const char *str, size_t len) {
-  fiobj_str_s *s = fio_malloc(sizeof(*s));
-  if (!s) {
-    perror("ERROR: fiobj string couldn't allocate memory");
-    exit(errno);
-  }
+  fiobj_str_s *s = fiobj_str_alloc();
   *s = (fiobj_str_s){
       .head =
           {
@@ -160,11 +239,7 @@ FIOBJ fiobj_str_new(const char *str, size_t len) {
  * zero.
  */
 FIOBJ fiobj_str_move(char *str, size_t len, size_t capacity) {
-  fiobj_str_s *s = fio_malloc(sizeof(*s));
-  if (!s) {
-    perror("ERROR: fiobj string couldn't allocate memory");
-    exit(errno);
-  }
+  fiobj_str_s *s = fiobj_str_alloc();
   *s = (fiobj_str_s){
       .head =
           {
@@ -176,6 +251,103 @@ FIOBJ fiobj_str_move(char *str, size_t len, size_t capacity) {
   return ((uintptr_t)s | FIOBJECT_STRING_FLAG);
 }
 
+/* *****************************************************************************
+Interned Strings
+***************************************************************************** */
+
+#define FIO_SET_NAME fiobj_str_intern_set
+#define FIO_SET_OBJ_TYPE FIOBJ
+#define FIO_SET_OBJ_COMPARE(o1, o2)                                            \
+  fio_str_iseq(&obj2str((o1))->str, &obj2str((o2))->str)
+#define FIO_SET_OBJ_DESTROY(obj) fiobj_free((obj))
+#include <fio.h>
+
+#if FIOBJ_STR_INTERN_STRIPES & (FIOBJ_STR_INTERN_STRIPES - 1)
+#error FIOBJ_STR_INTERN_STRIPES must be a power of 2
+#endif
+
+/* the table is striped by hash value, each stripe with its own lock */
+typedef struct {
+  fiobj_str_intern_set_s set;
+  fio_lock_i lock;
+} fiobj_str_intern_stripe_s;
+static fiobj_str_intern_stripe_s fiobj_str_interned[FIOBJ_STR_INTERN_STRIPES];
+static volatile size_t fiobj_str_interned_count;
+static volatile uint8_t fiobj_str_interned_registered;
+
+/* the sets use the lower bits of the hash value, stripes use the upper bits */
+#define FIOBJ_STR_INTERN_STRIPE(hash)                                          \
+  (&fiobj_str_interned[((hash) >> 48) & (FIOBJ_STR_INTERN_STRIPES - 1)])
+
+static void fiobj_str_intern_at_exit(void *ignr_) {
+  for (size_t i = 0; i < FIOBJ_STR_INTERN_STRIPES; ++i) {
+    fio_lock(&fiobj_str_interned[i].lock);
+    fiobj_str_intern_set_free(&fiobj_str_interned[i].set);
+    fio_unlock(&fiobj_str_interned[i].lock);
+  }
+  fiobj_str_interned_count = 0;
+  (void)ignr_;
+}
+
+static void fiobj_str_intern_on_fork(void *ignr_) {
+  for (size_t i = 0; i < FIOBJ_STR_INTERN_STRIPES; ++i)
+    fiobj_str_interned[i].lock = FIO_LOCK_INIT;
+  (void)ignr_;
+}
+
+/* a new frozen String with its hash value precomputed */
+static inline FIOBJ fiobj_str_new_frozen(const char *str, size_t len,
+                                         uint64_t hash) {
+  FIOBJ o = fiobj_str_new(str, len);
+  obj2str(o)->hash = hash;
+  fiobj_str_freeze(o);
+  return o;
+}
+
+/**
+ * Returns a shared, frozen (immutable) String object with the requested data,
+ * with its hash value precomputed. Remember to use `fiobj_free`.
+ */
+FIOBJ fiobj_str_intern(const char *str, size_t len) {
+  const uint64_t hash = fiobj_hash_string(str, len);
+  if (len > FIOBJ_STR_INTERN_MAX_LEN)
+    return fiobj_str_new_frozen(str, len, hash);
+  /* a stack allocated String, used for the lookup */
+  fiobj_str_s tmp = {
+      .head = {.ref = 1, .type = FIOBJ_T_STRING},
+      .hash = hash,
+      .str = FIO_STR_INIT_STATIC2(str, len),
+  };
+  FIOBJ o;
+  /* the table (and its Strings) must outlive any active memory region */
+  fio_region_s *old = fio_region_set(NULL);
+  fiobj_str_intern_stripe_s *stripe = FIOBJ_STR_INTERN_STRIPE(hash);
+  fio_lock(&stripe->lock);
+  o = fiobj_str_intern_set_find(&stripe->set, hash,
+                                ((uintptr_t)&tmp | FIOBJECT_STRING_FLAG));
+  if (o) {
+    fiobj_dup(o);
+    goto finish;
+  }
+  o = fiobj_str_new_frozen(str, len, hash);
+  if (fio_atomic_add(&fiobj_str_interned_count, 1) > FIOBJ_STR_INTERN_LIMIT) {
+    fio_atomic_sub(&fiobj_str_interned_count, 1);
+    goto finish;
+  }
+  if (!fiobj_str_interned_registered &&
+      !fio_atomic_xchange(&fiobj_str_interned_registered, 1)) {
+    fio_state_callback_add(FIO_CALL_AT_EXIT, fiobj_str_intern_at_exit, NULL);
+    fio_state_callback_add(FIO_CALL_IN_CHILD, fiobj_str_intern_on_fork, NULL);
+  }
+  /* the table keeps a reference (interned Strings are used by any thread) */
+  fiobj_share(o);
+  fiobj_str_intern_set_insert(&stripe->set, hash, fiobj_dup(o));
+finish:
+  fio_unlock(&stripe->lock);
+  fio_region_set(old);
+  return o;
+}
+
 /**
  * Returns a thread-static temporary string. Avoid calling `fiobj_dup` or
  * `fiobj_free`.
@@ -415,6 +587,67 @@ void fiobj_test_string(void) {
               fiobj_obj2cstr(o).data);
   fiobj_free(o);
 
+#if FIOBJ_STR_CACHE
+  {
+    /* short Strings fit in the container, which is reused once freed */
+    FIOBJ tmp = fiobj_str_new("content-type", 12);
+    TEST_ASSERT(obj2str(tmp)->str.small, "a header name isn't small\n");
+    fiobj_free(tmp);
+    o = fiobj_str_new("text/html", 9);
+    TEST_ASSERT(o == tmp, "String container wasn't reused\n");
+    TEST_ASSERT(!obj2str(o)->hash && fiobj_obj2cstr(o).len == 9 &&
+                    !memcmp(fiobj_obj2cstr(o).data, "text/html", 9) &&
+                    !obj2str(o)->str.frozen,
+                "reused String container wasn't reinitialized\n");
+    fiobj_free(o);
+  }
+#endif
+
+  {
+    /* interned Strings are shared, frozen and their hash is precomputed */
+    FIOBJ i1 = fiobj_str_intern("content-length", 14);
+    FIOBJ i2 = fiobj_str_intern("content-length", 14);
+    TEST_ASSERT(i1 == i2, "interned Strings should be the same object\n");
+    TEST_ASSERT(obj2str(i1)->str.frozen, "interned String isn't frozen\n");
+    TEST_ASSERT(obj2str(i1)->hash == fiobj_hash_string("content-length", 14),
+                "interned String hash wasn't precomputed\n");
+    o = fiobj_str_intern("content-type", 12);
+    TEST_ASSERT(o != i1 && fiobj_obj2cstr(o).len == 12,
+                "different interned Strings collide\n");
+    fiobj_free(o);
+    fiobj_free(i2);
+    fiobj_free(i1);
+    /* the table is striped by hash value */
+    FIOBJ names[64];
+    for (size_t i = 0; i < 64; ++i) {
+      char buf[16];
+      int l = snprintf(buf, sizeof(buf), "x-intern-%zu", i);
+      names[i] = fiobj_str_intern(buf, l);
+    }
+    size_t used = 0;
+    for (size_t i = 0; i < FIOBJ_STR_INTERN_STRIPES; ++i)
+      used += !!fiobj_str_intern_set_count(&fiobj_str_interned[i].set);
+    TEST_ASSERT(FIOBJ_STR_INTERN_STRIPES == 1 || used > 1,
+                "interned Strings should be spread over the table's stripes\n");
+    for (size_t i = 0; i < 64; ++i) {
+      char buf[16];
+      int l = snprintf(buf, sizeof(buf), "x-intern-%zu", i);
+      o = fiobj_str_intern(buf, l);
+      TEST_ASSERT(o == names[i], "interned String (%zu) wasn't found\n", i);
+      fiobj_free(o);
+      fiobj_free(names[i]);
+    }
+    char long_str[FIOBJ_STR_INTERN_MAX_LEN + 1];
+    memset(long_str, 'a', sizeof(long_str));
+    i1 = fiobj_str_intern(long_str, sizeof(long_str));
+    i2 = fiobj_str_intern(long_str, sizeof(long_str));
+    TEST_ASSERT(i1 != i2 && obj2str(i1)->str.frozen &&
+                    fiobj_iseq(i1, i2),
+                "long Strings shouldn't be interned\n");
+    fiobj_free(i2);
+    fiobj_free(i1);
+  }
+
   fprintf(stderr, "* passed.\n");
 }
 #endif
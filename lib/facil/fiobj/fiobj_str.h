@@ -13,6 +13,31 @@ extern "C" {
 
 #define FIOBJ_IS_STRING(obj) FIOBJ_TYPE_IS((obj), FIOBJ_T_STRING)
 
+#ifndef FIOBJ_STR_INTERN_LIMIT
+/**
+ * The maximum number of interned Strings (see `fiobj_str_intern`).
+ *
+ * The limit prevents untrusted data (i.e., random header names) from growing
+ * the table indefinitely.
+ */
+#define FIOBJ_STR_INTERN_LIMIT 4096
+#endif
+
+#ifndef FIOBJ_STR_INTERN_MAX_LEN
+/** The maximum length of an interned String (see `fiobj_str_intern`). */
+#define FIOBJ_STR_INTERN_MAX_LEN 64
+#endif
+
+#ifndef FIOBJ_STR_INTERN_STRIPES
+/**
+ * The number of separately locked parts of the interned Strings table (see
+ * `fiobj_str_intern`), so threads interning different Strings rarely contend.
+ *
+ * Must be a power of 2.
+ */
+#define FIOBJ_STR_INTERN_STRIPES 16
+#endif
+
 /* *****************************************************************************
 API: Creating a String Object
 ***************************************************************************** */
@@ -56,6 +81,21 @@ FIOBJ fiobj_str_move(char *str, size_t len, size_t capacity);
  */
 FIOBJ fiobj_str_tmp(void);
 
+/**
+ * Returns a shared, frozen (immutable) String object with the requested data,
+ * with its hash value precomputed. Remember to use `fiobj_free`.
+ *
+ * Interned Strings are kept in a global (thread safe) table, so calling the
+ * function again with the same data returns the same object (with its
+ * reference count incremented). This is useful for repeating keys, such as
+ * header names or JSON object keys.
+ *
+ * Strings longer than `FIOBJ_STR_INTERN_MAX_LEN` bytes, or any new Strings once
+ * the table holds `FIOBJ_STR_INTERN_LIMIT` Strings, aren't interned. A new
+ * (frozen) String is returned instead.
+ */
+FIOBJ fiobj_str_intern(const char *str, size_t len);
+
 /* *****************************************************************************
 API: Editing a String
 ***************************************************************************** */
@@ -378,6 +378,31 @@ finish:
   return packet.counter;
 }
 
+/* *****************************************************************************
+Sharing objects (between threads)
+***************************************************************************** */
+#include <fiobj_hash.h>
+
+static int fiobj_share_task(FIOBJ o, void *arg) {
+  if (FIOBJ_IS_ALLOCATED(o) && !FIOBJECT2HEAD(o)->shared)
+    FIOBJECT2HEAD(o)->shared = 1;
+  o = fiobj_hash_key_in_loop();
+  if (FIOBJ_IS_ALLOCATED(o) && !FIOBJECT2HEAD(o)->shared)
+    FIOBJECT2HEAD(o)->shared = 1;
+  return 0;
+  (void)arg;
+}
+
+/**
+ * Marks the object and any of it's "children" as shared, so they can be
+ * referenced by more than a single thread at the same time.
+ */
+FIOBJ fiobj_share(FIOBJ o) {
+  if (FIOBJ_IS_ALLOCATED(o) && !FIOBJECT2HEAD(o)->shared)
+    fiobj_each2(o, fiobj_share_task, NULL);
+  return o;
+}
+
 /* *****************************************************************************
 Free complex objects (objects with nesting)
 ***************************************************************************** */
@@ -535,6 +560,15 @@ static int fiobject_test_task(FIOBJ o, void *arg) {
   (void)o;
 }
 
+static void *fiobj_test_share_task(void *o_) {
+  FIOBJ o = (FIOBJ)o_;
+  for (size_t i = 0; i < 100000; ++i) {
+    fiobj_free(fiobj_dup(fiobj_dup(o)));
+    fiobj_free(o);
+  }
+  return NULL;
+}
+
 void fiobj_test_core(void) {
 #define TEST_ASSERT(cond, ...)                                                 \
   if (!(cond)) {                                                               \
@@ -614,6 +648,40 @@ void fiobj_test_core(void) {
   TEST_ASSERT(!fiobj_iseq(fiobj_null(), fiobj_true()),
               "fiobj_null eqal to fiobj_true!");
   fprintf(stderr, "* passed.\n");
+  fprintf(stderr, "=== Testing sharing objects between threads\n");
+  o = fiobj_hash_new();
+  key = fiobj_str_new("shared key", 10);
+  tmp = fiobj_ary_new();
+  fiobj_ary_push(tmp, fiobj_str_new("nested", 6));
+  fiobj_hash_set(o, key, tmp);
+  TEST_ASSERT(!FIOBJECT2HEAD(o)->shared && !FIOBJECT2HEAD(tmp)->shared,
+              "new objects shouldn't be shared!\n");
+  TEST_ASSERT(fiobj_share(o) == o, "fiobj_share should return the object\n");
+  TEST_ASSERT(FIOBJECT2HEAD(o)->shared && FIOBJECT2HEAD(tmp)->shared &&
+                  FIOBJECT2HEAD(key)->shared &&
+                  FIOBJECT2HEAD(fiobj_ary_index(tmp, 0))->shared,
+              "fiobj_share should share nested objects and keys!\n");
+  fiobj_free(key);
+  key = fiobj_str_new("added", 5);
+  fiobj_ary_push(tmp, fiobj_num_new_bignum(42));
+  fiobj_hash_set(o, key, fiobj_str_new("value", 5));
+  TEST_ASSERT(FIOBJECT2HEAD(key)->shared &&
+                  FIOBJECT2HEAD(fiobj_ary_index(tmp, -1))->shared &&
+                  FIOBJECT2HEAD(fiobj_hash_get(o, key))->shared,
+              "objects added to shared collections should be shared!\n");
+  fiobj_free(key);
+  {
+    void *threads[4];
+    for (size_t i = 0; i < 4; ++i)
+      threads[i] = fio_thread_new(fiobj_test_share_task, (void *)tmp);
+    for (size_t i = 0; i < 4; ++i)
+      fio_thread_join(threads[i]);
+    TEST_ASSERT(FIOBJECT2HEAD(tmp)->ref == 1,
+                "shared reference count error (%u)!\n",
+                (unsigned int)FIOBJECT2HEAD(tmp)->ref);
+  }
+  fiobj_free(o);
+  fprintf(stderr, "* passed.\n");
 }
 
 #endif
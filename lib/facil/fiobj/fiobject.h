@@ -39,6 +39,21 @@ types, abstracting some complexity and making dynamic type related tasks easier.
 #define FIO_GNUC_BYPASS 1
 #endif
 
+#ifndef FIOBJ_THREAD_OWNED
+/**
+ * If true, objects use plain (non-atomic) reference counting until they are
+ * shared using `fiobj_share` (atomic reference counting is used from then on).
+ *
+ * This requires that objects are shared before more than a single thread might
+ * reference them at the same time (i.e., global objects and caches). Objects
+ * that are handed over (where the sending thread no longer uses the object),
+ * such as objects passed along to `fio_defer`, don't need to be shared.
+ *
+ * By default, all objects use atomic reference counting.
+ */
+#define FIOBJ_THREAD_OWNED 0
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -112,6 +127,20 @@ FIO_INLINE FIOBJ fiobj_dup(FIOBJ);
  */
 FIO_INLINE void fiobj_free(FIOBJ);
 
+/**
+ * Marks the object and any of it's "children" as shared, so they can be
+ * referenced by more than a single thread at the same time.
+ *
+ * Objects added to a shared collection (Array or Hash) are shared as well.
+ *
+ * This is only required when `FIOBJ_THREAD_OWNED` is true (see above). It
+ * must be called by the thread that owns the object, before the object is
+ * made available to other threads.
+ *
+ * Always returns the value passed along.
+ */
+FIOBJ fiobj_share(FIOBJ);
+
 /**
  * Tests if an object evaluates as TRUE.
  *
@@ -327,6 +356,8 @@ typedef struct {
 typedef struct {
   /* must be first */
   fiobj_type_enum type;
+  /* set once the object might be referenced by more than a single thread */
+  uint8_t shared;
   /* reference counter */
   uint32_t ref;
 } fiobj_object_header_s;
@@ -370,21 +401,27 @@ Atomic reference counting
 
 /* C11 Atomics are defined? */
 #if defined(__ATOMIC_RELAXED)
-/** An atomic addition operation */
-#define fiobj_ref_inc(o)                                                       \
-  __atomic_add_fetch(&FIOBJECT2HEAD(o)->ref, 1, __ATOMIC_SEQ_CST)
-/** An atomic subtraction operation */
-#define fiobj_ref_dec(o)                                                       \
-  __atomic_sub_fetch(&FIOBJECT2HEAD(o)->ref, 1, __ATOMIC_SEQ_CST)
+/**
+ * An atomic addition operation (a new reference is always derived from an
+ * existing one, so no ordering is required).
+ */
+#define fiobj_ref_inc_atomic(o)                                                \
+  __atomic_add_fetch(&FIOBJECT2HEAD(o)->ref, 1, __ATOMIC_RELAXED)
+/**
+ * An atomic subtraction operation (the last reference must observe all the
+ * other threads' writes before the object is deallocated).
+ */
+#define fiobj_ref_dec_atomic(o)                                                \
+  __atomic_sub_fetch(&FIOBJECT2HEAD(o)->ref, 1, __ATOMIC_ACQ_REL)
 
 /* Select the correct compiler builtin method. */
 #elif defined(__has_builtin) && !FIO_GNUC_BYPASS
 
 #if __has_builtin(__sync_fetch_and_or)
 /** An atomic addition operation */
-#define fiobj_ref_inc(o) __sync_add_and_fetch(&FIOBJECT2HEAD(o)->ref, 1)
+#define fiobj_ref_inc_atomic(o) __sync_add_and_fetch(&FIOBJECT2HEAD(o)->ref, 1)
 /** An atomic subtraction operation */
-#define fiobj_ref_dec(o) __sync_sub_and_fetch(&FIOBJECT2HEAD(o)->ref, 1)
+#define fiobj_ref_dec_atomic(o) __sync_sub_and_fetch(&FIOBJECT2HEAD(o)->ref, 1)
 
 #else
 #error missing required atomic options.
@@ -392,17 +429,40 @@ Atomic reference counting
 
 #elif __GNUC__ > 3
 /** An atomic addition operation */
-#define fiobj_ref_inc(o) __sync_add_and_fetch(&FIOBJECT2HEAD(o)->ref, 1)
+#define fiobj_ref_inc_atomic(o) __sync_add_and_fetch(&FIOBJECT2HEAD(o)->ref, 1)
 /** An atomic subtraction operation */
-#define fiobj_ref_dec(o) __sync_sub_and_fetch(&FIOBJECT2HEAD(o)->ref, 1)
+#define fiobj_ref_dec_atomic(o) __sync_sub_and_fetch(&FIOBJECT2HEAD(o)->ref, 1)
 
 #else
 #error missing required atomic options.
 #endif
 
+#if FIOBJ_THREAD_OWNED
+/* objects that weren't shared use plain (non-atomic) reference counting */
+#define fiobj_ref_inc(o)                                                       \
+  (FIOBJECT2HEAD(o)->shared ? fiobj_ref_inc_atomic(o)                          \
+                            : ++FIOBJECT2HEAD(o)->ref)
+#define fiobj_ref_dec(o)                                                       \
+  (FIOBJECT2HEAD(o)->shared ? fiobj_ref_dec_atomic(o)                          \
+                            : --FIOBJECT2HEAD(o)->ref)
+#else
+#define fiobj_ref_inc(o) fiobj_ref_inc_atomic(o)
+#define fiobj_ref_dec(o) fiobj_ref_dec_atomic(o)
+#endif
+
 #define OBJREF_ADD(o) fiobj_ref_inc(o)
 #define OBJREF_REM(o) fiobj_ref_dec(o)
 
+/**
+ * Objects placed in a shared collection (Array or Hash) are shared as well
+ * (used internally).
+ */
+FIO_INLINE void fiobj___share_nested(FIOBJ collection, FIOBJ o) {
+  if (FIOBJECT2HEAD(collection)->shared && FIOBJ_IS_ALLOCATED(o) &&
+      !FIOBJECT2HEAD(o)->shared)
+    fiobj_share(o);
+}
+
 /* *****************************************************************************
 Inlined Functions
 ***************************************************************************** */
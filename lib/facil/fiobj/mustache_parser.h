@@ -122,6 +122,26 @@ inline MUSTACHE_FUNC void mustache_free(mustache_s *mustache) {
   free(mustache);
 }
 
+/** Returns the number of instructions in the template. */
+static inline uint32_t mustache_instruction_count(mustache_s *mustache);
+
+/**
+ * Returns the name of the argument / section tag at the instruction position
+ * `pos` (see `mustache_section_instruction`), or NULL if the instruction isn't
+ * a named tag. The name's length is placed in `p_len`.
+ *
+ * This allows data to be cached per tag before the template is rendered.
+ */
+static inline const char *mustache_instruction_name(mustache_s *mustache,
+                                                    uint32_t pos,
+                                                    uint32_t *p_len);
+
+/**
+ * Returns the total length of the template's static text (the text written
+ * regardless of the data), which can be used to size the rendered output.
+ */
+static inline size_t mustache_text_length(mustache_s *mustache);
+
 /** Arguments for the `mustache_build` function. */
 typedef struct {
   /** The parsed template (an instruction collection). */
@@ -182,6 +202,16 @@ Callbacks Helpers - These functions can be called from within callbacks
 static inline mustache_section_s *
 mustache_section_parent(mustache_section_s *section);
 
+/**
+ * Returns the position of the instruction being performed (the tag that invoked
+ * the callback) within the template's instruction array.
+ *
+ * The position is unique per argument / section tag, allowing implementations
+ * to cache data per tag (i.e., a pre-hashed version of the tag's name).
+ */
+static inline uint32_t
+mustache_section_instruction(mustache_section_s *section);
+
 /**
  * This helper function should be used to write text to the output
  * stream form within `mustache_on_arg` or `mustache_on_section_test`.
@@ -314,6 +344,8 @@ struct mustache_s {
       uint32_t data_length;
     } read_only;
   } u;
+  /* opaque data attached by the implementation (i.e., cached names) */
+  void *udata;
 };
 
 typedef struct mustache__instruction_s {
@@ -451,6 +483,57 @@ mustache_section_parent(mustache_section_s *section) {
   return NULL;
 }
 
+/** Returns the number of instructions in the template. */
+static inline uint32_t mustache_instruction_count(mustache_s *mustache) {
+  return mustache->u.read_only.intruction_count;
+}
+
+/**
+ * Returns the name of the argument / section tag at the instruction position
+ * `pos`, or NULL if the instruction isn't a named tag.
+ */
+static inline const char *mustache_instruction_name(mustache_s *mustache,
+                                                    uint32_t pos,
+                                                    uint32_t *p_len) {
+  mustache__instruction_s *inst = MUSTACH2INSTRUCTIONS(mustache) + pos;
+  *p_len = 0;
+  if (pos >= mustache->u.read_only.intruction_count)
+    return NULL;
+  switch (inst->instruction) {
+  case MUSTACHE_WRITE_ARG:
+  case MUSTACHE_WRITE_ARG_UNESCAPED:
+  case MUSTACHE_SECTION_START:
+  case MUSTACHE_SECTION_START_INV:
+  case MUSTACHE_SECTION_GOTO:
+    if (!inst->data.name_pos)
+      return NULL;
+    *p_len = inst->data.name_len;
+    return MUSTACH2DATA(mustache) + inst->data.name_pos;
+  default:
+    return NULL;
+  }
+}
+
+/** Returns the total length of the template's static text. */
+static inline size_t mustache_text_length(mustache_s *mustache) {
+  mustache__instruction_s *inst = MUSTACH2INSTRUCTIONS(mustache);
+  size_t len = 0;
+  for (uint32_t i = 0; i < mustache->u.read_only.intruction_count; ++i) {
+    if (inst[i].instruction == MUSTACHE_WRITE_TEXT)
+      len += inst[i].data.name_len;
+  }
+  return len;
+}
+
+/**
+ * Returns the position of the instruction being performed (the tag that invoked
+ * the callback) within the template's instruction array.
+ */
+static inline uint32_t
+mustache_section_instruction(mustache_section_s *section) {
+  return mustache___section2stack(section)->pos;
+}
+
 /**
  * Returns the section's unparsed content as a non-NUL terminated byte array.
  *
@@ -1177,6 +1260,7 @@ MUSTACHE_FUNC mustache_s *(mustache_load)(mustache_load_args_s args) {
   s.m->u.read_only_pt = 0;
   s.m->u.read_only.data_length = 0;
   s.m->u.read_only.intruction_count = 0;
+  s.m->udata = NULL;
   s.i = MUSTACH2INSTRUCTIONS(s.m);
   s.err = args.err;
 
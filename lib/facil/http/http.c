@@ -8,10 +8,12 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <fio.h>
 
 #include <http1.h>
+#include <http2.h>
 #include <http_internal.h>
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -81,17 +83,45 @@ static inline void add_content_type(http_s *r) {
   }
 }
 
+/* compresses the response body if the client and the server settings allow */
+static FIOBJ http_compress_body(http_s *r, void *data, uintptr_t length) {
+  static uint64_t ce_hash = 0, ct_hash = 0, vary_hash = 0, accept_enc_hash = 0;
+  if (length < HTTP_COMPRESS_MIN_SIZE || r->status == 206 ||
+      !http2protocol(r)->settings->compress ||
+      http2protocol(r)->settings->is_client)
+    return FIOBJ_INVALID;
+  if (!ce_hash) {
+    ce_hash = fiobj_hash_string("content-encoding", 16);
+    ct_hash = fiobj_hash_string("content-type", 12);
+    vary_hash = fiobj_hash_string("vary", 4);
+    accept_enc_hash = fiobj_hash_string("accept-encoding", 15);
+  }
+  FIOBJ out_headers = r->private_data.out_headers;
+  if (fiobj_hash_get2(out_headers, ce_hash))
+    return FIOBJ_INVALID;
+  FIOBJ ct = fiobj_hash_get2(out_headers, ct_hash);
+  if (FIOBJ_TYPE_IS(ct, FIOBJ_T_ARRAY))
+    ct = fiobj_ary_index(ct, 0);
+  if (!ct || !http_mimetype_is_compressible(fiobj_obj2cstr(ct)))
+    return FIOBJ_INVALID;
+  http_headers_load(r);
+  const http_encoder_s *enc =
+      http_encoder_negotiate(fiobj_hash_get2(r->headers, accept_enc_hash));
+  FIOBJ compressed = http_encoder_compress(enc, data, length);
+  if (!compressed)
+    return FIOBJ_INVALID;
+  fiobj_hash_set(out_headers, HTTP_HEADER_CONTENT_ENCODING,
+                 fiobj_str_new(enc->name.data, enc->name.len));
+  if (!fiobj_hash_get2(out_headers, vary_hash))
+    fiobj_hash_set(out_headers, HTTP_HEADER_VARY,
+                   fiobj_dup(HTTP_HVALUE_ACCEPT_ENCODING));
+  return compressed;
+}
+
 static FIOBJ current_date;
 static time_t last_date_added;
 static fio_lock_i date_lock;
-static inline void add_date(http_s *r) {
-  static uint64_t date_hash = 0;
-  if (!date_hash)
-    date_hash = fiobj_hash_string("date", 4);
-  static uint64_t mod_hash = 0;
-  if (!mod_hash)
-    mod_hash = fiobj_hash_string("last-modified", 13);
-
+static inline void refresh_date(void) {
   if (fio_last_tick().tv_sec > last_date_added) {
     fio_lock(&date_lock);
     if (fio_last_tick().tv_sec > last_date_added) { /* retest inside lock */
@@ -100,11 +130,28 @@ static inline void add_date(http_s *r) {
       fiobj_str_resize(
           tmp, http_time2str(fiobj_obj2cstr(tmp).data, fio_last_tick().tv_sec));
       last_date_added = fio_last_tick().tv_sec;
-      current_date = tmp;
+      current_date = fiobj_share(tmp);
       fiobj_free(old);
     }
     fio_unlock(&date_lock);
   }
+}
+
+/** Returns a new reference to the cached Date header value. */
+FIOBJ http_date_current(void) {
+  refresh_date();
+  return fiobj_dup(current_date);
+}
+
+static inline void add_date(http_s *r) {
+  static uint64_t date_hash = 0;
+  if (!date_hash)
+    date_hash = fiobj_hash_string("date", 4);
+  static uint64_t mod_hash = 0;
+  if (!mod_hash)
+    mod_hash = fiobj_hash_string("last-modified", 13);
+
+  refresh_date();
 
   if (!fiobj_hash_get2(r->private_data.out_headers, date_hash)) {
     fiobj_hash_set(r->private_data.out_headers, HTTP_HEADER_DATE,
@@ -182,6 +229,27 @@ int http_set_header2(http_s *r, fio_str_info_s n, fio_str_info_s v) {
   return ret;
 }
 
+/**
+ * Returns the request's header Hash (the `h->headers` field), creating the
+ * FIOBJ objects first if the headers were stored lazily.
+ */
+FIOBJ http_headers(http_s *h) {
+  if (HTTP_INVALID_HANDLE(h))
+    return FIOBJ_INVALID;
+  http_headers_load(h);
+  return h->headers;
+}
+
+/**
+ * Returns the value of a (lower case) request header without allocating any
+ * memory. If the header is missing, `.data` is NULL.
+ */
+fio_str_info_s http_header_get_slice(http_s *h, fio_str_info_s name) {
+  if (HTTP_INVALID_HANDLE(h) || !name.data)
+    return (fio_str_info_s){.data = NULL};
+  return http_header_slice(h, name, fiobj_hash_string(name.data, name.len));
+}
+
 /**
  * Sets a response cookie, taking ownership of the value object, but NOT the
  * name object (so name objects could be reused in future responses).
@@ -332,11 +400,100 @@ int http_send_body(http_s *r, void *data, uintptr_t length) {
     http_finish(r);
     return 0;
   }
+  FIOBJ compressed = http_compress_body(r, data, length);
+  if (compressed) {
+    fio_str_info_s c = fiobj_obj2cstr(compressed);
+    data = c.data;
+    length = c.len;
+  }
   add_content_length(r, length);
   // add_content_type(r);
   add_date(r);
-  return ((http_vtable_s *)r->private_data.vtbl)
-      ->http_send_body(r, data, length);
+  int ret = ((http_vtable_s *)r->private_data.vtbl)
+                ->http_send_body(r, data, length);
+  fiobj_free(compressed);
+  return ret;
+}
+
+/**
+ * Pre-serializes a Hash of response headers for fixed-shape responses.
+ *
+ * Returns NULL on error.
+ */
+http_response_template_s *http_response_template_new(FIOBJ headers) {
+  if (!FIOBJ_TYPE_IS(headers, FIOBJ_T_HASH))
+    return NULL;
+  static uint64_t connection_hash = 0;
+  if (!connection_hash)
+    connection_hash = fiobj_hash_string("connection", 10);
+  http_response_template_s *t = fio_malloc(sizeof(*t));
+  FIO_ASSERT_ALLOC(t);
+  *t = (http_response_template_s){
+      .headers = fiobj_dup(headers),
+      .block = fiobj_str_buf(fiobj_hash_count(headers) * 32),
+  };
+  struct header_writer_s w = {.dest = t->block};
+  fiobj_each1(headers, 0, write_header, &w);
+  fiobj_str_freeze(t->block);
+  /* templates might be used by any thread */
+  fiobj_share(t->headers);
+  fiobj_share(t->block);
+  FIOBJ connection = fiobj_hash_get2(headers, connection_hash);
+  if (connection) {
+    fio_str_info_s c = fiobj_obj2cstr(connection);
+    t->has_connection = 1;
+    t->close = (c.len && (c.data[0] == 'c' || c.data[0] == 'C'));
+  }
+  return t;
+}
+
+/** Frees a response template. */
+void http_response_template_free(http_response_template_s *t) {
+  if (!t)
+    return;
+  fiobj_free(t->headers);
+  fiobj_free(t->block);
+  fio_free(t);
+}
+
+/* copies a template's headers to the response (when no fast path exists) */
+static int http_template_copy_header(FIOBJ o, void *h_) {
+  http_s *h = h_;
+  FIOBJ name = fiobj_hash_key_in_loop();
+  if (FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY)) {
+    for (size_t i = 0; i < fiobj_ary_count(o); ++i) {
+      set_header_add(h->private_data.out_headers, name,
+                     fiobj_dup(fiobj_ary_index(o, i)));
+    }
+    return 0;
+  }
+  set_header_add(h->private_data.out_headers, name, fiobj_dup(o));
+  return 0;
+}
+
+/**
+ * Sends a response using a pre-serialized header block, followed by any
+ * headers set using `http_set_header`, the Content-Length and Date headers and
+ * the body.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_template(http_s *h, http_response_template_s *t, void *data,
+                       uintptr_t length) {
+  if (HTTP_INVALID_HANDLE(h))
+    return -1;
+  if (!t)
+    return http_send_body(h, data, length);
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (!vtbl->http_send_template || http2protocol(h)->settings->is_client) {
+    fiobj_each1(t->headers, 0, http_template_copy_header, h);
+    return http_send_body(h, data, length);
+  }
+  if (!data)
+    length = 0;
+  return vtbl->http_send_template(h, t, data, length);
 }
 /**
  * Sends the response headers and the specified file (the response's body).
@@ -363,111 +520,326 @@ int http_sendfile(http_s *r, int fd, uintptr_t length, uintptr_t offset) {
  *
  * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
  */
-int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
-                   const char *encoded, size_t encoded_len) {
-  if (HTTP_INVALID_HANDLE(h))
-    return -1;
-  struct stat file_data = {.st_size = 0};
-  static uint64_t accept_enc_hash = 0;
-  if (!accept_enc_hash)
-    accept_enc_hash = fiobj_hash_string("accept-encoding", 15);
-  static uint64_t range_hash = 0;
-  if (!range_hash)
-    range_hash = fiobj_hash_string("range", 5);
+/* *****************************************************************************
+Static File Cache
+***************************************************************************** */
 
-  /* create filename string */
-  FIOBJ filename = fiobj_str_tmp();
-  if (prefix && prefix_len) {
-    /* start with prefix path */
-    if (encoded && prefix[prefix_len - 1] == '/' && encoded[0] == '/')
-      --prefix_len;
-    fiobj_str_capa_assert(filename, prefix_len + encoded_len + 4);
-    fiobj_str_write(filename, prefix, prefix_len);
-  }
-  {
-    /* decode filename in cases where it's URL encoded */
-    fio_str_info_s tmp = fiobj_obj2cstr(filename);
-    if (encoded) {
-      char *pos = (char *)encoded;
-      const char *end = encoded + encoded_len;
-      while (pos < end) {
-        /* test for path manipulations while decoding */
-        if (*pos == '/' && (pos[1] == '/' ||
-                            (((uintptr_t)end - (uintptr_t)pos >= 4) &&
-                             pos[1] == '.' && pos[2] == '.' && pos[3] == '/')))
-          return -1;
-        if (*pos == '%') {
-          // decode hex value
-          // this is a percent encoded value.
-          if (hex2byte((uint8_t *)tmp.data + tmp.len, (uint8_t *)pos + 1))
-            return -1;
-          tmp.len++;
-          pos += 3;
-        } else
-          tmp.data[tmp.len++] = *(pos++);
-      }
-      tmp.data[tmp.len] = 0;
-      fiobj_str_resize(filename, tmp.len);
-    }
-    if (tmp.data[tmp.len - 1] == '/')
-      fiobj_str_write(filename, "index.html", 10);
-  }
-  /* test for file existance  */
+/* a file's (immutable) response data, shared by concurrent requests */
+typedef struct {
+  fio_ls_embd_s node; /* the cache's LRU list, most recently used first */
+  FIOBJ path;         /* the requested file name (the cache key) */
+  FIOBJ etag;
+  FIOBJ body;         /* small files are kept in memory */
+  http_response_template_s *headers; /* Last-Modified, ETag, Content-Type... */
+  struct stat st;
+  time_t validated; /* the last time the file was tested (`stat`) */
+  volatile uintptr_t ref;
+  const http_encoder_s *encoder; /* the accepted encoder (part of the key) */
+  size_t size;        /* the response body's size */
+  int fd;             /* -1 if the data is in `body` (or the file is missing) */
+  uint8_t gzip;       /* set if the client accepted gzip (part of the key) */
+  uint8_t is_gz;      /* set if the `.gz` version of the file is served */
+  uint8_t compressed; /* set if `body` was compressed using `encoder` */
+  uint8_t exists;     /* set if the file was found */
+  uint8_t cached;     /* set if the entry belongs to the cache */
+} http_file_cache_entry_s;
+
+#define FIO_SET_NAME http_file_cache_set
+#define FIO_SET_OBJ_TYPE http_file_cache_entry_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2)                                            \
+  ((o1)->gzip == (o2)->gzip && (o1)->encoder == (o2)->encoder &&               \
+   fiobj_iseq((o1)->path, (o2)->path))
+#include <fio.h>
+
+static http_file_cache_set_s http_file_cache = FIO_SET_INIT;
+static fio_ls_embd_s http_file_cache_lru = FIO_LS_INIT(http_file_cache_lru);
+static fio_lock_i http_file_cache_lock = FIO_LOCK_INIT;
+
+static inline uint64_t http_file_cache_hash(http_file_cache_entry_s *e) {
+  return fiobj_obj2hash(e->path) ^ e->gzip ^
+         (http_encoder_index(e->encoder) << 1);
+}
 
-  int file = -1;
-  uint8_t is_gz = 0;
+/** Releases a file cache entry reference. */
+static void http_file_cache_release(http_file_cache_entry_s *e) {
+  if (fio_atomic_sub(&e->ref, 1))
+    return;
+  fiobj_free(e->path);
+  fiobj_free(e->etag);
+  fiobj_free(e->body);
+  http_response_template_free(e->headers);
+  if (e->fd != -1)
+    close(e->fd);
+  fio_free(e);
+}
+
+/* tests if a file is a regular file (or a link), filling in the stat data */
+static inline int http_file_stat(const char *name, struct stat *st) {
+  return !stat(name, st) && (S_ISREG(st->st_mode) || S_ISLNK(st->st_mode));
+}
 
+/* reads a whole file, returning FIOBJ_INVALID on error */
+static FIOBJ http_file_read(int fd, size_t size) {
+  FIOBJ body = fiobj_str_buf(size);
+  fio_str_info_s b = fiobj_obj2cstr(body);
+  ssize_t r = 0;
+  while (b.len < size &&
+         (r = pread(fd, b.data + b.len, size - b.len, b.len)) > 0)
+    b.len += r;
+  if (b.len != size) {
+    fiobj_free(body);
+    return FIOBJ_INVALID;
+  }
+  fiobj_str_resize(body, b.len);
+  return body;
+}
+
+/* loads a file's response data (metadata, headers and possibly content) */
+static http_file_cache_entry_s *
+http_file_cache_load(FIOBJ path, uint8_t gzip, const http_encoder_s *encoder,
+                     uint8_t cached) {
+  http_file_cache_entry_s *e = fio_malloc(sizeof(*e));
+  FIO_ASSERT_ALLOC(e);
+  *e = (http_file_cache_entry_s){
+      .path = fiobj_str_copy(path),
+      .validated = fio_last_tick().tv_sec,
+      .ref = 1,
+      .fd = -1,
+      .gzip = gzip,
+      .encoder = encoder,
+      .cached = cached,
+  };
+  FIOBJ filename = fiobj_str_copy(path);
   fio_str_info_s s = fiobj_obj2cstr(filename);
-  {
-    FIOBJ tmp = fiobj_hash_get2(h->headers, accept_enc_hash);
-    if (!tmp)
-      goto no_gzip_support;
-    fio_str_info_s ac_str = fiobj_obj2cstr(tmp);
-    if (!ac_str.data || !strstr(ac_str.data, "gzip"))
-      goto no_gzip_support;
-    if (s.data[s.len - 3] != '.' || s.data[s.len - 2] != 'g' ||
-        s.data[s.len - 1] != 'z') {
-      fiobj_str_write(filename, ".gz", 3);
+  if (gzip && (s.len < 3 || s.data[s.len - 3] != '.' ||
+               s.data[s.len - 2] != 'g' || s.data[s.len - 1] != 'z')) {
+    fiobj_str_write(filename, ".gz", 3);
+    s = fiobj_obj2cstr(filename);
+    if (http_file_stat(s.data, &e->st))
+      e->is_gz = 1;
+    else {
+      fiobj_str_resize(filename, s.len - 3);
       s = fiobj_obj2cstr(filename);
-      if (!stat(s.data, &file_data) &&
-          (S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode))) {
-        is_gz = 1;
-        goto found_file;
+    }
+  }
+  if (!e->is_gz && !http_file_stat(s.data, &e->st))
+    goto finish; /* the file is missing (this is also cached) */
+  e->fd = open(s.data, O_RDONLY);
+  if (e->fd == -1) {
+    FIO_LOG_ERROR("(HTTP) couldn't open file %s!\n", s.data);
+    perror("     ");
+    goto finish;
+  }
+  e->exists = 1;
+  e->size = e->st.st_size;
+  /* find the content-type */
+  FIOBJ mime;
+  {
+    uintptr_t pos = 0;
+    if (e->is_gz) {
+      pos = s.len - 4;
+      while (pos && s.data[pos] != '.')
+        pos--;
+      pos++; /* assuming, but that's fine. */
+      mime = http_mimetype_find(s.data + pos, s.len - pos - 3);
+
+    } else {
+      pos = s.len - 1;
+      while (pos && s.data[pos] != '.')
+        pos--;
+      pos++; /* assuming, but that's fine. */
+      mime = http_mimetype_find(s.data + pos, s.len - pos);
+    }
+  }
+  /* keep small (and compressed) files in memory */
+  if (cached) {
+    const uint8_t compress =
+        (encoder && !e->is_gz && e->size >= HTTP_COMPRESS_MIN_SIZE &&
+         e->size <= HTTP_COMPRESS_STATIC_LIMIT &&
+         http_mimetype_is_compressible(fiobj_obj2cstr(mime)));
+    if (compress || e->size <= HTTP_FILE_CACHE_BODY_LIMIT)
+      e->body = http_file_read(e->fd, e->size);
+    if (e->body && compress) {
+      fio_str_info_s b = fiobj_obj2cstr(e->body);
+      FIOBJ compressed = http_encoder_compress(encoder, b.data, b.len);
+      if (compressed) {
+        fiobj_free(e->body);
+        e->body = compressed;
+        e->size = fiobj_obj2cstr(compressed).len;
+        e->compressed = 1;
+      } else if (e->size > HTTP_FILE_CACHE_BODY_LIMIT) {
+        fiobj_free(e->body);
+        e->body = FIOBJ_INVALID;
       }
-      fiobj_str_resize(filename, s.len - 3);
+    }
+    if (e->body) {
+      close(e->fd);
+      e->fd = -1;
     }
   }
-no_gzip_support:
-  if (stat(s.data, &file_data) ||
-      !(S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode)))
-    return -1;
-found_file:
+  FIOBJ headers = fiobj_hash_new2(8);
   /* set last-modified */
   {
     FIOBJ tmp = fiobj_str_buf(32);
-    fiobj_str_resize(
-        tmp, http_time2str(fiobj_obj2cstr(tmp).data, file_data.st_mtime));
-    http_set_header(h, HTTP_HEADER_LAST_MODIFIED, tmp);
+    fiobj_str_resize(tmp,
+                     http_time2str(fiobj_obj2cstr(tmp).data, e->st.st_mtime));
+    fiobj_hash_set(headers, HTTP_HEADER_LAST_MODIFIED, tmp);
   }
   /* set cache-control */
-  http_set_header(h, HTTP_HEADER_CACHE_CONTROL, fiobj_dup(HTTP_HVALUE_MAX_AGE));
-  /* set & test etag */
-  uint64_t etag = (uint64_t)file_data.st_size;
-  etag ^= (uint64_t)file_data.st_mtime;
-  etag = fiobj_hash_string(&etag, sizeof(uint64_t));
-  FIOBJ etag_str = fiobj_str_buf(32);
-  fiobj_str_resize(etag_str,
-                   fio_base64_encode(fiobj_obj2cstr(etag_str).data,
-                                     (void *)&etag, sizeof(uint64_t)));
-  /* set */
-  http_set_header(h, HTTP_HEADER_ETAG, etag_str);
-  /* test */
+  fiobj_hash_set(headers, HTTP_HEADER_CACHE_CONTROL,
+                 fiobj_dup(HTTP_HVALUE_MAX_AGE));
+  /* set etag (compressed versions are different representations) */
+  {
+    uint64_t etag = (uint64_t)e->st.st_size;
+    etag ^= (uint64_t)e->st.st_mtime;
+    if (e->compressed)
+      etag ^= ((uint64_t)http_encoder_index(encoder) << 56);
+    etag = fiobj_hash_string(&etag, sizeof(uint64_t));
+    e->etag = fiobj_str_buf(32);
+    fiobj_str_resize(e->etag,
+                     fio_base64_encode(fiobj_obj2cstr(e->etag).data,
+                                       (void *)&etag, sizeof(uint64_t)));
+    fiobj_hash_set(headers, HTTP_HEADER_ETAG, fiobj_dup(e->etag));
+  }
+  /* set content-type and content-encoding */
+  if (e->is_gz) {
+    fiobj_hash_set(headers, HTTP_HEADER_CONTENT_ENCODING,
+                   fiobj_dup(HTTP_HVALUE_GZIP));
+  } else if (e->compressed) {
+    fiobj_hash_set(headers, HTTP_HEADER_CONTENT_ENCODING,
+                   fiobj_str_new(encoder->name.data, encoder->name.len));
+    fiobj_hash_set(headers, HTTP_HEADER_VARY,
+                   fiobj_dup(HTTP_HVALUE_ACCEPT_ENCODING));
+  }
+  if (mime)
+    fiobj_hash_set(headers, HTTP_HEADER_CONTENT_TYPE, mime);
+  e->headers = http_response_template_new(headers);
+  fiobj_free(headers);
+finish:
+  fiobj_free(filename);
+  if (cached) {
+    /* cached entries are used by all the threads */
+    fiobj_share(e->path);
+    fiobj_share(e->etag);
+    fiobj_share(e->body);
+  }
+  return e;
+}
+
+/* adds an entry to the cache, evicting the least recently used entries */
+static void http_file_cache_insert(http_file_cache_entry_s *e) {
+  http_file_cache_entry_s *old = NULL;
+  fio_atomic_add(&e->ref, 1); /* the cache's reference */
+  fio_lock(&http_file_cache_lock);
+  http_file_cache_set_overwrite(&http_file_cache, http_file_cache_hash(e), e,
+                                &old);
+  if (old)
+    fio_ls_embd_remove(&old->node);
+  fio_ls_embd_push(&http_file_cache_lru, &e->node);
+  http_file_cache_entry_s *evicted = NULL;
+  if (http_file_cache_set_count(&http_file_cache) > HTTP_FILE_CACHE_LIMIT) {
+    evicted = FIO_LS_EMBD_OBJ(http_file_cache_entry_s, node,
+                              fio_ls_embd_shift(&http_file_cache_lru));
+    http_file_cache_set_remove(&http_file_cache,
+                               http_file_cache_hash(evicted), evicted, NULL);
+  }
+  fio_unlock(&http_file_cache_lock);
+  if (old)
+    http_file_cache_release(old);
+  if (evicted)
+    http_file_cache_release(evicted);
+}
+
+/**
+ * Returns a (referenced) file entry for the requested file name, using the
+ * cache when possible.
+ *
+ * Cached entries are revalidated (using `stat`) once they're older than
+ * HTTP_FILE_CACHE_TTL seconds.
+ */
+static http_file_cache_entry_s *
+http_file_cache_get(FIOBJ path, uint8_t gzip, const http_encoder_s *encoder) {
+  if (!HTTP_FILE_CACHE_LIMIT)
+    return http_file_cache_load(path, gzip, encoder, 0);
+  const time_t now = fio_last_tick().tv_sec;
+  http_file_cache_entry_s tmp = {
+      .path = path, .gzip = gzip, .encoder = encoder};
+  const uint64_t hash = http_file_cache_hash(&tmp);
+  fio_lock(&http_file_cache_lock);
+  http_file_cache_entry_s *e =
+      http_file_cache_set_find(&http_file_cache, hash, &tmp);
+  if (e) {
+    fio_atomic_add(&e->ref, 1);
+    /* LRU: move to the head of the list */
+    fio_ls_embd_remove(&e->node);
+    fio_ls_embd_push(&http_file_cache_lru, &e->node);
+  }
+  fio_unlock(&http_file_cache_lock);
+  if (e && now - e->validated >= HTTP_FILE_CACHE_TTL) {
+    /* revalidate the entry (the file might have changed) */
+    struct stat st;
+    fio_str_info_s s = fiobj_obj2cstr(e->path);
+    FIOBJ gz = FIOBJ_INVALID;
+    if (e->is_gz) {
+      gz = fiobj_str_copy(e->path);
+      fiobj_str_write(gz, ".gz", 3);
+      s = fiobj_obj2cstr(gz);
+    }
+    int found = http_file_stat(s.data, &st);
+    fiobj_free(gz);
+    if (found == e->exists &&
+        (!found || (st.st_ino == e->st.st_ino && st.st_size == e->st.st_size &&
+                    st.st_mtime == e->st.st_mtime))) {
+      e->validated = now;
+    } else {
+      http_file_cache_release(e);
+      e = NULL;
+    }
+  }
+  if (!e) {
+    e = http_file_cache_load(path, gzip, encoder, 1);
+    http_file_cache_insert(e);
+  }
+  return e;
+}
+
+/** Clears the static file cache (files will be reloaded on demand). */
+void http_file_cache_clear(void) {
+  fio_lock(&http_file_cache_lock);
+  while (!fio_ls_embd_is_empty(&http_file_cache_lru)) {
+    http_file_cache_entry_s *e = FIO_LS_EMBD_OBJ(
+        http_file_cache_entry_s, node, fio_ls_embd_pop(&http_file_cache_lru));
+    http_file_cache_release(e);
+  }
+  http_file_cache_set_free(&http_file_cache);
+  fio_unlock(&http_file_cache_lock);
+}
+
+/* copies the file's headers to the response */
+static inline void http_file_cache_set_headers(http_s *h,
+                                               http_file_cache_entry_s *e) {
+  fiobj_each1(e->headers->headers, 0, http_template_copy_header, h);
+}
+
+/* sends a file response (handles ETag, Range, HEAD and OPTIONS requests) */
+static int http_sendfile_entry(http_s *h, http_file_cache_entry_s *e) {
+  static uint64_t range_hash = 0;
+  if (!range_hash)
+    range_hash = fiobj_hash_string("range", 5);
+  if (!e->exists)
+    return -1;
+  if (!e->headers) {
+    http_send_error(h, 500);
+    return 0;
+  }
+  /* test etag */
   {
     static uint64_t none_match_hash = 0;
     if (!none_match_hash)
       none_match_hash = fiobj_hash_string("if-none-match", 13);
     FIOBJ tmp2 = fiobj_hash_get2(h->headers, none_match_hash);
-    if (tmp2 && fiobj_iseq(tmp2, etag_str)) {
+    if (tmp2 && fiobj_iseq(tmp2, e->etag)) {
+      http_file_cache_set_headers(h, e);
       h->status = 304;
       http_finish(h);
       return 0;
@@ -475,13 +847,14 @@ found_file:
   }
   /* handle range requests */
   int64_t offset = 0;
-  int64_t length = file_data.st_size;
+  int64_t length = (int64_t)e->size;
+  uint8_t ranged = 0;
   {
     static uint64_t ifrange_hash = 0;
     if (!ifrange_hash)
       ifrange_hash = fiobj_hash_string("if-range", 8);
     FIOBJ tmp = fiobj_hash_get2(h->headers, ifrange_hash);
-    if (tmp && fiobj_iseq(tmp, etag_str)) {
+    if (tmp && fiobj_iseq(tmp, e->etag)) {
       fiobj_hash_delete2(h->headers, range_hash);
     } else {
       tmp = fiobj_hash_get2(h->headers, range_hash);
@@ -491,41 +864,44 @@ found_file:
           tmp = fiobj_ary_index(tmp, 0);
         fio_str_info_s range = fiobj_obj2cstr(tmp);
         if (!range.data || memcmp("bytes=", range.data, 6))
-          goto open_file;
+          goto test_method;
         char *pos = range.data + 6;
-        int64_t start_at = 0, end_at = 0;
-        start_at = fio_atol(&pos);
-        if (start_at >= file_data.st_size)
-          goto open_file;
-        if (start_at >= 0) {
-          pos++;
-          end_at = fio_atol(&pos);
-          if (end_at <= 0)
-            goto open_file;
-        }
+        const int64_t size = (int64_t)e->size;
+        const uint8_t suffix = (*pos == '-');
+        int64_t start_at = fio_atol(&pos);
+        int64_t end_at = size - 1;
         /* we ignore multimple ranges, only responding with the first range. */
-        if (start_at < 0) {
-          if (0 - start_at < file_data.st_size) {
-            offset = file_data.st_size - start_at;
-            length = 0 - start_at;
-          }
-        } else if (end_at) {
-          offset = start_at;
-          length = end_at - start_at + 1;
-          if (length + start_at > file_data.st_size || length <= 0)
-            length = length - start_at;
+        if (suffix) {
+          /* a suffix range (the last N bytes) */
+          if (start_at >= 0 || !size)
+            goto unsatisfiable;
+          if (start_at < 0 - size)
+            start_at = 0 - size;
+          start_at = size + start_at;
         } else {
-          offset = start_at;
-          length = length - start_at;
+          if (*pos != '-')
+            goto test_method;
+          ++pos;
+          if (*pos >= '0' && *pos <= '9') {
+            end_at = fio_atol(&pos);
+            if (end_at < start_at)
+              goto test_method; /* invalid ranges are ignored */
+            if (end_at >= size)
+              end_at = size - 1;
+          }
+          if (start_at >= size)
+            goto unsatisfiable;
         }
+        offset = start_at;
+        length = end_at - start_at + 1;
         h->status = 206;
+        ranged = 1;
 
         {
           FIOBJ cranges = fiobj_str_buf(1);
           fiobj_str_printf(cranges, "bytes %lu-%lu/%lu",
-                           (unsigned long)start_at,
-                           (unsigned long)(start_at + length - 1),
-                           (unsigned long)file_data.st_size);
+                           (unsigned long)start_at, (unsigned long)end_at,
+                           (unsigned long)size);
           http_set_header(h, HTTP_HEADER_CONTENT_RANGE, cranges);
         }
         http_set_header(h, HTTP_HEADER_ACCEPT_RANGES,
@@ -533,66 +909,135 @@ found_file:
       }
     }
   }
+  goto test_method;
+unsatisfiable:
+  /* the range starts after the end of the file */
+  {
+    FIOBJ cranges = fiobj_str_buf(1);
+    fiobj_str_printf(cranges, "bytes */%lu", (unsigned long)e->size);
+    http_set_header(h, HTTP_HEADER_CONTENT_RANGE, cranges);
+  }
+  h->status = 416;
+  http_finish(h);
+  return 0;
+test_method:
   /* test for an OPTIONS request or invalid methods */
-  s = fiobj_obj2cstr(h->method);
-  switch (s.len) {
-  case 7:
-    if (!strncasecmp("options", s.data, 7)) {
-      http_set_header2(h, (fio_str_info_s){.data = (char *)"allow", .len = 5},
-                       (fio_str_info_s){.data = (char *)"GET, HEAD", .len = 9});
-      h->status = 200;
-      http_finish(h);
-      return 0;
-    }
-    break;
-  case 3:
-    if (!strncasecmp("get", s.data, 3))
-      goto open_file;
-    break;
-  case 4:
-    if (!strncasecmp("head", s.data, 4)) {
-      http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(length));
-      http_finish(h);
-      return 0;
+  {
+    fio_str_info_s s = fiobj_obj2cstr(h->method);
+    switch (s.len) {
+    case 7:
+      if (!strncasecmp("options", s.data, 7)) {
+        http_file_cache_set_headers(h, e);
+        http_set_header2(
+            h, (fio_str_info_s){.data = (char *)"allow", .len = 5},
+            (fio_str_info_s){.data = (char *)"GET, HEAD", .len = 9});
+        h->status = 200;
+        http_finish(h);
+        return 0;
+      }
+      break;
+    case 3:
+      if (!strncasecmp("get", s.data, 3))
+        goto send_file;
+      break;
+    case 4:
+      if (!strncasecmp("head", s.data, 4)) {
+        http_file_cache_set_headers(h, e);
+        http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(length));
+        http_finish(h);
+        return 0;
+      }
+      break;
     }
-    break;
   }
   http_send_error(h, 403);
   return 0;
-open_file:
-  s = fiobj_obj2cstr(filename);
-  file = open(s.data, O_RDONLY);
-  if (file == -1) {
-    FIO_LOG_ERROR("(HTTP) couldn't open file %s!\n", s.data);
-    perror("     ");
+send_file:
+  if (e->body) {
+    fio_str_info_s body = fiobj_obj2cstr(e->body);
+    if (!ranged) /* the pre-rendered header block */
+      return http_send_template(h, e->headers, body.data, body.len);
+    http_file_cache_set_headers(h, e);
+    return http_send_body(h, body.data + offset, length);
+  }
+  int fd = e->fd;
+  if (e->cached)
+    fd = dup(e->fd); /* the cache keeps the file open */
+  else
+    e->fd = -1; /* take ownership, the entry is about to be released */
+  if (fd == -1) {
+    FIO_LOG_ERROR("(HTTP) couldn't duplicate file descriptor");
     http_send_error(h, 500);
     return 0;
   }
-  {
-    FIOBJ tmp = 0;
-    uintptr_t pos = 0;
-    if (is_gz) {
-      http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
-                      fiobj_dup(HTTP_HVALUE_GZIP));
+  http_file_cache_set_headers(h, e);
+  http_sendfile(h, fd, length, offset);
+  return 0;
+}
 
-      pos = s.len - 4;
-      while (pos && s.data[pos] != '.')
-        pos--;
-      pos++; /* assuming, but that's fine. */
-      tmp = http_mimetype_find(s.data + pos, s.len - pos - 3);
+int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
+                   const char *encoded, size_t encoded_len) {
+  if (HTTP_INVALID_HANDLE(h))
+    return -1;
+  static uint64_t accept_enc_hash = 0;
+  if (!accept_enc_hash)
+    accept_enc_hash = fiobj_hash_string("accept-encoding", 15);
 
-    } else {
-      pos = s.len - 1;
-      while (pos && s.data[pos] != '.')
-        pos--;
-      pos++; /* assuming, but that's fine. */
-      tmp = http_mimetype_find(s.data + pos, s.len - pos);
+  /* create filename string */
+  FIOBJ filename = fiobj_str_tmp();
+  if (prefix && prefix_len) {
+    /* start with prefix path */
+    if (encoded && prefix[prefix_len - 1] == '/' && encoded[0] == '/')
+      --prefix_len;
+    fiobj_str_capa_assert(filename, prefix_len + encoded_len + 4);
+    fiobj_str_write(filename, prefix, prefix_len);
+  }
+  {
+    /* decode filename in cases where it's URL encoded */
+    fio_str_info_s tmp = fiobj_obj2cstr(filename);
+    if (encoded) {
+      char *pos = (char *)encoded;
+      const char *end = encoded + encoded_len;
+      while (pos < end) {
+        /* test for path manipulations while decoding */
+        if (*pos == '/' && (pos[1] == '/' ||
+                            (((uintptr_t)end - (uintptr_t)pos >= 4) &&
+                             pos[1] == '.' && pos[2] == '.' && pos[3] == '/')))
+          return -1;
+        if (*pos == '%') {
+          // decode hex value
+          // this is a percent encoded value.
+          if (hex2byte((uint8_t *)tmp.data + tmp.len, (uint8_t *)pos + 1))
+            return -1;
+          tmp.len++;
+          pos += 3;
+        } else
+          tmp.data[tmp.len++] = *(pos++);
+      }
+      tmp.data[tmp.len] = 0;
+      fiobj_str_resize(filename, tmp.len);
     }
-    if (tmp)
-      http_set_header(h, HTTP_HEADER_CONTENT_TYPE, tmp);
+    if (tmp.data[tmp.len - 1] == '/')
+      fiobj_str_write(filename, "index.html", 10);
   }
-  http_sendfile(h, file, length, offset);
-  return 0;
+  /* test for file existance  */
+  uint8_t gzip = 0;
+  http_headers_load(h);
+  {
+    FIOBJ tmp = fiobj_hash_get2(h->headers, accept_enc_hash);
+    fio_str_info_s ac_str = fiobj_obj2cstr(tmp);
+    gzip = (tmp && ac_str.data && strstr(ac_str.data, "gzip"));
+  }
+  const http_encoder_s *encoder = NULL;
+  if (http2protocol(h)->settings->compress)
+    encoder =
+        http_encoder_negotiate(fiobj_hash_get2(h->headers, accept_enc_hash));
+  http_file_cache_entry_s *e = http_file_cache_get(filename, gzip, encoder);
+  if (!e)
+    return -1;
+  int ret = http_sendfile_entry(h, e);
+  http_file_cache_release(e);
+  return ret;
 }
 
 /**
@@ -632,19 +1077,185 @@ int http_send_error(http_s *r, size_t error) {
   return 0;
 }
 
+typedef struct {
+  FIOBJ dest;
+  const char *family; /* the last metric's name (labels share HELP / TYPE) */
+  size_t family_len;
+} http_metrics_writer_s;
+
+/* writes a metric, using the Prometheus text format */
+static void http_metrics_write(fio_metric_s *m, void *w_) {
+  static const char *types[] = {"counter", "gauge", "summary"};
+  http_metrics_writer_s *w = w_;
+  FIOBJ dest = w->dest;
+  size_t len = 0;
+  while (m->name[len] && m->name[len] != '{')
+    ++len;
+  if (w->family && w->family_len == len && !memcmp(w->family, m->name, len))
+    goto value;
+  w->family = m->name;
+  w->family_len = len;
+  if (m->help) {
+    fiobj_str_write(dest, "# HELP ", 7);
+    fiobj_str_write(dest, m->name, len);
+    fiobj_str_write(dest, " ", 1);
+    fiobj_str_write(dest, m->help, strlen(m->help));
+    fiobj_str_write(dest, "\n", 1);
+  }
+  fiobj_str_write(dest, "# TYPE ", 7);
+  fiobj_str_write(dest, m->name, len);
+  fiobj_str_write(dest, " ", 1);
+  fiobj_str_write(dest, types[m->type], strlen(types[m->type]));
+  fiobj_str_write(dest, "\n", 1);
+value:
+  if (m->type == FIO_METRIC_HISTOGRAM) {
+    const uint64_t quantiles[] = {m->p50, m->p90, m->p99};
+    const char *names[] = {"0.5", "0.9", "0.99"};
+    for (size_t i = 0; i < 3; ++i) {
+      fiobj_str_write(dest, m->name, len);
+      fiobj_str_write(dest, "{quantile=\"", 11);
+      fiobj_str_write(dest, names[i], strlen(names[i]));
+      fiobj_str_write(dest, "\"} ", 3);
+      fiobj_str_write_i(dest, (int64_t)quantiles[i]);
+      fiobj_str_write(dest, "\n", 1);
+    }
+    fiobj_str_write(dest, m->name, len);
+    fiobj_str_write(dest, "_sum ", 5);
+    fiobj_str_write_i(dest, (int64_t)m->sum);
+    fiobj_str_write(dest, "\n", 1);
+    fiobj_str_write(dest, m->name, len);
+    fiobj_str_write(dest, "_count ", 7);
+  } else {
+    fiobj_str_write(dest, m->name, strlen(m->name));
+    fiobj_str_write(dest, " ", 1);
+  }
+  fiobj_str_write_i(dest, m->value);
+  fiobj_str_write(dest, "\n", 1);
+}
+
+/**
+ * Sends the process's runtime metrics using the Prometheus text format.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_metrics(http_s *h) {
+  if (!h || !h->private_data.out_headers)
+    return -1;
+  http_metrics_writer_s w = {.dest = fiobj_str_buf(4096)};
+  fio_metrics_each(http_metrics_write, &w);
+  http_set_header(h, HTTP_HEADER_CONTENT_TYPE,
+                  fiobj_str_new("text/plain; version=0.0.4", 25));
+  fio_str_info_s str = fiobj_obj2cstr(w.dest);
+  int ret = http_send_body(h, str.data, str.len);
+  fiobj_free(w.dest);
+  return ret;
+}
+
+/**
+ * Sends the response headers for a header only response, or completes a
+ * streamed response.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+void http_finish(http_s *r) {
+  if (!r || !r->private_data.vtbl) {
+    return;
+  }
+  add_content_length(r, 0);
+  add_date(r);
+  ((http_vtable_s *)r->private_data.vtbl)->http_finish(r);
+}
+/**
+ * Sends a chunk of the response's body, sending the response headers with the
+ * first chunk. Call `http_finish` to complete the response.
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int http_stream(http_s *h, void *data, uintptr_t length) {
+  if (HTTP_INVALID_HANDLE(h))
+    return -1;
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (!vtbl->http_stream)
+    return -1;
+  if (!data)
+    length = 0;
+  add_date(h);
+  return vtbl->http_stream(h, data, length);
+}
+
+/**
+ * Same as `http_stream`, except the data is *not* copied (ownership moves to
+ * facil.io and `dealloc` is called once the data was sent).
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int http_stream2(http_s *h, void *data, uintptr_t length,
+                 void (*dealloc)(void *)) {
+  if (!dealloc)
+    dealloc = free;
+  if (HTTP_INVALID_HANDLE(h))
+    goto error;
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (!vtbl->http_stream)
+    goto error;
+  if (!data)
+    length = 0;
+  add_date(h);
+  if (vtbl->http_stream2 && length)
+    return vtbl->http_stream2(h, data, length, dealloc);
+  /* fallback: copy the data */
+  int ret = vtbl->http_stream(h, data, length);
+  if (data)
+    dealloc(data);
+  return ret;
+error:
+  if (data)
+    dealloc(data);
+  return -1;
+}
+
+typedef struct {
+  http_s *h;
+  uint8_t streaming;
+} http_mustache_stream_s;
+
+static int http_mustache_on_chunk(fio_str_info_s chunk, void *s_) {
+  http_mustache_stream_s *s = s_;
+  s->streaming = 1;
+  return http_stream(s->h, chunk.data, chunk.len);
+}
+
 /**
- * Sends the response headers for a header only response.
+ * Renders a mustache template, streaming the output as the response's body.
+ *
+ * Returns -1 on error and 0 on success.
  *
  * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
  */
-void http_finish(http_s *r) {
-  if (!r || !r->private_data.vtbl) {
-    return;
+int http_send_mustache(http_s *h, mustache_s *mustache, FIOBJ data) {
+  if (HTTP_INVALID_HANDLE(h))
+    return -1;
+  if (!((http_vtable_s *)h->private_data.vtbl)->http_stream) {
+    FIOBJ body = fiobj_mustache_build(mustache, data);
+    if (!body) {
+      http_send_error(h, 500);
+      return -1;
+    }
+    fio_str_info_s b = fiobj_obj2cstr(body);
+    int ret = http_send_body(h, b.data, b.len);
+    fiobj_free(body);
+    return ret;
   }
-  add_content_length(r, 0);
-  add_date(r);
-  ((http_vtable_s *)r->private_data.vtbl)->http_finish(r);
+  http_mustache_stream_s s = {.h = h};
+  int ret = fiobj_mustache_stream(mustache, data, http_mustache_on_chunk, &s);
+  if (ret == -1 && !s.streaming) {
+    http_send_error(h, 500);
+    return -1;
+  }
+  http_finish(h);
+  return ret;
 }
+
 /**
  * Pushes a data response when supported (HTTP/2 only).
  *
@@ -775,6 +1386,72 @@ void http_resume(http_pause_handle_s *http, void (*task)(http_s *h),
                     .fallback = http_resume_fallback_wrapper);
 }
 
+/**
+ * Pauses the request / response handling until the data already written to the
+ * socket was sent (see `http_stream_wait`).
+ */
+int http_stream_wait(http_s *h, void (*task)(http_s *h)) {
+  if (HTTP_INVALID_HANDLE(h) || !task)
+    return -1;
+  http_fio_protocol_s *p = (http_fio_protocol_s *)h->private_data.flag;
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (!vtbl->http_stream_wait)
+    return -1;
+  http_pause_handle_s *http = fio_malloc(sizeof(*http));
+  FIO_ASSERT_ALLOC(http);
+  *http = (http_pause_handle_s){
+      .uuid = p->uuid,
+      .h = h,
+      .udata = h->udata,
+      .task = task,
+  };
+  vtbl->http_on_pause(h, p);
+  return vtbl->http_stream_wait(h, http);
+}
+
+/** Schedules a paused handle's task (see `http_stream_wait`). */
+void http_stream_resume(http_pause_handle_s *http) {
+  fio_defer_io_task(http->uuid, .udata = http, .type = FIO_PR_LOCK_TASK,
+                    .task = http_resume_wrapper,
+                    .fallback = http_resume_fallback_wrapper);
+}
+
+/* resume reading the request body within the connection's lock */
+static void http_resume_body_wrapper(intptr_t uuid, fio_protocol_s *p_,
+                                     void *arg) {
+  http_pause_handle_s *http = arg;
+  http_vtable_s *vtbl = (http_vtable_s *)http->udata;
+  if (vtbl->http_on_body_resume)
+    vtbl->http_on_body_resume(http->h, (http_fio_protocol_s *)p_);
+  fio_free(http);
+  (void)uuid;
+}
+
+/* the connection was closed, nothing to resume */
+static void http_resume_body_fallback(intptr_t uuid, void *arg) {
+  fio_free(arg);
+  (void)uuid;
+}
+
+/**
+ * Resumes reading a streamed request body after `on_body_chunk` returned a
+ * non-zero value.
+ */
+void http_resume_body(http_s *h) {
+  if (!h || !h->private_data.flag)
+    return;
+  http_pause_handle_s *http = fio_malloc(sizeof(*http));
+  FIO_ASSERT_ALLOC(http);
+  *http = (http_pause_handle_s){
+      .uuid = ((http_fio_protocol_s *)h->private_data.flag)->uuid,
+      .h = h,
+      .udata = h->private_data.vtbl,
+  };
+  fio_defer_io_task(http->uuid, .udata = http, .type = FIO_PR_LOCK_TASK,
+                    .task = http_resume_body_wrapper,
+                    .fallback = http_resume_body_fallback);
+}
+
 /**
  * Hijacks the socket away from the HTTP protocol and away from facil.io.
  */
@@ -878,6 +1555,23 @@ static void http_on_server_protocol_http1(intptr_t uuid, void *set,
   (void)ignr_;
 }
 
+static void http_on_server_protocol_http2(intptr_t uuid, void *set,
+                                          void *ignr_) {
+  fio_timeout_set(uuid, ((http_settings_s *)set)->timeout);
+  if (fio_uuid2fd(uuid) >= ((http_settings_s *)set)->max_clients) {
+    if (!fio_http_at_capa)
+      FIO_LOG_WARNING("HTTP server at capacity");
+    fio_http_at_capa = 1;
+    fio_close(uuid);
+    return;
+  }
+  fio_http_at_capa = 0;
+  fio_protocol_s *pr = http2_new(uuid, set, NULL, 0);
+  if (!pr)
+    fio_close(uuid);
+  (void)ignr_;
+}
+
 static void http_on_open(intptr_t uuid, void *set) {
   http_on_server_protocol_http1(uuid, set, NULL);
 }
@@ -914,11 +1608,17 @@ intptr_t http_listen(const char *port, const char *binding,
   if (settings->tls) {
     fio_tls_alpn_add(settings->tls, "http/1.1", http_on_server_protocol_http1,
                      NULL, NULL);
+    if (settings->http2)
+      fio_tls_alpn_add(settings->tls, "h2", http_on_server_protocol_http2,
+                       NULL, NULL);
   }
 
   return fio_listen(.port = port, .address = binding, .tls = arg_settings.tls,
                     .on_finish = http_on_finish, .on_open = http_on_open,
-                    .udata = settings);
+                    .udata = settings, .reuse_port = arg_settings.reuse_port,
+                    .connection_rate = arg_settings.connection_rate,
+                    .connections_per_address =
+                        arg_settings.connections_per_address);
 }
 /** Listens to HTTP connections at the specified `port` and `binding`. */
 #define http_listen(port, binding, ...)                                        \
@@ -958,6 +1658,7 @@ static void http_on_close_client(intptr_t uuid, fio_protocol_s *protocol) {
 
 static void http_on_open_client_perform(http_settings_s *set) {
   http_s *h = set->udata;
+  set->udata = h->udata;
   set->on_response(h);
 }
 static void http_on_open_client_http1(intptr_t uuid, void *set_,
@@ -998,6 +1699,370 @@ static void http_on_client_failed(intptr_t uuid, void *set_) {
   (void)uuid;
 }
 
+/* *****************************************************************************
+HTTP client connection pool
+***************************************************************************** */
+
+typedef struct http_pool_s http_pool_s;
+
+/* a pooled request (a single `http_connect` call) */
+typedef struct {
+  fio_ls_embd_s node; /* a connection's `requests` or the pool's `waiting` */
+  http_settings_s *settings; /* `udata` is the request handle until it's sent */
+  uint8_t sent;
+} http_pool_req_s;
+
+/* a pooled HTTP/1.1 client connection */
+typedef struct {
+  http_settings_s settings; /* the connection's settings (must be first) */
+  fio_ls_embd_s node;       /* the pool's `idle` list (while not full) */
+  fio_ls_embd_s requests;   /* assigned requests, in the order they're sent */
+  http_pool_s *pool;
+  /* the HTTP/1.1 protocol's `on_close` (wrapped) */
+  void (*on_close)(intptr_t uuid, fio_protocol_s *pr);
+  intptr_t uuid;     /* -1 while connecting */
+  size_t count;      /* the number of assigned requests */
+  uint8_t scheduled; /* a `http_pool_send` task is pending */
+  uint8_t close;     /* the connection can't be reused */
+} http_pool_conn_s;
+
+struct http_pool_s {
+  FIOBJ key; /* "scheme://host:port" or "unix:path" */
+  char *address;
+  char *port;
+  void *tls;
+  fio_ls_embd_s idle;    /* connections that can accept another request */
+  fio_ls_embd_s waiting; /* requests waiting for a connection */
+  size_t count;          /* open (or connecting) connections */
+  uint16_t limit;
+  uint8_t timeout;
+  uint8_t pipeline;
+};
+
+#define FIO_SET_NAME http_pool_set
+#define FIO_SET_OBJ_TYPE http_pool_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2)                                            \
+  ((o1)->tls == (o2)->tls && fiobj_iseq((o1)->key, (o2)->key))
+#include <fio.h>
+
+static http_pool_set_s http_pools = FIO_SET_INIT;
+static fio_lock_i http_pool_lock = FIO_LOCK_INIT;
+
+static inline uint64_t http_pool_hash(http_pool_s *pool) {
+  return fiobj_obj2hash(pool->key) ^ (uintptr_t)pool->tls;
+}
+
+/* calls `on_finish` and frees the request (destroying the unsent handle) */
+static void http_pool_req_finish(http_pool_req_s *r) {
+  http_settings_s *set = r->settings;
+  if (!r->sent) {
+    http_s *h = set->udata;
+    set->udata = h->udata;
+    http_s_destroy(h, 0);
+    fio_free(h);
+  }
+  if (set->on_finish)
+    set->on_finish(set);
+  http_settings_free(set);
+  fio_free(r);
+}
+
+/* tests if the server allows the connection to be reused */
+static int http_pool_keep_alive(http_s *h) {
+  FIOBJ tmp = fiobj_hash_get2(h->headers,
+                              fiobj_obj2hash(HTTP_HEADER_CONNECTION));
+  if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_STRING)) {
+    fio_str_info_s s = fiobj_obj2cstr(tmp);
+    return !s.len || (s.data[0] | 32) != 'c';
+  }
+  fio_str_info_s v = fiobj_obj2cstr(h->version);
+  return v.len > 7 && v.data[5] == '1' && v.data[6] == '.' && v.data[7] == '1';
+}
+
+/* assigns a request, returns non-zero if a send task should be scheduled */
+static int http_pool_assign_unsafe(http_pool_conn_s *c, http_pool_req_s *r) {
+  fio_ls_embd_push(&c->requests, &r->node);
+  if (++c->count >= c->pool->pipeline)
+    fio_ls_embd_remove(&c->node);
+  if (c->scheduled || c->uuid == -1)
+    return 0;
+  return (c->scheduled = 1);
+}
+
+/* assigns waiting requests and marks the connection as idle (if not full) */
+static int http_pool_available_unsafe(http_pool_conn_s *c) {
+  http_pool_s *pool = c->pool;
+  int schedule = 0;
+  while (c->count < pool->pipeline && fio_ls_embd_any(&pool->waiting))
+    schedule |= http_pool_assign_unsafe(
+        c, FIO_LS_EMBD_OBJ(http_pool_req_s, node,
+                           fio_ls_embd_shift(&pool->waiting)));
+  if (c->count < pool->pipeline && !fio_ls_embd_any(&c->node))
+    fio_ls_embd_push(&pool->idle, &c->node);
+  return schedule;
+}
+
+/* sends the assigned requests (in order), running within the protocol lock */
+static void http_pool_send(intptr_t uuid, fio_protocol_s *pr, void *c_) {
+  http_pool_conn_s *c = c_;
+  for (;;) {
+    http_pool_req_s *r = NULL;
+    fio_lock(&http_pool_lock);
+    FIO_LS_EMBD_FOR(&c->requests, pos) {
+      http_pool_req_s *tmp = FIO_LS_EMBD_OBJ(http_pool_req_s, node, pos);
+      if (!tmp->sent) {
+        r = tmp;
+        break;
+      }
+    }
+    if (r)
+      r->sent = 1;
+    else
+      c->scheduled = 0;
+    fio_unlock(&http_pool_lock);
+    if (!r)
+      return;
+    fio_timeout_set(uuid, r->settings->timeout);
+    http_s *h = r->settings->udata;
+    r->settings->udata = h->udata;
+    h->private_data.flag = (uintptr_t)pr;
+    h->private_data.vtbl = http1_vtable();
+    r->settings->on_response(h);
+  }
+}
+
+/* schedules `http_pool_send` (the connection is valid until it runs) */
+static inline void http_pool_send_schedule(http_pool_conn_s *c,
+                                           intptr_t uuid) {
+  fio_defer_io_task(uuid, .task = http_pool_send, .udata = c);
+}
+
+static void http_pool_connect(void *c_, void *ignr_);
+
+/* removes a closed (or failed) connection from the pool and frees it */
+static void http_pool_conn_free(http_pool_conn_s *c, uint8_t failed) {
+  http_pool_s *pool = c->pool;
+  fio_ls_embd_s done = FIO_LS_INIT(done);
+  http_pool_conn_s *next = NULL;
+  fio_lock(&http_pool_lock);
+  fio_ls_embd_remove(&c->node);
+  --pool->count;
+  /* unsent requests are safe to retry (unless the host is unreachable) */
+  while (fio_ls_embd_any(&c->requests)) {
+    http_pool_req_s *r = FIO_LS_EMBD_OBJ(http_pool_req_s, node,
+                                         fio_ls_embd_pop(&c->requests));
+    if (r->sent || failed)
+      fio_ls_embd_push(&done, &r->node);
+    else
+      fio_ls_embd_unshift(&pool->waiting, &r->node);
+  }
+  if (fio_ls_embd_any(&pool->waiting) && pool->count < pool->limit) {
+    next = fio_malloc(sizeof(*next));
+    FIO_ASSERT_ALLOC(next);
+    *next = *c;
+    next->node = (fio_ls_embd_s)FIO_LS_INIT(next->node);
+    next->requests = (fio_ls_embd_s)FIO_LS_INIT(next->requests);
+    next->settings.udata = next;
+    next->uuid = -1;
+    next->count = 0;
+    next->scheduled = next->close = 0;
+    ++pool->count;
+    http_pool_assign_unsafe(
+        next, FIO_LS_EMBD_OBJ(http_pool_req_s, node,
+                              fio_ls_embd_shift(&pool->waiting)));
+  }
+  fio_unlock(&http_pool_lock);
+  while (fio_ls_embd_any(&done))
+    http_pool_req_finish(
+        FIO_LS_EMBD_OBJ(http_pool_req_s, node, fio_ls_embd_shift(&done)));
+  fio_free(c);
+  if (next)
+    fio_defer(http_pool_connect, next, NULL);
+}
+
+static void http_pool_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  http_pool_conn_s *c =
+      (http_pool_conn_s *)((http_fio_protocol_s *)pr)->settings;
+  c->on_close(uuid, pr);
+  http_pool_conn_free(c, 0);
+}
+
+static void http_pool_on_response(http_s *h) {
+  http_pool_conn_s *c = (http_pool_conn_s *)http_settings(h);
+  http_pool_req_s *r = NULL;
+  fio_lock(&http_pool_lock);
+  if (fio_ls_embd_any(&c->requests)) {
+    r = FIO_LS_EMBD_OBJ(http_pool_req_s, node, c->requests.next);
+    if (r->sent)
+      fio_ls_embd_remove(&r->node);
+    else
+      r = NULL;
+  }
+  fio_unlock(&http_pool_lock);
+  if (!r) {
+    /* a response that wasn't requested */
+    c->close = 1;
+    fio_close(c->uuid);
+    return;
+  }
+  if (!http_pool_keep_alive(h))
+    c->close = 1;
+  http_on_response_handler______internal(h, r->settings);
+  http_pool_req_finish(r);
+
+  int schedule = 0;
+  fio_lock(&http_pool_lock);
+  --c->count;
+  if (!c->close)
+    schedule = http_pool_available_unsafe(c);
+  const size_t count = c->count;
+  fio_unlock(&http_pool_lock);
+  if (c->close) {
+    fio_close(c->uuid);
+    return;
+  }
+  if (schedule)
+    http_pool_send_schedule(c, c->uuid);
+  else if (!count)
+    fio_timeout_set(c->uuid, c->pool->timeout);
+}
+
+static void http_pool_on_upgrade(http_s *h, char *protocol, size_t len) {
+  http_pool_on_response(h);
+  (void)protocol;
+  (void)len;
+}
+
+static void http_pool_on_open(intptr_t uuid, void *c_) {
+  http_pool_conn_s *c = c_;
+  fio_protocol_s *pr = http1_new(uuid, &c->settings, NULL, 0);
+  if (!pr) {
+    http_pool_conn_free(c, 1);
+    fio_close(uuid);
+    return;
+  }
+  c->on_close = pr->on_close;
+  pr->on_close = http_pool_on_close;
+  fio_lock(&http_pool_lock);
+  c->uuid = uuid;
+  c->scheduled = 1;
+  http_pool_available_unsafe(c);
+  fio_unlock(&http_pool_lock);
+  http_pool_send_schedule(c, uuid);
+}
+
+static void http_pool_on_fail(intptr_t uuid, void *c_) {
+  http_pool_conn_free(c_, 1);
+  (void)uuid;
+}
+
+/* opens a pooled connection (the first request was already assigned) */
+static intptr_t http_pool_connect2(http_pool_conn_s *c) {
+  return fio_connect(.address = c->pool->address, .port = c->pool->port,
+                     .on_connect = http_pool_on_open,
+                     .on_fail = http_pool_on_fail, .udata = c,
+                     .tls = c->pool->tls);
+}
+
+static void http_pool_connect(void *c_, void *ignr_) {
+  http_pool_connect2(c_);
+  (void)ignr_;
+}
+
+/* routes a request to an idle connection, a new connection or the queue */
+static intptr_t http_pool_request(FIOBJ key, const char *address,
+                                  const char *port, http_settings_s *settings) {
+  http_pool_req_s *r = fio_malloc(sizeof(*r));
+  FIO_ASSERT_ALLOC(r);
+  *r = (http_pool_req_s){.settings = settings};
+  http_pool_s tmp = {.key = key, .tls = settings->tls};
+  const uint64_t hash = http_pool_hash(&tmp);
+  http_pool_conn_s *c = NULL;
+  intptr_t uuid = 0;
+  int schedule = 0;
+  fio_lock(&http_pool_lock);
+  http_pool_s *pool = http_pool_set_find(&http_pools, hash, &tmp);
+  if (!pool) {
+    pool = malloc(sizeof(*pool));
+    FIO_ASSERT_ALLOC(pool);
+    *pool = (http_pool_s){
+        .key = fiobj_dup(key),
+        .address = address ? strdup(address) : NULL,
+        .port = port ? strdup(port) : NULL,
+        .tls = settings->tls,
+    };
+    pool->idle = (fio_ls_embd_s)FIO_LS_INIT(pool->idle);
+    pool->waiting = (fio_ls_embd_s)FIO_LS_INIT(pool->waiting);
+    http_pool_set_insert(&http_pools, hash, pool);
+  }
+  /* the most recent request's settings apply */
+  pool->limit = settings->pool_limit;
+  pool->timeout = settings->pool_timeout;
+  pool->pipeline = settings->pool_pipeline;
+  if (fio_ls_embd_any(&pool->idle)) {
+    /* most recently used first, so surplus connections time out */
+    c = FIO_LS_EMBD_OBJ(http_pool_conn_s, node, pool->idle.prev);
+    uuid = c->uuid;
+    schedule = http_pool_assign_unsafe(c, r);
+  } else if (pool->count < pool->limit) {
+    c = fio_malloc(sizeof(*c));
+    FIO_ASSERT_ALLOC(c);
+    *c = (http_pool_conn_s){
+        .settings = *settings,
+        .pool = pool,
+        .uuid = -1,
+    };
+    c->node = (fio_ls_embd_s)FIO_LS_INIT(c->node);
+    c->requests = (fio_ls_embd_s)FIO_LS_INIT(c->requests);
+    c->settings.on_response = http_pool_on_response;
+    c->settings.on_upgrade = http_pool_on_upgrade;
+    c->settings.on_finish = NULL;
+    c->settings.udata = c;
+    c->settings.public_folder = NULL;
+    c->settings.public_folder_length = 0;
+    uuid = -1;
+    ++pool->count;
+    http_pool_assign_unsafe(c, r);
+  } else {
+    fio_ls_embd_push(&pool->waiting, &r->node);
+  }
+  fio_unlock(&http_pool_lock);
+  if (schedule)
+    http_pool_send_schedule(c, uuid);
+  else if (c && uuid == -1)
+    return http_pool_connect2(c);
+  return uuid;
+}
+
+/* fails waiting requests and releases the pools (once they have no sockets) */
+void http_client_pool_clear(void) {
+  fio_ls_embd_s done = FIO_LS_INIT(done);
+  size_t active = 0;
+  fio_lock(&http_pool_lock);
+  FIO_SET_FOR_LOOP(&http_pools, pos) {
+    if (!pos->hash)
+      continue;
+    while (fio_ls_embd_any(&pos->obj->waiting))
+      fio_ls_embd_push(&done, fio_ls_embd_shift(&pos->obj->waiting));
+    active += pos->obj->count;
+  }
+  if (!active) {
+    FIO_SET_FOR_LOOP(&http_pools, pos) {
+      if (!pos->hash)
+        continue;
+      fiobj_free(pos->obj->key);
+      free(pos->obj->address);
+      free(pos->obj->port);
+      free(pos->obj);
+    }
+    http_pool_set_free(&http_pools);
+  }
+  fio_unlock(&http_pool_lock);
+  while (fio_ls_embd_any(&done))
+    http_pool_req_finish(
+        FIO_LS_EMBD_OBJ(http_pool_req_s, node, fio_ls_embd_shift(&done)));
+}
+
 intptr_t http_connect__(void); /* sublime text marker */
 /**
  * Connects to an HTTP server as a client.
@@ -1119,7 +2184,29 @@ intptr_t http_connect FIO_IGNORE_MACRO(const char *url,
     http_set_header2(h, (fio_str_info_s){.data = (char *)"host", .len = 4},
                      (fio_str_info_s){.data = host, .len = h_len});
   intptr_t ret;
-  if (is_websocket) {
+  if (settings->pool_limit && !is_websocket) {
+    /* keep-alive connections are pooled by scheme, host and port */
+    if (!settings->pool_timeout)
+      settings->pool_timeout = 5;
+    if (!settings->pool_pipeline)
+      settings->pool_pipeline = 1;
+    FIOBJ key = fiobj_str_buf(len + 16);
+    if (!p) {
+      fiobj_str_write(key, "unix:", 5);
+      if (a)
+        fiobj_str_write(key, a, len);
+    } else {
+      if (is_secure)
+        fiobj_str_write(key, "https://", 8);
+      else
+        fiobj_str_write(key, "http://", 7);
+      fiobj_str_write(key, a, len);
+      fiobj_str_write(key, ":", 1);
+      fiobj_str_write(key, p, strlen(p));
+    }
+    ret = http_pool_request(key, a, p, settings);
+    fiobj_free(key);
+  } else if (is_websocket) {
     /* force HTTP/1.1 */
     ret = fio_connect(.address = a, .port = p, .on_fail = http_on_client_failed,
                       .on_connect = http_on_open_client, .udata = settings,
@@ -1211,6 +2298,68 @@ static inline void http_sse_copy2str(FIOBJ dest, char *prefix, size_t pre_len,
   }
 }
 
+/* encodes an SSE event (used by `http_sse_write` and the pub/sub metadata) */
+static FIOBJ http_sse_encode(struct http_sse_write_args args) {
+  FIOBJ buf;
+  {
+    /* best guess at data length, ignoring missing fields and multiline data */
+    const size_t total = 4 + args.id.len + 2 + 7 + args.event.len + 2 + 6 +
+                         args.data.len + 2 + 7 + 10 + 4;
+    buf = fiobj_str_buf(total);
+  }
+  http_sse_copy2str(buf, (char *)"id: ", 4, args.id);
+  http_sse_copy2str(buf, (char *)"event: ", 7, args.event);
+  if (args.retry) {
+    FIOBJ i = fiobj_num_new(args.retry);
+    fiobj_str_write(buf, (char *)"retry: ", 7);
+    fiobj_str_join(buf, i);
+    fiobj_str_write(buf, "\r\n", 2);
+    fiobj_free(i);
+  }
+  http_sse_copy2str(buf, (char *)"data: ", 6, args.data);
+  fiobj_str_write(buf, "\r\n", 2);
+  return buf;
+}
+
+static void http_sse_on_message__direct(http_sse_s *sse, fio_str_info_s channel,
+                                        fio_str_info_s msg, void *udata);
+
+static void http_sse_optimize_free(fio_msg_s *msg, void *metadata) {
+  fiobj_free((FIOBJ)metadata);
+  (void)msg;
+}
+
+/* pre-encodes the message as an SSE event, once for all direct subscribers */
+static fio_msg_metadata_s http_sse_optimize(fio_str_info_s ch,
+                                           fio_str_info_s msg,
+                                           uint8_t is_json) {
+  fio_msg_metadata_s ret = {
+      .type_id = HTTP_SSE_OPTIMIZE_PUBSUB,
+      .on_finish = http_sse_optimize_free,
+  };
+  if (!msg.len)
+    return ret;
+  /* must match the `http_sse_write` call in `http_sse_on_message__direct` */
+  ret.metadata = (void *)http_sse_encode((struct http_sse_write_args){
+      .data = msg,
+  });
+  return ret;
+  (void)ch;
+  (void)is_json;
+}
+
+/* enables the SSE pre-encoding while direct subscriptions exist */
+static void http_sse_optimize4broadcasts(int enable) {
+  static intptr_t counter = 0;
+  if (enable) {
+    if (fio_atomic_add(&counter, 1) == 1)
+      fio_message_metadata_callback_set(http_sse_optimize, 1);
+  } else {
+    if (fio_atomic_sub(&counter, 1) == 0)
+      fio_message_metadata_callback_set(http_sse_optimize, 0);
+  }
+}
+
 /** The on message callback. the `*msg` pointer is to a temporary object. */
 static void http_sse_on_message(fio_msg_s *msg) {
   http_sse_internal_s *sse = msg->udata1;
@@ -1219,6 +2368,16 @@ static void http_sse_on_message(fio_msg_s *msg) {
   fio_protocol_s *pr = fio_protocol_try_lock(sse->uuid, FIO_PR_LOCK_TASK);
   if (!pr)
     goto postpone;
+  if (args->on_message == http_sse_on_message__direct) {
+    /* the pre-encoded event is shared (not copied) by all subscribers */
+    FIOBJ pre_encoded =
+        (FIOBJ)fio_message_metadata(msg, HTTP_SSE_OPTIMIZE_PUBSUB);
+    if (pre_encoded) {
+      (sse->vtable->http_sse_write)(&sse->sse, fiobj_dup(pre_encoded));
+      fio_protocol_unlock(pr, FIO_PR_LOCK_TASK);
+      return;
+    }
+  }
   args->on_message(&sse->sse, msg->channel, msg->msg, args->udata);
   fio_protocol_unlock(pr, FIO_PR_LOCK_TASK);
   return;
@@ -1241,6 +2400,8 @@ static void http_sse_on_unsubscribe(void *sse_, void *args_) {
   struct http_sse_subscribe_args *args = args_;
   if (args->on_unsubscribe)
     args->on_unsubscribe(args->udata);
+  if (args->on_message == http_sse_on_message__direct)
+    http_sse_optimize4broadcasts(0);
   fio_free(args);
   http_sse_try_free(sse);
 }
@@ -1265,8 +2426,10 @@ uintptr_t http_sse_subscribe(http_sse_s *sse_,
   http_sse_internal_s *sse = FIO_LS_EMBD_OBJ(http_sse_internal_s, sse, sse_);
   if (sse->uuid == -1)
     return 0;
-  if (!args.on_message)
+  if (!args.on_message) {
     args.on_message = http_sse_on_message__direct;
+    http_sse_optimize4broadcasts(1);
+  }
   struct http_sse_subscribe_args *udata = fio_malloc(sizeof(*udata));
   FIO_ASSERT_ALLOC(udata);
   *udata = args;
@@ -1335,25 +2498,8 @@ int http_sse_write(http_sse_s *sse, struct http_sse_write_args args) {
   if (!sse || !(args.id.len + args.data.len + args.event.len) ||
       fio_is_closed(FIO_LS_EMBD_OBJ(http_sse_internal_s, sse, sse)->uuid))
     return -1;
-  FIOBJ buf;
-  {
-    /* best guess at data length, ignoring missing fields and multiline data */
-    const size_t total = 4 + args.id.len + 2 + 7 + args.event.len + 2 + 6 +
-                         args.data.len + 2 + 7 + 10 + 4;
-    buf = fiobj_str_buf(total);
-  }
-  http_sse_copy2str(buf, (char *)"id: ", 4, args.id);
-  http_sse_copy2str(buf, (char *)"event: ", 7, args.event);
-  if (args.retry) {
-    FIOBJ i = fiobj_num_new(args.retry);
-    fiobj_str_write(buf, (char *)"retry: ", 7);
-    fiobj_str_join(buf, i);
-    fiobj_free(i);
-  }
-  http_sse_copy2str(buf, (char *)"data: ", 6, args.data);
-  fiobj_str_write(buf, "\r\n", 2);
   return FIO_LS_EMBD_OBJ(http_sse_internal_s, sse, sse)
-      ->vtable->http_sse_write(sse, buf);
+      ->vtable->http_sse_write(sse, http_sse_encode(args));
 }
 
 /**
@@ -1442,8 +2588,7 @@ static inline FIOBJ http_str2fiobj(char *s, size_t len, uint8_t encoded) {
   return fiobj_str_new(s, len);
 }
 
-/** Parses the query part of an HTTP request/response. Uses `http_add2hash`. */
-void http_parse_query(http_s *h) {
+static void http_parse_query_internal(http_s *h) {
   if (!h->query)
     return;
   if (!h->params)
@@ -1471,6 +2616,13 @@ void http_parse_query(http_s *h) {
   } while (q.len);
 }
 
+/** Parses the query part of an HTTP request/response. Uses `http_add2hash`. */
+void http_parse_query(http_s *h) {
+  fio_region_s *old = http_region_enter(h);
+  http_parse_query_internal(h);
+  fio_region_set(old);
+}
+
 static inline void http_parse_cookies_cookie_str(FIOBJ dest, FIOBJ str,
                                                  uint8_t is_url_encoded) {
   if (!FIOBJ_TYPE_IS(str, FIOBJ_T_STRING))
@@ -1513,10 +2665,10 @@ static inline void http_parse_cookies_setcookie_str(FIOBJ dest, FIOBJ str,
                   is_url_encoded);
 }
 
-/** Parses any Cookie / Set-Cookie headers, using the `http_add2hash` scheme. */
-void http_parse_cookies(http_s *h, uint8_t is_url_encoded) {
+static void http_parse_cookies_internal(http_s *h, uint8_t is_url_encoded) {
   if (!h->headers)
     return;
+  http_headers_load(h);
   if (h->cookies && fiobj_hash_count(h->cookies)) {
     FIO_LOG_WARNING("(http) attempting to parse cookies more than once.");
     return;
@@ -1540,22 +2692,145 @@ void http_parse_cookies(http_s *h, uint8_t is_url_encoded) {
       http_parse_cookies_cookie_str(h->cookies, c, is_url_encoded);
     }
   }
-  c = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_SET_COOKIE));
-  if (c) {
-    if (!h->cookies)
-      h->cookies = fiobj_hash_new();
-    if (FIOBJ_TYPE_IS(c, FIOBJ_T_ARRAY)) {
-      /* Array of Strings */
-      size_t count = fiobj_ary_count(c);
-      for (size_t i = 0; i < count; ++i) {
-        http_parse_cookies_setcookie_str(
-            h->cookies, fiobj_ary_index(c, (int64_t)i), is_url_encoded);
-      }
-    } else {
-      /* single string */
-      http_parse_cookies_setcookie_str(h->cookies, c, is_url_encoded);
+  c = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_SET_COOKIE));
+  if (c) {
+    if (!h->cookies)
+      h->cookies = fiobj_hash_new();
+    if (FIOBJ_TYPE_IS(c, FIOBJ_T_ARRAY)) {
+      /* Array of Strings */
+      size_t count = fiobj_ary_count(c);
+      for (size_t i = 0; i < count; ++i) {
+        http_parse_cookies_setcookie_str(
+            h->cookies, fiobj_ary_index(c, (int64_t)i), is_url_encoded);
+      }
+    } else {
+      /* single string */
+      http_parse_cookies_setcookie_str(h->cookies, c, is_url_encoded);
+    }
+  }
+}
+
+/** Parses any Cookie / Set-Cookie headers, using the `http_add2hash` scheme. */
+void http_parse_cookies(http_s *h, uint8_t is_url_encoded) {
+  fio_region_s *old = http_region_enter(h);
+  http_parse_cookies_internal(h, is_url_encoded);
+  fio_region_set(old);
+}
+
+/* *****************************************************************************
+Lazy query / cookie accessors (no Hash Maps)
+***************************************************************************** */
+
+/* copies (URL decoding when `decode` is set) up to `capa - 1` bytes. */
+static ssize_t http_value_copy(char *dest, size_t capa, const char *src,
+                               size_t len, uint8_t decode) {
+  size_t count = 0;
+  const char *end = src + len;
+  while (src < end) {
+    char c = *(src++);
+    if (decode && c == '+') {
+      c = ' ';
+    } else if (decode && c == '%') {
+      if (end - src < 2 || hex2byte((uint8_t *)&c, (uint8_t *)src))
+        return -1;
+      src += 2;
+    }
+    if (count + 1 < capa)
+      dest[count] = c;
+    ++count;
+  }
+  if (capa)
+    dest[(count < capa ? count : capa - 1)] = 0;
+  return (ssize_t)count;
+}
+
+/**
+ * Finds a single query parameter without parsing the whole query string (no
+ * Hash is created and `h->params` is left untouched).
+ */
+ssize_t http_query_get(http_s *h, const char *name, size_t name_len,
+                       char *dest, size_t capa) {
+  if (HTTP_INVALID_HANDLE(h) || !h->query || !name || !name_len)
+    return -1;
+  fio_str_info_s q = fiobj_obj2cstr(h->query);
+  while (q.len) {
+    char *cut = memchr(q.data, '&', q.len);
+    if (!cut)
+      cut = q.data + q.len;
+    char *cut2 = memchr(q.data, '=', (cut - q.data));
+    if (cut2 && (size_t)(cut2 - q.data) == name_len &&
+        !memcmp(q.data, name, name_len))
+      return http_value_copy(dest, capa, cut2 + 1, (size_t)(cut - (cut2 + 1)),
+                             1);
+    if (cut[0] == '&') {
+      /* protecting against some ...less informed... clients */
+      if (cut[1] == 'a' && cut[2] == 'm' && cut[3] == 'p' && cut[4] == ';')
+        cut += 5;
+      else
+        cut += 1;
+    }
+    if ((size_t)(cut - q.data) >= q.len)
+      break;
+    q.len -= (uintptr_t)(cut - q.data);
+    q.data = cut;
+  }
+  return -1;
+}
+
+/* scans a single "Cookie" header value for `name`. */
+static ssize_t http_cookie_get_str(fio_str_info_s s, const char *name,
+                                   size_t name_len, char *dest, size_t capa) {
+  while (s.len) {
+    if (s.data[0] == ' ') {
+      ++s.data;
+      --s.len;
+      continue;
     }
+    char *cut2 = memchr(s.data, ';', s.len);
+    if (!cut2)
+      cut2 = s.data + s.len;
+    char *cut = memchr(s.data, '=', cut2 - s.data);
+    if (cut && (size_t)(cut - s.data) == name_len &&
+        !memcmp(s.data, name, name_len))
+      return http_value_copy(dest, capa, cut + 1, (cut2 - (cut + 1)), 0);
+    if ((size_t)((cut2 + 1) - s.data) > s.len)
+      break;
+    s.len -= ((cut2 + 1) - s.data);
+    s.data = cut2 + 1;
+  }
+  return -1;
+}
+
+/**
+ * Finds a single request cookie without loading the headers or parsing the
+ * rest of the cookies (the value is copied as is, with no URL decoding).
+ */
+ssize_t http_cookie_get(http_s *h, const char *name, size_t name_len,
+                        char *dest, size_t capa) {
+  if (HTTP_INVALID_HANDLE(h) || !name || !name_len)
+    return -1;
+  static uint64_t cookie_hash;
+  if (!cookie_hash)
+    cookie_hash = fiobj_obj2hash(HTTP_HEADER_COOKIE);
+  fio_str_info_s c = http_header_slice(
+      h, (fio_str_info_s){.data = (char *)"cookie", .len = 6}, cookie_hash);
+  ssize_t ret = -1;
+  if (c.data)
+    ret = http_cookie_get_str(c, name, name_len, dest, capa);
+  if (ret >= 0)
+    return ret;
+  /* HTTP/2 clients may split the cookies across multiple headers */
+  FIOBJ ary = fiobj_hash_get2(h->headers, cookie_hash);
+  if (!FIOBJ_TYPE_IS(ary, FIOBJ_T_ARRAY))
+    return -1;
+  size_t count = fiobj_ary_count(ary);
+  for (size_t i = 1; i < count && ret < 0; ++i) {
+    FIOBJ tmp = fiobj_ary_index(ary, (int64_t)i);
+    if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_STRING))
+      ret = http_cookie_get_str(fiobj_obj2cstr(tmp), name, name_len, dest,
+                                capa);
   }
+  return ret;
 }
 
 /**
@@ -1784,16 +3059,50 @@ typedef struct {
   size_t partial_offset;
   size_t partial_length;
   FIOBJ partial_name;
+  /* streaming mode (`http_multipart_s`), the part's info is copied */
+  void (*on_part)(http_s *h, http_multipart_part_s *part);
+  FIOBJ partial_filename;
+  FIOBJ partial_mime;
 } http_fio_mime_s;
 
 #define http_mime_parser2fio(parser) ((http_fio_mime_s *)(parser))
 
+/* calls the streaming `on_part` callback for the current (partial) part */
+static void http_mime_stream_part(http_fio_mime_s *p, void *value,
+                                  size_t value_len, uint8_t start,
+                                  uint8_t end) {
+  http_multipart_part_s part = {
+      .name = fiobj_obj2cstr(p->partial_name),
+      .data = {.data = value, .len = value_len},
+      .start = start,
+      .end = end,
+  };
+  if (p->partial_filename)
+    part.filename = fiobj_obj2cstr(p->partial_filename);
+  if (p->partial_mime)
+    part.mime_type = fiobj_obj2cstr(p->partial_mime);
+  p->on_part(p->h, &part);
+}
+
 /** Called when all the data is available at once. */
 static void http_mime_parser_on_data(http_mime_parser_s *parser, void *name,
                                      size_t name_len, void *filename,
                                      size_t filename_len, void *mimetype,
                                      size_t mimetype_len, void *value,
                                      size_t value_len) {
+  if (http_mime_parser2fio(parser)->on_part) {
+    http_multipart_part_s part = {
+        .name = {.data = name, .len = name_len},
+        .filename = {.data = filename, .len = filename_len},
+        .mime_type = {.data = mimetype, .len = mimetype_len},
+        .data = {.data = value, .len = value_len},
+        .start = 1,
+        .end = 1,
+    };
+    http_mime_parser2fio(parser)->on_part(http_mime_parser2fio(parser)->h,
+                                          &part);
+    return;
+  }
   if (!filename_len) {
     http_add2hash(http_mime_parser2fio(parser)->h->params, name, name_len,
                   value, value_len, 0);
@@ -1823,6 +3132,16 @@ static void http_mime_parser_on_data(http_mime_parser_s *parser, void *name,
 static void http_mime_parser_on_partial_start(
     http_mime_parser_s *parser, void *name, size_t name_len, void *filename,
     size_t filename_len, void *mimetype, size_t mimetype_len) {
+  if (http_mime_parser2fio(parser)->on_part) {
+    http_fio_mime_s *p = http_mime_parser2fio(parser);
+    p->partial_name = fiobj_str_new(name, name_len);
+    if (filename)
+      p->partial_filename = fiobj_str_new(filename, filename_len);
+    if (mimetype)
+      p->partial_mime = fiobj_str_new(mimetype, mimetype_len);
+    http_mime_stream_part(p, NULL, 0, 1, 0);
+    return;
+  }
   http_mime_parser2fio(parser)->partial_length = 0;
   http_mime_parser2fio(parser)->partial_offset = 0;
   http_mime_parser2fio(parser)->partial_name = fiobj_str_new(name, name_len);
@@ -1849,6 +3168,10 @@ static void http_mime_parser_on_partial_start(
 /** Called when partial data is available. */
 static void http_mime_parser_on_partial_data(http_mime_parser_s *parser,
                                              void *value, size_t value_len) {
+  if (http_mime_parser2fio(parser)->on_part) {
+    http_mime_stream_part(http_mime_parser2fio(parser), value, value_len, 0, 0);
+    return;
+  }
   if (!http_mime_parser2fio(parser)->partial_offset)
     http_mime_parser2fio(parser)->partial_offset =
         http_mime_parser2fio(parser)->pos +
@@ -1860,6 +3183,15 @@ static void http_mime_parser_on_partial_data(http_mime_parser_s *parser,
 
 /** Called when the partial data is complete. */
 static void http_mime_parser_on_partial_end(http_mime_parser_s *parser) {
+  if (http_mime_parser2fio(parser)->on_part) {
+    http_fio_mime_s *p = http_mime_parser2fio(parser);
+    http_mime_stream_part(p, NULL, 0, 0, 1);
+    fiobj_free(p->partial_name);
+    fiobj_free(p->partial_filename);
+    fiobj_free(p->partial_mime);
+    p->partial_name = p->partial_filename = p->partial_mime = FIOBJ_INVALID;
+    return;
+  }
 
   fio_str_info_s tmp =
       fiobj_obj2cstr(http_mime_parser2fio(parser)->partial_name);
@@ -1896,20 +3228,13 @@ static inline size_t http_mime_decode_url(char *dest, const char *encoded,
   return http_decode_url(dest, encoded, length);
 }
 
-/**
- * Attempts to decode the request's body.
- *
- * Supported Types include:
- * * application/x-www-form-urlencoded
- * * application/json
- * * multipart/form-data
- */
-int http_parse_body(http_s *h) {
+static int http_parse_body_internal(http_s *h) {
   static uint64_t content_type_hash;
   if (!h->body)
     return -1;
   if (!content_type_hash)
     content_type_hash = fiobj_hash_string("content-type", 12);
+  http_headers_load(h);
   FIOBJ ct = fiobj_hash_get2(h->headers, content_type_hash);
   fio_str_info_s content_type = fiobj_obj2cstr(ct);
   if (content_type.len < 16)
@@ -1921,7 +3246,7 @@ int http_parse_body(http_s *h) {
       h->params = fiobj_hash_new();
     FIOBJ tmp = h->query;
     h->query = h->body;
-    http_parse_query(h);
+    http_parse_query_internal(h);
     h->query = tmp;
     return 0;
   }
@@ -1958,6 +3283,121 @@ int http_parse_body(http_s *h) {
   return 0;
 }
 
+/* *****************************************************************************
+Streaming multipart/form-data
+***************************************************************************** */
+
+struct http_multipart_s {
+  http_fio_mime_s p;
+  FIOBJ pending; /* data the MIME parser couldn't consume yet */
+  char content_type[];
+};
+
+/** Creates a streaming `multipart/form-data` parser for the request. */
+http_multipart_s *
+http_multipart_new(http_s *h,
+                   void (*on_part)(http_s *h, http_multipart_part_s *part)) {
+  if (!h || !on_part)
+    return NULL;
+  fio_str_info_s ct = http_header_get_slice(
+      h, (fio_str_info_s){.data = "content-type", .len = 12});
+  if (!ct.data)
+    return NULL;
+  http_multipart_s *m = malloc(sizeof(*m) + ct.len + 1);
+  FIO_ASSERT_ALLOC(m);
+  *m = (http_multipart_s){
+      .p = {.h = h, .on_part = on_part},
+  };
+  /* the boundary points into the Content-Type, which must persist */
+  memcpy(m->content_type, ct.data, ct.len);
+  m->content_type[ct.len] = 0;
+  if (http_mime_parser_init(&m->p.p, m->content_type, ct.len)) {
+    free(m);
+    return NULL;
+  }
+  return m;
+}
+
+/** Consumes a chunk of the request body, calling `on_part` as needed. */
+int http_multipart_consume(http_multipart_s *m, fio_str_info_s chunk) {
+  if (!m || m->p.p.error)
+    return -1;
+  if (m->p.p.done)
+    return 1;
+  fio_str_info_s data = chunk;
+  /* data is copied only while a previous chunk left some of it unconsumed */
+  const uint8_t buffered = m->pending && fiobj_obj2cstr(m->pending).len;
+  if (buffered) {
+    fiobj_str_write(m->pending, chunk.data, chunk.len);
+    data = fiobj_obj2cstr(m->pending);
+  }
+  size_t consumed = 0;
+  for (;;) {
+    size_t cons = http_mime_parse(&m->p.p, data.data + consumed,
+                                  data.len - consumed);
+    consumed += cons;
+    if (m->p.p.error && !cons && data.len - consumed < HTTP_MAX_HEADER_LENGTH) {
+      /* a part's headers were split between chunks, wait for more data */
+      m->p.p.error = 0;
+      break;
+    }
+    if (!cons || m->p.p.error || m->p.p.done || consumed == data.len)
+      break;
+  }
+  if (m->p.p.error)
+    return -1;
+  if (m->p.p.done) {
+    fiobj_free(m->pending);
+    m->pending = FIOBJ_INVALID;
+    return 1;
+  }
+  if (consumed == data.len) {
+    if (buffered)
+      fiobj_str_resize(m->pending, 0);
+    return 0;
+  }
+  if (data.len - consumed > HTTP_MAX_HEADER_LENGTH) {
+    m->p.p.error = 1;
+    return -1;
+  }
+  /* keep the unconsumed data (a boundary or a part's headers) */
+  if (buffered) {
+    memmove(data.data, data.data + consumed, data.len - consumed);
+    fiobj_str_resize(m->pending, data.len - consumed);
+    return 0;
+  }
+  if (!m->pending)
+    m->pending = fiobj_str_buf(HTTP_MAX_HEADER_LENGTH);
+  fiobj_str_write(m->pending, data.data + consumed, data.len - consumed);
+  return 0;
+}
+
+/** Frees the streaming `multipart/form-data` parser. */
+void http_multipart_free(http_multipart_s *m) {
+  if (!m)
+    return;
+  fiobj_free(m->pending);
+  fiobj_free(m->p.partial_name);
+  fiobj_free(m->p.partial_filename);
+  fiobj_free(m->p.partial_mime);
+  free(m);
+}
+
+/**
+ * Attempts to decode the request's body.
+ *
+ * Supported Types include:
+ * * application/x-www-form-urlencoded
+ * * application/json
+ * * multipart/form-data
+ */
+int http_parse_body(http_s *h) {
+  fio_region_s *old = http_region_enter(h);
+  int ret = http_parse_body_internal(h);
+  fio_region_set(old);
+  return ret;
+}
+
 /* *****************************************************************************
 HTTP Helper functions that could be used globally
 ***************************************************************************** */
@@ -1968,7 +3408,10 @@ HTTP Helper functions that could be used globally
  * debugging.
  */
 FIOBJ http_req2str(http_s *h) {
-  if (HTTP_INVALID_HANDLE(h) || !fiobj_hash_count(h->headers))
+  if (HTTP_INVALID_HANDLE(h))
+    return FIOBJ_INVALID;
+  http_headers_load(h);
+  if (!fiobj_hash_count(h->headers))
     return FIOBJ_INVALID;
 
   struct header_writer_s w;
@@ -2011,63 +3454,351 @@ FIOBJ http_req2str(http_s *h) {
   return w.dest;
 }
 
-void http_write_log(http_s *h) {
-  FIOBJ l = fiobj_str_buf(128);
+/* *****************************************************************************
+Access log (buffered, written by a background thread)
 
-  intptr_t bytes_sent = fiobj_obj2num(fiobj_hash_get2(
-      h->private_data.out_headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH)));
+Request threads copy a binary record to a thread local ring buffer. A logger
+thread formats the records and writes them in large batches. Records are
+dropped (and counted) when a ring buffer is full, so logging never blocks.
+***************************************************************************** */
 
-  struct timespec start, end;
-  clock_gettime(CLOCK_REALTIME, &end);
-  start = h->received_at;
+#ifndef HTTP_LOG_RING_SIZE
+/** The number of log records buffered by each thread (a power of 2). */
+#define HTTP_LOG_RING_SIZE 256
+#endif
 
-  {
-    // TODO Guess IP address from headers (forwarded) where possible
-    fio_str_info_s peer = fio_peer_addr(http2protocol(h)->uuid);
-    fiobj_str_write(l, peer.data, peer.len);
+#ifndef HTTP_LOG_FLUSH_INTERVAL
+/** The number of milliseconds the logger thread waits when idle. */
+#define HTTP_LOG_FLUSH_INTERVAL 10
+#endif
+
+#define HTTP_LOG_DEFAULT_FORMAT "%a - - [%t] \"%r\" %s %b %Dms"
+
+/* a (binary) log record, strings are truncated to fit the record */
+typedef struct {
+  time_t time;       /* the time the response was completed */
+  intptr_t bytes;    /* the Content-Length header (or -1) */
+  uint32_t duration; /* milliseconds */
+  uint16_t status;
+  uint8_t addr_len;
+  uint8_t method_len;
+  uint8_t version_len;
+  uint16_t path_len;
+  char data[320]; /* address, method, version, path */
+} http_log_record_s;
+
+/* a single producer (request thread), single consumer (logger) ring buffer */
+typedef struct {
+  fio_ls_embd_s node;
+  size_t head; /* written by the request thread */
+  size_t tail; /* written by the logger thread */
+  size_t dropped;
+  size_t sampled;
+  http_log_record_s records[HTTP_LOG_RING_SIZE];
+} http_log_ring_s;
+
+static struct {
+  fio_ls_embd_s rings;
+  void *thread;
+  size_t sample;
+  fio_lock_i lock;
+  volatile uint8_t running;
+  uint8_t closed; /* set after the final flush, records are written inline */
+  char format[256];
+} http_log = {
+    .rings = FIO_LS_INIT(http_log.rings),
+    .lock = FIO_LOCK_INIT,
+    .format = HTTP_LOG_DEFAULT_FORMAT,
+};
+
+static __thread http_log_ring_s *http_log_ring;
+
+#undef http_log_setup
+/** Sets the access log's format and sampling rate. */
+void http_log_setup(struct http_log_settings_s settings) {
+  const char *format =
+      settings.format ? settings.format : HTTP_LOG_DEFAULT_FORMAT;
+  size_t len = strlen(format);
+  if (len >= sizeof(http_log.format)) {
+    FIO_LOG_WARNING("(http) access log format too long, truncated.");
+    len = sizeof(http_log.format) - 1;
+  }
+  memcpy(http_log.format, format, len);
+  http_log.format[len] = 0;
+  http_log.sample = settings.sample;
+}
+
+/* copies a record to the ring buffer, returns -1 if the ring was full */
+static int http_log_ring_push(http_log_ring_s *ring,
+                              const http_log_record_s *r) {
+  const size_t head = ring->head;
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >=
+      HTTP_LOG_RING_SIZE) {
+    fio_atomic_add(&ring->dropped, 1);
+    return -1;
+  }
+  ring->records[head & (HTTP_LOG_RING_SIZE - 1)] = *r;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* formats a record using the log format, returns the line's length */
+static size_t http_log_format_record(char *dest, const http_log_record_s *r) {
+  /* `dest` must fit the record's data, the date and 4 numbers per `%` */
+  const char *addr = r->data;
+  const char *method = addr + r->addr_len;
+  const char *version = method + r->method_len;
+  const char *path = version + r->version_len;
+  size_t len = 0;
+  for (const char *pos = http_log.format; *pos; ++pos) {
+    if (*pos != '%' || !pos[1]) {
+      dest[len++] = *pos;
+      continue;
+    }
+    switch (*(++pos)) {
+    case 'a':
+      if (!r->addr_len) {
+        memcpy(dest + len, "[unknown]", 9);
+        len += 9;
+        break;
+      }
+      memcpy(dest + len, addr, r->addr_len);
+      len += r->addr_len;
+      break;
+    case 't':
+      len += http_time2str(dest + len, r->time);
+      break;
+    case 'r':
+      memcpy(dest + len, method, r->method_len);
+      len += r->method_len;
+      dest[len++] = ' ';
+      memcpy(dest + len, path, r->path_len);
+      len += r->path_len;
+      dest[len++] = ' ';
+      /* fallthrough */
+    case 'H':
+      memcpy(dest + len, version, r->version_len);
+      len += r->version_len;
+      break;
+    case 'm':
+      memcpy(dest + len, method, r->method_len);
+      len += r->method_len;
+      break;
+    case 'U':
+      memcpy(dest + len, path, r->path_len);
+      len += r->path_len;
+      break;
+    case 's':
+      len += fio_ltoa(dest + len, r->status, 10);
+      break;
+    case 'b':
+      if (r->bytes > 0) {
+        len += fio_ltoa(dest + len, r->bytes, 10);
+        dest[len++] = 'b';
+      } else {
+        dest[len++] = '-';
+        dest[len++] = '-';
+      }
+      break;
+    case 'D':
+      len += fio_ltoa(dest + len, r->duration, 10);
+      break;
+    default:
+      dest[len++] = '%';
+      if (*pos != '%')
+        dest[len++] = *pos;
+    }
   }
-  fio_str_info_s buff = fiobj_obj2cstr(l);
+  dest[len++] = '\r';
+  dest[len++] = '\n';
+  return len;
+}
 
-  if (buff.len == 0) {
-    memcpy(buff.data, "[unknown]", 9);
-    buff.len = 9;
+/* the longest line the log format could produce */
+static size_t http_log_line_limit(void) {
+  size_t limit = 2; /* EOL */
+  for (const char *pos = http_log.format; *pos; ++pos) {
+    ++limit;
+    if (*pos == '%')
+      limit += sizeof(((http_log_record_s *)0)->data) + 48;
   }
-  memcpy(buff.data + buff.len, " - - [", 6);
-  buff.len += 6;
-  fiobj_str_resize(l, buff.len);
-  {
-    FIOBJ date;
-    fio_lock(&date_lock);
-    date = fiobj_dup(current_date);
-    fio_unlock(&date_lock);
-    fiobj_str_join(l, current_date);
-    fiobj_free(date);
-  }
-  fiobj_str_write(l, "] \"", 3);
-  fiobj_str_join(l, h->method);
-  fiobj_str_write(l, " ", 1);
-  fiobj_str_join(l, h->path);
-  fiobj_str_write(l, " ", 1);
-  fiobj_str_join(l, h->version);
-  fiobj_str_write(l, "\" ", 2);
-  if (bytes_sent > 0) {
-    fiobj_str_write_i(l, h->status);
-    fiobj_str_write(l, " ", 1);
-    fiobj_str_write_i(l, bytes_sent);
-    fiobj_str_write(l, "b ", 2);
-  } else {
-    fiobj_str_join(l, fiobj_num_tmp(h->status));
-    fiobj_str_write(l, " -- ", 4);
+  return limit;
+}
+
+/* formats and writes all the pending records, returns the number written */
+static size_t http_log_drain(void) {
+  static char buf[1 << 16];
+  const size_t line_limit = http_log_line_limit();
+  size_t count = 0;
+  size_t dropped = 0;
+  size_t len = 0;
+  fio_lock(&http_log.lock);
+  FIO_LS_EMBD_FOR(&http_log.rings, node) {
+    http_log_ring_s *ring = FIO_LS_EMBD_OBJ(http_log_ring_s, node, node);
+    const size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (size_t i = ring->tail; i != head; ++i) {
+      if (len + line_limit > sizeof(buf)) {
+        fwrite(buf, 1, len, stderr);
+        len = 0;
+      }
+      len += http_log_format_record(
+          buf + len, ring->records + (i & (HTTP_LOG_RING_SIZE - 1)));
+      ++count;
+    }
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+    if (ring->dropped)
+      dropped += fio_atomic_xchange(&ring->dropped, 0);
+  }
+  if (len)
+    fwrite(buf, 1, len, stderr);
+  fio_unlock(&http_log.lock);
+  if (dropped)
+    FIO_LOG_WARNING("(http) %zu access log records dropped (buffer full).",
+                    dropped);
+  return count;
+}
+
+static void *http_log_thread(void *ignr_) {
+  const struct timespec tm = {.tv_nsec = HTTP_LOG_FLUSH_INTERVAL * 1000000};
+  while (http_log.running) {
+    if (!http_log_drain())
+      nanosleep(&tm, NULL);
+  }
+  return ignr_;
+}
+
+/* starts the logger thread (unless it's running or the log was flushed) */
+static void http_log_start(void) {
+  fio_lock(&http_log.lock);
+  if (!http_log.thread && !http_log.closed) {
+    http_log.running = 1;
+    http_log.thread = fio_thread_new(http_log_thread, NULL);
+    if (!http_log.thread) {
+      http_log.running = 0;
+      FIO_LOG_ERROR("(http) couldn't start the access log thread.");
+    }
+  }
+  fio_unlock(&http_log.lock);
+}
+
+/* writes the ring's pending records and frees it (thread exit) */
+static void http_log_ring_free(void *ring_) {
+  http_log_ring_s *ring = ring_;
+  if (!ring)
+    return;
+  if (ring == http_log_ring)
+    http_log_ring = NULL;
+  http_log_drain();
+  fio_lock(&http_log.lock);
+  fio_ls_embd_remove(&ring->node);
+  fio_unlock(&http_log.lock);
+  fio_free(ring);
+}
+
+static pthread_key_t http_log_ring_key;
+static pthread_once_t http_log_ring_once = PTHREAD_ONCE_INIT;
+static uint8_t http_log_ring_key_valid;
+
+static void http_log_ring_init(void) {
+  http_log_ring_key_valid =
+      !pthread_key_create(&http_log_ring_key, http_log_ring_free);
+}
+
+/* allocates and registers the calling thread's ring buffer */
+static http_log_ring_s *http_log_ring_new(void) {
+  http_log_ring_s *ring = fio_malloc(sizeof(*ring));
+  FIO_ASSERT_ALLOC(ring);
+  ring->head = ring->tail = ring->dropped = ring->sampled = 0;
+  fio_lock(&http_log.lock);
+  fio_ls_embd_push(&http_log.rings, &ring->node);
+  fio_unlock(&http_log.lock);
+  /* the ring is freed once the thread exits */
+  pthread_once(&http_log_ring_once, http_log_ring_init);
+  if (http_log_ring_key_valid)
+    pthread_setspecific(http_log_ring_key, ring);
+  return ring;
+}
+
+/** Stops the logger thread and writes any pending records. */
+void http_log_flush(void) {
+  fio_lock(&http_log.lock);
+  void *thread = http_log.thread;
+  http_log.thread = NULL;
+  http_log.running = 0;
+  http_log.closed = 1;
+  fio_unlock(&http_log.lock);
+  if (thread)
+    fio_thread_join(thread);
+  http_log_drain();
+  /* thread specific destructors don't run for the main thread */
+  if (http_log_ring && http_log_ring_key_valid)
+    pthread_setspecific(http_log_ring_key, NULL);
+  http_log_ring_free(http_log_ring);
+}
+
+/* the logger thread isn't inherited, the records are the parent's to write */
+void http_log_on_fork(void *ignr_) {
+  http_log.lock = FIO_LOCK_INIT;
+  http_log.thread = NULL;
+  http_log.running = 0;
+  FIO_LS_EMBD_FOR(&http_log.rings, node) {
+    http_log_ring_s *ring = FIO_LS_EMBD_OBJ(http_log_ring_s, node, node);
+    ring->tail = ring->head;
+    ring->dropped = 0;
   }
+  (void)ignr_;
+}
+
+/* copies up to `limit` bytes of the String to the record's data */
+static inline size_t http_log_cpy(char *dest, FIOBJ o, size_t limit) {
+  fio_str_info_s s = fiobj_obj2cstr(o);
+  if (s.len > limit)
+    s.len = limit;
+  memcpy(dest, s.data, s.len);
+  return s.len;
+}
 
-  bytes_sent = ((end.tv_sec - start.tv_sec) * 1000) +
-               ((end.tv_nsec - start.tv_nsec) / 1000000);
-  fiobj_str_write_i(l, bytes_sent);
-  fiobj_str_write(l, "ms\r\n", 4);
+void http_write_log(http_s *h) {
+  http_log_ring_s *ring = http_log_ring;
+  if (!ring)
+    ring = http_log_ring = http_log_ring_new();
+  if (http_log.sample > 1 && (ring->sampled++ % http_log.sample))
+    return;
+  if (!http_log.running)
+    http_log_start(); /* lazy start (also in new worker processes) */
+  if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >=
+      HTTP_LOG_RING_SIZE) {
+    /* don't bother collecting the data */
+    fio_atomic_add(&ring->dropped, 1);
+    return;
+  }
 
-  buff = fiobj_obj2cstr(l);
-  fwrite(buff.data, 1, buff.len, stderr);
-  fiobj_free(l);
+  http_log_record_s r;
+  r.bytes = fiobj_obj2num(fiobj_hash_get2(
+      h->private_data.out_headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH)));
+  struct timespec end;
+  clock_gettime(CLOCK_REALTIME, &end);
+  r.time = end.tv_sec;
+  r.duration = ((end.tv_sec - h->received_at.tv_sec) * 1000) +
+               ((end.tv_nsec - h->received_at.tv_nsec) / 1000000);
+  r.status = h->status;
+  {
+    // TODO Guess IP address from headers (forwarded) where possible
+    fio_str_info_s peer = fio_peer_addr(http2protocol(h)->uuid);
+    if (peer.len > 64)
+      peer.len = 64;
+    memcpy(r.data, peer.data, peer.len);
+    r.addr_len = peer.len;
+  }
+  char *pos = r.data + r.addr_len;
+  r.method_len = http_log_cpy(pos, h->method, 16);
+  pos += r.method_len;
+  r.version_len = http_log_cpy(pos, h->version, 16);
+  pos += r.version_len;
+  r.path_len = http_log_cpy(pos, h->path, (r.data + sizeof(r.data)) - pos);
+  http_log_ring_push(ring, &r);
+  if (http_log.closed)
+    http_log_drain();
 }
 
 /**
@@ -2492,6 +4223,7 @@ void http_mimetype_register(char *file_ext, size_t file_ext_len,
     fio_mime_set_remove(&fio_http_mime_types, hash, FIOBJ_INVALID, NULL);
   } else {
     FIOBJ old = FIOBJ_INVALID;
+    fiobj_share(mime_type_str); /* the registry is used by all the threads */
     fio_mime_set_overwrite(&fio_http_mime_types, hash, mime_type_str, &old);
     if (old != FIOBJ_INVALID) {
       FIO_LOG_WARNING("mime-type collision: %.*s was %s, now %s",
@@ -2689,11 +4421,557 @@ fio_str_info_s http_status2str(uintptr_t status) {
 #undef HTTP_SET_STATUS_STR
 
 #if DEBUG
+#include <http1_parser.h>
+
+/* defined by `hpack.h` (included once, by `http2.c`) */
+void hpack_test(void);
+/* defined by `http2.c` */
+void http2_header_order_test(void);
+/* defined by `http_compress.c` */
+void http_compress_test(void);
+/* defined by `http_router.c` */
+void http_router_test(void);
+/* defined by `websockets.c` */
+void websocket_deflate_test(void);
+void websocket_stream_test(void);
+/* defined by `http1.c` */
+void http1_buffer_pool_test(void);
+void http1_stream_test(void);
+void http1_lazy_headers_test(void);
+void http1_template_test(void);
+void http1_sendfile_range_test(void);
+
+typedef struct {
+  fio_str_info_s method, path, query, version, name, value;
+  size_t headers, requests, errors, body;
+} http1_parser_test_s;
+
+#define HTTP1_PARSER_TEST_STORE(field, data_, len_)                            \
+  (((http1_parser_test_s *)parser->udata)->field =                             \
+       (fio_str_info_s){.data = (data_), .len = (len_)},                       \
+   0)
+
+static int http1_test_on_request(http1_parser_s *parser) {
+  ++((http1_parser_test_s *)parser->udata)->requests;
+  return 0;
+}
+static int http1_test_on_response(http1_parser_s *parser) {
+  (void)parser;
+  return -1;
+}
+static int http1_test_on_method(http1_parser_s *parser, char *d, size_t l) {
+  return HTTP1_PARSER_TEST_STORE(method, d, l);
+}
+static int http1_test_on_status(http1_parser_s *parser, size_t status,
+                                char *d, size_t l) {
+  (void)parser, (void)status, (void)d, (void)l;
+  return -1;
+}
+static int http1_test_on_path(http1_parser_s *parser, char *d, size_t l) {
+  return HTTP1_PARSER_TEST_STORE(path, d, l);
+}
+static int http1_test_on_query(http1_parser_s *parser, char *d, size_t l) {
+  return HTTP1_PARSER_TEST_STORE(query, d, l);
+}
+static int http1_test_on_version(http1_parser_s *parser, char *d, size_t l) {
+  return HTTP1_PARSER_TEST_STORE(version, d, l);
+}
+static int http1_test_on_header(http1_parser_s *parser, char *n, size_t nl,
+                                char *v, size_t vl) {
+  http1_parser_test_s *t = parser->udata;
+  if (t->headers++)
+    return 0;
+  t->name = (fio_str_info_s){.data = n, .len = nl};
+  t->value = (fio_str_info_s){.data = v, .len = vl};
+  return 0;
+}
+static int http1_test_on_body_chunk(http1_parser_s *parser, char *d,
+                                    size_t l) {
+  ((http1_parser_test_s *)parser->udata)->body += l;
+  (void)d;
+  return 0;
+}
+static int http1_test_on_error(http1_parser_s *parser) {
+  ++((http1_parser_test_s *)parser->udata)->errors;
+  return 0;
+}
+#undef HTTP1_PARSER_TEST_STORE
+
+static http1_parser_test_s http1_parser_test_run(char *request) {
+  http1_parser_test_s t = {.headers = 0};
+  http1_parser_s parser = {.udata = &t};
+  http1_fio_parser(.parser = &parser, .buffer = request,
+                   .length = strlen(request),
+                   .on_request = http1_test_on_request,
+                   .on_response = http1_test_on_response,
+                   .on_method = http1_test_on_method,
+                   .on_status = http1_test_on_status,
+                   .on_path = http1_test_on_path,
+                   .on_query = http1_test_on_query,
+                   .on_http_version = http1_test_on_version,
+                   .on_header = http1_test_on_header,
+                   .on_body_chunk = http1_test_on_body_chunk,
+                   .on_error = http1_test_on_error);
+  return t;
+}
+
+#define HTTP1_PARSER_TEST_EQ(field, expected)                                  \
+  FIO_ASSERT(t.field.len == sizeof(expected) - 1 &&                            \
+                 !memcmp(t.field.data, (expected), sizeof(expected) - 1),      \
+             "HTTP/1.1 parser " #field " error: %.*s != %s", (int)t.field.len, \
+             t.field.data, (expected))
+
+static void http1_parser_test(void) {
+  fprintf(stderr, "* Testing HTTP/1.1 parser.\n");
+  char r1[] = "GET /a/long/path/crossing/simd/blocks?q=1&z=2 HTTP/1.1\r\n"
+              "X-Header-Name-Longer-Than-16: Value\r\n"
+              "Host: example.com\r\n\r\n";
+  http1_parser_test_s t = http1_parser_test_run(r1);
+  FIO_ASSERT(t.requests == 1 && !t.errors && t.headers == 2,
+             "HTTP/1.1 parser failed to parse a valid request");
+  HTTP1_PARSER_TEST_EQ(method, "GET");
+  HTTP1_PARSER_TEST_EQ(path, "/a/long/path/crossing/simd/blocks");
+  HTTP1_PARSER_TEST_EQ(query, "q=1&z=2");
+  HTTP1_PARSER_TEST_EQ(version, "HTTP/1.1");
+#if HTTP_HEADERS_LOWERCASE
+  HTTP1_PARSER_TEST_EQ(name, "x-header-name-longer-than-16");
+#endif
+  HTTP1_PARSER_TEST_EQ(value, "Value");
+
+  char r2[] = "POST /path/without/a/query/string HTTP/1.1\r\n"
+              "Content-Length: 0\r\n\r\n";
+  t = http1_parser_test_run(r2);
+  FIO_ASSERT(t.requests == 1 && !t.errors && !t.query.len,
+             "HTTP/1.1 parser failed to parse a request without a query");
+  HTTP1_PARSER_TEST_EQ(path, "/path/without/a/query/string");
+
+  char r3[] = "GET / HTTP/1.1\r\nBad Header-Name-With-Space: x\r\n\r\n";
+  t = http1_parser_test_run(r3);
+  FIO_ASSERT(!t.requests && t.errors,
+             "HTTP/1.1 parser should reject whitespace in header names");
+
+  char r4[] = "GET / HTTP/1.1\r\n: no name\r\n\r\n";
+  t = http1_parser_test_run(r4);
+  FIO_ASSERT(!t.requests && t.errors,
+             "HTTP/1.1 parser should reject empty header names");
+
+  char r5[] = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+              "5\r\nhello\r\n3\r\nabc\r\n0\r\n\r\n";
+  t = http1_parser_test_run(r5);
+  FIO_ASSERT(t.requests == 1 && !t.errors && t.body == 8,
+             "HTTP/1.1 parser failed to parse a chunked body (%zu bytes)",
+             t.body);
+}
+#undef HTTP1_PARSER_TEST_EQ
+
+/* part data pointing into this chunk wasn't copied */
+static fio_str_info_s http_multipart_test_chunk;
+static size_t http_multipart_test_direct;
+
+/* collects streamed parts as "name[filename]=data;" */
+static void http_multipart_test_on_part(http_s *h,
+                                        http_multipart_part_s *part) {
+  FIOBJ out = (FIOBJ)h->udata;
+  if (part->data.len && part->data.data >= http_multipart_test_chunk.data &&
+      part->data.data + part->data.len <=
+          http_multipart_test_chunk.data + http_multipart_test_chunk.len)
+    ++http_multipart_test_direct;
+  if (part->start) {
+    fiobj_str_write(out, part->name.data, part->name.len);
+    if (part->filename.data) {
+      fiobj_str_write(out, "[", 1);
+      fiobj_str_write(out, part->filename.data, part->filename.len);
+      fiobj_str_write(out, "]", 1);
+    }
+    fiobj_str_write(out, "=", 1);
+  }
+  fiobj_str_write(out, part->data.data, part->data.len);
+  if (part->end)
+    fiobj_str_write(out, ";", 1);
+}
+
+static void http_multipart_test(void) {
+  fprintf(stderr, "* Testing streaming multipart/form-data parsing.\n");
+  char body[] = "--XyZ\r\n"
+                "Content-Disposition: form-data; name=\"field\"\r\n"
+                "\r\n"
+                "value\r\n"
+                "--XyZ\r\n"
+                "Content-Disposition: form-data; name=\"file\"; "
+                "filename=\"a.txt\"\r\n"
+                "Content-Type: text/plain\r\n"
+                "\r\n"
+                "line 1\r\n--Xy line 2\r\n"
+                "--XyZ--\r\n";
+  const char *expected = "field=value;file[a.txt]=line 1\r\n--Xy line 2;";
+  const size_t steps[] = {1, 3, 7, 16, sizeof(body)};
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); ++i) {
+    http_s h;
+    http_s_new(&h, NULL, NULL);
+    h.method = fiobj_str_new("POST", 4);
+    FIOBJ name = fiobj_str_new("content-type", 12);
+    fiobj_hash_set(h.headers, name,
+                   fiobj_str_new("multipart/form-data; boundary=XyZ", 33));
+    fiobj_free(name);
+    FIOBJ out = fiobj_str_buf(128);
+    h.udata = (void *)out;
+    http_multipart_s *m = http_multipart_new(&h, http_multipart_test_on_part);
+    FIO_ASSERT(m, "http_multipart_new failed");
+    int ret = 0;
+    for (size_t pos = 0; pos < sizeof(body) - 1 && !ret; pos += steps[i]) {
+      size_t len = steps[i];
+      if (pos + len > sizeof(body) - 1)
+        len = sizeof(body) - 1 - pos;
+      ret = http_multipart_consume(
+          m, (fio_str_info_s){.data = body + pos, .len = len});
+    }
+    FIO_ASSERT(ret == 1, "streaming multipart parser didn't finish (%d, %zu)",
+               ret, steps[i]);
+    fio_str_info_s result = fiobj_obj2cstr(out);
+    FIO_ASSERT(result.len == strlen(expected) &&
+                   !memcmp(result.data, expected, result.len),
+               "streaming multipart parser error (%zu):\n%s", steps[i],
+               result.data);
+    http_multipart_free(m);
+    fiobj_free(out);
+    http_s_destroy(&h, 0);
+  }
+  {
+    /* once the unconsumed data was parsed, chunks are parsed in place */
+    http_s h;
+    http_s_new(&h, NULL, NULL);
+    h.method = fiobj_str_new("POST", 4);
+    FIOBJ name = fiobj_str_new("content-type", 12);
+    fiobj_hash_set(h.headers, name,
+                   fiobj_str_new("multipart/form-data; boundary=XyZ", 33));
+    fiobj_free(name);
+    FIOBJ out = fiobj_str_buf(128);
+    h.udata = (void *)out;
+    http_multipart_s *m = http_multipart_new(&h, http_multipart_test_on_part);
+    const size_t split[] = {10, (size_t)(strstr(body, "line 1") + 3 - body),
+                            sizeof(body) - 1};
+    int ret = 0;
+    for (size_t i = 0, pos = 0; i < 3; pos = split[i++]) {
+      http_multipart_test_chunk =
+          (fio_str_info_s){.data = body + pos, .len = split[i] - pos};
+      http_multipart_test_direct = 0;
+      ret = http_multipart_consume(m, http_multipart_test_chunk);
+      FIO_ASSERT(ret == (i == 2),
+                 "streaming multipart parser error (chunk %zu)", i);
+    }
+    FIO_ASSERT(http_multipart_test_direct,
+               "streaming multipart parser copied a chunk it could parse");
+    fio_str_info_s result = fiobj_obj2cstr(out);
+    FIO_ASSERT(result.len == strlen(expected) &&
+                   !memcmp(result.data, expected, result.len),
+               "streaming multipart parser error:\n%s", result.data);
+    http_multipart_test_chunk = (fio_str_info_s){.data = NULL};
+    http_multipart_free(m);
+    fiobj_free(out);
+    http_s_destroy(&h, 0);
+  }
+}
+
+static void http_pool_test(void) {
+  fprintf(stderr, "* Testing the HTTP client connection pool.\n");
+  /* keep-alive detection */
+  struct {
+    const char *version;
+    const char *connection;
+    int expected;
+  } ka[] = {{"HTTP/1.1", NULL, 1},      {"HTTP/1.0", NULL, 0},
+            {"HTTP/1.1", "close", 0},   {"HTTP/1.0", "keep-alive", 1},
+            {"HTTP/1.1", "Close", 0}};
+  for (size_t i = 0; i < sizeof(ka) / sizeof(ka[0]); ++i) {
+    http_s h;
+    http_s_new(&h, NULL, NULL);
+    h.version = fiobj_str_new(ka[i].version, strlen(ka[i].version));
+    if (ka[i].connection)
+      fiobj_hash_set(h.headers, HTTP_HEADER_CONNECTION,
+                     fiobj_str_new(ka[i].connection,
+                                   strlen(ka[i].connection)));
+    FIO_ASSERT(http_pool_keep_alive(&h) == ka[i].expected,
+               "keep-alive detection error (%s, %s)", ka[i].version,
+               ka[i].connection ? ka[i].connection : "-");
+    http_s_destroy(&h, 0);
+  }
+  /* request assignment (2 pipelined requests per connection) */
+  http_pool_s pool = {.pipeline = 2, .limit = 1};
+  pool.idle = (fio_ls_embd_s)FIO_LS_INIT(pool.idle);
+  pool.waiting = (fio_ls_embd_s)FIO_LS_INIT(pool.waiting);
+  http_pool_conn_s c = {.pool = &pool, .uuid = -1};
+  c.node = (fio_ls_embd_s)FIO_LS_INIT(c.node);
+  c.requests = (fio_ls_embd_s)FIO_LS_INIT(c.requests);
+  http_pool_req_s r[4] = {{.sent = 0}};
+  FIO_ASSERT(!http_pool_assign_unsafe(&c, r),
+             "connecting sockets shouldn't schedule a send task");
+  for (size_t i = 2; i < 4; ++i)
+    fio_ls_embd_push(&pool.waiting, &r[i].node);
+  c.uuid = 1;
+  FIO_ASSERT(http_pool_available_unsafe(&c) && c.scheduled && c.count == 2,
+             "waiting requests should be assigned (up to `pipeline`)");
+  FIO_ASSERT(!fio_ls_embd_any(&c.node) &&
+                 c.requests.next == &r[0].node && r[0].node.next == &r[2].node,
+             "a full connection shouldn't be idle (or requests out of order)");
+  fio_ls_embd_remove(&r[0].node);
+  --c.count;
+  FIO_ASSERT(!http_pool_available_unsafe(&c) && c.count == 2 &&
+                 !fio_ls_embd_any(&pool.waiting) && !fio_ls_embd_any(&c.node),
+             "the next waiting request should be assigned (no new task)");
+  fio_ls_embd_remove(&r[2].node);
+  fio_ls_embd_remove(&r[3].node);
+  c.count = 0;
+  http_pool_available_unsafe(&c);
+  FIO_ASSERT(pool.idle.next == &c.node, "an available connection is idle");
+  fio_ls_embd_remove(&c.node);
+}
+
+static void *http_log_test_thread(void *ignr_) {
+  http_log_ring = http_log_ring_new();
+  (void)ignr_;
+  return http_log_ring;
+}
+
+static void http_log_test(void) {
+  fprintf(stderr, "* Testing the access log records.\n");
+  http_log_record_s r = {
+      .time = 0, .bytes = 12, .duration = 3, .status = 200,
+      .addr_len = 9, .method_len = 3, .version_len = 8, .path_len = 2,
+  };
+  memcpy(r.data, "127.0.0.1GETHTTP/1.1/a", 22);
+  char buf[1024];
+  size_t len = http_log_format_record(buf, &r);
+  const char expected[] = "127.0.0.1 - - [Thu, 01 Jan 1970 00:00:00 GMT] "
+                          "\"GET /a HTTP/1.1\" 200 12b 3ms\r\n";
+  FIO_ASSERT(len == sizeof(expected) - 1 && !memcmp(buf, expected, len),
+             "access log default format error: %.*s", (int)len, buf);
+  http_log_setup((struct http_log_settings_s){.format = "%m %U %s %b %% %q",
+                                              .sample = 2});
+  r.bytes = -1;
+  len = http_log_format_record(buf, &r);
+  FIO_ASSERT(len == 20 && !memcmp(buf, "GET /a 200 -- % %q\r\n", len),
+             "access log custom format error: %.*s", (int)len, buf);
+  FIO_ASSERT(http_log_line_limit() >= 4 * sizeof(r.data),
+             "access log line limit too short");
+  r.bytes = 12;
+  const struct {
+    const char *format;
+    const char *expected;
+  } directives[] = {
+      {"%a", "127.0.0.1\r\n"},
+      {"%t", "Thu, 01 Jan 1970 00:00:00 GMT\r\n"},
+      {"%r", "GET /a HTTP/1.1\r\n"},
+      {"%H", "HTTP/1.1\r\n"},
+      {"%m", "GET\r\n"},
+      {"%U", "/a\r\n"},
+      {"%s", "200\r\n"},
+      {"%b", "12b\r\n"},
+      {"%D", "3\r\n"},
+      {"%%", "%\r\n"},
+      {"%q", "%q\r\n"},
+      {"trailing %", "trailing %\r\n"},
+      {NULL, NULL},
+  };
+  for (size_t i = 0; directives[i].format; ++i) {
+    http_log_setup(
+        (struct http_log_settings_s){.format = directives[i].format});
+    len = http_log_format_record(buf, &r);
+    FIO_ASSERT(len == strlen(directives[i].expected) &&
+                   !memcmp(buf, directives[i].expected, len),
+               "access log format error for \"%s\": %.*s",
+               directives[i].format, (int)len, buf);
+  }
+  {
+    http_log_record_s anon = r;
+    anon.addr_len = 0;
+    memcpy(anon.data, "GETHTTP/1.1/a", 13);
+    http_log_setup((struct http_log_settings_s){.format = "%a %r"});
+    len = http_log_format_record(buf, &anon);
+    FIO_ASSERT(len == 27 && !memcmp(buf, "[unknown] GET /a HTTP/1.1\r\n", len),
+               "access log unknown address error: %.*s", (int)len, buf);
+  }
+  http_log_setup((struct http_log_settings_s){.format = NULL});
+  /* full ring buffers drop records instead of blocking */
+  http_log_ring_s *ring = fio_malloc(sizeof(*ring));
+  FIO_ASSERT_ALLOC(ring);
+  ring->head = ring->tail = ring->dropped = 0;
+  for (size_t i = 0; i < HTTP_LOG_RING_SIZE; ++i)
+    FIO_ASSERT(!http_log_ring_push(ring, &r), "access log ring push error");
+  FIO_ASSERT(http_log_ring_push(ring, &r) == -1 && ring->dropped == 1,
+             "a full access log ring should drop records");
+  FIO_ASSERT(http_log_ring_push(ring, &r) == -1 &&
+                 http_log_ring_push(ring, &r) == -1 && ring->dropped == 3,
+             "access log ring should count every dropped record");
+  ring->tail = 1;
+  FIO_ASSERT(!http_log_ring_push(ring, &r), "access log ring space error");
+  FIO_ASSERT(http_log_ring_push(ring, &r) == -1 && ring->dropped == 4,
+             "access log ring should stay bounded");
+  fio_free(ring);
+  /* thread rings are freed (and unlisted) once their thread exits */
+  pthread_t thread;
+  void *thread_ring = NULL;
+  FIO_ASSERT(!pthread_create(&thread, NULL, http_log_test_thread, NULL),
+             "couldn't start the access log test thread");
+  pthread_join(thread, &thread_ring);
+  FIO_ASSERT(thread_ring, "access log test thread ring missing");
+  uint8_t leaked = 0;
+  fio_lock(&http_log.lock);
+  FIO_LS_EMBD_FOR(&http_log.rings, node) {
+    leaked |= (FIO_LS_EMBD_OBJ(http_log_ring_s, node, node) == thread_ring);
+  }
+  fio_unlock(&http_log.lock);
+  FIO_ASSERT(!leaked, "access log ring leaked after its thread exited");
+}
+
+static void http_metrics_test(void) {
+  fprintf(stderr, "* Testing the Prometheus metrics format.\n");
+  fio_metric_s metrics[] = {
+      {.name = "a_total{x=\"1\"}", .help = "A.", .value = 3},
+      {.name = "a_total{x=\"2\"}", .value = 4},
+      {.name = "b", .type = FIO_METRIC_GAUGE, .value = -2},
+      {.name = "c_us", .type = FIO_METRIC_HISTOGRAM, .value = 2, .sum = 30,
+       .max = 20, .p50 = 10, .p90 = 20, .p99 = 20},
+  };
+  http_metrics_writer_s w = {.dest = fiobj_str_buf(1024)};
+  for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); ++i)
+    http_metrics_write(metrics + i, &w);
+  const char expected[] = "# HELP a_total A.\n"
+                          "# TYPE a_total counter\n"
+                          "a_total{x=\"1\"} 3\n"
+                          "a_total{x=\"2\"} 4\n"
+                          "# TYPE b gauge\n"
+                          "b -2\n"
+                          "# TYPE c_us summary\n"
+                          "c_us{quantile=\"0.5\"} 10\n"
+                          "c_us{quantile=\"0.9\"} 20\n"
+                          "c_us{quantile=\"0.99\"} 20\n"
+                          "c_us_sum 30\n"
+                          "c_us_count 2\n";
+  fio_str_info_s str = fiobj_obj2cstr(w.dest);
+  FIO_ASSERT(str.len == sizeof(expected) - 1 &&
+                 !memcmp(str.data, expected, str.len),
+             "Prometheus metrics format error:\n%s", str.data);
+  fiobj_free(w.dest);
+}
+
+static void http_sse_test(void) {
+  fprintf(stderr, "* Testing SSE event encoding (direct / pre-encoded).\n");
+  const struct {
+    const char *data;
+    const char *expected;
+  } tests[] = {
+      {"single line", "data: single line\r\n\r\n"},
+      {"a\nb\r\nc\rd", "data: a\r\ndata: b\r\ndata: c\r\ndata: d\r\n\r\n"},
+      {"trailing\n", "data: trailing\r\n\r\n"},
+      {"empty\n\nline", "data: empty\r\ndata: \r\ndata: line\r\n\r\n"},
+      {NULL, NULL},
+  };
+  for (size_t i = 0; tests[i].data; ++i) {
+    fio_str_info_s msg = {.data = (char *)tests[i].data,
+                          .len = strlen(tests[i].data)};
+    fio_msg_metadata_s meta =
+        http_sse_optimize((fio_str_info_s){.data = (char *)"ch", .len = 2},
+                          msg, 0);
+    FIOBJ direct = http_sse_encode((struct http_sse_write_args){.data = msg});
+    fio_str_info_s pre = fiobj_obj2cstr((FIOBJ)meta.metadata);
+    fio_str_info_s dir = fiobj_obj2cstr(direct);
+    FIO_ASSERT(meta.type_id == HTTP_SSE_OPTIMIZE_PUBSUB && meta.metadata,
+               "SSE pre-encoded metadata missing");
+    FIO_ASSERT(pre.len == dir.len && !memcmp(pre.data, dir.data, pre.len),
+               "SSE pre-encoded event differs from the direct encoding:\n"
+               "%s\n---\n%s",
+               pre.data, dir.data);
+    FIO_ASSERT(dir.len == strlen(tests[i].expected) &&
+                   !memcmp(dir.data, tests[i].expected, dir.len),
+               "SSE data encoding error:\n%s", dir.data);
+    meta.on_finish(NULL, meta.metadata);
+    fiobj_free(direct);
+  }
+  FIO_ASSERT(!http_sse_optimize((fio_str_info_s){.len = 0},
+                                (fio_str_info_s){.len = 0}, 0)
+                  .metadata,
+             "empty messages shouldn't be pre-encoded");
+  {
+    const char *expected = "id: 1\r\nevent: update\r\nretry: 10\r\n"
+                           "data: a\r\ndata: b\r\n\r\n";
+    FIOBJ out = http_sse_encode((struct http_sse_write_args){
+        .id = {.data = (char *)"1", .len = 1},
+        .event = {.data = (char *)"update", .len = 6},
+        .data = {.data = (char *)"a\r\nb", .len = 4},
+        .retry = 10,
+    });
+    fio_str_info_s str = fiobj_obj2cstr(out);
+    FIO_ASSERT(str.len == strlen(expected) &&
+                   !memcmp(str.data, expected, str.len),
+               "SSE event encoding error:\n%s", str.data);
+    fiobj_free(out);
+  }
+}
+
+static void http_lazy_params_test(void) {
+  fprintf(stderr, "* Testing lazy query / cookie accessors.\n");
+  http_s h;
+  http_s_new(&h, NULL, NULL);
+  h.method = fiobj_str_new("GET", 3);
+  h.query = fiobj_str_new("a=1&amp;name=J%20D+x&b&=c&bad=%G1&e=", 36);
+  char buf[16];
+  FIO_ASSERT(http_query_get(&h, "name", 4, buf, sizeof(buf)) == 5 &&
+                 !memcmp(buf, "J D x", 6),
+             "http_query_get value error (%s)", buf);
+  FIO_ASSERT(http_query_get(&h, "a", 1, buf, 2) == 1 && buf[0] == '1',
+             "http_query_get first value error");
+  FIO_ASSERT(http_query_get(&h, "name", 4, buf, 3) == 5 &&
+                 !memcmp(buf, "J ", 3),
+             "http_query_get truncation error (%s)", buf);
+  FIO_ASSERT(http_query_get(&h, "e", 1, buf, sizeof(buf)) == 0 && !buf[0],
+             "http_query_get empty value error");
+  FIO_ASSERT(http_query_get(&h, "b", 1, buf, sizeof(buf)) == -1 &&
+                 http_query_get(&h, "bad", 3, buf, sizeof(buf)) == -1 &&
+                 http_query_get(&h, "nam", 3, buf, sizeof(buf)) == -1,
+             "http_query_get should fail for missing / invalid values");
+  FIOBJ cookies = fiobj_ary_new2(2);
+  fiobj_ary_push(cookies, fiobj_str_new("sid=a%20b; theme=dark", 21));
+  fiobj_ary_push(cookies, fiobj_str_new("lang=en", 7));
+  fiobj_hash_set(h.headers, HTTP_HEADER_COOKIE, cookies);
+  FIO_ASSERT(http_cookie_get(&h, "sid", 3, buf, sizeof(buf)) == 5 &&
+                 !memcmp(buf, "a%20b", 6),
+             "http_cookie_get value error (%s)", buf);
+  FIO_ASSERT(http_cookie_get(&h, "theme", 5, buf, sizeof(buf)) == 4 &&
+                 !memcmp(buf, "dark", 5),
+             "http_cookie_get value error (%s)", buf);
+  FIO_ASSERT(http_cookie_get(&h, "lang", 4, buf, sizeof(buf)) == 2 &&
+                 !memcmp(buf, "en", 3),
+             "http_cookie_get should search every Cookie header");
+  FIO_ASSERT(http_cookie_get(&h, "the", 3, buf, sizeof(buf)) == -1,
+             "http_cookie_get should fail for missing cookies");
+  FIO_ASSERT(!h.params && !h.cookies,
+             "lazy accessors shouldn't create Hash Maps");
+  http_s_destroy(&h, 0);
+}
+
 void http_tests(void) {
   fprintf(stderr, "=== Testing HTTP helpers\n");
   FIOBJ html_mime = http_mimetype_find("html", 4);
   FIO_ASSERT(html_mime,
              "HTML mime-type not found! Mime-Type registry invalid!\n");
   fiobj_free(html_mime);
+  http1_parser_test();
+  http1_buffer_pool_test();
+  http1_stream_test();
+  http1_lazy_headers_test();
+  http1_template_test();
+  http1_sendfile_range_test();
+  http_multipart_test();
+  http_pool_test();
+  http_log_test();
+  http_metrics_test();
+  http_router_test();
+  http_lazy_params_test();
+  http_sse_test();
+  http_compress_test();
+  websocket_deflate_test();
+  websocket_stream_test();
+  hpack_test();
+  http2_header_order_test();
 }
 #endif
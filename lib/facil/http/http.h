@@ -42,6 +42,32 @@ Compile Time Settings
 #define HTTP_MAX_HEADER_LENGTH 8192
 #endif
 
+#ifndef HTTP_FILE_CACHE_LIMIT
+/**
+ * The maximum number of static files (file descriptors, metadata and headers)
+ * kept in the static file cache. Set to 0 to disable the cache.
+ */
+#define HTTP_FILE_CACHE_LIMIT 256
+#endif
+
+#ifndef HTTP_FILE_CACHE_TTL
+/**
+ * The number of seconds after which a cached static file is revalidated (using
+ * `stat`) before it's served again.
+ */
+#define HTTP_FILE_CACHE_TTL 1
+#endif
+
+#ifndef HTTP_FILE_CACHE_BODY_LIMIT
+/** Cached static files up to this size are kept in memory. */
+#define HTTP_FILE_CACHE_BODY_LIMIT HTTP_MAX_HEADER_LENGTH
+#endif
+
+#ifndef HTTP_ROUTER_MAX_PARAMS
+/** The maximal number of path parameters in a route (see `http_route`). */
+#define HTTP_ROUTER_MAX_PARAMS 8
+#endif
+
 #ifndef FIO_HTTP_EXACT_LOGGING
 /**
  * By default, facil.io logs the HTTP request cycle using a fuzzy starting point
@@ -99,7 +125,10 @@ typedef struct {
   /** The request query, if any. */
   FIOBJ query;
   /** a hash of general header data. When a header is set multiple times (such
-   * as cookie headers), an Array will be used instead of a String. */
+   * as cookie headers), an Array will be used instead of a String.
+   *
+   * When `lazy_headers` is set, use `http_headers` (or `http_header_get_slice`)
+   * rather than accessing this field directly. */
   FIOBJ headers;
   /**
    * a placeholder for a hash of cookie data.
@@ -170,6 +199,24 @@ int http_set_header(http_s *h, FIOBJ name, FIOBJ value);
  */
 int http_set_header2(http_s *h, fio_str_info_s name, fio_str_info_s value);
 
+/**
+ * Returns the request's header Hash (the `h->headers` field), creating the
+ * FIOBJ objects first if the headers were stored lazily (see the
+ * `lazy_headers` setting).
+ */
+FIOBJ http_headers(http_s *h);
+
+/**
+ * Returns the value of a request header without allocating any memory.
+ *
+ * The header `name` MUST be lower case. If the header was sent more than once,
+ * the first value is returned. If the header is missing, `.data` is NULL.
+ *
+ * When `lazy_headers` is set, the returned data points into the connection's
+ * buffer and is only valid until the request is finished or paused.
+ */
+fio_str_info_s http_header_get_slice(http_s *h, fio_str_info_s name);
+
 /**
  * Sets a response cookie.
  *
@@ -196,6 +243,45 @@ int http_set_cookie(http_s *h, http_cookie_args_s);
  */
 int http_send_body(http_s *h, void *data, uintptr_t length);
 
+/** A pre-serialized set of response headers, see `http_send_template`. */
+typedef struct http_response_template_s http_response_template_s;
+
+/**
+ * Pre-serializes a Hash of response headers (lower case String names
+ * with String or Array values) for fixed-shape responses.
+ *
+ * The Hash isn't consumed (call `fiobj_free`) and MUST NOT be edited later.
+ * Don't include the Date and Content-Length headers, these are added to every
+ * response.
+ *
+ * Returns NULL on error.
+ */
+http_response_template_s *http_response_template_new(FIOBJ headers);
+
+/**
+ * Frees a response template. Call this only after the server has stopped (or
+ * once no other thread can be using it).
+ */
+void http_response_template_free(http_response_template_s *t);
+
+/**
+ * Sends the response headers and body, using a response template.
+ *
+ * Only the status line, Content-Length and Date headers are written per
+ * response. The template's header block is copied as is, followed by any
+ * headers set using `http_set_header` (such as cookies). No `Last-Modified`
+ * header is added.
+ *
+ * **Note**: The body is *copied* to the HTTP stream and it's memory should be
+ * freed by the calling function.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_template(http_s *h, http_response_template_s *t, void *data,
+                       uintptr_t length);
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -237,12 +323,87 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
 int http_send_error(http_s *h, size_t error_code);
 
 /**
- * Sends the response headers for a header only response.
+ * Sends the process's runtime metrics (see `fio_metrics_each`) using the
+ * Prometheus text format.
+ *
+ * Histograms are reported as summaries (the 0.5, 0.9 and 0.99 quantiles).
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_metrics(http_s *h);
+
+/**
+ * Sends the response headers for a header only response, or completes a
+ * streamed response (see `http_stream`).
  *
  * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
  */
 void http_finish(http_s *h);
 
+/**
+ * Sends a chunk of the response's body, sending the response headers with the
+ * first chunk. This allows a response to be sent before its length is known
+ * (i.e., while it's being rendered).
+ *
+ * HTTP/1.1 responses use the chunked transfer encoding (unless a
+ * Content-Length header was set), HTTP/1.0 responses are completed by closing
+ * the connection and HTTP/2 responses are sent using DATA frames.
+ *
+ * Headers set after the first call are ignored. Call `http_finish` to complete
+ * the response.
+ *
+ * **Note**: The data is *copied* to the HTTP stream and it's memory should be
+ * freed by the calling function.
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int http_stream(http_s *h, void *data, uintptr_t length);
+
+/**
+ * Same as `http_stream`, except the data is *not* copied. The ownership of
+ * `data` is moved to facil.io, which calls `dealloc(data)` once it was sent (or
+ * the connection was closed). If `dealloc` is NULL, `free` will be used.
+ *
+ * On HTTP/1.1, the chunk's size line and trailing CRLF are written as separate
+ * (small) packets around the caller's buffer, so the body is never copied.
+ * Other protocols fall back to `http_stream` (the data is copied and freed).
+ *
+ * On error, `dealloc(data)` is called before returning -1.
+ */
+int http_stream2(http_s *h, void *data, uintptr_t length,
+                 void (*dealloc)(void *));
+
+/**
+ * Applies back-pressure to a streamed response: the request handling is paused
+ * until the data already written to the socket was sent, at which point `task`
+ * is performed (within the connection's lock).
+ *
+ * The `task` MUST call `http_stream` / `http_stream2` (optionally followed by
+ * another `http_stream_wait`) or `http_finish`.
+ *
+ * If the connection is closed while waiting, the `task` is never performed.
+ *
+ * Returns -1 if unsupported (HTTP/2 streams are governed by flow control) or
+ * on error, in which case the `http_s` handle is still valid and wasn't paused.
+ */
+int http_stream_wait(http_s *h, void (*task)(http_s *h));
+
+/**
+ * Renders a mustache template (see `fiobj_mustache.h`) using the information in
+ * the `data` object, streaming the output as the response's body (see
+ * `http_stream`) rather than rendering the whole response before sending it.
+ *
+ * If rendering fails before any data was sent, an error response (500) is sent.
+ * Otherwise, the response is completed with the data rendered so far.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_mustache(http_s *h, mustache_s *mustache, FIOBJ data);
+
 /**
  * Pushes a data response when supported (HTTP/2 only).
  *
@@ -301,6 +462,15 @@ void http_pause(http_s *h, void (*task)(http_pause_handle_s *http));
 void http_resume(http_pause_handle_s *http, void (*task)(http_s *h),
                  void (*fallback)(void *udata));
 
+/**
+ * Resumes reading a streamed request body after the `on_body_chunk` callback
+ * returned a non-zero value (see `http_settings_s`).
+ *
+ * This function is thread safe, but the `http_s` handle must still be valid
+ * (the request wasn't finished).
+ */
+void http_resume_body(http_s *h);
+
 /** Returns the `udata` associated with the paused opaque handle */
 void *http_paused_udata_get(http_pause_handle_s *http);
 
@@ -326,6 +496,20 @@ struct http_settings_s {
   void (*on_upgrade)(http_s *request, char *requested_protocol, size_t len);
   /** CLIENT REQUIRED: a callback for the HTTP response. */
   void (*on_response)(http_s *response);
+  /**
+   * (optional) streams the request body instead of collecting it in `h->body`.
+   *
+   * When set, the callback is called for every body chunk as it arrives. The
+   * request's method, path and headers are already available and `h->udata`
+   * can be used to store any streaming state. `on_request` is called once the
+   * body was fully received (with `h->body` set to `FIOBJ_INVALID`).
+   *
+   * Return a non-zero value to stop reading from the client (back-pressure)
+   * until `http_resume_body` is called.
+   *
+   * Ignored by HTTP clients.
+   */
+  int (*on_body_chunk)(http_s *h, fio_str_info_s chunk);
   /** (optional) the callback to be performed when the HTTP service closes. */
   void (*on_finish)(struct http_settings_s *settings);
   /** Opaque user data. Facil.io will ignore this field, but you can use it. */
@@ -383,6 +567,32 @@ struct http_settings_s {
    * connections. Defaults to ~250KB.
    */
   size_t ws_max_msg_size;
+  /**
+   * CLIENT: set to the maximum number of connections per host to have
+   * `http_connect` use a pool of keep-alive HTTP/1.1 connections.
+   *
+   * Pooled connections are shared by `http_connect` calls with the same
+   * scheme, host, port and `tls` object. Each call describes a single request,
+   * see `http_connect` for details.
+   *
+   * The most recent request's pool settings apply to the host's pool.
+   *
+   * Ignored by `http_listen` and Websocket connections.
+   */
+  uint16_t pool_limit;
+  /**
+   * CLIENT: the number of seconds an idle pooled connection is kept open.
+   * Defaults to 5 seconds.
+   */
+  uint8_t pool_timeout;
+  /**
+   * CLIENT: the number of requests a pooled connection may send before the
+   * previous responses arrived (HTTP/1.1 pipelining). Defaults to 1 (none).
+   *
+   * Pipelined requests MUST be sent (`http_finish`) from within the first
+   * `on_response` callback, so their responses arrive in order.
+   */
+  uint8_t pool_pipeline;
   /**
    * An HTTP/1.x connection timeout.
    *
@@ -399,8 +609,102 @@ struct http_settings_s {
    * fails). Pongs are ignored.
    */
   uint8_t ws_timeout;
+  /**
+   * Set to TRUE to accept the WebSocket permessage-deflate extension (RFC
+   * 7692) when offered by the client, if facil.io was compiled with zlib
+   * (`HAVE_ZLIB`).
+   *
+   * Set to 2 to also require `no_context_takeover` in both directions, so
+   * connections hold no compression state between messages (a small number of
+   * shared compression contexts is used instead, see
+   * WEBSOCKET_DEFLATE_CONTEXTS).
+   *
+   * Direct pub/sub broadcasts are compressed once and the same compressed
+   * frame is sent to every subscriber.
+   *
+   * Ignored by HTTP clients.
+   */
+  uint8_t ws_deflate;
+  /**
+   * Set to TRUE to allocate request data (method, path, query, headers and the
+   * data parsed by `http_parse_query`, `http_parse_cookies` and
+   * `http_parse_body`) from a per-request memory region (see
+   * `fio_region_set`).
+   *
+   * The region is released in a single step once the request is finished, so
+   * these objects MUST NOT be used after `http_finish` (not even after calling
+   * `fiobj_dup`; copy the data instead).
+   *
+   * Ignored by HTTP clients.
+   */
+  uint8_t request_region;
+  /**
+   * Set to TRUE to keep request headers in the connection's buffer (as
+   * name / value offsets) instead of creating FIOBJ objects for each header.
+   *
+   * The `h->headers` Hash is only filled in by `http_headers` (or internally,
+   * when a header dependent feature such as `http_parse_cookies` requires it).
+   * Use `http_header_get_slice` to read header values without allocating.
+   *
+   * Ignored by HTTP clients.
+   */
+  uint8_t lazy_headers;
+  /**
+   * Set to TRUE to accept HTTP/2 connections, either negotiated using TLS ALPN
+   * ("h2") or using prior knowledge on cleartext connections ("h2c").
+   *
+   * HTTP/2 requests can't be upgraded (WebSockets / SSE) or hijacked and server
+   * push isn't supported. `lazy_headers` and `http_send_template` fall back to
+   * the default behavior.
+   *
+   * Ignored by HTTP clients.
+   */
+  uint8_t http2;
+  /**
+   * Set to TRUE to compress responses when the client supports it (gzip and
+   * brotli, according to the `Accept-Encoding` header), if facil.io was
+   * compiled with zlib (`HAVE_ZLIB`) and / or brotli (`HAVE_BROTLI`).
+   *
+   * Textual responses sent using `http_send_body` (see
+   * HTTP_COMPRESS_MIN_SIZE), EventSource (SSE) streams and small static files
+   * are compressed. Compressed static files are cached.
+   *
+   * Ignored by HTTP clients.
+   */
+  uint8_t compress;
   /** Logging flag - set to TRUE to log HTTP requests. */
   uint8_t log;
+  /**
+   * Set to TRUE (or 2) to listen on a `SO_REUSEPORT` socket per worker process
+   * (see `reuse_port` in `fio_listen`).
+   *
+   * Ignored by HTTP clients.
+   */
+  uint8_t reuse_port;
+  /**
+   * The number of requests per second allowed from each peer address (a token
+   * bucket, see `fio_rate_limit`). Rate limited requests are answered with a
+   * 429 (Too Many Requests) error. Defaults to 0 (no limit).
+   *
+   * Ignored by HTTP clients.
+   */
+  uint32_t request_rate;
+  /** The request burst allowed per address, defaults to `request_rate`. */
+  uint32_t request_burst;
+  /**
+   * The number of new connections per second accepted from each peer address
+   * (see `connection_rate` in `fio_listen`). Defaults to 0 (no limit).
+   *
+   * Ignored by HTTP clients.
+   */
+  uint32_t connection_rate;
+  /**
+   * The maximal number of concurrent connections per peer address (see
+   * `connections_per_address` in `fio_listen`). Defaults to 0 (no limit).
+   *
+   * Ignored by HTTP clients.
+   */
+  uint32_t connections_per_address;
   /** a read only flag set automatically to indicate the protocol's mode. */
   uint8_t is_client;
 };
@@ -443,7 +747,16 @@ intptr_t http_listen(const char *port, const char *binding,
  * signature. However, it would be better to use the `websocket_connect`
  * function instead.
  *
- * Returns -1 on error and the socket's uuid on success.
+ * When `pool_limit` is set, the call describes a single request over a pooled
+ * keep-alive connection. `on_response` is called with an empty handler once a
+ * connection is available (requests wait while all of the host's connections
+ * are busy) and again with the response. `on_finish` is called once the
+ * response was handled (or the request failed) and the connection is returned
+ * to the pool. `http_settings` returns the connection's settings, use
+ * `h->udata` for the request's `udata`.
+ *
+ * Returns -1 on error and the socket's uuid on success (a pooled request that
+ * is waiting for a connection returns 0).
  *
  * The `on_finish` callback is always called.
  */
@@ -483,6 +796,96 @@ fio_str_info_s http_peer_addr(http_s *h);
  */
 intptr_t http_hijack(http_s *h, fio_str_info_s *leftover);
 
+/* *****************************************************************************
+Request Routing (a radix tree router)
+***************************************************************************** */
+
+/** A request router, see `http_router_new`. */
+typedef struct http_router_s http_router_s;
+
+/** A path parameter (`:name` or `*name` route segments). */
+typedef struct {
+  /** The parameter's name (as set in the route, without the `:` or `*`). */
+  fio_str_info_s name;
+  /** The parameter's value - a slice of the request's path (NOT copied). */
+  fio_str_info_s value;
+} http_route_param_s;
+
+/** The route matching the request, passed to the route's handler. */
+typedef struct {
+  /** The route's opaque user data. */
+  void *udata;
+  /** The number of path parameters. */
+  size_t count;
+  /** The path parameters, ordered as they appear in the path. */
+  http_route_param_s params[HTTP_ROUTER_MAX_PARAMS];
+} http_route_match_s;
+
+/**
+ * Creates a new (empty) router.
+ *
+ * Requests that don't match any route are passed to `on_not_found` (or
+ * answered with a 404 error when `on_not_found` is NULL).
+ */
+http_router_s *http_router_new(void (*on_not_found)(http_s *h));
+
+/** Frees the router and all it's routes. */
+void http_router_free(http_router_s *router);
+
+/** Named arguments for `http_route`. */
+struct http_route_args_s {
+  /** The request method (i.e., "GET"). NULL matches any method. */
+  const char *method;
+  /**
+   * The route's path (copied). The path may include named parameters:
+   *
+   * * `:name` matches a single path segment (up to the next `/`), i.e.,
+   *   `"/users/:id"`.
+   *
+   * * `*name` matches the rest of the path (must end the route), i.e., a
+   *   `*file` segment that follows `"/static/"`.
+   *
+   * Static routes take precedence over `:name` segments and these take
+   * precedence over `*name` segments.
+   */
+  const char *path;
+  /** The route's handler. */
+  void (*on_request)(http_s *h, http_route_match_s *match);
+  /** Opaque user data, available as `match->udata`. */
+  void *udata;
+};
+
+/**
+ * Adds a route to the router.
+ *
+ * Routes should be added before `fio_start` (the router isn't thread safe while
+ * routes are added).
+ *
+ * Returns -1 on error (i.e., an existing route, an invalid path or too many
+ * parameters) and 0 on success.
+ */
+int http_route(http_router_s *router, struct http_route_args_s args);
+#define http_route(router, ...)                                                \
+  http_route((router), (struct http_route_args_s){__VA_ARGS__})
+
+/**
+ * An `on_request` handler that routes the request using the router set as the
+ * `udata` of `http_listen`, i.e.:
+ *
+ *      http_listen("3000", NULL, .on_request = http_router_on_request,
+ *                  .udata = router);
+ *
+ * Matching is performed in O(path length) and path parameters point to the
+ * request's path (no memory is allocated).
+ */
+void http_router_on_request(http_s *h);
+
+/**
+ * Returns the value of the named path parameter (or a NULL `data` pointer when
+ * the parameter is missing).
+ */
+fio_str_info_s http_route_param(http_route_match_s *match, const char *name);
+
 /* *****************************************************************************
 Websocket Upgrade (Server and Client connection establishment)
 ***************************************************************************** */
@@ -510,6 +913,23 @@ typedef struct {
    * can be copied).
    */
   void (*on_message)(ws_s *ws, fio_str_info_s msg, uint8_t is_text);
+  /**
+   * The (optional) on_message_chunk callback streams large messages,
+   * delivering the data as it arrives instead of collecting the whole message.
+   *
+   * When set, any message containing a frame larger than 4Kb
+   * (`WS_INITIAL_BUFFER_SIZE`) is delivered in chunks (and isn't passed to
+   * `on_message`). `first` marks the message's first chunk and `last` marks
+   * the message's last chunk. Data received before the large frame (if any) is
+   * delivered as the first chunk.
+   *
+   * Streamed messages aren't limited by `ws_max_msg_size`.
+   * permessage-deflate compressed messages are never streamed.
+   *
+   * The chunk's data is only valid until the function returns.
+   */
+  void (*on_message_chunk)(ws_s *ws, fio_str_info_s chunk, uint8_t first,
+                           uint8_t last, uint8_t is_text);
   /**
    * The (optional) on_open callback will be called once the websocket
    * connection is established and before is is registered with `facil`, so no
@@ -704,6 +1124,18 @@ uintptr_t http_sse_subscribe(http_sse_s *sse,
  */
 void http_sse_unsubscribe(http_sse_s *sse, uintptr_t subscription);
 
+/**
+ * The pub/sub metadata type ID for pre-encoded SSE events.
+ *
+ * While SSE connections are subscribed without an `on_message` callback, each
+ * published message is encoded once (as a FIOBJ String containing the SSE
+ * `data` event) and the same buffer is sent to all these connections. i.e.:
+ *
+ *     FIOBJ pre_encoded = (FIOBJ)fio_message_metadata(msg,
+ *                               HTTP_SSE_OPTIMIZE_PUBSUB);
+ */
+#define HTTP_SSE_OPTIMIZE_PUBSUB (-40)
+
 /**
  * Named arguments for the {http_sse_write} function.
  *
@@ -775,6 +1207,50 @@ HTTP GET and POST parsing helpers
  */
 int http_parse_body(http_s *h);
 
+/** A streaming `multipart/form-data` parser, see `http_multipart_new`. */
+typedef struct http_multipart_s http_multipart_s;
+
+/** A `multipart/form-data` part (or a chunk of a part's data). */
+typedef struct {
+  /** The form field's name. */
+  fio_str_info_s name;
+  /** The part's file name (`.data == NULL` for regular form fields). */
+  fio_str_info_s filename;
+  /** The part's Content-Type (`.data == NULL` if missing). */
+  fio_str_info_s mime_type;
+  /** A chunk of the part's data (might be empty). */
+  fio_str_info_s data;
+  /** Set for the first chunk of every part. */
+  uint8_t start;
+  /** Set for the last chunk of every part. */
+  uint8_t end;
+} http_multipart_part_s;
+
+/**
+ * Creates a streaming `multipart/form-data` parser for the request, to be fed
+ * by the `on_body_chunk` callback (see `http_settings_s`).
+ *
+ * The `on_part` callback is called as parts (and their data) become available,
+ * so uploaded files are never collected in memory or in a temporary file. The
+ * `part` data is only valid during the callback.
+ *
+ * Returns NULL if the request's Content-Type isn't `multipart/form-data`.
+ */
+http_multipart_s *http_multipart_new(http_s *h,
+                                     void (*on_part)(http_s *h,
+                                                     http_multipart_part_s *part));
+
+/**
+ * Consumes a chunk of the request body, calling `on_part` as needed.
+ *
+ * Returns 1 once the whole form was parsed, 0 when expecting more data and -1
+ * on error.
+ */
+int http_multipart_consume(http_multipart_s *m, fio_str_info_s chunk);
+
+/** Frees the streaming `multipart/form-data` parser. */
+void http_multipart_free(http_multipart_s *m);
+
 /**
  * Parses the query part of an HTTP request/response. Uses `http_add2hash`.
  *
@@ -786,6 +1262,33 @@ void http_parse_query(http_s *h);
 /** Parses any Cookie / Set-Cookie headers, using the `http_add2hash` scheme. */
 void http_parse_cookies(http_s *h, uint8_t is_url_encoded);
 
+/**
+ * Finds the first query parameter named `name`, without parsing the rest of
+ * the query string (no Hash is created and `h->params` isn't touched).
+ *
+ * The name is compared as is (it isn't URL decoded). The URL decoded value is
+ * copied to `dest`, writing at most `capa - 1` bytes and a NUL byte.
+ *
+ * Returns the value's (decoded) length, much like `snprintf`, so a return
+ * value that is `>= capa` indicates that the value was truncated. Returns -1
+ * if the parameter is missing or its value isn't properly encoded.
+ */
+ssize_t http_query_get(http_s *h, const char *name, size_t name_len,
+                       char *dest, size_t capa);
+
+/**
+ * Finds the first request cookie named `name`, without loading the headers or
+ * parsing the rest of the cookies (`h->cookies` isn't touched).
+ *
+ * The value is copied as is (no URL decoding) to `dest`, writing at most
+ * `capa - 1` bytes and a NUL byte.
+ *
+ * Returns the value's length (`>= capa` if the value was truncated) or -1 if
+ * the cookie is missing.
+ */
+ssize_t http_cookie_get(http_s *h, const char *name, size_t name_len,
+                        char *dest, size_t capa);
+
 /**
  * Adds a named parameter to the hash, converting a string to an object and
  * resolving nesting references and URL decoding if required.
@@ -856,6 +1359,12 @@ FIOBJ http_mimetype_find2(FIOBJ url);
 /** Clears the Mime-Type registry (it will be empty after this call). */
 void http_mimetype_clear(void);
 
+/**
+ * Clears the static file cache, closing any cached file descriptors (files
+ * will be reloaded when requested).
+ */
+void http_file_cache_clear(void);
+
 /* *****************************************************************************
 Commonly used headers (fiobj Symbol objects)
 ***************************************************************************** */
@@ -875,6 +1384,7 @@ extern FIOBJ HTTP_HEADER_LAST_MODIFIED;
 extern FIOBJ HTTP_HEADER_ORIGIN;
 extern FIOBJ HTTP_HEADER_SET_COOKIE;
 extern FIOBJ HTTP_HEADER_UPGRADE;
+extern FIOBJ HTTP_HEADER_VARY;
 
 /* *****************************************************************************
 HTTP General Helper functions that could be used globally
@@ -887,11 +1397,45 @@ HTTP General Helper functions that could be used globally
 FIOBJ http_req2str(http_s *h);
 
 /**
- * Writes a log line to `stderr` about the request / response object.
+ * Queues a log line about the request / response object, to be written to
+ * `stderr` by a background thread.
+ *
+ * Log records are dropped (and counted) rather than block the calling thread
+ * when the thread's log buffer is full (see HTTP_LOG_RING_SIZE).
  *
  * This function is called automatically if the `.log` setting is enabled.
  */
 void http_write_log(http_s *h);
+
+/** The access log settings (see `http_log_setup`). */
+struct http_log_settings_s {
+  /**
+   * The log line's format. Defaults to: `%a - - [%t] "%r" %s %b %Dms`
+   *
+   * * `%a` - the peer's address.
+   * * `%t` - the response's date.
+   * * `%r` - the request line (`%m %U %H`).
+   * * `%m` - the request's method.
+   * * `%U` - the request's path.
+   * * `%H` - the request's HTTP version.
+   * * `%s` - the response's status code.
+   * * `%b` - the response's Content-Length followed by `b` (or `--`).
+   * * `%D` - the time it took to respond, in milliseconds.
+   * * `%%` - a `%` character.
+   */
+  const char *format;
+  /** Logs one of every `sample` requests (0 and 1 log every request). */
+  size_t sample;
+};
+
+/**
+ * Sets the access log's format and sampling rate, used by `http_write_log`.
+ *
+ * Should be called before `fio_start`.
+ */
+void http_log_setup(struct http_log_settings_s settings);
+#define http_log_setup(...)                                                    \
+  http_log_setup((struct http_log_settings_s){__VA_ARGS__})
 /* *****************************************************************************
 HTTP Time related helper functions that could be used globally
 ***************************************************************************** */
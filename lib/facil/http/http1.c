@@ -6,29 +6,47 @@ License: MIT
 
 #include <http1.h>
 #include <http1_parser.h>
+#include <http2.h>
 #include <http_internal.h>
 #include <websockets.h>
 
 #include <fiobj.h>
 
 #include <assert.h>
+#include <pthread.h>
 #include <stddef.h>
 
 /* *****************************************************************************
 The HTTP/1.1 Protocol Object
 ***************************************************************************** */
 
+/* a request header stored as offsets into the connection's buffer */
+typedef struct {
+  uint64_t hash;
+  uint32_t name;
+  uint32_t name_len;
+  uint32_t value;
+  uint32_t value_len;
+} h1_header_slice_s;
+
 typedef struct http1pr_s {
   http_fio_protocol_s p;
   http1_parser_s parser;
   http_s request;
+  fio_region_s region;
+  h1_header_slice_s *slices; /* NULL unless `lazy_headers` is set */
+  uintptr_t slice_count;
+  uint8_t *buf; /* NULL while idle (see `h1_buffer_acquire`) */
   uintptr_t buf_len;
   uintptr_t max_header_size;
   uintptr_t header_size;
   uint8_t close;
   uint8_t is_client;
-  uint8_t stop;
-  uint8_t buf[];
+  uint8_t stop; /* 1 == handling a request, 2 == hijacked, 4 == body paused */
+  uint8_t stream; /* 1 == streaming a chunked body, 2 == streaming as is */
+  uint8_t batch;  /* set while consuming data (responses are coalesced) */
+  uintptr_t streamed; /* the amount of streamed body data (for the log) */
+  http_pause_handle_s *drain; /* waiting for the data to be sent */
 } http1pr_s;
 
 struct http_vtable_s HTTP1_VTABLE; /* initialized later on */
@@ -40,23 +58,166 @@ Internal Helpers
 #define parser2http(x)                                                         \
   ((http1pr_s *)((uintptr_t)(x) - (uintptr_t)(&((http1pr_s *)0)->parser)))
 
-inline static void h1_reset(http1pr_s *p) { p->header_size = 0; }
+inline static void h1_reset(http1pr_s *p) {
+  p->header_size = 0;
+  p->slice_count = 0;
+}
+
+/* routes the parser's allocations to the request's memory region (if any) */
+#define h1_region_enter(parser) fio_region_set(parser2http(parser)->p.region)
 
 #define http1_pr2handle(pr) (((http1pr_s *)(pr))->request)
 #define handle2pr(h) ((http1pr_s *)h->private_data.flag)
 
 static fio_str_info_s http1pr_status2str(uintptr_t status);
 
+/* *****************************************************************************
+Read Buffer Pool
+***************************************************************************** */
+
+#ifndef HTTP1_BUFFER_POOL_LIMIT
+/**
+ * The number of idle read buffers (HTTP_MAX_HEADER_LENGTH bytes each) cached
+ * per thread. Connections only hold a buffer while a request is being parsed or
+ * handled.
+ */
+#define HTTP1_BUFFER_POOL_LIMIT 32
+#endif
+
+/* a per-thread stack of idle buffers, linked through their first bytes */
+static __thread struct {
+  void *head;
+  size_t count;
+  uint8_t registered; /* the thread exit destructor was set */
+} h1_buffer_pool;
+
+/* frees the calling thread's pooled buffers (thread exit / process exit) */
+static void h1_buffer_pool_drain(void *ignr_) {
+  while (h1_buffer_pool.head) {
+    void *buf = h1_buffer_pool.head;
+    h1_buffer_pool.head = *(void **)buf;
+    fio_free(buf);
+  }
+  h1_buffer_pool.count = 0;
+  (void)ignr_;
+}
+
+static pthread_key_t h1_buffer_pool_key;
+static pthread_once_t h1_buffer_pool_once = PTHREAD_ONCE_INIT;
+static uint8_t h1_buffer_pool_key_valid;
+
+static void h1_buffer_pool_init(void) {
+  h1_buffer_pool_key_valid =
+      !pthread_key_create(&h1_buffer_pool_key, h1_buffer_pool_drain);
+  /* thread specific destructors don't run for the main thread */
+  fio_state_callback_add(FIO_CALL_AT_EXIT, h1_buffer_pool_drain, NULL);
+}
+
+/* makes sure the pool is freed once the thread exits */
+static void h1_buffer_pool_register(void) {
+  h1_buffer_pool.registered = 1;
+  pthread_once(&h1_buffer_pool_once, h1_buffer_pool_init);
+  if (h1_buffer_pool_key_valid)
+    pthread_setspecific(h1_buffer_pool_key, &h1_buffer_pool);
+}
+
+static inline uint8_t *h1_buffer_acquire(void) {
+  uint8_t *buf = h1_buffer_pool.head;
+  if (buf) {
+    h1_buffer_pool.head = *(void **)buf;
+    --h1_buffer_pool.count;
+    return buf;
+  }
+  buf = fio_malloc(HTTP_MAX_HEADER_LENGTH);
+  FIO_ASSERT_ALLOC(buf);
+  return buf;
+}
+
+static inline void h1_buffer_release(uint8_t *buf) {
+  if (!buf)
+    return;
+  if (h1_buffer_pool.count >= HTTP1_BUFFER_POOL_LIMIT) {
+    fio_free(buf);
+    return;
+  }
+  if (!h1_buffer_pool.registered)
+    h1_buffer_pool_register();
+  *(void **)buf = h1_buffer_pool.head;
+  h1_buffer_pool.head = buf;
+  ++h1_buffer_pool.count;
+}
+
+/* returns the buffer to the pool when nothing (data or a request) uses it */
+static inline void h1_buffer_release_idle(http1pr_s *p) {
+  if (p->buf_len || p->stop || p->slice_count || !p->buf)
+    return;
+  h1_buffer_release(p->buf);
+  p->buf = NULL;
+}
+
+/* *****************************************************************************
+Lazy Headers (`lazy_headers`)
+***************************************************************************** */
+
+/* creates the `h->headers` objects for any headers stored as slices */
+static void http1_headers_load(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  if (!p->slice_count || h != &p->request)
+    return;
+  static uint64_t host_hash = 0;
+  if (!host_hash)
+    host_hash = fiobj_hash_string("host", 4);
+  fio_region_s *old = fio_region_set(p->p.region);
+  for (uintptr_t i = 0; i < p->slice_count; ++i) {
+    h1_header_slice_s *s = p->slices + i;
+    FIOBJ sym = fiobj_str_intern((char *)p->buf + s->name, s->name_len);
+    set_header_add(h->headers, sym,
+                   fiobj_str_new((char *)p->buf + s->value, s->value_len));
+    fiobj_free(sym);
+  }
+  p->slice_count = 0;
+  /* avoid duplicate Host headers, as done for eagerly parsed headers */
+  FIOBJ tmp = fiobj_hash_get2(h->headers, host_hash);
+  if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
+    fiobj_hash_set(h->headers, HTTP_HEADER_HOST, fiobj_ary_pop(tmp));
+  fio_region_set(old);
+}
+
+/* finds the first slice matching a (lower case) header name */
+static fio_str_info_s http1_header_slice(http_s *h, fio_str_info_s name,
+                                         uint64_t hash) {
+  http1pr_s *p = handle2pr(h);
+  if (h == &p->request) {
+    for (uintptr_t i = 0; i < p->slice_count; ++i) {
+      h1_header_slice_s *s = p->slices + i;
+      if (s->hash == hash && s->name_len == name.len &&
+          !memcmp(p->buf + s->name, name.data, name.len))
+        return (fio_str_info_s){.data = (char *)p->buf + s->value,
+                                .len = s->value_len};
+    }
+  }
+  return (fio_str_info_s){.data = NULL};
+}
+
 /* cleanup an HTTP/1.1 handler object */
 static inline void http1_after_finish(http_s *h) {
   http1pr_s *p = handle2pr(h);
-  p->stop = p->stop & (~1UL);
+  http_metric_on_response(h);
   if (h != &p->request) {
     http_s_destroy(h, 0);
     fio_free(h);
   } else {
     http_s_clear(h, p->p.settings->log);
+    fio_region_reset(&p->region);
+    p->slice_count = 0;
   }
+  /* a request finished asynchronously leaves the connection idle. The buffer
+   * is released before `stop` is cleared, so `on_data` can't be reading. */
+  if (!p->buf_len && !(p->stop & (~1UL)) && !p->slice_count && p->buf) {
+    h1_buffer_release(p->buf);
+    p->buf = NULL;
+  }
+  p->stop = p->stop & (~1UL);
   if (p->close)
     fio_close(p->p.uuid);
 }
@@ -95,6 +256,42 @@ static int write_header(FIOBJ o, void *w_) {
   return 0;
 }
 
+/* writes the Connection response header (if missing) and sets `p->close` */
+static void http1_write_connection(http_s *h, FIOBJ dest) {
+  static uintptr_t connection_hash;
+  if (!connection_hash)
+    connection_hash = fiobj_hash_string("connection", 10);
+  http1pr_s *p = handle2pr(h);
+  fio_str_info_s t;
+  FIOBJ tmp = fiobj_hash_get2(h->private_data.out_headers, connection_hash);
+  if (tmp) {
+    t = fiobj_obj2cstr(tmp);
+    if (t.data[0] == 'c' || t.data[0] == 'C')
+      p->close = 1;
+  } else {
+    t = http_header_slice(
+        h, (fio_str_info_s){.data = (char *)"connection", .len = 10},
+        connection_hash);
+    if (t.data) {
+      if (!t.len || t.data[0] == 'k' || t.data[0] == 'K')
+        fiobj_str_write(dest, "connection:keep-alive\r\n", 23);
+      else {
+        fiobj_str_write(dest, "connection:close\r\n", 18);
+        p->close = 1;
+      }
+    } else {
+      t = fiobj_obj2cstr(h->version);
+      if (!p->close && t.len > 7 && t.data && t.data[5] == '1' &&
+          t.data[6] == '.' && t.data[7] == '1')
+        fiobj_str_write(dest, "connection:keep-alive\r\n", 23);
+      else {
+        fiobj_str_write(dest, "connection:close\r\n", 18);
+        p->close = 1;
+      }
+    }
+  }
+}
+
 static FIOBJ headers2str(http_s *h, uintptr_t padding) {
   if (!h->method && !!h->status_str)
     return FIOBJ_INVALID;
@@ -114,32 +311,7 @@ static FIOBJ headers2str(http_s *h, uintptr_t padding) {
   if (p->is_client == 0) {
     fio_str_info_s t = http1pr_status2str(h->status);
     fiobj_str_write(w.dest, t.data, t.len);
-    FIOBJ tmp = fiobj_hash_get2(h->private_data.out_headers, connection_hash);
-    if (tmp) {
-      t = fiobj_obj2cstr(tmp);
-      if (t.data[0] == 'c' || t.data[0] == 'C')
-        p->close = 1;
-    } else {
-      tmp = fiobj_hash_get2(h->headers, connection_hash);
-      if (tmp) {
-        t = fiobj_obj2cstr(tmp);
-        if (!t.data || !t.len || t.data[0] == 'k' || t.data[0] == 'K')
-          fiobj_str_write(w.dest, "connection:keep-alive\r\n", 23);
-        else {
-          fiobj_str_write(w.dest, "connection:close\r\n", 18);
-          p->close = 1;
-        }
-      } else {
-        t = fiobj_obj2cstr(h->version);
-        if (!p->close && t.len > 7 && t.data && t.data[5] == '1' &&
-            t.data[6] == '.' && t.data[7] == '1')
-          fiobj_str_write(w.dest, "connection:keep-alive\r\n", 23);
-        else {
-          fiobj_str_write(w.dest, "connection:close\r\n", 18);
-          p->close = 1;
-        }
-      }
-    }
+    http1_write_connection(h, w.dest);
   } else {
     if (h->method) {
       fiobj_str_join(w.dest, h->method);
@@ -173,6 +345,19 @@ static FIOBJ headers2str(http_s *h, uintptr_t padding) {
   return w.dest;
 }
 
+/*
+ * Sends (and frees) a response packet. Responses written while the incoming
+ * data is consumed (i.e., pipelined requests) are flushed once, after the
+ * pass completes, instead of a flush (system call) per response.
+ */
+static inline void http1_send_packet(http1pr_s *p, FIOBJ packet) {
+  fio_str_info_s s = fiobj_obj2cstr(packet);
+  fio_write2(p->p.uuid, .data.buffer = (void *)packet,
+             .offset = (((intptr_t)s.data) - ((intptr_t)(packet))),
+             .length = s.len, .after.dealloc = fiobj4sock_dealloc,
+             .coalesce = p->batch);
+}
+
 /** Should send existing headers and data */
 static int http1_send_body(http_s *h, void *data, uintptr_t length) {
 
@@ -182,10 +367,47 @@ static int http1_send_body(http_s *h, void *data, uintptr_t length) {
     return -1;
   }
   fiobj_str_write(packet, data, length);
-  fiobj_send_free((handle2pr(h)->p.uuid), packet);
+  http1_send_packet(handle2pr(h), packet);
   http1_after_finish(h);
   return 0;
 }
+/** Should send a templated response (status, headers, date and data) */
+static int http1_send_template(http_s *h, http_response_template_s *t,
+                               void *data, uintptr_t length) {
+  http1pr_s *p = handle2pr(h);
+  fio_str_info_s status = http1pr_status2str(h->status);
+  fio_str_info_s block = fiobj_obj2cstr(t->block);
+  FIOBJ date = http_date_current();
+  fio_str_info_s date_str = fiobj_obj2cstr(date);
+  FIOBJ packet =
+      fiobj_str_buf(status.len + block.len + date_str.len + 64 + length +
+                    (fiobj_hash_count(h->private_data.out_headers) * 64));
+  fiobj_str_write(packet, status.data, status.len);
+  if (t->has_connection)
+    p->close |= t->close;
+  else
+    http1_write_connection(h, packet);
+  fiobj_str_write(packet, block.data, block.len);
+  fiobj_str_write(packet, "content-length:", 15);
+  fiobj_str_write_i(packet, length);
+  fiobj_str_write(packet, "\r\ndate:", 7);
+  fiobj_str_write(packet, date_str.data, date_str.len);
+  fiobj_str_write(packet, "\r\n", 2);
+  fiobj_free(date);
+  if (fiobj_hash_count(h->private_data.out_headers)) {
+    struct header_writer_s w = {.dest = packet};
+    fiobj_each1(h->private_data.out_headers, 0, write_header, &w);
+  }
+  fiobj_str_write(packet, "\r\n", 2);
+  fiobj_str_write(packet, data, length);
+  http1_send_packet(p, packet);
+  if (p->p.settings->log) /* the log reports the Content-Length header */
+    fiobj_hash_set(h->private_data.out_headers, HTTP_HEADER_CONTENT_LENGTH,
+                   fiobj_num_new(length));
+  http1_after_finish(h);
+  return 0;
+}
+
 /** Should send existing headers and file */
 static int http1_sendfile(http_s *h, int fd, uintptr_t length,
                           uintptr_t offset) {
@@ -203,27 +425,134 @@ static int http1_sendfile(http_s *h, int fd, uintptr_t length,
     intptr_t i = pread(fd, s.data + s.len, length, offset);
     if (i < 0) {
       close(fd);
-      fiobj_send_free((handle2pr(h)->p.uuid), packet);
+      http1_send_packet(handle2pr(h), packet);
       fio_close((handle2pr(h)->p.uuid));
       return -1;
     }
     close(fd);
     fiobj_str_resize(packet, s.len + i);
-    fiobj_send_free((handle2pr(h)->p.uuid), packet);
+    http1_send_packet(handle2pr(h), packet);
     http1_after_finish(h);
     return 0;
   }
-  fiobj_send_free((handle2pr(h)->p.uuid), packet);
-  fio_sendfile((handle2pr(h)->p.uuid), fd, offset, length);
+  http1_send_packet(handle2pr(h), packet);
+  fio_write2(handle2pr(h)->p.uuid, .data.fd = fd, .length = length,
+             .is_fd = 1, .offset = offset, .coalesce = handle2pr(h)->batch);
   http1_after_finish(h);
   return 0;
 }
 
+/* writes a chunk's size line, in hex (`fio_ltoa` would add a "0x" prefix) */
+static size_t http1_chunk_size(char *dest, uintptr_t length) {
+  size_t len = 0;
+  for (int shift = 60; shift >= 0; shift -= 4) {
+    const uint8_t digit = (length >> shift) & 15;
+    if (digit || len || !shift)
+      dest[len++] = "0123456789abcdef"[digit];
+  }
+  dest[len++] = '\r';
+  dest[len++] = '\n';
+  return len;
+}
+
+/** Should send existing headers and data and prepare for streaming */
+static int http1_stream(http_s *h, void *data, uintptr_t length) {
+  http1pr_s *p = handle2pr(h);
+  FIOBJ packet;
+  if (!p->stream) {
+    static uint64_t cl_hash = 0;
+    if (!cl_hash)
+      cl_hash = fiobj_hash_string("content-length", 14);
+    fio_str_info_s v = fiobj_obj2cstr(h->version);
+    if (fiobj_hash_get2(h->private_data.out_headers, cl_hash)) {
+      p->stream = 2;
+    } else if (p->is_client || (v.len > 7 && v.data[5] == '1' &&
+                                v.data[6] == '.' && v.data[7] == '1')) {
+      p->stream = 1;
+      http_set_header2(
+          h, (fio_str_info_s){.data = (char *)"transfer-encoding", .len = 17},
+          (fio_str_info_s){.data = (char *)"chunked", .len = 7});
+    } else {
+      /* HTTP/1.0 - the end of the body is marked by closing the connection */
+      p->stream = 2;
+      http_set_header(h, HTTP_HEADER_CONNECTION, fiobj_dup(HTTP_HVALUE_CLOSE));
+    }
+    packet = headers2str(h, length + 32);
+    if (!packet)
+      return -1;
+    p->streamed = 0;
+  } else {
+    if (!length)
+      return 0; /* an empty packet would stall the socket's write queue */
+    packet = fiobj_str_buf(length + 32);
+  }
+  if (length) {
+    if (p->stream == 1) {
+      char tmp[24];
+      fiobj_str_write(packet, tmp, http1_chunk_size(tmp, length));
+      fiobj_str_write(packet, data, length);
+      fiobj_str_write(packet, "\r\n", 2);
+    } else {
+      fiobj_str_write(packet, data, length);
+    }
+    p->streamed += length;
+  }
+  http1_send_packet(p, packet);
+  return 0;
+}
+
+/** Streams data without copying it (the chunk framing is written around it) */
+static int http1_stream2(http_s *h, void *data, uintptr_t length,
+                         void (*dealloc)(void *)) {
+  http1pr_s *p = handle2pr(h);
+  if (!p->stream && http1_stream(h, NULL, 0)) {
+    dealloc(data);
+    return -1;
+  }
+  if (p->stream == 1) {
+    char *tmp = fio_malloc(24);
+    FIO_ASSERT_ALLOC(tmp);
+    fio_write2(p->p.uuid, .data.buffer = tmp,
+               .length = http1_chunk_size(tmp, length),
+               .after.dealloc = fio_free, .coalesce = p->batch);
+  }
+  fio_write2(p->p.uuid, .data.buffer = data, .length = length,
+             .after.dealloc = dealloc, .coalesce = p->batch);
+  if (p->stream == 1)
+    fio_write2(p->p.uuid, .data.buffer = "\r\n", .length = 2,
+               .after.dealloc = FIO_DEALLOC_NOOP, .coalesce = p->batch);
+  p->streamed += length;
+  return 0;
+}
+
+/** Performs the paused task once the data written so far was sent */
+static int http1_stream_wait(http_s *h, http_pause_handle_s *http) {
+  http1pr_s *p = handle2pr(h);
+  (void)fio_atomic_xchange(&p->drain, http);
+  /* `on_ready` might have been called before the handle was stored */
+  if (!fio_pending(p->p.uuid) &&
+      (http = fio_atomic_xchange(&p->drain, NULL)) != NULL)
+    http_stream_resume(http);
+  return 0;
+}
+
 /** Should send existing headers or complete streaming */
 static void htt1p_finish(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  if (p->stream) {
+    if (p->stream == 1)
+      fio_write2(p->p.uuid, .data.buffer = "0\r\n\r\n", .length = 5,
+                 .after.dealloc = FIO_DEALLOC_NOOP, .coalesce = p->batch);
+    p->stream = 0;
+    if (p->p.settings->log) /* the log reports the Content-Length header */
+      fiobj_hash_set(h->private_data.out_headers, HTTP_HEADER_CONTENT_LENGTH,
+                     fiobj_num_new(p->streamed));
+    http1_after_finish(h);
+    return;
+  }
   FIOBJ packet = headers2str(h, 0);
   if (packet)
-    fiobj_send_free((handle2pr(h)->p.uuid), packet);
+    http1_send_packet(handle2pr(h), packet);
   else {
     // fprintf(stderr, "WARNING: invalid call to `htt1p_finish`\n");
   }
@@ -250,7 +579,9 @@ static int http1_push_file(http_s *h, FIOBJ filename, FIOBJ mime_type) {
  * Called befor a pause task,
  */
 static void http1_on_pause(http_s *h, http_fio_protocol_s *pr) {
-  ((http1pr_s *)pr)->stop = 1;
+  /* the buffer is reused while the request is paused */
+  http1_headers_load(h);
+  ((http1pr_s *)pr)->stop |= 1;
   fio_suspend(pr->uuid);
   (void)h;
 }
@@ -265,6 +596,18 @@ static void http1_on_resume(http_s *h, http_fio_protocol_s *pr) {
   (void)h;
 }
 
+/**
+ * called (within the connection's lock) when a streamed body can be read again.
+ */
+static void http1_on_body_resume(http_s *h, http_fio_protocol_s *pr) {
+  http1pr_s *p = (http1pr_s *)pr;
+  if (h != &p->request || !(p->stop & 4))
+    return; /* the protocol or the request changed */
+  p->stop &= ~4;
+  if (!p->stop)
+    fio_force_event(pr->uuid, FIO_EVENT_ON_DATA);
+}
+
 static intptr_t http1_hijack(http_s *h, fio_str_info_s *leftover) {
   if (leftover) {
     intptr_t len =
@@ -278,6 +621,7 @@ static intptr_t http1_hijack(http_s *h, fio_str_info_s *leftover) {
     }
   }
 
+  http1_headers_load(h);
   handle2pr(h)->stop = 3;
   intptr_t uuid = handle2pr(h)->p.uuid;
   fio_attach(uuid, NULL);
@@ -298,7 +642,7 @@ static void http1_websocket_client_on_upgrade(http_s *h, char *proto,
   http_finish(h);
   p->stop = 1;
   websocket_attach(uuid, set, args, p->parser.state.next,
-                   p->buf_len - (intptr_t)(p->parser.state.next - p->buf));
+                   p->buf_len - (intptr_t)(p->parser.state.next - p->buf), 0);
   fio_free(args);
   (void)proto;
   (void)len;
@@ -325,41 +669,61 @@ static int http1_http2websocket_server(http_s *h, websocket_settings_s *args) {
   static char ws_key_accpt_str[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
   static uintptr_t sec_version = 0;
   static uintptr_t sec_key = 0;
+  static uintptr_t sec_extensions = 0;
   if (!sec_version)
     sec_version = fiobj_hash_string("sec-websocket-version", 21);
   if (!sec_key)
     sec_key = fiobj_hash_string("sec-websocket-key", 17);
+  if (!sec_extensions)
+    sec_extensions = fiobj_hash_string("sec-websocket-extensions", 24);
 
-  FIOBJ tmp = fiobj_hash_get2(h->headers, sec_version);
-  if (!tmp)
-    goto bad_request;
-  fio_str_info_s stmp = fiobj_obj2cstr(tmp);
+  fio_str_info_s stmp = http_header_slice(
+      h, (fio_str_info_s){.data = (char *)"sec-websocket-version", .len = 21},
+      sec_version);
   if (stmp.len != 2 || stmp.data[0] != '1' || stmp.data[1] != '3')
     goto bad_request;
 
-  tmp = fiobj_hash_get2(h->headers, sec_key);
-  if (!tmp)
+  stmp = http_header_slice(
+      h, (fio_str_info_s){.data = (char *)"sec-websocket-key", .len = 17},
+      sec_key);
+  if (!stmp.data)
     goto bad_request;
-  stmp = fiobj_obj2cstr(tmp);
 
   fio_sha1_s sha1 = fio_sha1_init();
   fio_sha1_write(&sha1, stmp.data, stmp.len);
   fio_sha1_write(&sha1, ws_key_accpt_str, sizeof(ws_key_accpt_str) - 1);
-  tmp = fiobj_str_buf(32);
+  FIOBJ tmp = fiobj_str_buf(32);
   stmp = fiobj_obj2cstr(tmp);
   fiobj_str_resize(tmp,
                    fio_base64_encode(stmp.data, fio_sha1_result(&sha1), 20));
   http_set_header(h, HTTP_HEADER_CONNECTION, fiobj_dup(HTTP_HVALUE_WS_UPGRADE));
   http_set_header(h, HTTP_HEADER_UPGRADE, fiobj_dup(HTTP_HVALUE_WEBSOCKET));
   http_set_header(h, HTTP_HEADER_WS_SEC_KEY, tmp);
-  h->status = 101;
   http1pr_s *pr = handle2pr(h);
   const intptr_t uuid = handle2pr(h)->p.uuid;
   http_settings_s *set = handle2pr(h)->p.settings;
+  uint8_t deflate = 0;
+  if (set->ws_deflate) {
+    fio_str_info_s response;
+    stmp = http_header_slice(
+        h,
+        (fio_str_info_s){.data = (char *)"sec-websocket-extensions",
+                         .len = 24},
+        sec_extensions);
+    deflate = websocket_deflate_negotiate(stmp, set->ws_deflate, &response);
+    if (deflate)
+      http_set_header2(
+          h,
+          (fio_str_info_s){.data = (char *)"sec-websocket-extensions",
+                           .len = 24},
+          response);
+  }
+  h->status = 101;
   http_finish(h);
   pr->stop = 1;
   websocket_attach(uuid, set, args, pr->parser.state.next,
-                   pr->buf_len - (intptr_t)(pr->parser.state.next - pr->buf));
+                   pr->buf_len - (intptr_t)(pr->parser.state.next - pr->buf),
+                   deflate);
   return 0;
 bad_request:
   http_send_error(h, 400);
@@ -446,10 +810,16 @@ static void http1_sse_on_close(intptr_t uuid, fio_protocol_s *p_) {
   fio_free(p);
   (void)uuid;
 }
+static int http1_sse_write(http_sse_s *sse, FIOBJ str);
 static void http1_sse_ping(intptr_t uuid, fio_protocol_s *p_) {
+  http1_sse_fio_protocol_s *p = (http1_sse_fio_protocol_s *)p_;
+  if (p->sse->encoder) {
+    /* the ping must be a part of the compressed stream */
+    http1_sse_write(&p->sse->sse, fiobj_str_new(": ping\n\n", 8));
+    return;
+  }
   fio_write2(uuid, .data.buffer = ": ping\n\n", .length = 8,
              .after.dealloc = FIO_DEALLOC_NOOP);
-  (void)p_;
 }
 
 /**
@@ -462,13 +832,33 @@ static void http1_sse_ping(intptr_t uuid, fio_protocol_s *p_) {
  */
 static int http1_upgrade2sse(http_s *h, http_sse_s *sse) {
   const intptr_t uuid = handle2pr(h)->p.uuid;
+  const http_encoder_s *encoder = NULL;
+  void *encoder_stream = NULL;
+  if (handle2pr(h)->p.settings->compress) {
+    static uint64_t accept_enc_hash = 0;
+    if (!accept_enc_hash)
+      accept_enc_hash = fiobj_hash_string("accept-encoding", 15);
+    http_headers_load(h);
+    encoder =
+        http_encoder_negotiate(fiobj_hash_get2(h->headers, accept_enc_hash));
+    /* only advertise the encoding once the stream exists */
+    if (encoder && !(encoder_stream = encoder->stream_new()))
+      encoder = NULL;
+  }
   /* send response */
   h->status = 200;
   http_set_header(h, HTTP_HEADER_CONTENT_TYPE, fiobj_dup(HTTP_HVALUE_SSE_MIME));
   http_set_header(h, HTTP_HEADER_CACHE_CONTROL,
                   fiobj_dup(HTTP_HVALUE_NO_CACHE));
-  http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
-                  fiobj_str_new("identity", 8));
+  if (encoder) {
+    http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
+                    fiobj_str_new(encoder->name.data, encoder->name.len));
+    http_set_header(h, HTTP_HEADER_VARY,
+                    fiobj_dup(HTTP_HVALUE_ACCEPT_ENCODING));
+  } else {
+    http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
+                    fiobj_str_new("identity", 8));
+  }
   handle2pr(h)->stop = 1;
   htt1p_finish(h); /* avoid the enforced content length in http_finish */
 
@@ -491,6 +881,8 @@ static int http1_upgrade2sse(http_s *h, http_sse_s *sse) {
     goto failed;
 
   http_sse_init(sse_pr->sse, uuid, &HTTP1_VTABLE, sse);
+  sse_pr->sse->encoder_stream = encoder_stream;
+  sse_pr->sse->encoder = encoder;
   fio_timeout_set(uuid, handle2pr(h)->p.settings->ws_timeout);
   if (sse->on_open)
     sse->on_open(&sse_pr->sse->sse);
@@ -498,21 +890,52 @@ static int http1_upgrade2sse(http_s *h, http_sse_s *sse) {
   return 0;
 
 failed:
-  fio_close(handle2pr(h)->p.uuid);
+  if (encoder_stream)
+    encoder->stream_free(encoder_stream);
+  fio_free(sse_pr);
+  fio_close(uuid);
   if (sse->on_close)
     sse->on_close(sse);
   return -1;
   (void)sse;
 }
 
+/*
+ * Sends (and frees) an event. Events written during the same reactor cycle
+ * (i.e., a pub/sub broadcast) are coalesced into a single system call.
+ */
+static inline int http1_sse_send(intptr_t uuid, FIOBJ str) {
+  fio_str_info_s s = fiobj_obj2cstr(str);
+  return (int)fio_write2(uuid, .data.buffer = (void *)str,
+                         .offset = (((intptr_t)s.data) - ((intptr_t)(str))),
+                         .length = s.len, .after.dealloc = fiobj4sock_dealloc,
+                         .coalesce = 1);
+}
+
 #undef http_sse_write
 /**
  * Writes data to an EventSource (SSE) connection.
  *
  * See the {struct http_sse_write_args} for possible named arguments.
  */
-static int http1_sse_write(http_sse_s *sse, FIOBJ str) {
-  return fiobj_send_free(((http_sse_internal_s *)sse)->uuid, str);
+static int http1_sse_write(http_sse_s *sse_, FIOBJ str) {
+  http_sse_internal_s *sse = (http_sse_internal_s *)sse_;
+  if (!sse->encoder)
+    return http1_sse_send(sse->uuid, str);
+  /* compress (flushing each event), keeping the order of the writes */
+  fio_str_info_s s = fiobj_obj2cstr(str);
+  FIOBJ out = fiobj_str_buf((s.len >> 1) + 32);
+  int ret = -1;
+  fio_lock(&sse->encoder_lock);
+  if (!sse->encoder->write(sse->encoder_stream, out, s.data, s.len,
+                           HTTP_COMPRESS_SYNC_FLUSH)) {
+    ret = http1_sse_send(sse->uuid, out);
+    out = FIOBJ_INVALID;
+  }
+  fio_unlock(&sse->encoder_lock);
+  fiobj_free(out);
+  fiobj_free(str);
+  return ret;
 }
 
 /**
@@ -529,16 +952,23 @@ Virtual Table Decleration
 struct http_vtable_s HTTP1_VTABLE = {
     .http_send_body = http1_send_body,
     .http_sendfile = http1_sendfile,
+    .http_stream = http1_stream,
     .http_finish = htt1p_finish,
     .http_push_data = http1_push_data,
     .http_push_file = http1_push_file,
     .http_on_pause = http1_on_pause,
     .http_on_resume = http1_on_resume,
+    .http_on_body_resume = http1_on_body_resume,
     .http_hijack = http1_hijack,
     .http2websocket = http1_http2websocket,
     .http_upgrade2sse = http1_upgrade2sse,
     .http_sse_write = http1_sse_write,
     .http_sse_close = http1_sse_close,
+    .http_send_template = http1_send_template,
+    .http_headers_load = http1_headers_load,
+    .http_header_slice = http1_header_slice,
+    .http_stream2 = http1_stream2,
+    .http_stream_wait = http1_stream_wait,
 };
 
 void *http1_vtable(void) { return (void *)&HTTP1_VTABLE; }
@@ -550,8 +980,13 @@ Parser Callbacks
 /** called when a request was received. */
 static int http1_on_request(http1_parser_s *parser) {
   http1pr_s *p = parser2http(parser);
+  if (p->stop & 4) {
+    /* the body was streamed, reading resumes once the request is complete */
+    p->stop &= ~4;
+    fio_force_event(p->p.uuid, FIO_EVENT_ON_DATA);
+  }
   http_on_request_handler______internal(&http1_pr2handle(p), p->p.settings);
-  if (p->request.method && !p->stop)
+  if (p->request.method && !(p->stop & 1))
     http_finish(&p->request);
   h1_reset(p);
   return fio_is_closed(p->p.uuid);
@@ -560,7 +995,7 @@ static int http1_on_request(http1_parser_s *parser) {
 static int http1_on_response(http1_parser_s *parser) {
   http1pr_s *p = parser2http(parser);
   http_on_response_handler______internal(&http1_pr2handle(p), p->p.settings);
-  if (p->request.status_str && !p->stop)
+  if (p->request.status_str && !(p->stop & 1))
     http_finish(&p->request);
   h1_reset(p);
   return fio_is_closed(p->p.uuid);
@@ -568,8 +1003,12 @@ static int http1_on_response(http1_parser_s *parser) {
 /** called when a request method is parsed. */
 static int http1_on_method(http1_parser_s *parser, char *method,
                            size_t method_len) {
+  fio_region_s *old = h1_region_enter(parser);
   http1_pr2handle(parser2http(parser)).method =
       fiobj_str_new(method, method_len);
+  http1_pr2handle(parser2http(parser)).udata =
+      parser2http(parser)->p.settings->udata;
+  fio_region_set(old);
   parser2http(parser)->header_size += method_len;
   return 0;
 }
@@ -587,21 +1026,27 @@ static int http1_on_status(http1_parser_s *parser, size_t status,
 
 /** called when a request path (excluding query) is parsed. */
 static int http1_on_path(http1_parser_s *parser, char *path, size_t len) {
+  fio_region_s *old = h1_region_enter(parser);
   http1_pr2handle(parser2http(parser)).path = fiobj_str_new(path, len);
+  fio_region_set(old);
   parser2http(parser)->header_size += len;
   return 0;
 }
 
 /** called when a request path (excluding query) is parsed. */
 static int http1_on_query(http1_parser_s *parser, char *query, size_t len) {
+  fio_region_s *old = h1_region_enter(parser);
   http1_pr2handle(parser2http(parser)).query = fiobj_str_new(query, len);
+  fio_region_set(old);
   parser2http(parser)->header_size += len;
   return 0;
 }
 /** called when a the HTTP/1.x version is parsed. */
 static int http1_on_http_version(http1_parser_s *parser, char *version,
                                  size_t len) {
+  fio_region_s *old = h1_region_enter(parser);
   http1_pr2handle(parser2http(parser)).version = fiobj_str_new(version, len);
+  fio_region_set(old);
   parser2http(parser)->header_size += len;
 /* start counting - occurs on the first line of both requests and responses */
 #if FIO_HTTP_EXACT_LOGGING
@@ -636,10 +1081,27 @@ static int http1_on_header(http1_parser_s *parser, char *name, size_t name_len,
     http_send_error(&http1_pr2handle(parser2http(parser)), 413);
     return -1;
   }
-  sym = fiobj_str_new(name, name_len);
+  if (parser2http(parser)->slices) {
+    http1pr_s *p = parser2http(parser);
+    if (p->slice_count < HTTP_MAX_HEADER_COUNT) {
+      p->slices[p->slice_count++] = (h1_header_slice_s){
+          .hash = fiobj_hash_string(name, name_len),
+          .name = (uint32_t)((uint8_t *)name - p->buf),
+          .name_len = (uint32_t)name_len,
+          .value = (uint32_t)((uint8_t *)data - p->buf),
+          .value_len = (uint32_t)data_len,
+      };
+      return 0;
+    }
+    /* too many headers to keep as slices, switch to FIOBJ objects */
+    http1_headers_load(&p->request);
+  }
+  fio_region_s *old = h1_region_enter(parser);
+  sym = fiobj_str_intern(name, name_len);
   obj = fiobj_str_new(data, data_len);
   set_header_add(http1_pr2handle(parser2http(parser)).headers, sym, obj);
   fiobj_free(sym);
+  fio_region_set(old);
   return 0;
 }
 /** called when a body chunk is parsed. */
@@ -652,6 +1114,16 @@ static int http1_on_body_chunk(http1_parser_s *parser, char *data,
     http_send_error(&http1_pr2handle(parser2http(parser)), 413);
     return -1; /* test every time, in case of chunked data */
   }
+  http1pr_s *p = parser2http(parser);
+  if (p->p.settings->on_body_chunk && !p->is_client) {
+    /* stream the body, suspending the connection when the handler asks */
+    if (p->p.settings->on_body_chunk(
+            &p->request, (fio_str_info_s){.data = data, .len = data_len})) {
+      p->stop |= 4;
+      fio_suspend(p->p.uuid);
+    }
+    return 0;
+  }
   if (!parser->state.read) {
     if (parser->state.content_length > 0 &&
         parser->state.content_length <= HTTP_MAX_HEADER_LENGTH) {
@@ -683,7 +1155,8 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
   size_t org_len = p->buf_len;
   int pipeline_limit = 8;
   if (!p->buf_len)
-    return;
+    goto idle;
+  p->batch = 1;
   do {
     i = http1_fio_parser(.parser = &p->parser,
                          .buffer = p->buf + (org_len - p->buf_len),
@@ -699,10 +1172,16 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
     p->buf_len -= i;
     --pipeline_limit;
   } while (i && p->buf_len && pipeline_limit && !p->stop);
-
-  if (p->buf_len && org_len != p->buf_len) {
+  p->batch = 0;
+
+  /* a request still being parsed (or followed by pipelined data) can't keep
+   * pointing into the buffer, as the buffer is about to be moved or reused.
+   * Requests being handled keep their slices (the buffer isn't read to). */
+  if (p->slice_count && org_len != p->buf_len &&
+      (p->buf_len || !(p->stop & 1)))
+    http1_headers_load(&p->request);
+  if (p->buf_len && org_len != p->buf_len)
     memmove(p->buf, p->buf + (org_len - p->buf_len), p->buf_len);
-  }
 
   if (p->buf_len == HTTP_MAX_HEADER_LENGTH) {
     /* no room to read... parser not consuming data */
@@ -717,6 +1196,8 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
   if (!pipeline_limit) {
     fio_force_event(uuid, FIO_EVENT_ON_DATA);
   }
+idle:
+  h1_buffer_release_idle(p);
   return;
 
 throttle:
@@ -734,6 +1215,8 @@ static void http1_on_data(intptr_t uuid, fio_protocol_s *protocol) {
     return;
   }
   ssize_t i = 0;
+  if (!p->buf)
+    p->buf = h1_buffer_acquire();
   if (HTTP_MAX_HEADER_LENGTH - p->buf_len)
     i = fio_read(uuid, p->buf + p->buf_len,
                  HTTP_MAX_HEADER_LENGTH - p->buf_len);
@@ -751,9 +1234,15 @@ static void http1_on_close(intptr_t uuid, fio_protocol_s *protocol) {
 
 /** called when the connection was closed, but will not run concurrently */
 static void http1_on_ready(intptr_t uuid, fio_protocol_s *protocol) {
+  http1pr_s *p = (http1pr_s *)protocol;
+  /* the data was sent, resume a streamed response (see `http_stream_wait`).
+   * A stale event (from earlier writes) is followed by another, once flushed */
+  http_pause_handle_s *http;
+  if (p->drain && !fio_pending(uuid) &&
+      (http = fio_atomic_xchange(&p->drain, NULL)) != NULL)
+    http_stream_resume(http);
   /* resume slow clients from suspension */
   fio_force_event(uuid, FIO_EVENT_ON_DATA);
-  (void)protocol;
 }
 
 /** called when a data is available for the first time */
@@ -761,15 +1250,22 @@ static void http1_on_data_first_time(intptr_t uuid, fio_protocol_s *protocol) {
   http1pr_s *p = (http1pr_s *)protocol;
   ssize_t i;
 
+  if (!p->buf)
+    p->buf = h1_buffer_acquire();
   i = fio_read(uuid, p->buf + p->buf_len, HTTP_MAX_HEADER_LENGTH - p->buf_len);
 
-  if (i <= 0)
+  if (i <= 0) {
+    h1_buffer_release_idle(p);
     return;
+  }
   p->buf_len += i;
 
   /* ensure future reads skip this first time HTTP/2.0 test */
   p->p.protocol.on_data = http1_on_data;
   if (i >= 24 && !memcmp(p->buf, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24)) {
+    if (p->p.settings->http2 && !p->p.settings->is_client &&
+        http2_new(uuid, p->p.settings, p->buf, p->buf_len))
+      return; /* the HTTP/1.1 protocol object is freed by `fio_attach` */
     FIO_LOG_WARNING("client claimed unsupported HTTP/2 prior knowledge.");
     fio_close(uuid);
     return;
@@ -789,7 +1285,10 @@ fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
                           void *unread_data, size_t unread_length) {
   if (unread_data && unread_length > HTTP_MAX_HEADER_LENGTH)
     return NULL;
-  http1pr_s *p = fio_malloc(sizeof(*p) + HTTP_MAX_HEADER_LENGTH);
+  const uint8_t lazy = settings->lazy_headers && !settings->is_client;
+  http1pr_s *p = fio_malloc(
+      sizeof(*p) +
+      (lazy ? (sizeof(h1_header_slice_s) * HTTP_MAX_HEADER_COUNT) : 0));
   // FIO_LOG_DEBUG("Allocated HTTP/1.1 protocol at. %p", (void *)p);
   FIO_ASSERT_ALLOC(p);
   *p = (http1pr_s){
@@ -801,11 +1300,18 @@ fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
           },
       .p.uuid = uuid,
       .p.settings = settings,
+      .region = FIO_REGION_INIT,
       .max_header_size = settings->max_header_size,
       .is_client = settings->is_client,
   };
+  if (settings->request_region && !settings->is_client)
+    p->p.region = &p->region;
+  if (lazy)
+    p->slices = (h1_header_slice_s *)(p + 1);
   http_s_new(&p->request, &p->p, &HTTP1_VTABLE);
+  http_metric_add(HTTP_METRIC_HTTP1, 1);
   if (unread_data && unread_length <= HTTP_MAX_HEADER_LENGTH) {
+    p->buf = h1_buffer_acquire();
     memcpy(p->buf, unread_data, unread_length);
     p->buf_len = unread_length;
   }
@@ -821,7 +1327,11 @@ void http1_destroy(fio_protocol_s *pr) {
   http1pr_s *p = (http1pr_s *)pr;
   http1_pr2handle(p).status = 0;
   http_s_destroy(&http1_pr2handle(p), 0);
+  fio_region_reset(&p->region);
+  h1_buffer_release(p->buf);
+  fio_free(p->drain); /* the connection closed while waiting */
   fio_free(p);
+  http_metric_add(HTTP_METRIC_HTTP1, -1);
   // FIO_LOG_DEBUG("Deallocated HTTP/1.1 protocol at. %p", (void *)p);
 }
 
@@ -911,3 +1421,539 @@ static fio_str_info_s http1pr_status2str(uintptr_t status) {
   return ret;
 }
 #undef HTTP_SET_STATUS_STR
+
+#if DEBUG
+/* attaches an HTTP/1.1 connection to one end of a socket pair */
+static http1pr_s *http1_test_connect(int sv[2], http_settings_s *settings) {
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed.");
+  fio_set_non_block(sv[0]);
+  fio_set_non_block(sv[1]);
+  return (http1pr_s *)http1_new(fio_fd2uuid(sv[0]), settings, NULL, 0);
+}
+
+/* sends (part of) a request and performs the tasks it schedules */
+static void http1_test_send(int sv[2], http1pr_s *p, const char *data) {
+  const size_t len = strlen(data);
+  FIO_ASSERT(write(sv[1], data, len) == (ssize_t)len,
+             "socketpair write failed.");
+  fio_force_event(p->p.uuid, FIO_EVENT_ON_DATA);
+  fio_defer_perform();
+}
+
+/* sends a request and performs the tasks it schedules */
+static void http1_test_request(int sv[2], http1pr_s *p) {
+  http1_test_send(sv, p, "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+}
+
+static void http1_test_disconnect(int sv[2], http1pr_s *p) {
+  fio_force_close(p->p.uuid);
+  close(sv[1]);
+  fio_defer_perform();
+}
+
+#define H1_STREAM_TEST_LARGE (1UL << 20)
+
+static struct {
+  size_t freed;
+  size_t resumed;
+} h1_stream_test_state;
+
+static void h1_stream_test_dealloc(void *buf) {
+  ++h1_stream_test_state.freed;
+  free(buf);
+}
+
+static char *h1_stream_test_chunk(size_t length) {
+  char *buf = malloc(length);
+  FIO_ASSERT_ALLOC(buf);
+  for (size_t i = 0; i < length; ++i)
+    buf[i] = 'a' + (i % 26);
+  return buf;
+}
+
+/* the second wait, with data pending, is resumed by `on_ready` */
+static void h1_stream_test_finish(http_s *h) {
+  ++h1_stream_test_state.resumed;
+  FIO_ASSERT(h1_stream_test_state.freed == 3,
+             "streamed data should be released once sent (%zu)",
+             h1_stream_test_state.freed);
+  http_finish(h);
+}
+
+/* the first wait found nothing pending (`on_ready` won't be called) */
+static void h1_stream_test_resume(http_s *h) {
+  ++h1_stream_test_state.resumed;
+  FIO_ASSERT(h1_stream_test_state.freed == 1,
+             "streamed data should be released once sent (%zu)",
+             h1_stream_test_state.freed);
+  /* empty chunks are copied (sending nothing), the data is released */
+  FIO_ASSERT(!http_stream2(h, h1_stream_test_chunk(1), 0,
+                           h1_stream_test_dealloc) &&
+                 h1_stream_test_state.freed == 2,
+             "http_stream2 should release the data of empty chunks");
+  /* larger than the socket's buffer, so the data remains pending */
+  FIO_ASSERT(!http_stream2(h, h1_stream_test_chunk(H1_STREAM_TEST_LARGE),
+                           H1_STREAM_TEST_LARGE, h1_stream_test_dealloc),
+             "http_stream2 failed");
+  FIO_ASSERT(!http_stream_wait(h, h1_stream_test_finish),
+             "http_stream_wait failed");
+  FIO_ASSERT(handle2pr(h)->drain,
+             "http_stream_wait should wait for pending data to be sent");
+}
+
+static void h1_stream_test_on_request(http_s *h) {
+  FIO_ASSERT(!http_stream2(h, h1_stream_test_chunk(3000), 3000,
+                           h1_stream_test_dealloc),
+             "http_stream2 failed");
+  /* sent before waiting, as if `on_ready` ran before the wait */
+  while (fio_flush(handle2pr(h)->p.uuid) > 0)
+    ;
+  FIO_ASSERT(!http_stream_wait(h, h1_stream_test_resume),
+             "http_stream_wait failed");
+  FIO_ASSERT(!handle2pr(h)->drain,
+             "http_stream_wait should resume when nothing is pending");
+}
+
+void http1_stream_test(void) {
+  fprintf(stderr, "=== Testing HTTP/1.1 chunked streaming\n");
+  struct {
+    uintptr_t length;
+    const char *expected;
+  } t[] = {{1, "1\r\n"},
+           {15, "f\r\n"},
+           {16, "10\r\n"},
+           {0xA0B0, "a0b0\r\n"},
+           {~(uintptr_t)0 >> 4, "fffffffffffffff\r\n"}};
+  char buf[24];
+  for (size_t i = 0; i < sizeof(t) / sizeof(t[0]); ++i) {
+    size_t len = http1_chunk_size(buf, t[i].length);
+    FIO_ASSERT(len == strlen(t[i].expected) &&
+                   !memcmp(buf, t[i].expected, len),
+               "chunk size line error for %zu: %.*s", (size_t)t[i].length,
+               (int)len, buf);
+  }
+  /* the data is released when it can't be sent */
+  h1_stream_test_state.freed = 0;
+  FIO_ASSERT(http_stream2(NULL, h1_stream_test_chunk(1), 1,
+                          h1_stream_test_dealloc) == -1 &&
+                 h1_stream_test_state.freed == 1,
+             "http_stream2 should release the data on error");
+  /* the data is framed (without copying) and the waiting tasks performed */
+  h1_stream_test_state.freed = h1_stream_test_state.resumed = 0;
+  int sv[2];
+  http_settings_s settings = {
+      .on_request = h1_stream_test_on_request,
+      .max_body_size = HTTP_DEFAULT_BODY_LIMIT,
+      .max_header_size = 32 * 1024,
+  };
+  http1pr_s *p = http1_test_connect(sv, &settings);
+  http1_test_request(sv, p);
+  const size_t capa = H1_STREAM_TEST_LARGE + 8192;
+  char *reply = malloc(capa + 1);
+  FIO_ASSERT_ALLOC(reply);
+  size_t len = 0;
+  for (size_t i = 0; i < 4096 && (h1_stream_test_state.resumed < 2 ||
+                                  fio_pending(p->p.uuid));
+       ++i) {
+    /* the reactor's role: flush the data, reporting once all was sent */
+    fio_flush(p->p.uuid);
+    if (!fio_pending(p->p.uuid))
+      fio_force_event(p->p.uuid, FIO_EVENT_ON_READY);
+    fio_defer_perform();
+    ssize_t r;
+    while (len < capa && (r = read(sv[1], reply + len, capa - len)) > 0)
+      len += r;
+  }
+  FIO_ASSERT(h1_stream_test_state.resumed == 2,
+             "http_stream_wait should resume once the data was sent");
+  reply[len] = 0;
+  char *body = strstr(reply, "\r\n\r\n");
+  FIO_ASSERT(body && strstr(reply, "transfer-encoding:chunked\r\n"),
+             "streamed responses should use chunked encoding");
+  body += 4;
+  len -= body - reply;
+  /* "<hex>\r\n<data>\r\n" for each chunk, then "0\r\n\r\n" */
+  char *chunk = h1_stream_test_chunk(H1_STREAM_TEST_LARGE);
+  FIO_ASSERT(len == 5 + 3000 + 10 + H1_STREAM_TEST_LARGE + 7 &&
+                 !memcmp(body, "bb8\r\n", 5) &&
+                 !memcmp(body + 5, chunk, 3000) &&
+                 !memcmp(body + 3005, "\r\n100000\r\n", 10) &&
+                 !memcmp(body + 3015, chunk, H1_STREAM_TEST_LARGE) &&
+                 !strcmp(body + 3015 + H1_STREAM_TEST_LARGE, "\r\n0\r\n\r\n"),
+             "chunk framing error (%zu bytes): %.64s", len, body);
+  free(reply);
+  free(chunk);
+  http1_test_disconnect(sv, p);
+  fprintf(stderr, "* passed.\n");
+}
+#undef H1_STREAM_TEST_LARGE
+
+static struct {
+  size_t requests;
+  size_t lazy;
+  size_t errors;
+  char body[128];
+} h1_lazy_test_state;
+
+static void h1_lazy_test_on_request(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  ++h1_lazy_test_state.requests;
+  if (p->slice_count)
+    ++h1_lazy_test_state.lazy;
+  fio_str_info_s host =
+      http_header_get_slice(h, (fio_str_info_s){.data = "host", .len = 4});
+  fio_str_info_s test =
+      http_header_get_slice(h, (fio_str_info_s){.data = "x-test", .len = 6});
+  if (host.len != 9 || memcmp(host.data, "localhost", 9) || test.len != 4 ||
+      memcmp(test.data, "lazy", 4))
+    ++h1_lazy_test_state.errors;
+  FIOBJ headers = http_headers(h);
+  FIOBJ value = fiobj_hash_get2(headers, fiobj_hash_string("x-test", 6));
+  if (p->slice_count || !FIOBJ_TYPE_IS(value, FIOBJ_T_STRING) ||
+      fiobj_obj2cstr(value).len != 4 ||
+      memcmp(fiobj_obj2cstr(value).data, "lazy", 4))
+    ++h1_lazy_test_state.errors;
+#if !FIO_FORCE_MALLOC
+  /* loaded headers are sliced from the region (short strings are embedded) */
+  value = fiobj_hash_get2(headers, fiobj_hash_string("x-long", 6));
+  if (value && (!p->region.block || fiobj_obj2cstr(value).len != 100 ||
+                !fio_region_owns(fiobj_obj2cstr(value).data)))
+    ++h1_lazy_test_state.errors;
+#endif
+  h1_lazy_test_state.body[0] = 0;
+  if (h->body) {
+    fio_str_info_s body = fiobj_data_pread(h->body, 0, 127);
+    memcpy(h1_lazy_test_state.body, body.data, body.len);
+    h1_lazy_test_state.body[body.len] = 0;
+  }
+  http_send_body(h, "ok", 2);
+}
+
+void http1_lazy_headers_test(void) {
+  fprintf(stderr, "=== Testing HTTP/1.1 lazy headers and request regions\n");
+  int sv[2];
+  http_settings_s settings = {
+      .on_request = h1_lazy_test_on_request,
+      .max_body_size = HTTP_DEFAULT_BODY_LIMIT,
+      .max_header_size = 32 * 1024,
+      .lazy_headers = 1,
+      .request_region = 1,
+  };
+  memset(&h1_lazy_test_state, 0, sizeof(h1_lazy_test_state));
+  http1pr_s *p = http1_test_connect(sv, &settings);
+  FIO_ASSERT(p->slices && p->p.region == &p->region,
+             "lazy headers / request region settings ignored");
+  {
+    char request[256];
+    char value[101];
+    memset(value, 'a', 100);
+    value[100] = 0;
+    snprintf(request, sizeof(request),
+             "GET / HTTP/1.1\r\nHost: localhost\r\nX-Test: lazy\r\n"
+             "X-Long: %s\r\n\r\n",
+             value);
+    http1_test_send(sv, p, request);
+  }
+  FIO_ASSERT(h1_lazy_test_state.requests == 1 &&
+                 h1_lazy_test_state.lazy == 1 && !h1_lazy_test_state.errors,
+             "lazy headers error (%zu requests, %zu lazy, %zu errors)",
+             h1_lazy_test_state.requests, h1_lazy_test_state.lazy,
+             h1_lazy_test_state.errors);
+  FIO_ASSERT(!p->slice_count && !p->region.block,
+             "finished requests should drop their slices and region");
+  /* the body arrives after the headers, the buffer is consumed and reused
+   * (the rest of the body overwrites the headers) */
+  const char *body = "0123456789abcdefghijklmnopqrstuvwxyz"
+                     "0123456789abcdefghijklmnopqrstuvwxyz";
+  http1_test_send(sv, p,
+                  "POST / HTTP/1.1\r\nHost: localhost\r\nX-Test: lazy\r\n"
+                  "Content-Length: 72\r\n\r\n0123");
+  FIO_ASSERT(h1_lazy_test_state.requests == 1,
+             "request handled before the body was received");
+  http1_test_send(sv, p, body + 4);
+  FIO_ASSERT(h1_lazy_test_state.requests == 2 && !h1_lazy_test_state.errors &&
+                 !strcmp(h1_lazy_test_state.body, body),
+             "lazy headers should survive a body split across reads (%s)",
+             h1_lazy_test_state.body);
+  /* a pipelined request follows a complete one */
+  http1_test_send(sv, p,
+                  "GET / HTTP/1.1\r\nHost: localhost\r\nX-Test: lazy\r\n\r\n"
+                  "GET / HTTP/1.1\r\nHost: localhost\r\nX-Test: la");
+  http1_test_send(sv, p, "zy\r\n\r\n");
+  FIO_ASSERT(h1_lazy_test_state.requests == 4 && !h1_lazy_test_state.errors,
+             "lazy headers error with pipelined requests (%zu, %zu errors)",
+             h1_lazy_test_state.requests, h1_lazy_test_state.errors);
+  char reply[1024];
+  size_t len = 0;
+  ssize_t r;
+  fio_flush(p->p.uuid);
+  while (len < sizeof(reply) - 1 &&
+         (r = read(sv[1], reply + len, sizeof(reply) - 1 - len)) > 0)
+    len += r;
+  reply[len] = 0;
+  size_t count = 0;
+  for (char *pos = reply; (pos = strstr(pos, "HTTP/1.1 200 OK\r\n")); ++pos)
+    ++count;
+  FIO_ASSERT(count == 4 && !strstr(reply, "HTTP/1.1 4"),
+             "every request should be answered (%zu):\n%s", count, reply);
+  http1_test_disconnect(sv, p);
+  fprintf(stderr, "* passed.\n");
+}
+
+static struct {
+  http_response_template_s *t;
+  size_t status;
+} h1_template_test_state;
+
+static void h1_template_test_on_request(http_s *h) {
+  h->status = h1_template_test_state.status;
+  http_set_header2(h, (fio_str_info_s){.data = "x-extra", .len = 7},
+                   (fio_str_info_s){.data = "1", .len = 1});
+  http_send_template(h, h1_template_test_state.t, "hello", 5);
+}
+
+/* reads the reply, expecting `expected`, where "%s" is the Date value */
+static void h1_template_test_reply(int sv[2], http1pr_s *p,
+                                   const char *expected) {
+  char date[64];
+  char reply[512];
+  {
+    FIOBJ tmp = http_date_current();
+    fio_str_info_s s = fiobj_obj2cstr(tmp);
+    memcpy(date, s.data, s.len + 1);
+    fiobj_free(tmp);
+  }
+  char buf[512];
+  snprintf(buf, sizeof(buf), expected, date);
+  size_t len = 0;
+  ssize_t r;
+  fio_flush(p->p.uuid);
+  while (len < sizeof(reply) - 1 &&
+         (r = read(sv[1], reply + len, sizeof(reply) - 1 - len)) > 0)
+    len += r;
+  reply[len] = 0;
+  FIO_ASSERT(len == strlen(buf) && !memcmp(reply, buf, len),
+             "response template rendering error, expected:\n%s\ngot:\n%s", buf,
+             reply);
+}
+
+void http1_template_test(void) {
+  fprintf(stderr, "=== Testing HTTP/1.1 response templates\n");
+  int sv[2];
+  http_settings_s settings = {
+      .on_request = h1_template_test_on_request,
+      .max_body_size = HTTP_DEFAULT_BODY_LIMIT,
+      .max_header_size = 32 * 1024,
+  };
+  FIOBJ headers = fiobj_hash_new();
+  FIOBJ name = fiobj_str_new("content-type", 12);
+  fiobj_hash_set(headers, name, fiobj_str_new("text/plain", 10));
+  fiobj_free(name);
+  name = fiobj_str_new("server", 6);
+  fiobj_hash_set(headers, name, fiobj_str_new("facil.io", 8));
+  fiobj_free(name);
+  h1_template_test_state.t = http_response_template_new(headers);
+  h1_template_test_state.status = 200;
+  FIO_ASSERT(h1_template_test_state.t, "http_response_template_new failed");
+  http1pr_s *p = http1_test_connect(sv, &settings);
+  http1_test_request(sv, p);
+  h1_template_test_reply(sv, p,
+                         "HTTP/1.1 200 OK\r\nconnection:keep-alive\r\n"
+                         "content-type:text/plain\r\nserver:facil.io\r\n"
+                         "content-length:5\r\ndate:%s\r\nx-extra:1\r\n\r\n"
+                         "hello");
+  FIO_ASSERT(!p->close, "keep-alive connection marked for closure");
+  h1_template_test_state.status = 404;
+  http1_test_request(sv, p);
+  h1_template_test_reply(sv, p,
+                         "HTTP/1.1 404 Not Found\r\nconnection:keep-alive\r\n"
+                         "content-type:text/plain\r\nserver:facil.io\r\n"
+                         "content-length:5\r\ndate:%s\r\nx-extra:1\r\n\r\n"
+                         "hello");
+  http_response_template_free(h1_template_test_state.t);
+  /* a template's Connection header replaces the default one */
+  name = fiobj_str_new("connection", 10);
+  fiobj_hash_set(headers, name, fiobj_str_new("close", 5));
+  fiobj_free(name);
+  h1_template_test_state.t = http_response_template_new(headers);
+  h1_template_test_state.status = 200;
+  http1_test_request(sv, p);
+  h1_template_test_reply(sv, p,
+                         "HTTP/1.1 200 OK\r\n"
+                         "content-type:text/plain\r\nserver:facil.io\r\n"
+                         "connection:close\r\n"
+                         "content-length:5\r\ndate:%s\r\nx-extra:1\r\n\r\n"
+                         "hello");
+  http1_test_disconnect(sv, p);
+  http_response_template_free(h1_template_test_state.t);
+  fiobj_free(headers);
+  fprintf(stderr, "* passed.\n");
+}
+
+static char h1_range_test_path[64];
+
+static void h1_range_test_on_request(http_s *h) {
+  if (http_sendfile2(h, h1_range_test_path, strlen(h1_range_test_path), NULL,
+                     0))
+    http_send_error(h, 404);
+}
+
+/* requests the file with a Range header and validates the reply */
+static void h1_range_test_request(int sv[2], http1pr_s *p, const char *range,
+                                  const char *status, const char *crange,
+                                  size_t offset, size_t length) {
+  char reply[1024];
+  snprintf(reply, sizeof(reply),
+           "GET / HTTP/1.1\r\nHost: localhost\r\nRange: %s\r\n\r\n", range);
+  http1_test_send(sv, p, reply);
+  size_t len = 0;
+  ssize_t r;
+  fio_flush(p->p.uuid);
+  while (len < sizeof(reply) - 1 &&
+         (r = read(sv[1], reply + len, sizeof(reply) - 1 - len)) > 0)
+    len += r;
+  reply[len] = 0;
+  FIO_ASSERT(!strncmp(reply, status, strlen(status)),
+             "Range %s: wrong status line:\n%s", range, reply);
+  FIO_ASSERT(!crange || strstr(reply, crange),
+             "Range %s: expecting %s in:\n%s", range, crange, reply);
+  char *body = strstr(reply, "\r\n\r\n");
+  FIO_ASSERT(body, "Range %s: incomplete reply:\n%s", range, reply);
+  body += 4;
+  FIO_ASSERT((size_t)(reply + len - body) == length,
+             "Range %s: expecting %zu bytes, got %zu", range, length,
+             (size_t)(reply + len - body));
+  for (size_t i = 0; i < length; ++i)
+    FIO_ASSERT(body[i] == (char)('0' + ((offset + i) % 10)),
+               "Range %s: wrong data at byte %zu", range, i);
+}
+
+void http1_sendfile_range_test(void) {
+  fprintf(stderr, "=== Testing HTTP/1.1 Range requests (cached file body)\n");
+  snprintf(h1_range_test_path, sizeof(h1_range_test_path),
+           "/tmp/fio_range_test_%d.txt", (int)getpid());
+  {
+    char data[100];
+    for (size_t i = 0; i < sizeof(data); ++i)
+      data[i] = '0' + (i % 10);
+    int fd = open(h1_range_test_path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+    FIO_ASSERT(fd != -1, "couldn't create %s", h1_range_test_path);
+    FIO_ASSERT(write(fd, data, sizeof(data)) == (ssize_t)sizeof(data),
+               "couldn't write %s", h1_range_test_path);
+    close(fd);
+  }
+  int sv[2];
+  http_settings_s settings = {
+      .on_request = h1_range_test_on_request,
+      .max_body_size = HTTP_DEFAULT_BODY_LIMIT,
+      .max_header_size = 32 * 1024,
+  };
+  http1pr_s *p = http1_test_connect(sv, &settings);
+  h1_range_test_request(sv, p, "bytes=0-0", "HTTP/1.1 206",
+                        "content-range:bytes 0-0/100\r\n", 0, 1);
+  h1_range_test_request(sv, p, "bytes=90-200", "HTTP/1.1 206",
+                        "content-range:bytes 90-99/100\r\n", 90, 10);
+  h1_range_test_request(sv, p, "bytes=-10", "HTTP/1.1 206",
+                        "content-range:bytes 90-99/100\r\n", 90, 10);
+  h1_range_test_request(sv, p, "bytes=-200", "HTTP/1.1 206",
+                        "content-range:bytes 0-99/100\r\n", 0, 100);
+  h1_range_test_request(sv, p, "bytes=10-", "HTTP/1.1 206",
+                        "content-range:bytes 10-99/100\r\n", 10, 90);
+  h1_range_test_request(sv, p, "bytes=100-", "HTTP/1.1 416",
+                        "content-range:bytes */100\r\n", 0, 0);
+  h1_range_test_request(sv, p, "bytes=-0", "HTTP/1.1 416",
+                        "content-range:bytes */100\r\n", 0, 0);
+  /* invalid ranges are ignored */
+  h1_range_test_request(sv, p, "bytes=5-2", "HTTP/1.1 200", NULL, 0, 100);
+  http1_test_disconnect(sv, p);
+  unlink(h1_range_test_path);
+  http_file_cache_clear();
+  fprintf(stderr, "* passed.\n");
+}
+
+static void *h1_buffer_pool_test_thread(void *registered) {
+  h1_buffer_release(h1_buffer_acquire());
+  *(void **)registered = pthread_getspecific(h1_buffer_pool_key);
+  return NULL;
+}
+
+static void h1_buffer_test_finish(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  FIO_ASSERT(p->buf, "paused requests should keep the buffer");
+  http_send_body(h, "ok", 2);
+  /* released by the (asynchronous) finish, not by a later read */
+  FIO_ASSERT(!p->buf && !p->stop,
+             "an asynchronously finished request should release the buffer");
+}
+static void h1_buffer_test_pause(http_pause_handle_s *http) {
+  http_resume(http, h1_buffer_test_finish, NULL);
+}
+static void h1_buffer_test_on_request(http_s *h) {
+  http_pause(h, h1_buffer_test_pause);
+}
+
+void http1_buffer_pool_test(void) {
+  fprintf(stderr, "=== Testing HTTP/1.1 read buffer pool\n");
+  while (h1_buffer_pool.count)
+    fio_free(h1_buffer_acquire());
+  uint8_t *a = h1_buffer_acquire();
+  uint8_t *b = h1_buffer_acquire();
+  FIO_ASSERT(a && b && a != b, "read buffer allocation error");
+  h1_buffer_release(a);
+  h1_buffer_release(b);
+  FIO_ASSERT(h1_buffer_pool.count == 2, "released buffers should be pooled");
+  FIO_ASSERT(h1_buffer_acquire() == b && h1_buffer_acquire() == a,
+             "pooled buffers should be reused");
+  /* connections keep their buffer while it holds data or a request */
+  http1pr_s p = {.buf = a, .buf_len = 1};
+  h1_buffer_release_idle(&p);
+  FIO_ASSERT(p.buf == a, "buffer released while holding unparsed data");
+  p.buf_len = 0;
+  p.stop = 1;
+  h1_buffer_release_idle(&p);
+  FIO_ASSERT(p.buf == a, "buffer released while handling a request");
+  p.stop = 0;
+  h1_buffer_release_idle(&p);
+  FIO_ASSERT(!p.buf && h1_buffer_pool.head == a,
+             "idle connection should return its buffer to the pool");
+  /* the pool is bounded */
+  uint8_t *bufs[HTTP1_BUFFER_POOL_LIMIT + 1];
+  for (size_t i = 0; i <= HTTP1_BUFFER_POOL_LIMIT; ++i)
+    bufs[i] = h1_buffer_acquire();
+  FIO_ASSERT(!h1_buffer_pool.count, "pool should be empty");
+  for (size_t i = 0; i <= HTTP1_BUFFER_POOL_LIMIT; ++i)
+    h1_buffer_release(bufs[i]);
+  h1_buffer_release(b);
+  FIO_ASSERT(h1_buffer_pool.count == HTTP1_BUFFER_POOL_LIMIT,
+             "pool should be limited to HTTP1_BUFFER_POOL_LIMIT (%zu)",
+             h1_buffer_pool.count);
+  /* pooled buffers are freed when the thread (or process) exits */
+  h1_buffer_pool_drain(NULL);
+  FIO_ASSERT(!h1_buffer_pool.count && !h1_buffer_pool.head,
+             "the pool should be empty once drained");
+  void *registered = NULL;
+  pthread_t thread;
+  FIO_ASSERT(!pthread_create(&thread, NULL, h1_buffer_pool_test_thread,
+                             &registered) &&
+                 !pthread_join(thread, NULL),
+             "couldn't run the buffer pool thread test");
+  FIO_ASSERT(h1_buffer_pool_key_valid && registered,
+             "the pool's thread exit destructor wasn't set");
+  /* a request finished after `http_pause` releases the buffer */
+  int sv[2];
+  http_settings_s settings = {
+      .on_request = h1_buffer_test_on_request,
+      .max_body_size = HTTP_DEFAULT_BODY_LIMIT,
+      .max_header_size = 32 * 1024,
+  };
+  http1pr_s *c = http1_test_connect(sv, &settings);
+  http1_test_request(sv, c);
+  char reply[64];
+  fio_flush(c->p.uuid);
+  ssize_t r = read(sv[1], reply, sizeof(reply));
+  FIO_ASSERT(r > 12 && !memcmp(reply, "HTTP/1.1 200", 12),
+             "the paused request wasn't answered");
+  http1_test_disconnect(sv, c);
+  fprintf(stderr, "* passed.\n");
+}
+#endif
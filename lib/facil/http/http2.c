@@ -0,0 +1,1178 @@
+/*
+Copyright: Boaz Segev, 2017-2019
+License: MIT
+*/
+#include <fio.h>
+
+#include <hpack.h>
+#include <http2.h>
+#include <http_internal.h>
+
+#include <fiobj.h>
+
+#include <assert.h>
+#include <stddef.h>
+
+/* *****************************************************************************
+Constants (RFC 7540)
+***************************************************************************** */
+
+/** The frame size we accept (the SETTINGS_MAX_FRAME_SIZE default). */
+#define HTTP2_FRAME_SIZE 16384
+/** The default (initial) flow control window size. */
+#define HTTP2_DEFAULT_WINDOW 65535
+/** The maximal flow control window size. */
+#define HTTP2_MAX_WINDOW 2147483647
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LEN 24
+
+enum {
+  H2_DATA = 0x0,
+  H2_HEADERS = 0x1,
+  H2_PRIORITY = 0x2,
+  H2_RST_STREAM = 0x3,
+  H2_SETTINGS = 0x4,
+  H2_PUSH_PROMISE = 0x5,
+  H2_PING = 0x6,
+  H2_GOAWAY = 0x7,
+  H2_WINDOW_UPDATE = 0x8,
+  H2_CONTINUATION = 0x9,
+};
+
+enum {
+  H2_FLAG_END_STREAM = 0x1,
+  H2_FLAG_ACK = 0x1,
+  H2_FLAG_END_HEADERS = 0x4,
+  H2_FLAG_PADDED = 0x8,
+  H2_FLAG_PRIORITY = 0x20,
+};
+
+enum {
+  H2_NO_ERROR = 0x0,
+  H2_PROTOCOL_ERROR = 0x1,
+  H2_INTERNAL_ERROR = 0x2,
+  H2_FLOW_CONTROL_ERROR = 0x3,
+  H2_STREAM_CLOSED = 0x5,
+  H2_FRAME_SIZE_ERROR = 0x6,
+  H2_REFUSED_STREAM = 0x7,
+  H2_COMPRESSION_ERROR = 0x9,
+};
+
+enum {
+  H2_SETTINGS_HEADER_TABLE_SIZE = 0x1,
+  H2_SETTINGS_ENABLE_PUSH = 0x2,
+  H2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+  H2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+  H2_SETTINGS_MAX_FRAME_SIZE = 0x5,
+  H2_SETTINGS_MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+/* stream state flags */
+enum {
+  H2_S_END_IN = 1,      /* the client finished sending the request */
+  H2_S_HEADERS = 2,     /* the request headers were received */
+  H2_S_DISPATCHED = 4,  /* the request was forwarded to the `on_request` */
+  H2_S_HANDLED = 8,     /* the response was finished (`http_s` destroyed) */
+  H2_S_END_OUT = 16,    /* the last DATA frame should end the stream */
+  H2_S_RESET = 32,      /* the stream was reset (no more frames allowed) */
+  H2_S_PAUSED = 64,     /* the handler paused the request (`http_pause`) */
+  H2_S_MALFORMED = 128, /* the request headers were malformed or too long */
+  H2_S_BODY_PAUSED = 256, /* `on_body_chunk` asked to stop (back-pressure) */
+  H2_S_STREAMING = 512,   /* the response body is streamed (`http_stream`) */
+  H2_S_REGULAR = 1024,    /* a regular (not a pseudo) header was received */
+};
+
+/* *****************************************************************************
+The HTTP/2 Protocol Object
+***************************************************************************** */
+
+typedef struct http2pr_s http2pr_s;
+
+typedef struct {
+  http_s h;           /* the request / response handle (MUST be first) */
+  fio_ls_embd_s node; /* the connection's stream list */
+  http2pr_s *pr;      /* the connection */
+  FIOBJ out;          /* response data waiting for the flow control window */
+  size_t out_pos;     /* the amount of `out` data already sent */
+  int fd;             /* a file waiting to be sent (-1 if none) */
+  off_t fd_offset;    /* the next file offset to be sent */
+  size_t fd_left;     /* the amount of file data left to be sent */
+  int64_t window;     /* the stream's send window */
+  size_t header_size; /* the (decoded) request header size */
+  size_t body_size;   /* the amount of request body data received */
+  size_t streamed;    /* the amount of streamed response data (for the log) */
+  uint32_t withheld;  /* the stream's WINDOW_UPDATE delayed by back-pressure */
+  uint32_t id;        /* the stream identifier */
+  uint16_t flags;     /* the stream's state */
+} http2_stream_s;
+
+struct http2pr_s {
+  http_fio_protocol_s p;
+  hpack_context_s decoder; /* the HPACK decoding context (dynamic table) */
+  fio_ls_embd_s streams;   /* the connection's open streams */
+  size_t stream_count;     /* the number of open streams */
+  FIOBJ block;             /* a header block waiting for CONTINUATION frames */
+  int64_t window;          /* the connection's send window */
+  uint32_t initial_window; /* the peer's SETTINGS_INITIAL_WINDOW_SIZE */
+  uint32_t max_frame;      /* the peer's SETTINGS_MAX_FRAME_SIZE */
+  uint32_t last_id;        /* the last stream opened by the client */
+  uint32_t continuation;   /* the stream expecting CONTINUATION frames */
+  uint8_t block_flags;     /* the HEADERS frame flags of the pending block */
+  uint8_t preface;         /* set once the client's preface was consumed */
+  uint8_t goaway;          /* set once a GOAWAY frame was sent or received */
+  size_t buf_len;
+  uint8_t buf[(9 + HTTP2_FRAME_SIZE) * 2];
+};
+
+struct http_vtable_s HTTP2_VTABLE; /* initialized later on */
+
+#define handle2stream(h) ((http2_stream_s *)(h))
+
+/* *****************************************************************************
+Writing Frames
+***************************************************************************** */
+
+/* writes a frame header to the buffer (which must have 9 bytes or more) */
+static inline void http2_frame_header(uint8_t *dest, size_t len, uint8_t type,
+                                      uint8_t flags, uint32_t id) {
+  dest[0] = (len >> 16) & 0xFF;
+  dest[1] = (len >> 8) & 0xFF;
+  dest[2] = len & 0xFF;
+  dest[3] = type;
+  dest[4] = flags;
+  fio_u2str32(dest + 5, (id & 0x7FFFFFFF));
+}
+
+/* sends a whole frame, copying the payload */
+static void http2_frame_send(http2pr_s *p, uint8_t type, uint8_t flags,
+                             uint32_t id, const void *payload, size_t len) {
+  uint8_t *frame = fio_malloc(9 + len);
+  FIO_ASSERT_ALLOC(frame);
+  http2_frame_header(frame, len, type, flags, id);
+  if (len)
+    memcpy(frame + 9, payload, len);
+  fio_write2(p->p.uuid, .data.buffer = frame, .length = 9 + len,
+             .after.dealloc = fio_free);
+}
+
+/* sends a frame with a single 32 bit payload (RST_STREAM / WINDOW_UPDATE) */
+static inline void http2_frame_send_u32(http2pr_s *p, uint8_t type,
+                                        uint32_t id, uint32_t value) {
+  uint8_t payload[4];
+  fio_u2str32(payload, value);
+  http2_frame_send(p, type, 0, id, payload, 4);
+}
+
+/* informs the client that no more streams will be processed */
+static void http2_goaway(http2pr_s *p, uint32_t error) {
+  uint8_t payload[8];
+  fio_u2str32(payload, p->last_id);
+  fio_u2str32(payload + 4, error);
+  http2_frame_send(p, H2_GOAWAY, 0, 0, payload, 8);
+  p->goaway = 1;
+}
+
+/* a connection error: sends a GOAWAY frame and closes the connection */
+static int http2_connection_error(http2pr_s *p, uint32_t error) {
+  FIO_LOG_DEBUG("(HTTP/2) connection error %u for %p", (unsigned int)error,
+                (void *)p->p.uuid);
+  http2_goaway(p, error);
+  fio_close(p->p.uuid);
+  p->buf_len = 0;
+  return -1;
+}
+
+/* *****************************************************************************
+Streams
+***************************************************************************** */
+
+static http2_stream_s *http2_stream_find(http2pr_s *p, uint32_t id) {
+  FIO_LS_EMBD_FOR(&p->streams, pos) {
+    http2_stream_s *s = FIO_LS_EMBD_OBJ(http2_stream_s, node, pos);
+    if (s->id == id)
+      return s;
+  }
+  return NULL;
+}
+
+static http2_stream_s *http2_stream_new(http2pr_s *p, uint32_t id) {
+  http2_stream_s *s = fio_malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  *s = (http2_stream_s){
+      .pr = p,
+      .fd = -1,
+      .window = p->initial_window,
+      .id = id,
+  };
+  http_s_new(&s->h, &p->p, &HTTP2_VTABLE);
+  s->h.udata = p->p.settings->udata;
+  s->h.version = fiobj_str_new("HTTP/2", 6);
+#if FIO_HTTP_EXACT_LOGGING
+  clock_gettime(CLOCK_REALTIME, &s->h.received_at);
+#endif
+  fio_ls_embd_push(&p->streams, &s->node);
+  ++p->stream_count;
+  return s;
+}
+
+/* removes the stream from the connection and frees it */
+static void http2_stream_free(http2_stream_s *s) {
+  fio_ls_embd_remove(&s->node);
+  --s->pr->stream_count;
+  if (!(s->flags & H2_S_HANDLED))
+    http_s_destroy(&s->h, 0);
+  if (s->fd != -1)
+    close(s->fd);
+  fiobj_free(s->out);
+  fio_free(s);
+}
+
+/* tests if a reset stream can be freed (no handler holds the `http_s`) */
+static inline int http2_stream_is_idle(http2_stream_s *s) {
+  return (!(s->flags & H2_S_DISPATCHED) || (s->flags & H2_S_HANDLED)) &&
+         !(s->flags & H2_S_BODY_PAUSED);
+}
+
+/* resets a stream (stream error), the stream is freed unless it's handled */
+static void http2_stream_reset(http2_stream_s *s, uint32_t error) {
+  if (!(s->flags & H2_S_RESET))
+    http2_frame_send_u32(s->pr, H2_RST_STREAM, s->id, error);
+  s->flags |= H2_S_RESET | H2_S_END_IN;
+  if (http2_stream_is_idle(s))
+    http2_stream_free(s);
+}
+
+/* sends as much of the pending response data as the windows allow */
+static void http2_stream_flush(http2_stream_s *s) {
+  http2pr_s *p = s->pr;
+  fio_str_info_s out = {.data = NULL};
+  if (s->out) /* `fiobj_obj2cstr` would return "null" for FIOBJ_INVALID */
+    out = fiobj_obj2cstr(s->out);
+  while (!(s->flags & H2_S_RESET) &&
+         (s->out_pos < out.len || s->fd_left) && p->window > 0 &&
+         s->window > 0) {
+    size_t left = s->fd_left ? s->fd_left : (out.len - s->out_pos);
+    size_t chunk = left;
+    if ((int64_t)chunk > p->window)
+      chunk = (size_t)p->window;
+    if ((int64_t)chunk > s->window)
+      chunk = (size_t)s->window;
+    if (chunk > p->max_frame)
+      chunk = p->max_frame;
+    const uint8_t last = (s->flags & H2_S_END_OUT);
+    uint8_t *frame = fio_malloc(9 + chunk);
+    FIO_ASSERT_ALLOC(frame);
+    if (s->fd_left) {
+      ssize_t r = pread(s->fd, frame + 9, chunk, s->fd_offset);
+      if (r <= 0) {
+        fio_free(frame);
+        FIO_LOG_WARNING("(HTTP/2) couldn't read file for stream %u",
+                        (unsigned int)s->id);
+        http2_stream_reset(s, H2_INTERNAL_ERROR);
+        return;
+      }
+      chunk = (size_t)r;
+      s->fd_offset += r;
+      s->fd_left -= chunk;
+      if (!s->fd_left) {
+        close(s->fd);
+        s->fd = -1;
+      }
+    } else {
+      memcpy(frame + 9, out.data + s->out_pos, chunk);
+      s->out_pos += chunk;
+    }
+    http2_frame_header(frame, chunk, H2_DATA,
+                       ((last && chunk == left) ? H2_FLAG_END_STREAM : 0),
+                       s->id);
+    fio_write2(p->p.uuid, .data.buffer = frame, .length = 9 + chunk,
+               .after.dealloc = fio_free);
+    p->window -= chunk;
+    s->window -= chunk;
+  }
+  if (!(s->flags & H2_S_HANDLED) || (s->flags & H2_S_BODY_PAUSED))
+    return;
+  if ((s->flags & H2_S_RESET) || (s->out_pos >= out.len && !s->fd_left)) {
+    /* the response is complete, stop the client from sending more data */
+    if (!(s->flags & (H2_S_END_IN | H2_S_RESET)))
+      http2_frame_send_u32(p, H2_RST_STREAM, s->id, H2_NO_ERROR);
+    http2_stream_free(s);
+  }
+}
+
+/* sends pending data for all the streams (after a window update) */
+static void http2_flush_all(http2pr_s *p) {
+  fio_ls_embd_s *pos = p->streams.next;
+  while (pos != &p->streams) {
+    fio_ls_embd_s *next = pos->next; /* the stream might be freed */
+    http2_stream_flush(FIO_LS_EMBD_OBJ(http2_stream_s, node, pos));
+    pos = next;
+  }
+}
+
+/* *****************************************************************************
+HTTP Request / Response (Virtual) Functions
+***************************************************************************** */
+
+struct http2_header_writer_s {
+  FIOBJ dest;
+  FIOBJ name;
+};
+
+/* packs a single response header into the header block */
+static void http2_pack_header(FIOBJ dest, const char *name, size_t name_len,
+                              const char *value, size_t value_len) {
+  char buf[HPACK_BUFFER_SIZE];
+  int len =
+      hpack_header_pack(buf, sizeof(buf), name, name_len, value, value_len);
+  if (len < 0 || len > (int)sizeof(buf)) {
+    FIO_LOG_WARNING("(HTTP/2) response header too long (%.*s), skipped",
+                    (int)name_len, name);
+    return;
+  }
+  fiobj_str_write(dest, buf, len);
+}
+
+static int http2_write_header(FIOBJ o, void *w_) {
+  struct http2_header_writer_s *w = w_;
+  if (!o)
+    return 0;
+  if (fiobj_hash_key_in_loop()) {
+    w->name = fiobj_hash_key_in_loop();
+  }
+  if (FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY)) {
+    fiobj_each1(o, 0, http2_write_header, w);
+    return 0;
+  }
+  fio_str_info_s name = fiobj_obj2cstr(w->name);
+  char lower[256];
+  if (!name.len || name.len > sizeof(lower))
+    return 0;
+  for (size_t i = 0; i < name.len; ++i) {
+    lower[i] = (name.data[i] >= 'A' && name.data[i] <= 'Z')
+                   ? (name.data[i] | 32)
+                   : name.data[i];
+  }
+  /* connection specific headers aren't allowed in HTTP/2 (RFC 7540, 8.1.2.2) */
+  switch (name.len) {
+  case 7:
+    if (!memcmp(lower, "upgrade", 7))
+      return 0;
+    break;
+  case 10:
+    if (!memcmp(lower, "connection", 10) || !memcmp(lower, "keep-alive", 10))
+      return 0;
+    break;
+  case 16:
+    if (!memcmp(lower, "proxy-connection", 16))
+      return 0;
+    break;
+  case 17:
+    if (!memcmp(lower, "transfer-encoding", 17))
+      return 0;
+    break;
+  }
+  fio_str_info_s str = fiobj_obj2cstr(o);
+  if (!str.data)
+    return 0;
+  http2_pack_header(w->dest, lower, name.len, str.data, str.len);
+  return 0;
+}
+
+/* sends the response headers (HEADERS and CONTINUATION frames) */
+static void http2_send_headers(http2_stream_s *s, uint8_t end_stream) {
+  http2pr_s *p = s->pr;
+  http_s *h = &s->h;
+  struct http2_header_writer_s w = {
+      .dest = fiobj_str_buf(
+          32 + (fiobj_hash_count(h->private_data.out_headers) * 32)),
+  };
+  {
+    char status[24];
+    size_t len = fio_ltoa(status, (int64_t)h->status, 10);
+    http2_pack_header(w.dest, ":status", 7, status, len);
+  }
+  fiobj_each1(h->private_data.out_headers, 0, http2_write_header, &w);
+  fio_str_info_s block = fiobj_obj2cstr(w.dest);
+  size_t pos = 0;
+  uint8_t type = H2_HEADERS;
+  do {
+    size_t len = block.len - pos;
+    if (len > p->max_frame)
+      len = p->max_frame;
+    uint8_t flags = (type == H2_HEADERS && end_stream) ? H2_FLAG_END_STREAM : 0;
+    if (pos + len == block.len)
+      flags |= H2_FLAG_END_HEADERS;
+    http2_frame_send(p, type, flags, s->id, block.data + pos, len);
+    pos += len;
+    type = H2_CONTINUATION;
+  } while (pos < block.len);
+  fiobj_free(w.dest);
+}
+
+/* cleanup after a response was finished (the stream may live on) */
+static void http2_after_finish(http2_stream_s *s) {
+  http_metric_on_response(&s->h);
+  http_s_destroy(&s->h, s->pr->p.settings->log);
+  s->flags |= H2_S_HANDLED;
+  http2_stream_flush(s);
+}
+
+/** Should send existing headers and data */
+static int http2_send_body(http_s *h, void *data, uintptr_t length) {
+  http2_stream_s *s = handle2stream(h);
+  if (!(s->flags & H2_S_RESET)) {
+    http2_send_headers(s, length == 0);
+    if (length) {
+      s->out = fiobj_str_new(data, length);
+      s->flags |= H2_S_END_OUT;
+    }
+  }
+  http2_after_finish(s);
+  return 0;
+}
+
+/** Should send existing headers and file */
+static int http2_sendfile(http_s *h, int fd, uintptr_t length,
+                          uintptr_t offset) {
+  http2_stream_s *s = handle2stream(h);
+  if (s->flags & H2_S_RESET) {
+    close(fd);
+    http2_after_finish(s);
+    return -1;
+  }
+  http2_send_headers(s, length == 0);
+  if (length) {
+    s->fd = fd;
+    s->fd_offset = offset;
+    s->fd_left = length;
+    s->flags |= H2_S_END_OUT;
+  } else {
+    close(fd);
+  }
+  http2_after_finish(s);
+  return 0;
+}
+
+/** Should send existing headers and data and prepare for streaming */
+static int http2_stream(http_s *h, void *data, uintptr_t length) {
+  http2_stream_s *s = handle2stream(h);
+  if (s->flags & H2_S_RESET)
+    return -1;
+  if (!(s->flags & H2_S_STREAMING)) {
+    http2_send_headers(s, 0);
+    s->flags |= H2_S_STREAMING;
+  }
+  if (!length)
+    return 0;
+  if (!s->out) {
+    s->out = fiobj_str_buf(length);
+  } else if (s->out_pos == fiobj_obj2cstr(s->out).len) {
+    /* everything was sent, reuse the buffer */
+    fiobj_str_resize(s->out, 0);
+    s->out_pos = 0;
+  }
+  fiobj_str_write(s->out, data, length);
+  s->streamed += length;
+  http2_stream_flush(s);
+  return 0;
+}
+
+/** Should send existing headers or complete streaming */
+static void http2_finish(http_s *h) {
+  http2_stream_s *s = handle2stream(h);
+  if (s->flags & H2_S_STREAMING) {
+    if (s->flags & H2_S_RESET)
+      goto finish;
+    if (!s->out || s->out_pos == fiobj_obj2cstr(s->out).len)
+      http2_frame_send(s->pr, H2_DATA, H2_FLAG_END_STREAM, s->id, "", 0);
+    else
+      s->flags |= H2_S_END_OUT; /* the last DATA frame will end the stream */
+    if (s->pr->p.settings->log) /* the log reports the Content-Length header */
+      fiobj_hash_set(h->private_data.out_headers, HTTP_HEADER_CONTENT_LENGTH,
+                     fiobj_num_new(s->streamed));
+    goto finish;
+  }
+  if (!(s->flags & H2_S_RESET))
+    http2_send_headers(s, 1);
+finish:
+  http2_after_finish(s);
+}
+
+/** Push for data - unsupported. */
+static int http2_push_data(http_s *h, void *data, uintptr_t length,
+                           FIOBJ mime_type) {
+  return -1;
+  (void)h;
+  (void)data;
+  (void)length;
+  (void)mime_type;
+}
+
+/** Push for files - unsupported. */
+static int http2_push_file(http_s *h, FIOBJ filename, FIOBJ mime_type) {
+  return -1;
+  (void)h;
+  (void)filename;
+  (void)mime_type;
+}
+
+/** Pauses the request / response handling (other streams keep running). */
+static void http2_on_pause(http_s *h, http_fio_protocol_s *pr) {
+  handle2stream(h)->flags |= H2_S_PAUSED;
+  (void)pr;
+}
+
+/** Resumes a request / response handling. */
+static void http2_on_resume(http_s *h, http_fio_protocol_s *pr) {
+  handle2stream(h)->flags &= ~H2_S_PAUSED;
+  (void)pr;
+}
+
+/** Resumes reading a streamed request body (sends the withheld window). */
+static void http2_on_body_resume(http_s *h, http_fio_protocol_s *pr) {
+  http2pr_s *p = (http2pr_s *)pr;
+  FIO_LS_EMBD_FOR(&p->streams, pos) {
+    http2_stream_s *s = FIO_LS_EMBD_OBJ(http2_stream_s, node, pos);
+    if (&s->h != h)
+      continue;
+    if (!(s->flags & H2_S_BODY_PAUSED))
+      return;
+    s->flags &= ~H2_S_BODY_PAUSED;
+    if (s->withheld && !(s->flags & (H2_S_END_IN | H2_S_RESET)))
+      http2_frame_send_u32(p, H2_WINDOW_UPDATE, s->id, s->withheld);
+    s->withheld = 0;
+    if ((s->flags & H2_S_RESET) && http2_stream_is_idle(s))
+      http2_stream_free(s);
+    else
+      http2_stream_flush(s);
+    return;
+  }
+}
+
+/** Hijacking isn't possible, the connection is shared by multiple streams. */
+static intptr_t http2_hijack(http_s *h, fio_str_info_s *leftover) {
+  FIO_LOG_WARNING("(HTTP/2) connections can't be hijacked.");
+  if (leftover)
+    *leftover = (fio_str_info_s){.data = NULL};
+  return -1;
+  (void)h;
+}
+
+/** Websockets over HTTP/2 (RFC 8441) are unsupported. */
+static int http2_http2websocket(http_s *h, websocket_settings_s *args) {
+  http_send_error(h, 400);
+  if (args->on_close)
+    args->on_close(0, args->udata);
+  return -1;
+}
+
+/** EventSource (SSE) over HTTP/2 is unsupported. */
+static int http2_upgrade2sse(http_s *h, http_sse_s *sse) {
+  http_send_error(h, 400);
+  if (sse->on_close)
+    sse->on_close(sse);
+  return -1;
+}
+
+static int http2_sse_write(http_sse_s *sse, FIOBJ str) {
+  fiobj_free(str);
+  return -1;
+  (void)sse;
+}
+
+static int http2_sse_close(http_sse_s *sse) {
+  return -1;
+  (void)sse;
+}
+
+/* *****************************************************************************
+Virtual Table Decleration
+***************************************************************************** */
+
+struct http_vtable_s HTTP2_VTABLE = {
+    .http_send_body = http2_send_body,
+    .http_sendfile = http2_sendfile,
+    .http_stream = http2_stream,
+    .http_finish = http2_finish,
+    .http_push_data = http2_push_data,
+    .http_push_file = http2_push_file,
+    .http_on_pause = http2_on_pause,
+    .http_on_resume = http2_on_resume,
+    .http_on_body_resume = http2_on_body_resume,
+    .http_hijack = http2_hijack,
+    .http2websocket = http2_http2websocket,
+    .http_upgrade2sse = http2_upgrade2sse,
+    .http_sse_write = http2_sse_write,
+    .http_sse_close = http2_sse_close,
+};
+
+void *http2_vtable(void) { return (void *)&HTTP2_VTABLE; }
+
+/* *****************************************************************************
+Request Handling
+***************************************************************************** */
+
+/* forwards a complete request to the `on_request` callback */
+static void http2_dispatch(http2_stream_s *s) {
+  http2pr_s *p = s->pr;
+  s->flags |= H2_S_DISPATCHED;
+  if (s->flags & H2_S_MALFORMED) {
+    http_send_error(&s->h, 431);
+    return;
+  }
+  http_on_request_handler______internal(&s->h, p->p.settings);
+  if (!(s->flags & (H2_S_HANDLED | H2_S_PAUSED)))
+    http_finish(&s->h);
+}
+
+/* called by the HPACK decoder for every request header */
+static int http2_on_header(void *udata, char *name, size_t name_len,
+                           char *value, size_t value_len) {
+  http2_stream_s *s = udata;
+  http_s *h = &s->h;
+  s->header_size += name_len + value_len;
+  if (s->header_size >= s->pr->p.settings->max_header_size ||
+      fiobj_hash_count(h->headers) > HTTP_MAX_HEADER_COUNT) {
+    if (s->pr->p.settings->log)
+      FIO_LOG_WARNING("(HTTP/2) security alert - header flood detected.");
+    s->flags |= H2_S_MALFORMED;
+    return -1;
+  }
+  if (!name_len)
+    goto malformed;
+  if (name[0] == ':') {
+    /* pseudo headers are only allowed before regular headers */
+    if (s->flags & (H2_S_HEADERS | H2_S_REGULAR))
+      goto malformed;
+    if (name_len == 7 && !memcmp(name, ":method", 7)) {
+      if (h->method)
+        goto malformed;
+      h->method = fiobj_str_new(value, value_len);
+    } else if (name_len == 5 && !memcmp(name, ":path", 5)) {
+      if (h->path || !value_len)
+        goto malformed;
+      char *query = memchr(value, '?', value_len);
+      if (query) {
+        h->query = fiobj_str_new(query + 1, (value + value_len) - (query + 1));
+        value_len = query - value;
+      }
+      h->path = fiobj_str_new(value, value_len);
+    } else if (name_len == 10 && !memcmp(name, ":authority", 10)) {
+      /* the host header isn't required, but might still be sent */
+      set_header_add(h->headers, HTTP_HEADER_HOST,
+                     fiobj_str_new(value, value_len));
+    } else if (!(name_len == 7 && !memcmp(name, ":scheme", 7))) {
+      goto malformed;
+    }
+    return 0;
+  }
+  for (size_t i = 0; i < name_len; ++i) {
+    if (name[i] >= 'A' && name[i] <= 'Z')
+      goto malformed; /* header names MUST be lower case in HTTP/2 */
+  }
+  if (name_len == 10 && !memcmp(name, "connection", 10))
+    goto malformed;
+  s->flags |= H2_S_REGULAR;
+  FIOBJ sym = fiobj_str_new(name, name_len);
+  set_header_add(h->headers, sym, fiobj_str_new(value, value_len));
+  fiobj_free(sym);
+  return 0;
+malformed:
+  s->flags |= H2_S_MALFORMED;
+  return -1;
+}
+
+/* handles a complete header block (HEADERS + any CONTINUATION frames) */
+static int http2_on_header_block(http2pr_s *p, uint32_t id, uint8_t flags,
+                                 uint8_t *data, size_t len) {
+  http2_stream_s *s = http2_stream_find(p, id);
+  if (!s && id > p->last_id) {
+    p->last_id = id;
+    if (p->goaway || p->stream_count >= HTTP2_MAX_STREAMS) {
+      /* keep the HPACK table in sync, but refuse the stream */
+      if (hpack_decode(&p->decoder, data, len, NULL, NULL))
+        return http2_connection_error(p, H2_COMPRESSION_ERROR);
+      http2_frame_send_u32(p, H2_RST_STREAM, id, H2_REFUSED_STREAM);
+      return 0;
+    }
+    s = http2_stream_new(p, id);
+  }
+  if (!s || (s->flags & H2_S_END_IN)) {
+    /* a closed stream (or an unexpected header block), keep HPACK in sync */
+    if (hpack_decode(&p->decoder, data, len, NULL, NULL))
+      return http2_connection_error(p, H2_COMPRESSION_ERROR);
+    if (s)
+      http2_stream_reset(s, H2_STREAM_CLOSED);
+    return 0;
+  }
+  if ((s->flags & H2_S_HEADERS) && !(flags & H2_FLAG_END_STREAM)) {
+    /* trailers MUST end the stream */
+    if (hpack_decode(&p->decoder, data, len, NULL, NULL))
+      return http2_connection_error(p, H2_COMPRESSION_ERROR);
+    http2_stream_reset(s, H2_PROTOCOL_ERROR);
+    return 0;
+  }
+  if (hpack_decode(&p->decoder, data, len, http2_on_header, s))
+    return http2_connection_error(p, H2_COMPRESSION_ERROR);
+  if (!(s->flags & H2_S_HEADERS)) {
+    s->flags |= H2_S_HEADERS;
+    if (!(s->flags & H2_S_MALFORMED) && (!s->h.method || !s->h.path)) {
+      http2_stream_reset(s, H2_PROTOCOL_ERROR);
+      return 0;
+    }
+    if ((s->flags & H2_S_MALFORMED) && s->header_size <
+                                           p->p.settings->max_header_size) {
+      /* malformed (rather than too long) */
+      http2_stream_reset(s, H2_PROTOCOL_ERROR);
+      return 0;
+    }
+  }
+  if (s->flags & H2_S_MALFORMED) {
+    /* headers too long, respond with an error without waiting for the body */
+    http2_dispatch(s);
+    return 0;
+  }
+  if (flags & H2_FLAG_END_STREAM) {
+    s->flags |= H2_S_END_IN;
+    http2_dispatch(s);
+  }
+  return 0;
+}
+
+/* handles a DATA frame (the request body) */
+static int http2_on_data_frame(http2pr_s *p, http2_stream_s *s, uint32_t id,
+                               uint8_t flags, uint8_t *data, size_t len,
+                               size_t frame_len) {
+  if (!id)
+    return http2_connection_error(p, H2_PROTOCOL_ERROR);
+  if (id > p->last_id)
+    return http2_connection_error(p, H2_PROTOCOL_ERROR); /* idle stream */
+  /* replenish the connection's flow control window right away */
+  if (frame_len)
+    http2_frame_send_u32(p, H2_WINDOW_UPDATE, 0, (uint32_t)frame_len);
+  if (!s || (s->flags & (H2_S_HANDLED | H2_S_RESET)))
+    return 0; /* the request is no longer processed */
+  if ((s->flags & H2_S_END_IN) || !(s->flags & H2_S_HEADERS)) {
+    http2_stream_reset(s, H2_STREAM_CLOSED);
+    return 0;
+  }
+  http_s *h = &s->h;
+  if (len) {
+    s->body_size += len;
+    if (s->body_size > p->p.settings->max_body_size) {
+      s->flags |= H2_S_DISPATCHED;
+      http_send_error(h, 413);
+      return 0;
+    }
+  }
+  if (len && p->p.settings->on_body_chunk) {
+    /* stream the body, back-pressure withholds the stream's window updates */
+    if (p->p.settings->on_body_chunk(
+            h, (fio_str_info_s){.data = (char *)data, .len = len}))
+      s->flags |= H2_S_BODY_PAUSED;
+  } else if (len) {
+    if (!h->body) {
+      static uint64_t content_length_hash = 0;
+      if (!content_length_hash)
+        content_length_hash = fiobj_hash_string("content-length", 14);
+      intptr_t expected =
+          fiobj_obj2num(fiobj_hash_get2(h->headers, content_length_hash));
+      if (expected > 0 && expected <= HTTP_MAX_HEADER_LENGTH)
+        h->body = fiobj_data_newstr();
+      else
+        h->body = fiobj_data_newtmpfile();
+    }
+    fiobj_data_write(h->body, data, len);
+  }
+  if (frame_len && !(flags & H2_FLAG_END_STREAM)) {
+    if (s->flags & H2_S_BODY_PAUSED)
+      s->withheld += frame_len;
+    else
+      http2_frame_send_u32(p, H2_WINDOW_UPDATE, id, (uint32_t)frame_len);
+  }
+  if (flags & H2_FLAG_END_STREAM) {
+    s->flags |= H2_S_END_IN;
+    s->flags &= ~H2_S_BODY_PAUSED;
+    if (h->body)
+      fiobj_data_seek(h->body, 0);
+    http2_dispatch(s);
+  }
+  return 0;
+}
+
+/* handles a SETTINGS frame */
+static int http2_on_settings(http2pr_s *p, uint32_t id, uint8_t flags,
+                             uint8_t *data, size_t len) {
+  if (id)
+    return http2_connection_error(p, H2_PROTOCOL_ERROR);
+  if (flags & H2_FLAG_ACK) {
+    if (len)
+      return http2_connection_error(p, H2_FRAME_SIZE_ERROR);
+    return 0;
+  }
+  if (len % 6)
+    return http2_connection_error(p, H2_FRAME_SIZE_ERROR);
+  for (size_t i = 0; i < len; i += 6) {
+    uint16_t key = fio_str2u16(data + i);
+    uint32_t value = fio_str2u32(data + i + 2);
+    switch (key) {
+    case H2_SETTINGS_ENABLE_PUSH:
+      if (value > 1)
+        return http2_connection_error(p, H2_PROTOCOL_ERROR);
+      break;
+    case H2_SETTINGS_INITIAL_WINDOW_SIZE: {
+      if (value > HTTP2_MAX_WINDOW)
+        return http2_connection_error(p, H2_FLOW_CONTROL_ERROR);
+      /* adjust existing streams by the difference (RFC 7540, 6.9.2) */
+      int64_t delta = (int64_t)value - (int64_t)p->initial_window;
+      p->initial_window = value;
+      FIO_LS_EMBD_FOR(&p->streams, pos) {
+        http2_stream_s *s = FIO_LS_EMBD_OBJ(http2_stream_s, node, pos);
+        if (s->window + delta > HTTP2_MAX_WINDOW)
+          return http2_connection_error(p, H2_FLOW_CONTROL_ERROR);
+        s->window += delta;
+      }
+      break;
+    }
+    case H2_SETTINGS_MAX_FRAME_SIZE:
+      if (value < 16384 || value > 16777215)
+        return http2_connection_error(p, H2_PROTOCOL_ERROR);
+      p->max_frame = value;
+      break;
+    default:
+      /* the encoder doesn't use the peer's dynamic table, ignore the rest */
+      break;
+    }
+  }
+  http2_frame_send(p, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+  http2_flush_all(p);
+  return 0;
+}
+
+/* handles a single (complete) frame */
+static int http2_on_frame(http2pr_s *p, uint8_t type, uint8_t flags,
+                          uint32_t id, uint8_t *data, size_t len) {
+  const size_t frame_len = len;
+  if (p->continuation && (type != H2_CONTINUATION || id != p->continuation))
+    return http2_connection_error(p, H2_PROTOCOL_ERROR);
+  /* remove padding */
+  if ((type == H2_DATA || type == H2_HEADERS) && (flags & H2_FLAG_PADDED)) {
+    if (!len || data[0] >= len)
+      return http2_connection_error(p, H2_PROTOCOL_ERROR);
+    len -= 1 + data[0];
+    ++data;
+  }
+  switch (type) {
+  case H2_DATA:
+    return http2_on_data_frame(p, http2_stream_find(p, id), id, flags, data,
+                               len, frame_len);
+
+  case H2_HEADERS:
+    if (!id || !(id & 1))
+      return http2_connection_error(p, H2_PROTOCOL_ERROR);
+    if (flags & H2_FLAG_PRIORITY) {
+      if (len < 5)
+        return http2_connection_error(p, H2_FRAME_SIZE_ERROR);
+      data += 5;
+      len -= 5;
+    }
+    if (flags & H2_FLAG_END_HEADERS)
+      return http2_on_header_block(p, id, flags, data, len);
+    /* wait for CONTINUATION frames */
+    fiobj_free(p->block);
+    p->block = fiobj_str_buf(len << 1);
+    fiobj_str_write(p->block, (char *)data, len);
+    p->block_flags = flags;
+    p->continuation = id;
+    return 0;
+
+  case H2_CONTINUATION:
+    if (!p->continuation)
+      return http2_connection_error(p, H2_PROTOCOL_ERROR);
+    if (fiobj_obj2cstr(p->block).len + len > HPACK_BUFFER_SIZE * 4)
+      return http2_connection_error(p, H2_COMPRESSION_ERROR);
+    fiobj_str_write(p->block, (char *)data, len);
+    if (flags & H2_FLAG_END_HEADERS) {
+      FIOBJ block = p->block;
+      p->block = FIOBJ_INVALID;
+      p->continuation = 0;
+      fio_str_info_s b = fiobj_obj2cstr(block);
+      int ret = http2_on_header_block(p, id, p->block_flags, (uint8_t *)b.data,
+                                      b.len);
+      fiobj_free(block);
+      return ret;
+    }
+    return 0;
+
+  case H2_PRIORITY:
+    if (!id)
+      return http2_connection_error(p, H2_PROTOCOL_ERROR);
+    if (len != 5)
+      return http2_connection_error(p, H2_FRAME_SIZE_ERROR);
+    return 0; /* priorities are ignored */
+
+  case H2_RST_STREAM: {
+    if (!id || id > p->last_id)
+      return http2_connection_error(p, H2_PROTOCOL_ERROR);
+    if (len != 4)
+      return http2_connection_error(p, H2_FRAME_SIZE_ERROR);
+    http2_stream_s *s = http2_stream_find(p, id);
+    if (s) {
+      s->flags |= H2_S_RESET | H2_S_END_IN;
+      if (http2_stream_is_idle(s))
+        http2_stream_free(s);
+    }
+    return 0;
+  }
+
+  case H2_SETTINGS:
+    return http2_on_settings(p, id, flags, data, len);
+
+  case H2_PUSH_PROMISE:
+    return http2_connection_error(p, H2_PROTOCOL_ERROR);
+
+  case H2_PING:
+    if (id)
+      return http2_connection_error(p, H2_PROTOCOL_ERROR);
+    if (len != 8)
+      return http2_connection_error(p, H2_FRAME_SIZE_ERROR);
+    if (!(flags & H2_FLAG_ACK))
+      http2_frame_send(p, H2_PING, H2_FLAG_ACK, 0, data, 8);
+    return 0;
+
+  case H2_GOAWAY:
+    if (id)
+      return http2_connection_error(p, H2_PROTOCOL_ERROR);
+    if (len < 8)
+      return http2_connection_error(p, H2_FRAME_SIZE_ERROR);
+    p->goaway = 1; /* no new streams, existing streams may complete */
+    return 0;
+
+  case H2_WINDOW_UPDATE: {
+    if (len != 4)
+      return http2_connection_error(p, H2_FRAME_SIZE_ERROR);
+    uint32_t increment = fio_str2u32(data) & 0x7FFFFFFF;
+    if (!id) {
+      if (!increment)
+        return http2_connection_error(p, H2_PROTOCOL_ERROR);
+      p->window += increment;
+      if (p->window > HTTP2_MAX_WINDOW)
+        return http2_connection_error(p, H2_FLOW_CONTROL_ERROR);
+      http2_flush_all(p);
+      return 0;
+    }
+    http2_stream_s *s = http2_stream_find(p, id);
+    if (!s)
+      return 0;
+    if (!increment) {
+      http2_stream_reset(s, H2_PROTOCOL_ERROR);
+      return 0;
+    }
+    s->window += increment;
+    if (s->window > HTTP2_MAX_WINDOW) {
+      http2_stream_reset(s, H2_FLOW_CONTROL_ERROR);
+      return 0;
+    }
+    http2_stream_flush(s);
+    return 0;
+  }
+  }
+  return 0; /* unknown frame types are ignored */
+}
+
+/* consumes all the complete frames in the buffer */
+static int http2_consume_data(http2pr_s *p) {
+  size_t pos = 0;
+  if (!p->preface) {
+    size_t cmp =
+        p->buf_len < HTTP2_PREFACE_LEN ? p->buf_len : HTTP2_PREFACE_LEN;
+    if (memcmp(p->buf, HTTP2_PREFACE, cmp))
+      return http2_connection_error(p, H2_PROTOCOL_ERROR);
+    if (p->buf_len < HTTP2_PREFACE_LEN)
+      return 0;
+    pos = HTTP2_PREFACE_LEN;
+    p->preface = 1;
+  }
+  while (p->buf_len - pos >= 9) {
+    uint8_t *frame = p->buf + pos;
+    size_t len = ((size_t)frame[0] << 16) | ((size_t)frame[1] << 8) | frame[2];
+    if (len > HTTP2_FRAME_SIZE)
+      return http2_connection_error(p, H2_FRAME_SIZE_ERROR);
+    if (p->buf_len - pos < 9 + len)
+      break;
+    if (http2_on_frame(p, frame[3], frame[4], fio_str2u32(frame + 5) & 0x7FFFFFFF,
+                       frame + 9, len))
+      return -1;
+    pos += 9 + len;
+  }
+  if (pos) {
+    p->buf_len -= pos;
+    if (p->buf_len)
+      memmove(p->buf, p->buf + pos, p->buf_len);
+  }
+  return 0;
+}
+
+/* *****************************************************************************
+Connection Callbacks
+***************************************************************************** */
+
+/** called when a data is available */
+static void http2_on_data(intptr_t uuid, fio_protocol_s *protocol) {
+  http2pr_s *p = (http2pr_s *)protocol;
+  ssize_t i;
+  /* handle data copied from the HTTP/1.1 connection (prior knowledge) */
+  if (p->buf_len && http2_consume_data(p))
+    return;
+  while ((i = fio_read(uuid, p->buf + p->buf_len,
+                       sizeof(p->buf) - p->buf_len)) > 0) {
+    p->buf_len += i;
+    if (http2_consume_data(p))
+      return;
+  }
+}
+
+/** called when the connection was closed, but will not run concurrently */
+static void http2_on_close(intptr_t uuid, fio_protocol_s *protocol) {
+  http2_destroy(protocol);
+  (void)uuid;
+}
+
+/** called when the server is shutting down */
+static uint8_t http2_on_shutdown(intptr_t uuid, fio_protocol_s *protocol) {
+  http2pr_s *p = (http2pr_s *)protocol;
+  if (!p->goaway)
+    http2_goaway(p, H2_NO_ERROR);
+  return 0;
+  (void)uuid;
+}
+
+/* *****************************************************************************
+Public API
+***************************************************************************** */
+
+/** Creates an HTTP/2 protocol object and handles any unread data. */
+fio_protocol_s *http2_new(uintptr_t uuid, http_settings_s *settings,
+                          void *unread_data, size_t unread_length) {
+  if (unread_data && unread_length > sizeof(((http2pr_s *)0)->buf))
+    return NULL;
+  http2pr_s *p = fio_malloc(sizeof(*p));
+  FIO_ASSERT_ALLOC(p);
+  *p = (http2pr_s){
+      .p.protocol =
+          {
+              .on_data = http2_on_data,
+              .on_close = http2_on_close,
+              .on_shutdown = http2_on_shutdown,
+          },
+      .p.uuid = uuid,
+      .p.settings = settings,
+      .streams = FIO_LS_INIT(p->streams),
+      .window = HTTP2_DEFAULT_WINDOW,
+      .initial_window = HTTP2_DEFAULT_WINDOW,
+      .max_frame = HTTP2_FRAME_SIZE,
+  };
+  hpack_context_init(&p->decoder, 4096);
+  http_metric_add(HTTP_METRIC_HTTP2, 1);
+  if (unread_data && unread_length) {
+    memcpy(p->buf, unread_data, unread_length);
+    p->buf_len = unread_length;
+  }
+  fio_attach(uuid, &p->p.protocol);
+  {
+    /* the server's connection preface (a SETTINGS frame) */
+    uint8_t settings_payload[18];
+    fio_u2str16(settings_payload, H2_SETTINGS_MAX_CONCURRENT_STREAMS);
+    fio_u2str32(settings_payload + 2, HTTP2_MAX_STREAMS);
+    fio_u2str16(settings_payload + 6, H2_SETTINGS_ENABLE_PUSH);
+    fio_u2str32(settings_payload + 8, 0);
+    fio_u2str16(settings_payload + 12, H2_SETTINGS_MAX_HEADER_LIST_SIZE);
+    fio_u2str32(settings_payload + 14, settings->max_header_size);
+    http2_frame_send(p, H2_SETTINGS, 0, 0, settings_payload, 18);
+  }
+  if (p->buf_len)
+    fio_force_event(uuid, FIO_EVENT_ON_DATA);
+  return &p->p.protocol;
+}
+
+/** Manually destroys the HTTP/2 protocol object. */
+void http2_destroy(fio_protocol_s *pr) {
+  http2pr_s *p = (http2pr_s *)pr;
+  while (!fio_ls_embd_is_empty(&p->streams)) {
+    http2_stream_free(
+        FIO_LS_EMBD_OBJ(http2_stream_s, node, p->streams.next));
+  }
+  fiobj_free(p->block);
+  hpack_context_destroy(&p->decoder);
+  fio_free(p);
+  http_metric_add(HTTP_METRIC_HTTP2, -1);
+}
+
+#if DEBUG
+/* decodes a header list (name / value pairs), returning -1 if malformed */
+static int http2_header_order_test_run(http2pr_s *p, const char **headers) {
+  http2_stream_s *s = http2_stream_new(p, 1);
+  int ret = 0;
+  for (size_t i = 0; headers[i] && !ret; i += 2) {
+    ret = http2_on_header(s, (char *)headers[i], strlen(headers[i]),
+                          (char *)headers[i + 1], strlen(headers[i + 1]));
+  }
+  FIO_ASSERT(!ret == !(s->flags & H2_S_MALFORMED),
+             "HTTP/2 malformed flag should match the header callback result");
+  if (!ret) {
+    FIOBJ host = fiobj_hash_get(s->h.headers, HTTP_HEADER_HOST);
+    FIO_ASSERT(s->h.method && s->h.path && host &&
+                   !strcmp(fiobj_obj2cstr(host).data, "example.com"),
+               "HTTP/2 pseudo headers weren't stored");
+  }
+  http2_stream_free(s);
+  return ret;
+}
+
+void http2_header_order_test(void) {
+  fprintf(stderr, "* Testing HTTP/2 request header ordering.\n");
+  http_settings_s settings = {.max_header_size = 32 * 1024};
+  http2pr_s *p = fio_malloc(sizeof(*p));
+  FIO_ASSERT_ALLOC(p);
+  *p = (http2pr_s){
+      .p.settings = &settings,
+      .streams = FIO_LS_INIT(p->streams),
+      .initial_window = HTTP2_DEFAULT_WINDOW,
+  };
+  const char *valid[][12] = {
+      {":method", "GET", ":authority", "example.com", ":path", "/", ":scheme",
+       "https", "accept", "*/*", NULL},
+      {":authority", "example.com", ":scheme", "https", ":method", "GET",
+       ":path", "/?a=1", NULL},
+  };
+  const char *malformed[][12] = {
+      /* pseudo headers after a regular header */
+      {":method", "GET", "accept", "*/*", ":path", "/", NULL},
+      {":authority", "example.com", "accept", "*/*", ":method", "GET", NULL},
+      /* duplicate, unknown or invalid pseudo headers */
+      {":method", "GET", ":method", "GET", NULL},
+      {":method", "GET", ":path", "", NULL},
+      {":method", "GET", ":status", "200", NULL},
+      /* upper case and connection specific headers */
+      {":method", "GET", ":path", "/", "Accept", "*/*", NULL},
+      {":method", "GET", ":path", "/", "connection", "close", NULL},
+  };
+  for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); ++i)
+    FIO_ASSERT(!http2_header_order_test_run(p, valid[i]),
+               "HTTP/2 valid header list %zu rejected", i);
+  for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i)
+    FIO_ASSERT(http2_header_order_test_run(p, malformed[i]),
+               "HTTP/2 malformed header list %zu accepted", i);
+  /* trailers can't contain pseudo headers */
+  http2_stream_s *s = http2_stream_new(p, 1);
+  s->flags |= H2_S_HEADERS;
+  FIO_ASSERT(http2_on_header(s, (char *)":path", 5, (char *)"/", 1) &&
+                 !http2_on_header(s, (char *)"x-trailer", 9, (char *)"1", 1),
+             "HTTP/2 trailers should only accept regular headers");
+  http2_stream_free(s);
+  FIO_ASSERT(!p->stream_count, "HTTP/2 test streams weren't freed");
+  fio_free(p);
+}
+#endif
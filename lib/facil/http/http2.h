@@ -0,0 +1,33 @@
+/*
+Copyright: Boaz Segev, 2017-2019
+License: MIT
+*/
+#ifndef H_HTTP2_H
+#define H_HTTP2_H
+
+#include <http.h>
+
+#ifndef HTTP2_MAX_STREAMS
+/**
+ * The maximum number of concurrent streams a client may open on a single
+ * HTTP/2 connection (advertised using SETTINGS_MAX_CONCURRENT_STREAMS).
+ */
+#define HTTP2_MAX_STREAMS 100
+#endif
+
+/**
+ * Creates an HTTP/2 (server) protocol object and handles any unread data in
+ * the buffer (if any).
+ *
+ * The unread data, if any, should start with the client's connection preface.
+ */
+fio_protocol_s *http2_new(uintptr_t uuid, http_settings_s *settings,
+                          void *unread_data, size_t unread_length);
+
+/** Manually destroys the HTTP/2 protocol object. */
+void http2_destroy(fio_protocol_s *);
+
+/** returns the HTTP/2 protocol's VTable. */
+void *http2_vtable(void);
+
+#endif
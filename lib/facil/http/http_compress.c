@@ -0,0 +1,367 @@
+/*
+Copyright: Boaz Segev, 2017-2019
+License: MIT
+*/
+#include <fio.h>
+
+#include <http_compress.h>
+
+#include <string.h>
+#include <strings.h>
+
+/* *****************************************************************************
+gzip (zlib)
+***************************************************************************** */
+#if HAVE_ZLIB
+#include <zlib.h>
+
+static void *http_gzip_new(void) {
+  z_stream *z = fio_malloc(sizeof(*z));
+  if (!z)
+    return NULL;
+  *z = (z_stream){.zalloc = Z_NULL};
+  /* 15 + 16 window bits select the gzip wrapper */
+  if (deflateInit2(z, HTTP_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    fio_free(z);
+    return NULL;
+  }
+  return z;
+}
+
+static int http_gzip_write(void *stream, FIOBJ dest, const void *data,
+                           size_t len, int flush) {
+  z_stream *z = stream;
+  const int mode =
+      (flush == HTTP_COMPRESS_FINISH)
+          ? Z_FINISH
+          : (flush == HTTP_COMPRESS_SYNC_FLUSH ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+  z->next_in = (Bytef *)data;
+  z->avail_in = len;
+  int r;
+  do {
+    size_t pos = fiobj_obj2cstr(dest).len;
+    size_t capa = fiobj_str_capa_assert(dest, pos + (len >> 1) + 64);
+    z->next_out = (Bytef *)fiobj_obj2cstr(dest).data + pos;
+    z->avail_out = capa - pos;
+    r = deflate(z, mode);
+    fiobj_str_resize(dest, capa - z->avail_out);
+    if (r == Z_STREAM_ERROR)
+      return -1;
+  } while (!z->avail_out || (mode == Z_FINISH && r != Z_STREAM_END));
+  return 0;
+}
+
+static void http_gzip_free(void *stream) {
+  deflateEnd(stream);
+  fio_free(stream);
+}
+#endif
+
+/* *****************************************************************************
+Brotli
+***************************************************************************** */
+#if HAVE_BROTLI
+#include <brotli/encode.h>
+
+static void *http_brotli_new(void) {
+  BrotliEncoderState *s = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+  if (!s)
+    return NULL;
+  BrotliEncoderSetParameter(s, BROTLI_PARAM_QUALITY, HTTP_BROTLI_QUALITY);
+  return s;
+}
+
+static int http_brotli_write(void *stream, FIOBJ dest, const void *data,
+                             size_t len, int flush) {
+  BrotliEncoderState *s = stream;
+  const BrotliEncoderOperation op =
+      (flush == HTTP_COMPRESS_FINISH)
+          ? BROTLI_OPERATION_FINISH
+          : (flush == HTTP_COMPRESS_SYNC_FLUSH ? BROTLI_OPERATION_FLUSH
+                                               : BROTLI_OPERATION_PROCESS);
+  const uint8_t *next_in = data;
+  size_t avail_in = len;
+  do {
+    size_t pos = fiobj_obj2cstr(dest).len;
+    size_t capa = fiobj_str_capa_assert(dest, pos + (len >> 1) + 64);
+    uint8_t *next_out = (uint8_t *)fiobj_obj2cstr(dest).data + pos;
+    size_t avail_out = capa - pos;
+    if (!BrotliEncoderCompressStream(s, op, &avail_in, &next_in, &avail_out,
+                                     &next_out, NULL))
+      return -1;
+    fiobj_str_resize(dest, capa - avail_out);
+  } while (avail_in || BrotliEncoderHasMoreOutput(s) ||
+           (op == BROTLI_OPERATION_FINISH && !BrotliEncoderIsFinished(s)));
+  return 0;
+}
+
+static void http_brotli_free(void *stream) {
+  BrotliEncoderDestroyInstance(stream);
+}
+#endif
+
+/* *****************************************************************************
+The encoder table (ordered by preference)
+***************************************************************************** */
+
+static const http_encoder_s HTTP_ENCODERS[] = {
+#if HAVE_BROTLI
+    {
+        .name = {.data = (char *)"br", .len = 2},
+        .stream_new = http_brotli_new,
+        .write = http_brotli_write,
+        .stream_free = http_brotli_free,
+    },
+#endif
+#if HAVE_ZLIB
+    {
+        .name = {.data = (char *)"gzip", .len = 4},
+        .stream_new = http_gzip_new,
+        .write = http_gzip_write,
+        .stream_free = http_gzip_free,
+    },
+#endif
+    {.name = {.len = 0}},
+};
+
+#define HTTP_ENCODERS_COUNT                                                    \
+  ((sizeof(HTTP_ENCODERS) / sizeof(HTTP_ENCODERS[0])) - 1)
+
+/* *****************************************************************************
+Negotiation
+***************************************************************************** */
+
+/* returns the q value of an Accept-Encoding token's parameters (0-1000) */
+static size_t http_encoder_qvalue(const char *pos, const char *end) {
+  while (pos < end && (*pos == ';' || *pos == ' ' || *pos == '\t'))
+    ++pos;
+  if (end - pos < 3 || (pos[0] | 32) != 'q' || pos[1] != '=')
+    return 1000;
+  pos += 2;
+  if (*pos == '1')
+    return 1000;
+  size_t q = 0;
+  size_t digits = 0;
+  if (*pos == '0' && pos + 1 < end && pos[1] == '.') {
+    pos += 2;
+    while (pos < end && digits < 3 && *pos >= '0' && *pos <= '9') {
+      q = (q * 10) + (*pos - '0');
+      ++digits;
+      ++pos;
+    }
+  }
+  while (digits < 3) {
+    q *= 10;
+    ++digits;
+  }
+  return q;
+}
+
+/* updates the encoders' q values using a single header value */
+static void http_encoder_negotiate1(fio_str_info_s s, size_t *q_values,
+                                    size_t *explicit_mask) {
+  const char *pos = s.data;
+  const char *end = s.data + s.len;
+  while (pos < end) {
+    while (pos < end && (*pos == ',' || *pos == ' ' || *pos == '\t'))
+      ++pos;
+    const char *token = pos;
+    while (pos < end && *pos != ',' && *pos != ';' && *pos != ' ')
+      ++pos;
+    const size_t token_len = pos - token;
+    const char *params = pos;
+    while (pos < end && *pos != ',')
+      ++pos;
+    if (!token_len)
+      continue;
+    const size_t q = http_encoder_qvalue(params, pos);
+    for (size_t i = 0; HTTP_ENCODERS[i].name.len; ++i) {
+      if (token_len == HTTP_ENCODERS[i].name.len &&
+          !strncasecmp(token, HTTP_ENCODERS[i].name.data, token_len)) {
+        q_values[i] = q;
+        *explicit_mask |= ((size_t)1 << i);
+      } else if (token_len == 1 && token[0] == '*' &&
+                 !(*explicit_mask & ((size_t)1 << i))) {
+        /* the wildcard applies to encoders that weren't named */
+        q_values[i] = q;
+      }
+    }
+  }
+}
+
+/**
+ * Returns the preferred encoder according to the `Accept-Encoding` header
+ * value (a String or an Array of Strings). Returns NULL if no supported encoder
+ * is acceptable.
+ */
+const http_encoder_s *http_encoder_negotiate(FIOBJ accept_encoding) {
+  if (!HTTP_ENCODERS_COUNT || !accept_encoding)
+    return NULL;
+  size_t q_values[HTTP_ENCODERS_COUNT + 1] = {0};
+  size_t explicit_mask = 0;
+  if (FIOBJ_TYPE_IS(accept_encoding, FIOBJ_T_ARRAY)) {
+    for (size_t i = 0; i < fiobj_ary_count(accept_encoding); ++i) {
+      http_encoder_negotiate1(
+          fiobj_obj2cstr(fiobj_ary_index(accept_encoding, i)), q_values,
+          &explicit_mask);
+    }
+  } else {
+    http_encoder_negotiate1(fiobj_obj2cstr(accept_encoding), q_values,
+                            &explicit_mask);
+  }
+  /* the highest q value wins, ties are resolved by the table's order */
+  size_t best = HTTP_ENCODERS_COUNT;
+  for (size_t i = 0; HTTP_ENCODERS[i].name.len; ++i) {
+    if (q_values[i] &&
+        (best == HTTP_ENCODERS_COUNT || q_values[i] > q_values[best]))
+      best = i;
+  }
+  if (best == HTTP_ENCODERS_COUNT)
+    return NULL;
+  return HTTP_ENCODERS + best;
+}
+
+/* *****************************************************************************
+Helpers
+***************************************************************************** */
+
+/**
+ * Compresses `data` into a new String object.
+ *
+ * Returns FIOBJ_INVALID on error or if the compressed data isn't smaller.
+ */
+FIOBJ http_encoder_compress(const http_encoder_s *enc, const void *data,
+                            size_t len) {
+  if (!enc)
+    return FIOBJ_INVALID;
+  void *stream = enc->stream_new();
+  if (!stream)
+    return FIOBJ_INVALID;
+  FIOBJ dest = fiobj_str_buf((len >> 1) + 64);
+  if (enc->write(stream, dest, data, len, HTTP_COMPRESS_FINISH) ||
+      fiobj_obj2cstr(dest).len >= len) {
+    fiobj_free(dest);
+    dest = FIOBJ_INVALID;
+  }
+  enc->stream_free(stream);
+  return dest;
+}
+
+/** Returns an encoder's index in the encoder table (used for hashing). */
+uintptr_t http_encoder_index(const http_encoder_s *enc) {
+  if (!enc)
+    return 0;
+  return 1 + (enc - HTTP_ENCODERS);
+}
+
+/** Returns TRUE if data of the Mime-Type is worth compressing. */
+int http_mimetype_is_compressible(fio_str_info_s mime) {
+  if (!mime.data || !mime.len)
+    return 0;
+  if (mime.len > 5 && !strncasecmp(mime.data, "text/", 5))
+    return 1;
+  /* ignore parameters, i.e. "application/json; charset=utf-8" */
+  const char *end = memchr(mime.data, ';', mime.len);
+  if (end)
+    mime.len = end - mime.data;
+  static const struct {
+    const char *str;
+    size_t len;
+  } types[] = {
+      {"json", 4}, {"javascript", 10}, {"xml", 3}, {"wasm", 4}, {NULL, 0},
+  };
+  for (size_t i = 0; types[i].str; ++i) {
+    for (size_t pos = 0; pos + types[i].len <= mime.len; ++pos) {
+      if (!strncasecmp(mime.data + pos, types[i].str, types[i].len))
+        return 1;
+    }
+  }
+  return 0;
+}
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+#if DEBUG
+static const char *http_encoder_test_name(const char *accept_encoding) {
+  FIOBJ tmp = fiobj_str_new(accept_encoding, strlen(accept_encoding));
+  const http_encoder_s *enc = http_encoder_negotiate(tmp);
+  fiobj_free(tmp);
+  return enc ? enc->name.data : "identity";
+}
+
+void http_compress_test(void) {
+  fprintf(stderr, "=== Testing HTTP content encoding (%zu encoders)\n",
+          (size_t)HTTP_ENCODERS_COUNT);
+  FIO_ASSERT(!strcmp(http_encoder_test_name("identity"), "identity"),
+             "unsupported encodings should be ignored");
+  FIO_ASSERT(!strcmp(http_encoder_test_name("gzip;q=0"), "identity"),
+             "q=0 should disable an encoding");
+#if HAVE_BROTLI
+  FIO_ASSERT(!strcmp(http_encoder_test_name("gzip;q=0, *;q=0.5"), "br"),
+             "the wildcard shouldn't override named encodings");
+  FIO_ASSERT(!strcmp(http_encoder_test_name("gzip, br"), "br"),
+             "ties should be resolved by preference");
+#else
+  FIO_ASSERT(!strcmp(http_encoder_test_name("gzip;q=0, *;q=0.5"), "identity"),
+             "the wildcard shouldn't override named encodings");
+#endif
+#if HAVE_ZLIB
+  FIO_ASSERT(!strcmp(http_encoder_test_name("deflate, GZip"), "gzip"),
+             "gzip negotiation failed");
+  FIO_ASSERT(!strcmp(http_encoder_test_name("br;q=0.5, gzip;q=0.8"), "gzip"),
+             "the highest q value should win");
+  {
+    /* round trip, using a sync flush between the two writes */
+    FIOBJ name = fiobj_str_new("gzip", 4);
+    const http_encoder_s *gz = http_encoder_negotiate(name);
+    fiobj_free(name);
+    char data[4096];
+    for (size_t i = 0; i < sizeof(data); ++i)
+      data[i] = 'a' + (i % 13);
+    void *stream = gz->stream_new();
+    FIOBJ out = fiobj_str_buf(0);
+    FIO_ASSERT(!gz->write(stream, out, data, 1024, HTTP_COMPRESS_SYNC_FLUSH),
+               "gzip write error");
+    const size_t flushed = fiobj_obj2cstr(out).len;
+    FIO_ASSERT(!gz->write(stream, out, data + 1024, sizeof(data) - 1024,
+                          HTTP_COMPRESS_FINISH),
+               "gzip finish error");
+    gz->stream_free(stream);
+    fio_str_info_s c = fiobj_obj2cstr(out);
+    FIO_ASSERT(c.len < sizeof(data) >> 2, "gzip didn't compress (%zu)", c.len);
+    char result[sizeof(data) + 1];
+    z_stream z = {.zalloc = Z_NULL};
+    FIO_ASSERT(inflateInit2(&z, 15 + 16) == Z_OK, "inflateInit2 failed");
+    z.next_in = (Bytef *)c.data;
+    z.avail_in = flushed;
+    z.next_out = (Bytef *)result;
+    z.avail_out = sizeof(result);
+    inflate(&z, Z_SYNC_FLUSH);
+    FIO_ASSERT(z.total_out == 1024 && !memcmp(result, data, 1024),
+               "sync flush should allow partial decompression (%zu)",
+               (size_t)z.total_out);
+    z.next_in = (Bytef *)c.data + flushed;
+    z.avail_in = c.len - flushed;
+    FIO_ASSERT(inflate(&z, Z_FINISH) == Z_STREAM_END &&
+                   z.total_out == sizeof(data) &&
+                   !memcmp(result, data, sizeof(data)),
+               "gzip round trip failed");
+    inflateEnd(&z);
+    fiobj_free(out);
+    FIO_ASSERT(!http_encoder_compress(gz, "ab", 2),
+               "compression shouldn't grow the data");
+  }
+#endif
+  FIO_ASSERT(http_mimetype_is_compressible(
+                 (fio_str_info_s){.data = (char *)"text/html", .len = 9}) &&
+                 http_mimetype_is_compressible((fio_str_info_s){
+                     .data = (char *)"application/json; charset=utf-8",
+                     .len = 31}) &&
+                 !http_mimetype_is_compressible(
+                     (fio_str_info_s){.data = (char *)"image/png", .len = 9}),
+             "compressible Mime-Type detection error");
+  fprintf(stderr, "* passed.\n");
+}
+#endif
@@ -0,0 +1,94 @@
+/*
+Copyright: Boaz Segev, 2017-2019
+License: MIT
+*/
+#ifndef H_HTTP_COMPRESS_H
+#define H_HTTP_COMPRESS_H
+
+#include <fiobj.h>
+
+/* *****************************************************************************
+Compile Time Settings
+***************************************************************************** */
+
+#ifndef HTTP_COMPRESS_MIN_SIZE
+/** Responses smaller than this are never compressed. */
+#define HTTP_COMPRESS_MIN_SIZE 1024
+#endif
+
+#ifndef HTTP_COMPRESS_STATIC_LIMIT
+/**
+ * Static files up to this size are compressed (once) and the compressed
+ * version is kept in the static file cache.
+ */
+#define HTTP_COMPRESS_STATIC_LIMIT (1024 * 1024)
+#endif
+
+#ifndef HTTP_GZIP_LEVEL
+/** The zlib compression level used for gzip responses (1-9). */
+#define HTTP_GZIP_LEVEL 6
+#endif
+
+#ifndef HTTP_BROTLI_QUALITY
+/** The brotli compression quality used for brotli responses (0-11). */
+#define HTTP_BROTLI_QUALITY 5
+#endif
+
+/* *****************************************************************************
+Content Encoders
+***************************************************************************** */
+
+/** Flush modes for the `write` callback. */
+enum {
+  HTTP_COMPRESS_NO_FLUSH = 0,
+  HTTP_COMPRESS_SYNC_FLUSH = 1,
+  HTTP_COMPRESS_FINISH = 2,
+};
+
+/**
+ * A content encoder (compression algorithm).
+ *
+ * New encoders are added to the `HTTP_ENCODERS` table in `http_compress.c`.
+ */
+typedef struct {
+  /** The content-coding token (i.e., "gzip"). */
+  fio_str_info_s name;
+  /** Returns a new compression stream (or NULL on error). */
+  void *(*stream_new)(void);
+  /**
+   * Compresses `data`, appending the compressed data to the `dest` String.
+   *
+   * `flush` is one of `HTTP_COMPRESS_NO_FLUSH`, `HTTP_COMPRESS_SYNC_FLUSH` (so
+   * the client can decompress everything written so far) or
+   * `HTTP_COMPRESS_FINISH`.
+   *
+   * Returns -1 on error and 0 on success.
+   */
+  int (*write)(void *stream, FIOBJ dest, const void *data, size_t len,
+               int flush);
+  /** Frees a compression stream. */
+  void (*stream_free)(void *stream);
+} http_encoder_s;
+
+/**
+ * Returns the preferred encoder according to the `Accept-Encoding` header
+ * value (a String or an Array of Strings). Returns NULL if no supported encoder
+ * is acceptable.
+ */
+const http_encoder_s *http_encoder_negotiate(FIOBJ accept_encoding);
+
+/**
+ * Compresses `data` into a new String object.
+ *
+ * Returns FIOBJ_INVALID on error or if the compressed data isn't smaller.
+ */
+FIOBJ http_encoder_compress(const http_encoder_s *enc, const void *data,
+                            size_t len);
+
+/** Returns an encoder's index in the encoder table (used for hashing). */
+uintptr_t http_encoder_index(const http_encoder_s *enc);
+
+/** Returns TRUE if data of the Mime-Type is worth compressing. */
+int http_mimetype_is_compressible(fio_str_info_s mime);
+
+#endif
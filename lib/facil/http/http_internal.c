@@ -13,12 +13,18 @@ Internal Request / Response Handlers
 ***************************************************************************** */
 
 static uint64_t http_upgrade_hash = 0;
-/** Use this function to handle HTTP requests.*/
-void http_on_request_handler______internal(http_s *h,
-                                           http_settings_s *settings) {
+/* routes the request (Host validation, upgrades, static files, `on_request`) */
+static void http_on_request_perform(http_s *h, http_settings_s *settings) {
   if (!http_upgrade_hash)
     http_upgrade_hash = fiobj_hash_string("upgrade", 7);
-  h->udata = settings->udata;
+  if (!settings->on_body_chunk) /* otherwise, set before streaming the body */
+    h->udata = settings->udata;
+
+  if (settings->request_rate &&
+      fio_rate_limit((uintptr_t)settings,
+                     fio_peer_addr(http2protocol(h)->uuid),
+                     settings->request_rate, settings->request_burst))
+    goto rate_limited;
 
   static uint64_t host_hash = 0;
   if (!host_hash)
@@ -26,22 +32,30 @@ void http_on_request_handler______internal(http_s *h,
 
   if (1) {
     /* test for Host header and avoid duplicates */
-    FIOBJ tmp = fiobj_hash_get2(h->headers, host_hash);
-    if (!tmp)
+    fio_str_info_s host = {.data = (char *)"host", .len = 4};
+    if (!http_header_slice(h, host, host_hash).data)
       goto missing_host;
+    FIOBJ tmp = fiobj_hash_get2(h->headers, host_hash);
     if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY)) {
       fiobj_hash_set(h->headers, HTTP_HEADER_HOST, fiobj_ary_pop(tmp));
     }
   }
 
-  FIOBJ t = fiobj_hash_get2(h->headers, http_upgrade_hash);
-  if (t)
+  fio_str_info_s upgrade_name = {.data = (char *)"upgrade", .len = 7};
+  if (http_header_slice(h, upgrade_name, http_upgrade_hash).data)
     goto upgrade;
 
-  if (fiobj_iseq(
-          fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_ACCEPT)),
-          HTTP_HVALUE_SSE_MIME))
-    goto eventsource;
+  if (1) {
+    static uint64_t accept_hash = 0;
+    if (!accept_hash)
+      accept_hash = fiobj_hash_string("accept", 6);
+    fio_str_info_s accept = {.data = (char *)"accept", .len = 6};
+    accept = http_header_slice(h, accept, accept_hash);
+    fio_str_info_s sse_mime = fiobj_obj2cstr(HTTP_HVALUE_SSE_MIME);
+    if (accept.len == sse_mime.len &&
+        !memcmp(accept.data, sse_mime.data, sse_mime.len))
+      goto eventsource;
+  }
   if (settings->public_folder) {
     fio_str_info_s path_str = fiobj_obj2cstr(h->path);
     if (!http_sendfile2(h, settings->public_folder,
@@ -55,8 +69,10 @@ void http_on_request_handler______internal(http_s *h,
 
 upgrade:
   if (1) {
-    fiobj_dup(t); /* allow upgrade name access after http_finish */
-    fio_str_info_s val = fiobj_obj2cstr(t);
+    /* allow upgrade name access after http_finish (lazy headers remain in the
+     * connection's buffer until the callback returns) */
+    FIOBJ t = fiobj_dup(fiobj_hash_get2(h->headers, http_upgrade_hash));
+    fio_str_info_s val = http_header_slice(h, upgrade_name, http_upgrade_hash);
     if (val.data[0] == 'h' && val.data[1] == '2') {
       http_send_error(h, 400);
     } else {
@@ -72,6 +88,29 @@ missing_host:
   FIO_LOG_DEBUG("missing Host header");
   http_send_error(h, 400);
   return;
+rate_limited:
+  http_set_header2(h,
+                   (fio_str_info_s){.data = (char *)"retry-after", .len = 11},
+                   (fio_str_info_s){.data = (char *)"1", .len = 1});
+  http_send_error(h, 429);
+  return;
+}
+
+/** Use this function to handle HTTP requests.*/
+void http_on_request_handler______internal(http_s *h,
+                                           http_settings_s *settings) {
+#if FIO_METRICS
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  http_on_request_perform(h, settings);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  http_metric_add(HTTP_METRIC_REQUESTS, 1);
+  fio_metric_record(http_metrics[HTTP_METRIC_DURATION],
+                    ((end.tv_sec - start.tv_sec) * 1000000) +
+                        ((end.tv_nsec - start.tv_nsec) / 1000));
+#else
+  http_on_request_perform(h, settings);
+#endif
 }
 
 void http_on_response_handler______internal(http_s *h,
@@ -109,6 +148,47 @@ int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings) {
 Library initialization
 ***************************************************************************** */
 
+size_t http_metrics[HTTP_METRIC_COUNT] = {
+    FIO_METRIC_INVALID, FIO_METRIC_INVALID, FIO_METRIC_INVALID,
+    FIO_METRIC_INVALID, FIO_METRIC_INVALID, FIO_METRIC_INVALID,
+    FIO_METRIC_INVALID, FIO_METRIC_INVALID, FIO_METRIC_INVALID,
+    FIO_METRIC_INVALID, FIO_METRIC_INVALID,
+};
+
+static void http_metrics_register(void) {
+#if FIO_METRICS
+  static const struct {
+    const char *name;
+    const char *help;
+    uint8_t type;
+  } info[HTTP_METRIC_COUNT] = {
+      [HTTP_METRIC_REQUESTS] = {"http_requests_total",
+                                "HTTP requests handled."},
+      [HTTP_METRIC_DURATION] = {"http_request_duration_microseconds",
+                                "Request handler execution time.",
+                                FIO_METRIC_HISTOGRAM},
+      [HTTP_METRIC_1XX] = {"http_responses_total{class=\"1xx\"}",
+                           "HTTP responses sent, by status class."},
+      [HTTP_METRIC_2XX] = {"http_responses_total{class=\"2xx\"}"},
+      [HTTP_METRIC_3XX] = {"http_responses_total{class=\"3xx\"}"},
+      [HTTP_METRIC_4XX] = {"http_responses_total{class=\"4xx\"}"},
+      [HTTP_METRIC_5XX] = {"http_responses_total{class=\"5xx\"}"},
+      [HTTP_METRIC_HTTP1] = {"http_connections{protocol=\"http/1.1\"}",
+                             "Open connections, by protocol.",
+                             FIO_METRIC_GAUGE},
+      [HTTP_METRIC_HTTP2] = {"http_connections{protocol=\"h2\"}", NULL,
+                             FIO_METRIC_GAUGE},
+      [HTTP_METRIC_WEBSOCKET] = {"http_connections{protocol=\"websocket\"}",
+                                 NULL, FIO_METRIC_GAUGE},
+      [HTTP_METRIC_SSE] = {"http_connections{protocol=\"sse\"}", NULL,
+                           FIO_METRIC_GAUGE},
+  };
+  for (size_t i = 0; i < HTTP_METRIC_COUNT; ++i)
+    http_metrics[i] = fio_metric_register(
+        .name = info[i].name, .help = info[i].help, .type = info[i].type);
+#endif
+}
+
 FIOBJ HTTP_HEADER_ACCEPT;
 FIOBJ HTTP_HEADER_ACCEPT_RANGES;
 FIOBJ HTTP_HEADER_CACHE_CONTROL;
@@ -125,8 +205,10 @@ FIOBJ HTTP_HEADER_LAST_MODIFIED;
 FIOBJ HTTP_HEADER_ORIGIN;
 FIOBJ HTTP_HEADER_SET_COOKIE;
 FIOBJ HTTP_HEADER_UPGRADE;
+FIOBJ HTTP_HEADER_VARY;
 FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 FIOBJ HTTP_HEADER_WS_SEC_KEY;
+FIOBJ HTTP_HVALUE_ACCEPT_ENCODING;
 FIOBJ HTTP_HVALUE_BYTES;
 FIOBJ HTTP_HVALUE_CLOSE;
 FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
@@ -145,13 +227,17 @@ static void http_lib_cleanup(void *ignr_);
 static __attribute__((constructor)) void http_lib_constructor(void) {
   fio_state_callback_add(FIO_CALL_ON_INITIALIZE, http_lib_init, NULL);
   fio_state_callback_add(FIO_CALL_AT_EXIT, http_lib_cleanup, NULL);
+  fio_state_callback_add(FIO_CALL_IN_CHILD, http_log_on_fork, NULL);
 }
 
 void http_mimetype_stats(void);
 
 static void http_lib_cleanup(void *ignr_) {
   (void)ignr_;
+  http_log_flush();
   http_mimetype_clear();
+  http_file_cache_clear();
+  http_client_pool_clear();
 #define HTTPLIB_RESET(x)                                                       \
   fiobj_free(x);                                                               \
   x = FIOBJ_INVALID;
@@ -171,8 +257,10 @@ static void http_lib_cleanup(void *ignr_) {
   HTTPLIB_RESET(HTTP_HEADER_ORIGIN);
   HTTPLIB_RESET(HTTP_HEADER_SET_COOKIE);
   HTTPLIB_RESET(HTTP_HEADER_UPGRADE);
+  HTTPLIB_RESET(HTTP_HEADER_VARY);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_KEY);
+  HTTPLIB_RESET(HTTP_HVALUE_ACCEPT_ENCODING);
   HTTPLIB_RESET(HTTP_HVALUE_BYTES);
   HTTPLIB_RESET(HTTP_HVALUE_CLOSE);
   HTTPLIB_RESET(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
@@ -196,6 +284,7 @@ static void http_lib_init(void *ignr_) {
   (void)ignr_;
   if (HTTP_HEADER_ACCEPT_RANGES)
     return;
+  http_metrics_register();
   HTTP_HEADER_ACCEPT = fiobj_str_new("accept", 6);
   HTTP_HEADER_ACCEPT_RANGES = fiobj_str_new("accept-ranges", 13);
   HTTP_HEADER_CACHE_CONTROL = fiobj_str_new("cache-control", 13);
@@ -212,8 +301,10 @@ static void http_lib_init(void *ignr_) {
   HTTP_HEADER_ORIGIN = fiobj_str_new("origin", 6);
   HTTP_HEADER_SET_COOKIE = fiobj_str_new("set-cookie", 10);
   HTTP_HEADER_UPGRADE = fiobj_str_new("upgrade", 7);
+  HTTP_HEADER_VARY = fiobj_str_new("vary", 4);
   HTTP_HEADER_WS_SEC_CLIENT_KEY = fiobj_str_new("sec-websocket-key", 17);
   HTTP_HEADER_WS_SEC_KEY = fiobj_str_new("sec-websocket-accept", 20);
+  HTTP_HVALUE_ACCEPT_ENCODING = fiobj_str_new("accept-encoding", 15);
   HTTP_HVALUE_BYTES = fiobj_str_new("bytes", 5);
   HTTP_HVALUE_CLOSE = fiobj_str_new("close", 5);
   HTTP_HVALUE_CONTENT_TYPE_DEFAULT =
@@ -243,8 +334,10 @@ static void http_lib_init(void *ignr_) {
   fiobj_obj2hash(HTTP_HEADER_ORIGIN);
   fiobj_obj2hash(HTTP_HEADER_SET_COOKIE);
   fiobj_obj2hash(HTTP_HEADER_UPGRADE);
+  fiobj_obj2hash(HTTP_HEADER_VARY);
   fiobj_obj2hash(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   fiobj_obj2hash(HTTP_HEADER_WS_SEC_KEY);
+  fiobj_obj2hash(HTTP_HVALUE_ACCEPT_ENCODING);
   fiobj_obj2hash(HTTP_HVALUE_BYTES);
   fiobj_obj2hash(HTTP_HVALUE_CLOSE);
   fiobj_obj2hash(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
@@ -258,6 +351,40 @@ static void http_lib_init(void *ignr_) {
   fiobj_obj2hash(HTTP_HVALUE_WS_UPGRADE);
   fiobj_obj2hash(HTTP_HVALUE_WS_VERSION);
 
+  /* the constants are used by all the threads */
+  fiobj_share(HTTP_HEADER_ACCEPT);
+  fiobj_share(HTTP_HEADER_ACCEPT_RANGES);
+  fiobj_share(HTTP_HEADER_CACHE_CONTROL);
+  fiobj_share(HTTP_HEADER_CONNECTION);
+  fiobj_share(HTTP_HEADER_CONTENT_ENCODING);
+  fiobj_share(HTTP_HEADER_CONTENT_LENGTH);
+  fiobj_share(HTTP_HEADER_CONTENT_RANGE);
+  fiobj_share(HTTP_HEADER_CONTENT_TYPE);
+  fiobj_share(HTTP_HEADER_COOKIE);
+  fiobj_share(HTTP_HEADER_DATE);
+  fiobj_share(HTTP_HEADER_ETAG);
+  fiobj_share(HTTP_HEADER_HOST);
+  fiobj_share(HTTP_HEADER_LAST_MODIFIED);
+  fiobj_share(HTTP_HEADER_ORIGIN);
+  fiobj_share(HTTP_HEADER_SET_COOKIE);
+  fiobj_share(HTTP_HEADER_UPGRADE);
+  fiobj_share(HTTP_HEADER_VARY);
+  fiobj_share(HTTP_HEADER_WS_SEC_CLIENT_KEY);
+  fiobj_share(HTTP_HEADER_WS_SEC_KEY);
+  fiobj_share(HTTP_HVALUE_ACCEPT_ENCODING);
+  fiobj_share(HTTP_HVALUE_BYTES);
+  fiobj_share(HTTP_HVALUE_CLOSE);
+  fiobj_share(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
+  fiobj_share(HTTP_HVALUE_GZIP);
+  fiobj_share(HTTP_HVALUE_KEEP_ALIVE);
+  fiobj_share(HTTP_HVALUE_MAX_AGE);
+  fiobj_share(HTTP_HVALUE_NO_CACHE);
+  fiobj_share(HTTP_HVALUE_SSE_MIME);
+  fiobj_share(HTTP_HVALUE_WEBSOCKET);
+  fiobj_share(HTTP_HVALUE_WS_SEC_VERSION);
+  fiobj_share(HTTP_HVALUE_WS_UPGRADE);
+  fiobj_share(HTTP_HVALUE_WS_VERSION);
+
 #define REGISTER_MIME(ext, type)                                               \
   http_mimetype_register((char *)ext, sizeof(ext) - 1,                         \
                          fiobj_str_new((char *)type, sizeof(type) - 1))
@@ -14,6 +14,7 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <fio.h>
 
 #include <http.h>
+#include <http_compress.h>
 
 #include <arpa/inet.h>
 #include <errno.h>
@@ -47,6 +48,8 @@ struct http_vtable_s {
 
   /** Resumes a request / response handling. */
   void (*http_on_resume)(http_s *, http_fio_protocol_s *);
+  /** Resumes reading a streamed request body (see `on_body_chunk`). */
+  void (*http_on_body_resume)(http_s *, http_fio_protocol_s *);
   /** hijacks the socket aaway from the protocol. */
   intptr_t (*http_hijack)(http_s *h, fio_str_info_s *leftover);
 
@@ -56,16 +59,73 @@ struct http_vtable_s {
   int (*http_sse_write)(http_sse_s *sse, FIOBJ str);
   /** Closes an EventSource (SSE) connection. */
   int (*http_sse_close)(http_sse_s *sse);
+  /** Fills in `h->headers` with any lazily stored headers (optional). */
+  void (*http_headers_load)(http_s *h);
+  /** Sends a templated response, the template is valid (optional). */
+  int (*http_send_template)(http_s *h, http_response_template_s *t,
+                            void *data, uintptr_t length);
+  /** Finds a lazily stored header, `.data == NULL` if none (optional). */
+  fio_str_info_s (*http_header_slice)(http_s *h, fio_str_info_s name,
+                                      uint64_t hash);
+  /** Streams data without copying it, MUST call `dealloc` (optional). */
+  int (*http_stream2)(http_s *h, void *data, uintptr_t length,
+                      void (*dealloc)(void *));
+  /** Performs the paused handle's task once written data is sent (optional). */
+  int (*http_stream_wait)(http_s *h, http_pause_handle_s *http);
 };
 
+/** Schedules a paused handle's task (see `http_stream_wait`). */
+void http_stream_resume(http_pause_handle_s *http);
+
+struct http_response_template_s {
+  FIOBJ headers;          /* the Hash used to create the template */
+  FIOBJ block;            /* the serialized `name:value\r\n` lines */
+  uint8_t has_connection; /* set if the Hash contains a Connection header */
+  uint8_t close;          /* set if that header is `connection: close` */
+};
+
+/** Returns a new reference to the cached Date header value. */
+FIOBJ http_date_current(void);
+
 struct http_fio_protocol_s {
   fio_protocol_s protocol;   /* facil.io protocol */
   intptr_t uuid;             /* socket uuid */
   http_settings_s *settings; /* pointer to HTTP settings */
+  fio_region_s *region;      /* request data memory region (if enabled) */
 };
 
 #define http2protocol(h) ((http_fio_protocol_s *)h->private_data.flag)
 
+/** Routes allocations to the request's memory region, returning the old one. */
+static inline fio_region_s *http_region_enter(http_s *h) {
+  http_fio_protocol_s *p = http2protocol(h);
+  return fio_region_set(p ? p->region : NULL);
+}
+
+/** Makes sure `h->headers` contains all the request headers. */
+static inline void http_headers_load(http_s *h) {
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (vtbl && vtbl->http_headers_load)
+    vtbl->http_headers_load(h);
+}
+
+/** Finds a request header's first value (`name` MUST be lower case). */
+static inline fio_str_info_s http_header_slice(http_s *h, fio_str_info_s name,
+                                               uint64_t hash) {
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (vtbl && vtbl->http_header_slice) {
+    fio_str_info_s ret = vtbl->http_header_slice(h, name, hash);
+    if (ret.data)
+      return ret;
+  }
+  FIOBJ tmp = fiobj_hash_get2(h->headers, hash);
+  if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
+    tmp = fiobj_ary_index(tmp, 0);
+  if (!tmp)
+    return (fio_str_info_s){.data = NULL};
+  return fiobj_obj2cstr(tmp);
+}
+
 /* *****************************************************************************
 Constants that shouldn't be accessed by the users (`fiobj_dup` required).
 ***************************************************************************** */
@@ -73,6 +133,7 @@ Constants that shouldn't be accessed by the users (`fiobj_dup` required).
 extern FIOBJ HTTP_HEADER_ACCEPT_RANGES;
 extern FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 extern FIOBJ HTTP_HEADER_WS_SEC_KEY;
+extern FIOBJ HTTP_HVALUE_ACCEPT_ENCODING;
 extern FIOBJ HTTP_HVALUE_BYTES;
 extern FIOBJ HTTP_HVALUE_CLOSE;
 extern FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
@@ -148,6 +209,47 @@ void http_on_response_handler______internal(http_s *h,
                                             http_settings_s *settings);
 int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings);
 
+/* fails waiting pooled client requests and releases the (unused) pools. */
+void http_client_pool_clear(void);
+
+/* stops the access log thread and writes any pending log records. */
+void http_log_flush(void);
+/* resets the access log in a new (forked) worker process. */
+void http_log_on_fork(void *ignr_);
+
+/* *****************************************************************************
+Metrics
+***************************************************************************** */
+
+/* the HTTP metrics (registered by `http_lib_init`) */
+enum {
+  HTTP_METRIC_REQUESTS,
+  HTTP_METRIC_DURATION,
+  HTTP_METRIC_1XX,
+  HTTP_METRIC_2XX,
+  HTTP_METRIC_3XX,
+  HTTP_METRIC_4XX,
+  HTTP_METRIC_5XX,
+  HTTP_METRIC_HTTP1,
+  HTTP_METRIC_HTTP2,
+  HTTP_METRIC_WEBSOCKET,
+  HTTP_METRIC_SSE,
+  HTTP_METRIC_COUNT,
+};
+
+/* the metric identifiers (`FIO_METRIC_INVALID` when disabled) */
+extern size_t http_metrics[HTTP_METRIC_COUNT];
+
+#define http_metric_add(metric, value)                                         \
+  fio_metric_add(http_metrics[(metric)], (value))
+
+/* counts a finished response by its status class */
+static inline void http_metric_on_response(http_s *h) {
+  if (h->status_str || h->status < 100 || h->status > 599)
+    return;
+  http_metric_add(HTTP_METRIC_1XX + (h->status / 100) - 1, 1);
+}
+
 /* *****************************************************************************
 EventSource Support (SSE)
 ***************************************************************************** */
@@ -160,6 +262,9 @@ typedef struct http_sse_internal_s {
   fio_ls_s subscriptions; /* Subscription List */
   fio_lock_i lock;        /* Subscription List lock */
   size_t ref;             /* reference count */
+  const http_encoder_s *encoder; /* the stream's encoder (if compressed) */
+  void *encoder_stream;          /* the compression stream */
+  fio_lock_i encoder_lock;       /* serializes compression and writes */
 } http_sse_internal_s;
 
 static inline void http_sse_init(http_sse_internal_s *sse, intptr_t uuid,
@@ -171,11 +276,14 @@ static inline void http_sse_init(http_sse_internal_s *sse, intptr_t uuid,
       .vtable = vtbl,
       .ref = 1,
   };
+  http_metric_add(HTTP_METRIC_SSE, 1);
 }
 
 static inline void http_sse_try_free(http_sse_internal_s *sse) {
   if (fio_atomic_sub(&sse->ref, 1))
     return;
+  if (sse->encoder_stream)
+    sse->encoder->stream_free(sse->encoder_stream);
   fio_free(sse);
 }
 
@@ -187,6 +295,7 @@ static inline void http_sse_destroy(http_sse_internal_s *sse) {
   if (sse->sse.on_close)
     sse->sse.on_close(&sse->sse);
   sse->uuid = -1;
+  http_metric_add(HTTP_METRIC_SSE, -1);
   http_sse_try_free(sse);
 }
 
@@ -0,0 +1,433 @@
+/*
+Copyright: Boaz Segev, 2017-2019
+License: MIT
+*/
+#include <fio.h>
+
+#include <http.h>
+
+#include <string.h>
+
+/* *****************************************************************************
+The Radix Tree
+***************************************************************************** */
+
+typedef struct http_router_node_s http_router_node_s;
+
+/* a tree node - a static path fragment, a `:param` or a `*wildcard` */
+struct http_router_node_s {
+  /* static children (each child starts with a different byte) */
+  http_router_node_s **children;
+  size_t children_count;
+  /* the `:param` child (if any) */
+  http_router_node_s *param;
+  /* the `*wildcard` child (if any) */
+  http_router_node_s *wildcard;
+  /* the static path fragment / the parameter's name */
+  char *label;
+  size_t label_len;
+  /* the route's handler (if a route ends at this node) */
+  void (*on_request)(http_s *h, http_route_match_s *match);
+  void *udata;
+};
+
+/* a tree per request method (methods are few, a linear search is faster) */
+typedef struct {
+  char *method;
+  size_t method_len;
+  http_router_node_s root;
+} http_router_tree_s;
+
+struct http_router_s {
+  http_router_tree_s *trees;
+  size_t trees_count;
+  /* routes set for any method (a NULL method) */
+  http_router_node_s any;
+  void (*on_not_found)(http_s *h);
+};
+
+static http_router_node_s *http_router_node_new(const char *label,
+                                                size_t len) {
+  http_router_node_s *n = fio_malloc(sizeof(*n) + len + 1);
+  FIO_ASSERT_ALLOC(n);
+  *n = (http_router_node_s){.label = (char *)(n + 1), .label_len = len};
+  memcpy(n->label, label, len);
+  n->label[len] = 0;
+  return n;
+}
+
+static void http_router_node_clear(http_router_node_s *n) {
+  for (size_t i = 0; i < n->children_count; ++i) {
+    http_router_node_clear(n->children[i]);
+    fio_free(n->children[i]);
+  }
+  fio_free(n->children);
+  if (n->param) {
+    http_router_node_clear(n->param);
+    fio_free(n->param);
+  }
+  if (n->wildcard) {
+    http_router_node_clear(n->wildcard);
+    fio_free(n->wildcard);
+  }
+}
+
+static void http_router_node_attach(http_router_node_s *parent,
+                                    http_router_node_s *child) {
+  parent->children =
+      fio_realloc2(parent->children,
+                   sizeof(*parent->children) * (parent->children_count + 1),
+                   sizeof(*parent->children) * parent->children_count);
+  FIO_ASSERT_ALLOC(parent->children);
+  parent->children[parent->children_count++] = child;
+}
+
+/* returns the child with the same first byte (static children only) */
+static inline http_router_node_s **
+http_router_node_child(http_router_node_s *n, char c) {
+  for (size_t i = 0; i < n->children_count; ++i)
+    if (n->children[i]->label[0] == c)
+      return n->children + i;
+  return NULL;
+}
+
+/* adds a static path fragment below `n`, splitting nodes when required */
+static http_router_node_s *http_router_insert_static(http_router_node_s *n,
+                                                     const char *s,
+                                                     size_t len) {
+  while (len) {
+    http_router_node_s **pos = http_router_node_child(n, s[0]);
+    if (!pos) {
+      http_router_node_s *child = http_router_node_new(s, len);
+      http_router_node_attach(n, child);
+      return child;
+    }
+    http_router_node_s *child = *pos;
+    size_t common = 1;
+    while (common < len && common < child->label_len &&
+           s[common] == child->label[common])
+      ++common;
+    if (common < child->label_len) {
+      /* split the child, the common prefix becomes the parent */
+      http_router_node_s *mid = http_router_node_new(child->label, common);
+      http_router_node_s *rest = http_router_node_new(
+          child->label + common, child->label_len - common);
+      rest->children = child->children;
+      rest->children_count = child->children_count;
+      rest->param = child->param;
+      rest->wildcard = child->wildcard;
+      rest->on_request = child->on_request;
+      rest->udata = child->udata;
+      fio_free(child);
+      http_router_node_attach(mid, rest);
+      *pos = child = mid;
+    }
+    n = child;
+    s += common;
+    len -= common;
+  }
+  return n;
+}
+
+/* finds the route for the path, collecting the parameters into `m` */
+static http_router_node_s *http_router_node_find(http_router_node_s *n,
+                                                 const char *path, size_t len,
+                                                 http_route_match_s *m) {
+  if (!len && n->on_request)
+    return n;
+  if (len) {
+    http_router_node_s **pos = http_router_node_child(n, path[0]);
+    if (pos && (*pos)->label_len <= len &&
+        !memcmp((*pos)->label, path, (*pos)->label_len)) {
+      http_router_node_s *found =
+          http_router_node_find(*pos, path + (*pos)->label_len,
+                                len - (*pos)->label_len, m);
+      if (found)
+        return found;
+    }
+  }
+  if (n->param && len && path[0] != '/') {
+    size_t seg = 1;
+    while (seg < len && path[seg] != '/')
+      ++seg;
+    const size_t index = m->count++;
+    m->params[index] = (http_route_param_s){
+        .name = {.data = n->param->label, .len = n->param->label_len},
+        .value = {.data = (char *)path, .len = seg},
+    };
+    http_router_node_s *found =
+        http_router_node_find(n->param, path + seg, len - seg, m);
+    if (found)
+      return found;
+    m->count = index;
+  }
+  if (n->wildcard) {
+    m->params[m->count++] = (http_route_param_s){
+        .name = {.data = n->wildcard->label, .len = n->wildcard->label_len},
+        .value = {.data = (char *)path, .len = len},
+    };
+    return n->wildcard;
+  }
+  return NULL;
+}
+
+/* *****************************************************************************
+Router API
+***************************************************************************** */
+
+/** Creates a new (empty) router. */
+http_router_s *http_router_new(void (*on_not_found)(http_s *h)) {
+  http_router_s *r = fio_malloc(sizeof(*r));
+  FIO_ASSERT_ALLOC(r);
+  *r = (http_router_s){.on_not_found = on_not_found};
+  return r;
+}
+
+/** Frees the router and all it's routes. */
+void http_router_free(http_router_s *router) {
+  if (!router)
+    return;
+  for (size_t i = 0; i < router->trees_count; ++i) {
+    http_router_node_clear(&router->trees[i].root);
+    fio_free(router->trees[i].method);
+  }
+  fio_free(router->trees);
+  http_router_node_clear(&router->any);
+  fio_free(router);
+}
+
+/* returns the method's tree root, adding a tree if `create` is set */
+static http_router_node_s *http_router_root(http_router_s *r,
+                                            fio_str_info_s method,
+                                            uint8_t create) {
+  if (!method.data)
+    return &r->any;
+  for (size_t i = 0; i < r->trees_count; ++i) {
+    if (r->trees[i].method_len == method.len &&
+        !memcmp(r->trees[i].method, method.data, method.len))
+      return &r->trees[i].root;
+  }
+  if (!create)
+    return NULL;
+  r->trees = fio_realloc2(r->trees, sizeof(*r->trees) * (r->trees_count + 1),
+                          sizeof(*r->trees) * r->trees_count);
+  FIO_ASSERT_ALLOC(r->trees);
+  http_router_tree_s *t = r->trees + r->trees_count++;
+  *t = (http_router_tree_s){.method = fio_malloc(method.len + 1),
+                            .method_len = method.len};
+  FIO_ASSERT_ALLOC(t->method);
+  memcpy(t->method, method.data, method.len);
+  t->method[method.len] = 0;
+  return &t->root;
+}
+
+#undef http_route
+/** Adds a route to the router. */
+int http_route(http_router_s *router, struct http_route_args_s args) {
+  if (!router || !args.path || args.path[0] != '/' || !args.on_request)
+    goto invalid;
+  fio_str_info_s method = {.data = (char *)args.method};
+  if (method.data)
+    method.len = strlen(method.data);
+  http_router_node_s *n = http_router_root(router, method, 1);
+  const char *path = args.path;
+  size_t params = 0;
+  while (*path) {
+    if (*path == ':' || *path == '*') {
+      const char type = *path++;
+      size_t len = 0;
+      while (path[len] && path[len] != '/')
+        ++len;
+      if (!len || (type == '*' && path[len]) ||
+          ++params > HTTP_ROUTER_MAX_PARAMS)
+        goto invalid;
+      http_router_node_s **child = (type == ':' ? &n->param : &n->wildcard);
+      if (!*child) {
+        *child = http_router_node_new(path, len);
+      } else if ((*child)->label_len != len ||
+                 memcmp((*child)->label, path, len)) {
+        FIO_LOG_ERROR("(http_route) %s conflicts with an existing parameter"
+                      " name (%s).",
+                      args.path, (*child)->label);
+        return -1;
+      }
+      n = *child;
+      path += len;
+      continue;
+    }
+    size_t len = 1;
+    while (path[len] && path[len] != ':' && path[len] != '*')
+      ++len;
+    n = http_router_insert_static(n, path, len);
+    path += len;
+  }
+  if (n->on_request) {
+    FIO_LOG_ERROR("(http_route) route exists: %s %s",
+                  (args.method ? args.method : "*"), args.path);
+    return -1;
+  }
+  n->on_request = args.on_request;
+  n->udata = args.udata;
+  return 0;
+invalid:
+  FIO_LOG_ERROR("(http_route) invalid route: %s",
+                (args.path ? args.path : "(NULL)"));
+  return -1;
+}
+
+/* finds the route for the method and path, filling in `m` */
+static http_router_node_s *http_router_find(http_router_s *r,
+                                            fio_str_info_s method,
+                                            fio_str_info_s path,
+                                            http_route_match_s *m) {
+  http_router_node_s *root = http_router_root(r, method, 0);
+  http_router_node_s *found = NULL;
+  m->count = 0;
+  if (root)
+    found = http_router_node_find(root, path.data, path.len, m);
+  if (!found) {
+    m->count = 0;
+    found = http_router_node_find(&r->any, path.data, path.len, m);
+  }
+  if (found)
+    m->udata = found->udata;
+  return found;
+}
+
+/** Routes the request using the router set as the `http_listen` udata. */
+void http_router_on_request(http_s *h) {
+  http_router_s *r = h->udata;
+  http_route_match_s m;
+  http_router_node_s *found = http_router_find(r, fiobj_obj2cstr(h->method),
+                                               fiobj_obj2cstr(h->path), &m);
+  if (found) {
+    found->on_request(h, &m);
+    return;
+  }
+  if (r->on_not_found) {
+    r->on_not_found(h);
+    return;
+  }
+  http_send_error(h, 404);
+}
+
+/** Returns the value of the named path parameter. */
+fio_str_info_s http_route_param(http_route_match_s *match, const char *name) {
+  const size_t len = strlen(name);
+  for (size_t i = 0; i < match->count; ++i) {
+    if (match->params[i].name.len == len &&
+        !memcmp(match->params[i].name.data, name, len))
+      return match->params[i].value;
+  }
+  return (fio_str_info_s){.data = NULL};
+}
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+#if DEBUG
+
+static void http_router_test_task(http_s *h, http_route_match_s *m) {
+  (void)h;
+  (void)m;
+}
+
+#define HTTP_ROUTER_TEST_FIND(method_, path_, udata_)                          \
+  do {                                                                         \
+    fio_str_info_s method = {.data = (char *)(method_),                        \
+                             .len = strlen((method_))};                        \
+    fio_str_info_s path = {.data = (char *)(path_), .len = strlen((path_))};   \
+    http_router_node_s *found = http_router_find(r, method, path, &m);         \
+    FIO_ASSERT((found ? found->udata : NULL) == (void *)(uintptr_t)(udata_),   \
+               "route error for %s %s (%zu != %zu)", (method_), (path_),       \
+               (size_t)(found ? (uintptr_t)found->udata : 0),                  \
+               (size_t)(udata_));                                              \
+  } while (0)
+
+void http_router_test(void) {
+  fprintf(stderr, "* Testing the HTTP request router.\n");
+  http_router_s *r = http_router_new(NULL);
+  http_route_match_s m;
+  struct {
+    const char *method;
+    const char *path;
+  } routes[] = {
+      {"GET", "/"},
+      {"GET", "/users"},
+      {"GET", "/users/:id"},
+      {"GET", "/users/:id/posts/:post"},
+      {"GET", "/users/new"},
+      {"GET", "/usage"},
+      {"POST", "/users"},
+      {"GET", "/static/*file"},
+      {NULL, "/any/:thing"},
+      {"GET", "/u"},
+  };
+  for (size_t i = 0; i < sizeof(routes) / sizeof(routes[0]); ++i) {
+    FIO_ASSERT(!http_route(r,
+                           (struct http_route_args_s){
+                               .method = routes[i].method,
+                               .path = routes[i].path,
+                               .on_request = http_router_test_task,
+                               .udata = (void *)(uintptr_t)(i + 1),
+                           }),
+               "couldn't add route %s", routes[i].path);
+  }
+  const int log_level = FIO_LOG_LEVEL; /* silence the expected errors */
+  FIO_LOG_LEVEL = FIO_LOG_LEVEL_NONE;
+  FIO_ASSERT(http_route(r, (struct http_route_args_s){
+                               .method = "GET",
+                               .path = "/users",
+                               .on_request = http_router_test_task,
+                           }) == -1,
+             "existing routes should be rejected");
+  FIO_ASSERT(http_route(r, (struct http_route_args_s){
+                               .method = "GET",
+                               .path = "/users/:name",
+                               .on_request = http_router_test_task,
+                           }) == -1,
+             "conflicting parameter names should be rejected");
+  FIO_ASSERT(http_route(r, (struct http_route_args_s){
+                               .method = "GET",
+                               .path = "/bad/*rest/more",
+                               .on_request = http_router_test_task,
+                           }) == -1,
+             "wildcards should end the route");
+  FIO_LOG_LEVEL = log_level;
+  HTTP_ROUTER_TEST_FIND("GET", "/", 1);
+  HTTP_ROUTER_TEST_FIND("GET", "/users", 2);
+  HTTP_ROUTER_TEST_FIND("POST", "/users", 7);
+  HTTP_ROUTER_TEST_FIND("PUT", "/users", 0);
+  HTTP_ROUTER_TEST_FIND("GET", "/users/new", 5);
+  HTTP_ROUTER_TEST_FIND("GET", "/usage", 6);
+  HTTP_ROUTER_TEST_FIND("GET", "/u", 10);
+  HTTP_ROUTER_TEST_FIND("GET", "/us", 0);
+  HTTP_ROUTER_TEST_FIND("GET", "/users/", 0);
+  HTTP_ROUTER_TEST_FIND("GET", "/users/42", 3);
+  FIO_ASSERT(m.count == 1 && m.params[0].value.len == 2 &&
+                 !memcmp(m.params[0].value.data, "42", 2),
+             "path parameter error");
+  /* "/users/n" shares a prefix with the static "/users/new" route */
+  HTTP_ROUTER_TEST_FIND("GET", "/users/n", 3);
+  HTTP_ROUTER_TEST_FIND("GET", "/users/newer", 3);
+  HTTP_ROUTER_TEST_FIND("GET", "/users/42/posts/7", 4);
+  fio_str_info_s post = http_route_param(&m, "post");
+  fio_str_info_s id = http_route_param(&m, "id");
+  FIO_ASSERT(m.count == 2 && post.len == 1 && post.data[0] == '7' &&
+                 id.len == 2 && !memcmp(id.data, "42", 2) &&
+                 !http_route_param(&m, "missing").data,
+             "multiple path parameters error");
+  HTTP_ROUTER_TEST_FIND("GET", "/users/42/posts", 0);
+  HTTP_ROUTER_TEST_FIND("GET", "/static/css/main.css", 8);
+  FIO_ASSERT(m.count == 1 && m.params[0].value.len == 12 &&
+                 !memcmp(m.params[0].value.data, "css/main.css", 12) &&
+                 m.params[0].name.len == 4,
+             "wildcard parameter error");
+  HTTP_ROUTER_TEST_FIND("GET", "/static/", 8);
+  HTTP_ROUTER_TEST_FIND("DELETE", "/any/1", 9);
+  HTTP_ROUTER_TEST_FIND("GET", "/any/1/2", 0);
+  http_router_free(r);
+}
+
+#undef HTTP_ROUTER_TEST_FIND
+#endif
@@ -1,4 +1,5 @@
 #ifndef H_HPACK_H
+#define H_HPACK_H
 
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
@@ -37,10 +38,69 @@ Types
 /** The HPACK context. */
 typedef struct hpack_context_s hpack_context_s;
 
+/** A dynamic table entry (the name and value share a single allocation). */
+typedef struct {
+  char *name;
+  size_t name_len;
+  char *value;
+  size_t value_len;
+} hpack_entry_s;
+
+/** The HPACK context (a decoder's dynamic table), don't access directly. */
+struct hpack_context_s {
+  hpack_entry_s *entries; /* a ring buffer, `pos` is the newest entry */
+  size_t capa;            /* the ring buffer's length */
+  size_t pos;             /* the newest entry's position */
+  size_t count;           /* the number of entries in the table */
+  size_t size;            /* the HPACK size of the table (RFC 7541, 4.1) */
+  size_t max_size;        /* the current size limit (size update) */
+  size_t limit;           /* the size limit advertised to the peer */
+};
+
 /* *****************************************************************************
 Context API
 ***************************************************************************** */
 
+/**
+ * Initializes an HPACK decoding context, `limit` is the table size advertised
+ * to the peer (4096 unless the peer was informed otherwise).
+ */
+static inline void hpack_context_init(hpack_context_s *ctx, size_t limit);
+
+/** Frees any resources used by the HPACK context. */
+static inline void hpack_context_destroy(hpack_context_s *ctx);
+
+/**
+ * Decodes a complete header block, calling `on_header` for every header field.
+ *
+ * The `name` and `value` pointers are only valid during the callback. If
+ * `on_header` returns a non-zero value, decoding continues (keeping the
+ * dynamic table in sync) but the callback is no longer called.
+ *
+ * Returns 0 on success or -1 on a decoding error (a COMPRESSION_ERROR).
+ */
+static MAYBE_UNUSED int hpack_decode(hpack_context_s *ctx, void *data,
+                                     size_t len,
+                                     int (*on_header)(void *udata, char *name,
+                                                      size_t name_len,
+                                                      char *value,
+                                                      size_t value_len),
+                                     void *udata);
+
+/**
+ * Encodes a header field without adding it to the peer's dynamic table.
+ *
+ * Static table entries are referenced where possible and strings are Huffman
+ * encoded when this makes them shorter.
+ *
+ * Returns the number of bytes written to the destination buffer. If the buffer
+ * was too small, returns the buffer size required (which might include a spare
+ * byte for each Huffman encoded string).
+ */
+static MAYBE_UNUSED int hpack_header_pack(void *dest, size_t limit,
+                                          const char *name, size_t name_len,
+                                          const char *value, size_t value_len);
+
 /* *****************************************************************************
 Primitive Types API
 ***************************************************************************** */
@@ -113,14 +173,14 @@ typedef const struct {
   const uint32_t code;
   const uint8_t bits;
 } huffman_encode_s;
-static const huffman_encode_s huffman_encode_table[];
+static const huffman_encode_s huffman_encode_table[257];
 
 /* the huffman decoding binary tree type */
 typedef struct {
   const int16_t value;     // value, -1 == none.
   const uint8_t offset[2]; // offset for 0 and one. 0 == leaf node.
 } huffman_decode_s;
-static const huffman_decode_s huffman_decode_tree[];
+static const huffman_decode_s huffman_decode_tree[513];
 
 /**
  * Unpack (de-compress) using HPACK huffman - returns the number of bytes
@@ -250,8 +310,10 @@ static MAYBE_UNUSED int hpack_string_pack(void *dest_, size_t limit,
   uint8_t *buf = (uint8_t *)data_;
   int encoded_int_len = 0;
   int pos = 0;
+  /* with no room, only the required length is calculated */
   if (compress) {
-    dest[pos] = 128;
+    if (limit)
+      dest[pos] = 128;
     int comp_len = hpack_huffman_pack(NULL, 0, buf, len);
     encoded_int_len = hpack_int_pack(dest, limit, comp_len, 7);
     if (encoded_int_len + comp_len > (int)limit)
@@ -260,7 +322,8 @@ static MAYBE_UNUSED int hpack_string_pack(void *dest_, size_t limit,
                                   limit - encoded_int_len, buf, len);
     return encoded_int_len + comp_len;
   }
-  dest[pos] = 0;
+  if (limit)
+    dest[pos] = 0;
   encoded_int_len = hpack_int_pack(dest, limit, len, 7);
   if (encoded_int_len + (int)len > (int)limit)
     return len + encoded_int_len;
@@ -369,6 +432,16 @@ static MAYBE_UNUSED int hpack_huffman_pack(void *dest_, const int limit,
       if (bits + offset <= 8) {
         dest[comp_len] |= code >> (24 + offset);
         offset = offset + bits;
+        if (offset == 8) {
+          /* the byte is full, move on to the next one */
+          offset = 0;
+          ++comp_len;
+          if (pos < end) {
+            if (comp_len >= limit)
+              goto calc_final_length;
+            dest[comp_len] = 0;
+          }
+        }
         continue;
       }
       /* fill in current byte */
@@ -388,11 +461,11 @@ static MAYBE_UNUSED int hpack_huffman_pack(void *dest_, const int limit,
     switch (bits >> 3) {
     case 3:
       dest[comp_len + 2] = (uint8_t)(code >> 8) & 0xFF;
-    /* overflow */
+    /* fallthrough */
     case 2:
       dest[comp_len + 1] = (uint8_t)(code >> 16) & 0xFF;
-    /* overflow */
-    case 1: /* overflow */
+    /* fallthrough */
+    case 1:
       dest[comp_len + 0] = (uint8_t)(code >> 24) & 0xFF;
       comp_len += (bits >> 3);
       code <<= (bits & (~7));
@@ -426,7 +499,7 @@ calc_final_length:
 Header static table lookup
 ***************************************************************************** */
 
-const static struct {
+static const struct {
   struct hpack_static_data_s {
     const char *val;
     const size_t len;
@@ -438,15 +511,15 @@ const static struct {
     {.data = {{.val = ":method", .len = 7}, {.val = "POST", .len = 4}}},
     {.data = {{.val = ":path", .len = 5}, {.val = "/", .len = 1}}},
     {.data = {{.val = ":path", .len = 5}, {.val = "/index.html", .len = 11}}},
-    {.data = {{.val = ":scheme", .len = 7}, {.val = "http", .len = 0}}},
-    {.data = {{.val = ":scheme", .len = 7}, {.val = "https", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "200", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "204", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "206", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "304", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "400", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "404", .len = 0}}},
-    {.data = {{.val = ":status", .len = 7}, {.val = "500", .len = 0}}},
+    {.data = {{.val = ":scheme", .len = 7}, {.val = "http", .len = 4}}},
+    {.data = {{.val = ":scheme", .len = 7}, {.val = "https", .len = 5}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "200", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "204", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "206", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "304", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "400", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "404", .len = 3}}},
+    {.data = {{.val = ":status", .len = 7}, {.val = "500", .len = 3}}},
     {.data = {{.val = "accept-charset", .len = 14}, {.len = 0}}},
     {.data = {{.val = "accept-encoding", .len = 15},
               {.val = "gzip, deflate", .len = 13}}},
@@ -458,7 +531,7 @@ const static struct {
     {.data = {{.val = "allow", .len = 5}, {.len = 0}}},
     {.data = {{.val = "authorization", .len = 13}, {.len = 0}}},
     {.data = {{.val = "cache-control", .len = 13}, {.len = 0}}},
-    {.data = {{.val = "content-disposition", .len = 0}, {.len = 0}}},
+    {.data = {{.val = "content-disposition", .len = 19}, {.len = 0}}},
     {.data = {{.val = "content-encoding", .len = 16}, {.len = 0}}},
     {.data = {{.val = "content-language", .len = 16}, {.len = 0}}},
     {.data = {{.val = "content-length", .len = 14}, {.len = 0}}},
@@ -516,6 +589,232 @@ err:
 }
 
 /* *****************************************************************************
+Context (dynamic table) implementation
+***************************************************************************** */
+
+static inline void hpack_context_init(hpack_context_s *ctx, size_t limit) {
+  if (limit > HPACK_MAX_TABLE_SIZE)
+    limit = HPACK_MAX_TABLE_SIZE;
+  *ctx = (hpack_context_s){
+      .capa = (limit >> 5) + 1, /* each entry costs at least 32 bytes */
+      .max_size = limit,
+      .limit = limit,
+  };
+  ctx->entries = fio_malloc(sizeof(*ctx->entries) * ctx->capa);
+  FIO_ASSERT_ALLOC(ctx->entries);
+}
+
+/* removes the oldest entry from the dynamic table */
+static inline void hpack_context_evict(hpack_context_s *ctx) {
+  hpack_entry_s *e =
+      ctx->entries + ((ctx->pos + ctx->capa - (ctx->count - 1)) % ctx->capa);
+  ctx->size -= e->name_len + e->value_len + 32;
+  fio_free(e->name);
+  --ctx->count;
+}
+
+static inline void hpack_context_destroy(hpack_context_s *ctx) {
+  while (ctx->count)
+    hpack_context_evict(ctx);
+  fio_free(ctx->entries);
+  *ctx = (hpack_context_s){.entries = NULL};
+}
+
+/* sets the dynamic table's size limit, evicting entries as required */
+static inline void hpack_context_resize(hpack_context_s *ctx, size_t size) {
+  ctx->max_size = size;
+  while (ctx->count && ctx->size > ctx->max_size)
+    hpack_context_evict(ctx);
+}
+
+/* adds an entry to the dynamic table (RFC 7541, section 4.4) */
+static inline void hpack_context_add(hpack_context_s *ctx, char *name,
+                                     size_t name_len, char *value,
+                                     size_t value_len) {
+  const size_t size = name_len + value_len + 32;
+  while (ctx->count && ctx->size + size > ctx->max_size)
+    hpack_context_evict(ctx);
+  if (size > ctx->max_size)
+    return; /* an empty table is the result of adding an oversized entry */
+  char *mem = fio_malloc(name_len + value_len + 1);
+  FIO_ASSERT_ALLOC(mem);
+  memcpy(mem, name, name_len);
+  memcpy(mem + name_len, value, value_len);
+  ctx->pos = (ctx->pos + 1) % ctx->capa;
+  ctx->entries[ctx->pos] = (hpack_entry_s){
+      .name = mem,
+      .name_len = name_len,
+      .value = mem + name_len,
+      .value_len = value_len,
+  };
+  ctx->size += size;
+  ++ctx->count;
+}
+
+/* finds an entry in either the static or dynamic table (1 based index) */
+static inline int hpack_context_find(hpack_context_s *ctx, uint64_t index,
+                                     const char **name, size_t *name_len,
+                                     const char **value, size_t *value_len) {
+  if (!index)
+    return -1;
+  if (index < 62) {
+    hpack_header_static_find(index, 0, name, name_len);
+    hpack_header_static_find(index, 1, value, value_len);
+    return 0;
+  }
+  index -= 62;
+  if (index >= ctx->count)
+    return -1;
+  hpack_entry_s *e = ctx->entries + ((ctx->pos + ctx->capa - index) % ctx->capa);
+  *name = e->name;
+  *name_len = e->name_len;
+  *value = e->value;
+  *value_len = e->value_len;
+  return 0;
+}
+
+static MAYBE_UNUSED int hpack_decode(hpack_context_s *ctx, void *data_,
+                                     size_t len,
+                                     int (*on_header)(void *udata, char *name,
+                                                      size_t name_len,
+                                                      char *value,
+                                                      size_t value_len),
+                                     void *udata) {
+  uint8_t *data = (uint8_t *)data_;
+  /* names are decoded to the start of the buffer, values after the name */
+  char buf[HPACK_BUFFER_SIZE];
+  size_t pos = 0;
+  uint8_t table_update_allowed = 1;
+  while (pos < len) {
+    const uint8_t type = data[pos];
+    const char *name = NULL, *value = NULL;
+    size_t name_len = 0, value_len = 0;
+    int64_t index;
+    uint8_t add = 0;
+    if ((type & 0xE0) == 0x20) {
+      /* dynamic table size update (only allowed at the start) */
+      index = hpack_int_unpack(data, len, 5, &pos);
+      if (index < 0 || (size_t)index > ctx->limit || !table_update_allowed)
+        return -1;
+      hpack_context_resize(ctx, (size_t)index);
+      continue;
+    }
+    table_update_allowed = 0;
+    if (type & 0x80) {
+      /* indexed header field */
+      index = hpack_int_unpack(data, len, 7, &pos);
+      if (index < 0 || hpack_context_find(ctx, (uint64_t)index, &name,
+                                          &name_len, &value, &value_len))
+        return -1;
+      goto found;
+    }
+    /* literal header field (with incremental indexing, without indexing or
+     * never indexed) */
+    add = ((type & 0xC0) == 0x40);
+    index = hpack_int_unpack(data, len, (add ? 6 : 4), &pos);
+    if (index < 0 || pos >= len)
+      return -1;
+    if (index) {
+      const char *ignr;
+      size_t ignr_len;
+      if (hpack_context_find(ctx, (uint64_t)index, &name, &name_len, &ignr,
+                             &ignr_len) ||
+          name_len > sizeof(buf))
+        return -1;
+      memcpy(buf, name, name_len); /* the entry might be evicted */
+    } else {
+      int l = hpack_string_unpack(buf, sizeof(buf), data, len, &pos);
+      if (l < 0 || (size_t)l > sizeof(buf) || pos >= len)
+        return -1;
+      name_len = (size_t)l;
+    }
+    name = buf;
+    {
+      int l = hpack_string_unpack(buf + name_len, sizeof(buf) - name_len, data,
+                                  len, &pos);
+      if (l < 0 || (size_t)l > sizeof(buf) - name_len)
+        return -1;
+      value = buf + name_len;
+      value_len = (size_t)l;
+    }
+    if (add)
+      hpack_context_add(ctx, (char *)name, name_len, (char *)value, value_len);
+  found:
+    if (on_header &&
+        on_header(udata, (char *)name, name_len, (char *)value, value_len))
+      on_header = NULL;
+  }
+  return 0;
+}
+
+/* finds a static table entry, preferring an exact (name and value) match */
+static inline int hpack_header_static_index(const char *name, size_t name_len,
+                                            const char *value, size_t value_len,
+                                            uint8_t *exact) {
+  int found = 0;
+  *exact = 0;
+  for (int i = 1; i < 62; ++i) {
+    if (hpack_static_table[i].data[0].len != name_len ||
+        memcmp(hpack_static_table[i].data[0].val, name, name_len))
+      continue;
+    if (!found)
+      found = i;
+    if (hpack_static_table[i].data[1].len == value_len &&
+        (!value_len ||
+         !memcmp(hpack_static_table[i].data[1].val, value, value_len))) {
+      *exact = 1;
+      return i;
+    }
+  }
+  return found;
+}
+
+/* packs a string, Huffman encoding it only when it's shorter */
+static inline int hpack_header_string_pack(uint8_t *dest, size_t limit,
+                                           const char *str, size_t len) {
+  int comp_len = hpack_huffman_pack(NULL, 0, (void *)str, len);
+  uint8_t compress = comp_len < (int)len;
+  int required =
+      hpack_int_pack(NULL, 0, (compress ? (size_t)comp_len : len), 7) +
+      (compress ? comp_len : (int)len);
+  /* the Huffman encoder requires a spare byte in the destination buffer */
+  if ((size_t)required + compress > limit)
+    return required + compress;
+  return hpack_string_pack(dest, limit, (void *)str, len, compress);
+}
+
+static MAYBE_UNUSED int hpack_header_pack(void *dest_, size_t limit,
+                                          const char *name, size_t name_len,
+                                          const char *value,
+                                          size_t value_len) {
+  uint8_t *dest = (uint8_t *)dest_;
+  uint8_t exact;
+  int index = hpack_header_static_index(name, name_len, value, value_len, &exact);
+  if (exact) {
+    /* indexed header field */
+    if (!limit)
+      return hpack_int_pack(NULL, 0, index, 7);
+    dest[0] = 0x80;
+    return hpack_int_pack(dest, limit, index, 7);
+  }
+  /* literal header field without indexing */
+  int len = hpack_int_pack(NULL, 0, index, 4);
+  if ((size_t)len <= limit) {
+    dest[0] = 0;
+    hpack_int_pack(dest, limit, index, 4);
+  }
+  if (!index) {
+    len += hpack_header_string_pack((limit ? dest + len : NULL),
+                                    ((size_t)len < limit ? limit - len : 0),
+                                    name, name_len);
+  }
+  len += hpack_header_string_pack((limit ? dest + len : NULL),
+                                  ((size_t)len < limit ? limit - len : 0),
+                                  value, value_len);
+  return len;
+}
+
+/* *****************************************************************************
 
 
 
@@ -537,6 +836,20 @@ err:
 #include <inttypes.h>
 #include <stdio.h>
 
+/* collects the last header as "name:value" */
+static int hpack_test_on_header(void *udata, char *name, size_t name_len,
+                                char *value, size_t value_len) {
+  struct {
+    size_t count;
+    size_t len;
+    char last[64];
+  } *c = udata;
+  ++c->count;
+  c->len = (size_t)snprintf(c->last, sizeof(c->last), "%.*s:%.*s",
+                            (int)name_len, name, (int)value_len, value);
+  return 0;
+}
+
 void hpack_test(void) {
   uint8_t buffer[1 << 15];
   const size_t limit = (1 << 15);
@@ -822,6 +1135,82 @@ void hpack_test(void) {
               count, repeats);
     }
   }
+  {
+    /* test the dynamic table using RFC 7541, Appendix C.3 and C.4 */
+    struct {
+      size_t count;
+      size_t len;
+      char last[64];
+    } collected;
+    struct {
+      const char *data;
+      size_t len;
+      size_t count;
+      const char *last;
+      size_t table_size;
+    } examples[] = {
+        {"\x82\x86\x84\x41\x0f\x77\x77\x77\x2e\x65\x78\x61\x6d\x70\x6c\x65"
+         "\x2e\x63\x6f\x6d",
+         20, 4, ":authority:www.example.com", 57},
+        {"\x82\x86\x84\xbe\x58\x08\x6e\x6f\x2d\x63\x61\x63\x68\x65", 14, 5,
+         "cache-control:no-cache", 110},
+        {"\x82\x87\x85\xbf\x40\x0a\x63\x75\x73\x74\x6f\x6d\x2d\x6b\x65\x79"
+         "\x0c\x63\x75\x73\x74\x6f\x6d\x2d\x76\x61\x6c\x75\x65",
+         29, 5, "custom-key:custom-value", 164},
+    };
+    hpack_context_s ctx;
+    hpack_context_init(&ctx, 4096);
+    fprintf(stderr, "* HPACK testing dynamic table (RFC 7541, C.3).\n");
+    for (size_t i = 0; i < sizeof(examples) / sizeof(examples[0]); ++i) {
+      collected.count = 0;
+      FIO_ASSERT(!hpack_decode(&ctx, (void *)examples[i].data, examples[i].len,
+                               hpack_test_on_header, &collected),
+                 "HPACK decoding error for example %zu", i);
+      FIO_ASSERT(collected.count == examples[i].count &&
+                     !strcmp(collected.last, examples[i].last),
+                 "HPACK decoding example %zu mismatch (%zu headers, %s)", i,
+                 collected.count, collected.last);
+      FIO_ASSERT(ctx.size == examples[i].table_size,
+                 "HPACK dynamic table size error for example %zu (%zu)", i,
+                 ctx.size);
+    }
+    hpack_context_destroy(&ctx);
+    /* the Huffman encoded version of C.3.1 (RFC 7541, C.4.1) */
+    hpack_context_init(&ctx, 4096);
+    collected.count = 0;
+    FIO_ASSERT(!hpack_decode(&ctx, (void *)
+                             "\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a\x6b"
+                             "\xa0\xab\x90\xf4\xff",
+                             17, hpack_test_on_header, &collected) &&
+                   collected.count == 4 &&
+                   !strcmp(collected.last, ":authority:www.example.com") &&
+                   ctx.size == 57,
+               "HPACK Huffman decoding error (RFC 7541, C.4.1)");
+    /* a size update that exceeds the advertised limit is an error */
+    FIO_ASSERT(hpack_decode(&ctx, (void *)"\x3f\xe2\x1f", 3, NULL, NULL) == -1,
+               "HPACK dynamic table size update should have been limited");
+    hpack_context_destroy(&ctx);
+    /* round trip through the encoder */
+    hpack_context_init(&ctx, 4096);
+    buf_pos = 0;
+    buf_pos += hpack_header_pack(buffer + buf_pos, limit - buf_pos, ":status",
+                                 7, "200", 3);
+    FIO_ASSERT(buf_pos == 1 && buffer[0] == 0x88,
+               "HPACK static table exact match should be indexed");
+    buf_pos += hpack_header_pack(buffer + buf_pos, limit - buf_pos,
+                                 "content-type", 12, "text/plain", 10);
+    buf_pos += hpack_header_pack(buffer + buf_pos, limit - buf_pos, "x-custom",
+                                 8, "a custom header value", 21);
+    collected.count = 0;
+    FIO_ASSERT(!hpack_decode(&ctx, buffer, buf_pos, hpack_test_on_header,
+                             &collected) &&
+                   collected.count == 3 &&
+                   !strcmp(collected.last, "x-custom:a custom header value") &&
+                   ctx.size == 0,
+               "HPACK encoder round trip error");
+    hpack_context_destroy(&ctx);
+    fprintf(stderr, "* HPACK dynamic table test complete.\n");
+  }
 }
 #else
 
@@ -123,6 +123,170 @@ inline static uint8_t seek2eol(uint8_t **pos, uint8_t *const limit) {
   return 1;
 }
 
+/* *****************************************************************************
+Seeking for structural characters (SIMD)
+
+The request line and header names are scanned 16 bytes at a time, finding all
+the structural characters in a single pass. SSE2 is part of the x86_64 baseline
+and NEON is part of the AArch64 baseline, so no runtime detection is required.
+***************************************************************************** */
+
+#ifndef HTTP1_PARSER_SIMD
+#if defined(__SSE2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+#define HTTP1_PARSER_SIMD 1
+#else
+#define HTTP1_PARSER_SIMD 0
+#endif
+#endif
+
+#if HTTP1_PARSER_SIMD && defined(__SSE2__)
+#include <emmintrin.h>
+#elif HTTP1_PARSER_SIMD && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#else
+#undef HTTP1_PARSER_SIMD
+#define HTTP1_PARSER_SIMD 0
+#endif
+
+#if HTTP1_PARSER_SIMD && defined(__SSE2__)
+
+typedef __m128i http1_vec_s;
+#define HTTP1_VEC_LOAD(ptr) _mm_loadu_si128((const __m128i *)(ptr))
+#define HTTP1_VEC_STORE(ptr, v) _mm_storeu_si128((__m128i *)(ptr), (v))
+#define HTTP1_VEC_DUP(c) _mm_set1_epi8((char)(c))
+#define HTTP1_VEC_EQ(a, b) _mm_cmpeq_epi8((a), (b))
+#define HTTP1_VEC_OR(a, b) _mm_or_si128((a), (b))
+/* unsigned `a <= b` */
+#define HTTP1_VEC_LE(a, b) _mm_cmpeq_epi8(_mm_min_epu8((a), (b)), (a))
+/* a bitmap with one bit per byte */
+#define HTTP1_VEC_MASK(v) ((uint64_t)_mm_movemask_epi8((v)))
+#define HTTP1_VEC_MASK_INDEX(m) ((size_t)__builtin_ctzll((m)))
+/* sets the 0x20 bit for 'A'-'Z' (bytes above 127 are negative, unaffected) */
+#define HTTP1_VEC_TOLOWER(v)                                                   \
+  _mm_or_si128((v), _mm_and_si128(                                             \
+                        _mm_and_si128(_mm_cmpgt_epi8((v), HTTP1_VEC_DUP(64)),  \
+                                      _mm_cmplt_epi8((v), HTTP1_VEC_DUP(91))), \
+                        HTTP1_VEC_DUP(32)))
+
+#elif HTTP1_PARSER_SIMD
+
+typedef uint8x16_t http1_vec_s;
+#define HTTP1_VEC_LOAD(ptr) vld1q_u8((const uint8_t *)(ptr))
+#define HTTP1_VEC_STORE(ptr, v) vst1q_u8((uint8_t *)(ptr), (v))
+#define HTTP1_VEC_DUP(c) vdupq_n_u8((uint8_t)(c))
+#define HTTP1_VEC_EQ(a, b) vceqq_u8((a), (b))
+#define HTTP1_VEC_OR(a, b) vorrq_u8((a), (b))
+#define HTTP1_VEC_LE(a, b) vcleq_u8((a), (b))
+/* a bitmap with 4 bits per byte (narrowing shift) */
+#define HTTP1_VEC_MASK(v)                                                      \
+  vget_lane_u64(                                                               \
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8((v)), 4)), 0)
+#define HTTP1_VEC_MASK_INDEX(m) ((size_t)(__builtin_ctzll((m)) >> 2))
+#define HTTP1_VEC_TOLOWER(v)                                                   \
+  vorrq_u8((v), vandq_u8(vandq_u8(vcgeq_u8((v), HTTP1_VEC_DUP('A')),           \
+                                  vcleq_u8((v), HTTP1_VEC_DUP('Z'))),          \
+                         HTTP1_VEC_DUP(32)))
+
+#endif
+
+/**
+ * Returns a pointer to the first `a` or `b` character (or `limit`).
+ *
+ * Used for finding the end of the request target's path, which might end
+ * with either a query (`?`) or a space.
+ */
+inline static uint8_t *seek2any(uint8_t *pos, uint8_t *const limit,
+                                const uint8_t a, const uint8_t b) {
+#if HTTP1_PARSER_SIMD
+  const http1_vec_s va = HTTP1_VEC_DUP(a);
+  const http1_vec_s vb = HTTP1_VEC_DUP(b);
+  for (; pos + 16 <= limit; pos += 16) {
+    const http1_vec_s v = HTTP1_VEC_LOAD(pos);
+    const uint64_t m =
+        HTTP1_VEC_MASK(HTTP1_VEC_OR(HTTP1_VEC_EQ(v, va), HTTP1_VEC_EQ(v, vb)));
+    if (m)
+      return pos + HTTP1_VEC_MASK_INDEX(m);
+  }
+#endif
+  while (pos < limit && *pos != a && *pos != b)
+    ++pos;
+  return pos;
+}
+
+/**
+ * Returns a pointer to the end of a header name - the first `:` or any byte
+ * that isn't valid in a header name (SP, CTL or DEL), or `limit`.
+ *
+ * When HTTP_HEADERS_LOWERCASE is set, the name is converted to lowercase during
+ * the same pass.
+ */
+inline static uint8_t *seek2header_end(uint8_t *pos, uint8_t *const limit) {
+#if HTTP1_PARSER_SIMD
+  const http1_vec_s colon = HTTP1_VEC_DUP(':');
+  const http1_vec_s space = HTTP1_VEC_DUP(' ');
+  const http1_vec_s del = HTTP1_VEC_DUP(127);
+  for (; pos + 16 <= limit; pos += 16) {
+    const http1_vec_s v = HTTP1_VEC_LOAD(pos);
+    const uint64_t m = HTTP1_VEC_MASK(HTTP1_VEC_OR(
+        HTTP1_VEC_OR(HTTP1_VEC_EQ(v, colon), HTTP1_VEC_LE(v, space)),
+        HTTP1_VEC_EQ(v, del)));
+    if (m)
+      break; /* the last (partial) block is handled byte by byte */
+#if HTTP_HEADERS_LOWERCASE
+    HTTP1_VEC_STORE(pos, HTTP1_VEC_TOLOWER(v));
+#endif
+  }
+#endif
+  for (; pos < limit && *pos != ':' && *pos > ' ' && *pos != 127; ++pos) {
+#if HTTP_HEADERS_LOWERCASE
+    *pos = tolower(*pos);
+#endif
+  }
+  return pos;
+}
+
+/* *****************************************************************************
+Parsing numbers (Content-Length values and chunk lengths)
+***************************************************************************** */
+
+/* parses a decimal length, returns -1 if the value doesn't start with digits */
+inline static int64_t http1_atol(uint8_t *pos) {
+  while (*pos == ' ' || *pos == '\t')
+    ++pos;
+  if ((uint8_t)(*pos - '0') > 9)
+    return -1; /* also a negative value */
+  int64_t i = 0;
+  for (size_t digits = 0; (uint8_t)(*pos - '0') <= 9; ++pos) {
+    if (++digits > 18)
+      return INT64_MAX; /* larger than any possible body */
+    i = (i * 10) + (*pos - '0');
+  }
+  return i;
+}
+
+/* parses a hex chunk length, returns -1 if there are no digits (or overflow) */
+inline static int64_t http1_atol16(uint8_t *pos) {
+  while (*pos == ' ' || *pos == '\t')
+    ++pos;
+  uint8_t *const start = pos;
+  while (*pos == '0')
+    ++pos;
+  int64_t i = 0;
+  for (size_t digits = 0;; ++pos) {
+    uint8_t digit = *pos - '0';
+    if (digit > 9) {
+      digit = (*pos | 32) - 'a';
+      if (digit > 5)
+        break;
+      digit += 10;
+    }
+    if (++digits > 15)
+      return -1;
+    i = (i << 4) | digit;
+  }
+  return (pos == start ? -1 : i);
+}
+
 /* *****************************************************************************
 HTTP/1.1 parsre stages
 ***************************************************************************** */
@@ -177,8 +341,14 @@ inline static int consume_request_line(struct http1_fio_parser_args_s *args,
     start = host_end;
   }
 review_path:
-  tmp = start;
-  if (seek2ch(&tmp, end, '?')) {
+  /* a single pass finds the end of the path (query or version) */
+  tmp = seek2any(start, end, '?', ' ');
+  if (tmp >= end || tmp == start)
+    return -1;
+  if (*tmp == '?') {
+#if HTTP1_PARSER_CONVERT_EOL2NUL
+    *tmp = 0;
+#endif
     if (args->on_path(args->parser, (char *)start, tmp - start))
       return -1;
     tmp = start = tmp + 1;
@@ -188,9 +358,9 @@ review_path:
         args->on_query(args->parser, (char *)start, tmp - start))
       return -1;
   } else {
-    tmp = start;
-    if (!seek2ch(&tmp, end, ' '))
-      return -1;
+#if HTTP1_PARSER_CONVERT_EOL2NUL
+    *tmp = 0;
+#endif
     if (args->on_path(args->parser, (char *)start, tmp - start))
       return -1;
   }
@@ -209,14 +379,12 @@ start_version:
 
 inline static int consume_header(struct http1_fio_parser_args_s *args,
                                  uint8_t *start, uint8_t *end) {
-  uint8_t *end_name = start;
-  /* divide header name from data */
-  if (!seek2ch(&end_name, end, ':'))
+  /* divide header name from data, validating (and lowercasing) the name */
+  uint8_t *end_name = seek2header_end(start, end);
+  if (end_name >= end || end_name == start || *end_name != ':')
     return -1;
-#if HTTP_HEADERS_LOWERCASE
-  for (uint8_t *t = start; t < end_name; t++) {
-    *t = tolower(*t);
-  }
+#if HTTP1_PARSER_CONVERT_EOL2NUL
+  *end_name = 0;
 #endif
   uint8_t *start_value = end_name + 1;
   if (start_value[0] == ' ') {
@@ -228,7 +396,8 @@ inline static int consume_header(struct http1_fio_parser_args_s *args,
       *((uint64_t *)start) == *((uint64_t *)"content-") &&
       *((uint64_t *)(start + 6)) == *((uint64_t *)"t-length")) {
     /* handle the special `content-length` header */
-    args->parser->state.content_length = atol((char *)start_value);
+    if ((args->parser->state.content_length = http1_atol(start_value)) < 0)
+      return -1;
   } else if ((end_name - start) == 17 &&
              *((uint64_t *)start) == *((uint64_t *)"transfer") &&
              *((uint64_t *)(start + 8)) == *((uint64_t *)"-encodin") &&
@@ -246,10 +415,11 @@ inline static int consume_header(struct http1_fio_parser_args_s *args,
   if ((end_name - start) == 14 &&
       HEADER_NAME_IS_EQ((char *)start, "content-length", 14)) {
     /* handle the special `content-length` header */
-    args->parser->state.content_length = atol((char *)start_value);
+    if ((args->parser->state.content_length = http1_atol(start_value)) < 0)
+      return -1;
   } else if ((end_name - start) == 17 &&
              HEADER_NAME_IS_EQ((char *)start, "transfer-encoding", 17) &&
-             memcmp(start_value, "chunked", 7)) {
+             (end - start_value) >= 7 && !memcmp(start_value, "chunked", 7)) {
     /* handle the special `transfer-encoding: chunked` header */
     args->parser->state.reserved |= 64;
   } else if ((end_name - start) == 7 &&
@@ -293,20 +463,21 @@ inline static int consume_body_chunked(struct http1_fio_parser_args_s *args,
   uint8_t *end = *start;
   while (*start < stop) {
     if (args->parser->state.content_length == 0) {
-      size_t eol_len;
-      /* consume seperator */
+      /* consume seperator (the previous chunk's EOL) */
       while (*start < stop && (**start == '\n' || **start == '\r'))
         ++(*start);
       /* collect chunked length */
-      if (!(eol_len = seek2eol(&end, stop))) {
+      end = *start;
+      if (!seek2eol(&end, stop)) {
         /* requires length data to continue */
         return 0;
       }
-      /* an empty EOL is possible in mid stream processing */
-      if (*start + eol_len > end && (*start = end) && !seek2eol(&end, stop)) {
-        return 0;
+      {
+        const int64_t chunk_len = http1_atol16(*start);
+        if (chunk_len < 0)
+          return -1;
+        args->parser->state.content_length = 0 - chunk_len;
       }
-      args->parser->state.content_length = 0 - strtol((char *)*start, NULL, 16);
       *start = end = end + 1;
       if (args->parser->state.content_length == 0) {
         /* all chunked data was parsed */
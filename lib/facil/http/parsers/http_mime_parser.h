@@ -155,13 +155,17 @@ consume_partial:
               memcmp(end + 2, parser->boundary, parser->boundary_len)));
     if (!end) {
       end = (char *)stop;
+      /* a trailing '\r' might belong to the next boundary's EOL */
+      if (end > start && end[-1] == '\r')
+        --end;
       pos = end;
       if (end - start)
         http_mime_parser_on_partial_data(parser, start, (size_t)(end - start));
       goto end_of_data;
     } else if (end + 4 + parser->boundary_len >= stop) {
-      end -= 2;
-      if (end[0] == '\r')
+      /* might be a boundary, keep the EOL until more data is available */
+      --end;
+      if (end > start && end[-1] == '\r')
         --end;
       pos = end;
       if (end - start)
@@ -169,7 +173,7 @@ consume_partial:
       goto end_of_data;
     }
     size_t len = (end - start) - 1;
-    if (start[len - 1] == '\r')
+    if (len && start[len - 1] == '\r')
       --len;
     if (len)
       http_mime_parser_on_partial_data(parser, start, len);
@@ -205,7 +209,7 @@ consume_partial:
       goto done;
     }
     start = pos + 3 + parser->boundary_len;
-    if (start[0] == '\n') {
+    if (start < stop && start[0] == '\n') {
       /* should be true, unless new line marker was just '\n' */
       ++start;
     }
@@ -300,6 +304,12 @@ consume_partial:
       if (header_count++ > 4)
         goto error;
     }
+    if (start + 1 >= stop || (start[0] != '\n' && start[1] != '\n')) {
+      /* the headers are incomplete (streaming) */
+      if (first_run)
+        goto error;
+      goto end_of_data;
+    }
     if (!name) {
       if (start + 4 >= stop)
         goto end_of_data;
@@ -308,7 +318,7 @@ consume_partial:
 
     /* advance to end of boundry */
     ++start;
-    if (start[0] == '\n')
+    if (start < stop && start[0] == '\n')
       ++start;
     value = start;
     end = start;
@@ -134,6 +134,44 @@ API - Internal Helpers
 /** used internally to mask and unmask client messages. */
 inline static void websocket_xmask(void *msg, uint64_t len, uint32_t mask);
 
+/** the portable (word by word) masking implementation. */
+inline static void websocket_xmask_scalar(void *msg, uint64_t len,
+                                          uint32_t mask);
+
+/* *****************************************************************************
+Compile Time Settings
+***************************************************************************** */
+
+#ifndef WEBSOCKET_XMASK_SIMD
+/**
+ * Set to 0 to disable the SIMD masking implementations.
+ *
+ * SSE2 (x86_64) and NEON (AArch64) are part of the architecture's baseline.
+ * AVX2 is detected at runtime (unless the compiler already targets AVX2).
+ */
+#if defined(__SSE2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+#define WEBSOCKET_XMASK_SIMD 1
+#else
+#define WEBSOCKET_XMASK_SIMD 0
+#endif
+#endif
+
+#if WEBSOCKET_XMASK_SIMD && defined(__SSE2__)
+#include <immintrin.h>
+#if defined(__AVX2__)
+#define WEBSOCKET_XMASK_AVX2 1 /* always available */
+#elif defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define WEBSOCKET_XMASK_AVX2 2 /* detected at runtime */
+#else
+#define WEBSOCKET_XMASK_AVX2 0
+#endif
+#elif WEBSOCKET_XMASK_SIMD && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#else
+#undef WEBSOCKET_XMASK_SIMD
+#define WEBSOCKET_XMASK_SIMD 0
+#endif
+
 /* *****************************************************************************
 
                                 Implementation
@@ -143,8 +181,8 @@ inline static void websocket_xmask(void *msg, uint64_t len, uint32_t mask);
 /* *****************************************************************************
 Message masking
 ***************************************************************************** */
-/** used internally to mask and unmask client messages. */
-void websocket_xmask(void *msg, uint64_t len, uint32_t mask) {
+/** the portable (word by word) masking implementation. */
+void websocket_xmask_scalar(void *msg, uint64_t len, uint32_t mask) {
   if (len > 7) {
     { /* XOR any unaligned memory (4 byte alignment) */
       const uintptr_t offset = 4 - ((uintptr_t)msg & 3);
@@ -217,6 +255,113 @@ void websocket_xmask(void *msg, uint64_t len, uint32_t mask) {
   }
 }
 
+/*
+ * The SIMD implementations XOR 16 (or 32) bytes at a time using unaligned
+ * loads. Vector lengths are a multiple of 4, so the mask never rotates and the
+ * remaining bytes are handled by the scalar implementation.
+ */
+
+#if WEBSOCKET_XMASK_SIMD && defined(__SSE2__)
+/** SSE2 masking (x86_64 baseline). */
+inline static void websocket_xmask_sse2(void *msg, uint64_t len,
+                                        uint32_t mask) {
+  const __m128i m = _mm_set1_epi32((int)mask);
+  uint8_t *pos = (uint8_t *)msg;
+  for (; len >= 64; len -= 64, pos += 64) {
+    __m128i v0 = _mm_loadu_si128((__m128i *)pos);
+    __m128i v1 = _mm_loadu_si128((__m128i *)(pos + 16));
+    __m128i v2 = _mm_loadu_si128((__m128i *)(pos + 32));
+    __m128i v3 = _mm_loadu_si128((__m128i *)(pos + 48));
+    _mm_storeu_si128((__m128i *)pos, _mm_xor_si128(v0, m));
+    _mm_storeu_si128((__m128i *)(pos + 16), _mm_xor_si128(v1, m));
+    _mm_storeu_si128((__m128i *)(pos + 32), _mm_xor_si128(v2, m));
+    _mm_storeu_si128((__m128i *)(pos + 48), _mm_xor_si128(v3, m));
+  }
+  for (; len >= 16; len -= 16, pos += 16) {
+    _mm_storeu_si128((__m128i *)pos,
+                     _mm_xor_si128(_mm_loadu_si128((__m128i *)pos), m));
+  }
+  websocket_xmask_scalar(pos, len, mask);
+}
+#endif
+
+#if WEBSOCKET_XMASK_SIMD && WEBSOCKET_XMASK_AVX2
+/** AVX2 masking. */
+#if WEBSOCKET_XMASK_AVX2 == 2
+__attribute__((target("avx2")))
+#endif
+inline static void
+websocket_xmask_avx2(void *msg, uint64_t len, uint32_t mask) {
+  const __m256i m = _mm256_set1_epi32((int)mask);
+  uint8_t *pos = (uint8_t *)msg;
+  for (; len >= 128; len -= 128, pos += 128) {
+    __m256i v0 = _mm256_loadu_si256((__m256i *)pos);
+    __m256i v1 = _mm256_loadu_si256((__m256i *)(pos + 32));
+    __m256i v2 = _mm256_loadu_si256((__m256i *)(pos + 64));
+    __m256i v3 = _mm256_loadu_si256((__m256i *)(pos + 96));
+    _mm256_storeu_si256((__m256i *)pos, _mm256_xor_si256(v0, m));
+    _mm256_storeu_si256((__m256i *)(pos + 32), _mm256_xor_si256(v1, m));
+    _mm256_storeu_si256((__m256i *)(pos + 64), _mm256_xor_si256(v2, m));
+    _mm256_storeu_si256((__m256i *)(pos + 96), _mm256_xor_si256(v3, m));
+  }
+  for (; len >= 32; len -= 32, pos += 32) {
+    _mm256_storeu_si256(
+        (__m256i *)pos,
+        _mm256_xor_si256(_mm256_loadu_si256((__m256i *)pos), m));
+  }
+  websocket_xmask_scalar(pos, len, mask);
+}
+#endif
+
+#if WEBSOCKET_XMASK_SIMD && defined(__ARM_NEON)
+/** NEON masking (AArch64 baseline). */
+inline static void websocket_xmask_neon(void *msg, uint64_t len,
+                                        uint32_t mask) {
+  const uint8x16_t m = vreinterpretq_u8_u32(vdupq_n_u32(mask));
+  uint8_t *pos = (uint8_t *)msg;
+  for (; len >= 64; len -= 64, pos += 64) {
+    uint8x16_t v0 = vld1q_u8(pos);
+    uint8x16_t v1 = vld1q_u8(pos + 16);
+    uint8x16_t v2 = vld1q_u8(pos + 32);
+    uint8x16_t v3 = vld1q_u8(pos + 48);
+    vst1q_u8(pos, veorq_u8(v0, m));
+    vst1q_u8(pos + 16, veorq_u8(v1, m));
+    vst1q_u8(pos + 32, veorq_u8(v2, m));
+    vst1q_u8(pos + 48, veorq_u8(v3, m));
+  }
+  for (; len >= 16; len -= 16, pos += 16) {
+    vst1q_u8(pos, veorq_u8(vld1q_u8(pos), m));
+  }
+  websocket_xmask_scalar(pos, len, mask);
+}
+#endif
+
+/** used internally to mask and unmask client messages. */
+void websocket_xmask(void *msg, uint64_t len, uint32_t mask) {
+#if WEBSOCKET_XMASK_SIMD
+  if (len < 16) {
+    websocket_xmask_scalar(msg, len, mask);
+    return;
+  }
+#if WEBSOCKET_XMASK_AVX2 == 1
+  websocket_xmask_avx2(msg, len, mask);
+#elif WEBSOCKET_XMASK_AVX2 == 2
+  /* runtime detection (a benign race - all threads store the same value) */
+  static void (*xmask)(void *, uint64_t, uint32_t) = NULL;
+  if (!xmask)
+    xmask = (__builtin_cpu_supports("avx2") ? websocket_xmask_avx2
+                                            : websocket_xmask_sse2);
+  xmask(msg, len, mask);
+#elif defined(__SSE2__)
+  websocket_xmask_sse2(msg, len, mask);
+#else
+  websocket_xmask_neon(msg, len, mask);
+#endif
+#else
+  websocket_xmask_scalar(msg, len, mask);
+#endif
+}
+
 /* *****************************************************************************
 Message wrapping
 ***************************************************************************** */
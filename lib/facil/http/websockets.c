@@ -26,6 +26,10 @@ Feel free to copy, use and enjoy according to the license provided.
 
 #include <websocket_parser.h>
 
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #if !defined(__BIG_ENDIAN__) && !defined(__LITTLE_ENDIAN__)
 #include <endian.h>
 #if !defined(__BIG_ENDIAN__) && !defined(__LITTLE_ENDIAN__) &&                 \
@@ -57,6 +61,16 @@ void free_ws_buffer(ws_s *owner, struct buffer_s);
 /** Sets the initial buffer size. (4Kb)*/
 #define WS_INITIAL_BUFFER_SIZE 4096UL
 
+#ifndef WS_SHARED_BUFFER_SIZE
+/**
+ * The size of the (per thread) buffer used for reading from the socket.
+ *
+ * Connections only keep a buffer of their own while a partial frame is
+ * pending, so idle connections don't hold any buffer memory.
+ */
+#define WS_SHARED_BUFFER_SIZE 16384UL
+#endif
+
 /*******************************************************************************
 Buffer management - simple implementation...
 Since Websocket connections have a long life expectancy, optimizing this part of
@@ -109,6 +123,8 @@ struct ws_s {
   intptr_t fd;
   /** callbacks */
   void (*on_message)(ws_s *ws, fio_str_info_s msg, uint8_t is_text);
+  void (*on_message_chunk)(ws_s *ws, fio_str_info_s chunk, uint8_t first,
+                           uint8_t last, uint8_t is_text);
   void (*on_shutdown)(ws_s *ws);
   void (*on_ready)(ws_s *ws);
   void (*on_open)(ws_s *ws);
@@ -130,8 +146,344 @@ struct ws_s {
   uint8_t is_text;
   /** websocket connection type. */
   uint8_t is_client;
+  /** permessage-deflate flags (see WEBSOCKET_DEFLATE_ON). */
+  uint8_t deflate;
+  /** latest message compression state (RSV1). */
+  uint8_t is_deflated;
+  /** protects the compression context and the order of compressed writes. */
+  fio_lock_i deflate_lock;
+  /** connection specific compression contexts (allocated when required). */
+  void *deflater;
+  void *inflater;
+  /** streamed frame: the payload left and the payload already delivered. */
+  uint64_t stream_left;
+  uint64_t stream_pos;
+  /** streamed frame: the frame's mask. */
+  uint32_t stream_mask;
+  /** streamed frame: the frame's FIN and masking flags. */
+  uint8_t stream_fin;
+  uint8_t stream_masked;
+  /** streamed message state (1 - streaming, 2 - next chunk is the first) */
+  uint8_t streaming;
+  /** a fragmented message is in progress (continuation frames expected). */
+  uint8_t fragmented;
 };
 
+/* *****************************************************************************
+permessage-deflate (RFC 7692)
+***************************************************************************** */
+
+#define WS_DEFLATE_RESPONSE(ext)                                               \
+  ((fio_str_info_s){.data = (char *)(ext), .len = sizeof(ext) - 1})
+
+#if HAVE_ZLIB
+/** Returns the length of the token starting at `p` (up to `end`). */
+static size_t websocket_deflate_token(const char *p, const char *end) {
+  const char *start = p;
+  while (p < end && *p != ';' && *p != ',' && *p != '=' && *p != ' ' &&
+         *p != '\t' && *p != '"')
+    ++p;
+  return p - start;
+}
+#endif
+
+/**
+ * Negotiates the permessage-deflate extension, picking the first acceptable
+ * offer.
+ */
+uint8_t websocket_deflate_negotiate(fio_str_info_s offers, uint8_t mode,
+                                    fio_str_info_s *response) {
+#if HAVE_ZLIB
+  if (!mode || !offers.data)
+    return 0;
+  const char *p = offers.data;
+  const char *end = offers.data + offers.len;
+  while (p < end) {
+    /* extension name */
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+      ++p;
+    size_t len = websocket_deflate_token(p, end);
+    uint8_t accept = (len == 18 && !strncasecmp(p, "permessage-deflate", 18));
+    uint8_t flags = WEBSOCKET_DEFLATE_ON;
+    if (mode > 1)
+      flags |= WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT |
+               WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT;
+    /* extension parameters */
+    uint8_t seen = 0;
+    p += len;
+    while (p < end && *p != ',') {
+      while (p < end && (*p == ' ' || *p == '\t' || *p == ';'))
+        ++p;
+      const char *name = p;
+      len = websocket_deflate_token(p, end);
+      p += len;
+      while (p < end && (*p == ' ' || *p == '\t'))
+        ++p;
+      const char *value = NULL;
+      size_t value_len = 0;
+      if (p < end && *p == '=') {
+        ++p;
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '"'))
+          ++p;
+        value = p;
+        value_len = websocket_deflate_token(p, end);
+        p += value_len;
+        if (p < end && *p == '"')
+          ++p;
+      }
+      if (!len) {
+        /* malformed parameter (skip any stray character) */
+        if (value || (p < end && *p != ','))
+          accept = 0;
+        if (!value && p < end && *p != ',')
+          ++p;
+        continue;
+      }
+      uint8_t bit = 0;
+      if (len == 26 && !strncasecmp(name, "server_no_context_takeover", 26) &&
+          !value) {
+        bit = 1;
+        flags |= WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT;
+      } else if (len == 26 &&
+                 !strncasecmp(name, "client_no_context_takeover", 26) &&
+                 !value) {
+        bit = 2;
+        flags |= WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT;
+      } else if (len == 22 &&
+                 !strncasecmp(name, "client_max_window_bits", 22)) {
+        /* our decompression window is always large enough */
+        bit = 4;
+      } else if (len == 22 &&
+                 !strncasecmp(name, "server_max_window_bits", 22) &&
+                 value_len == 2 && value[0] == '1' && value[1] == '5') {
+        /* smaller windows aren't supported by the shared contexts */
+        bit = 8;
+      }
+      if (!bit || (seen & bit))
+        accept = 0;
+      seen |= bit;
+    }
+    if (!accept)
+      continue;
+    switch (flags) {
+    case WEBSOCKET_DEFLATE_ON:
+      *response = WS_DEFLATE_RESPONSE("permessage-deflate");
+      break;
+    case WEBSOCKET_DEFLATE_ON | WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT:
+      *response =
+          WS_DEFLATE_RESPONSE("permessage-deflate; server_no_context_takeover");
+      break;
+    case WEBSOCKET_DEFLATE_ON | WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT:
+      *response =
+          WS_DEFLATE_RESPONSE("permessage-deflate; client_no_context_takeover");
+      break;
+    default:
+      *response = WS_DEFLATE_RESPONSE("permessage-deflate; "
+                                      "server_no_context_takeover; "
+                                      "client_no_context_takeover");
+      break;
+    }
+    return flags;
+  }
+#endif
+  return 0;
+  (void)offers;
+  (void)mode;
+  (void)response;
+}
+
+#undef WS_DEFLATE_RESPONSE
+
+#if HAVE_ZLIB
+
+/* a compression context shared by connections without context takeover */
+typedef struct {
+  fio_lock_i lock;
+  uint8_t initialized;
+  z_stream z;
+} ws_zcontext_s;
+
+static ws_zcontext_s ws_deflate_shared[WEBSOCKET_DEFLATE_CONTEXTS];
+static ws_zcontext_s ws_inflate_shared[WEBSOCKET_DEFLATE_CONTEXTS];
+
+static int ws_zstream_init(z_stream *z, uint8_t inflater) {
+  *z = (z_stream){.zalloc = Z_NULL};
+  /* negative window bits select raw deflate data (no zlib wrapper) */
+  int r = (inflater ? inflateInit2(z, -15)
+                    : deflateInit2(z, WEBSOCKET_DEFLATE_LEVEL, Z_DEFLATED, -15,
+                                   8, Z_DEFAULT_STRATEGY));
+  return (r == Z_OK ? 0 : -1);
+}
+
+/** Locks a shared context, preferring contexts that aren't in use. */
+static ws_zcontext_s *ws_zcontext_lock(ws_zcontext_s *pool, uint8_t inflater) {
+  static size_t counter = 0;
+  const size_t start = fio_atomic_add(&counter, 1);
+  ws_zcontext_s *c = NULL;
+  for (size_t i = 0; i < WEBSOCKET_DEFLATE_CONTEXTS; ++i) {
+    c = pool + ((start + i) % WEBSOCKET_DEFLATE_CONTEXTS);
+    if (!fio_trylock(&c->lock))
+      goto locked;
+  }
+  c = pool + (start % WEBSOCKET_DEFLATE_CONTEXTS);
+  fio_lock(&c->lock);
+locked:
+  if (!c->initialized) {
+    if (ws_zstream_init(&c->z, inflater)) {
+      fio_unlock(&c->lock);
+      return NULL;
+    }
+    c->initialized = 1;
+  }
+  return c;
+}
+
+/** Resets and unlocks a shared context. */
+static void ws_zcontext_unlock(ws_zcontext_s *c, uint8_t inflater) {
+  if (inflater)
+    inflateReset(&c->z);
+  else
+    deflateReset(&c->z);
+  fio_unlock(&c->lock);
+}
+
+static void ws_zcontext_cleanup(void *ignr_) {
+  for (size_t i = 0; i < WEBSOCKET_DEFLATE_CONTEXTS; ++i) {
+    if (ws_deflate_shared[i].initialized)
+      deflateEnd(&ws_deflate_shared[i].z);
+    if (ws_inflate_shared[i].initialized)
+      inflateEnd(&ws_inflate_shared[i].z);
+    ws_deflate_shared[i].initialized = 0;
+    ws_inflate_shared[i].initialized = 0;
+  }
+  (void)ignr_;
+}
+
+static __attribute__((constructor)) void ws_zcontext_constructor(void) {
+  fio_state_callback_add(FIO_CALL_AT_EXIT, ws_zcontext_cleanup, NULL);
+}
+
+/** Returns a connection specific context, allocating it if required. */
+static z_stream *ws_zstream(void **ptr, uint8_t inflater) {
+  if (*ptr)
+    return *ptr;
+  z_stream *z = malloc(sizeof(*z));
+  if (!z)
+    return NULL;
+  if (ws_zstream_init(z, inflater)) {
+    free(z);
+    return NULL;
+  }
+  *ptr = z;
+  return z;
+}
+
+static void ws_zstream_free(void *ptr, uint8_t inflater) {
+  if (!ptr)
+    return;
+  if (inflater)
+    inflateEnd(ptr);
+  else
+    deflateEnd(ptr);
+  free(ptr);
+}
+
+/**
+ * Compresses a message, appending the data to `dest` without the trailing
+ * empty block (00 00 FF FF).
+ */
+static int ws_deflate_write(z_stream *z, FIOBJ dest, const void *data,
+                            size_t len) {
+  z->next_in = (Bytef *)data;
+  z->avail_in = len;
+  int r;
+  do {
+    size_t pos = fiobj_obj2cstr(dest).len;
+    size_t capa = fiobj_str_capa_assert(dest, pos + (len >> 1) + 64);
+    z->next_out = (Bytef *)fiobj_obj2cstr(dest).data + pos;
+    z->avail_out = capa - pos;
+    r = deflate(z, Z_SYNC_FLUSH);
+    fiobj_str_resize(dest, capa - z->avail_out);
+    if (r == Z_STREAM_ERROR)
+      return -1;
+  } while (!z->avail_out);
+  fio_str_info_s s = fiobj_obj2cstr(dest);
+  if (s.len < 4 || memcmp(s.data + s.len - 4, "\x00\x00\xff\xff", 4))
+    return -1;
+  fiobj_str_resize(dest, s.len - 4);
+  return 0;
+}
+
+/**
+ * Decompresses a message, appending the data to `dest`. Fails if the message
+ * grows over `limit` bytes.
+ */
+static int ws_inflate_write(z_stream *z, FIOBJ dest, const void *data,
+                            size_t len, size_t limit) {
+  for (int i = 0; i < 2; ++i) {
+    /* the trailing empty block is added before decompressing the last part */
+    z->next_in = (Bytef *)(i ? "\x00\x00\xff\xff" : data);
+    z->avail_in = (i ? 4 : len);
+    int r;
+    do {
+      size_t pos = fiobj_obj2cstr(dest).len;
+      if (pos > limit)
+        return -1;
+      size_t capa = fiobj_str_capa_assert(dest, pos + (len << 1) + 256);
+      z->next_out = (Bytef *)fiobj_obj2cstr(dest).data + pos;
+      z->avail_out = capa - pos;
+      r = inflate(z, Z_SYNC_FLUSH);
+      fiobj_str_resize(dest, capa - z->avail_out);
+      if (r == Z_STREAM_END) {
+        /* a final block was sent, the context can't be taken over */
+        inflateReset(z);
+        return 0 - (fiobj_obj2cstr(dest).len > limit);
+      }
+      if (r != Z_OK && r != Z_BUF_ERROR)
+        return -1;
+    } while (r == Z_OK && (z->avail_in || !z->avail_out));
+  }
+  return 0 - (fiobj_obj2cstr(dest).len > limit);
+}
+
+/** Decompresses a message received by the connection. */
+static int websocket_inflate(ws_s *ws, FIOBJ dest, const void *data,
+                             size_t len) {
+  int ret = -1;
+  if ((ws->deflate & WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT)) {
+    ws_zcontext_s *c = ws_zcontext_lock(ws_inflate_shared, 1);
+    if (!c)
+      return -1;
+    ret = ws_inflate_write(&c->z, dest, data, len, ws->max_msg_size);
+    ws_zcontext_unlock(c, 1);
+    return ret;
+  }
+  z_stream *z = ws_zstream(&ws->inflater, 1);
+  if (z)
+    ret = ws_inflate_write(z, dest, data, len, ws->max_msg_size);
+  return ret;
+}
+
+/**
+ * Compresses a message using a shared context, returning a new String (or
+ * FIOBJ_INVALID if compression failed or wasn't worth it).
+ */
+static FIOBJ websocket_deflate_shared(fio_str_info_s msg) {
+  ws_zcontext_s *c = ws_zcontext_lock(ws_deflate_shared, 0);
+  if (!c)
+    return FIOBJ_INVALID;
+  FIOBJ tmp = fiobj_str_buf(msg.len >> 1);
+  int e = ws_deflate_write(&c->z, tmp, msg.data, msg.len);
+  ws_zcontext_unlock(c, 0);
+  if (e || fiobj_obj2cstr(tmp).len >= msg.len) {
+    fiobj_free(tmp);
+    return FIOBJ_INVALID;
+  }
+  return tmp;
+}
+
+#endif /* HAVE_ZLIB */
+
 /* *****************************************************************************
 Create/Destroy the websocket subscription objects
 ***************************************************************************** */
@@ -148,10 +500,61 @@ static inline void clear_subscriptions(ws_s *ws) {
 Callbacks - Required functions for websocket_parser.h
 ***************************************************************************** */
 
+#if HAVE_ZLIB
+/* handles compressed messages (collects fragments before decompression) */
+static void websocket_on_unwrapped_deflated(ws_s *ws, void *msg, uint64_t len,
+                                            char first, char last, char text) {
+  if (first) {
+    ws->is_text = (uint8_t)text;
+    if (ws->msg == FIOBJ_INVALID)
+      ws->msg = fiobj_str_buf(len << 1);
+    fiobj_str_resize(ws->msg, 0);
+  }
+  if (!first || !last) {
+    fiobj_str_write(ws->msg, msg, len);
+    if (!last)
+      return;
+  }
+  FIOBJ dest = ws->msg;
+  if (!first) {
+    fio_str_info_s s = fiobj_obj2cstr(ws->msg);
+    msg = s.data;
+    len = s.len;
+    dest = fiobj_str_buf(len << 1);
+  }
+  if (websocket_inflate(ws, dest, msg, len)) {
+    FIO_LOG_DEBUG("WebSocket permessage-deflate error (or message too big).");
+    fio_close(ws->fd);
+  } else {
+    ws->on_message(ws, fiobj_obj2cstr(dest), ws->is_text);
+  }
+  if (dest != ws->msg)
+    fiobj_free(dest);
+}
+#endif
+
 static void websocket_on_unwrapped(void *ws_p, void *msg, uint64_t len,
                                    char first, char last, char text,
                                    unsigned char rsv) {
   ws_s *ws = ws_p;
+  if (first) {
+    ws->streaming = 0;
+  } else if (ws->streaming) {
+    /* a small frame, following a streamed frame in the same message */
+    ws->on_message_chunk(ws, (fio_str_info_s){.data = msg, .len = len}, 0,
+                         (uint8_t)last, ws->is_text);
+    if (last)
+      ws->streaming = 0;
+    return;
+  }
+#if HAVE_ZLIB
+  if (first)
+    ws->is_deflated = (ws->deflate && (rsv & 4));
+  if (ws->is_deflated) {
+    websocket_on_unwrapped_deflated(ws, msg, len, first, last, text);
+    return;
+  }
+#endif
   if (last && first) {
     ws->on_message(ws, (fio_str_info_s){.data = msg, .len = len},
                    (uint8_t)text);
@@ -244,37 +647,229 @@ static uint8_t on_shutdown(intptr_t fd, fio_protocol_s *ws) {
   return 0;
 }
 
+/* *****************************************************************************
+Reading (shared buffer and frame streaming)
+***************************************************************************** */
+
+/**
+ * Tests if the (data) frame at `pos` should be streamed using the
+ * `on_message_chunk` callback.
+ */
+static inline uint8_t
+websocket_is_streamed(ws_s *ws, uint8_t *pos,
+                      struct websocket_packet_info_s info) {
+  const uint8_t opcode = pos[0] & 15;
+  if (!ws->on_message_chunk || info.packet_length <= WS_INITIAL_BUFFER_SIZE ||
+      opcode > 2)
+    return 0;
+  /* compressed messages are collected and decompressed as a whole */
+  if ((ws->deflate && (pos[0] & 64)) || (!opcode && ws->is_deflated))
+    return 0;
+  return 1;
+}
+
+/**
+ * Validates the header of the frame at `pos` before it's consumed, tracking
+ * fragmented messages.
+ *
+ * Returns -1 (after closing the connection) on a protocol error.
+ */
+static int websocket_frame_validate(ws_s *ws, uint8_t *pos) {
+  const uint8_t opcode = pos[0] & 15;
+  const uint8_t rsv = (pos[0] >> 4) & 7;
+  if (opcode & 8) {
+    /* control frames are never compressed or fragmented */
+    if (rsv || !(pos[0] & 128))
+      goto error;
+    return 0;
+  }
+  if (opcode > 2)
+    return 0; /* unknown opcodes are reported by `websocket_consume` */
+  /* RSV1 marks the first frame of a compressed message, RSV2-3 are unused */
+  if ((rsv & 3) || ((rsv & 4) && (!ws->deflate || !opcode)))
+    goto error;
+  /* continuation frames require a message, new messages require none */
+  if ((!opcode) != ws->fragmented)
+    goto error;
+  ws->fragmented = !(pos[0] & 128);
+  return 0;
+error:
+  FIO_LOG_DEBUG("WebSocket protocol error - invalid frame header (%u).",
+                (unsigned int)pos[0]);
+  websocket_on_protocol_error(ws);
+  return -1;
+}
+
+/** Starts streaming the frame at `pos` (the frame's header was consumed). */
+static void websocket_stream_start(ws_s *ws, uint8_t *pos,
+                                   struct websocket_packet_info_s info) {
+  const uint8_t opcode = pos[0] & 15;
+  ws->stream_left = info.packet_length;
+  ws->stream_pos = 0;
+  ws->stream_fin = (pos[0] >> 7) & 1;
+  ws->stream_masked = info.masked;
+  if (info.masked) {
+    uint8_t *mask = pos + info.head_length - 4;
+    ((uint8_t *)(&ws->stream_mask))[0] = mask[0];
+    ((uint8_t *)(&ws->stream_mask))[1] = mask[1];
+    ((uint8_t *)(&ws->stream_mask))[2] = mask[2];
+    ((uint8_t *)(&ws->stream_mask))[3] = mask[3];
+  }
+  if (opcode) {
+    /* a new message */
+    ws->is_text = (opcode == 1);
+    ws->is_deflated = 0;
+    ws->streaming = 2;
+  } else if (!ws->streaming) {
+    /* the message started with small frames, deliver the collected data */
+    fio_str_info_s collected = {.data = NULL};
+    if (ws->msg)
+      collected = fiobj_obj2cstr(ws->msg);
+    ws->streaming = 1;
+    ws->on_message_chunk(ws, collected, 1, 0, ws->is_text);
+    if (ws->msg)
+      fiobj_str_resize(ws->msg, 0);
+  }
+}
+
+/** Delivers a streamed frame's payload (or a part of it). */
+static void websocket_stream_chunk(ws_s *ws, uint8_t *data, size_t len) {
+  if (ws->stream_masked) {
+    /* rotate the mask to match the chunk's position within the frame */
+    uint32_t mask;
+    const uint8_t *src = (uint8_t *)(&ws->stream_mask);
+    const size_t rotate = ws->stream_pos & 3;
+    for (size_t i = 0; i < 4; ++i)
+      ((uint8_t *)(&mask))[i] = src[(i + rotate) & 3];
+    websocket_xmask(data, len, mask);
+  }
+  ws->stream_pos += len;
+  ws->stream_left -= len;
+  const uint8_t first = (ws->streaming == 2);
+  const uint8_t last = (!ws->stream_left && ws->stream_fin);
+  if (len || first || last) {
+    ws->streaming = 1;
+    ws->on_message_chunk(ws, (fio_str_info_s){.data = (char *)data, .len = len},
+                         first, last, ws->is_text);
+  }
+  if (last)
+    ws->streaming = 0;
+}
+
+/**
+ * Consumes the data at `buffer`, one frame at a time, streaming large frames.
+ *
+ * Returns the length of the unconsumed data (a partial frame), which is moved
+ * to the beginning of `buffer`.
+ */
+static size_t websocket_consume_stream(ws_s *ws, uint8_t *buffer, size_t len) {
+  uint8_t *pos = buffer;
+  while (len) {
+    if (ws->stream_left) {
+      size_t tmp = (ws->stream_left < len ? ws->stream_left : len);
+      websocket_stream_chunk(ws, pos, tmp);
+      pos += tmp;
+      len -= tmp;
+      continue;
+    }
+    struct websocket_packet_info_s info = websocket_buffer_peek(pos, len);
+    if (info.head_length > len)
+      break;
+    if (websocket_is_streamed(ws, pos, info)) {
+      if (!info.masked && !ws->is_client) {
+        FIO_LOG_DEBUG("WebSocket protocol error - unmasked data.");
+        websocket_on_protocol_error(ws);
+        return 0;
+      }
+      if (websocket_frame_validate(ws, pos))
+        return 0;
+      websocket_stream_start(ws, pos, info);
+      pos += info.head_length;
+      len -= info.head_length;
+      continue;
+    }
+    const uint64_t raw_length = info.head_length + info.packet_length;
+    if (raw_length > len)
+      break;
+    if (websocket_frame_validate(ws, pos))
+      return 0;
+    websocket_consume(pos, raw_length, ws, (~(ws->is_client) & 1));
+    pos += raw_length;
+    len -= raw_length;
+  }
+  if (len && pos != buffer)
+    memmove(buffer, pos, len);
+  return len;
+}
+
+/** Keeps the unconsumed data, freeing the connection's buffer if possible. */
+static int websocket_buffer_keep(ws_s *ws, uint8_t *data, size_t len) {
+  if (!len) {
+    if (ws->buffer.data)
+      free_ws_buffer(ws, ws->buffer);
+    ws->buffer = (struct buffer_s){.data = NULL};
+    ws->length = 0;
+    return 0;
+  }
+  if (!ws->buffer.data) {
+    ws->buffer = create_ws_buffer(ws);
+    if (!ws->buffer.data)
+      return -1;
+  }
+  if (len > ws->buffer.size) {
+    ws->buffer.size = len;
+    ws->buffer = resize_ws_buffer(ws, ws->buffer);
+    if (!ws->buffer.data)
+      return -1;
+  }
+  if (data != ws->buffer.data)
+    memcpy(ws->buffer.data, data, len);
+  ws->length = len;
+  return 0;
+}
+
 static void on_data(intptr_t sockfd, fio_protocol_s *ws_) {
+  static __thread uint8_t shared[WS_SHARED_BUFFER_SIZE];
   ws_s *const ws = (ws_s *)ws_;
   if (ws == NULL)
     return;
-  struct websocket_packet_info_s info =
-      websocket_buffer_peek(ws->buffer.data, ws->length);
-  const uint64_t raw_length = info.packet_length + info.head_length;
-  /* test expected data amount */
-  if (ws->max_msg_size < raw_length) {
-    /* too big */
-    websocket_close(ws);
-    return;
-  }
-  /* test buffer capacity */
-  if (raw_length > ws->buffer.size) {
-    ws->buffer.size = (size_t)raw_length;
-    ws->buffer = resize_ws_buffer(ws, ws->buffer);
-    if (!ws->buffer.data) {
-      // no memory.
+  uint8_t *buffer = shared;
+  size_t capa = WS_SHARED_BUFFER_SIZE;
+  if (ws->length) {
+    /* a partial frame is pending - make sure the whole frame will fit */
+    struct websocket_packet_info_s info =
+        websocket_buffer_peek(ws->buffer.data, ws->length);
+    const uint64_t raw_length = info.packet_length + info.head_length;
+    /* test expected data amount */
+    if (ws->max_msg_size < raw_length) {
+      /* too big */
       websocket_close(ws);
       return;
     }
+    /* test buffer capacity */
+    if (raw_length > ws->buffer.size) {
+      ws->buffer.size = (size_t)raw_length;
+      ws->buffer = resize_ws_buffer(ws, ws->buffer);
+      if (!ws->buffer.data) {
+        // no memory.
+        websocket_close(ws);
+        return;
+      }
+    }
+    buffer = ws->buffer.data;
+    capa = ws->buffer.size;
   }
 
-  const ssize_t len = fio_read(sockfd, (uint8_t *)ws->buffer.data + ws->length,
-                               ws->buffer.size - ws->length);
+  const ssize_t len = fio_read(sockfd, buffer + ws->length, capa - ws->length);
   if (len <= 0) {
     return;
   }
-  ws->length = websocket_consume(ws->buffer.data, ws->length + len, ws,
-                                 (~(ws->is_client) & 1));
+  size_t left = websocket_consume_stream(ws, buffer, ws->length + len);
+  if (websocket_buffer_keep(ws, buffer, left)) {
+    // no memory.
+    websocket_close(ws);
+    return;
+  }
 
   fio_force_event(sockfd, FIO_EVENT_ON_DATA);
 }
@@ -287,8 +882,9 @@ static void on_data_first(intptr_t sockfd, fio_protocol_s *ws_) {
   ws->protocol.on_ready = on_ready;
 
   if (ws->length) {
-    ws->length = websocket_consume(ws->buffer.data, ws->length, ws,
-                                   (~(ws->is_client) & 1));
+    size_t left = websocket_consume_stream(ws, ws->buffer.data, ws->length);
+    if (websocket_buffer_keep(ws, ws->buffer.data, left))
+      websocket_close(ws);
   }
   fio_force_event(sockfd, FIO_EVENT_ON_DATA);
   fio_force_event(sockfd, FIO_EVENT_ON_READY);
@@ -296,7 +892,8 @@ static void on_data_first(intptr_t sockfd, fio_protocol_s *ws_) {
 
 /* later */
 static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client);
+                                 char first, char last, char client,
+                                 unsigned char rsv);
 
 /*******************************************************************************
 Create/Destroy the websocket object
@@ -315,6 +912,7 @@ static ws_s *new_websocket(intptr_t uuid) {
       .is_client = 0,
       .fd = uuid,
   };
+  http_metric_add(HTTP_METRIC_WEBSOCKET, 1);
   return ws;
 }
 static void destroy_ws(ws_s *ws) {
@@ -323,24 +921,32 @@ static void destroy_ws(ws_s *ws) {
   if (ws->msg)
     fiobj_free(ws->msg);
   clear_subscriptions(ws);
-  free_ws_buffer(ws, ws->buffer);
+  if (ws->buffer.data)
+    free_ws_buffer(ws, ws->buffer);
+#if HAVE_ZLIB
+  ws_zstream_free(ws->deflater, 0);
+  ws_zstream_free(ws->inflater, 1);
+#endif
   free(ws);
+  http_metric_add(HTTP_METRIC_WEBSOCKET, -1);
 }
 
 void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
-                      websocket_settings_s *args, void *data, size_t length) {
+                      websocket_settings_s *args, void *data, size_t length,
+                      uint8_t deflate) {
   ws_s *ws = new_websocket(uuid);
   FIO_ASSERT_ALLOC(ws);
-  // we have an active websocket connection - prep the connection buffer
-  ws->buffer = create_ws_buffer(ws);
   // Setup ws callbacks
   ws->on_open = args->on_open;
   ws->on_close = args->on_close;
   ws->on_message = args->on_message;
+  ws->on_message_chunk = args->on_message_chunk;
   ws->on_ready = args->on_ready;
   ws->on_shutdown = args->on_shutdown;
   // setup any user data
   ws->udata = args->udata;
+  // permessage-deflate (compression contexts are allocated when required)
+  ws->deflate = deflate;
   if (http_settings) {
     // client mode?
     ws->is_client = http_settings->is_client;
@@ -353,19 +959,12 @@ void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
     fio_timeout_set(uuid, 40);
   }
 
-  if (data && length) {
-    if (length > ws->buffer.size) {
-      ws->buffer.size = length;
-      ws->buffer = resize_ws_buffer(ws, ws->buffer);
-      if (!ws->buffer.data) {
-        // no memory.
-        fio_attach(uuid, (fio_protocol_s *)ws);
-        websocket_close(ws);
-        return;
-      }
-    }
-    memcpy(ws->buffer.data, data, length);
-    ws->length = length;
+  // the connection buffer is only allocated for pending data
+  if (data && length && websocket_buffer_keep(ws, data, length)) {
+    // no memory.
+    fio_attach(uuid, (fio_protocol_s *)ws);
+    websocket_close(ws);
+    return;
   }
   // update the protocol object, cleaning up the old one
   fio_attach(uuid, (fio_protocol_s *)ws);
@@ -380,32 +979,79 @@ Writing to the Websocket
   (FIO_MEMORY_BLOCK_ALLOC_LIMIT - 4096) // should be less then `unsigned short`
 
 static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client) {
+                                 char first, char last, char client,
+                                 unsigned char rsv) {
   if (len <= WS_MAX_FRAME_SIZE) {
     void *buff = fio_malloc(len + 16);
     len = (client ? websocket_client_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0)
+                                          first, last, rsv)
                   : websocket_server_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0));
+                                          first, last, rsv));
     fio_write2(fd, .data.buffer = buff, .length = len,
                .after.dealloc = fio_free);
   } else {
     /* frame fragmentation is better for large data then large frames */
     while (len > WS_MAX_FRAME_SIZE) {
-      websocket_write_impl(fd, data, WS_MAX_FRAME_SIZE, text, first, 0, client);
+      websocket_write_impl(fd, data, WS_MAX_FRAME_SIZE, text, first, 0, client,
+                           rsv);
       data = ((uint8_t *)data) + WS_MAX_FRAME_SIZE;
       first = 0;
+      rsv = 0; /* RSV1 (compression) is only set for the first frame */
       len -= WS_MAX_FRAME_SIZE;
     }
-    websocket_write_impl(fd, data, len, text, first, 1, client);
+    websocket_write_impl(fd, data, len, text, first, 1, client, rsv);
   }
   return;
 }
 
+#if HAVE_ZLIB
+/**
+ * Writes a compressed message. Returns -1 if the message wasn't written.
+ *
+ * Connections with context takeover compress (and write) while holding the
+ * connection's lock, so the compressed messages arrive in order.
+ */
+static int websocket_write_deflated(ws_s *ws, fio_str_info_s msg,
+                                    uint8_t is_text) {
+  int ret = -1;
+  FIOBJ tmp;
+  if ((ws->deflate & WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT)) {
+    tmp = websocket_deflate_shared(msg);
+    if (!tmp)
+      return -1;
+    fio_str_info_s s = fiobj_obj2cstr(tmp);
+    websocket_write_impl(ws->fd, s.data, s.len, is_text, 1, 1, ws->is_client,
+                         4);
+    fiobj_free(tmp);
+    return 0;
+  }
+  tmp = fiobj_str_buf(msg.len >> 1);
+  fio_lock(&ws->deflate_lock);
+  z_stream *z = ws_zstream(&ws->deflater, 0);
+  if (z) {
+    if (!ws_deflate_write(z, tmp, msg.data, msg.len)) {
+      fio_str_info_s s = fiobj_obj2cstr(tmp);
+      websocket_write_impl(ws->fd, s.data, s.len, is_text, 1, 1, ws->is_client,
+                           4);
+      ret = 0;
+    } else {
+      /* nothing was sent, so the context must forget the data */
+      deflateReset(z);
+    }
+  }
+  fio_unlock(&ws->deflate_lock);
+  fiobj_free(tmp);
+  return ret;
+}
+#endif
+
 /* *****************************************************************************
 Multi-client broadcast optimizations
 ***************************************************************************** */
 
+/* internal: lazily compressed broadcast frames (permessage-deflate) */
+#define WEBSOCKET_OPTIMIZE_DEFLATE (-35)
+
 static void websocket_optimize_free(fio_msg_s *msg, void *metadata) {
   fiobj_free((FIOBJ)metadata);
   (void)msg;
@@ -459,6 +1105,83 @@ static fio_msg_metadata_s websocket_optimize_binary(fio_str_info_s ch,
   (void)is_json;
 }
 
+#if HAVE_ZLIB
+/* compressed frames are only created for permessage-deflate subscribers */
+typedef struct {
+  fio_lock_i lock;
+  /** the text state, 2 until tested. */
+  uint8_t is_text;
+  /** a bitmap of the frames that were created (1 - binary, 2 - text) */
+  uint8_t done;
+  /** binary / text frames (FIOBJ_INVALID if compression wasn't worth it). */
+  FIOBJ frame[2];
+} websocket_deflated_s;
+
+static void websocket_optimize_deflate_free(fio_msg_s *msg, void *metadata) {
+  websocket_deflated_s *d = metadata;
+  if (d) {
+    fiobj_free(d->frame[0]);
+    fiobj_free(d->frame[1]);
+    fio_free(d);
+  }
+  (void)msg;
+}
+
+static fio_msg_metadata_s websocket_optimize_deflate(fio_str_info_s ch,
+                                                     fio_str_info_s msg,
+                                                     uint8_t is_json) {
+  websocket_deflated_s *d = NULL;
+  if (msg.len >= WEBSOCKET_DEFLATE_MIN_SIZE) {
+    d = fio_malloc(sizeof(*d));
+    FIO_ASSERT_ALLOC(d);
+    *d = (websocket_deflated_s){.is_text = 2};
+  }
+  fio_msg_metadata_s ret = {
+      .type_id = WEBSOCKET_OPTIMIZE_DEFLATE,
+      .on_finish = websocket_optimize_deflate_free,
+      .metadata = (void *)d,
+  };
+  return ret;
+  (void)ch;
+  (void)is_json;
+}
+
+/**
+ * Returns the compressed frame for the message (compressing the message once,
+ * using a shared context), or FIOBJ_INVALID.
+ */
+static FIOBJ websocket_deflated_frame(fio_msg_s *msg, uint8_t txt) {
+  websocket_deflated_s *d =
+      fio_message_metadata(msg, WEBSOCKET_OPTIMIZE_DEFLATE);
+  if (!d)
+    return FIOBJ_INVALID;
+  fio_lock(&d->lock);
+  if (txt == 2) {
+    if (d->is_text == 2) {
+      fio_str_s tmp = FIO_STR_INIT_STATIC2(msg->msg.data, msg->msg.len);
+      d->is_text = (tmp.len >= (2 << 14) ? 0 : fio_str_utf8_valid(&tmp));
+    }
+    txt = d->is_text;
+  }
+  if (!(d->done & (1 << txt))) {
+    d->done |= (1 << txt);
+    FIOBJ tmp = websocket_deflate_shared(msg->msg);
+    if (tmp) {
+      fio_str_info_s s = fiobj_obj2cstr(tmp);
+      d->frame[txt] = fiobj_str_buf(s.len + 10);
+      fiobj_str_resize(
+          d->frame[txt],
+          websocket_server_wrap(fiobj_obj2cstr(d->frame[txt]).data, s.data,
+                                s.len, (txt ? 1 : 2), 1, 1, 4));
+      fiobj_free(tmp);
+    }
+  }
+  FIOBJ ret = d->frame[txt];
+  fio_unlock(&d->lock);
+  return ret;
+}
+#endif
+
 /**
  * Enables (or disables) broadcast optimizations.
  *
@@ -489,6 +1212,9 @@ void websocket_optimize4broadcasts(intptr_t type, int enable) {
   static intptr_t generic = 0;
   static intptr_t text = 0;
   static intptr_t binary = 0;
+#if HAVE_ZLIB
+  static intptr_t deflated = 0;
+#endif
   fio_msg_metadata_s (*callback)(fio_str_info_s, fio_str_info_s, uint8_t);
   intptr_t *counter;
   switch ((0 - type)) {
@@ -504,6 +1230,12 @@ void websocket_optimize4broadcasts(intptr_t type, int enable) {
     counter = &binary;
     callback = websocket_optimize_binary;
     break;
+#if HAVE_ZLIB
+  case (0 - WEBSOCKET_OPTIMIZE_DEFLATE):
+    counter = &deflated;
+    callback = websocket_optimize_deflate;
+    break;
+#endif
   default:
     return;
   }
@@ -527,8 +1259,25 @@ typedef struct {
                      void *udata);
   void (*on_unsubscribe)(void *udata);
   void *udata;
+  /** set when the subscription enabled the compressed broadcasts. */
+  uint8_t deflate;
 } websocket_sub_data_s;
 
+/**
+ * Sends a shared (pre-wrapped) broadcast frame.
+ *
+ * The socket is flushed by a deferred task rather than immediately, so all the
+ * broadcasts delivered to the socket during the same reactor cycle are sent
+ * using a single write (`writev`).
+ */
+static inline void websocket_send_shared(intptr_t uuid, FIOBJ frame) {
+  fio_str_info_s s = fiobj_obj2cstr(frame);
+  fio_write2(uuid, .data.buffer = (void *)fiobj_dup(frame),
+             .offset = (((intptr_t)s.data) - ((intptr_t)(frame))),
+             .length = s.len, .after.dealloc = fiobj4sock_dealloc,
+             .coalesce = 1);
+}
+
 static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
                                                                uint8_t txt) {
   fio_protocol_s *pr =
@@ -541,6 +1290,19 @@ static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
   }
   FIOBJ message = FIOBJ_INVALID;
   FIOBJ pre_wrapped = FIOBJ_INVALID;
+#if HAVE_ZLIB
+  if (((ws_s *)pr)->deflate &&
+      (pre_wrapped = websocket_deflated_frame(msg, txt))) {
+    ws_s *ws = (ws_s *)pr;
+    /* a shared (context free) frame - the connection's context must forget */
+    fio_lock(&ws->deflate_lock);
+    websocket_send_shared(ws->fd, pre_wrapped);
+    if (ws->deflater)
+      deflateReset(ws->deflater);
+    fio_unlock(&ws->deflate_lock);
+    goto finish;
+  }
+#endif
   if (!((ws_s *)pr)->is_client) {
     /* pre-wrapping is only for client data */
     switch (txt) {
@@ -561,7 +1323,7 @@ static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
     if (pre_wrapped) {
       // FIO_LOG_DEBUG(
       //     "pub/sub WebSocket optimization route for pre-wrapped message.");
-      fiobj_send_free((intptr_t)msg->udata1, fiobj_dup(pre_wrapped));
+      websocket_send_shared((intptr_t)msg->udata1, pre_wrapped);
       goto finish;
     }
   }
@@ -611,6 +1373,10 @@ static void websocket_on_unsubscribe(void *u1, void *u2) {
     d->on_unsubscribe(d->udata);
   }
 
+#if HAVE_ZLIB
+  if (d->deflate)
+    websocket_optimize4broadcasts(WEBSOCKET_OPTIMIZE_DEFLATE, 0);
+#endif
   if ((intptr_t)d->on_message == (intptr_t)WEBSOCKET_OPTIMIZE_PUBSUB) {
     websocket_optimize4broadcasts(WEBSOCKET_OPTIMIZE_PUBSUB, 0);
   } else if ((intptr_t)d->on_message ==
@@ -652,6 +1418,12 @@ uintptr_t websocket_subscribe(struct websocket_subscribe_s args) {
       handler = websocket_on_pubsub_message_direct;
     }
     websocket_optimize4broadcasts(br_type, 1);
+#if HAVE_ZLIB
+    if (args.ws->deflate) {
+      d->deflate = 1;
+      websocket_optimize4broadcasts(WEBSOCKET_OPTIMIZE_DEFLATE, 1);
+    }
+#endif
     d->on_message =
         (void (*)(ws_s *, fio_str_info_s, fio_str_info_s, void *))br_type;
   }
@@ -716,8 +1488,13 @@ uint8_t websocket_is_client(ws_s *ws) { return ws->is_client; }
 /** Writes data to the websocket. Returns -1 on failure (0 on success). */
 int websocket_write(ws_s *ws, fio_str_info_s msg, uint8_t is_text) {
   if (fio_is_valid(ws->fd)) {
+#if HAVE_ZLIB
+    if (ws->deflate && msg.len >= WEBSOCKET_DEFLATE_MIN_SIZE &&
+        !websocket_write_deflated(ws, msg, is_text))
+      return 0;
+#endif
     websocket_write_impl(ws->fd, msg.data, msg.len, is_text, 1, 1,
-                         ws->is_client);
+                         ws->is_client, 0);
     return 0;
   }
   return -1;
@@ -729,3 +1506,210 @@ void websocket_close(ws_s *ws) {
   fio_close(ws->fd);
   return;
 }
+
+/* *****************************************************************************
+Tests
+***************************************************************************** */
+#if DEBUG
+
+static uint8_t websocket_deflate_test_negotiate(const char *offers,
+                                                uint8_t mode) {
+  fio_str_info_s response = {.data = NULL};
+  return websocket_deflate_negotiate(
+      (fio_str_info_s){.data = (char *)offers, .len = strlen(offers)}, mode,
+      &response);
+}
+
+void websocket_deflate_test(void) {
+  fprintf(stderr, "=== Testing WebSocket permessage-deflate\n");
+#if HAVE_ZLIB
+  FIO_ASSERT(websocket_deflate_test_negotiate("permessage-deflate", 1) ==
+                 WEBSOCKET_DEFLATE_ON,
+             "permessage-deflate negotiation failed");
+  FIO_ASSERT(!websocket_deflate_test_negotiate("permessage-deflate", 0),
+             "permessage-deflate should be disabled by default");
+  FIO_ASSERT(websocket_deflate_test_negotiate("permessage-deflate", 2) ==
+                 (WEBSOCKET_DEFLATE_ON | WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT |
+                  WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT),
+             "no_context_takeover should be forced by the settings");
+  FIO_ASSERT(websocket_deflate_test_negotiate(
+                 "permessage-deflate; client_max_window_bits; "
+                 "server_no_context_takeover",
+                 1) ==
+                 (WEBSOCKET_DEFLATE_ON | WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT),
+             "permessage-deflate parameter negotiation failed");
+  FIO_ASSERT(websocket_deflate_test_negotiate(
+                 "permessage-deflate; server_max_window_bits=10, "
+                 "permessage-deflate; client_no_context_takeover",
+                 1) ==
+                 (WEBSOCKET_DEFLATE_ON | WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT),
+             "unsupported offers should be skipped");
+  FIO_ASSERT(
+      !websocket_deflate_test_negotiate("permessage-deflate; unknown", 1) &&
+          !websocket_deflate_test_negotiate("x-webkit-deflate-frame", 1) &&
+          !websocket_deflate_test_negotiate(
+              "permessage-deflate; server_no_context_takeover; "
+              "server_no_context_takeover",
+              1),
+      "invalid offers should be declined");
+  /* round trip, using the shared contexts */
+  ws_s ws = {.deflate = WEBSOCKET_DEFLATE_ON |
+                        WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT,
+             .max_msg_size = 1 << 16};
+  FIOBJ src = fiobj_str_buf(4096);
+  for (size_t i = 0; i < 128; ++i)
+    fiobj_str_write(src, "{\"user\":\"facil.io\",\"msg\":\"hello\"},", 34);
+  fio_str_info_s s = fiobj_obj2cstr(src);
+  FIOBJ compressed = websocket_deflate_shared(s);
+  FIO_ASSERT(compressed && fiobj_obj2cstr(compressed).len < (s.len >> 2),
+             "permessage-deflate compression failed");
+  FIOBJ out = fiobj_str_buf(1);
+  FIO_ASSERT(!websocket_inflate(&ws, out, fiobj_obj2cstr(compressed).data,
+                                fiobj_obj2cstr(compressed).len) &&
+                 fiobj_iseq(out, src),
+             "permessage-deflate decompression failed");
+  fiobj_str_resize(out, 0);
+  ws.max_msg_size = 1024;
+  FIO_ASSERT(websocket_inflate(&ws, out, fiobj_obj2cstr(compressed).data,
+                               fiobj_obj2cstr(compressed).len),
+             "permessage-deflate decompression should respect the size limit");
+  fiobj_free(out);
+  fiobj_free(compressed);
+  fiobj_free(src);
+  fprintf(stderr, "* passed.\n");
+#else
+  FIO_ASSERT(!websocket_deflate_test_negotiate("permessage-deflate", 1),
+             "permessage-deflate requires zlib");
+  fprintf(stderr, "* skipped (no zlib).\n");
+#endif
+}
+
+static struct {
+  FIOBJ data;
+  size_t messages;
+  size_t errors;
+} websocket_stream_test_state;
+
+static void websocket_stream_test_on_chunk(ws_s *ws, fio_str_info_s chunk,
+                                           uint8_t first, uint8_t last,
+                                           uint8_t is_text) {
+  if (first && fiobj_obj2cstr(websocket_stream_test_state.data).len)
+    ++websocket_stream_test_state.errors;
+  fiobj_str_write(websocket_stream_test_state.data, chunk.data, chunk.len);
+  websocket_stream_test_state.messages += last;
+  websocket_stream_test_state.errors += !is_text;
+  (void)ws;
+}
+
+static void websocket_stream_test_on_message(ws_s *ws, fio_str_info_s msg,
+                                             uint8_t is_text) {
+  fiobj_str_write(websocket_stream_test_state.data, msg.data, msg.len);
+  ++websocket_stream_test_state.messages;
+  (void)ws;
+  (void)is_text;
+}
+
+/* feeds `len` bytes to a new server connection, `step` bytes at a time */
+static ws_s websocket_stream_test_feed(uint8_t *data, size_t len,
+                                       size_t step) {
+  static uint8_t buffer[1 << 16];
+  int sv[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed.");
+  close(sv[1]);
+  ws_s ws = {
+      .fd = fio_fd2uuid(sv[0]),
+      .on_message = websocket_stream_test_on_message,
+      .on_message_chunk = websocket_stream_test_on_chunk,
+  };
+  fiobj_str_resize(websocket_stream_test_state.data, 0);
+  websocket_stream_test_state.messages = 0;
+  websocket_stream_test_state.errors = 0;
+  size_t left = 0;
+  for (size_t i = 0; i < len && !fio_is_closed(ws.fd); i += step) {
+    const size_t tmp = (len - i < step ? len - i : step);
+    memcpy(buffer + left, data + i, tmp);
+    left = websocket_consume_stream(&ws, buffer, left + tmp);
+    FIO_ASSERT(left < sizeof(buffer), "WebSocket test buffer overflow");
+  }
+  if (!fio_is_closed(ws.fd))
+    fio_force_close(ws.fd);
+  else
+    ws.fd = -1; /* marks the protocol error */
+  if (ws.msg)
+    fiobj_free(ws.msg);
+  return ws;
+}
+
+void websocket_stream_test(void) {
+  fprintf(stderr, "=== Testing WebSocket frame streaming\n");
+  const size_t big = WS_INITIAL_BUFFER_SIZE * 3 + 5;
+  uint8_t *msg = malloc(big * 2 + 16);
+  uint8_t *frames = malloc(big * 3 + 256);
+  FIO_ASSERT_ALLOC(msg && frames);
+  for (size_t i = 0; i < big * 2 + 16; ++i)
+    msg[i] = 'a' + (i % 26);
+  websocket_stream_test_state.data = fiobj_str_buf(big * 2 + 16);
+  /* a streamed frame, a small frame, a ping and a streamed last frame */
+  size_t len = 0;
+  len += websocket_client_wrap(frames + len, msg, big, 1, 1, 0, 0);
+  len += websocket_client_wrap(frames + len, msg + big, 16, 1, 0, 0, 0);
+  len += websocket_client_wrap(frames + len, msg, 0, 10, 1, 1, 0);
+  len += websocket_client_wrap(frames + len, msg + big + 16, big, 1, 0, 1, 0);
+  /* followed by a small (collected) message */
+  len += websocket_client_wrap(frames + len, msg, 100, 1, 1, 1, 0);
+  const size_t steps[] = {1, 2, 3, 5, 7, 13, 64, 125, 126, 4095, 4097, len};
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); ++i) {
+    uint8_t *copy = malloc(len);
+    FIO_ASSERT_ALLOC(copy);
+    memcpy(copy, frames, len);
+    ws_s ws = websocket_stream_test_feed(copy, len, steps[i]);
+    free(copy);
+    fio_str_info_s s = fiobj_obj2cstr(websocket_stream_test_state.data);
+    FIO_ASSERT(ws.fd != -1, "valid frames caused a protocol error (step %zu)",
+               steps[i]);
+    FIO_ASSERT(websocket_stream_test_state.messages == 2 &&
+                   !websocket_stream_test_state.errors,
+               "streamed message count error (step %zu)", steps[i]);
+    FIO_ASSERT(s.len == big * 2 + 16 + 100 &&
+                   !memcmp(s.data, msg, big * 2 + 16) &&
+                   !memcmp(s.data + big * 2 + 16, msg, 100),
+               "streamed data error (step %zu)", steps[i]);
+    FIO_ASSERT(!ws.fragmented && !ws.streaming && !ws.stream_left,
+               "stream state error after the message (step %zu)", steps[i]);
+  }
+  /* invalid frames are rejected, streamed or not */
+  struct {
+    size_t len;
+    uint8_t opcode;
+    uint8_t first;
+    uint8_t rsv;
+    const char *name;
+  } invalid[] = {
+      {big, 1, 1, 2, "RSV2 (streamed)"},
+      {16, 1, 1, 1, "RSV3"},
+      {big, 1, 1, 4, "RSV1 without permessage-deflate (streamed)"},
+      {big, 0, 0, 0, "a continuation frame without a message (streamed)"},
+      {16, 0, 0, 0, "a continuation frame without a message"},
+      {0, 9, 1, 0, "a fragmented ping"},
+  };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+    len = websocket_client_wrap(frames, msg, invalid[i].len, invalid[i].opcode,
+                                invalid[i].first, invalid[i].opcode != 9,
+                                invalid[i].rsv);
+    ws_s ws = websocket_stream_test_feed(frames, len, 7);
+    FIO_ASSERT(ws.fd == -1 && !websocket_stream_test_state.messages &&
+                   !fiobj_obj2cstr(websocket_stream_test_state.data).len,
+               "%s should be a protocol error", invalid[i].name);
+  }
+  /* a new message can't interrupt a fragmented message */
+  len = websocket_client_wrap(frames, msg, big, 1, 1, 0, 0);
+  len += websocket_client_wrap(frames + len, msg, big, 2, 1, 1, 0);
+  ws_s ws = websocket_stream_test_feed(frames, len, 100);
+  FIO_ASSERT(ws.fd == -1 && !websocket_stream_test_state.messages,
+             "an interrupted fragmented message should be a protocol error");
+  fiobj_free(websocket_stream_test_state.data);
+  free(frames);
+  free(msg);
+  fprintf(stderr, "* passed.\n");
+}
+#endif
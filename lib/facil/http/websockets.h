@@ -14,9 +14,55 @@ Feel free to copy, use and enjoy according to the license provided.
 extern "C" {
 #endif
 
+/* *****************************************************************************
+Compile Time Settings
+***************************************************************************** */
+
+#ifndef WEBSOCKET_DEFLATE_MIN_SIZE
+/** permessage-deflate: messages smaller than this are never compressed. */
+#define WEBSOCKET_DEFLATE_MIN_SIZE 64
+#endif
+
+#ifndef WEBSOCKET_DEFLATE_LEVEL
+/** permessage-deflate: the zlib compression level (1-9). */
+#define WEBSOCKET_DEFLATE_LEVEL 6
+#endif
+
+#ifndef WEBSOCKET_DEFLATE_CONTEXTS
+/**
+ * permessage-deflate: the number of compression (and decompression) contexts
+ * shared by all the `no_context_takeover` connections (and broadcasts).
+ */
+#define WEBSOCKET_DEFLATE_CONTEXTS 8
+#endif
+
+/* *****************************************************************************
+Internal API
+***************************************************************************** */
+
+/** used internally: permessage-deflate negotiation result flags. */
+enum {
+  WEBSOCKET_DEFLATE_ON = 1,
+  WEBSOCKET_DEFLATE_SERVER_NO_CONTEXT = 2,
+  WEBSOCKET_DEFLATE_CLIENT_NO_CONTEXT = 4,
+};
+
+/**
+ * used internally: negotiates the permessage-deflate extension (RFC 7692).
+ *
+ * `offers` is the client's `Sec-WebSocket-Extensions` header value and `mode`
+ * is the `ws_deflate` HTTP setting.
+ *
+ * Returns the negotiated flags (0 if the extension was declined), setting
+ * `response` to the `Sec-WebSocket-Extensions` response header value.
+ */
+uint8_t websocket_deflate_negotiate(fio_str_info_s offers, uint8_t mode,
+                                    fio_str_info_s *response);
+
 /** used internally: attaches the Websocket protocol to the socket. */
 void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
-                      websocket_settings_s *args, void *data, size_t length);
+                      websocket_settings_s *args, void *data, size_t length,
+                      uint8_t deflate);
 
 /* *****************************************************************************
 Websocket information
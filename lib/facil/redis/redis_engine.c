@@ -16,51 +16,107 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <resp_parser.h>
 
 #define REDIS_READ_BUFFER 8192
+
+#ifndef REDIS_PIPELINE_DEPTH
+/** The default number of commands sent before waiting for the first reply. */
+#define REDIS_PIPELINE_DEPTH 64
+#endif
+
+#ifndef REDIS_CLUSTER_REDIRECTS_MAX
+/** The maximal number of times a command is redirected (MOVED / ASK). */
+#define REDIS_CLUSTER_REDIRECTS_MAX 5
+#endif
+
+/** Larger bulk Strings are never sliced by the subscription fast path. */
+#define REDIS_SUB_SLICE_MAX (REDIS_READ_BUFFER)
+
+/** The number of Redis Cluster hash slots. */
+#define REDIS_CLUSTER_SLOTS 16384
 /* *****************************************************************************
 The Redis Engine and Callbacks Object
 ***************************************************************************** */
 
+typedef struct redis_engine_s redis_engine_s;
+
+/** a connection's protocol and parser state. */
+struct redis_engine_internal_s {
+  fio_protocol_s protocol;
+  intptr_t uuid;
+  resp_parser_s parser;
+  void (*on_message)(struct redis_engine_internal_s *parser, FIOBJ msg);
+  FIOBJ str;
+  FIOBJ ary;
+  uint32_t ary_count;
+  uint16_t buf_pos;
+  uint16_t nesting;
+  /* set when the reply is an error message */
+  uint8_t is_err;
+};
+
+/** a publishing (command) connection and its command queue. */
 typedef struct {
+  struct redis_engine_internal_s i;
+  redis_engine_s *r;
+  struct redis_node_s *node;
+  fio_ls_embd_s queue;
+  /* the first command in the queue that wasn't sent (or &queue) */
+  fio_ls_embd_s *next;
+  /* the number of commands sent (awaiting a reply) */
+  size_t sent;
+  volatile uint8_t flush;
+  /* set once the connection is established (commands can be sent) */
+  uint8_t ready;
+  uint8_t buf[REDIS_READ_BUFFER];
+} redis_pub_s;
+
+/** a Redis server (cluster node) and its pool of publishing connections. */
+typedef struct redis_node_s {
+  char *address;
+  char *port;
+  redis_pub_s pub[];
+} redis_node_s;
+
+struct redis_engine_s {
   fio_pubsub_engine_s en;
-  struct redis_engine_internal_s {
-    fio_protocol_s protocol;
-    intptr_t uuid;
-    resp_parser_s parser;
-    void (*on_message)(struct redis_engine_internal_s *parser, FIOBJ msg);
-    FIOBJ str;
-    FIOBJ ary;
-    uint32_t ary_count;
-    uint16_t buf_pos;
-    uint16_t nesting;
-  } pub_data, sub_data;
+  struct redis_engine_internal_s sub_data;
   subscription_s *publication_forwarder;
   subscription_s *cmd_forwarder;
   subscription_s *cmd_reply;
   char *address;
   char *port;
   char *auth;
-  FIOBJ last_ch;
+  /* the last channel a message was published to ("message" / "pmessage") */
+  fio_str_s last_ch;
   size_t auth_len;
   size_t ref;
-  fio_ls_embd_s queue;
+  /* nodes[0] is the server the engine was created with */
+  redis_node_s **nodes;
+  size_t node_count;
+  /* the number of publishing connections per node */
+  size_t connections;
+  size_t pipeline;
+  /* maps cluster hash slots to nodes (NULL unless in cluster mode) */
+  uint16_t *slots;
   fio_lock_i lock;
   fio_lock_i lock_connection;
   uint8_t ping_int;
-  volatile uint8_t pub_sent;
+  uint8_t slots_refresh;
   volatile uint8_t flag;
   uint8_t buf[];
-} redis_engine_s;
+};
 
 typedef struct {
   fio_ls_embd_s node;
   void (*callback)(fio_pubsub_engine_s *e, FIOBJ reply, void *udata);
   void *udata;
   size_t cmd_len;
+  uint16_t slot;
+  uint8_t redirects;
   uint8_t cmd[];
 } redis_commands_s;
 
-/** converts from a publishing protocol to an `redis_engine_s`. */
-#define pub2redis(pr) FIO_LS_EMBD_OBJ(redis_engine_s, pub_data, (pr))
+/** converts from a publishing protocol to a `redis_pub_s`. */
+#define pub2conn(pr) FIO_LS_EMBD_OBJ(redis_pub_s, i, (pr))
 /** converts from a subscribing protocol to an `redis_engine_s`. */
 #define sub2redis(pr) FIO_LS_EMBD_OBJ(redis_engine_s, sub_data, (pr))
 
@@ -72,27 +128,51 @@ typedef struct {
 static inline void redis_internal_reset(struct redis_engine_internal_s *i) {
   i->buf_pos = 0;
   i->parser = (resp_parser_s){.obj_countdown = 0, .expecting = 0};
+  while (i->nesting && i->ary) {
+    /* incomplete nested Arrays aren't part of their parent Array (yet) */
+    FIOBJ parent = (FIOBJ)fiobj_obj2num(fiobj_ary_index(i->ary, 1));
+    fiobj_free(i->ary);
+    i->ary = parent;
+    --i->nesting;
+  }
   fiobj_free((FIOBJ)fio_ct_if(i->ary == FIOBJ_INVALID, (uintptr_t)i->str,
                               (uintptr_t)i->ary));
   i->str = FIOBJ_INVALID;
   i->ary = FIOBJ_INVALID;
   i->ary_count = 0;
   i->nesting = 0;
+  i->is_err = 0;
   i->uuid = -1;
 }
 
+/* frees a publishing connection's command queue */
+static inline void redis_pub_clear(redis_pub_s *c) {
+  while (fio_ls_embd_any(&c->queue)) {
+    fio_free(
+        FIO_LS_EMBD_OBJ(redis_commands_s, node, fio_ls_embd_pop(&c->queue)));
+  }
+  c->next = &c->queue;
+  c->sent = 0;
+  c->flush = 0;
+  c->ready = 0;
+}
+
 /** cleans up and frees the engine data. */
 static inline void redis_free(redis_engine_s *r) {
   if (fio_atomic_sub(&r->ref, 1))
     return;
   FIO_LOG_DEBUG("freeing redis engine for %s:%s", r->address, r->port);
-  redis_internal_reset(&r->pub_data);
   redis_internal_reset(&r->sub_data);
-  fiobj_free(r->last_ch);
-  while (fio_ls_embd_any(&r->queue)) {
-    fio_free(
-        FIO_LS_EMBD_OBJ(redis_commands_s, node, fio_ls_embd_pop(&r->queue)));
+  fio_str_free(&r->last_ch);
+  for (size_t n = 0; n < r->node_count; ++n) {
+    for (size_t i = 0; i < r->connections; ++i) {
+      redis_internal_reset(&r->nodes[n]->pub[i].i);
+      redis_pub_clear(r->nodes[n]->pub + i);
+    }
+    fio_free(r->nodes[n]);
   }
+  fio_free(r->nodes);
+  fio_free(r->slots);
   fio_unsubscribe(r->publication_forwarder);
   r->publication_forwarder = NULL;
   fio_unsubscribe(r->cmd_forwarder);
@@ -102,6 +182,93 @@ static inline void redis_free(redis_engine_s *r) {
   fio_free(r);
 }
 
+/* *****************************************************************************
+Cluster Hash Slots
+***************************************************************************** */
+
+/* CRC16 (XMODEM), as used by Redis Cluster for key hash slots */
+static const uint16_t redis_crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
+};
+
+/** Returns the Redis Cluster hash slot for `key` (honoring `{hash tags}`). */
+static uint16_t redis_key_slot(const char *key, size_t len) {
+  const char *tag = memchr(key, '{', len);
+  if (tag) {
+    const char *end = memchr(tag + 1, '}', len - (size_t)(tag + 1 - key));
+    if (end && end > tag + 1) {
+      key = tag + 1;
+      len = (size_t)(end - key);
+    }
+  }
+  uint16_t crc = 0;
+  for (size_t i = 0; i < len; ++i)
+    crc = (uint16_t)(crc << 8) ^
+          redis_crc16_table[((crc >> 8) ^ (uint8_t)key[i]) & 0xFF];
+  return crc & (REDIS_CLUSTER_SLOTS - 1);
+}
+
+/**
+ * Returns the hash slot of a RESP encoded command, assuming the key is the
+ * command's first argument (commands without arguments map to slot 0).
+ *
+ * The command must be NUL terminated.
+ */
+static uint16_t redis_cmd_slot(uint8_t *cmd, size_t len) {
+  char *pos = (char *)cmd;
+  char *end = pos + len;
+  if (len < 4 || *pos != '*')
+    return 0;
+  ++pos;
+  if (fio_atol(&pos) < 2)
+    return 0;
+  pos += 2;
+  /* skip the command name */
+  if (pos >= end || *pos != '$')
+    return 0;
+  ++pos;
+  pos += fio_atol(&pos) + 4;
+  if (pos >= end || *pos != '$')
+    return 0;
+  ++pos;
+  int64_t key_len = fio_atol(&pos);
+  pos += 2;
+  if (key_len < 0 || pos + key_len > end)
+    return 0;
+  return redis_key_slot(pos, (size_t)key_len);
+}
+
 /* *****************************************************************************
 Simple RESP formatting
 ***************************************************************************** */
@@ -197,6 +364,7 @@ static int resp_on_message(resp_parser_s *parser) {
   fiobj_free(msg);
   i->ary = FIOBJ_INVALID;
   i->str = FIOBJ_INVALID;
+  i->is_err = 0;
   return 0;
 }
 
@@ -205,11 +373,17 @@ static inline void resp_add_obj(struct redis_engine_internal_s *dest, FIOBJ o) {
   if (dest->ary) {
     fiobj_ary_push(dest->ary, o);
     --dest->ary_count;
-    if (!dest->ary_count && dest->nesting) {
-      FIOBJ tmp = fiobj_ary_shift(dest->ary);
-      dest->ary_count = fiobj_obj2num(tmp);
+    while (!dest->ary_count && dest->nesting) {
+      /* a nested Array is complete, add it to the parent Array */
+      FIOBJ child = dest->ary;
+      FIOBJ tmp = fiobj_ary_shift(child);
+      dest->ary_count = (uint32_t)fiobj_obj2num(tmp);
       fiobj_free(tmp);
-      dest->ary = fiobj_ary_shift(dest->ary);
+      tmp = fiobj_ary_shift(child);
+      dest->ary = (FIOBJ)fiobj_obj2num(tmp);
+      fiobj_free(tmp);
+      fiobj_ary_push(dest->ary, child);
+      --dest->ary_count;
       --dest->nesting;
     }
   }
@@ -265,6 +439,8 @@ static int resp_on_end_string(resp_parser_s *parser) {
 /** a local static callback, called an error message is received. */
 static int resp_on_err_msg(resp_parser_s *parser, void *data, size_t len) {
   struct redis_engine_internal_s *i = parser2data(parser);
+  if (!i->ary)
+    i->is_err = 1;
   resp_add_obj(i, fiobj_str_new(data, len));
   return 0;
 }
@@ -285,6 +461,11 @@ static int resp_on_err_msg(resp_parser_s *parser, void *data, size_t len) {
 static int resp_on_start_array(resp_parser_s *parser, size_t array_len) {
   struct redis_engine_internal_s *i = parser2data(parser);
   if (i->ary) {
+    if (!array_len) {
+      resp_add_obj(i, fiobj_ary_new());
+      return 0;
+    }
+    /* nested Arrays store the parent's state until they are complete */
     ++i->nesting;
     FIOBJ tmp = fiobj_ary_new2(array_len + 2);
     fiobj_ary_push(tmp, fiobj_num_new(i->ary_count));
@@ -312,30 +493,266 @@ static void redis_perform_callback(void *e, void *cmd_) {
   fio_free(cmd);
 }
 
-/* send command within lock, to ensure flag integrity */
-static void redis_send_next_command_unsafe(redis_engine_s *r) {
-  if (!r->pub_sent && fio_ls_embd_any(&r->queue)) {
-    r->pub_sent = 1;
-    redis_commands_s *cmd =
-        FIO_LS_EMBD_OBJ(redis_commands_s, node, r->queue.next);
-    fio_write2(r->pub_data.uuid, .data.buffer = cmd->cmd,
-               .length = cmd->cmd_len, .after.dealloc = FIO_DEALLOC_NOOP);
+/*
+ * Sends the unsent commands (up to the pipeline depth) within the lock, to
+ * ensure flag integrity.
+ *
+ * Commands stay in the queue until their reply arrives (so they can be resent
+ * on network failures). When more than a single command is sent, the commands
+ * are coalesced into a single write.
+ */
+static void redis_send_next_command_unsafe(redis_pub_s *c) {
+  redis_engine_s *r = c->r;
+  if (!c->ready || c->next == &c->queue || c->sent >= r->pipeline)
+    return;
+  fio_ls_embd_s *first = c->next;
+  fio_ls_embd_s *pos = first;
+  size_t count = 0;
+  size_t len = 0;
+  while (pos != &c->queue && c->sent + count < r->pipeline) {
+    len += FIO_LS_EMBD_OBJ(redis_commands_s, node, pos)->cmd_len;
+    ++count;
+    pos = pos->next;
+  }
+  c->next = pos;
+  c->sent += count;
+  if (count == 1) {
+    redis_commands_s *cmd = FIO_LS_EMBD_OBJ(redis_commands_s, node, first);
+    fio_write2(c->i.uuid, .data.buffer = cmd->cmd, .length = cmd->cmd_len,
+               .after.dealloc = FIO_DEALLOC_NOOP);
     FIO_LOG_DEBUG("(redis %d) Sending (%zu bytes):\n%s\n", (int)getpid(),
                   cmd->cmd_len, cmd->cmd);
+    return;
   }
+  char *buf = fio_malloc(len);
+  FIO_ASSERT_ALLOC(buf);
+  len = 0;
+  for (pos = first; pos != c->next; pos = pos->next) {
+    redis_commands_s *cmd = FIO_LS_EMBD_OBJ(redis_commands_s, node, pos);
+    memcpy(buf + len, cmd->cmd, cmd->cmd_len);
+    len += cmd->cmd_len;
+  }
+  fio_write2(c->i.uuid, .data.buffer = buf, .length = len,
+             .after.dealloc = fio_free);
+  FIO_LOG_DEBUG("(redis %d) Sending %zu commands (%zu bytes)", (int)getpid(),
+                count, len);
+}
+
+/* the deferred flush task, sending all the commands queued so far */
+static void redis_flush_commands(void *r_, void *c_) {
+  redis_engine_s *r = r_;
+  redis_pub_s *c = c_;
+  fio_lock(&r->lock);
+  c->flush = 0;
+  redis_send_next_command_unsafe(c);
+  fio_unlock(&r->lock);
+  redis_free(r);
+}
+
+/* schedules a flush within lock (commands queued until then are coalesced) */
+static void redis_schedule_flush_unsafe(redis_pub_s *c) {
+  if (c->flush || c->next == &c->queue || c->sent >= c->r->pipeline)
+    return;
+  c->flush = 1;
+  fio_atomic_add(&c->r->ref, 1);
+  fio_defer(redis_flush_commands, c->r, c);
+}
+
+/* resets the pipeline (within lock), so all the commands are (re)sent */
+static void redis_pipeline_reset_unsafe(redis_pub_s *c, uint8_t ready) {
+  c->sent = 0;
+  c->next = c->queue.next;
+  c->ready = ready;
+}
+
+/* adds a command to a connection's queue (within lock) */
+static void redis_pub_push_unsafe(redis_pub_s *c, redis_commands_s *cmd) {
+  fio_ls_embd_push(&c->queue, &cmd->node);
+  if (c->next == &c->queue)
+    c->next = &cmd->node;
+  redis_schedule_flush_unsafe(c);
+}
+
+/**
+ * Routes a command to a publishing connection (within lock).
+ *
+ * Commands are routed by their key's hash slot, so commands for the same key
+ * use the same connection (and their order is preserved).
+ */
+static redis_pub_s *redis_route_unsafe(redis_engine_s *r, uint16_t slot) {
+  redis_node_s *node = r->nodes[r->slots ? r->slots[slot] : 0];
+  return node->pub + (slot % r->connections);
 }
 
 /* attach a command to the queue */
 static void redis_attach_cmd(redis_engine_s *r, redis_commands_s *cmd) {
+  cmd->slot = redis_cmd_slot(cmd->cmd, cmd->cmd_len);
+  fio_lock(&r->lock);
+  redis_pub_push_unsafe(redis_route_unsafe(r, cmd->slot), cmd);
+  fio_unlock(&r->lock);
+}
+
+/* *****************************************************************************
+Cluster Nodes and Redirection
+***************************************************************************** */
+
+/** defined later - connects to Redis */
+static void redis_connect(void *r, void *i);
+
+#define defer_redis_connect(r, i)                                              \
+  do {                                                                         \
+    fio_atomic_add(&(r)->ref, 1);                                              \
+    fio_defer(redis_connect, (r), (i));                                        \
+  } while (0);
+
+/** defined later - initializes a node's connection pool */
+static redis_node_s *redis_node_new(redis_engine_s *r, fio_str_info_s address,
+                                    fio_str_info_s port);
+
+/**
+ * Returns the index of the node at `address`:`port`, adding (and connecting)
+ * a new node if required (within lock).
+ */
+static uint16_t redis_node_find_unsafe(redis_engine_s *r,
+                                       fio_str_info_s address,
+                                       fio_str_info_s port) {
+  for (size_t n = 0; n < r->node_count; ++n) {
+    if (strlen(r->nodes[n]->address) == address.len &&
+        strlen(r->nodes[n]->port) == port.len &&
+        !memcmp(r->nodes[n]->address, address.data, address.len) &&
+        !memcmp(r->nodes[n]->port, port.data, port.len))
+      return (uint16_t)n;
+  }
+  if (r->node_count >= REDIS_CLUSTER_SLOTS)
+    return 0;
+  redis_node_s **tmp =
+      fio_realloc(r->nodes, sizeof(*r->nodes) * (r->node_count + 1));
+  FIO_ASSERT_ALLOC(tmp);
+  r->nodes = tmp;
+  r->nodes[r->node_count] = redis_node_new(r, address, port);
+  FIO_LOG_INFO("(redis %d) added cluster node %s:%s", (int)getpid(),
+               r->nodes[r->node_count]->address,
+               r->nodes[r->node_count]->port);
+  if (r->flag) {
+    for (size_t i = 0; i < r->connections; ++i)
+      defer_redis_connect(r, &r->nodes[r->node_count]->pub[i].i);
+  }
+  return (uint16_t)(r->node_count++);
+}
+
+/* updates the slot map using a `CLUSTER SLOTS` reply */
+static void redis_on_cluster_slots(fio_pubsub_engine_s *e, FIOBJ reply,
+                                   void *udata) {
+  redis_engine_s *r = (redis_engine_s *)e;
   fio_lock(&r->lock);
-  fio_ls_embd_push(&r->queue, &cmd->node);
-  redis_send_next_command_unsafe(r);
+  r->slots_refresh = 0;
+  if (!FIOBJ_TYPE_IS(reply, FIOBJ_T_ARRAY))
+    goto finish;
+  for (size_t i = 0; i < fiobj_ary_count(reply); ++i) {
+    /* [start, end, [address, port, id], replicas...] */
+    FIOBJ range = fiobj_ary_index(reply, i);
+    if (!FIOBJ_TYPE_IS(range, FIOBJ_T_ARRAY) || fiobj_ary_count(range) < 3)
+      continue;
+    FIOBJ master = fiobj_ary_index(range, 2);
+    if (!FIOBJ_TYPE_IS(master, FIOBJ_T_ARRAY) || fiobj_ary_count(master) < 2)
+      continue;
+    intptr_t start = fiobj_obj2num(fiobj_ary_index(range, 0));
+    intptr_t end = fiobj_obj2num(fiobj_ary_index(range, 1));
+    fio_str_info_s address = fiobj_obj2cstr(fiobj_ary_index(master, 0));
+    fio_str_info_s port = fiobj_obj2cstr(fiobj_ary_index(master, 1));
+    if (!address.len || !port.len || start < 0 || end < start ||
+        end >= REDIS_CLUSTER_SLOTS)
+      continue;
+    uint16_t index = redis_node_find_unsafe(r, address, port);
+    for (intptr_t slot = start; slot <= end; ++slot)
+      r->slots[slot] = index;
+  }
+finish:
   fio_unlock(&r->lock);
+  (void)udata;
+}
+
+/* requests the cluster's slot map from a node (within lock) */
+static void redis_cluster_refresh_unsafe(redis_engine_s *r, uint16_t node) {
+  static const char refresh[] = "*2\r\n$7\r\nCLUSTER\r\n$5\r\nSLOTS\r\n";
+  if (r->slots_refresh)
+    return;
+  r->slots_refresh = 1;
+  redis_commands_s *cmd = fio_malloc(sizeof(*cmd) + sizeof(refresh));
+  FIO_ASSERT_ALLOC(cmd);
+  *cmd = (redis_commands_s){.callback = redis_on_cluster_slots,
+                            .cmd_len = sizeof(refresh) - 1};
+  memcpy(cmd->cmd, refresh, sizeof(refresh));
+  redis_pub_push_unsafe(r->nodes[node]->pub, cmd);
+}
+
+/**
+ * Handles MOVED and ASK error replies in cluster mode (within lock), resending
+ * the command to the node it was redirected to.
+ *
+ * Returns 0 if the error wasn't a redirection (or the command was redirected
+ * too many times).
+ */
+static int redis_redirect_unsafe(redis_engine_s *r, redis_commands_s *cmd,
+                                 FIOBJ msg) {
+  static const char asking[] = "*1\r\n$6\r\nASKING\r\n";
+  fio_str_info_s err = fiobj_obj2cstr(msg);
+  uint8_t ask;
+  if (err.len && err.data[0] == '-') {
+    /* the parser keeps the error marker */
+    ++err.data;
+    --err.len;
+  }
+  if (err.len > 6 && !memcmp(err.data, "MOVED ", 6))
+    ask = 0;
+  else if (err.len > 4 && !memcmp(err.data, "ASK ", 4))
+    ask = 1;
+  else
+    return 0;
+  if (cmd->redirects >= REDIS_CLUSTER_REDIRECTS_MAX)
+    return 0;
+  /* "MOVED <slot> <address>:<port>" */
+  char *pos = (char *)memchr(err.data, ' ', err.len) + 1;
+  int64_t slot = fio_atol(&pos);
+  if (slot < 0 || slot >= REDIS_CLUSTER_SLOTS || *pos != ' ')
+    return 0;
+  fio_str_info_s address = {.data = pos + 1,
+                            .len = (size_t)(err.data + err.len - (pos + 1))};
+  fio_str_info_s port = {.data = NULL};
+  for (size_t i = address.len; i; --i) {
+    if (address.data[i - 1] == ':') {
+      port = (fio_str_info_s){.data = address.data + i,
+                              .len = address.len - i};
+      address.len = i - 1;
+      break;
+    }
+  }
+  if (!address.len || !port.len)
+    return 0;
+  uint16_t node = redis_node_find_unsafe(r, address, port);
+  redis_pub_s *c = r->nodes[node]->pub + (cmd->slot % r->connections);
+  ++cmd->redirects;
+  if (ask) {
+    /* ASKING must precede the command (on the same connection) */
+    redis_commands_s *tmp = fio_malloc(sizeof(*tmp) + sizeof(asking));
+    FIO_ASSERT_ALLOC(tmp);
+    *tmp = (redis_commands_s){.cmd_len = sizeof(asking) - 1};
+    memcpy(tmp->cmd, asking, sizeof(asking));
+    redis_pub_push_unsafe(c, tmp);
+  } else {
+    r->slots[slot] = node;
+    redis_cluster_refresh_unsafe(r, node);
+  }
+  FIO_LOG_DEBUG("(redis %d) command redirected to %s:%s", (int)getpid(),
+                r->nodes[node]->address, r->nodes[node]->port);
+  redis_pub_push_unsafe(c, cmd);
+  return 1;
 }
 
 /** a local static callback, called when the RESP message is complete. */
 static void resp_on_pub_message(struct redis_engine_internal_s *i, FIOBJ msg) {
-  redis_engine_s *r = pub2redis(i);
+  redis_pub_s *c = pub2conn(i);
+  redis_engine_s *r = c->r;
   // #if DEBUG
   if (FIO_LOG_LEVEL >= FIO_LOG_LEVEL_DEBUG) {
     FIOBJ json = fiobj_obj2json(msg, 1);
@@ -344,11 +761,21 @@ static void resp_on_pub_message(struct redis_engine_internal_s *i, FIOBJ msg) {
   }
   // #endif
   /* publishing / command parser */
+  /* replies arrive in the order the commands were sent (FIFO) */
+  fio_ls_embd_s *node = NULL;
+  int redirected = 0;
   fio_lock(&r->lock);
-  fio_ls_embd_s *node = fio_ls_embd_shift(&r->queue);
-  r->pub_sent = 0;
-  redis_send_next_command_unsafe(r);
+  if (c->sent) {
+    node = fio_ls_embd_shift(&c->queue);
+    --c->sent;
+    if (i->is_err && r->slots)
+      redirected = redis_redirect_unsafe(
+          r, FIO_LS_EMBD_OBJ(redis_commands_s, node, node), msg);
+  }
+  redis_schedule_flush_unsafe(c);
   fio_unlock(&r->lock);
+  if (redirected)
+    return; /* the command was resent */
   if (!node) {
     /* TODO: possible ping? from server?! not likely... */
     FIO_LOG_WARNING("(redis %d) received a reply when no command was sent.",
@@ -364,6 +791,25 @@ static void resp_on_pub_message(struct redis_engine_internal_s *i, FIOBJ msg) {
 Subscription Message Handling
 ***************************************************************************** */
 
+/**
+ * Publishes a message received from Redis to the facil.io cluster.
+ *
+ * A "pmessage" that follows a "message" for the same channel is skipped (the
+ * channel matched both a subscription and a pattern subscription).
+ */
+static void redis_sub_publish(redis_engine_s *r, fio_str_info_s channel,
+                              fio_str_info_s msg, uint8_t is_pattern) {
+  if (is_pattern) {
+    fio_str_info_s last = fio_str_info(&r->last_ch);
+    if (last.len == channel.len && !memcmp(last.data, channel.data, last.len))
+      return;
+  } else {
+    fio_str_clear(&r->last_ch);
+    fio_str_write(&r->last_ch, channel.data, channel.len);
+  }
+  fio_publish(.channel = channel, .message = msg, .engine = FIO_PUBSUB_CLUSTER);
+}
+
 /** a local static callback, called when the RESP message is complete. */
 static void resp_on_sub_message(struct redis_engine_internal_s *i, FIOBJ msg) {
   redis_engine_s *r = sub2redis(i);
@@ -383,42 +829,107 @@ static void resp_on_sub_message(struct redis_engine_internal_s *i, FIOBJ msg) {
     // }
     fio_str_info_s tmp = fiobj_obj2cstr(fiobj_ary_index(msg, 0));
     if (tmp.len == 7) { /* "message"  */
-      fiobj_free(r->last_ch);
-      r->last_ch = fiobj_dup(fiobj_ary_index(msg, 1));
-      fio_publish(.channel = fiobj_obj2cstr(r->last_ch),
-                  .message = fiobj_obj2cstr(fiobj_ary_index(msg, 2)),
-                  .engine = FIO_PUBSUB_CLUSTER);
+      redis_sub_publish(r, fiobj_obj2cstr(fiobj_ary_index(msg, 1)),
+                        fiobj_obj2cstr(fiobj_ary_index(msg, 2)), 0);
     } else if (tmp.len == 8) { /* "pmessage" */
-      if (!fiobj_iseq(r->last_ch, fiobj_ary_index(msg, 2)))
-        fio_publish(.channel = fiobj_obj2cstr(fiobj_ary_index(msg, 2)),
-                    .message = fiobj_obj2cstr(fiobj_ary_index(msg, 3)),
-                    .engine = FIO_PUBSUB_CLUSTER);
+      redis_sub_publish(r, fiobj_obj2cstr(fiobj_ary_index(msg, 2)),
+                        fiobj_obj2cstr(fiobj_ary_index(msg, 3)), 1);
+    }
+  }
+}
+
+/* reads a bulk String ("$<len>\r\n<data>\r\n") - returns 0 if incomplete. */
+static int redis_bulk_slice(uint8_t **ppos, uint8_t *end, fio_str_info_s *s) {
+  uint8_t *pos = *ppos;
+  size_t len = 0;
+  if (pos >= end)
+    return 0;
+  if (*pos != '$')
+    return -1;
+  ++pos;
+  while (pos < end && (size_t)(*pos - (uint8_t)'0') <= 9) {
+    len = (len * 10) + (*pos - (uint8_t)'0');
+    if (len > REDIS_SUB_SLICE_MAX)
+      return -1;
+    ++pos;
+  }
+  if (pos + 2 > end)
+    return 0;
+  if (pos[0] != '\r' || pos[1] != '\n')
+    return -1; /* i.e., "$-1\r\n" */
+  pos += 2;
+  if ((size_t)(end - pos) < len + 2)
+    return 0;
+  if (pos[len] != '\r' || pos[len + 1] != '\n')
+    return -1;
+  *s = (fio_str_info_s){.data = (char *)pos, .len = len};
+  *ppos = pos + len + 2;
+  return 1;
+}
+
+/**
+ * A fast path for the subscription stream, publishing "message" and
+ * "pmessage" messages directly from the read buffer (no objects are created).
+ *
+ * Returns the number of bytes consumed. Stops at the first reply that isn't a
+ * message, setting `*incomplete` if the message is only partially buffered.
+ */
+static size_t redis_sub_fast_path(redis_engine_s *r, uint8_t *buf, size_t len,
+                                  int *incomplete) {
+  static const char msg_head[] = "*3\r\n$7\r\nmessage\r\n";
+  static const char pmsg_head[] = "*4\r\n$8\r\npmessage\r\n";
+  uint8_t *pos = buf;
+  uint8_t *end = buf + len;
+  *incomplete = 0;
+  while (pos < end) {
+    const size_t left = (size_t)(end - pos);
+    fio_str_info_s pattern, channel, msg;
+    uint8_t is_pattern;
+    size_t head = sizeof(msg_head) - 1;
+    /* a partial header is compared against the available bytes */
+    if (!memcmp(pos, msg_head, (left < head ? left : head))) {
+      is_pattern = 0;
+    } else {
+      head = sizeof(pmsg_head) - 1;
+      if (memcmp(pos, pmsg_head, (left < head ? left : head)))
+        break;
+      is_pattern = 1;
+    }
+    if (left < head) {
+      *incomplete = 1;
+      break;
     }
+    uint8_t *tmp = pos + head;
+    int ret = 1;
+    if (is_pattern)
+      ret = redis_bulk_slice(&tmp, end, &pattern);
+    if (ret > 0)
+      ret = redis_bulk_slice(&tmp, end, &channel);
+    if (ret > 0)
+      ret = redis_bulk_slice(&tmp, end, &msg);
+    if (ret <= 0) {
+      *incomplete = !ret;
+      break;
+    }
+    redis_sub_publish(r, channel, msg, is_pattern);
+    pos = tmp;
   }
+  return (size_t)(pos - buf);
 }
 
 /* *****************************************************************************
 Connection Callbacks (fio_protocol_s) and Engine
 ***************************************************************************** */
 
-/** defined later - connects to Redis */
-static void redis_connect(void *r, void *i);
-
-#define defer_redis_connect(r, i)                                              \
-  do {                                                                         \
-    fio_atomic_add(&(r)->ref, 1);                                              \
-    fio_defer(redis_connect, (r), (i));                                        \
-  } while (0);
-
 /** Called when a data is available, but will not run concurrently */
 static void redis_on_data(intptr_t uuid, fio_protocol_s *pr) {
   struct redis_engine_internal_s *internal =
       (struct redis_engine_internal_s *)pr;
   uint8_t *buf;
   if (internal->on_message == resp_on_sub_message) {
-    buf = sub2redis(pr)->buf + REDIS_READ_BUFFER;
+    buf = sub2redis(pr)->buf;
   } else {
-    buf = pub2redis(pr)->buf;
+    buf = pub2conn(pr)->buf;
   }
   ssize_t i = fio_read(uuid, buf + internal->buf_pos,
                        REDIS_READ_BUFFER - internal->buf_pos);
@@ -426,7 +937,28 @@ static void redis_on_data(intptr_t uuid, fio_protocol_s *pr) {
     return;
 
   internal->buf_pos += i;
-  i = resp_parse(&internal->parser, buf, internal->buf_pos);
+  size_t consumed = 0;
+  if (internal->on_message == resp_on_sub_message && !internal->ary &&
+      !internal->str && !internal->parser.expecting &&
+      internal->parser.obj_countdown <= 1) {
+    /* the parser is between replies, try the Pub/Sub message fast path */
+    int incomplete;
+    consumed = redis_sub_fast_path(sub2redis(pr), buf, internal->buf_pos,
+                                   &incomplete);
+    if (incomplete && internal->buf_pos < REDIS_READ_BUFFER) {
+      /* wait for the rest of the message (it might fit in the buffer) */
+      internal->buf_pos -= consumed;
+      if (consumed)
+        memmove(buf, buf + consumed, internal->buf_pos);
+      return;
+    }
+  }
+  if (consumed == internal->buf_pos) {
+    internal->buf_pos = 0;
+    return;
+  }
+  i = resp_parse(&internal->parser, buf + consumed,
+                 internal->buf_pos - consumed);
   if (i) {
     memmove(buf, buf + internal->buf_pos - i, i);
   }
@@ -441,8 +973,7 @@ static void redis_on_close(intptr_t uuid, fio_protocol_s *pr) {
   redis_engine_s *r;
   if (internal->on_message == resp_on_sub_message) {
     r = sub2redis(pr);
-    fiobj_free(r->last_ch);
-    r->last_ch = FIOBJ_INVALID;
+    fio_str_clear(&r->last_ch);
     if (r->flag) {
       /* reconnection for subscription connection. */
       if (uuid != -1) {
@@ -456,15 +987,23 @@ static void redis_on_close(intptr_t uuid, fio_protocol_s *pr) {
       redis_free(r);
     }
   } else {
-    r = pub2redis(pr);
-    if (r->flag && uuid != -1) {
-      FIO_LOG_WARNING("(redis %d) publication connection lost. "
-                      "Reconnecting...",
-                      (int)getpid());
+    redis_pub_s *c = pub2conn(pr);
+    r = c->r;
+    fio_lock(&r->lock);
+    redis_pipeline_reset_unsafe(c, 0);
+    fio_unlock(&r->lock);
+    if (r->flag) {
+      /* reconnection for publication connection (resending the commands). */
+      if (uuid != -1) {
+        FIO_LOG_WARNING("(redis %d) publication connection lost (%s:%s). "
+                        "Reconnecting...",
+                        (int)getpid(), c->node->address, c->node->port);
+      }
+      fio_atomic_sub(&r->ref, 1);
+      defer_redis_connect(r, internal);
+    } else {
+      redis_free(r);
     }
-    r->pub_sent = 0;
-    fio_close(r->sub_data.uuid);
-    redis_free(r);
   }
   (void)uuid;
 }
@@ -486,8 +1025,8 @@ static void redis_sub_ping(intptr_t uuid, fio_protocol_s *pr) {
 
 /** Called on connection timeout. */
 static void redis_pub_ping(intptr_t uuid, fio_protocol_s *pr) {
-  redis_engine_s *r = pub2redis(pr);
-  if (fio_ls_embd_any(&r->queue)) {
+  redis_pub_s *c = pub2conn(pr);
+  if (c->sent) {
     FIO_LOG_WARNING("(redis) Redis server unresponsive, disconnecting.");
     fio_close(uuid);
     return;
@@ -495,7 +1034,9 @@ static void redis_pub_ping(intptr_t uuid, fio_protocol_s *pr) {
   redis_commands_s *cmd = fio_malloc(sizeof(*cmd) + 15);
   *cmd = (redis_commands_s){.cmd_len = 14};
   memcpy(cmd->cmd, "*1\r\n$4\r\nPING\r\n\0", 15);
-  redis_attach_cmd(r, cmd);
+  fio_lock(&c->r->lock);
+  redis_pub_push_unsafe(c, cmd);
+  fio_unlock(&c->r->lock);
 }
 
 /* *****************************************************************************
@@ -525,31 +1066,37 @@ static void redis_on_connect(intptr_t uuid, void *i_) {
                  .after.dealloc = FIO_DEALLOC_NOOP);
     }
     fio_pubsub_reattach(&r->en);
-    if (r->pub_data.uuid == -1) {
-      defer_redis_connect(r, &r->pub_data);
+    fio_lock(&r->lock);
+    for (size_t n = 0; n < r->node_count; ++n) {
+      for (size_t c = 0; c < r->connections; ++c) {
+        if (r->nodes[n]->pub[c].i.uuid == -1)
+          defer_redis_connect(r, &r->nodes[n]->pub[c].i);
+      }
     }
+    fio_unlock(&r->lock);
     FIO_LOG_INFO("(redis %d) subscription connection established.",
                  (int)getpid());
   } else {
-    r = pub2redis(i);
+    redis_pub_s *c = pub2conn(i);
+    r = c->r;
     if (r->auth_len) {
       redis_commands_s *cmd = fio_malloc(sizeof(*cmd) + r->auth_len);
       *cmd =
           (redis_commands_s){.cmd_len = r->auth_len, .callback = redis_on_auth};
       memcpy(cmd->cmd, r->auth, r->auth_len);
       fio_lock(&r->lock);
-      r->pub_sent = 0;
-      fio_ls_embd_unshift(&r->queue, &cmd->node);
-      redis_send_next_command_unsafe(r);
+      fio_ls_embd_unshift(&c->queue, &cmd->node);
+      redis_pipeline_reset_unsafe(c, 1);
+      redis_send_next_command_unsafe(c);
       fio_unlock(&r->lock);
     } else {
       fio_lock(&r->lock);
-      r->pub_sent = 0;
-      redis_send_next_command_unsafe(r);
+      redis_pipeline_reset_unsafe(c, 1);
+      redis_send_next_command_unsafe(c);
       fio_unlock(&r->lock);
     }
-    FIO_LOG_INFO("(redis %d) publication connection established.",
-                 (int)getpid());
+    FIO_LOG_INFO("(redis %d) publication connection established (%s:%s).",
+                 (int)getpid(), c->node->address, c->node->port);
   }
 
   i->protocol.rsv = 0;
@@ -575,8 +1122,14 @@ static void redis_connect(void *r_, void *i_) {
     redis_free(r);
     return;
   }
+  char *address = r->address;
+  char *port = r->port;
+  if (i->on_message != resp_on_sub_message) {
+    address = pub2conn(i)->node->address;
+    port = pub2conn(i)->node->port;
+  }
   // fio_atomic_add(&r->ref, 1);
-  i->uuid = fio_connect(.address = r->address, .port = r->port,
+  i->uuid = fio_connect(.address = address, .port = port,
                         .on_connect = redis_on_connect, .udata = i,
                         .on_fail = redis_on_connect_failed);
   fio_unlock(&r->lock_connection);
@@ -748,6 +1301,7 @@ static void redis_on_internal_cmd(fio_msg_s *msg) {
                             .udata = (cmd->cmd + msg->msg.len + 1),
                             .cmd_len = msg->msg.len};
   memcpy(cmd->cmd, msg->msg.data, msg->msg.len);
+  cmd->cmd[msg->msg.len] = 0;
   memcpy(cmd->cmd + msg->msg.len + 1, msg->channel.data, 28);
   redis_attach_cmd((redis_engine_s *)engine, cmd);
   // fprintf(stderr, " *** Attached CMD (%d) ***\n%s\n", getpid(), cmd->cmd);
@@ -800,6 +1354,84 @@ intptr_t redis_engine_send(fio_pubsub_engine_s *engine, FIOBJ command,
   return 0;
 }
 
+/* returns the number of decimal digits in `i` */
+static inline size_t redis_digits(size_t i) {
+  size_t len = 1;
+  while (i >= 10) {
+    i /= 10;
+    ++len;
+  }
+  return len;
+}
+
+/* writes a RESP command (an Array of bulk Strings), returns the length */
+static size_t redis_resp_write(char *dest, size_t argc,
+                               const char *const argv[],
+                               const size_t lens[]) {
+  char *pos = dest;
+  *pos++ = '*';
+  pos += fio_ltoa(pos, (int64_t)argc, 10);
+  *pos++ = '\r';
+  *pos++ = '\n';
+  for (size_t i = 0; i < argc; ++i) {
+    const size_t len = lens ? lens[i] : strlen(argv[i]);
+    *pos++ = '$';
+    pos += fio_ltoa(pos, (int64_t)len, 10);
+    *pos++ = '\r';
+    *pos++ = '\n';
+    memcpy(pos, argv[i], len);
+    pos += len;
+    *pos++ = '\r';
+    *pos++ = '\n';
+  }
+  *pos = 0;
+  return (size_t)(pos - dest);
+}
+
+/* sends a command (arguments) without building FIOBJ objects */
+intptr_t redis_engine_sendv(fio_pubsub_engine_s *engine, size_t argc,
+                            const char *const argv[], const size_t lens[],
+                            void (*callback)(fio_pubsub_engine_s *e,
+                                             FIOBJ reply, void *udata),
+                            void *udata) {
+  if ((uintptr_t)engine < 4) {
+    FIO_LOG_WARNING("(redis send) trying to use one of the core engines");
+    return -1;
+  }
+  if (!argc || !argv)
+    return -1;
+  /* compute the RESP length, so the command is written in a single pass */
+  size_t len = 3 + redis_digits(argc);
+  for (size_t i = 0; i < argc; ++i) {
+    const size_t arg_len = lens ? lens[i] : strlen(argv[i]);
+    len += 5 + redis_digits(arg_len) + arg_len;
+  }
+  if (getpid() == fio_parent_pid()) {
+    /* Root owns the connections, the command is queued directly */
+    redis_engine_s *r = (redis_engine_s *)engine;
+    redis_commands_s *cmd = fio_malloc(sizeof(*cmd) + len + 1);
+    FIO_ASSERT_ALLOC(cmd);
+    *cmd = (redis_commands_s){.callback = callback, .udata = udata};
+    cmd->cmd_len = redis_resp_write((char *)cmd->cmd, argc, argv, lens);
+    redis_attach_cmd(r, cmd);
+    return 0;
+  }
+  /* forward the command to Root (see `redis_engine_send`) */
+  char meta[28];
+  fio_u2str64(meta + 0, (uint64_t)engine);
+  fio_u2str64(meta + 8, (uint64_t)callback);
+  fio_u2str64(meta + 16, (uint64_t)udata);
+  fio_u2str32(meta + 24, (uint32_t)getpid());
+  char *buf = fio_malloc(len + 1);
+  FIO_ASSERT_ALLOC(buf);
+  len = redis_resp_write(buf, argc, argv, lens);
+  fio_publish(.filter = -2, .channel = {.data = meta, .len = 28},
+              .message = {.data = buf, .len = len}, .engine = FIO_PUBSUB_ROOT,
+              .is_json = 0);
+  fio_free(buf);
+  return 0;
+}
+
 /* *****************************************************************************
 Redis Engine Creation
 ***************************************************************************** */
@@ -822,12 +1454,12 @@ static void redis_on_engine_fork(void *r_) {
   r->lock = FIO_LOCK_INIT;
   fio_force_close(r->sub_data.uuid);
   r->sub_data.uuid = -1;
-  fio_force_close(r->pub_data.uuid);
-  r->pub_data.uuid = -1;
-  while (fio_ls_embd_any(&r->queue)) {
-    redis_commands_s *cmd =
-        FIO_LS_EMBD_OBJ(redis_commands_s, node, fio_ls_embd_pop(&r->queue));
-    fio_free(cmd);
+  for (size_t n = 0; n < r->node_count; ++n) {
+    for (size_t i = 0; i < r->connections; ++i) {
+      fio_force_close(r->nodes[n]->pub[i].i.uuid);
+      r->nodes[n]->pub[i].i.uuid = -1;
+      redis_pub_clear(r->nodes[n]->pub + i);
+    }
   }
   r->en = (fio_pubsub_engine_s){
       .subscribe = redis_on_mock_subscribe_child,
@@ -844,6 +1476,42 @@ static void redis_on_engine_fork(void *r_) {
                     .on_message = redis_on_internal_reply, .udata1 = r);
 }
 
+static redis_node_s *redis_node_new(redis_engine_s *r, fio_str_info_s address,
+                                    fio_str_info_s port) {
+  redis_node_s *node =
+      fio_malloc(sizeof(*node) + (sizeof(node->pub[0]) * r->connections) +
+                 address.len + 1 + port.len + 1);
+  FIO_ASSERT_ALLOC(node);
+  node->address = (char *)(node->pub + r->connections);
+  node->port = node->address + address.len + 1;
+  memcpy(node->address, address.data, address.len);
+  node->address[address.len] = 0;
+  memcpy(node->port, port.data, port.len);
+  node->port[port.len] = 0;
+  for (size_t i = 0; i < r->connections; ++i) {
+    redis_pub_s *c = node->pub + i;
+    c->i = (struct redis_engine_internal_s){
+        .protocol =
+            {
+                .on_data = redis_on_data,
+                .on_close = redis_on_close,
+                .on_shutdown = redis_on_shutdown,
+                .ping = redis_pub_ping,
+            },
+        .uuid = -1,
+        .on_message = resp_on_pub_message,
+    };
+    c->r = r;
+    c->node = node;
+    c->queue = (fio_ls_embd_s)FIO_LS_INIT(c->queue);
+    c->next = &c->queue;
+    c->sent = 0;
+    c->flush = 0;
+    c->ready = 0;
+  }
+  return node;
+}
+
 fio_pubsub_engine_s *redis_engine_create
 FIO_IGNORE_MACRO(struct redis_engine_create_args args) {
   if (getpid() != fio_parent_pid()) {
@@ -867,9 +1535,13 @@ FIO_IGNORE_MACRO(struct redis_engine_create_args args) {
   if (!args.port.data || !args.port.len) {
     args.port = (fio_str_info_s){.len = 4, .data = (char *)"6379"};
   }
+  if (!args.pipeline)
+    args.pipeline = REDIS_PIPELINE_DEPTH;
+  if (!args.connections)
+    args.connections = 1;
   redis_engine_s *r =
       fio_malloc(sizeof(*r) + args.port.len + 1 + args.address.len + 1 +
-                 args.auth.len + 1 + (REDIS_READ_BUFFER * 2));
+                 args.auth.len + 1 + REDIS_READ_BUFFER);
   FIO_ASSERT_ALLOC(r);
   *r = (redis_engine_s){
       .en =
@@ -878,18 +1550,6 @@ FIO_IGNORE_MACRO(struct redis_engine_create_args args) {
               .unsubscribe = redis_on_unsubscribe_root,
               .publish = redis_on_publish_root,
           },
-      .pub_data =
-          {
-              .protocol =
-                  {
-                      .on_data = redis_on_data,
-                      .on_close = redis_on_close,
-                      .on_shutdown = redis_on_shutdown,
-                      .ping = redis_pub_ping,
-                  },
-              .uuid = -1,
-              .on_message = resp_on_pub_message,
-          },
       .sub_data =
           {
               .protocol =
@@ -910,14 +1570,15 @@ FIO_IGNORE_MACRO(struct redis_engine_create_args args) {
       .cmd_reply =
           fio_subscribe(.filter = -10 - (uint32_t)getpid(), .udata1 = r,
                         .on_message = redis_on_internal_reply),
-      .address = ((char *)(r + 1) + (REDIS_READ_BUFFER * 2)),
-      .port =
-          ((char *)(r + 1) + (REDIS_READ_BUFFER * 2) + args.address.len + 1),
-      .auth = ((char *)(r + 1) + (REDIS_READ_BUFFER * 2) + args.address.len +
+      .address = ((char *)(r + 1) + REDIS_READ_BUFFER),
+      .port = ((char *)(r + 1) + REDIS_READ_BUFFER + args.address.len + 1),
+      .auth = ((char *)(r + 1) + REDIS_READ_BUFFER + args.address.len +
                args.port.len + 2),
+      .last_ch = FIO_STR_INIT,
       .auth_len = args.auth.len,
       .ref = 1,
-      .queue = FIO_LS_INIT(r->queue),
+      .connections = args.connections,
+      .pipeline = args.pipeline,
       .lock = FIO_LOCK_INIT,
       .lock_connection = FIO_LOCK_INIT,
       .ping_int = args.ping_interval,
@@ -927,6 +1588,14 @@ FIO_IGNORE_MACRO(struct redis_engine_create_args args) {
   memcpy(r->port, args.port.data, args.port.len);
   if (args.auth.len)
     memcpy(r->auth, args.auth.data, args.auth.len);
+  r->nodes = fio_malloc(sizeof(*r->nodes));
+  FIO_ASSERT_ALLOC(r->nodes);
+  r->nodes[0] = redis_node_new(r, args.address, args.port);
+  r->node_count = 1;
+  if (args.cluster) {
+    r->slots = fio_calloc(REDIS_CLUSTER_SLOTS, sizeof(*r->slots));
+    FIO_ASSERT_ALLOC(r->slots);
+  }
   fio_pubsub_attach(&r->en);
   redis_on_facil_start(r);
   fio_state_callback_add(FIO_CALL_IN_CHILD, redis_on_engine_fork, r);
@@ -25,6 +25,31 @@ struct redis_engine_create_args {
   fio_str_info_s auth;
   /** A `ping` will be sent every `ping_interval` interval or inactivity. */
   uint8_t ping_interval;
+  /**
+   * The maximal number of commands sent before waiting for a reply (pipeline
+   * depth), defaults to `REDIS_PIPELINE_DEPTH` (64).
+   *
+   * Commands queued while waiting are coalesced into a single write. A value
+   * of 1 sends a single command per round trip.
+   */
+  size_t pipeline;
+  /**
+   * The number of publishing (command) connections per Redis server, defaults
+   * to 1.
+   *
+   * Commands are routed to a connection by their key's hash slot, so commands
+   * for the same key preserve their order.
+   */
+  size_t connections;
+  /**
+   * If true, the server is assumed to be a Redis Cluster node.
+   *
+   * Commands are routed to the node that owns their key's hash slot (the key
+   * is assumed to be the command's first argument). The slot map is learned
+   * from `MOVED` redirections (followed by a `CLUSTER SLOTS` request) and `ASK`
+   * redirections are followed.
+   */
+  uint8_t cluster;
 };
 
 /**
@@ -64,6 +89,29 @@ intptr_t redis_engine_send(fio_pubsub_engine_s *engine, FIOBJ command,
                                             void *udata),
                            void *udata);
 
+/**
+ * Sends a Redis command through the engine's connection, without building a
+ * FIOBJ Array for the command.
+ *
+ * The command is composed of `argc` arguments (the first being the command's
+ * name). `lens` may be NULL, in which case the arguments must be NUL
+ * terminated Strings.
+ *
+ * The command is serialized (RESP) directly into the command buffer. Commands
+ * sent by the Root process are queued directly (the `callback` receives the
+ * reply object as parsed).
+ *
+ * Otherwise, see `redis_engine_send`.
+ *
+ *      const char *argv[] = {"LPUSH", "pids", pid_str};
+ *      redis_engine_sendv(engine, 3, argv, NULL, NULL, NULL);
+ */
+intptr_t redis_engine_sendv(fio_pubsub_engine_s *engine, size_t argc,
+                            const char *const argv[], const size_t lens[],
+                            void (*callback)(fio_pubsub_engine_s *e,
+                                             FIOBJ reply, void *udata),
+                            void *udata);
+
 /**
  * See the {pubsub.h} file for documentation about engines.
  *
@@ -11,6 +11,7 @@ Feel free to copy, use and enjoy according to the license provided.
  */
 #define H_FIO_TLS
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifndef FIO_TLS_PRINT_SECRET
@@ -18,6 +19,48 @@ Feel free to copy, use and enjoy according to the license provided.
 #define FIO_TLS_PRINT_SECRET 0
 #endif
 
+#ifndef FIO_TLS_KTLS
+/*
+ * if true, kernel TLS offload is enabled where supported (OpenSSL 3 on Linux),
+ * allowing files to be sent over TLS connections using `sendfile`.
+ */
+#define FIO_TLS_KTLS 1
+#endif
+
+#ifndef FIO_TLS_TICKET_ROTATE
+/*
+ * The number of seconds between session ticket key rotations.
+ *
+ * The ticket keys are shared by all the worker processes (so any worker can
+ * resume a session) and rotated by the root process. Tickets encrypted using
+ * the previous key are still accepted (and renewed), so tickets (and sessions)
+ * expire after this many seconds.
+ */
+#define FIO_TLS_TICKET_ROTATE 3600
+#endif
+
+#ifndef FIO_TLS_SESSION_CACHE
+/*
+ * The number of session cache slots in a server-side session cache shared by
+ * all the worker processes (0 disables the shared cache).
+ *
+ * The cache allows clients that don't support session tickets to resume
+ * sessions (using the session ID). Each slot requires about
+ * `FIO_TLS_SESSION_MAX_LEN` bytes of shared memory.
+ */
+#define FIO_TLS_SESSION_CACHE 0
+#endif
+
+#ifndef FIO_TLS_SESSION_MAX_LEN
+/* The maximum length of a serialized session in the shared session cache. */
+#define FIO_TLS_SESSION_MAX_LEN 1024
+#endif
+
+#ifndef FIO_TLS_HANDSHAKE_THREADS_MAX
+/* The maximal number of handshake threads (see `fio_tls_handshake_threads`). */
+#define FIO_TLS_HANDSHAKE_THREADS_MAX 32
+#endif
+
 /** An opaque type used for the SSL/TLS functions. */
 typedef struct fio_tls_s fio_tls_s;
 
@@ -89,6 +132,25 @@ uintptr_t fio_tls_alpn_count(fio_tls_s *tls);
  */
 void fio_tls_trust(fio_tls_s *, const char *public_cert_file);
 
+/**
+ * Performs the (CPU intensive) handshakes of connections using the `tls` object
+ * on a dedicated thread pool, so handshakes (i.e., during a reconnection storm)
+ * don't delay the events of established connections.
+ *
+ * The pool is shared by all the TLS objects. Each process runs up to `threads`
+ * handshake threads (the largest value requested, limited by
+ * `FIO_TLS_HANDSHAKE_THREADS_MAX`), capping the handshake concurrency.
+ * Completed handshakes wake the reactor (forcing an `on_data` event), which
+ * establishes the connection.
+ *
+ * Setting `threads` to zero (0) performs the handshakes on the reactor's
+ * threads (the default).
+ *
+ *      fio_tls_s * tls = fio_tls_new("www.example.com", NULL, NULL, NULL);
+ *      fio_tls_handshake_threads(tls, 2);
+ */
+void fio_tls_handshake_threads(fio_tls_s *tls, size_t threads);
+
 /**
  * Establishes an SSL/TLS connection as an SSL/TLS Server, using the specified
  * context / settings object.
@@ -126,4 +188,11 @@ void fio_tls_dup(fio_tls_s *tls);
  */
 void fio_tls_destroy(fio_tls_s *tls);
 
+#if DEBUG
+/** Tests the SSL/TLS implementation (when available). */
+void fio_tls_test(void);
+#else
+#define fio_tls_test()
+#endif
+
 #endif
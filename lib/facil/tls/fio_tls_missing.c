@@ -578,6 +578,18 @@ file_missing:
   exit(-1);
 }
 
+/**
+ * Performs the TLS handshakes of connections using the `tls` object on a
+ * dedicated (bounded) thread pool, instead of the reactor's threads.
+ *
+ * This implementation performs no handshake, so the value is ignored.
+ */
+void FIO_TLS_WEAK fio_tls_handshake_threads(fio_tls_s *tls, size_t threads) {
+  REQUIRE_LIBRARY();
+  (void)tls;
+  (void)threads;
+}
+
 /**
  * Establishes an SSL/TLS connection as an SSL/TLS Server, using the specified
  * context / settings object.
@@ -631,4 +643,10 @@ void FIO_TLS_WEAK fio_tls_destroy(fio_tls_s *tls) {
   free(tls);
 }
 
+#if DEBUG
+void FIO_TLS_WEAK fio_tls_test(void) {
+  fprintf(stderr, "=== Testing TLS handshakes\n* skipped (no TLS library).\n");
+}
+#endif
+
 #endif /* Library compiler flags */
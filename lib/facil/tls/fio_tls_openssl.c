@@ -17,11 +17,27 @@ Feel free to copy, use and enjoy according to the license provided.
 #if HAVE_OPENSSL
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+#include <pthread.h>
+#include <sys/mman.h>
 
 #define REQUIRE_LIBRARY()
 #define FIO_TLS_WEAK
 
+#if FIO_TLS_KTLS && defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+#define FIO_TLS_USE_KTLS 1
+#else
+#define FIO_TLS_USE_KTLS 0
+#endif
+
 /* *****************************************************************************
 The SSL/TLS helper data types (can be left as is)
 ***************************************************************************** */
@@ -139,6 +155,7 @@ struct fio_tls_s {
   SSL_CTX *ctx;            /* The Open SSL context (updated each time). */
   unsigned char *alpn_str; /* the computed server-format ALPN string */
   int alpn_len;
+  uint8_t offload; /* handshakes are performed by the handshake thread pool */
 };
 
 /* *****************************************************************************
@@ -294,14 +311,22 @@ SSL/TLS Context (re)-building
 ***************************************************************************** */
 
 #define TLS_BUFFER_LENGTH (1 << 15)
-typedef struct {
+typedef struct fio_tls_connection_s fio_tls_connection_s;
+struct fio_tls_connection_s {
   SSL *ssl;
   fio_tls_s *tls;
   void *alpn_arg;
   intptr_t uuid;
+  fio_tls_connection_s *next; /* handshake thread pool queue */
+  volatile size_t ref;        /* the connection and handshake pool tasks */
+  volatile size_t hs_requests; /* handshake steps requested from the pool */
   uint8_t is_server;
+  uint8_t offload;
+  volatile uint8_t offload_done; /* no more handshake steps (done / failed) */
+  volatile uint8_t handshake_done; /* the pool completed the handshake */
+  volatile uint8_t closed;
   volatile uint8_t alpn_ok;
-} fio_tls_connection_s;
+};
 
 static void fio_tls_alpn_fallback(fio_tls_connection_s *c) {
   alpn_s *alpn = alpn_default(c->tls);
@@ -377,6 +402,262 @@ static int fio_tls_pem_passwd_cb(char *buf, int size, int rwflag,
   (void)rwflag;
 }
 
+/* *****************************************************************************
+Session Resumption (shared by all the worker processes)
+
+The session ticket keys (and the optional session cache) are placed in a
+shared memory segment created by the root process (before the workers are
+forked), so a session can be resumed by any of the workers. The root process
+rotates the ticket keys every `FIO_TLS_TICKET_ROTATE` seconds.
+***************************************************************************** */
+
+typedef struct {
+  unsigned char name[16];
+  unsigned char aes[32];
+  unsigned char hmac[32];
+} fio_tls_ticket_key_s;
+
+#if FIO_TLS_SESSION_CACHE
+typedef struct {
+  unsigned int id_len;
+  unsigned int len;
+  unsigned char id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+  unsigned char data[FIO_TLS_SESSION_MAX_LEN];
+} fio_tls_session_s;
+#endif
+
+typedef struct {
+  fio_lock_i lock;
+  /* keys[0] encrypts new tickets, keys[1] (the previous key) only decrypts */
+  fio_tls_ticket_key_s keys[2];
+#if FIO_TLS_SESSION_CACHE
+  fio_tls_session_s sessions[FIO_TLS_SESSION_CACHE];
+#endif
+} fio_tls_shared_s;
+
+static fio_tls_shared_s *fio_tls_shared = NULL;
+/* the process that created (and manages) the shared memory segment */
+static pid_t fio_tls_shared_owner = 0;
+
+static void fio_tls_ticket_key_new(fio_tls_ticket_key_s *key) {
+  FIO_ASSERT(RAND_bytes((unsigned char *)key, sizeof(*key)) == 1,
+             "OpenSSL failed to create a session ticket key.");
+}
+
+/* rotates the ticket keys (the timer is inherited by forked workers) */
+static void fio_tls_ticket_rotate(void *ignr_) {
+  if (!fio_tls_shared || fio_tls_shared_owner != getpid())
+    return;
+  fio_tls_ticket_key_s key;
+  fio_tls_ticket_key_new(&key);
+  fio_lock(&fio_tls_shared->lock);
+  fio_tls_shared->keys[1] = fio_tls_shared->keys[0];
+  fio_tls_shared->keys[0] = key;
+  fio_unlock(&fio_tls_shared->lock);
+  OPENSSL_cleanse(&key, sizeof(key));
+  FIO_LOG_DEBUG("(%d) TLS session ticket keys rotated.", (int)getpid());
+  (void)ignr_;
+}
+
+static void fio_tls_shared_destroy(void *ignr_) {
+  if (fio_tls_shared_owner == getpid()) /* workers might still be running */
+    OPENSSL_cleanse(fio_tls_shared, sizeof(*fio_tls_shared));
+  munmap(fio_tls_shared, sizeof(*fio_tls_shared));
+  fio_tls_shared = NULL;
+  (void)ignr_;
+}
+
+/* creates the shared memory segment (once), returns -1 if unavailable */
+static int fio_tls_shared_init(void) {
+  static fio_lock_i lock = FIO_LOCK_INIT;
+  static uint8_t failed = 0;
+  if (fio_tls_shared)
+    return 0;
+  fio_lock(&lock);
+  if (fio_tls_shared || failed)
+    goto finish;
+  void *mem = mmap(NULL, sizeof(*fio_tls_shared), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    FIO_LOG_WARNING("(%d) TLS session resumption is limited to the worker "
+                    "process (no shared memory).",
+                    (int)getpid());
+    failed = 1;
+    goto finish;
+  }
+  fio_tls_shared = mem; /* mmap memory is zeroed out */
+  fio_tls_shared_owner = getpid();
+  fio_tls_ticket_key_new(fio_tls_shared->keys);
+  fio_tls_ticket_key_new(fio_tls_shared->keys + 1);
+  fio_run_every(FIO_TLS_TICKET_ROTATE * 1000, 0, fio_tls_ticket_rotate, NULL,
+                NULL);
+  fio_state_callback_add(FIO_CALL_AT_EXIT, fio_tls_shared_destroy, NULL);
+finish:
+  fio_unlock(&lock);
+  return (fio_tls_shared ? 0 : -1);
+}
+
+/* finds the ticket key, returns 1 for the current key, 2 for the previous */
+static int fio_tls_ticket_key_get(fio_tls_ticket_key_s *dest,
+                                  unsigned char *name, int enc) {
+  int ret = 0;
+  if (!fio_tls_shared)
+    return ret;
+  fio_lock(&fio_tls_shared->lock);
+  if (enc || !memcmp(name, fio_tls_shared->keys[0].name, 16)) {
+    *dest = fio_tls_shared->keys[0];
+    ret = 1;
+  } else if (!memcmp(name, fio_tls_shared->keys[1].name, 16)) {
+    *dest = fio_tls_shared->keys[1];
+    ret = 2; /* the ticket should be renewed */
+  }
+  fio_unlock(&fio_tls_shared->lock);
+  return ret;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int fio_tls_ticket_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+                             EVP_CIPHER_CTX *ctx, EVP_MAC_CTX *hctx, int enc) {
+  fio_tls_ticket_key_s key;
+  int ret = fio_tls_ticket_key_get(&key, name, enc);
+  if (!ret)
+    return 0; /* unknown key - perform a full handshake */
+  if (enc) {
+    memcpy(name, key.name, 16);
+    if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1)
+      goto error;
+  }
+  OSSL_PARAM params[] = {
+      OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac,
+                                        sizeof(key.hmac)),
+      OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)"SHA256",
+                                       0),
+      OSSL_PARAM_construct_end(),
+  };
+  if (!EVP_MAC_CTX_set_params(hctx, params) ||
+      !EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.aes, iv, enc))
+    goto error;
+  OPENSSL_cleanse(&key, sizeof(key));
+  return ret;
+error:
+  OPENSSL_cleanse(&key, sizeof(key));
+  return -1;
+  (void)ssl;
+}
+#else
+static int fio_tls_ticket_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+                             EVP_CIPHER_CTX *ctx, HMAC_CTX *hctx, int enc) {
+  fio_tls_ticket_key_s key;
+  int ret = fio_tls_ticket_key_get(&key, name, enc);
+  if (!ret)
+    return 0; /* unknown key - perform a full handshake */
+  if (enc) {
+    memcpy(name, key.name, 16);
+    if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1)
+      goto error;
+  }
+  if (!HMAC_Init_ex(hctx, key.hmac, sizeof(key.hmac), EVP_sha256(), NULL) ||
+      !EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.aes, iv, enc))
+    goto error;
+  OPENSSL_cleanse(&key, sizeof(key));
+  return ret;
+error:
+  OPENSSL_cleanse(&key, sizeof(key));
+  return -1;
+  (void)ssl;
+}
+#endif
+
+#if FIO_TLS_SESSION_CACHE
+static inline fio_tls_session_s *fio_tls_session_slot(const unsigned char *id,
+                                                      unsigned int len) {
+  uint64_t h = 0;
+  memcpy(&h, id, (len < 8 ? len : 8)); /* session IDs are random */
+  return fio_tls_shared->sessions + (h % FIO_TLS_SESSION_CACHE);
+}
+
+static int fio_tls_session_new_cb(SSL *ssl, SSL_SESSION *session) {
+  unsigned int id_len;
+  const unsigned char *id = SSL_SESSION_get_id(session, &id_len);
+  int len = i2d_SSL_SESSION(session, NULL);
+  if (!fio_tls_shared || !id_len || len <= 0 ||
+      len > FIO_TLS_SESSION_MAX_LEN)
+    return 0;
+  fio_tls_session_s *slot = fio_tls_session_slot(id, id_len);
+  fio_lock(&fio_tls_shared->lock);
+  unsigned char *pos = slot->data;
+  slot->len = (unsigned int)i2d_SSL_SESSION(session, &pos);
+  slot->id_len = id_len;
+  memcpy(slot->id, id, id_len);
+  fio_unlock(&fio_tls_shared->lock);
+  return 0; /* the session object isn't retained */
+  (void)ssl;
+}
+
+static SSL_SESSION *fio_tls_session_get_cb(SSL *ssl, const unsigned char *id,
+                                           int id_len, int *copy) {
+  unsigned char buf[FIO_TLS_SESSION_MAX_LEN];
+  unsigned int len = 0;
+  *copy = 0;
+  if (!fio_tls_shared || id_len <= 0 ||
+      id_len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+    return NULL;
+  fio_tls_session_s *slot = fio_tls_session_slot(id, (unsigned int)id_len);
+  fio_lock(&fio_tls_shared->lock);
+  if (slot->id_len == (unsigned int)id_len &&
+      !memcmp(slot->id, id, (size_t)id_len)) {
+    len = slot->len;
+    memcpy(buf, slot->data, len);
+  }
+  fio_unlock(&fio_tls_shared->lock);
+  if (!len)
+    return NULL;
+  const unsigned char *pos = buf;
+  SSL_SESSION *session = d2i_SSL_SESSION(NULL, &pos, (long)len);
+  OPENSSL_cleanse(buf, len);
+  return session; /* OpenSSL tests the session's timeout */
+  (void)ssl;
+}
+
+static void fio_tls_session_remove_cb(SSL_CTX *ctx, SSL_SESSION *session) {
+  unsigned int id_len;
+  const unsigned char *id = SSL_SESSION_get_id(session, &id_len);
+  if (!fio_tls_shared || !id_len)
+    return;
+  fio_tls_session_s *slot = fio_tls_session_slot(id, id_len);
+  fio_lock(&fio_tls_shared->lock);
+  if (slot->id_len == id_len && !memcmp(slot->id, id, id_len)) {
+    OPENSSL_cleanse(slot->data, slot->len);
+    slot->id_len = 0;
+    slot->len = 0;
+  }
+  fio_unlock(&fio_tls_shared->lock);
+  (void)ctx;
+}
+#endif /* FIO_TLS_SESSION_CACHE */
+
+/* sets up session resumption for the context */
+static void fio_tls_resumption_setup(SSL_CTX *ctx) {
+  static const unsigned char sid_ctx[] = "facil.io";
+  SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+  /* sessions shouldn't outlive their ticket key */
+  SSL_CTX_set_timeout(ctx, FIO_TLS_TICKET_ROTATE);
+  if (fio_tls_shared_init())
+    return; /* OpenSSL's defaults (per process keys and cache) */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, fio_tls_ticket_cb);
+#else
+  SSL_CTX_set_tlsext_ticket_key_cb(ctx, fio_tls_ticket_cb);
+#endif
+#if FIO_TLS_SESSION_CACHE
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER |
+                                          SSL_SESS_CACHE_NO_INTERNAL);
+  SSL_CTX_sess_set_new_cb(ctx, fio_tls_session_new_cb);
+  SSL_CTX_sess_set_get_cb(ctx, fio_tls_session_get_cb);
+  SSL_CTX_sess_set_remove_cb(ctx, fio_tls_session_remove_cb);
+#endif
+}
+
 /** Called when the library specific data for the context should be built */
 static void fio_tls_build_context(fio_tls_s *tls) {
   fio_tls_destroy_context(tls);
@@ -384,10 +665,19 @@ static void fio_tls_build_context(fio_tls_s *tls) {
 
   /* create new context */
   tls->ctx = SSL_CTX_new(TLS_method());
-  SSL_CTX_set_mode(tls->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+  /* idle connections release their (~34Kb) record buffers */
+  SSL_CTX_set_mode(tls->ctx,
+                   SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_RELEASE_BUFFERS);
+  /* read as many records as possible using a single system call */
+  SSL_CTX_set_read_ahead(tls->ctx, 1);
   /* see: https://caniuse.com/#search=tls */
   SSL_CTX_set_min_proto_version(tls->ctx, TLS1_2_VERSION);
   SSL_CTX_set_options(tls->ctx, SSL_OP_NO_COMPRESSION);
+#if FIO_TLS_USE_KTLS
+  /* OpenSSL falls back to user-space TLS if the kernel can't offload it */
+  SSL_CTX_set_options(tls->ctx, SSL_OP_ENABLE_KTLS);
+#endif
+  fio_tls_resumption_setup(tls->ctx);
 
   /* attach certificates */
   FIO_ARY_FOR(&tls->sni, pos) {
@@ -529,9 +819,27 @@ static void fio_tls_delayed_close(void *uuid, void *ignr_) {
 static ssize_t fio_tls_read(intptr_t uuid, void *udata, void *buf,
                             size_t count) {
   fio_tls_connection_s *c = udata;
+  /* stale errors (i.e., from another connection) confuse `SSL_get_error` */
+  ERR_clear_error();
   ssize_t ret = SSL_read(c->ssl, buf, count);
-  if (ret > 0)
+  if (ret > 0) {
+    /* consume the records already read (read-ahead) from the socket */
+    while ((size_t)ret < count && SSL_has_pending(c->ssl)) {
+      int tmp = SSL_read(c->ssl, (char *)buf + ret, count - ret);
+      if (tmp <= 0) {
+        /* an incomplete record (or an error the next read will report),
+         * don't leave the failure's error queue for the next SSL call */
+        ERR_clear_error();
+        return ret; /* wait for the socket */
+      }
+      ret += tmp;
+    }
+    /* buffered data won't trigger a socket event, schedule another read
+     * (`fio_force_event` doesn't lock the socket, so it's safe to call) */
+    if (SSL_has_pending(c->ssl))
+      fio_force_event(uuid, FIO_EVENT_ON_DATA);
     return ret;
+  }
   ret = SSL_get_error(c->ssl, ret);
   switch (ret) {
   case SSL_ERROR_SSL: /* overflow */
@@ -583,6 +891,7 @@ static ssize_t fio_tls_flush(intptr_t uuid, void *udata) {
 static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
                              size_t count) {
   fio_tls_connection_s *c = udata;
+  ERR_clear_error();
   ssize_t ret = SSL_write(c->ssl, buf, count);
   if (ret > 0)
     return ret;
@@ -608,6 +917,42 @@ static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
   (void)uuid;
 }
 
+#if FIO_TLS_USE_KTLS
+/**
+ * Sends a file using the kernel's TLS offload (when it's active for the
+ * connection), avoiding the user-space copy and encryption.
+ *
+ * Sets errno to ENOTSUP when the connection isn't offloaded to the kernel.
+ */
+static ssize_t fio_tls_sendfile(intptr_t uuid, void *udata, int fd,
+                                off_t offset, size_t count) {
+  fio_tls_connection_s *c = udata;
+  if (!BIO_get_ktls_send(SSL_get_wbio(c->ssl))) {
+    errno = ENOTSUP;
+    return -1;
+  }
+  ERR_clear_error();
+  ossl_ssize_t ret = SSL_sendfile(c->ssl, fd, offset, count, 0);
+  if (ret >= 0)
+    return ret;
+  switch (SSL_get_error(c->ssl, ret)) {
+  case SSL_ERROR_WANT_WRITE: /* overflow */
+  case SSL_ERROR_WANT_READ:
+    errno = EWOULDBLOCK;
+    break;
+  case SSL_ERROR_SYSCALL:
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      errno = EWOULDBLOCK;
+    break;
+  default:
+    errno = ECONNRESET;
+    break;
+  }
+  return -1;
+  (void)uuid;
+}
+#endif
+
 /**
  * The `close` callback should close the underlying socket / file descriptor.
  *
@@ -619,6 +964,7 @@ static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
  * */
 static ssize_t fio_tls_before_close(intptr_t uuid, void *udata) {
   fio_tls_connection_s *c = udata;
+  ERR_clear_error();
   SSL_shutdown(c->ssl);
   return 1;
   (void)uuid;
@@ -626,15 +972,24 @@ static ssize_t fio_tls_before_close(intptr_t uuid, void *udata) {
 /**
  * Called to perform cleanup after the socket was closed.
  * */
-static void fio_tls_cleanup(void *udata) {
-  fio_tls_connection_s *c = udata;
+static void fio_tls_connection_free(fio_tls_connection_s *c) {
+  if (fio_atomic_sub(&c->ref, 1))
+    return; /* a handshake pool task is still using the connection */
   if (!c->alpn_ok) {
     alpn_select(alpn_default(c->tls), -1, c->alpn_arg);
   }
+  /* closed connections (i.e., no close_notify) can still be resumed */
+  SSL_set_shutdown(c->ssl, SSL_get_shutdown(c->ssl) | SSL_SENT_SHUTDOWN);
   SSL_free(c->ssl);
   FIO_LOG_DEBUG("TLS cleanup for %p", (void *)c->uuid);
   fio_tls_destroy(c->tls); /* manage reference count */
-  free(udata);
+  free(c);
+}
+
+static void fio_tls_cleanup(void *udata) {
+  fio_tls_connection_s *c = udata;
+  c->closed = 1;
+  fio_tls_connection_free(c);
 }
 
 static fio_rw_hook_s FIO_TLS_HOOKS = {
@@ -643,11 +998,15 @@ static fio_rw_hook_s FIO_TLS_HOOKS = {
     .before_close = fio_tls_before_close,
     .flush = fio_tls_flush,
     .cleanup = fio_tls_cleanup,
+#if FIO_TLS_USE_KTLS
+    .sendfile = fio_tls_sendfile,
+#endif
 };
 
-static size_t fio_tls_handshake(intptr_t uuid, void *udata) {
-  fio_tls_connection_s *c = udata;
+/* performs a handshake step: returns 1 when done, -1 on error, else 0 */
+static int fio_tls_handshake_step(intptr_t uuid, fio_tls_connection_s *c) {
   int ri;
+  ERR_clear_error();
   if (c->is_server) {
     ri = SSL_accept(c->ssl);
   } else {
@@ -716,8 +1075,13 @@ static size_t fio_tls_handshake(intptr_t uuid, void *udata) {
       break;
     }
     fio_defer(fio_tls_delayed_close, (void *)uuid, NULL);
-    return 0;
+    return -1;
   }
+  return 1;
+}
+
+/* selects the protocol and switches to the established connection hooks */
+static size_t fio_tls_handshake_finish(intptr_t uuid, fio_tls_connection_s *c) {
   if (!c->alpn_ok) {
     c->alpn_ok = 1;
     if (c->is_server) {
@@ -740,7 +1104,7 @@ static size_t fio_tls_handshake(intptr_t uuid, void *udata) {
       alpn_select(alpn, c->uuid, c->alpn_arg);
     }
   }
-  if (fio_rw_hook_replace_unsafe(uuid, &FIO_TLS_HOOKS, udata) == 0) {
+  if (fio_rw_hook_replace_unsafe(uuid, &FIO_TLS_HOOKS, c) == 0) {
     FIO_LOG_DEBUG("Completed TLS handshake for %p", (void *)uuid);
   } else {
     FIO_LOG_DEBUG("Something went wrong during TLS handshake for %p",
@@ -771,6 +1135,155 @@ static size_t fio_tls_handshake(intptr_t uuid, void *udata) {
   return 1;
 }
 
+/* *****************************************************************************
+Handshake Thread Pool (see `fio_tls_handshake_threads`)
+
+Handshake steps are performed by a bounded pool of threads (per process), so
+CPU intensive handshakes don't delay the events of established connections.
+Once the handshake is complete, the pool forces an `on_data` event and the
+hooks are replaced by the next read / flush hook (under the socket's lock).
+***************************************************************************** */
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  fio_tls_connection_s *head;
+  fio_tls_connection_s *tail;
+  void *threads[FIO_TLS_HANDSHAKE_THREADS_MAX];
+  size_t count;  /* running threads */
+  size_t target; /* the pool's (maximal) size */
+  uint8_t stop;
+} fio_tls_hs_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* performs the requested handshake steps (steps requested while running are
+ * performed before the task returns) */
+static void fio_tls_hs_pool_perform(fio_tls_connection_s *c) {
+  size_t requests;
+  do {
+    requests = c->hs_requests;
+    if (c->offload_done || c->closed)
+      continue;
+    int ret = fio_tls_handshake_step(c->uuid, c);
+    if (ret == 0)
+      continue;
+    c->offload_done = 1;
+    if (ret == 1) {
+      /* the hooks can only be replaced from within a hook */
+      fio_atomic_xchange(&c->handshake_done, 1);
+      fio_force_event(c->uuid, FIO_EVENT_ON_DATA);
+    }
+  } while (fio_atomic_sub(&c->hs_requests, requests));
+  fio_tls_connection_free(c);
+}
+
+static void *fio_tls_hs_pool_thread(void *ignr_) {
+  pthread_mutex_lock(&fio_tls_hs_pool.lock);
+  while (!fio_tls_hs_pool.stop) {
+    fio_tls_connection_s *c = fio_tls_hs_pool.head;
+    if (!c) {
+      pthread_cond_wait(&fio_tls_hs_pool.cond, &fio_tls_hs_pool.lock);
+      continue;
+    }
+    fio_tls_hs_pool.head = c->next;
+    if (!fio_tls_hs_pool.head)
+      fio_tls_hs_pool.tail = NULL;
+    pthread_mutex_unlock(&fio_tls_hs_pool.lock);
+    fio_tls_hs_pool_perform(c);
+    pthread_mutex_lock(&fio_tls_hs_pool.lock);
+  }
+  pthread_mutex_unlock(&fio_tls_hs_pool.lock);
+  return NULL;
+  (void)ignr_;
+}
+
+/* releases the queued connections (must be called with the lock held) */
+static void fio_tls_hs_pool_clear(void) {
+  while (fio_tls_hs_pool.head) {
+    fio_tls_connection_s *c = fio_tls_hs_pool.head;
+    fio_tls_hs_pool.head = c->next;
+    c->hs_requests = 0;
+    fio_tls_connection_free(c);
+  }
+  fio_tls_hs_pool.tail = NULL;
+}
+
+/* stops the pool's threads (the pool restarts if handshakes are requested) */
+static void fio_tls_hs_pool_stop(void *ignr_) {
+  pthread_mutex_lock(&fio_tls_hs_pool.lock);
+  fio_tls_hs_pool.stop = 1;
+  pthread_cond_broadcast(&fio_tls_hs_pool.cond);
+  pthread_mutex_unlock(&fio_tls_hs_pool.lock);
+  for (size_t i = 0; i < fio_tls_hs_pool.count; ++i)
+    fio_thread_join(fio_tls_hs_pool.threads[i]);
+  pthread_mutex_lock(&fio_tls_hs_pool.lock);
+  fio_tls_hs_pool.count = 0;
+  fio_tls_hs_pool.stop = 0;
+  fio_tls_hs_pool_clear();
+  pthread_mutex_unlock(&fio_tls_hs_pool.lock);
+  (void)ignr_;
+}
+
+/* threads aren't inherited by forked processes */
+static void fio_tls_hs_pool_on_fork(void *ignr_) {
+  pthread_mutex_init(&fio_tls_hs_pool.lock, NULL);
+  pthread_cond_init(&fio_tls_hs_pool.cond, NULL);
+  fio_tls_hs_pool.count = 0;
+  fio_tls_hs_pool.stop = 0;
+  fio_tls_hs_pool_clear();
+  (void)ignr_;
+}
+
+/* requests a handshake step, returns -1 if the pool is unavailable */
+static int fio_tls_hs_pool_request(fio_tls_connection_s *c) {
+  if (fio_atomic_add(&c->hs_requests, 1) != 1)
+    return 0; /* the scheduled task will perform the step */
+  fio_atomic_add(&c->ref, 1);
+  pthread_mutex_lock(&fio_tls_hs_pool.lock);
+  if (fio_tls_hs_pool.count < fio_tls_hs_pool.target) {
+    void *thr = fio_thread_new(fio_tls_hs_pool_thread, NULL);
+    if (thr)
+      fio_tls_hs_pool.threads[fio_tls_hs_pool.count++] = thr;
+  }
+  if (!fio_tls_hs_pool.count) {
+    pthread_mutex_unlock(&fio_tls_hs_pool.lock);
+    FIO_LOG_ERROR("TLS handshake thread pool unavailable, handshakes will be "
+                  "performed by the reactor.");
+    c->hs_requests = 0;
+    fio_atomic_sub(&c->ref, 1);
+    return -1;
+  }
+  c->next = NULL;
+  if (fio_tls_hs_pool.tail)
+    fio_tls_hs_pool.tail->next = c;
+  else
+    fio_tls_hs_pool.head = c;
+  fio_tls_hs_pool.tail = c;
+  pthread_cond_signal(&fio_tls_hs_pool.cond);
+  pthread_mutex_unlock(&fio_tls_hs_pool.lock);
+  return 0;
+}
+
+/* returns 1 once the handshake is complete (the hooks were replaced) */
+static size_t fio_tls_handshake(intptr_t uuid, void *udata) {
+  fio_tls_connection_s *c = udata;
+  if (c->offload) {
+    if (c->handshake_done) {
+      c->offload = 0;
+      return fio_tls_handshake_finish(uuid, c);
+    }
+    if (c->offload_done || !fio_tls_hs_pool_request(c))
+      return 0; /* the pool performs the handshake */
+    c->offload = 0;
+  }
+  int ret = fio_tls_handshake_step(uuid, c);
+  if (ret <= 0)
+    return 0;
+  return fio_tls_handshake_finish(uuid, c);
+}
+
 static ssize_t fio_tls_read4handshake(intptr_t uuid, void *udata, void *buf,
                                       size_t count) {
   // FIO_LOG_DEBUG("TLS handshake from read %p", (void *)uuid);
@@ -789,6 +1302,14 @@ static ssize_t fio_tls_write4handshake(intptr_t uuid, void *udata,
   return -1;
 }
 
+/* the pool might be using the SSL object, no shutdown before the handshake */
+static ssize_t fio_tls_before_close4handshake(intptr_t uuid, void *udata) {
+  fio_tls_connection_s *c = udata;
+  if (c->offload)
+    return 0;
+  return fio_tls_before_close(uuid, udata);
+}
+
 static ssize_t fio_tls_flush4handshake(intptr_t uuid, void *udata) {
   // FIO_LOG_DEBUG("TLS handshake from flush %p", (void *)uuid);
   if (fio_tls_handshake(uuid, udata)) {
@@ -800,7 +1321,7 @@ static ssize_t fio_tls_flush4handshake(intptr_t uuid, void *udata) {
 static fio_rw_hook_s FIO_TLS_HANDSHAKE_HOOKS = {
     .read = fio_tls_read4handshake,
     .write = fio_tls_write4handshake,
-    .before_close = fio_tls_before_close,
+    .before_close = fio_tls_before_close4handshake,
     .flush = fio_tls_flush4handshake,
     .cleanup = fio_tls_cleanup,
 };
@@ -815,7 +1336,9 @@ static inline void fio_tls_attach2uuid(intptr_t uuid, fio_tls_s *tls,
       .tls = tls,
       .uuid = uuid,
       .ssl = SSL_new(tls->ctx),
+      .ref = 1,
       .is_server = is_server,
+      .offload = tls->offload,
       .alpn_ok = 0,
   };
   FIO_ASSERT_ALLOC(c->ssl);
@@ -955,6 +1478,33 @@ file_missing:
   exit(-1);
 }
 
+/**
+ * Performs the TLS handshakes of connections using the `tls` object on a
+ * dedicated (bounded) thread pool, instead of the reactor's threads.
+ *
+ * The pool is shared by all the TLS objects. Each process runs up to `threads`
+ * (the largest value requested) handshake threads. Zero (0) disables the
+ * offloading for the `tls` object.
+ */
+void FIO_TLS_WEAK fio_tls_handshake_threads(fio_tls_s *tls, size_t threads) {
+  static uint8_t initialized = 0;
+  REQUIRE_LIBRARY();
+  if (!tls)
+    return;
+  if (threads > FIO_TLS_HANDSHAKE_THREADS_MAX)
+    threads = FIO_TLS_HANDSHAKE_THREADS_MAX;
+  pthread_mutex_lock(&fio_tls_hs_pool.lock);
+  if (fio_tls_hs_pool.target < threads)
+    fio_tls_hs_pool.target = threads;
+  if (!initialized && threads) {
+    initialized = 1;
+    fio_state_callback_add(FIO_CALL_IN_CHILD, fio_tls_hs_pool_on_fork, NULL);
+    fio_state_callback_add(FIO_CALL_ON_FINISH, fio_tls_hs_pool_stop, NULL);
+  }
+  pthread_mutex_unlock(&fio_tls_hs_pool.lock);
+  tls->offload = (threads != 0);
+}
+
 /**
  * Establishes an SSL/TLS connection as an SSL/TLS Server, using the specified
  * context / settings object.
@@ -1008,4 +1558,105 @@ void FIO_TLS_WEAK fio_tls_destroy(fio_tls_s *tls) {
   free(tls);
 }
 
+#if DEBUG
+#include <poll.h>
+
+static struct {
+  char data[16];
+  size_t len;
+  size_t selected;
+} fio_tls_test_state;
+
+static void fio_tls_test_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  ssize_t r = fio_read(uuid, fio_tls_test_state.data + fio_tls_test_state.len,
+                       sizeof(fio_tls_test_state.data) - 1 -
+                           fio_tls_test_state.len);
+  if (r <= 0)
+    return;
+  fio_tls_test_state.len += r;
+  if (fio_tls_test_state.len >= 4)
+    fio_write(uuid, "pong", 4);
+  (void)pr;
+}
+
+static void fio_tls_test_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  (void)uuid;
+  (void)pr;
+}
+
+static fio_protocol_s fio_tls_test_protocol = {
+    .on_data = fio_tls_test_on_data,
+    .on_close = fio_tls_test_on_close,
+};
+
+static void fio_tls_test_on_selected(intptr_t uuid, void *udata_connection,
+                                     void *udata_tls) {
+  ++fio_tls_test_state.selected;
+  fio_attach(uuid, &fio_tls_test_protocol);
+  (void)udata_connection;
+  (void)udata_tls;
+}
+
+/* a blocking OpenSSL client, returns non-NULL on success */
+static void *fio_tls_test_client(void *fd_) {
+  const int fd = (int)(intptr_t)fd_;
+  char buf[4];
+  void *ok = NULL;
+  SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+  SSL *ssl = SSL_new(ctx);
+  SSL_set_fd(ssl, fd);
+  if (SSL_connect(ssl) == 1 && SSL_write(ssl, "ping", 4) == 4 &&
+      SSL_read(ssl, buf, 4) == 4 && !memcmp(buf, "pong", 4))
+    ok = (void *)1;
+  /* wait for the server to close the connection */
+  while (ok && SSL_read(ssl, buf, 4) > 0)
+    ;
+  SSL_free(ssl);
+  SSL_CTX_free(ctx);
+  close(fd);
+  return ok;
+}
+
+void fio_tls_test(void) {
+  fprintf(stderr, "=== Testing TLS handshakes (handshake thread pool)\n");
+  int sv[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed.");
+  fio_set_non_block(sv[0]);
+  fio_tls_s *tls = fio_tls_new("localhost", NULL, NULL, NULL);
+  fio_tls_alpn_add(tls, "test", fio_tls_test_on_selected, NULL, NULL);
+  fio_tls_handshake_threads(tls, 1);
+  const intptr_t uuid = fio_fd2uuid(sv[0]);
+  fio_tls_accept(uuid, tls, NULL);
+  pthread_t client;
+  FIO_ASSERT(!pthread_create(&client, NULL, fio_tls_test_client,
+                             (void *)(intptr_t)sv[1]),
+             "couldn't start the TLS client thread");
+  /* the reactor isn't running, so socket events are forced (~10 seconds) */
+  for (size_t i = 0; i < 10000 && fio_tls_test_state.len < 4; ++i) {
+    struct pollfd pfd = {.fd = sv[0], .events = POLLIN};
+    if (poll(&pfd, 1, 1) > 0) {
+      fio_force_event(uuid, FIO_EVENT_ON_DATA);
+      poll(NULL, 0, 1); /* the pool might be reading the data */
+    }
+    fio_defer_perform();
+  }
+  FIO_ASSERT(fio_tls_test_state.selected == 1,
+             "the ALPN protocol should be selected once the pool completed "
+             "the handshake (%zu)",
+             fio_tls_test_state.selected);
+  FIO_ASSERT(fio_tls_test_state.len == 4 &&
+                 !memcmp(fio_tls_test_state.data, "ping", 4),
+             "the TLS connection didn't read the client's data");
+  fio_flush_strong(uuid);
+  fio_force_close(uuid);
+  fio_defer_perform();
+  void *ok = NULL;
+  pthread_join(client, &ok);
+  FIO_ASSERT(ok, "the TLS client failed");
+  fio_tls_destroy(tls);
+  fio_tls_hs_pool_stop(NULL);
+  fprintf(stderr, "* passed.\n");
+}
+#endif
+
 #endif /* Library compiler flags */
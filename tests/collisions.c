@@ -53,6 +53,29 @@ typedef uintptr_t (*hashing_func_fn)(char *, size_t);
 #define FIO_ARY_DESTROY(a) fio_str_free((&a))
 #include <fio.h>
 
+/* Sets used for benchmarking the probing (FIO_SET_SIMD_PROBE) */
+#define FIO_SET_NAME probe_str
+#define FIO_SET_OBJ_TYPE fio_str_s *
+#define FIO_SET_OBJ_COMPARE(a, b) fio_str_iseq((a), (b))
+#include <fio.h>
+
+#define FIO_SET_NAME probe_str_simd
+#define FIO_SET_OBJ_TYPE fio_str_s *
+#define FIO_SET_OBJ_COMPARE(a, b) fio_str_iseq((a), (b))
+#define FIO_SET_SIMD_PROBE 1
+#include <fio.h>
+
+#define FIO_SET_NAME probe_int
+#define FIO_SET_KEY_TYPE uint64_t
+#define FIO_SET_OBJ_TYPE uint64_t
+#include <fio.h>
+
+#define FIO_SET_NAME probe_int_simd
+#define FIO_SET_KEY_TYPE uint64_t
+#define FIO_SET_OBJ_TYPE uint64_t
+#define FIO_SET_SIMD_PROBE 1
+#include <fio.h>
+
 static hash_name_s hash_names = FIO_SET_INIT;
 static words_s words = FIO_SET_INIT;
 
@@ -67,10 +90,16 @@ static void initialize_hash_names(void);
 static void print_hash_names(void);
 static char *hash_name(hashing_func_fn fn);
 static void cleanup(void);
+static void benchmark_set_probing(void);
 
 int main(int argc, char const *argv[]) {
   // FIO_LOG_LEVEL = FIO_LOG_LEVEL_DEBUG;
   initialize_cli(argc, argv);
+  if (fio_cli_get_bool("-p")) {
+    benchmark_set_probing();
+    fio_cli_end();
+    return 0;
+  }
   load_words();
   initialize_hash_names();
   if (fio_cli_get("-t")) {
@@ -105,10 +134,13 @@ static void initialize_cli(int argc, char const *argv[]) {
       FIO_CLI_PRINT("\t\tsha1"),
       FIO_CLI_PRINT("\t\trisky (fio_str_hash_risky)"),
       FIO_CLI_PRINT("\t\trisky2 (fio_str_hash_risky alternative)"),
+      FIO_CLI_PRINT("\t\twyhash (fio_wyhash)"),
       // FIO_CLI_PRINT("\t\txor (xor all bytes and length)"),
       FIO_CLI_STRING(
           "-dictionary -d a text file containing words separated by an "
           "EOL marker."),
+      FIO_CLI_BOOL("-probe -p benchmark the Set's probing (FIO_SET_SIMD_PROBE) "
+                   "and exit."),
       FIO_CLI_BOOL("-v make output more verbouse (debug mode)"));
   if (fio_cli_get_bool("-v"))
     FIO_LOG_LEVEL = FIO_LOG_LEVEL_DEBUG;
@@ -268,6 +300,10 @@ inline FIO_FUNC uintptr_t risky(char *data, size_t len) {
   return fio_risky_hash(data, len, 0);
 }
 
+inline FIO_FUNC uintptr_t wyhash(char *data, size_t len) {
+  return fio_wyhash(data, len, 0);
+}
+
 /* *****************************************************************************
 Hash setup and testing...
 ***************************************************************************** */
@@ -285,6 +321,7 @@ struct hash_fn_names_s {
 #endif
     {"risky", risky},
     {"risky2", risky2},
+    {"wyhash", wyhash},
     {NULL, NULL},
 };
 
@@ -343,6 +380,60 @@ static void test_hash_function_speed(hashing_func_fn h, char *name) {
   }
 }
 
+/* short keys (i.e., header names and pub/sub channels) are the common case */
+static void test_hash_function_speed_short(hashing_func_fn h) {
+  const size_t lengths[] = {4, 8, 13, 16, 24, 32, 48, 64};
+  const size_t rounds = (1UL << 22);
+  char key[64];
+  memset(key, 'K', sizeof(key));
+  for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+    uint64_t hash = 0;
+    clock_t start = clock();
+    for (size_t i = 0; i < rounds; ++i) {
+      key[0] = (char)i;
+      hash += h(key, lengths[l]);
+      __asm__ volatile("" ::: "memory");
+    }
+    clock_t end = clock();
+    fprintf(stderr, "* %2zu byte keys: %6.2f ns per hash\n", lengths[l],
+            ((double)(end - start) * 1000000000.0 / CLOCKS_PER_SEC) / rounds);
+  }
+}
+
+/* flips every input bit, measuring the bias of each output bit flipping */
+static void test_hash_function_avalanche(hashing_func_fn h) {
+  enum { AVALANCHE_BYTES = 24, AVALANCHE_ROUNDS = 4096 };
+  static uint32_t flips[AVALANCHE_BYTES * 8][64];
+  char data[AVALANCHE_BYTES];
+  memset(flips, 0, sizeof(flips));
+  for (size_t r = 0; r < AVALANCHE_ROUNDS; ++r) {
+    fio_rand_bytes(data, AVALANCHE_BYTES);
+    const uint64_t org = h(data, AVALANCHE_BYTES);
+    for (size_t bit = 0; bit < AVALANCHE_BYTES * 8; ++bit) {
+      data[bit >> 3] ^= (char)(1 << (bit & 7));
+      const uint64_t diff = org ^ h(data, AVALANCHE_BYTES);
+      data[bit >> 3] ^= (char)(1 << (bit & 7));
+      for (size_t o = 0; o < 64; ++o)
+        flips[bit][o] += (diff >> o) & 1;
+    }
+  }
+  double worst = 0, total = 0;
+  for (size_t bit = 0; bit < AVALANCHE_BYTES * 8; ++bit) {
+    for (size_t o = 0; o < 64; ++o) {
+      double bias = ((double)flips[bit][o] / AVALANCHE_ROUNDS) - 0.5;
+      if (bias < 0)
+        bias = 0 - bias;
+      if (bias > worst)
+        worst = bias;
+      total += bias;
+    }
+  }
+  fprintf(stderr,
+          "* Avalanche bias (%d byte keys): worst %.4f, average %.4f "
+          "(ideal ~0)\n",
+          AVALANCHE_BYTES, worst, total / (AVALANCHE_BYTES * 8 * 64));
+}
+
 static void test_hash_function(hashing_func_fn h) {
   size_t best_count = 0, best_capa = 1024;
 #define test_for_best()                                                        \
@@ -364,6 +455,9 @@ static void test_hash_function(hashing_func_fn h) {
   fprintf(stderr, "======= %s\n", name);
   /* Speed test */
   test_hash_function_speed(h, name);
+  test_hash_function_speed_short(h);
+  /* Quality test */
+  test_hash_function_avalanche(h);
   /* Collision test */
   collisions_s c = FIO_SET_INIT;
   size_t count = 0;
@@ -384,6 +478,96 @@ static void test_hash_function(hashing_func_fn h) {
   collisions_free(&c);
 }
 
+/* *****************************************************************************
+Set probing benchmark (FIO_SET_SIMD_PROBE vs. cuckoo steps)
+***************************************************************************** */
+
+#define PROBE_BENCH_COUNT (1UL << 20)
+#define PROBE_BENCH_ROUNDS 8
+
+static double probe_bench_ms(clock_t start) {
+  return (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+/* benchmarks a Set type (`set_name`) of String objects */
+#define PROBE_BENCH_STR(set_name, title, keys, count)                          \
+  do {                                                                         \
+    set_name##_s s_ = FIO_SET_INIT;                                            \
+    size_t found_ = 0;                                                         \
+    clock_t start_ = clock();                                                  \
+    for (size_t i_ = 0; i_ < (count); ++i_)                                    \
+      set_name##_insert(&s_, fio_str_hash((keys) + i_), (keys) + i_);          \
+    double insert_ = probe_bench_ms(start_);                                   \
+    start_ = clock();                                                          \
+    for (size_t r_ = 0; r_ < PROBE_BENCH_ROUNDS; ++r_)                         \
+      for (size_t i_ = 0; i_ < (count); ++i_)                                  \
+        found_ += !!set_name##_find(&s_, fio_str_hash((keys) + i_),            \
+                                    (keys) + i_);                              \
+    double find_ = probe_bench_ms(start_);                                     \
+    fprintf(stderr,                                                            \
+            "%-24s insert %8.2fms  find %8.2fms  (%zu/%zu found, capa %zu)\n", \
+            (title), insert_, find_, found_ / PROBE_BENCH_ROUNDS,              \
+            (size_t)(count), set_name##_capa(&s_));                            \
+    set_name##_free(&s_);                                                      \
+  } while (0)
+
+/* benchmarks a Hash Map type (`set_name`) of integers (hits and misses) */
+#define PROBE_BENCH_INT(set_name, title, keys, count)                          \
+  do {                                                                         \
+    set_name##_s s_ = FIO_SET_INIT;                                            \
+    size_t found_ = 0;                                                         \
+    clock_t start_ = clock();                                                  \
+    for (size_t i_ = 0; i_ < (count); ++i_)                                    \
+      set_name##_insert(&s_, (keys)[i_], (keys)[i_], i_ + 1, NULL);            \
+    double insert_ = probe_bench_ms(start_);                                   \
+    start_ = clock();                                                          \
+    for (size_t r_ = 0; r_ < PROBE_BENCH_ROUNDS; ++r_)                         \
+      for (size_t i_ = 0; i_ < (count); ++i_)                                  \
+        found_ += !!set_name##_find(&s_, (keys)[i_], (keys)[i_]);              \
+    double find_ = probe_bench_ms(start_);                                     \
+    start_ = clock();                                                          \
+    for (size_t r_ = 0; r_ < PROBE_BENCH_ROUNDS; ++r_)                         \
+      for (size_t i_ = 0; i_ < (count); ++i_)                                  \
+        found_ += !!set_name##_find(&s_, ~(keys)[i_], ~(keys)[i_]);            \
+    double miss_ = probe_bench_ms(start_);                                     \
+    fprintf(stderr,                                                            \
+            "%-24s insert %8.2fms  find %8.2fms  miss %8.2fms  "               \
+            "(%zu/%zu found, capa %zu)\n",                                     \
+            (title), insert_, find_, miss_, found_ / PROBE_BENCH_ROUNDS,       \
+            (size_t)(count), set_name##_capa(&s_));                            \
+    set_name##_free(&s_);                                                      \
+  } while (0)
+
+static void benchmark_set_probing(void) {
+  const size_t str_counts[] = {64, 4096, PROBE_BENCH_COUNT >> 2};
+  fio_str_s *strs = calloc(sizeof(*strs), PROBE_BENCH_COUNT >> 2);
+  uint64_t *ints = malloc(sizeof(*ints) * PROBE_BENCH_COUNT);
+  FIO_ASSERT_ALLOC(strs);
+  FIO_ASSERT_ALLOC(ints);
+  for (size_t i = 0; i < (PROBE_BENCH_COUNT >> 2); ++i)
+    fio_str_printf(strs + i, "header-name-%zu", i);
+  for (size_t i = 0; i < PROBE_BENCH_COUNT; ++i)
+    ints[i] = fio_rand64() | 1; /* never 0 or all bits set */
+  fprintf(stderr, "======= Set probing (%d lookup rounds)\n",
+          PROBE_BENCH_ROUNDS);
+  for (size_t i = 0; i < sizeof(str_counts) / sizeof(str_counts[0]); ++i) {
+    fprintf(stderr, "* %zu String objects:\n", str_counts[i]);
+    PROBE_BENCH_STR(probe_str, "cuckoo steps", strs, str_counts[i]);
+    PROBE_BENCH_STR(probe_str_simd, "FIO_SET_SIMD_PROBE", strs, str_counts[i]);
+  }
+  fprintf(stderr, "* %lu random integer keys:\n", PROBE_BENCH_COUNT);
+  PROBE_BENCH_INT(probe_int, "cuckoo steps", ints, PROBE_BENCH_COUNT);
+  PROBE_BENCH_INT(probe_int_simd, "FIO_SET_SIMD_PROBE", ints,
+                  PROBE_BENCH_COUNT);
+  for (size_t i = 0; i < (PROBE_BENCH_COUNT >> 2); ++i)
+    fio_str_free(strs + i);
+  free(strs);
+  free(ints);
+}
+
+#undef PROBE_BENCH_STR
+#undef PROBE_BENCH_INT
+
 /* *****************************************************************************
 Finsing a mod64 inverse
 See: https://lemire.me/blog/2017/09/18/computing-the-inverse-of-odd-integers/
@@ -0,0 +1,707 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+
+/* *****************************************************************************
+An HTTP / WebSocket load generator and regression benchmark.
+
+The server and the clients run within the same process (and reactor), so the
+results are reproducible and don't require any external tools (i.e., `wrk`).
+
+The clients are implemented using facil.io's own client side - raw `fio_connect`
+connections that parse the responses using the `http1_parser` (and
+`websocket_connect` for the WebSocket scenario).
+
+Each scenario measures the requests per second, the latency percentiles (p50,
+p99 and p99.9) and the number of memory allocations per request (see
+`fio_malloc_stats`). Allocations include those performed by the clients, which
+are the same for every version, so they can be compared between versions.
+
+* keep-alive: a single request in flight per connection.
+
+* pipeline: `-d` requests in flight per connection.
+
+* tls: same as keep-alive, over TLS (requires OpenSSL).
+
+* upload: a chunked (`transfer-encoding: chunked`) `-u` bytes POST request.
+
+* websocket: a pub/sub broadcast to `-c` WebSocket clients, `-d` messages in
+  flight. Every delivery counts as a request.
+
+When the `-s` argument is missing, the benchmark runs itself (in a new process
+per run) for every scenario.
+
+Run using:
+
+    make test/http
+
+Or, with specific arguments:
+
+    make test/http && ./tmp/fioapp -s pipeline -c 8 -d 32 -n 500000
+***************************************************************************** */
+
+#include <fio.h>
+#include <fio_cli.h>
+#include <fio_tls.h>
+#include <http.h>
+#include <http1_parser.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* *****************************************************************************
+Latency histogram (log-linear buckets, ~12.5% resolution)
+***************************************************************************** */
+
+#define BENCH_HIST_SIZE 512
+
+typedef struct {
+  uint64_t completed;
+  uint32_t hist[BENCH_HIST_SIZE];
+} bench_result_s;
+
+static inline size_t bench_hist_index(uint64_t ns) {
+  if (ns < 8)
+    return (size_t)ns;
+  size_t e = 63 - __builtin_clzll(ns);
+  return ((e - 2) << 3) | ((ns >> (e - 3)) & 7);
+}
+
+static inline uint64_t bench_hist_value(size_t index) {
+  if (index < 8)
+    return index;
+  return (uint64_t)(8 | (index & 7)) << ((index >> 3) - 1);
+}
+
+/* returns the latency (in nanoseconds) at the requested percentile */
+static uint64_t bench_hist_percentile(bench_result_s *r, double percentile) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < BENCH_HIST_SIZE; ++i)
+    total += r->hist[i];
+  if (!total)
+    return 0;
+  uint64_t target = (uint64_t)(total * percentile);
+  uint64_t count = 0;
+  for (size_t i = 0; i < BENCH_HIST_SIZE; ++i) {
+    count += r->hist[i];
+    if (count > target)
+      return bench_hist_value(i);
+  }
+  return bench_hist_value(BENCH_HIST_SIZE - 1);
+}
+
+static inline uint64_t bench_time_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000000) + (uint64_t)t.tv_nsec;
+}
+
+/* *****************************************************************************
+Benchmark state
+***************************************************************************** */
+
+/* the maximal number of requests in flight per connection */
+#define BENCH_MAX_DEPTH 256
+/* the client's read buffer (responses are small) */
+#define BENCH_BUFFER_SIZE 16384
+
+typedef enum {
+  BENCH_KEEP_ALIVE,
+  BENCH_PIPELINE,
+  BENCH_TLS,
+  BENCH_UPLOAD,
+  BENCH_WEBSOCKET,
+  BENCH_SCENARIO_COUNT,
+} bench_scenario_e;
+
+static const char *bench_names[BENCH_SCENARIO_COUNT] = {
+    [BENCH_KEEP_ALIVE] = "keep-alive", [BENCH_PIPELINE] = "pipeline",
+    [BENCH_TLS] = "tls",               [BENCH_UPLOAD] = "upload",
+    [BENCH_WEBSOCKET] = "websocket",
+};
+
+typedef struct bench_client_s bench_client_s;
+
+static struct {
+  bench_scenario_e scenario;
+  const char *port;
+  size_t connections;
+  size_t depth;
+  size_t requests;
+  size_t upload;
+  size_t timeout;
+  /* the raw request (`depth` copies, for pipelining) */
+  char *request;
+  size_t request_len;
+  /* run state */
+  fio_lock_i lock;
+  size_t connected;
+  size_t errors;
+  uint8_t finished;
+  uint64_t start_ns;
+  uint64_t end_ns;
+  size_t allocations;
+  bench_client_s **clients;
+  void *server_tls;
+  void *client_tls;
+  /* WebSocket broadcast state */
+  size_t server_open;
+  size_t messages;
+  size_t published;
+  char payload[64];
+  bench_result_s result;
+} bench = {.lock = FIO_LOCK_INIT};
+
+static fio_str_info_s bench_channel = {.data = "bench.broadcast", .len = 15};
+
+static size_t bench_allocations(void) { return fio_malloc_stats().allocations; }
+
+static void bench_print_header(void) {
+  fprintf(stdout, "%-10s %11s %6s %10s %12s %10s %10s %10s %11s\n", "scenario",
+          "connections", "depth", "requests", "requests/s", "p50 (us)",
+          "p99 (us)", "p999 (us)", "allocs/req");
+  fflush(stdout);
+}
+
+static void bench_report(void) {
+  bench_result_s *r = &bench.result;
+  if (!bench.end_ns)
+    bench.end_ns = bench_time_ns();
+  double sec = (bench.end_ns - bench.start_ns) / 1000000000.0;
+  if (!bench.start_ns || sec <= 0)
+    sec = 0.000000001;
+  const size_t allocs =
+      (bench.start_ns ? bench_allocations() - bench.allocations : 0);
+  fprintf(stdout, "%-10s %11zu %6zu %10zu %12.0f %10.1f %10.1f %10.1f %11.2f%s",
+          bench_names[bench.scenario], bench.connections, bench.depth,
+          (size_t)r->completed, r->completed / sec,
+          bench_hist_percentile(r, 0.50) / 1000.0,
+          bench_hist_percentile(r, 0.99) / 1000.0,
+          bench_hist_percentile(r, 0.999) / 1000.0,
+          (r->completed ? (double)allocs / r->completed : 0.0),
+          (r->completed >= bench.requests ? "" : " (incomplete)"));
+  if (bench.errors)
+    fprintf(stdout, " (%zu errors)", bench.errors);
+  fprintf(stdout, "\n");
+  fflush(stdout);
+}
+
+/*
+ * Records a completed request, stopping the reactor after the last one.
+ * Returns the number of completed requests.
+ */
+static uint64_t bench_record(uint64_t latency_ns) {
+  fio_atomic_add(&bench.result.hist[bench_hist_index(latency_ns)], 1);
+  const uint64_t completed = fio_atomic_add(&bench.result.completed, 1);
+  if (completed != bench.requests)
+    return completed;
+  bench.end_ns = bench_time_ns();
+  bench.finished = 1;
+  bench_report();
+  fio_stop();
+  return completed;
+}
+
+/* starts the clock once every connection was established */
+static void bench_start(void) {
+  bench.allocations = bench_allocations();
+  bench.start_ns = bench_time_ns();
+}
+
+/* *****************************************************************************
+The server
+***************************************************************************** */
+
+static void bench_on_request(http_s *h) {
+  static const char body[] = "Hello World!";
+  http_set_header(h, HTTP_HEADER_CONTENT_TYPE, http_mimetype_find("txt", 3));
+  http_send_body(h, (char *)body, sizeof(body) - 1);
+}
+
+static void bench_ws_server_open(ws_s *ws) {
+  websocket_subscribe(ws, .channel = bench_channel, .force_binary = 1);
+  fio_atomic_add(&bench.server_open, 1);
+}
+
+static void bench_on_upgrade(http_s *h, char *target, size_t len) {
+  if (len != 9 || memcmp(target, "websocket", 9)) {
+    http_send_error(h, 400);
+    return;
+  }
+  http_upgrade2ws(h, .on_open = bench_ws_server_open);
+}
+
+/* *****************************************************************************
+HTTP clients (`fio_connect` + `http1_parser`)
+***************************************************************************** */
+
+struct bench_client_s {
+  fio_protocol_s pr;
+  http1_parser_s parser;
+  intptr_t uuid;
+  size_t index;     /* the client's position in `bench.clients` */
+  size_t first;     /* the oldest request in flight (`sent` index) */
+  size_t in_flight; /* the number of requests in flight */
+  size_t responses; /* responses received during this `on_data` event */
+  size_t len;
+  uint64_t sent[BENCH_MAX_DEPTH];
+  char buf[BENCH_BUFFER_SIZE];
+};
+
+#define parser2client(p)                                                       \
+  ((bench_client_s *)((uintptr_t)(p) -                                         \
+                      (uintptr_t)(&((bench_client_s *)0)->parser)))
+
+/* sends `count` requests, all in a single packet */
+static void bench_client_send(bench_client_s *c, size_t count) {
+  const uint64_t now = bench_time_ns();
+  for (size_t i = 0; i < count; ++i)
+    c->sent[(c->first + c->in_flight + i) % BENCH_MAX_DEPTH] = now;
+  c->in_flight += count;
+  fio_write2(c->uuid, .data.buffer = bench.request,
+             .length = bench.request_len * count,
+             .after.dealloc = FIO_DEALLOC_NOOP);
+}
+
+static int bench_on_response(http1_parser_s *parser) {
+  bench_client_s *c = parser2client(parser);
+  if (!c->in_flight) {
+    fio_atomic_add(&bench.errors, 1);
+    return -1;
+  }
+  const uint64_t sent = c->sent[c->first];
+  c->first = (c->first + 1) % BENCH_MAX_DEPTH;
+  --c->in_flight;
+  ++c->responses;
+  bench_record(bench_time_ns() - sent);
+  return 0;
+}
+
+static int bench_on_status(http1_parser_s *parser, size_t status,
+                           char *status_str, size_t len) {
+  if (status != 200)
+    fio_atomic_add(&bench.errors, 1);
+  return 0;
+  (void)parser;
+  (void)status_str;
+  (void)len;
+}
+
+static int bench_on_ignored_str(http1_parser_s *parser, char *str,
+                                size_t len) {
+  return 0;
+  (void)parser;
+  (void)str;
+  (void)len;
+}
+
+static int bench_on_header(http1_parser_s *parser, char *name,
+                           size_t name_len, char *data, size_t data_len) {
+  return 0;
+  (void)parser;
+  (void)name;
+  (void)name_len;
+  (void)data;
+  (void)data_len;
+}
+
+static int bench_on_parsed_request(http1_parser_s *parser) {
+  return -1; /* the server shouldn't send requests */
+  (void)parser;
+}
+
+static int bench_on_parser_error(http1_parser_s *parser) {
+  bench_client_s *c = parser2client(parser);
+  fio_atomic_add(&bench.errors, 1);
+  fio_close(c->uuid);
+  return -1;
+}
+
+static void bench_client_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  bench_client_s *c = (bench_client_s *)pr;
+  ssize_t r;
+  while ((r = fio_read(uuid, c->buf + c->len, BENCH_BUFFER_SIZE - c->len)) >
+         0) {
+    c->len += r;
+    size_t pos = 0;
+    size_t consumed;
+    while (pos < c->len &&
+           (consumed = http1_fio_parser(
+                .parser = &c->parser, .buffer = c->buf + pos,
+                .length = c->len - pos, .on_request = bench_on_parsed_request,
+                .on_response = bench_on_response,
+                .on_method = bench_on_ignored_str,
+                .on_status = bench_on_status, .on_path = bench_on_ignored_str,
+                .on_query = bench_on_ignored_str,
+                .on_http_version = bench_on_ignored_str,
+                .on_header = bench_on_header,
+                .on_body_chunk = bench_on_ignored_str,
+                .on_error = bench_on_parser_error)) > 0)
+      pos += consumed;
+    if (pos) {
+      c->len -= pos;
+      memmove(c->buf, c->buf + pos, c->len);
+    }
+    if (c->len == BENCH_BUFFER_SIZE) {
+      FIO_LOG_ERROR("response too long.");
+      bench_on_parser_error(&c->parser);
+      return;
+    }
+  }
+  /* keep the same number of requests in flight */
+  if (c->responses && !bench.finished)
+    bench_client_send(c, c->responses);
+  c->responses = 0;
+}
+
+static void bench_client_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  if (!bench.finished && fio_is_running()) {
+    FIO_LOG_ERROR("client connection closed before the benchmark completed.");
+    fio_atomic_add(&bench.errors, 1);
+  }
+  fio_lock(&bench.lock);
+  bench.clients[((bench_client_s *)pr)->index] = NULL;
+  fio_unlock(&bench.lock);
+  free(pr);
+  (void)uuid;
+}
+
+static void bench_client_on_connect(intptr_t uuid, void *udata) {
+  bench_client_s *c = malloc(sizeof(*c));
+  FIO_ASSERT_ALLOC(c);
+  *c = (bench_client_s){
+      .pr = {.on_data = bench_client_on_data,
+             .on_close = bench_client_on_close},
+      .uuid = uuid,
+  };
+  fio_lock(&bench.lock);
+  c->index = bench.connected++;
+  bench.clients[c->index] = c;
+  const uint8_t all = (bench.connected == bench.connections);
+  fio_unlock(&bench.lock);
+  fio_attach(uuid, &c->pr);
+  if (!all)
+    return;
+  bench_start();
+  fio_lock(&bench.lock);
+  for (size_t i = 0; i < bench.connections; ++i) {
+    if (bench.clients[i])
+      bench_client_send(bench.clients[i], bench.depth);
+  }
+  fio_unlock(&bench.lock);
+  (void)udata;
+}
+
+static void bench_client_on_fail(intptr_t uuid, void *udata) {
+  FIO_LOG_ERROR("client connection failed.");
+  fio_atomic_add(&bench.errors, 1);
+  fio_stop();
+  (void)uuid;
+  (void)udata;
+}
+
+/* creates the raw request, `depth` copies of it (for pipelining) */
+static void bench_request_build(void) {
+  char head[256];
+  size_t head_len;
+  size_t body_len = 0;
+  if (bench.scenario == BENCH_UPLOAD) {
+    head_len = (size_t)snprintf(head, sizeof(head),
+                                "POST /upload HTTP/1.1\r\n"
+                                "Host: localhost\r\n"
+                                "Transfer-Encoding: chunked\r\n\r\n");
+    /* 1Kb chunks ("400\r\n" + data + "\r\n") and a last chunk */
+    body_len = ((bench.upload + 1023) / 1024) * 7 + bench.upload + 5;
+  } else {
+    head_len = (size_t)snprintf(head, sizeof(head),
+                                "GET / HTTP/1.1\r\n"
+                                "Host: localhost\r\n"
+                                "Accept: */*\r\n\r\n");
+  }
+  bench.request_len = head_len + body_len;
+  bench.request = malloc(bench.request_len * bench.depth);
+  FIO_ASSERT_ALLOC(bench.request);
+  char *pos = bench.request;
+  memcpy(pos, head, head_len);
+  pos += head_len;
+  for (size_t left = (body_len ? bench.upload : 0); left;) {
+    const size_t len = (left > 1024 ? 1024 : left);
+    pos += snprintf(pos, 8, "%zx\r\n", len);
+    memset(pos, 'x', len);
+    pos += len;
+    memcpy(pos, "\r\n", 2);
+    pos += 2;
+    left -= len;
+  }
+  if (body_len) {
+    memcpy(pos, "0\r\n\r\n", 5);
+    pos += 5;
+  }
+  bench.request_len = (size_t)(pos - bench.request);
+  for (size_t i = 1; i < bench.depth; ++i)
+    memcpy(bench.request + (i * bench.request_len), bench.request,
+           bench.request_len);
+}
+
+/* *****************************************************************************
+WebSocket clients (a pub/sub broadcast)
+***************************************************************************** */
+
+static void bench_ws_publish(void) {
+  if (fio_atomic_add(&bench.published, 1) > bench.messages)
+    return;
+  fio_u2str64(bench.payload, bench_time_ns());
+  fio_publish(.engine = FIO_PUBSUB_PROCESS, .channel = bench_channel,
+              .message = {.data = bench.payload, .len = sizeof(bench.payload)});
+}
+
+/* waits for the server's subscriptions before publishing anything */
+static void bench_ws_start(void *ignr_) {
+  if (!fio_is_running())
+    return;
+  if (bench.server_open != bench.connections) {
+    fio_run_every(1, 1, bench_ws_start, NULL, NULL);
+    return;
+  }
+  bench_start();
+  for (size_t i = 0; i < bench.depth; ++i)
+    bench_ws_publish();
+  (void)ignr_;
+}
+
+static void bench_ws_client_open(ws_s *ws) {
+  fio_lock(&bench.lock);
+  const uint8_t all = (++bench.connected == bench.connections);
+  fio_unlock(&bench.lock);
+  if (all)
+    bench_ws_start(NULL);
+  (void)ws;
+}
+
+static void bench_ws_client_message(ws_s *ws, fio_str_info_s msg,
+                                    uint8_t is_text) {
+  if (msg.len != sizeof(bench.payload)) {
+    fio_atomic_add(&bench.errors, 1);
+    return;
+  }
+  const uint64_t completed =
+      bench_record(bench_time_ns() - fio_str2u64(msg.data));
+  /* a message was delivered to every client (roughly), publish another */
+  if (!(completed % bench.connections) && !bench.finished)
+    bench_ws_publish();
+  (void)ws;
+  (void)is_text;
+}
+
+static void bench_ws_client_close(intptr_t uuid, void *udata) {
+  if (!uuid || (!bench.finished && fio_is_running())) {
+    FIO_LOG_ERROR("WebSocket client closed before the benchmark completed.");
+    fio_atomic_add(&bench.errors, 1);
+    if (!uuid)
+      fio_stop();
+  }
+  (void)udata;
+}
+
+/* *****************************************************************************
+Running a scenario
+***************************************************************************** */
+
+/* reports partial results if the run takes too long */
+static void bench_watchdog(void *ignr_) {
+  static size_t seconds = 0;
+  if (bench.finished || ++seconds < bench.timeout)
+    return;
+  FIO_LOG_WARNING("(%d) benchmark timed out.", (int)getpid());
+  bench.finished = 1;
+  bench_report();
+  fio_stop();
+  (void)ignr_;
+}
+
+static void bench_on_start(void *ignr_) {
+  fio_run_every(1000, 0, bench_watchdog, NULL, NULL);
+  if (bench.scenario == BENCH_WEBSOCKET) {
+    char url[64];
+    snprintf(url, sizeof(url), "ws://127.0.0.1:%s/", bench.port);
+    for (size_t i = 0; i < bench.connections; ++i)
+      websocket_connect(url, .on_open = bench_ws_client_open,
+                        .on_message = bench_ws_client_message,
+                        .on_close = bench_ws_client_close);
+    return;
+  }
+  for (size_t i = 0; i < bench.connections; ++i)
+    fio_connect(.address = "127.0.0.1", .port = bench.port,
+                .on_connect = bench_client_on_connect,
+                .on_fail = bench_client_on_fail, .tls = bench.client_tls);
+  (void)ignr_;
+}
+
+static int bench_run(void) {
+  if (bench.scenario == BENCH_TLS) {
+#if HAVE_OPENSSL
+    /* a self signed certificate, the client doesn't verify the peer */
+    bench.server_tls = fio_tls_new("localhost", NULL, NULL, NULL);
+    bench.client_tls = fio_tls_new(NULL, NULL, NULL, NULL);
+#else
+    fprintf(stdout, "%-10s (skipped, no TLS library available)\n",
+            bench_names[bench.scenario]);
+    return 0;
+#endif
+  }
+  if (bench.scenario == BENCH_WEBSOCKET) {
+    bench.messages = bench.requests / bench.connections;
+    if (!bench.messages)
+      bench.messages = 1;
+    bench.requests = bench.messages * bench.connections;
+  } else {
+    bench_request_build();
+  }
+  bench.clients = calloc(bench.connections, sizeof(*bench.clients));
+  FIO_ASSERT_ALLOC(bench.clients);
+  if (http_listen(bench.port, "127.0.0.1", .on_request = bench_on_request,
+                  .on_upgrade = bench_on_upgrade,
+                  .tls = bench.server_tls) == -1) {
+    perror("ERROR: couldn't listen for connections");
+    return -1;
+  }
+  fio_state_callback_add(FIO_CALL_ON_START, bench_on_start, NULL);
+  fio_start(.threads = fio_cli_get_i("-t"), .workers = 1);
+  if (!bench.finished)
+    bench_report();
+#if HAVE_OPENSSL
+  if (bench.server_tls)
+    fio_tls_destroy(bench.server_tls);
+  if (bench.client_tls)
+    fio_tls_destroy(bench.client_tls);
+#endif
+  free(bench.clients);
+  free(bench.request);
+  return (bench.errors ? -1 : 0);
+}
+
+/* *****************************************************************************
+Running every scenario
+***************************************************************************** */
+
+static void bench_run_child(char const *exe, bench_scenario_e scenario) {
+  char c[32], d[32], n[32], u[32], t[32], th[32];
+  size_t depth = bench.depth;
+  if (scenario != BENCH_PIPELINE && scenario != BENCH_WEBSOCKET)
+    depth = 1;
+  snprintf(c, sizeof(c), "%zu", bench.connections);
+  snprintf(d, sizeof(d), "%zu", depth);
+  snprintf(n, sizeof(n), "%zu", bench.requests);
+  snprintf(u, sizeof(u), "%zu", bench.upload);
+  snprintf(t, sizeof(t), "%zu", bench.timeout);
+  snprintf(th, sizeof(th), "%d", fio_cli_get_i("-t"));
+  char *argv[] = {(char *)exe,
+                  "-s",
+                  (char *)bench_names[scenario],
+                  "-c",
+                  c,
+                  "-d",
+                  d,
+                  "-n",
+                  n,
+                  "-u",
+                  u,
+                  "-T",
+                  t,
+                  "-t",
+                  th,
+                  "-p",
+                  (char *)bench.port,
+                  "-q",
+                  NULL};
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork failed");
+    return;
+  }
+  if (!pid) {
+    /* a new process group, as the reactor might signal the whole group */
+    setpgid(0, 0);
+    execv(exe, argv);
+    perror("execv failed");
+    exit(1);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+}
+
+int main(int argc, char const *argv[]) {
+  fio_cli_start(
+      argc, argv, 0, 0,
+      "An HTTP / WebSocket benchmark, running the server and the clients "
+      "within the same process. When the scenario is missing, every scenario "
+      "is tested (keep-alive, pipeline, tls, upload, websocket).",
+      FIO_CLI_STRING("-scenario -s the scenario to run."),
+      FIO_CLI_INT("-connections -c the number of client connections."),
+      FIO_CLI_INT("-depth -d requests in flight per connection (pipelining)."),
+      FIO_CLI_INT("-requests -n the number of requests to complete."),
+      FIO_CLI_INT("-upload -u the length of an uploaded (chunked) body."),
+      FIO_CLI_INT("-threads -t the number of threads."),
+      FIO_CLI_INT("-timeout -T seconds to wait before giving up."),
+      FIO_CLI_STRING("-port -p the port to listen to (on 127.0.0.1)."),
+      FIO_CLI_BOOL("-quiet -q don't print the table header."));
+  fio_cli_set_default("-c", "16");
+  fio_cli_set_default("-d", "16");
+  fio_cli_set_default("-n", "200000");
+  fio_cli_set_default("-u", "4096");
+  fio_cli_set_default("-t", "1");
+  fio_cli_set_default("-T", "30");
+  fio_cli_set_default("-p", "3031");
+
+  bench.port = fio_cli_get("-p");
+  bench.connections = fio_cli_get_i("-c");
+  bench.depth = fio_cli_get_i("-d");
+  bench.requests = fio_cli_get_i("-n");
+  bench.upload = fio_cli_get_i("-u");
+  bench.timeout = fio_cli_get_i("-T");
+  if (!bench.connections)
+    bench.connections = 1;
+  if (!bench.depth)
+    bench.depth = 1;
+  if (bench.depth > BENCH_MAX_DEPTH)
+    bench.depth = BENCH_MAX_DEPTH;
+  if (!bench.requests)
+    bench.requests = 1;
+
+  if (!fio_cli_get("-s")) {
+    /* run every scenario, a new process per run */
+    bench_print_header();
+    for (size_t i = 0; i < BENCH_SCENARIO_COUNT; ++i)
+      bench_run_child(argv[0], (bench_scenario_e)i);
+    fio_cli_end();
+    return 0;
+  }
+
+  const char *name = fio_cli_get("-s");
+  bench.scenario = BENCH_SCENARIO_COUNT;
+  for (size_t i = 0; i < BENCH_SCENARIO_COUNT; ++i) {
+    if (!strcmp(name, bench_names[i]))
+      bench.scenario = (bench_scenario_e)i;
+  }
+  if (bench.scenario == BENCH_SCENARIO_COUNT) {
+    fprintf(stderr, "ERROR: unknown scenario: %s\n", name);
+    fio_cli_end();
+    return 1;
+  }
+  if (bench.scenario != BENCH_PIPELINE && bench.scenario != BENCH_WEBSOCKET)
+    bench.depth = 1;
+  if (!fio_cli_get_bool("-q"))
+    bench_print_header();
+
+  FIO_LOG_LEVEL = FIO_LOG_LEVEL_WARNING;
+  int ret = bench_run();
+  fio_cli_end();
+  return (ret ? 1 : 0);
+}
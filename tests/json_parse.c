@@ -0,0 +1,631 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+
+/* *****************************************************************************
+A JSON parsing test and micro-benchmark.
+
+The two stage (indexed) parser is compared against the bytewise parser, using
+the callbacks they invoke and the number of bytes they consume, for generated
+documents (including escapes, comments and the parser's extensions). Every
+prefix of a document is tested as well, so streaming behaves the same.
+
+The structural index stage is tested for escape sequences of any length at any
+position against a simple scalar implementation, and validation is tested
+using valid and invalid documents.
+
+The parsers (and validation) are then benchmarked, as is the JSON formatting
+(`fiobj_obj2json`) of generated objects.
+
+Run using:
+
+    make test/json
+***************************************************************************** */
+
+#include <fio.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fio_json_parser.h>
+
+#include <fiobj.h>
+
+/* *****************************************************************************
+The callbacks record the events (so the parsers can be compared)
+***************************************************************************** */
+
+static char *trace;
+static size_t trace_len;
+static size_t trace_capa;
+static uint8_t trace_on = 1;
+
+static void trace_write(const char *data, size_t len) {
+  if (!trace_on)
+    return;
+  if (trace_len + len + 1 > trace_capa) {
+    trace_capa = (trace_len + len + 1) << 1;
+    trace = realloc(trace, trace_capa);
+    FIO_ASSERT_ALLOC(trace);
+  }
+  memcpy(trace + trace_len, data, len);
+  trace_len += len;
+  trace[trace_len] = 0;
+}
+
+static void trace_printf(const char *format, ...) {
+  if (!trace_on)
+    return;
+  char buf[64];
+  va_list argv;
+  va_start(argv, format);
+  int len = vsnprintf(buf, sizeof(buf), format, argv);
+  va_end(argv);
+  trace_write(buf, (size_t)len);
+}
+
+static void fio_json_on_null(json_parser_s *p) {
+  trace_write("n", 1);
+  (void)p;
+}
+static void fio_json_on_true(json_parser_s *p) {
+  trace_write("t", 1);
+  (void)p;
+}
+static void fio_json_on_false(json_parser_s *p) {
+  trace_write("f", 1);
+  (void)p;
+}
+static void fio_json_on_number(json_parser_s *p, long long i) {
+  trace_printf("i%lld", i);
+  (void)p;
+}
+static void fio_json_on_float(json_parser_s *p, double f) {
+  trace_printf("d%.17g", f);
+  (void)p;
+}
+static void fio_json_on_string(json_parser_s *p, void *start, size_t length) {
+  trace_printf("s%zu:", length);
+  trace_write(start, length);
+  (void)p;
+}
+static int fio_json_on_start_object(json_parser_s *p) {
+  trace_write("{", 1);
+  (void)p;
+  return 0;
+}
+static void fio_json_on_end_object(json_parser_s *p) {
+  trace_write("}", 1);
+  (void)p;
+}
+static int fio_json_on_start_array(json_parser_s *p) {
+  trace_write("[", 1);
+  (void)p;
+  return 0;
+}
+static void fio_json_on_end_array(json_parser_s *p) {
+  trace_write("]", 1);
+  (void)p;
+}
+static void fio_json_on_json(json_parser_s *p) {
+  trace_write("$", 1);
+  (void)p;
+}
+static void fio_json_on_error(json_parser_s *p) {
+  trace_write("!", 1);
+  (void)p;
+}
+
+/* *****************************************************************************
+Document generation
+***************************************************************************** */
+
+static char *doc;
+static size_t doc_len;
+static size_t doc_capa;
+
+static void doc_write(const char *data, size_t len) {
+  if (doc_len + len + 1 > doc_capa) {
+    doc_capa = (doc_len + len + 1) << 1;
+    doc = realloc(doc, doc_capa);
+    FIO_ASSERT_ALLOC(doc);
+  }
+  memcpy(doc + doc_len, data, len);
+  doc_len += len;
+  doc[doc_len] = 0;
+}
+#define DOC_WRITE(str) doc_write((str), sizeof(str) - 1)
+
+static void doc_space(uint8_t noise) {
+  static const char *spaces[] = {"", "", "", " ", "\n  ", "\t", "\r\n", ","};
+  size_t i = fio_rand64() & 7;
+  if (!noise && i == 7)
+    i = 0;
+  doc_write(spaces[i], strlen(spaces[i]));
+  if (noise && !(fio_rand64() & 31)) {
+    if (fio_rand64() & 1)
+      DOC_WRITE("/* a \"comment\" {[ */");
+    else
+      DOC_WRITE("// a \"comment\n");
+  }
+}
+
+static void doc_string(void) {
+  static const char *parts[] = {
+      "a",         "key",     "\\\"",           "\\\\",     "\\\\\\\"",
+      "\\u00e9",   "\\n",     "{[:,]}",         "caf\xc3\xa9", " ",
+      "012345678", "\\/\\t",  "\\\\\\\\\\\\\\", "\\\\\\\\", "#/",
+  };
+  DOC_WRITE("\"");
+  for (size_t i = fio_rand64() % 8; i; --i) {
+    size_t p = fio_rand64() % (sizeof(parts) / sizeof(parts[0]));
+    /* an odd sequence of backslashes escapes the next part */
+    if (p == 12)
+      DOC_WRITE("\\\\\\\\\\\\\\\"");
+    else
+      doc_write(parts[p], strlen(parts[p]));
+  }
+  /* long Strings span blocks */
+  if (!(fio_rand64() & 15))
+    for (size_t i = fio_rand64() % 200; i; --i)
+      DOC_WRITE("lorem ipsum ");
+  DOC_WRITE("\"");
+}
+
+static void doc_value(size_t depth, uint8_t noise) {
+  static const char *scalars[] = {
+      "true", "false", "null",   "0",      "-12",  "123456789", "1.5",
+      "-0.25e3", "1E-2", "3.14159265358979", "0x1F", "NaN", "1e400",
+  };
+  size_t type = fio_rand64() % (depth >= 3 ? 2 : 4);
+  switch (type) {
+  case 0: {
+    size_t i = fio_rand64() % (sizeof(scalars) / sizeof(scalars[0]));
+    if (!noise && i >= 10)
+      i = 0;
+    doc_write(scalars[i], strlen(scalars[i]));
+    break;
+  }
+  case 1:
+    doc_string();
+    break;
+  case 2:
+    DOC_WRITE("[");
+    for (size_t i = fio_rand64() % 8; i; --i) {
+      doc_space(noise);
+      doc_value(depth + 1, noise);
+      doc_space(noise);
+      if (i > 1)
+        DOC_WRITE(",");
+    }
+    DOC_WRITE("]");
+    break;
+  case 3:
+    DOC_WRITE("{");
+    for (size_t i = fio_rand64() % 8; i; --i) {
+      doc_space(noise);
+      doc_string();
+      doc_space(0);
+      DOC_WRITE(":");
+      doc_space(0);
+      doc_value(depth + 1, noise);
+      doc_space(noise);
+      if (i > 1)
+        DOC_WRITE(",");
+    }
+    DOC_WRITE("}");
+    break;
+  }
+}
+
+/* generates an object (or array) with at least `min` bytes */
+static void doc_generate(size_t min, uint8_t noise) {
+  doc_len = 0;
+  DOC_WRITE("[");
+  do {
+    doc_space(noise);
+    doc_value(0, noise);
+    DOC_WRITE(",");
+  } while (doc_len < min);
+  DOC_WRITE("{}]");
+}
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+
+static char *trace_copy(void) {
+  char *t = malloc(trace_len + 1);
+  FIO_ASSERT_ALLOC(t);
+  memcpy(t, trace, trace_len + 1);
+  return t;
+}
+
+/* compares the parsers, the data must be followed by a NUL byte */
+static void compare_parsers(const char *data, size_t len) {
+  json_parser_s p1 = {.depth = 0}, p2 = {.depth = 0};
+  trace_len = 0;
+  size_t c1 = fio_json_parse_bytewise(&p1, data, (uint8_t *)data,
+                                      (uint8_t *)data + len);
+  char *t1 = trace_copy();
+  trace_len = 0;
+  size_t c2 = fio_json_parse_indexed(&p2, data, len);
+  if (c1 != c2 || strcmp(t1, trace) || p1.depth != p2.depth ||
+      p1.dict != p2.dict || p1.key != p2.key) {
+    fprintf(stderr,
+            "FAILED: parsers differ (consumed %zu / %zu) for %zu bytes:\n%.*s\n"
+            "bytewise: %.200s\nindexed:  %.200s\n",
+            c1, c2, len, (int)(len > 400 ? 400 : len), data, t1, trace);
+    exit(-1);
+  }
+  free(t1);
+}
+
+/* compares the structural index with a simple (bytewise) implementation */
+static void test_index(void) {
+  /* random data made of quotes, backslashes, separators and letters */
+  static const char alphabet[] = "\"\\\\\\a b,{";
+  char data[512];
+  size_t expected[512];
+  for (size_t round = 0; round < 4000; ++round) {
+    size_t len = 1 + (fio_rand64() % sizeof(data));
+    size_t count = 0;
+    uint8_t escaped = 0, in_str = 0, scalar = 0;
+    for (size_t i = 0; i < len; ++i) {
+      const char c = data[i] = alphabet[fio_rand64() % (sizeof(alphabet) - 1)];
+      /* backslashes escape the next byte (even outside of Strings) */
+      const uint8_t is_escaped = escaped;
+      escaped = (c == '\\' && !escaped);
+      if (c == '"' && !is_escaped) {
+        expected[count++] = i;
+        in_str = !in_str;
+        scalar = 0;
+      } else if (in_str) {
+        continue;
+      } else if (c == ',' || c == '{') {
+        expected[count++] = i;
+        scalar = 0;
+      } else if (c == ' ') {
+        scalar = 0;
+      } else if (!scalar) {
+        expected[count++] = i;
+        scalar = 1;
+      }
+    }
+    fio_json_index_s s;
+    fio_json_index_init(&s, data, len, 1);
+    uint8_t *tok;
+    size_t i = 0;
+    while ((tok = fio_json_index_next(&s))) {
+      FIO_ASSERT(i < count && (size_t)(tok - (uint8_t *)data) == expected[i],
+                 "index mismatch at %zu (expected %zu) for:\n%.*s",
+                 (size_t)(tok - (uint8_t *)data), i < count ? expected[i] : 0,
+                 (int)len, data);
+      ++i;
+    }
+    FIO_ASSERT(i == count, "index missing positions (%zu / %zu) for:\n%.*s", i,
+               count, (int)len, data);
+    FIO_ASSERT(!s.in_string == !in_str, "String state error for:\n%.*s",
+               (int)len, data);
+  }
+  fprintf(stderr, "* structural index matches a bytewise implementation.\n");
+}
+
+static void test_parsers(void) {
+  for (size_t round = 0; round < 300; ++round) {
+    doc_generate(JSON_SIMD_MIN_LENGTH + (fio_rand64() % 4096), round & 1);
+    compare_parsers(doc, doc_len);
+    /* streaming: every prefix (the parsers require a NUL at the end) */
+    if (round < 16) {
+      for (size_t i = 1; i < doc_len; ++i) {
+        const char c = doc[i];
+        doc[i] = 0;
+        compare_parsers(doc, i);
+        doc[i] = c;
+      }
+    }
+  }
+  /* invalid and unusual data */
+  const char *samples[] = {
+      "[1, 2, true1, 3]", "[1, 2, 3]  ] more", "{\"a\" 1}",  "{\"a\": }",
+      "[\"a\" \"b\"]",    "{\"a\":{\"b\":[1,2,{}]}}",        "[1 2 3]",
+      "[truefalse]",      "[12abc]",                         "[\"x\\\"]",
+      "{\"a\"::1}",       "[1] [2]",                         "[nan, inf]",
+      "[1, // c\n 2]",    "[\"\\\\\"]",                      "{]",
+  };
+  /* pads the samples so the indexed parser is used (and tested) */
+  for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); ++i) {
+    doc_len = 0;
+    for (size_t j = 0; j < JSON_SIMD_MIN_LENGTH; ++j)
+      DOC_WRITE(" ");
+    doc_write(samples[i], strlen(samples[i]));
+    for (size_t j = 0; j < 100; ++j)
+      DOC_WRITE(" ");
+    compare_parsers(doc, doc_len);
+    compare_parsers(doc + JSON_SIMD_MIN_LENGTH, doc_len - JSON_SIMD_MIN_LENGTH);
+  }
+  /* a parser is reused for consecutive documents (i.e., NDJSON) */
+  doc_len = 0;
+  for (size_t j = 0; j < JSON_SIMD_MIN_LENGTH; ++j)
+    DOC_WRITE(" ");
+  DOC_WRITE("{\"a\":1}\n{\"b\":[2]}\n[3]");
+  for (size_t indexed = 0; indexed < 2; ++indexed) {
+    json_parser_s p = {.depth = 0};
+    size_t pos = 0, docs = 0;
+    trace_len = 0;
+    while (pos < doc_len) {
+      size_t c = indexed ? fio_json_parse_indexed(&p, doc + pos, doc_len - pos)
+                         : fio_json_parse_bytewise(&p, doc + pos,
+                                                   (uint8_t *)doc + pos,
+                                                   (uint8_t *)doc + doc_len);
+      if (!c || memchr(trace, '!', trace_len))
+        break;
+      pos += c;
+      ++docs;
+    }
+    FIO_ASSERT(docs == 3 && !memchr(trace, '!', trace_len),
+               "consecutive documents failed for the %s parser: %.*s",
+               indexed ? "indexed" : "bytewise", (int)trace_len, trace);
+  }
+  fprintf(stderr, "* the indexed parser matches the bytewise parser.\n");
+}
+
+static void test_validation(void) {
+  const char *valid[] = {
+      "{}",
+      "[]",
+      " [ ] ",
+      "0",
+      "-0.5e-3",
+      "\"\"",
+      "\"\\u00e9 caf\xc3\xa9 \\\\ \\\" \\/ \\b\\f\\n\\r\\t\"",
+      "{\"a\":[1,2,{\"b\":null}],\"c\":true,\"d\":false}",
+      "[1E5, 1e+5, 123.456, \"\xf0\x9f\x98\x80\"]",
+      "\n\t{\r\n\"key\" : \"value\" }\n",
+  };
+  const char *invalid[] = {
+      "",
+      " ",
+      "{",
+      "[1,]",
+      "[,1]",
+      "{\"a\":1,}",
+      "{\"a\" 1}",
+      "{1:1}",
+      "[1 2]",
+      "[01]",
+      "[1.]",
+      "[.5]",
+      "[+1]",
+      "[0x1F]",
+      "[NaN]",
+      "[tru]",
+      "[truex]",
+      "[1] [2]",
+      "\"abc",
+      "\"\\x\"",
+      "\"\\u12\"",
+      "\"a\tb\"",
+      "[1, // c\n 2]",
+      "\"\xc3\"",
+      "\"\xc0\xaf\"",
+      "\"\xed\xa0\x80\"",
+      "{\"a\":1]",
+      "[1}",
+      "]",
+      "\"a\":1",
+  };
+  for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); ++i)
+    FIO_ASSERT(fio_json_validate(valid[i], strlen(valid[i])),
+               "valid JSON failed validation: %s", valid[i]);
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+    FIO_ASSERT(!fio_json_validate(invalid[i], strlen(invalid[i])),
+               "invalid JSON passed validation: %s", invalid[i]);
+  /* nesting limits */
+  char nested[JSON_MAX_DEPTH * 2];
+  for (size_t i = 0; i < JSON_MAX_DEPTH - 1; ++i) {
+    nested[i] = '[';
+    nested[(JSON_MAX_DEPTH - 1) * 2 - 1 - i] = ']';
+  }
+  FIO_ASSERT(fio_json_validate(nested, (JSON_MAX_DEPTH - 1) * 2),
+             "nesting to the limit should be valid");
+  nested[JSON_MAX_DEPTH - 2] = '{';
+  FIO_ASSERT(!fio_json_validate(nested, (JSON_MAX_DEPTH - 1) * 2),
+             "mismatched nesting should be invalid");
+  /* multi-byte UTF-8 sequences crossing the (64 byte) block boundaries */
+  char utf8[160];
+  for (size_t i = 0; i < 140; ++i) {
+    memset(utf8, 'a', sizeof(utf8));
+    utf8[0] = '"';
+    memcpy(utf8 + 1 + i, "\xF0\x9D\x84\x9E", 4);
+    utf8[sizeof(utf8) - 1] = '"';
+    FIO_ASSERT(fio_json_validate(utf8, sizeof(utf8)),
+               "UTF-8 at offset %zu failed validation", i + 1);
+    utf8[1 + i + 3] = 'a'; /* truncated sequence */
+    FIO_ASSERT(!fio_json_validate(utf8, sizeof(utf8)),
+               "truncated UTF-8 at offset %zu passed validation", i + 1);
+    utf8[1 + i] = '\x80'; /* stray continuation byte */
+    utf8[1 + i + 1] = 'a';
+    utf8[1 + i + 2] = 'a';
+    FIO_ASSERT(!fio_json_validate(utf8, sizeof(utf8)),
+               "stray UTF-8 at offset %zu passed validation", i + 1);
+  }
+  /* generated documents (without the extensions) are valid */
+  for (size_t i = 0; i < 100; ++i) {
+    doc_generate(1 + (fio_rand64() % 8192), 0);
+    FIO_ASSERT(fio_json_validate(doc, doc_len),
+               "generated JSON failed validation:\n%.400s", doc);
+    /* ... and their prefixes aren't */
+    FIO_ASSERT(!fio_json_validate(doc, doc_len - 1 - (fio_rand64() % doc_len)),
+               "truncated JSON passed validation");
+  }
+  fprintf(stderr, "* validation passed.\n");
+}
+
+/* *****************************************************************************
+Benchmark
+***************************************************************************** */
+
+static uint64_t bench_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000000ULL) + (uint64_t)t.tv_nsec;
+}
+
+static void bench_report(const char *name, uint64_t ns, size_t bytes) {
+  if (!ns)
+    ns = 1;
+  fprintf(stderr, "  %-12s %8.2f MB/s\n", name,
+          (double)bytes * 1000.0 / (double)ns);
+}
+
+static void json_bench(uint8_t pretty) {
+  /* a ~1MB document */
+  doc_generate(1 << 20, 0);
+  if (pretty) {
+    /* indentation (white space runs) */
+    char *tmp = doc;
+    size_t len = doc_len;
+    doc = NULL;
+    doc_len = doc_capa = 0;
+    uint8_t in_str = 0;
+    for (size_t i = 0; i < len; ++i) {
+      doc_write(tmp + i, 1);
+      if (in_str) {
+        if (tmp[i] == '\\')
+          doc_write(tmp + (++i), 1);
+        else if (tmp[i] == '"')
+          in_str = 0;
+      } else if (tmp[i] == '"') {
+        in_str = 1;
+      } else if (tmp[i] == ',' || tmp[i] == '{' || tmp[i] == '[') {
+        DOC_WRITE("\n        ");
+      }
+    }
+    free(tmp);
+  }
+  const size_t rounds = 20;
+  fprintf(stderr, "\n%s document (%zu bytes):\n",
+          pretty ? "Indented" : "Compact", doc_len);
+  trace_on = 0;
+  uint64_t start = bench_ns();
+  for (size_t i = 0; i < rounds; ++i) {
+    json_parser_s p = {.depth = 0};
+    FIO_ASSERT(fio_json_parse_bytewise(&p, doc, (uint8_t *)doc,
+                                       (uint8_t *)doc + doc_len) == doc_len,
+               "bytewise parsing failed");
+  }
+  bench_report("bytewise", bench_ns() - start, doc_len * rounds);
+  start = bench_ns();
+  for (size_t i = 0; i < rounds; ++i) {
+    json_parser_s p = {.depth = 0};
+    FIO_ASSERT(fio_json_parse_indexed(&p, doc, doc_len) == doc_len,
+               "indexed parsing failed");
+  }
+  bench_report("indexed", bench_ns() - start, doc_len * rounds);
+  start = bench_ns();
+  for (size_t i = 0; i < rounds; ++i)
+    FIO_ASSERT(fio_json_validate(doc, doc_len), "validation failed");
+  bench_report("validation", bench_ns() - start, doc_len * rounds);
+  trace_on = 1;
+}
+
+static __attribute__((format(printf, 1, 2))) FIOBJ
+format_str(const char *format, ...) {
+  FIOBJ s = fiobj_str_buf(64);
+  va_list argv;
+  va_start(argv, format);
+  fiobj_str_vprintf(s, format, argv);
+  va_end(argv);
+  return s;
+}
+
+/* an API response like object (an Array of records) */
+static FIOBJ format_bench_object(size_t count) {
+  FIOBJ ary = fiobj_ary_new2(count);
+  for (size_t i = 0; i < count; ++i) {
+    FIOBJ h = fiobj_hash_new();
+    FIOBJ tmp;
+    tmp = fiobj_str_new("id", 2);
+    fiobj_hash_set(h, tmp, fiobj_num_new((intptr_t)i * 7919));
+    fiobj_free(tmp);
+    tmp = fiobj_str_new("name", 4);
+    fiobj_hash_set(h, tmp, format_str("User Name %zu", i));
+    fiobj_free(tmp);
+    tmp = fiobj_str_new("email", 5);
+    fiobj_hash_set(h, tmp, format_str("user.%zu@example.com", i));
+    fiobj_free(tmp);
+    tmp = fiobj_str_new("score", 5);
+    fiobj_hash_set(h, tmp, fiobj_float_new((double)i * 1.0001 + 0.1));
+    fiobj_free(tmp);
+    tmp = fiobj_str_new("active", 6);
+    fiobj_hash_set(h, tmp, (i & 1) ? fiobj_true() : fiobj_false());
+    fiobj_free(tmp);
+    tmp = fiobj_str_new("tags", 4);
+    FIOBJ tags = fiobj_ary_new2(3);
+    fiobj_ary_push(tags, fiobj_str_new("alpha", 5));
+    fiobj_ary_push(tags, fiobj_str_new("beta", 4));
+    fiobj_ary_push(tags, fiobj_num_new(-42));
+    fiobj_hash_set(h, tmp, tags);
+    fiobj_free(tmp);
+    tmp = fiobj_str_new("bio", 3);
+    fiobj_hash_set(h, tmp,
+                   format_str("A longer text field, with \"quotes\", "
+                                   "a tab\tand a new line\n (%zu).",
+                                   i));
+    fiobj_free(tmp);
+    fiobj_ary_push(ary, h);
+  }
+  return ary;
+}
+
+static void format_bench(size_t records, size_t rounds) {
+  FIOBJ o = format_bench_object(records);
+  for (uint8_t pretty = 0; pretty < 2; ++pretty) {
+    FIOBJ json = fiobj_obj2json(o, pretty);
+    size_t len = fiobj_obj2cstr(json).len;
+    fiobj_free(json);
+    fprintf(stderr, "\nFormatting (%s, %zu bytes):\n",
+            pretty ? "pretty" : "compact", len);
+    /* the best of a few runs (less noise) */
+    uint64_t best = 0;
+    for (size_t run = 0; run < 5; ++run) {
+      uint64_t start = bench_ns();
+      for (size_t i = 0; i < rounds; ++i)
+        fiobj_free(fiobj_obj2json(o, pretty));
+      start = bench_ns() - start;
+      if (!best || start < best)
+        best = start;
+    }
+    bench_report("fiobj2json", best, len * rounds);
+  }
+  fiobj_free(o);
+}
+
+int main(void) {
+  fprintf(stderr, "=== Testing JSON parsing (%s)\n",
+#if JSON_SIMD_SSE2
+          "SSE2"
+#elif JSON_SIMD_NEON
+          "NEON"
+#else
+          "scalar"
+#endif
+  );
+  test_index();
+  test_parsers();
+  test_validation();
+  json_bench(0);
+  json_bench(1);
+  format_bench(10000, 4);
+  format_bench(10, 4000);
+  free(doc);
+  free(trace);
+  return 0;
+}
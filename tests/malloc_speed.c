@@ -145,6 +145,120 @@ void *test_facil_malloc(void *ignr) {
   return (void *)result;
 }
 
+/* *****************************************************************************
+Multi-threaded scenarios
+***************************************************************************** */
+
+#define MT_ALLOCATIONS (1 << 20)
+#define MT_RING_SIZE 1024
+
+typedef struct {
+  void *(*malloc_func)(size_t);
+  void (*free_func)(void *);
+  /* producer / consumer ring (single producer, single consumer) */
+  void *volatile ring[MT_RING_SIZE];
+  volatile size_t head;
+  volatile size_t tail;
+} mt_test_s;
+
+/* each thread allocates and frees it's own memory */
+static void *mt_local_task(void *test_) {
+  mt_test_s *test = test_;
+  void *pointers[64];
+  for (size_t i = 0; i < MT_ALLOCATIONS; i += 64) {
+    for (size_t j = 0; j < 64; ++j) {
+      pointers[j] = test->malloc_func(((i + j) & 15) << 4 | 16);
+      ((char *)pointers[j])[0] = 'a';
+    }
+    for (size_t j = 0; j < 64; ++j)
+      test->free_func(pointers[j]);
+  }
+  return NULL;
+}
+
+/* memory is allocated by the producer and freed by the consumer */
+static void *mt_producer_task(void *test_) {
+  mt_test_s *test = test_;
+  for (size_t i = 0; i < MT_ALLOCATIONS; ++i) {
+    void *mem = test->malloc_func((i & 15) << 4 | 16);
+    ((char *)mem)[0] = 'a';
+    while (test->head - test->tail == MT_RING_SIZE)
+      fio_reschedule_thread();
+    test->ring[test->head & (MT_RING_SIZE - 1)] = mem;
+    __sync_synchronize();
+    ++test->head;
+  }
+  return NULL;
+}
+
+static void *mt_consumer_task(void *test_) {
+  mt_test_s *test = test_;
+  for (size_t i = 0; i < MT_ALLOCATIONS; ++i) {
+    while (test->head == test->tail)
+      fio_reschedule_thread();
+    __sync_synchronize();
+    test->free_func(test->ring[test->tail & (MT_RING_SIZE - 1)]);
+    ++test->tail;
+  }
+  return NULL;
+}
+
+static double mt_time(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + ((double)t.tv_nsec / 1000000000.0);
+}
+
+/* runs `count` threads (or producer / consumer pairs), returns seconds */
+static double test_mt(void *(*malloc_func)(size_t), void (*free_func)(void *),
+                      size_t count, int producer_consumer) {
+  pthread_t threads[32];
+  mt_test_s *tests = calloc(sizeof(*tests), count);
+  FIO_ASSERT_ALLOC(tests);
+  double start = mt_time();
+  for (size_t i = 0; i < count; ++i) {
+    tests[i].malloc_func = malloc_func;
+    tests[i].free_func = free_func;
+    if (producer_consumer) {
+      FIO_ASSERT(!pthread_create(threads + (i << 1), NULL, mt_producer_task,
+                                 tests + i) &&
+                     !pthread_create(threads + (i << 1) + 1, NULL,
+                                     mt_consumer_task, tests + i),
+                 "Couldn't spawn thread.");
+    } else {
+      FIO_ASSERT(!pthread_create(threads + i, NULL, mt_local_task, tests + i),
+                 "Couldn't spawn thread.");
+    }
+  }
+  for (size_t i = 0; i < (count << (!!producer_consumer)); ++i) {
+    FIO_ASSERT(pthread_join(threads[i], NULL) == 0, "Couldn't join thread");
+  }
+  double end = mt_time();
+  free(tests);
+  return end - start;
+}
+
+static void test_mt_all(void) {
+  const size_t counts[] = {1, 4, 16};
+  fprintf(stderr, "\n===== Multi-threaded scenarios (%d allocations per "
+                  "thread, seconds):\n",
+          MT_ALLOCATIONS);
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+    fprintf(stderr,
+            "* %zu threads, thread local malloc-free: system %.3lf, "
+            "facil.io %.3lf\n",
+            counts[i], test_mt(malloc, free, counts[i], 0),
+            test_mt(fio_malloc, fio_free, counts[i], 0));
+  }
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+    fprintf(stderr,
+            "* %zu producer / consumer pairs (cross-thread free): system "
+            "%.3lf, facil.io %.3lf\n",
+            counts[i], test_mt(malloc, free, counts[i], 1),
+            test_mt(fio_malloc, fio_free, counts[i], 1));
+  }
+}
+
 int main(void) {
 #if DEBUG
   fprintf(stderr, "\n=== WARNING: performance tests using the DEBUG mode are "
@@ -174,5 +288,7 @@ int main(void) {
   fio += (uintptr_t)thrd_result;
   fprintf(stderr, "Total Cycles: %zu\n", fio);
 
+  test_mt_all();
+
   return 0; // fio > system;
 }
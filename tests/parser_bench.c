@@ -0,0 +1,768 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+
+/* *****************************************************************************
+A parser micro-benchmark and fuzzing harness.
+
+The HTTP/1.x (`http1_fio_parser`), WebSocket (`websocket_consume`), RESP
+(`resp_parse`), JSON (`fio_json_parse`) and multipart MIME (`http_mime_parse`)
+parsers are benchmarked using generated corpora that resemble real world
+traffic:
+
+* http1: pipelined browser requests (long headers and cookies) and large
+  chunked (`transfer-encoding: chunked`) uploads.
+
+* websocket: fragmented (masked) client messages with interleaved pings and a
+  stream of small text messages.
+
+* resp: a pub/sub stream (subscription replies and published messages).
+
+* json: a large nested document and a stream of small documents (NDJSON).
+
+* mime: a `multipart/form-data` body with text fields and files.
+
+Each corpus is parsed repeatedly (in a single buffer) and the throughput
+(MB/s) and cycles per byte (using the CPU's time stamp counter, where
+available) are reported. The number of messages parsed is compared with the
+number of messages in the corpus, so broken parsers are detected as well.
+
+The `LLVMFuzzerTestOneInput` entry point feeds its input to one of the parsers.
+The first byte selects the parser and the second byte selects the size of the
+reads (0 == a single buffer), so the streaming (resumable) code paths are
+fuzzed as well. The corpora can be written as a seed corpus (`-w`) and crashing
+inputs can be replayed without libFuzzer (`-r`).
+
+Run using:
+
+    make test/parsers
+
+Or, with specific arguments:
+
+    make test/parsers && ./tmp/fioapp -p json -d 2000
+
+Fuzz using clang's libFuzzer:
+
+    make test/parsers && ./tmp/fioapp -w ./tmp/corpus
+    make test/fuzz && ./tmp/parser_fuzz ./tmp/corpus
+***************************************************************************** */
+
+#ifndef PARSER_FUZZ
+#include <fio.h>
+#include <fio_cli.h>
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PARSER_BENCH_CYCLES() __rdtsc()
+#else
+#define PARSER_BENCH_CYCLES() 0
+#endif
+
+#include <fio_json_parser.h>
+#include <http1_parser.h>
+#include <http_mime_parser.h>
+#include <resp_parser.h>
+#include <websocket_parser.h>
+
+/* counts the messages parsed by the callbacks (and any errors) */
+static size_t parser_messages;
+static size_t parser_errors;
+
+/* *****************************************************************************
+HTTP/1.x parser callbacks
+***************************************************************************** */
+
+static int h1_on_message(http1_parser_s *parser) {
+  ++parser_messages;
+  return 0;
+  (void)parser;
+}
+static int h1_on_status(http1_parser_s *parser, size_t status,
+                        char *status_str, size_t len) {
+  return 0;
+  (void)parser, (void)status, (void)status_str, (void)len;
+}
+static int h1_on_str(http1_parser_s *parser, char *str, size_t len) {
+  return 0;
+  (void)parser, (void)str, (void)len;
+}
+static int h1_on_header(http1_parser_s *parser, char *name, size_t name_len,
+                        char *data, size_t data_len) {
+  return 0;
+  (void)parser, (void)name, (void)name_len, (void)data, (void)data_len;
+}
+static int h1_on_error(http1_parser_s *parser) {
+  ++parser_errors;
+  return -1;
+  (void)parser;
+}
+
+/* *****************************************************************************
+WebSocket parser callbacks
+***************************************************************************** */
+
+static void websocket_on_unwrapped(void *udata, void *msg, uint64_t len,
+                                   char first, char last, char text,
+                                   unsigned char rsv) {
+  parser_messages += (last ? 1 : 0);
+  (void)udata, (void)msg, (void)len, (void)first, (void)text, (void)rsv;
+}
+static void websocket_on_protocol_ping(void *udata, void *msg, uint64_t len) {
+  (void)udata, (void)msg, (void)len;
+}
+static void websocket_on_protocol_pong(void *udata, void *msg, uint64_t len) {
+  (void)udata, (void)msg, (void)len;
+}
+static void websocket_on_protocol_close(void *udata) { (void)udata; }
+static void websocket_on_protocol_error(void *udata) {
+  ++parser_errors;
+  (void)udata;
+}
+
+/* *****************************************************************************
+RESP parser callbacks
+***************************************************************************** */
+
+static int resp_on_message(resp_parser_s *parser) {
+  ++parser_messages;
+  return 0;
+  (void)parser;
+}
+static int resp_on_number(resp_parser_s *parser, int64_t num) {
+  return 0;
+  (void)parser, (void)num;
+}
+static int resp_on_okay(resp_parser_s *parser) {
+  return 0;
+  (void)parser;
+}
+static int resp_on_null(resp_parser_s *parser) {
+  return 0;
+  (void)parser;
+}
+static int resp_on_start_string(resp_parser_s *parser, size_t str_len) {
+  return 0;
+  (void)parser, (void)str_len;
+}
+static int resp_on_string_chunk(resp_parser_s *parser, void *data,
+                                size_t len) {
+  return 0;
+  (void)parser, (void)data, (void)len;
+}
+static int resp_on_end_string(resp_parser_s *parser) {
+  return 0;
+  (void)parser;
+}
+static int resp_on_err_msg(resp_parser_s *parser, void *data, size_t len) {
+  return 0;
+  (void)parser, (void)data, (void)len;
+}
+static int resp_on_start_array(resp_parser_s *parser, size_t array_len) {
+  return 0;
+  (void)parser, (void)array_len;
+}
+static int resp_on_parser_error(resp_parser_s *parser) {
+  ++parser_errors;
+  return -1;
+  (void)parser;
+}
+
+/* *****************************************************************************
+JSON parser callbacks
+***************************************************************************** */
+
+static void fio_json_on_null(json_parser_s *p) { (void)p; }
+static void fio_json_on_true(json_parser_s *p) { (void)p; }
+static void fio_json_on_false(json_parser_s *p) { (void)p; }
+static void fio_json_on_number(json_parser_s *p, long long i) {
+  (void)p, (void)i;
+}
+static void fio_json_on_float(json_parser_s *p, double f) { (void)p, (void)f; }
+static void fio_json_on_string(json_parser_s *p, void *start, size_t length) {
+  (void)p, (void)start, (void)length;
+}
+static int fio_json_on_start_object(json_parser_s *p) {
+  return 0;
+  (void)p;
+}
+static void fio_json_on_end_object(json_parser_s *p) { (void)p; }
+static int fio_json_on_start_array(json_parser_s *p) {
+  return 0;
+  (void)p;
+}
+static void fio_json_on_end_array(json_parser_s *p) { (void)p; }
+static void fio_json_on_json(json_parser_s *p) {
+  ++parser_messages;
+  (void)p;
+}
+static void fio_json_on_error(json_parser_s *p) {
+  ++parser_errors;
+  (void)p;
+}
+
+/* *****************************************************************************
+MIME parser callbacks
+***************************************************************************** */
+
+static void http_mime_parser_on_data(http_mime_parser_s *parser, void *name,
+                                     size_t name_len, void *filename,
+                                     size_t filename_len, void *mimetype,
+                                     size_t mimetype_len, void *value,
+                                     size_t value_len) {
+  ++parser_messages;
+  (void)parser, (void)name, (void)name_len, (void)filename,
+      (void)filename_len, (void)mimetype, (void)mimetype_len, (void)value,
+      (void)value_len;
+}
+static void http_mime_parser_on_partial_start(
+    http_mime_parser_s *parser, void *name, size_t name_len, void *filename,
+    size_t filename_len, void *mimetype, size_t mimetype_len) {
+  (void)parser, (void)name, (void)name_len, (void)filename,
+      (void)filename_len, (void)mimetype, (void)mimetype_len;
+}
+static void http_mime_parser_on_partial_data(http_mime_parser_s *parser,
+                                             void *value, size_t value_len) {
+  (void)parser, (void)value, (void)value_len;
+}
+static void http_mime_parser_on_partial_end(http_mime_parser_s *parser) {
+  ++parser_messages;
+  (void)parser;
+}
+static size_t http_mime_decode_url(char *dest, const char *encoded,
+                                   size_t length) {
+  /* in place decoding (`dest == encoded`) is supported */
+  static const char hex[] = "0123456789abcdef";
+  size_t len = 0;
+  for (size_t i = 0; i < length; ++i) {
+    const char *h, *l;
+    if (encoded[i] == '%' && i + 2 < length &&
+        (h = memchr(hex, encoded[i + 1] | 32, 16)) &&
+        (l = memchr(hex, encoded[i + 2] | 32, 16))) {
+      dest[len++] = (char)(((h - hex) << 4) | (l - hex));
+      i += 2;
+      continue;
+    }
+    dest[len++] = (encoded[i] == '+' ? ' ' : encoded[i]);
+  }
+  return len;
+}
+
+/* *****************************************************************************
+Parser drivers
+
+Each driver parses `data` and returns the number of messages parsed (or -1 on
+error). A non-zero `step` limits the data available to the parser, revealing
+`step` more bytes whenever more data is required (simulating network reads).
+
+`data` must be followed by a NUL byte and might be edited by the parser.
+***************************************************************************** */
+
+static const char mime_content_type[] =
+    "multipart/form-data; boundary=----WebKitFormBoundary7MA4YWxkTrZu0gW";
+
+/* advances the visible data, returns 0 once all the data was visible */
+static inline int parser_reveal(size_t *visible, size_t len, size_t step) {
+  if (*visible >= len)
+    return 0;
+  *visible += step;
+  if (*visible > len)
+    *visible = len;
+  return 1;
+}
+
+static ssize_t parse_http1(char *data, size_t len, size_t step) {
+  http1_parser_s parser = {.udata = NULL};
+  size_t pos = 0;
+  size_t visible = (step ? (step < len ? step : len) : len);
+  parser_messages = parser_errors = 0;
+  while (!parser_errors) {
+    size_t consumed = http1_fio_parser(
+        .parser = &parser, .buffer = data + pos, .length = visible - pos,
+        .on_request = h1_on_message, .on_response = h1_on_message,
+        .on_method = h1_on_str, .on_status = h1_on_status,
+        .on_path = h1_on_str, .on_query = h1_on_str,
+        .on_http_version = h1_on_str, .on_header = h1_on_header,
+        .on_body_chunk = h1_on_str, .on_error = h1_on_error);
+    pos += consumed;
+    if ((!consumed || pos == visible) && !parser_reveal(&visible, len, step))
+      break;
+  }
+  return (parser_errors ? -1 : (ssize_t)parser_messages);
+}
+
+static ssize_t parse_websocket(char *data, size_t len, size_t step) {
+  parser_messages = parser_errors = 0;
+  if (!step || step >= len) {
+    websocket_consume(data, len, NULL, 1);
+  } else {
+    /* `websocket_consume` moves leftover data to the head of the buffer */
+    char *buf = malloc(len + 1);
+    size_t buf_len = 0;
+    if (!buf)
+      return -1;
+    for (size_t pos = 0; pos < len && !parser_errors; pos += step) {
+      const size_t read = (len - pos < step ? len - pos : step);
+      memcpy(buf + buf_len, data + pos, read);
+      buf_len = websocket_consume(buf, buf_len + read, NULL, 1);
+    }
+    free(buf);
+  }
+  return (parser_errors ? -1 : (ssize_t)parser_messages);
+}
+
+static ssize_t parse_resp(char *data, size_t len, size_t step) {
+  resp_parser_s parser = {.obj_countdown = 0};
+  size_t pos = 0;
+  size_t visible = (step ? (step < len ? step : len) : len);
+  parser_messages = parser_errors = 0;
+  while (!parser_errors) {
+    /* the returned value is the number of bytes to be resent */
+    const size_t resend = resp_parse(&parser, data + pos, visible - pos);
+    pos = visible - resend;
+    if (!parser_reveal(&visible, len, step))
+      break;
+  }
+  return (parser_errors ? -1 : (ssize_t)parser_messages);
+}
+
+static ssize_t parse_json(char *data, size_t len, size_t step) {
+  json_parser_s parser = {.dict = 0};
+  size_t pos = 0;
+  size_t visible = (step ? (step < len ? step : len) : len);
+  parser_messages = parser_errors = 0;
+  while (!parser_errors) {
+    const size_t consumed = fio_json_parse(&parser, data + pos, visible - pos);
+    pos += consumed;
+    if ((!consumed || pos == visible) && !parser_reveal(&visible, len, step))
+      break;
+  }
+  return (parser_errors ? -1 : (ssize_t)parser_messages);
+}
+
+static ssize_t parse_mime(char *data, size_t len, size_t step) {
+  http_mime_parser_s parser;
+  char content_type[sizeof(mime_content_type)];
+  memcpy(content_type, mime_content_type, sizeof(content_type));
+  parser_messages = parser_errors = 0;
+  if (http_mime_parser_init(&parser, content_type, sizeof(content_type) - 1))
+    return -1;
+  size_t pos = 0;
+  size_t visible = (step ? (step < len ? step : len) : len);
+  while (!parser.done && !parser.error) {
+    const size_t consumed = http_mime_parse(&parser, data + pos, visible - pos);
+    pos += consumed;
+    if ((!consumed || pos == visible) && !parser_reveal(&visible, len, step))
+      break;
+  }
+  return (parser.error ? -1 : (ssize_t)parser_messages);
+}
+
+typedef struct {
+  const char *name;
+  ssize_t (*parse)(char *data, size_t len, size_t step);
+} parser_s;
+
+static const parser_s parsers[] = {
+    {.name = "http1", .parse = parse_http1},
+    {.name = "websocket", .parse = parse_websocket},
+    {.name = "resp", .parse = parse_resp},
+    {.name = "json", .parse = parse_json},
+    {.name = "mime", .parse = parse_mime},
+};
+
+#define PARSER_COUNT (sizeof(parsers) / sizeof(parsers[0]))
+
+/* *****************************************************************************
+libFuzzer entry point
+***************************************************************************** */
+
+/**
+ * The first byte selects the parser, the second byte selects the read size
+ * (0 == the whole input at once).
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (size < 2)
+    return 0;
+  const parser_s *parser = parsers + (data[0] % PARSER_COUNT);
+  const size_t step = data[1];
+  size -= 2;
+  /* parsers expect a NUL byte after the data and might edit the data */
+  char *copy = malloc(size + 1);
+  if (!copy)
+    return 0;
+  memcpy(copy, data + 2, size);
+  copy[size] = 0;
+  parser->parse(copy, size, step);
+  free(copy);
+  return 0;
+}
+
+#ifndef PARSER_FUZZ
+/* *****************************************************************************
+Corpora
+***************************************************************************** */
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t capa;
+} corpus_buf_s;
+
+static void corpus_write(corpus_buf_s *b, const void *data, size_t len) {
+  if (b->len + len + 1 > b->capa) {
+    b->capa = (b->len + len + 1) << 1;
+    b->data = realloc(b->data, b->capa);
+    FIO_ASSERT_ALLOC(b->data);
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+  b->data[b->len] = 0;
+}
+
+static void corpus_printf(corpus_buf_s *b, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+static void corpus_printf(corpus_buf_s *b, const char *format, ...) {
+  char tmp[1024];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(tmp, sizeof(tmp), format, args);
+  va_end(args);
+  if (len > 0)
+    corpus_write(b, tmp, ((size_t)len < sizeof(tmp) ? (size_t)len
+                                                    : sizeof(tmp) - 1));
+}
+
+/* writes `len` pseudo random printable bytes */
+static void corpus_fill(corpus_buf_s *b, size_t len) {
+  static const char chars[] = "abcdefghijklmnopqrstuvwxyz"
+                              "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 _-.";
+  char tmp[256];
+  while (len) {
+    size_t n = (len > sizeof(tmp) ? sizeof(tmp) : len);
+    for (size_t i = 0; i < n; ++i)
+      tmp[i] = chars[fio_rand64() % (sizeof(chars) - 1)];
+    corpus_write(b, tmp, n);
+    len -= n;
+  }
+}
+
+/* writes a (masked) WebSocket frame */
+static void corpus_ws_frame(corpus_buf_s *b, uint8_t opcode, uint8_t fin,
+                            size_t len) {
+  uint8_t head[14];
+  size_t head_len = 2;
+  head[0] = (uint8_t)((fin ? 128 : 0) | opcode);
+  if (len < 126) {
+    head[1] = (uint8_t)(128 | len);
+  } else if (len < 65536) {
+    head[1] = 128 | 126;
+    head[2] = (uint8_t)(len >> 8);
+    head[3] = (uint8_t)len;
+    head_len = 4;
+  } else {
+    head[1] = 128 | 127;
+    for (size_t i = 0; i < 8; ++i)
+      head[2 + i] = (uint8_t)(len >> ((7 - i) << 3));
+    head_len = 10;
+  }
+  const uint32_t mask = (uint32_t)fio_rand64() | 0x01010101;
+  memcpy(head + head_len, &mask, 4);
+  head_len += 4;
+  corpus_write(b, head, head_len);
+  const size_t start = b->len;
+  corpus_fill(b, len);
+  websocket_xmask(b->data + start, len, mask);
+}
+
+static void corpus_browser_headers(corpus_buf_s *b) {
+  static const char *paths[] = {"/", "/assets/app.js?v=1.2.3",
+                                "/api/v1/users/42?fields=name,email",
+                                "/images/logo.png", "/favicon.ico"};
+  for (size_t i = 0; i < 256; ++i) {
+    corpus_printf(
+        b,
+        "GET %s HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", "
+        "\"Not=A?Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "sec-ch-ua-platform: \"macOS\"\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) "
+        "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 "
+        "Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+        "image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-User: ?1\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Referer: https://www.example.com/articles/%zu\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: en-US,en;q=0.9,he;q=0.8\r\n"
+        "If-None-Match: W/\"%zx-1a2b3c4d\"\r\n"
+        "Cookie: _ga=GA1.2.1234567890.1690000000; session=",
+        paths[i % (sizeof(paths) / sizeof(paths[0]))], i, i);
+    corpus_fill(b, 96 + (i & 63));
+    corpus_printf(b, "; theme=dark; consent=1\r\n\r\n");
+  }
+}
+
+static void corpus_chunked_body(corpus_buf_s *b) {
+  for (size_t i = 0; i < 16; ++i) {
+    corpus_printf(b, "POST /upload HTTP/1.1\r\n"
+                     "Host: www.example.com\r\n"
+                     "Content-Type: application/octet-stream\r\n"
+                     "Transfer-Encoding: chunked\r\n\r\n");
+    for (size_t c = 0; c < 16; ++c) {
+      corpus_printf(b, "1000\r\n");
+      corpus_fill(b, 4096);
+      corpus_printf(b, "\r\n");
+    }
+    corpus_printf(b, "0\r\n\r\n");
+  }
+}
+
+static void corpus_ws_fragmented(corpus_buf_s *b) {
+  for (size_t i = 0; i < 256; ++i) {
+    /* a 4Kb message in 16 fragments, with a ping in the middle */
+    for (size_t f = 0; f < 16; ++f) {
+      corpus_ws_frame(b, (f ? 0 : 2), (f == 15), 256);
+      if (f == 7)
+        corpus_ws_frame(b, 9, 1, 8);
+    }
+  }
+}
+
+static void corpus_ws_small(corpus_buf_s *b) {
+  for (size_t i = 0; i < 8192; ++i)
+    corpus_ws_frame(b, 1, 1, 16 + (i & 127));
+}
+
+static void corpus_resp_pubsub(corpus_buf_s *b) {
+  for (size_t i = 0; i < 64; ++i)
+    corpus_printf(b,
+                  "*3\r\n$9\r\nsubscribe\r\n$12\r\nchannel:%04zu\r\n"
+                  ":%zu\r\n",
+                  i, i + 1);
+  for (size_t i = 0; i < 8192; ++i) {
+    const size_t len = 32 + (i & 255);
+    corpus_printf(b, "*3\r\n$7\r\nmessage\r\n$12\r\nchannel:%04zu\r\n$%zu\r\n",
+                  i & 63, len);
+    corpus_fill(b, len);
+    corpus_printf(b, "\r\n");
+  }
+}
+
+static void corpus_json_object(corpus_buf_s *b, size_t i, size_t depth) {
+  corpus_printf(b,
+                "{\"id\":%zu,\"name\":\"item \\\"%zu\\\"\\n\\u00e9\","
+                "\"price\":%zu.%02zu,\"active\":%s,\"parent\":null,"
+                "\"tags\":[\"a\",\"b\",\"c\",%zu,%zu.5e3]",
+                i, i, i, i % 100, (i & 1 ? "true" : "false"), i, i);
+  if (depth) {
+    corpus_printf(b, ",\"children\":[");
+    for (size_t c = 0; c < 2; ++c) {
+      if (c)
+        corpus_printf(b, ",");
+      corpus_json_object(b, i * 2 + c, depth - 1);
+    }
+    corpus_printf(b, "]");
+  }
+  corpus_printf(b, "}");
+}
+
+static void corpus_json_nested(corpus_buf_s *b) {
+  corpus_printf(b, "{\"data\":[");
+  for (size_t i = 0; i < 64; ++i) {
+    if (i)
+      corpus_printf(b, ",\n  ");
+    corpus_json_object(b, i, 4);
+  }
+  corpus_printf(b, "],\"count\":64}");
+}
+
+static void corpus_json_stream(corpus_buf_s *b) {
+  for (size_t i = 0; i < 4096; ++i) {
+    corpus_json_object(b, i, 0);
+    corpus_printf(b, "\n");
+  }
+}
+
+static void corpus_mime_form(corpus_buf_s *b) {
+  const char *boundary = strchr(mime_content_type, '=') + 1;
+  for (size_t i = 0; i < 64; ++i) {
+    corpus_printf(b,
+                  "--%s\r\nContent-Disposition: form-data; name=\"field%zu\""
+                  "\r\n\r\n",
+                  boundary, i);
+    corpus_fill(b, 16 + (i & 63));
+    corpus_printf(b, "\r\n");
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    corpus_printf(b,
+                  "--%s\r\nContent-Disposition: form-data; name=\"file%zu\"; "
+                  "filename=\"photo%zu.jpg\"\r\nContent-Type: image/jpeg"
+                  "\r\n\r\n",
+                  boundary, i, i);
+    corpus_fill(b, 65536);
+    corpus_printf(b, "\r\n");
+  }
+  corpus_printf(b, "--%s--\r\n", boundary);
+}
+
+typedef struct {
+  size_t parser; /* index in `parsers` */
+  const char *name;
+  void (*generate)(corpus_buf_s *b);
+  size_t messages; /* the expected number of messages */
+} corpus_s;
+
+static const corpus_s corpora[] = {
+    {0, "browser-headers", corpus_browser_headers, 256},
+    {0, "chunked-body", corpus_chunked_body, 16},
+    {1, "fragmented", corpus_ws_fragmented, 256},
+    {1, "small-text", corpus_ws_small, 8192},
+    {2, "pubsub", corpus_resp_pubsub, 64 + 8192},
+    {3, "nested", corpus_json_nested, 1},
+    {3, "ndjson", corpus_json_stream, 4096},
+    {4, "form-data", corpus_mime_form, 68},
+};
+
+/* *****************************************************************************
+Benchmarking
+***************************************************************************** */
+
+static inline uint64_t bench_time_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000000) + (uint64_t)t.tv_nsec;
+}
+
+static void bench_corpus(const corpus_s *c, corpus_buf_s *b,
+                         uint64_t duration_ns) {
+  const parser_s *parser = parsers + c->parser;
+  /* a warm up run (also tests the streaming code paths) */
+  const ssize_t messages = parser->parse(b->data, b->len, 0);
+  const ssize_t streamed = parser->parse(b->data, b->len, 1460);
+  size_t passes = 0;
+  const uint64_t start = bench_time_ns();
+  const uint64_t start_cycles = PARSER_BENCH_CYCLES();
+  uint64_t end;
+  do {
+    parser->parse(b->data, b->len, 0);
+    ++passes;
+    end = bench_time_ns();
+  } while (end - start < duration_ns);
+  const uint64_t cycles = PARSER_BENCH_CYCLES() - start_cycles;
+  const double bytes = (double)b->len * passes;
+  const double sec = (end - start) / 1000000000.0;
+  fprintf(stdout, "%-10s %-16s %10zu %10.1f %12.2f %10zd%s\n", parser->name,
+          c->name, b->len, bytes / sec / (1024.0 * 1024.0),
+          (cycles ? cycles / bytes : 0.0), messages,
+          ((size_t)messages == c->messages && streamed == messages
+               ? ""
+               : " (error)"));
+  fflush(stdout);
+}
+
+/* writes the corpora as a libFuzzer seed corpus */
+static int bench_write_corpus(const char *folder, const corpus_s *c,
+                              corpus_buf_s *b) {
+  char path[1024];
+  mkdir(folder, 0777);
+  for (uint8_t step = 0; step < 2; ++step) {
+    snprintf(path, sizeof(path), "%s/%s-%s%s", folder, parsers[c->parser].name,
+             c->name, (step ? "-streamed" : ""));
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+      perror(path);
+      return -1;
+    }
+    /* seeds are limited to 64Kb, so the fuzzer remains fast */
+    const uint8_t head[2] = {(uint8_t)c->parser, (uint8_t)(step ? 251 : 0)};
+    const size_t len = (b->len > 65536 ? 65536 : b->len);
+    fwrite(head, 1, 2, f);
+    fwrite(b->data, 1, len, f);
+    fclose(f);
+  }
+  return 0;
+}
+
+/* replays a fuzzer input (i.e., a crash reproducer) */
+static int bench_replay(const char *filename) {
+  FILE *f = fopen(filename, "rb");
+  if (!f) {
+    perror(filename);
+    return -1;
+  }
+  corpus_buf_s b = {.data = NULL};
+  char tmp[4096];
+  size_t len;
+  while ((len = fread(tmp, 1, sizeof(tmp), f)) > 0)
+    corpus_write(&b, tmp, len);
+  fclose(f);
+  if (b.len >= 2)
+    fprintf(stderr, "* replaying %zu bytes using the %s parser (step %u).\n",
+            b.len - 2, parsers[(uint8_t)b.data[0] % PARSER_COUNT].name,
+            (unsigned int)(uint8_t)b.data[1]);
+  LLVMFuzzerTestOneInput((uint8_t *)b.data, b.len);
+  fprintf(stderr, "* %zu messages, %zu errors.\n", parser_messages,
+          parser_errors);
+  free(b.data);
+  return 0;
+}
+
+int main(int argc, char const *argv[]) {
+  fio_cli_start(
+      argc, argv, 0, 0,
+      "A parser micro-benchmark (http1, websocket, resp, json, mime) and "
+      "fuzzing harness.",
+      FIO_CLI_STRING("-parser -p benchmark only the named parser."),
+      FIO_CLI_INT("-duration -d milliseconds to spend on each corpus."),
+      FIO_CLI_STRING("-write -w write the corpora to a (seed) folder."),
+      FIO_CLI_STRING("-replay -r replay a fuzzer input file."));
+  fio_cli_set_default("-d", "500");
+
+  if (fio_cli_get("-r")) {
+    int ret = bench_replay(fio_cli_get("-r"));
+    fio_cli_end();
+    return (ret ? 1 : 0);
+  }
+
+  const char *only = fio_cli_get("-p");
+  const char *folder = fio_cli_get("-w");
+  const uint64_t duration_ns = (uint64_t)fio_cli_get_i("-d") * 1000000;
+  int ret = 0;
+  if (!folder)
+    fprintf(stdout, "%-10s %-16s %10s %10s %12s %10s\n", "parser", "corpus",
+            "bytes", "MB/s", "cycles/byte", "messages");
+  for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); ++i) {
+    if (only && strcmp(only, parsers[corpora[i].parser].name))
+      continue;
+    corpus_buf_s b = {.data = NULL};
+    corpora[i].generate(&b);
+    if (folder)
+      ret |= bench_write_corpus(folder, corpora + i, &b);
+    else
+      bench_corpus(corpora + i, &b, duration_ns);
+    free(b.data);
+  }
+  fio_cli_end();
+  return (ret ? 1 : 0);
+}
+#endif /* PARSER_FUZZ */
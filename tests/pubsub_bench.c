@@ -0,0 +1,379 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+
+/* *****************************************************************************
+A pub/sub throughput and latency benchmark.
+
+Each run publishes a number of timestamped messages and measures the delivery
+rate and the publish-to-deliver latency for every subscription:
+
+* With a single worker, messages are published and delivered within the same
+  process (`FIO_PUBSUB_PROCESS`).
+
+* With multiple workers, the root process publishes (`FIO_PUBSUB_CLUSTER`) and
+  each worker subscribes, so every message crosses the cluster's IPC.
+
+When the `-w` argument is missing, the benchmark runs itself (in a new process
+per run) for a matrix of worker and subscription counts, for both exact channel
+matching and glob pattern matching.
+
+Run using:
+
+    make test/pubsub
+
+Or, with specific arguments:
+
+    make test/pubsub && ./tmp/fioapp -w 4 -s 100 -n 100000 -p
+***************************************************************************** */
+
+#include <fio.h>
+#include <fio_cli.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* *****************************************************************************
+Latency histogram (log-linear buckets, ~12.5% resolution)
+***************************************************************************** */
+
+#define BENCH_HIST_SIZE 512
+
+typedef struct {
+  uint64_t delivered;
+  uint64_t last_ns;
+  uint32_t hist[BENCH_HIST_SIZE];
+} bench_result_s;
+
+static inline size_t bench_hist_index(uint64_t ns) {
+  if (ns < 8)
+    return (size_t)ns;
+  size_t e = 63 - __builtin_clzll(ns);
+  return ((e - 2) << 3) | ((ns >> (e - 3)) & 7);
+}
+
+static inline uint64_t bench_hist_value(size_t index) {
+  if (index < 8)
+    return index;
+  return (uint64_t)(8 | (index & 7)) << ((index >> 3) - 1);
+}
+
+/* returns the latency (in nanoseconds) at the requested percentile */
+static uint64_t bench_hist_percentile(bench_result_s *r, double percentile) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < BENCH_HIST_SIZE; ++i)
+    total += r->hist[i];
+  if (!total)
+    return 0;
+  uint64_t target = (uint64_t)(total * percentile);
+  uint64_t count = 0;
+  for (size_t i = 0; i < BENCH_HIST_SIZE; ++i) {
+    count += r->hist[i];
+    if (count > target)
+      return bench_hist_value(i);
+  }
+  return bench_hist_value(BENCH_HIST_SIZE - 1);
+}
+
+static inline uint64_t bench_time_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000000) + (uint64_t)t.tv_nsec;
+}
+
+/* *****************************************************************************
+Benchmark state
+***************************************************************************** */
+
+static struct {
+  size_t workers;
+  size_t subscribers;
+  size_t messages;
+  size_t batch;
+  size_t length;
+  size_t decoys;
+  size_t timeout;
+  uint8_t pattern;
+  /* publisher state */
+  size_t published;
+  size_t ready;
+  size_t reported;
+  fio_lock_i lock;
+  uint64_t start_ns;
+  uint64_t publish_ns;
+  char *payload;
+  /* subscriber state (per process) */
+  bench_result_s local;
+  /* merged results (root process) */
+  bench_result_s total;
+} bench = {.lock = FIO_LOCK_INIT};
+
+static fio_str_info_s bench_channel = {.data = "bench.channel", .len = 13};
+static fio_str_info_s bench_pattern = {.data = "bench.*", .len = 7};
+static fio_str_info_s bench_ready_ch = {.data = "bench:ready", .len = 11};
+static fio_str_info_s bench_result_ch = {.data = "bench:result", .len = 12};
+
+static void bench_report(void) {
+  bench_result_s *r = (bench.workers > 1 ? &bench.total : &bench.local);
+  const uint64_t expected =
+      (uint64_t)bench.messages * bench.subscribers *
+      (bench.workers > 1 ? bench.workers : 1);
+  double publish_sec = (bench.publish_ns - bench.start_ns) / 1000000000.0;
+  double deliver_sec = (r->last_ns - bench.start_ns) / 1000000000.0;
+  if (publish_sec <= 0)
+    publish_sec = 0.000000001;
+  if (deliver_sec <= 0)
+    deliver_sec = 0.000000001;
+  fprintf(stdout,
+          "%-8s %7zu %11zu %10zu %14.0f %14.0f %10.1f %10.1f%s\n",
+          (bench.pattern ? "pattern" : "exact"), bench.workers,
+          bench.subscribers, bench.messages, bench.messages / publish_sec,
+          r->delivered / deliver_sec,
+          bench_hist_percentile(r, 0.50) / 1000.0,
+          bench_hist_percentile(r, 0.99) / 1000.0,
+          (r->delivered == expected ? "" : " (incomplete)"));
+  fflush(stdout);
+}
+
+/* *****************************************************************************
+Subscribers
+***************************************************************************** */
+
+static void bench_on_message(fio_msg_s *msg) {
+  const uint64_t now = bench_time_ns();
+  const uint64_t sent = fio_str2u64(msg->msg.data);
+  fio_atomic_add(&bench.local.hist[bench_hist_index(now - sent)], 1);
+  bench.local.last_ns = now; /* benign race, close enough */
+  if (fio_atomic_add(&bench.local.delivered, 1) !=
+      (uint64_t)bench.messages * bench.subscribers)
+    return;
+  if (bench.workers == 1) {
+    bench_report();
+    fio_stop();
+    return;
+  }
+  fio_publish(.engine = FIO_PUBSUB_ROOT, .channel = bench_result_ch,
+              .message = {.data = (char *)&bench.local,
+                          .len = sizeof(bench.local)});
+}
+
+static void bench_on_decoy(fio_msg_s *msg) { (void)msg; }
+
+static void bench_subscribe(void) {
+  char buf[64];
+  for (size_t i = 0; i < bench.decoys; ++i) {
+    /* decoys share the channel's prefix, but never match it */
+    fio_str_info_s decoy = {.data = buf};
+    decoy.len = (size_t)snprintf(buf, sizeof(buf), "bench.%zu.*", i);
+    fio_subscribe(.channel = decoy, .on_message = bench_on_decoy,
+                  .match = (bench.pattern ? FIO_MATCH_GLOB : NULL));
+  }
+  for (size_t i = 0; i < bench.subscribers; ++i) {
+    fio_subscribe(.channel = (bench.pattern ? bench_pattern : bench_channel),
+                  .on_message = bench_on_message,
+                  .match = (bench.pattern ? FIO_MATCH_GLOB : NULL));
+  }
+}
+
+/* *****************************************************************************
+Publisher
+***************************************************************************** */
+
+static void bench_publish_task(void *a1, void *a2) {
+  if (!fio_is_running())
+    return;
+  if (!bench.start_ns)
+    bench.start_ns = bench_time_ns();
+  for (size_t i = 0; i < bench.batch && bench.published < bench.messages;
+       ++i) {
+    fio_u2str64(bench.payload, bench_time_ns());
+    fio_publish(.engine = (bench.workers > 1 ? FIO_PUBSUB_CLUSTER
+                                             : FIO_PUBSUB_PROCESS),
+                .channel = bench_channel,
+                .message = {.data = bench.payload, .len = bench.length});
+    ++bench.published;
+  }
+  if (bench.published < bench.messages) {
+    fio_defer(bench_publish_task, a1, a2);
+    return;
+  }
+  bench.publish_ns = bench_time_ns();
+}
+
+/* the root process collects the workers' state */
+static void bench_on_ready(fio_msg_s *msg) {
+  if (fio_atomic_add(&bench.ready, 1) == bench.workers)
+    fio_defer(bench_publish_task, NULL, NULL);
+  (void)msg;
+}
+
+static void bench_on_result(fio_msg_s *msg) {
+  bench_result_s r;
+  if (msg->msg.len != sizeof(r))
+    return;
+  memcpy(&r, msg->msg.data, sizeof(r));
+  fio_lock(&bench.lock);
+  bench.total.delivered += r.delivered;
+  if (r.last_ns > bench.total.last_ns)
+    bench.total.last_ns = r.last_ns;
+  for (size_t i = 0; i < BENCH_HIST_SIZE; ++i)
+    bench.total.hist[i] += r.hist[i];
+  const size_t reported = ++bench.reported;
+  fio_unlock(&bench.lock);
+  if (reported != bench.workers)
+    return;
+  bench_report();
+  fio_stop();
+}
+
+/* the publishing process reports partial results if the run takes too long */
+static void bench_watchdog(void *ignr_) {
+  static size_t seconds = 0;
+  if (!fio_is_master() || ++seconds < bench.timeout)
+    return;
+  FIO_LOG_WARNING("(%d) benchmark timed out.", (int)getpid());
+  if (!bench.publish_ns)
+    bench.publish_ns = bench_time_ns();
+  bench_report();
+  fio_stop();
+  (void)ignr_;
+}
+
+/* called by the root process (before any worker is spawned) */
+static void bench_pre_start(void *ignr_) {
+  fio_run_every(1000, 0, bench_watchdog, NULL, NULL);
+  if (bench.workers == 1)
+    return;
+  fio_subscribe(.channel = bench_ready_ch, .on_message = bench_on_ready);
+  fio_subscribe(.channel = bench_result_ch, .on_message = bench_on_result);
+  (void)ignr_;
+}
+
+/* called by each worker process */
+static void bench_on_start(void *ignr_) {
+  bench_subscribe();
+  if (bench.workers == 1)
+    fio_defer(bench_publish_task, NULL, NULL);
+  else
+    fio_publish(.engine = FIO_PUBSUB_ROOT, .channel = bench_ready_ch);
+  (void)ignr_;
+}
+
+/* *****************************************************************************
+Running the benchmark matrix
+***************************************************************************** */
+
+static void bench_run_child(char const *exe, size_t workers,
+                            size_t subscribers, uint8_t pattern) {
+  char w[32], s[32], n[32], b[32], l[32], x[32], t[32], th[32];
+  snprintf(w, sizeof(w), "%zu", workers);
+  snprintf(s, sizeof(s), "%zu", subscribers);
+  snprintf(n, sizeof(n), "%zu", bench.messages);
+  snprintf(b, sizeof(b), "%zu", bench.batch);
+  snprintf(l, sizeof(l), "%zu", bench.length);
+  snprintf(x, sizeof(x), "%zu", bench.decoys);
+  snprintf(t, sizeof(t), "%zu", bench.timeout);
+  snprintf(th, sizeof(th), "%d", fio_cli_get_i("-t"));
+  char *argv[] = {(char *)exe, "-w", w,   "-s", s,  "-n", n,
+                  "-b",        b,  "-l", l,   "-x", x,  "-T", t,
+                  "-t",        th, "-q", (pattern ? "-p" : NULL), NULL};
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork failed");
+    return;
+  }
+  if (!pid) {
+    /* a new process group, as the cluster might signal the whole group */
+    setpgid(0, 0);
+    execv(exe, argv);
+    perror("execv failed");
+    exit(1);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+}
+
+static void bench_print_header(void) {
+  fprintf(stdout, "%-8s %7s %11s %10s %14s %14s %10s %10s\n", "match",
+          "workers", "subscribers", "messages", "published/s", "delivered/s",
+          "p50 (us)", "p99 (us)");
+  fflush(stdout);
+}
+
+int main(int argc, char const *argv[]) {
+  fio_cli_start(
+      argc, argv, 0, 0,
+      "A pub/sub throughput and latency benchmark. When the number of workers "
+      "is missing, a matrix of workers and subscribers is tested.",
+      FIO_CLI_INT("-workers -w the number of worker processes (1 = local)."),
+      FIO_CLI_INT("-threads -t the number of threads per process."),
+      FIO_CLI_INT("-subscribers -s the number of subscriptions per worker."),
+      FIO_CLI_INT("-messages -n the number of messages to publish."),
+      FIO_CLI_INT("-batch -b messages published per scheduled task."),
+      FIO_CLI_INT("-length -l the message length (minimum 8 bytes)."),
+      FIO_CLI_INT("-decoys -x non-matching subscriptions per worker."),
+      FIO_CLI_INT("-timeout -T seconds to wait before giving up."),
+      FIO_CLI_BOOL("-pattern -p subscribe using glob pattern matching."),
+      FIO_CLI_BOOL("-quiet -q don't print the table header."));
+  fio_cli_set_default("-t", "1");
+  fio_cli_set_default("-n", "100000");
+  fio_cli_set_default("-b", "64");
+  fio_cli_set_default("-l", "64");
+  fio_cli_set_default("-x", "0");
+  fio_cli_set_default("-T", "30");
+
+  bench.messages = fio_cli_get_i("-n");
+  bench.batch = fio_cli_get_i("-b");
+  bench.length = fio_cli_get_i("-l");
+  bench.decoys = fio_cli_get_i("-x");
+  bench.timeout = fio_cli_get_i("-T");
+  bench.pattern = fio_cli_get_bool("-p");
+  if (bench.length < 8)
+    bench.length = 8;
+  if (!bench.batch)
+    bench.batch = 1;
+
+  if (!fio_cli_get("-w")) {
+    /* run the benchmark matrix, a new process per run */
+    const size_t workers[] = {1, 2, 4};
+    const size_t subscribers[] = {1, 10, 100};
+    bench_print_header();
+    for (uint8_t pattern = 0; pattern < 2; ++pattern) {
+      for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); ++w) {
+        for (size_t s = 0; s < sizeof(subscribers) / sizeof(subscribers[0]);
+             ++s) {
+          bench_run_child(argv[0], workers[w], subscribers[s], pattern);
+        }
+      }
+    }
+    fio_cli_end();
+    return 0;
+  }
+
+  bench.workers = fio_cli_get_i("-w");
+  bench.subscribers = fio_cli_get_i("-s");
+  if (!bench.workers)
+    bench.workers = 1;
+  if (!bench.subscribers)
+    bench.subscribers = 1;
+  bench.payload = calloc(bench.length, 1);
+  FIO_ASSERT_ALLOC(bench.payload);
+  memset(bench.payload + 8, 'x', bench.length - 8);
+  if (!fio_cli_get_bool("-q"))
+    bench_print_header();
+
+  FIO_LOG_LEVEL = FIO_LOG_LEVEL_WARNING;
+  fio_state_callback_add(FIO_CALL_PRE_START, bench_pre_start, NULL);
+  fio_state_callback_add(FIO_CALL_ON_START, bench_on_start, NULL);
+  fio_start(.threads = fio_cli_get_i("-t"), .workers = (int)bench.workers);
+  free(bench.payload);
+  fio_cli_end();
+  return 0;
+}
@@ -2,6 +2,7 @@
 #include "tests/mustache.c.h"
 
 #include <fio.h>
+#include <fio_tls.h>
 #include <fiobj.h>
 #include <http.h>
 
@@ -11,6 +12,7 @@ void resp_test(void);
 
 int main(void) {
   fio_test();
+  fio_tls_test();
   mustache_test();
   fiobj_test();
   http_tests();
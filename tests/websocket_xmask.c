@@ -0,0 +1,180 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+
+/* *****************************************************************************
+A WebSocket (un)masking test and micro-benchmark.
+
+Every available `websocket_xmask` implementation (scalar, SSE2, AVX2, NEON) is
+compared byte-for-byte against the scalar implementation for all the lengths
+up to 512 bytes, at every memory offset (alignment) up to 32 bytes and for a
+number of random masks.
+
+The implementations are then benchmarked for a few message sizes.
+
+Run using:
+
+    make test/xmask
+***************************************************************************** */
+
+#include <fio.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <websocket_parser.h>
+
+/* the parser's callbacks (unused) */
+static void websocket_on_unwrapped(void *udata, void *msg, uint64_t len,
+                                   char first, char last, char text,
+                                   unsigned char rsv) {
+  (void)udata, (void)msg, (void)len, (void)first, (void)last, (void)text,
+      (void)rsv;
+}
+static void websocket_on_protocol_ping(void *udata, void *msg, uint64_t len) {
+  (void)udata, (void)msg, (void)len;
+}
+static void websocket_on_protocol_pong(void *udata, void *msg, uint64_t len) {
+  (void)udata, (void)msg, (void)len;
+}
+static void websocket_on_protocol_close(void *udata) { (void)udata; }
+static void websocket_on_protocol_error(void *udata) { (void)udata; }
+
+/* *****************************************************************************
+Implementations
+***************************************************************************** */
+
+typedef struct {
+  const char *name;
+  void (*xmask)(void *msg, uint64_t len, uint32_t mask);
+  int available;
+} xmask_impl_s;
+
+static xmask_impl_s impl[8];
+static size_t impl_count = 0;
+
+static void impl_add(const char *name,
+                     void (*xmask)(void *msg, uint64_t len, uint32_t mask),
+                     int available) {
+  impl[impl_count++] = (xmask_impl_s){
+      .name = name,
+      .xmask = xmask,
+      .available = available,
+  };
+}
+
+static void impl_init(void) {
+  impl_add("scalar", websocket_xmask_scalar, 1);
+#if WEBSOCKET_XMASK_SIMD && defined(__SSE2__)
+  impl_add("SSE2", websocket_xmask_sse2, 1);
+#endif
+#if WEBSOCKET_XMASK_SIMD && WEBSOCKET_XMASK_AVX2 == 1
+  impl_add("AVX2", websocket_xmask_avx2, 1);
+#elif WEBSOCKET_XMASK_SIMD && WEBSOCKET_XMASK_AVX2 == 2
+  impl_add("AVX2", websocket_xmask_avx2, __builtin_cpu_supports("avx2"));
+#endif
+#if WEBSOCKET_XMASK_SIMD && defined(__ARM_NEON)
+  impl_add("NEON", websocket_xmask_neon, 1);
+#endif
+  impl_add("dispatch", websocket_xmask, 1);
+}
+
+/* *****************************************************************************
+Correctness
+***************************************************************************** */
+
+#define TEST_MAX_LEN 512
+#define TEST_MAX_OFFSET 32
+
+static void xmask_test(void) {
+  static uint8_t src[TEST_MAX_LEN + TEST_MAX_OFFSET + 64];
+  static uint8_t expected[sizeof(src)];
+  static uint8_t result[sizeof(src)];
+  for (size_t i = 0; i < sizeof(src); ++i)
+    src[i] = (uint8_t)fio_rand64();
+  for (size_t m = 0; m < 16; ++m) {
+    const uint32_t mask = (m ? (uint32_t)fio_rand64() : 0x01020304UL);
+    for (size_t offset = 0; offset < TEST_MAX_OFFSET; ++offset) {
+      for (size_t len = 0; len <= TEST_MAX_LEN; ++len) {
+        memcpy(expected, src, sizeof(src));
+        websocket_xmask_scalar(expected + offset, len, mask);
+        for (size_t i = 1; i < impl_count; ++i) {
+          if (!impl[i].available)
+            continue;
+          memcpy(result, src, sizeof(src));
+          impl[i].xmask(result + offset, len, mask);
+          /* compares the whole buffer, so overflows are detected */
+          FIO_ASSERT(!memcmp(result, expected, sizeof(src)),
+                     "%s masking error (length %zu, offset %zu, mask %08x)",
+                     impl[i].name, len, offset, (unsigned int)mask);
+        }
+      }
+    }
+  }
+  /* masking twice restores the data */
+  memcpy(result, src, sizeof(src));
+  websocket_xmask(result + 3, TEST_MAX_LEN, 0xA5C3E10FUL);
+  websocket_xmask(result + 3, TEST_MAX_LEN, 0xA5C3E10FUL);
+  FIO_ASSERT(!memcmp(result, src, sizeof(src)),
+             "masking twice should restore the data");
+  fprintf(stderr, "* all implementations match the scalar implementation.\n");
+}
+
+/* *****************************************************************************
+Benchmark
+***************************************************************************** */
+
+static uint64_t bench_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000000ULL) + (uint64_t)t.tv_nsec;
+}
+
+static void xmask_bench(void) {
+  const size_t sizes[] = {64, 1024, 16384, 1048576};
+  const size_t total = (size_t)1 << 30; /* bytes per measurement */
+  uint8_t *buf = malloc(sizes[3] + 64);
+  FIO_ASSERT_ALLOC(buf);
+  memset(buf, 0x5A, sizes[3] + 64);
+  fprintf(stderr, "\n%-10s", "size");
+  for (size_t i = 0; i < impl_count; ++i)
+    fprintf(stderr, " %10s", impl[i].name);
+  fprintf(stderr, "\n");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    /* an odd offset, so the scalar implementation pays its alignment cost */
+    uint8_t *msg = buf + 1;
+    fprintf(stderr, "%-10zu", sizes[s]);
+    for (size_t i = 0; i < impl_count; ++i) {
+      if (!impl[i].available) {
+        fprintf(stderr, " %10s", "n/a");
+        continue;
+      }
+      const size_t rounds = total / sizes[s];
+      uint64_t start = bench_ns();
+      for (size_t r = 0; r < rounds; ++r) {
+        impl[i].xmask(msg, sizes[s], 0x12345678UL);
+        __asm__ volatile("" ::: "memory");
+      }
+      uint64_t ns = bench_ns() - start;
+      if (!ns)
+        ns = 1;
+      fprintf(stderr, " %6.2fGB/s", (double)(rounds * sizes[s]) / (double)ns);
+    }
+    fprintf(stderr, "\n");
+  }
+  free(buf);
+}
+
+int main(void) {
+  impl_init();
+  fprintf(stderr, "=== Testing WebSocket masking (%zu implementations)\n",
+          impl_count);
+  xmask_test();
+  xmask_bench();
+  return 0;
+}